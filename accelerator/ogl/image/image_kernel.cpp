@@ -151,6 +151,7 @@ struct image_kernel::impl
 		static const double epsilon = 0.001;
 
 		CASPAR_ASSERT(params.pix_desc.planes.size() == params.textures.size());
+		CASPAR_ASSERT(params.key_pix_desc.planes.size() == params.key_textures.size());
 
 		if(params.textures.empty() || !params.background)
 			return;
@@ -238,6 +239,9 @@ struct image_kernel::impl
 		for(int n = 0; n < params.textures.size(); ++n)
 			params.textures[n]->bind(n);
 
+		for(int n = 0; n < params.key_textures.size(); ++n)
+			params.key_textures[n]->bind(static_cast<int>(texture_id::key_plane0) + n);
+
 		if(params.local_key)
 			params.local_key->bind(static_cast<int>(texture_id::local_key));
 
@@ -258,12 +262,30 @@ struct image_kernel::impl
 						 static_cast<float>(params.textures[n]->width()),
 						 static_cast<float>(params.textures[n]->height()));
 
+		shader_->set("key_plane[0]",	texture_id::key_plane0);
+		shader_->set("key_plane[1]",	texture_id::key_plane1);
+		shader_->set("key_plane[2]",	texture_id::key_plane2);
+		shader_->set("key_plane[3]",	texture_id::key_plane3);
+
 		shader_->set("local_key",		texture_id::local_key);
 		shader_->set("layer_key",		texture_id::layer_key);
 		shader_->set("is_hd",		 	params.pix_desc.planes.at(0).height > 700 ? 1 : 0);
 		shader_->set("has_local_key",	static_cast<bool>(params.local_key));
 		shader_->set("has_layer_key",	static_cast<bool>(params.layer_key));
 		shader_->set("pixel_format",		params.pix_desc.format);
+		shader_->set("has_paired_key",	!params.key_textures.empty());
+
+		if (!params.key_textures.empty())
+		{
+			shader_->set("key_is_hd",			params.key_pix_desc.planes.at(0).height > 700 ? 1 : 0);
+			shader_->set("key_pixel_format",	params.key_pix_desc.format);
+
+			for (int n = 0; n < params.key_textures.size(); ++n)
+				shader_->set("key_plane_size[" + boost::lexical_cast<std::string>(n) + "]",
+							 static_cast<float>(params.key_textures[n]->width()),
+							 static_cast<float>(params.key_textures[n]->height()));
+		}
+
 		shader_->set("opacity",			params.transform.is_key ? 1.0 : params.transform.opacity);
 
 		if (params.transform.chroma.enable)
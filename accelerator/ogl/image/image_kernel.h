@@ -41,6 +41,8 @@ struct draw_params final
 {
 	core::pixel_format_desc						pix_desc		= core::pixel_format::invalid;
 	std::vector<spl::shared_ptr<class texture>>	textures;
+	core::pixel_format_desc						key_pix_desc	= core::pixel_format::invalid;	// Of a paired key, sampled like textures.
+	std::vector<spl::shared_ptr<class texture>>	key_textures;
 	core::image_transform						transform;
 	core::frame_geometry						geometry		= core::frame_geometry::get_default();
 	core::blend_mode							blend_mode		= core::blend_mode::normal;
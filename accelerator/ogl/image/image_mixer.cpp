@@ -40,6 +40,7 @@
 
 #include <GL/glew.h>
 
+#include <boost/range/algorithm/equal.hpp>
 #include <boost/range/algorithm_ext/erase.hpp>
 
 #include <algorithm>
@@ -49,12 +50,17 @@ namespace caspar { namespace accelerator { namespace ogl {
 
 typedef std::shared_future<std::shared_ptr<texture>> future_texture;
 
+struct layer;
+
 struct item
 {
 	core::pixel_format_desc		pix_desc	= core::pixel_format::invalid;
 	std::vector<future_texture>	textures;
+	core::pixel_format_desc		key_pix_desc	= core::pixel_format::invalid;
+	std::vector<future_texture>	key_textures;	// Of a paired key, sampled while drawing this item.
 	core::image_transform		transform;
 	core::frame_geometry		geometry	= core::frame_geometry::get_default();
+	std::shared_ptr<layer>		group;		// Drawn into a texture of its own first, which is then drawn like a frame.
 };
 
 struct layer
@@ -124,6 +130,25 @@ private:
 		}
 	}
 
+	void draw_group(spl::shared_ptr<texture>&		target_texture,
+					item&							item,
+					const core::video_format_desc&	format_desc,
+					core::field_mode				field_mode)
+	{
+		auto group_texture = ogl_->create_texture(target_texture->width(), target_texture->height(), 4, item.transform.use_mipmap);
+
+		// Copied, both fields of interlaced formats draw the same group.
+		draw(group_texture, std::vector<layer> { *item.group }, format_desc, field_mode);
+
+		std::promise<std::shared_ptr<texture>> drawn;
+		drawn.set_value(group_texture);
+
+		item.pix_desc	= core::pixel_format_desc(core::pixel_format::bgra);
+		item.pix_desc.planes.push_back(core::pixel_format_desc::plane(group_texture->width(), group_texture->height(), 4));
+		item.textures	= { drawn.get_future().share() };
+		item.group.reset();
+	}
+
 	void draw(spl::shared_ptr<texture>&			target_texture,
 			  layer								layer,
 			  std::shared_ptr<texture>&			layer_key_texture,
@@ -164,6 +189,14 @@ private:
 		if(layer.items.empty())
 			return;
 
+		for (auto& item : layer.items)
+		{
+			if (item.group)
+				draw_group(target_texture, item, format_desc, field_mode);
+		}
+
+		pair_keys(layer.items);
+
 		std::shared_ptr<texture> local_key_texture;
 		std::shared_ptr<texture> local_mix_texture;
 
@@ -188,6 +221,48 @@ private:
 		layer_key_texture = std::move(local_key_texture);
 	}
 
+	// A paired key is sampled by the draw of the fill after it, instead of being drawn into the
+	// local key texture first. A key after an unused key adds to it, so it is drawn as before.
+	static void pair_keys(std::vector<item>& items)
+	{
+		std::vector<item> paired;
+		bool pending_key = false;
+
+		for (auto it = items.begin(); it != items.end(); ++it)
+		{
+			auto next = it + 1;
+
+			if (!pending_key && next != items.end() && can_pair(*it, *next))
+			{
+				next->key_pix_desc	= std::move(it->pix_desc);
+				next->key_textures	= std::move(it->textures);
+				continue;
+			}
+
+			pending_key = it->transform.is_key;
+			paired.push_back(std::move(*it));
+		}
+
+		items = std::move(paired);
+	}
+
+	static bool can_pair(const item& key, const item& fill)
+	{
+		if (!key.transform.is_key || !key.transform.is_paired_key || fill.transform.is_key)
+			return false;
+
+		if (key.group || fill.group || !fill.key_textures.empty())
+			return false;
+
+		auto key_transform			= key.transform;
+		key_transform.is_key		= false;
+		key_transform.is_paired_key	= false;
+
+		return key_transform == fill.transform
+			&& key.geometry.type() == fill.geometry.type()
+			&& boost::equal(key.geometry.data(), fill.geometry.data());
+	}
+
 	void draw(spl::shared_ptr<texture>& target_texture,
 			  item item,
 		      std::shared_ptr<texture>& layer_key_texture,
@@ -204,6 +279,11 @@ private:
 		for (auto& future_texture : item.textures)
 			draw_params.textures.push_back(spl::make_shared_ptr(future_texture.get()));
 
+		draw_params.key_pix_desc	= std::move(item.key_pix_desc);
+
+		for (auto& future_texture : item.key_textures)
+			draw_params.key_textures.push_back(spl::make_shared_ptr(future_texture.get()));
+
 		if(item.transform.is_key)
 		{
 			local_key_texture = local_key_texture ? local_key_texture : ogl_->create_texture(target_texture->width(), target_texture->height(), 1, draw_params.transform.use_mipmap);
@@ -278,6 +358,13 @@ public:
 	{
 		auto previous_layer_depth = transform_stack_.back().layer_depth;
 		transform_stack_.push_back(transform_stack_.back() * transform.image_transform);
+
+		if (transform.image_transform.is_isolated && !draws_in_place(transform_stack_.back()))
+		{
+			push_group();
+			return;
+		}
+
 		auto new_layer_depth = transform_stack_.back().layer_depth;
 
 		if (previous_layer_depth < new_layer_depth)
@@ -298,6 +385,40 @@ public:
 
 	}
 
+	// Frames in an isolated group may overlap, blending them one by one looks the same as
+	// blending the group as a whole only when nothing but their position and size changes.
+	static bool draws_in_place(const core::image_transform& transform)
+	{
+		core::image_transform in_place;
+		in_place.fill_translation	= transform.fill_translation;
+		in_place.fill_scale			= transform.fill_scale;
+		in_place.clip_translation	= transform.clip_translation;
+		in_place.clip_scale			= transform.clip_scale;
+		in_place.field_mode			= transform.field_mode;
+		in_place.use_mipmap			= transform.use_mipmap;
+		in_place.layer_depth		= transform.layer_depth;
+		in_place.is_isolated		= transform.is_isolated;
+
+		return transform == in_place;
+	}
+
+	// The group becomes an item with the transform so far. Its contents are collected in a
+	// layer of their own, starting over from an untransformed full screen image.
+	void push_group()
+	{
+		auto& group_transform = transform_stack_.back();
+
+		item item;
+		item.transform	= group_transform;
+		item.group		= std::make_shared<layer>(core::blend_mode::normal);
+		layer_stack_.back()->items.push_back(item);
+		layer_stack_.push_back(item.group.get());
+
+		core::image_transform contents;
+		contents.layer_depth = group_transform.layer_depth + 1;
+		group_transform = contents;
+	}
+
 	void visit(const core::const_frame& frame)
 	{
 		if(frame.pixel_format_desc().format == core::pixel_format::invalid)
@@ -174,15 +174,20 @@ std::string get_fragment(bool blend_modes, bool post_processing)
 			uniform sampler2D	background;
 			uniform sampler2D	plane[4];
 			uniform vec2		plane_size[4];
+			uniform sampler2D	key_plane[4];
+			uniform vec2		key_plane_size[4];
 			uniform sampler2D	local_key;
 			uniform sampler2D	layer_key;
 
 			uniform bool		is_hd;
 			uniform bool		has_local_key;
 			uniform bool		has_layer_key;
+			uniform bool		has_paired_key;
+			uniform bool		key_is_hd;
 			uniform int			blend_mode;
 			uniform int			keyer;
 			uniform int			pixel_format;
+			uniform int			key_pixel_format;
 			uniform int			deinterlace;
 
 			uniform float		opacity;
@@ -244,9 +249,9 @@ std::string get_fragment(bool blend_modes, bool post_processing)
 				return rgba;
 			}
 
-			vec4 ycbcra_to_rgba(float y, float cb, float cr, float a)
+			vec4 ycbcra_to_rgba(bool hd, float y, float cb, float cr, float a)
 			{
-				if(is_hd)
+				if(hd)
 					return ycbcra_to_rgba_hd(y, cb, cr, a);
 				else
 					return ycbcra_to_rgba_sd(y, cb, cr, a);
@@ -265,48 +270,61 @@ std::string get_fragment(bool blend_modes, bool post_processing)
 				}
 			}
 
-			vec4 get_rgba_color()
+			vec4 get_rgba_color(int format, bool hd, sampler2D plane0, sampler2D plane1, sampler2D plane2, sampler2D plane3, vec2 coords, vec2 size)
 			{
-				switch(pixel_format)
+				switch(format)
 				{
 				case 0:		//gray
-					return vec4(get_sample(plane[0], gl_TexCoord[0].st / gl_TexCoord[0].q, plane_size[0]).rrr, 1.0);
+					return vec4(get_sample(plane0, coords, size).rrr, 1.0);
 				case 1:		//bgra,
-					return get_sample(plane[0], gl_TexCoord[0].st / gl_TexCoord[0].q, plane_size[0]).bgra;
+					return get_sample(plane0, coords, size).bgra;
 				case 2:		//rgba,
-					return get_sample(plane[0], gl_TexCoord[0].st / gl_TexCoord[0].q, plane_size[0]).rgba;
+					return get_sample(plane0, coords, size).rgba;
 				case 3:		//argb,
-					return get_sample(plane[0], gl_TexCoord[0].st / gl_TexCoord[0].q, plane_size[0]).argb;
+					return get_sample(plane0, coords, size).argb;
 				case 4:		//abgr,
-					return get_sample(plane[0], gl_TexCoord[0].st / gl_TexCoord[0].q, plane_size[0]).gbar;
+					return get_sample(plane0, coords, size).gbar;
 				case 5:		//ycbcr,
 					{
-						float y  = get_sample(plane[0], gl_TexCoord[0].st / gl_TexCoord[0].q, plane_size[0]).r;
-						float cb = get_sample(plane[1], gl_TexCoord[0].st / gl_TexCoord[0].q, plane_size[0]).r;
-						float cr = get_sample(plane[2], gl_TexCoord[0].st / gl_TexCoord[0].q, plane_size[0]).r;
-						return ycbcra_to_rgba(y, cb, cr, 1.0);
+						float y  = get_sample(plane0, coords, size).r;
+						float cb = get_sample(plane1, coords, size).r;
+						float cr = get_sample(plane2, coords, size).r;
+						return ycbcra_to_rgba(hd, y, cb, cr, 1.0);
 					}
 				case 6:		//ycbcra
 					{
-						float y  = get_sample(plane[0], gl_TexCoord[0].st / gl_TexCoord[0].q, plane_size[0]).r;
-						float cb = get_sample(plane[1], gl_TexCoord[0].st / gl_TexCoord[0].q, plane_size[0]).r;
-						float cr = get_sample(plane[2], gl_TexCoord[0].st / gl_TexCoord[0].q, plane_size[0]).r;
-						float a  = get_sample(plane[3], gl_TexCoord[0].st / gl_TexCoord[0].q, plane_size[0]).r;
-						return ycbcra_to_rgba(y, cb, cr, a);
+						float y  = get_sample(plane0, coords, size).r;
+						float cb = get_sample(plane1, coords, size).r;
+						float cr = get_sample(plane2, coords, size).r;
+						float a  = get_sample(plane3, coords, size).r;
+						return ycbcra_to_rgba(hd, y, cb, cr, a);
 					}
 				case 7:		//luma
 					{
-						vec3 y3 = get_sample(plane[0], gl_TexCoord[0].st / gl_TexCoord[0].q, plane_size[0]).rrr;
+						vec3 y3 = get_sample(plane0, coords, size).rrr;
 						return vec4((y3-0.065)/0.859, 1.0);
 					}
 				case 8:		//bgr,
-					return vec4(get_sample(plane[0], gl_TexCoord[0].st / gl_TexCoord[0].q, plane_size[0]).bgr, 1.0);
+					return vec4(get_sample(plane0, coords, size).bgr, 1.0);
 				case 9:		//rgb,
-					return vec4(get_sample(plane[0], gl_TexCoord[0].st / gl_TexCoord[0].q, plane_size[0]).rgb, 1.0);
+					return vec4(get_sample(plane0, coords, size).rgb, 1.0);
 				}
 				return vec4(0.0, 0.0, 0.0, 0.0);
 			}
 
+			// The value the key pass of the mask path would leave in local_key for this fragment.
+			float get_paired_key()
+			{
+				vec4 key = get_rgba_color(key_pixel_format, key_is_hd, key_plane[0], key_plane[1], key_plane[2], key_plane[3], gl_TexCoord[0].st / gl_TexCoord[0].q, key_plane_size[0]);
+				if (chroma)
+					key = chroma_key(key);
+				if(levels)
+					key.rgb = LevelsControl(key.rgb, min_input, gamma, max_input, min_output, max_output);
+				if(csb)
+					key.rgb = ContrastSaturationBrightness(key, brt, sat, con);
+				return clamp(key.b, 0.0, 1.0);
+			}
+
 			vec4 post_process()
 			{
 				vec4 color = texture2D(background, gl_TexCoord[0].st).bgra;
@@ -329,13 +347,15 @@ std::string get_fragment(bool blend_modes, bool post_processing)
 
 	R"shader(
 				{
-					vec4 color = get_rgba_color();
+					vec4 color = get_rgba_color(pixel_format, is_hd, plane[0], plane[1], plane[2], plane[3], gl_TexCoord[0].st / gl_TexCoord[0].q, plane_size[0]);
 					if (chroma)
 						color = chroma_key(color);
 					if(levels)
 						color.rgb = LevelsControl(color.rgb, min_input, gamma, max_input, min_output, max_output);
 					if(csb)
 						color.rgb = ContrastSaturationBrightness(color, brt, sat, con);
+					if(has_paired_key)
+						color *= get_paired_key();
 					if(has_local_key)
 						color *= texture2D(local_key, gl_TexCoord[1].st).r;
 					if(has_layer_key)
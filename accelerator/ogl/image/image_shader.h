@@ -36,7 +36,11 @@ enum class texture_id
 	plane3,
 	local_key,
 	layer_key,
-	background
+	background,
+	key_plane0,
+	key_plane1,
+	key_plane2,
+	key_plane3
 };
 
 std::shared_ptr<shader> get_image_shader(
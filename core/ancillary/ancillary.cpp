@@ -21,232 +21,341 @@
 
 #include "ancillary.h"
 
+#include <mutex>
+
+#include <smmintrin.h>
+
 namespace caspar { namespace core { namespace ancillary {
 
-	static std::vector<std::uint16_t> write_vanc_pkt_10bit(std::vector<std::uint8_t> const &inbuf, uint8_t did,uint8_t sdid)
+	//Parity (0x100) or inverse parity (0x200) bits for the 8 data bits of a 10 bit ancillary word
+	static const std::array<uint16_t, 256>& parity_table()
 	{
-		std::vector<std::uint16_t> outbuf = std::vector<std::uint16_t>();
-		outbuf.reserve(inbuf.size() + 7);//vanc header (3) + sdid + (1) + did (1) + count (1) + checksum (1) = 7;
-		outbuf.push_back(0x000);
-		outbuf.push_back(0x3ff);
-		outbuf.push_back(0x3ff);
-		outbuf.push_back(did);
-		outbuf.push_back(sdid);
-		outbuf.push_back(inbuf.size());
-		for (const auto& word : inbuf)
-			outbuf.push_back(word);
-		
-		uint16_t checksum = 0;
-		uint16_t *data = outbuf.data();
-		//set even parity & inverse bits + calculate checksum
-		for (int i= 3; i < outbuf.size(); i++)
+		static const std::array<uint16_t, 256> table = []
 		{
-			if (__builtin_parity(data[i]))
-				data[i] |= 0x100;
-			else
-				data[i] |= 0x200;
-			checksum += data[i];
-			checksum &= 0x1ff;
-		}
-		checksum |= (~checksum & 0x100) << 1;//set the inverse bit
-		outbuf.push_back(checksum);
-		return outbuf;
+			std::array<uint16_t, 256> t;
+			for (int i = 0; i < 256; i++)
+			{
+				int bits = 0;
+				for (int v = i; v != 0; v >>= 1)
+					bits ^= v & 1;
+				t[i] = bits ? 0x100 : 0x200;
+			}
+			return t;
+		}();
+		return table;
 	}
 
-	static void inline write_v210_pixel(uint32_t pixel, std::vector<std::uint32_t>&dst)
+	static inline uint16_t with_parity(uint16_t word)
 	{
-		dst.push_back(htole32(pixel));
+		auto bits = parity_table()[word & 0xff];
+		if (word >> 8)//only the data count of oversized packets
+			bits ^= __builtin_parity(word >> 8) ? 0x300 : 0;
+		return word | bits;
+	}
+
+	//Writes ADF, DID, SDID, data count, user data words and checksum, returns the number of samples written
+	static size_t write_vanc_pkt_10bit(std::vector<std::uint8_t> const &inbuf, uint8_t did, uint8_t sdid, uint16_t* dst)
+	{
+		dst[0] = 0x000;
+		dst[1] = 0x3ff;
+		dst[2] = 0x3ff;
+		dst[3] = with_parity(did);
+		dst[4] = with_parity(sdid);
+		dst[5] = with_parity(static_cast<uint16_t>(inbuf.size()));
+
+		auto& parity = parity_table();
+		uint16_t checksum = dst[3] + dst[4] + dst[5];
+		for (size_t i = 0; i < inbuf.size(); i++)
+		{
+			auto word = static_cast<uint16_t>(inbuf[i] | parity[inbuf[i]]);
+			dst[6 + i] = word;
+			checksum += word;
+		}
+		checksum &= 0x1ff;
+		checksum |= (~checksum & 0x100) << 1;//set the inverse bit
+		dst[6 + inbuf.size()] = checksum;
+		return inbuf.size() + 7;
 	}
 
-	static void pack_y10_to_v210(uint16_t *src, std::vector<uint32_t>& dst, int width)
+	//Y only VANC (HD): 6 luma samples per 4 words, chroma left at 0. Reads up to 2 samples past count.
+	static size_t pack_y10_to_v210(const uint16_t* src, uint32_t* dst, size_t count)
 	{
-		size_t len = width /6;//6 Y per 4 pixels
-		size_t w;
-		for (w = 0; w < len; w++)
+		const __m128i a_mask = _mm_setr_epi8(0, 1, -1, -1, 2, 3, -1, -1, 6, 7, -1, -1, 8, 9, -1, -1);
+		const __m128i b_mask = _mm_setr_epi8(-1, -1, -1, -1, 4, 5, -1, -1, -1, -1, -1, -1, 10, 11, -1, -1);
+		const __m128i a_shift = _mm_setr_epi32(1 << 10, 1, 1 << 10, 1);
+
+		size_t groups = count / 6;
+		for (size_t g = 0; g < groups; g++)
 		{
-			write_v210_pixel(src[w * 6 + 0] << 10, dst);// U0+1, Y0, V0+1
-			write_v210_pixel(src[w * 6 + 1] | (src[w * 6 + 2] << 20), dst);//Y1, U2+3, Y3
-			write_v210_pixel(src[w * 6 + 3] << 10, dst);// V2+3, Y4, U4+5
-			write_v210_pixel(src[w * 6 + 4] | (src[w * 6 + 5] << 20), dst);//Y4, V4+5, Y5
+			auto y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + g * 6));
+			auto a = _mm_mullo_epi32(_mm_shuffle_epi8(y, a_mask), a_shift);// Y0 << 10, Y1, Y3 << 10, Y4
+			auto b = _mm_slli_epi32(_mm_shuffle_epi8(y, b_mask), 20);// 0, Y2 << 20, 0, Y5 << 20
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + g * 4), _mm_or_si128(a, b));
 		}
-		size_t remaining = width % 6;
+
+		src += groups * 6;
+		dst += groups * 4;
+		size_t words = groups * 4;
+		size_t remaining = count % 6;
 		if (remaining)
 		{
-			write_v210_pixel(src[w * 6 + 0] << 10, dst);// U0+1, Y0, V0+1
-			if (remaining == 2)
-			{
-				write_v210_pixel(src[w * 6 + 1], dst);
-			} else if (remaining > 2)
-			{
-				write_v210_pixel(src[w * 6 + 1] | (src[w * 6 + 2] << 20),  dst);
-				if (remaining > 3)
-				{
-					write_v210_pixel(src[w * 6 + 3] << 10, dst);
-					if (remaining > 4)
-					{
-						write_v210_pixel(src[w * 6 + 4] | (src[w * 6 + 5] << 20), dst);
-					}
-				}
-			}
+			dst[0] = src[0] << 10;
+			dst[1] = remaining == 2 ? src[1] : src[1] | (src[2] << 20);
+			dst[2] = src[3] << 10;
+			dst[3] = src[4] | (src[5] << 20);
+			words += remaining < 2 ? 1 : remaining < 4 ? 2 : remaining < 5 ? 3 : 4;
 		}
+		return words;
 	}
 
-	static void pack_uyvy_to_v210(uint16_t *src, std::vector<uint32_t>& dst, int width)
+	//Interleaved VANC (SD): 3 samples per word, a partial last word is padded with black. Reads up to 4 samples past count.
+	static size_t pack_uyvy_to_v210(const uint16_t* src, uint32_t* dst, size_t count)
 	{
-		size_t len = width /12;//We fill all datapoints per block of 4 pixels
-		size_t w;
+		const __m128i s0_lo = _mm_setr_epi8(0, 1, -1, -1, 6, 7, -1, -1, 12, 13, -1, -1, -1, -1, -1, -1);
+		const __m128i s0_hi = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 3, -1, -1);
+		const __m128i s1_lo = _mm_setr_epi8(2, 3, -1, -1, 8, 9, -1, -1, 14, 15, -1, -1, -1, -1, -1, -1);
+		const __m128i s1_hi = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 4, 5, -1, -1);
+		const __m128i s2_lo = _mm_setr_epi8(4, 5, -1, -1, 10, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+		const __m128i s2_hi = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 0, 1, -1, -1, 6, 7, -1, -1);
 
-		uint32_t pixel = 0;
-		for (w = 0; w < len; w++)
+		size_t groups = count / 12;
+		for (size_t g = 0; g < groups; g++)
 		{
-			pixel = src[w * 12 + 0] | (src[w * 12 + 1] << 10) | (src[w * 12 + 2] << 20);
-			write_v210_pixel(pixel, dst);
-			pixel = src[w * 12 + 3] | (src[w * 12 + 4] << 10) | (src[w * 12 + 5] << 20);
-			write_v210_pixel(pixel, dst);
-			pixel = src[w * 12 + 6] | (src[w * 12 + 7] << 10) | (src[w * 12 + 8] << 20);
-			write_v210_pixel(pixel, dst);
-			pixel = src[w * 12 + 9] | (src[w * 12 + 10] << 10) | (src[w * 12 + 11] << 20);
-			write_v210_pixel(pixel, dst);
+			auto lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + g * 12));
+			auto hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + g * 12 + 8));
+			auto s0 = _mm_or_si128(_mm_shuffle_epi8(lo, s0_lo), _mm_shuffle_epi8(hi, s0_hi));
+			auto s1 = _mm_or_si128(_mm_shuffle_epi8(lo, s1_lo), _mm_shuffle_epi8(hi, s1_hi));
+			auto s2 = _mm_or_si128(_mm_shuffle_epi8(lo, s2_lo), _mm_shuffle_epi8(hi, s2_hi));
+			auto words = _mm_or_si128(s0, _mm_or_si128(_mm_slli_epi32(s1, 10), _mm_slli_epi32(s2, 20)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + g * 4), words);
 		}
 
-		size_t remaining = width % 12;
-		if (remaining)
+		size_t words = groups * 4;
+		for (size_t i = groups * 12; i < count; i += 3)
 		{
-
-			pixel = src[w * 12 + 0];
-			if (remaining > 1)
-				pixel |= (src[w * 12 + 1] << 10);
-			else
-				pixel |= (0x040 << 10);
-			if (remaining > 2)
-				pixel |= (src[w * 12 + 2] << 20);
-			else
-				pixel |= (0x200 << 20);
-			write_v210_pixel(pixel, dst);
-			if (remaining > 3)
-			{
-				pixel = src[w * 12 + 3];
-				if (remaining > 4)
-					pixel |= (src[w * 12 + 4] << 10);
-				else
-					pixel |= (0x040 << 10);
-				if (remaining > 5)
-					pixel |= (src[w * 12 + 5] << 20);
-				else
-					pixel |= (0x200 << 20);
-				write_v210_pixel(pixel, dst);
-				if (remaining > 6)
-				{
-					pixel = src[w * 12 + 6];
-					if (remaining > 7)
-						pixel |= (src[w * 12 + 7] << 10);
-					else
-						pixel |= (0x040 << 10);
-					if (remaining > 8)
-						pixel |= (src[w * 12 + 8] << 20);
-					else
-						pixel |= (0x200 << 20);
-					write_v210_pixel(pixel, dst);
-					if (remaining > 9)
-					{
-						pixel = src[w * 12 + 9];
-						if (remaining > 10)
-							pixel |= (src[w * 12 + 10] << 10);
-						else
-							pixel |= (0x040 << 10);
-						pixel |= (0x200 << 20);
-						write_v210_pixel(pixel, dst);
-					}
-				}
-			}
+			uint32_t pixel = src[i];
+			pixel |= (i + 1 < count ? src[i + 1] : 0x040) << 10;
+			pixel |= (i + 2 < count ? src[i + 2] : 0x200) << 20;
+			dst[words++] = pixel;
 		}
+		return words;
 	}
 
-	static std::vector<uint32_t> pack_vanc_v210(std::vector<uint16_t>&inbuf, int width)
+	//Appends one line of line_words words, the samples past what fits the line are dropped
+	static void pack_vanc_v210(uint16_t* samples, size_t count, AncillaryLines& lines)
 	{
-		std::vector<uint32_t> out_buf = std::vector<uint32_t>();
-		size_t allign_size = (width + 31) & ~31;//First next 128byte boundary, not sure if needed
-		out_buf.reserve(allign_size);
-		if (width > 720)
-			pack_y10_to_v210(inbuf.data(), out_buf, inbuf.size());
+		auto offset = lines.words.size();
+		lines.words.resize(offset + lines.line_words, 0);
+		auto dst = lines.words.data() + offset;
+		if (lines.width > 720)
+			pack_y10_to_v210(samples, dst, std::min(count, lines.line_words / 4 * 6));
 		else
-		pack_uyvy_to_v210(inbuf.data(), out_buf, inbuf.size());
-		out_buf.resize(allign_size, 0);
-		return out_buf;
+			pack_uyvy_to_v210(samples, dst, std::min(count, lines.line_words * 3));
+	}
+
+	VancLineAllocator::VancLineAllocator(uint32_t width)
+		: samples_per_line_(width > 720 ? (width / 4) * 6 : (width / 4) * 12)
+	{
+	}
+
+	size_t VancLineAllocator::peek(size_t size) const
+	{
+		//ADF (3), DID, SDID, data count and checksum surround the user data words
+		if (used_ == 0 || used_ + size + 7 >= samples_per_line_)
+			return lines_;
+		return lines_ - 1;
+	}
+
+	size_t VancLineAllocator::add(size_t size)
+	{
+		auto line = peek(size);
+		if (line == lines_)
+		{
+			used_ = 0;
+			lines_++;
+		}
+		used_ += size + 7;
+		return line;
+	}
+
+	RawAncillaryData::RawAncillaryData(uint8_t did, uint8_t sdid, std::vector<uint8_t> data)
+		: did_(did)
+		, sdid_(sdid)
+		, data_(std::move(data))
+	{
+	}
+
+	ancillary_data_type RawAncillaryData::getType() const
+	{
+		if (did_ == 0x41 && sdid_ == 0x07)
+			return ancillary_data_type_scte_104;
+		if (did_ == 0x61 && sdid_ == 0x01)
+			return ancillary_data_type_cea708;
+		return ancillary_data_type_other;
 	}
 
 	struct AncillaryContainer::impl : boost::noncopyable
 	{
 		std::vector<std::shared_ptr<AncillaryData>> ancillary_data_container;
+
+		//Packed lines are shared by the consumers of a frame, the container is not modified once it is sent
+		mutable std::mutex lines_mutex;
+		mutable std::shared_ptr<const AncillaryLines> cached_lines;
+		mutable ancillary_data_type cached_exclude = ancillary_data_none;
 		
 		public:
 			//default constructor
 			impl(){}
 
 			//copy contructor
-			impl(const impl& other) : ancillary_data_container(other.ancillary_data_container) {}
+			impl(const impl& other) : ancillary_data_container(other.ancillary_data_container)
+			{
+				std::lock_guard<std::mutex> lock(other.lines_mutex);
+				cached_lines = other.cached_lines;
+				cached_exclude = other.cached_exclude;
+			}
 
 			void addData(std::shared_ptr<AncillaryData> data)
 			{
+				invalidate();
 				ancillary_data_container.push_back(std::move(data));
 			}
 
+			std::vector<std::shared_ptr<AncillaryData>> takeData(ancillary_data_type type)
+			{
+				invalidate();
+				std::vector<std::shared_ptr<AncillaryData>> taken;
+				auto it = std::stable_partition(ancillary_data_container.begin(), ancillary_data_container.end(), [&](const std::shared_ptr<AncillaryData>& data)
+				{
+					return data->getType() != type;
+				});
+				std::move(it, ancillary_data_container.end(), std::back_inserter(taken));
+				ancillary_data_container.erase(it, ancillary_data_container.end());
+				return taken;
+			}
+
+			std::vector<std::shared_ptr<AncillaryData>> takeAll()
+			{
+				invalidate();
+				std::vector<std::shared_ptr<AncillaryData>> taken;
+				taken.swap(ancillary_data_container);
+				return taken;
+			}
+
 			void appendFrom(AncillaryContainer& other)
 			{
+				invalidate();
+				other.impl_->invalidate();
 				for (auto& data: other.impl_->ancillary_data_container)
 				{
 					ancillary_data_container.push_back(std::move(data));
 				}
+
+				other.impl_->ancillary_data_container.clear();
 			}
 
 			void clear()
 			{
+				invalidate();
 				ancillary_data_container.clear();
 			}
 
-			std::list<std::vector<uint32_t>> getAncillaryAsLines(uint32_t width, ancillary_data_type exclude) const
+			void getAncillaryAsPackets(std::vector<uint8_t>& buf, ancillary_data_type exclude) const
 			{
-				std::list<std::vector<uint32_t>> lines;
-				if (ancillary_data_container.empty())
-					return lines;
-				uint32_t pixels_remaining, pixels_per_line;
-				if (width > 720)
-					pixels_remaining = pixels_per_line = (width / 4) * 6;
-				else
-					pixels_remaining = pixels_per_line = (width / 4) * 12;
-				std::list<std::vector<uint16_t>> lines_data;
-				std::vector<uint16_t> line;
-				line.reserve(pixels_per_line);
 				for (auto& data : ancillary_data_container)
 				{
-					if ((data->getType() & exclude) == 0)
+					if ((data->getType() & exclude) != 0)
+						continue;
+
+					auto pkt_data = data->getData();
+					uint8_t did, sdid;
+					data->getVancID(did, sdid);
+					buf.push_back(did);
+					buf.push_back(sdid);
+					buf.push_back(static_cast<uint8_t>(pkt_data.size() >> 8));
+					buf.push_back(static_cast<uint8_t>(pkt_data.size() & 0xff));
+					buf.insert(buf.end(), pkt_data.begin(), pkt_data.end());
+				}
+			}
+
+			bool addPackets(const uint8_t* data, size_t size)
+			{
+				size_t offset = 0;
+				while (offset + 4 <= size)
+				{
+					uint8_t did = data[offset];
+					uint8_t sdid = data[offset + 1];
+					size_t pkt_size = (data[offset + 2] << 8) | data[offset + 3];
+					offset += 4;
+					if (offset + pkt_size > size)
+						return false;
+					addData(std::make_shared<RawAncillaryData>(did, sdid, std::vector<uint8_t>(data + offset, data + offset + pkt_size)));
+					offset += pkt_size;
+				}
+				return offset == size;
+			}
+
+			void packAncillaryLines(uint32_t width, AncillaryLines& lines, ancillary_data_type exclude) const
+			{
+				lines.width = width;
+				lines.line_words = (width + 31) & ~31;//First next 128byte boundary, not sure if needed
+				lines.words.clear();
+
+				VancLineAllocator allocator(width);
+				size_t samples_per_line = allocator.samplesPerLine();
+				size_t line = 0;
+				//The packers read up to padding samples past the end
+				static const size_t padding = 8;
+				thread_local std::vector<uint16_t> samples;
+
+				size_t used = 0;
+				auto flush = [&]
+				{
+					if (used == 0)
+						return;
+					std::fill_n(samples.begin() + used, padding, 0);
+					pack_vanc_v210(samples.data(), used, lines);
+					used = 0;
+				};
+
+				for (auto& data : ancillary_data_container)
+				{
+					if ((data->getType() & exclude) != 0)
+						continue;
+
+					auto pkt_data = data->getData();
+					auto index = allocator.add(pkt_data.size());
+					if (index != line)
 					{
-						auto pkt_data = data->getData();
-						uint8_t did, sdid;
-						data->getVancID(did, sdid);
-						auto vanc_pkt = write_vanc_pkt_10bit(pkt_data, did, sdid);
-						if (vanc_pkt.size() < pixels_remaining)
-						{
-							line.insert(line.end(), vanc_pkt.begin(), vanc_pkt.end());
-							pixels_remaining -= vanc_pkt.size();
-						} else
-						{
-							pixels_remaining = pixels_per_line;
-							lines_data.push_back(std::move(line));
-							line.clear();
-							line.reserve(pixels_per_line);
-							line.insert(line.end(), vanc_pkt.begin(), vanc_pkt.end());
-							pixels_remaining -= vanc_pkt.size();
-						}
+						flush();
+						line = index;
 					}
+					if (samples.size() < used + pkt_data.size() + 7 + padding)
+						samples.resize(std::max(samples_per_line, used + pkt_data.size() + 7) + padding);
+					uint8_t did, sdid;
+					data->getVancID(did, sdid);
+					used += write_vanc_pkt_10bit(pkt_data, did, sdid, samples.data() + used);
 				}
-				lines_data.push_back(std::move(line));
+				flush();
+			}
 
-				for (auto &line_data : lines_data)
+			std::shared_ptr<const AncillaryLines> getAncillaryAsLines(uint32_t width, ancillary_data_type exclude) const
+			{
+				std::lock_guard<std::mutex> lock(lines_mutex);
+				if (!cached_lines || cached_lines->width != width || cached_exclude != exclude)
 				{
-					lines.push_back(pack_vanc_v210(line_data, width));
+					auto lines = std::make_shared<AncillaryLines>();
+					packAncillaryLines(width, *lines, exclude);
+					cached_lines = std::move(lines);
+					cached_exclude = exclude;
 				}
-				return lines;
+				return cached_lines;
+			}
+
+			void invalidate()
+			{
+				std::lock_guard<std::mutex> lock(lines_mutex);
+				cached_lines.reset();
 			}
 
 	};
@@ -266,12 +375,24 @@ namespace caspar { namespace core { namespace ancillary {
 		impl_ = std::move(tmp);
 		return *this;
 	}
-    std::list<std::vector<uint32_t>> AncillaryContainer::getAncillaryAsLines(uint32_t width, ancillary_data_type exclude) const 
-	{ 
+	std::shared_ptr<const AncillaryLines> AncillaryContainer::getAncillaryAsLines(uint32_t width, ancillary_data_type exclude) const
+	{
 		return impl_->getAncillaryAsLines(width, exclude);
 	}
+	void AncillaryContainer::packAncillaryLines(uint32_t width, AncillaryLines& lines, ancillary_data_type exclude) const
+	{
+		impl_->packAncillaryLines(width, lines, exclude);
+	}
 
 	void AncillaryContainer::addData(std::shared_ptr<AncillaryData> data) {	return impl_->addData(data);}
+	std::vector<std::shared_ptr<AncillaryData>> AncillaryContainer::takeData(ancillary_data_type type) { return impl_->takeData(type); }
+	std::vector<std::shared_ptr<AncillaryData>> AncillaryContainer::takeAll() { return impl_->takeAll(); }
+	void AncillaryContainer::getAncillaryAsPackets(std::vector<uint8_t>& buf, ancillary_data_type exclude) const
+	{
+		impl_->getAncillaryAsPackets(buf, exclude);
+	}
+	bool AncillaryContainer::addPackets(const uint8_t* data, size_t size) { return impl_->addPackets(data, size); }
+	bool AncillaryContainer::empty() const { return impl_->ancillary_data_container.empty(); }
 	void AncillaryContainer::clear() { return impl_->clear(); }
 	void AncillaryContainer::appendFrom(AncillaryContainer& other) { return impl_->appendFrom( other ); }
 }}}
@@ -26,7 +26,9 @@ namespace caspar { namespace core { namespace ancillary {
 
 enum ancillary_data_type {
     ancillary_data_none = 0,
-    ancillary_data_type_scte_104 = 1
+    ancillary_data_type_scte_104 = 1,
+    ancillary_data_type_cea708 = 2,
+    ancillary_data_type_other = 0x80
 };
 
 class AncillaryData 
@@ -39,6 +41,55 @@ class AncillaryData
         virtual void getVancID(uint8_t& did, uint8_t& sdid)const = 0;
 };
 
+//Ancillary packet that is passed through without being parsed, e.g. when received from another process
+class RawAncillaryData : public AncillaryData
+{
+    public:
+        RawAncillaryData(uint8_t did, uint8_t sdid, std::vector<uint8_t> data);
+        std::vector<uint8_t> getData() const { return data_; }
+        ancillary_data_type getType() const;
+        void getVancID(uint8_t& did, uint8_t& sdid) const { did = did_; sdid = sdid_; }
+    private:
+        uint8_t did_;
+        uint8_t sdid_;
+        std::vector<uint8_t> data_;
+};
+
+//v210 VANC lines, stored back to back
+struct AncillaryLines
+{
+    uint32_t width = 0;
+    size_t line_words = 0;//32 bit words per line
+    std::vector<uint32_t> words;
+
+    size_t size() const { return line_words == 0 ? 0 : words.size() / line_words; }
+    const uint32_t* line(size_t index) const { return words.data() + index * line_words; }
+};
+
+//Assigns packets to VANC lines in the order packAncillaryLines packs them
+class VancLineAllocator final
+{
+    public:
+        explicit VancLineAllocator(uint32_t width);
+
+        //Returns the index of the line a packet with size user data words would be placed on
+        size_t peek(size_t size) const;
+
+        //Places a packet with size user data words, returns the index of its line
+        size_t add(size_t size);
+
+        //Number of lines used
+        size_t lines() const { return lines_; }
+
+        //10 bit samples that fit on a line of the width
+        size_t samplesPerLine() const { return samples_per_line_; }
+
+    private:
+        size_t samples_per_line_;
+        size_t used_ = 0;
+        size_t lines_ = 0;
+};
+
 class AncillaryContainer final
 {
     public:
@@ -51,9 +102,27 @@ class AncillaryContainer final
 
         void addData(std::shared_ptr<AncillaryData> data);
 
+        //Removes all ancillary data of type from the container and returns it
+        std::vector<std::shared_ptr<AncillaryData>> takeData(ancillary_data_type type);
+
+        //Removes all ancillary data from the container and returns it, in the order it was added
+        std::vector<std::shared_ptr<AncillaryData>> takeAll();
+
         //Concats all ancillary data into v210 anc lines
         //exclude: OR ancillary_data_types to exclude
-        std::list<std::vector<uint32_t>> getAncillaryAsLines(uint32_t width, ancillary_data_type exclude = ancillary_data_none) const;
+        //The result is kept until the container changes, so all consumers of a frame share it
+        std::shared_ptr<const AncillaryLines> getAncillaryAsLines(uint32_t width, ancillary_data_type exclude = ancillary_data_none) const;
+
+        //As getAncillaryAsLines but packs into lines, reusing its buffer
+        void packAncillaryLines(uint32_t width, AncillaryLines& lines, ancillary_data_type exclude = ancillary_data_none) const;
+
+        //Appends all ancillary data to buf as compact packets: did (1), sdid (1), size (2, big endian), data (size)
+        void getAncillaryAsPackets(std::vector<uint8_t>& buf, ancillary_data_type exclude = ancillary_data_none) const;
+
+        //Parses packets written by getAncillaryAsPackets, returns false if the buffer is truncated
+        bool addPackets(const uint8_t* data, size_t size);
+
+        bool empty() const;
 
         void clear();
         
@@ -0,0 +1,235 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ancillary_merger.h"
+
+#include <common/except.h>
+
+#include <core/video_format.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+
+#include <algorithm>
+#include <map>
+
+namespace caspar { namespace core { namespace ancillary {
+
+    merge_policy merge_policy_from_string(const std::wstring& str)
+    {
+        if (boost::iequals(str, L"keep-all"))
+            return merge_policy::keep_all;
+        if (boost::iequals(str, L"priority"))
+            return merge_policy::priority;
+        if (boost::iequals(str, L"newest"))
+            return merge_policy::newest;
+
+        CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"Invalid ancillary merge policy: " + str));
+    }
+
+    std::wstring to_string(merge_policy policy)
+    {
+        switch (policy)
+        {
+        case merge_policy::priority:
+            return L"priority";
+        case merge_policy::newest:
+            return L"newest";
+        default:
+            return L"keep-all";
+        }
+    }
+
+    size_t vanc_line_budget(const video_format_desc& format_desc)
+    {
+        bool interlaced = format_desc.field_mode != field_mode::progressive;
+
+        //From the line after the switching line + 2 (SMPTE RP 168) up to the first active line
+        switch (format_desc.height)
+        {
+        case 480:
+        case 486:
+            return 11 + 11;//10-20, 273-283
+        case 576:
+            return 16 + 16;//7-22, 320-335
+        case 720:
+            return 17;//9-25
+        case 1080:
+            return interlaced ? 12 + 13 : 33;//9-20, 571-583 or 9-41
+        default:
+            return 33;
+        }
+    }
+
+    static uint16_t merge_key(uint8_t did, uint8_t sdid)
+    {
+        return static_cast<uint16_t>((did << 8) | sdid);
+    }
+
+    struct AncillaryMerger::impl : boost::noncopyable
+    {
+        struct entry
+        {
+            int layer;
+            uint16_t key;
+            std::vector<uint8_t> payload;
+            std::shared_ptr<AncillaryData> data;
+        };
+
+        std::map<uint16_t, merge_policy> policies;
+        merge_policy default_policy = merge_policy::keep_all;
+
+        std::vector<entry> pending;
+        std::vector<const entry*> kept;
+
+        //Frame on which each layer started carrying a DID/SDID, for the newest policy
+        std::map<uint16_t, std::map<int, uint64_t>> onsets;
+        uint64_t frame = 0;
+
+        AncillaryMergeStats stats;
+
+        impl()
+        {
+            policies[merge_key(0x61, 0x01)] = merge_policy::priority;
+        }
+
+        merge_policy getPolicy(uint16_t key) const
+        {
+            auto it = policies.find(key);
+            return it == policies.end() ? default_policy : it->second;
+        }
+
+        void add(int layer, AncillaryContainer& ancillary)
+        {
+            for (auto& data : ancillary.takeAll())
+            {
+                uint8_t did, sdid;
+                data->getVancID(did, sdid);
+                pending.push_back(entry{ layer, merge_key(did, sdid), data->getData(), std::move(data) });
+            }
+        }
+
+        //Returns the layer whose packets are kept for each DID/SDID that is not merged with keep_all
+        std::map<uint16_t, int> select_layers()
+        {
+            std::map<uint16_t, std::map<int, uint64_t>> carried;
+            for (auto& e : pending)
+            {
+                if (getPolicy(e.key) == merge_policy::keep_all)
+                    continue;
+
+                auto& layers = carried[e.key];
+                if (layers.count(e.layer) != 0)
+                    continue;
+
+                //A layer that carried the DID/SDID on the previous frame keeps its onset
+                auto previous = onsets.find(e.key);
+                auto onset = frame;
+                if (previous != onsets.end())
+                {
+                    auto it = previous->second.find(e.layer);
+                    if (it != previous->second.end())
+                        onset = it->second;
+                }
+                layers[e.layer] = onset;
+            }
+
+            std::map<uint16_t, int> selected;
+            for (auto& layers : carried)
+            {
+                auto winner = layers.second.rbegin();
+                if (getPolicy(layers.first) == merge_policy::newest)
+                {
+                    for (auto it = layers.second.rbegin(); it != layers.second.rend(); ++it)
+                    {
+                        if (it->second > winner->second)
+                            winner = it;
+                    }
+                }
+                selected[layers.first] = winner->first;
+            }
+
+            onsets = std::move(carried);
+            return selected;
+        }
+
+        bool is_duplicate(const entry& e) const
+        {
+            return std::any_of(kept.begin(), kept.end(), [&](const entry* other)
+            {
+                return other->key == e.key && other->payload == e.payload;
+            });
+        }
+
+        void merge(const video_format_desc& format_desc, AncillaryContainer& out)
+        {
+            std::stable_sort(pending.begin(), pending.end(), [](const entry& a, const entry& b)
+            {
+                return a.layer < b.layer;
+            });
+
+            auto selected = select_layers();
+
+            kept.clear();
+            for (auto& e : pending)
+            {
+                auto it = selected.find(e.key);
+                if (it != selected.end() && it->second != e.layer)
+                    stats.conflicts++;
+                else if (is_duplicate(e))
+                    stats.duplicates++;
+                else
+                    kept.push_back(&e);
+            }
+
+            auto budget = vanc_line_budget(format_desc);
+            VancLineAllocator allocator(format_desc.width);
+            bool overflow = false;
+            for (auto e : kept)
+            {
+                if (allocator.peek(e->payload.size()) >= budget)
+                {
+                    stats.overflows++;
+                    overflow = true;
+                    continue;
+                }
+                allocator.add(e->payload.size());
+                out.addData(e->data);
+                stats.packets++;
+            }
+
+            if (overflow)
+                stats.overflow_frames++;
+            stats.lines = allocator.lines();
+
+            kept.clear();
+            pending.clear();
+            frame++;
+        }
+    };
+
+    AncillaryMerger::AncillaryMerger() : impl_(new impl) {}
+    AncillaryMerger::~AncillaryMerger() {}
+    void AncillaryMerger::setPolicy(uint8_t did, uint8_t sdid, merge_policy policy) { impl_->policies[merge_key(did, sdid)] = policy; }
+    void AncillaryMerger::setDefaultPolicy(merge_policy policy) { impl_->default_policy = policy; }
+    merge_policy AncillaryMerger::getPolicy(uint8_t did, uint8_t sdid) const { return impl_->getPolicy(merge_key(did, sdid)); }
+    void AncillaryMerger::add(int layer, AncillaryContainer& ancillary) { impl_->add(layer, ancillary); }
+    void AncillaryMerger::merge(const video_format_desc& format_desc, AncillaryContainer& out) { impl_->merge(format_desc, out); }
+    const AncillaryMergeStats& AncillaryMerger::stats() const { return impl_->stats; }
+
+}}}
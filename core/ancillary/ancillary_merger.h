@@ -0,0 +1,80 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "ancillary.h"
+
+#include <core/fwd.h>
+
+namespace caspar { namespace core { namespace ancillary {
+
+//How the packets of one DID/SDID are merged when several layers carry them
+enum class merge_policy
+{
+    keep_all,   //packets of all layers are kept
+    priority,   //only the packets of the highest layer are kept
+    newest      //only the packets of the layer that started carrying the DID/SDID last are kept
+};
+
+//Parses keep-all, priority or newest, throws user_error otherwise
+merge_policy merge_policy_from_string(const std::wstring& str);
+std::wstring to_string(merge_policy policy);
+
+//Number of VANC lines ancillary data can be inserted on in format_desc, for all fields together
+size_t vanc_line_budget(const video_format_desc& format_desc);
+
+struct AncillaryMergeStats
+{
+    uint64_t packets = 0;       //packets in merged frames
+    uint64_t duplicates = 0;    //identical packets that were dropped
+    uint64_t conflicts = 0;     //packets dropped by the priority or newest policies
+    uint64_t overflows = 0;     //packets dropped because the VANC lines of the format were full
+    uint64_t overflow_frames = 0;
+    size_t lines = 0;           //VANC lines used by the last merged frame
+};
+
+//Merges the ancillary data of the layers of a channel into the ancillary data of the output frame.
+//Identical packets are always sent once. CEA-708 captions default to the priority policy since an
+//output can only carry one caption stream, everything else defaults to keep_all.
+class AncillaryMerger final
+{
+    public:
+        AncillaryMerger();
+        ~AncillaryMerger();
+
+        void setPolicy(uint8_t did, uint8_t sdid, merge_policy policy);
+        void setDefaultPolicy(merge_policy policy);
+        merge_policy getPolicy(uint8_t did, uint8_t sdid) const;
+
+        //Moves the ancillary data of layer out of ancillary, layers may be added in any order
+        void add(int layer, AncillaryContainer& ancillary);
+
+        //Merges the layers added since the last call into out, in layer order, keeping within the VANC
+        //lines of format_desc. Packets that do not fit are dropped and counted as overflows.
+        void merge(const video_format_desc& format_desc, AncillaryContainer& out);
+
+        const AncillaryMergeStats& stats() const;
+
+    private:
+        struct impl;
+        spl::unique_ptr<impl> impl_;
+};
+
+}}}
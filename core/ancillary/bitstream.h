@@ -53,7 +53,7 @@ public:
     }
     void inline write_bits(uint64_t bits, uint64_t bitcount)
     {
-        for (uint64_t i = (bitcount -1); i >= 0; i--)
+        for (uint64_t i = bitcount; i-- > 0;)
         {
             write_bit(bits >> i);
         }
@@ -89,17 +89,88 @@ public:
         }
     }
 
-    void inline write_finalize()
+    //Pads with bit up to the next byte boundary
+    void inline write_align(uint_fast8_t bit)
     {
         while (scratch_used > 0)
         {
-            write_bit(0);
+            write_bit(bit);
         }
     }
 
+    void inline write_finalize()
+    {
+        write_align(0);
+    }
+
     private:
         std::vector<std::uint8_t>& buf;
         uint8_t scratch = 0;
         std::size_t scratch_used  = 0;
 };
 
+
+//Reads big endian bit fields, reads past the end return 0 and set overrun
+class BitstreamReader
+{
+public:
+    BitstreamReader(const std::uint8_t* data, std::size_t size) : data(data), size(size){}
+
+    uint64_t inline read_bits(std::size_t bitcount)
+    {
+        assert(bitcount <= 64);
+        uint64_t value = 0;
+        for (std::size_t i = 0; i < bitcount; i++)
+        {
+            if (bit_pos >= size * 8)
+            {
+                overrun = true;
+                value <<= 1;
+                continue;
+            }
+            value = (value << 1) | ((data[bit_pos / 8] >> (7 - bit_pos % 8)) & 1);
+            bit_pos++;
+        }
+        return value;
+    }
+
+    uint8_t inline read_byte()
+    {
+        return static_cast<uint8_t>(read_bits(8));
+    }
+
+    void inline skip_bytes(std::size_t count)
+    {
+        bit_pos += count * 8;
+        if (bit_pos > size * 8)
+        {
+            overrun = true;
+            bit_pos = size * 8;
+        }
+    }
+
+    void inline align()
+    {
+        skip_bits((8 - bit_pos % 8) % 8);
+    }
+
+    void inline skip_bits(std::size_t count)
+    {
+        bit_pos += count;
+        if (bit_pos > size * 8)
+        {
+            overrun = true;
+            bit_pos = size * 8;
+        }
+    }
+
+    std::size_t inline byte_pos() const { return bit_pos / 8; }
+    std::size_t inline bytes_left() const { return size - byte_pos(); }
+    bool inline has_overrun() const { return overrun; }
+
+    private:
+        const std::uint8_t* data;
+        std::size_t size;
+        std::size_t bit_pos = 0;
+        bool overrun = false;
+};
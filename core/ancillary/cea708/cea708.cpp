@@ -21,26 +21,328 @@
 
 #include "cea708.h"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 namespace caspar { namespace core { namespace ancillary {
 
+    static const uint16_t cdp_identifier = 0x9669;
+    static const uint8_t ccdata_section_id = 0x72;
+    static const uint8_t timecode_section_id = 0x71;
+    static const uint8_t svcinfo_section_id = 0x73;
+    static const uint8_t footer_section_id = 0x74;
+
+    struct cdp_framerate
+    {
+        boost::rational<int> framerate;
+        uint8_t code;
+        int cc_count;
+    };
+
+    static const cdp_framerate cdp_framerates[] = {
+        { boost::rational<int>(24000, 1001), 0x1, 25 },
+        { boost::rational<int>(24, 1), 0x2, 25 },
+        { boost::rational<int>(25, 1), 0x3, 24 },
+        { boost::rational<int>(30000, 1001), 0x4, 20 },
+        { boost::rational<int>(30, 1), 0x5, 20 },
+        { boost::rational<int>(50, 1), 0x6, 12 },
+        { boost::rational<int>(60000, 1001), 0x7, 10 },
+        { boost::rational<int>(60, 1), 0x8, 10 },
+    };
+
+    static const cdp_framerate* find_cdp_framerate(boost::rational<int> framerate)
+    {
+        for (auto& entry : cdp_framerates)
+        {
+            if (entry.framerate == framerate)
+                return &entry;
+        }
+        return nullptr;
+    }
+
+    static const cdp_framerate* find_cdp_framerate(uint8_t code)
+    {
+        for (auto& entry : cdp_framerates)
+        {
+            if (entry.code == code)
+                return &entry;
+        }
+        return nullptr;
+    }
+
+    static void parse_cc_data(const uint8_t* data, size_t count, std::vector<cc_data>& out)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            const uint8_t* triplet = data + i * 3;
+            cc_data cc;
+            cc.cc_valid = (triplet[0] & 0x04) != 0;
+            cc.type = static_cast<cc_type>(triplet[0] & 0x03);
+            cc.data1 = triplet[1];
+            cc.data2 = triplet[2];
+            out.push_back(cc);
+        }
+    }
+
+    //Returns false if the packet is not a well formed CDP, out is left untouched in that case
+    static bool parse_cdp(const uint8_t* data, size_t size, std::vector<cc_data>& out, boost::rational<int>& framerate)
+    {
+        if (size < 11 || ((data[0] << 8) | data[1]) != cdp_identifier)
+            return false;
+
+        size_t length = data[2];
+        if (length > size || length < 11)
+            return false;
+
+        uint8_t checksum = 0;
+        for (size_t i = 0; i < length; i++)
+            checksum += data[i];
+        if (checksum != 0)
+            return false;
+
+        std::vector<cc_data> captions;
+        size_t offset = 7;//identifier (2), length (1), frame rate (1), flags (1), sequence counter (2)
+        while (offset < length)
+        {
+            uint8_t section_id = data[offset];
+            if (section_id == footer_section_id)
+                break;
+            if (section_id == timecode_section_id)
+            {
+                offset += 5;
+            } else if (section_id == ccdata_section_id)
+            {
+                if (offset + 2 > length)
+                    return false;
+                size_t cc_count = data[offset + 1] & 0x1f;
+                if (offset + 2 + cc_count * 3 > length)
+                    return false;
+                parse_cc_data(data + offset + 2, cc_count, captions);
+                offset += 2 + cc_count * 3;
+            } else if (section_id == svcinfo_section_id)
+            {
+                if (offset + 2 > length)
+                    return false;
+                offset += 2 + (data[offset + 1] & 0x0f) * 7;
+            } else if (section_id >= 0x75 && section_id <= 0xef)//future_section: id, length, data
+            {
+                if (offset + 2 > length)
+                    return false;
+                offset += 2 + data[offset + 1];
+            } else
+            {
+                return false;
+            }
+        }
+
+        auto entry = find_cdp_framerate(static_cast<uint8_t>(data[3] >> 4));
+        if (entry)
+            framerate = entry->framerate;
+        out = std::move(captions);
+        return true;
+    }
+
+    static void write_cc_data(const std::vector<cc_data>& captions, std::vector<uint8_t>& out)
+    {
+        for (auto& cc : captions)
+        {
+            out.push_back(0xf8 | (cc.cc_valid ? 0x04 : 0x00) | static_cast<uint8_t>(cc.type));
+            out.push_back(cc.data1);
+            out.push_back(cc.data2);
+        }
+    }
+
     struct CEA708::impl : boost::noncopyable
     {
+        std::vector<cc_data> captions;
+        boost::rational<int> framerate;
+        uint16_t sequence_counter = 0;
+        bool valid = true;
+
         impl(const uint8_t* data, size_t size, cea708_format type)
+            : framerate(0)
         {
-            //parser atsc a53
+            if (type == cdp)
+            {
+                valid = parse_cdp(data, size, captions, framerate);
+                if (valid)
+                    sequence_counter = (data[5] << 8) | data[6];
+            } else
+            {
+                parse_cc_data(data, size / 3, captions);
+            }
         }
 
-        impl(const &other)
+        impl(std::vector<cc_data> captions, boost::rational<int> framerate, uint16_t sequence_counter)
+            : captions(std::move(captions))
+            , framerate(framerate)
+            , sequence_counter(sequence_counter)
         {
-            //
         }
 
-        std::vector<uint8_t> getData()
+        std::vector<uint8_t> getData() const
         {
-            return std::vector<uint8_t>();
+            auto entry = find_cdp_framerate(framerate);
+            uint8_t code = entry ? entry->code : find_cdp_framerate(boost::rational<int>(30000, 1001))->code;
+            size_t cc_count = std::min<size_t>(captions.size(), 0x1f);
+
+            std::vector<uint8_t> out;
+            out.reserve(11 + cc_count * 3 + 4);
+            out.push_back(cdp_identifier >> 8);
+            out.push_back(cdp_identifier & 0xff);
+            out.push_back(0);//cdp_length, set below
+            out.push_back((code << 4) | 0x0f);
+            out.push_back(0x43);//ccdata_present, caption_service_active, reserved
+            out.push_back(sequence_counter >> 8);
+            out.push_back(sequence_counter & 0xff);
+            out.push_back(ccdata_section_id);
+            out.push_back(0xe0 | static_cast<uint8_t>(cc_count));
+            write_cc_data(std::vector<cc_data>(captions.begin(), captions.begin() + cc_count), out);
+            out.push_back(footer_section_id);
+            out.push_back(sequence_counter >> 8);
+            out.push_back(sequence_counter & 0xff);
+            out.push_back(0);//packet_checksum, set below
+
+            out[2] = static_cast<uint8_t>(out.size());
+            uint8_t checksum = 0;
+            for (auto byte : out)
+                checksum += byte;
+            out.back() = static_cast<uint8_t>(0x100 - checksum);
+            return out;
+        }
+
+        std::vector<uint8_t> getA53Data() const
+        {
+            std::vector<uint8_t> out;
+            out.reserve(captions.size() * 3);
+            write_cc_data(captions, out);
+            return out;
         }
     };
 
     CEA708::CEA708(const uint8_t* data, size_t size, cea708_format type) : impl_(new impl(data, size, type)){}
-    std::vector<uint8_t> CEA708::getData(){ return impl_->getData(); }
-}}}
\ No newline at end of file
+    CEA708::CEA708(std::vector<cc_data> captions, boost::rational<int> framerate, uint16_t sequence_counter)
+        : impl_(new impl(std::move(captions), framerate, sequence_counter)){}
+    std::vector<uint8_t> CEA708::getData() const { return impl_->getData(); }
+    std::vector<uint8_t> CEA708::getA53Data() const { return impl_->getA53Data(); }
+    const std::vector<cc_data>& CEA708::captions() const { return impl_->captions; }
+    bool CEA708::valid() const { return impl_->valid; }
+
+    int CEA708::cc_count(boost::rational<int> framerate)
+    {
+        auto entry = find_cdp_framerate(framerate);
+        return entry ? entry->cc_count : 0;
+    }
+
+    //Keep captions flowing for about a second after the last caption data, so that a short gap
+    //in the source does not switch the caption service off downstream
+    static int idle_frames_limit(boost::rational<int> framerate)
+    {
+        return static_cast<int>(std::ceil(boost::rational_cast<double>(framerate)));
+    }
+
+    //About two seconds of caption data, anything beyond that means the source outruns the output
+    static size_t max_queue_size(int cc_count, boost::rational<int> framerate)
+    {
+        return static_cast<size_t>(cc_count * idle_frames_limit(framerate) * 2);
+    }
+
+    CEA708Retimer::CEA708Retimer()
+        : sequence_counter_(0)
+        , idle_frames_(std::numeric_limits<int>::max())
+    {
+    }
+
+    void CEA708Retimer::push(const AncillaryData& data)
+    {
+        if (data.getType() != ancillary_data_type_cea708)
+            return;
+
+        auto cea708 = dynamic_cast<const CEA708*>(&data);
+        std::shared_ptr<CEA708> parsed;
+        if (!cea708)
+        {
+            auto packet = data.getData();
+            parsed = std::make_shared<CEA708>(packet.data(), packet.size(), cdp);
+            cea708 = parsed.get();
+        }
+
+        for (auto& cc : cea708->captions())
+        {
+            if (!cc.cc_valid)//padding
+                continue;
+            if (cc.is_608())
+                queue_608_.push_back(cc);
+            else
+                queue_708_.push_back(cc);
+            idle_frames_ = 0;
+        }
+    }
+
+    std::shared_ptr<CEA708> CEA708Retimer::pop(boost::rational<int> framerate)
+    {
+        int cc_count = CEA708::cc_count(framerate);
+        if (cc_count == 0)
+        {
+            clear();
+            return nullptr;
+        }
+
+        if (queue_608_.empty() && queue_708_.empty())
+        {
+            if (idle_frames_ >= idle_frames_limit(framerate))
+                return nullptr;
+            idle_frames_++;
+        }
+
+        auto max_queue = max_queue_size(cc_count, framerate);
+        while (queue_608_.size() > max_queue)
+            queue_608_.pop_front();
+        while (queue_708_.size() > max_queue)
+            queue_708_.pop_front();
+
+        //CEA-608 carries one byte pair per field at 29.97 frames per second, whatever the frame rate
+        auto field_rate = boost::rational<int>(30000, 1001) / framerate;
+        int max_608_per_field = std::max(1, static_cast<int>(std::ceil(boost::rational_cast<double>(field_rate) - 0.0001)));
+
+        std::vector<cc_data> captions;
+        captions.reserve(cc_count);
+
+        int field1 = 0, field2 = 0;
+        for (auto it = queue_608_.begin(); it != queue_608_.end() && static_cast<int>(captions.size()) < cc_count;)
+        {
+            int& used = it->type == cc_type_608_field1 ? field1 : field2;
+            if (used == max_608_per_field)
+            {
+                //Keep the field order, a field that is ahead waits for the other one
+                break;
+            }
+            used++;
+            captions.push_back(*it);
+            it = queue_608_.erase(it);
+        }
+
+        while (!queue_708_.empty() && static_cast<int>(captions.size()) < cc_count)
+        {
+            captions.push_back(queue_708_.front());
+            queue_708_.pop_front();
+        }
+
+        while (static_cast<int>(captions.size()) < cc_count)
+        {
+            cc_data padding = { false, cc_type_dtvcc_start, 0x00, 0x00 };
+            captions.push_back(padding);
+        }
+
+        return std::make_shared<CEA708>(std::move(captions), framerate, sequence_counter_++);
+    }
+
+    void CEA708Retimer::clear()
+    {
+        queue_608_.clear();
+        queue_708_.clear();
+        idle_frames_ = std::numeric_limits<int>::max();
+    }
+
+}}}
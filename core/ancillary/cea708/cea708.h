@@ -23,23 +23,76 @@
 
 #include "../ancillary.h"
 
+#include <boost/rational.hpp>
+
+#include <deque>
+
 namespace caspar { namespace core { namespace ancillary {
 
     enum cea708_format {
-        atsc53,
-        cdp
+        atsc53,//cc_data triplets as carried in ATSC A/53 user data and AV_FRAME_DATA_A53_CC
+        cdp//SMPTE 334-2 caption distribution packet
+    };
+
+    enum cc_type {
+        cc_type_608_field1 = 0,
+        cc_type_608_field2 = 1,
+        cc_type_dtvcc_start = 2,
+        cc_type_dtvcc_data = 3
+    };
+
+    struct cc_data
+    {
+        bool cc_valid;
+        cc_type type;
+        uint8_t data1;
+        uint8_t data2;
+
+        bool is_608() const { return type == cc_type_608_field1 || type == cc_type_608_field2; }
     };
 
     class CEA708 : public AncillaryData
     {
         public:
+            //Parses A/53 cc_data or a CDP, invalid triplets are dropped and a malformed CDP yields no captions
             CEA708(const uint8_t* data, size_t size, cea708_format type);
-            std::vector<uint8_t> getData();
-            void getVancID(uint8_t& did, uint8_t& sdid) { did = 0x61; sdid = 0x01; }
-            ancillary_data_type getType() { return ancillary_data_type_cea708; }
+            //Captions for one frame at framerate, serialized as a CDP with the given sequence counter
+            CEA708(std::vector<cc_data> captions, boost::rational<int> framerate, uint16_t sequence_counter);
+
+            std::vector<uint8_t> getData() const;
+            void getVancID(uint8_t& did, uint8_t& sdid) const { did = 0x61; sdid = 0x01; }
+            ancillary_data_type getType() const { return ancillary_data_type_cea708; }
+
+            const std::vector<cc_data>& captions() const;
+            //False when a CDP failed to parse
+            bool valid() const;
+            std::vector<uint8_t> getA53Data() const;
+
+            //Number of cc_data triplets in one CDP at framerate (SMPTE 334-2 / CEA-708 table 3), 0 if unsupported
+            static int cc_count(boost::rational<int> framerate);
         private:
             struct impl;
-            spl::unique_ptr<impl> impl_;
+            spl::shared_ptr<impl> impl_;
+    };
+
+    //Re-times caption data from the frames of one frame rate to another. Triplets are queued
+    //in order and handed out at most cc_count per output frame; slots without data are
+    //padded, so frame repeats never duplicate and frame drops never lose caption bytes.
+    class CEA708Retimer final
+    {
+        public:
+            CEA708Retimer();
+
+            //Queues the captions of a source frame, accepts CEA708 as well as raw CDP packets
+            void push(const AncillaryData& data);
+            //Captions for the next output frame, nullptr when no captions are flowing
+            std::shared_ptr<CEA708> pop(boost::rational<int> framerate);
+            void clear();
+        private:
+            std::deque<cc_data> queue_608_;
+            std::deque<cc_data> queue_708_;
+            uint16_t sequence_counter_;
+            int idle_frames_;
     };
 
 }}}
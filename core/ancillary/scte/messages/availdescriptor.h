@@ -0,0 +1,46 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "messages.h"
+#include "core/ancillary/bitstream.h"
+#include "core/StdAfx.h"
+
+namespace caspar { namespace core { namespace ancillary { namespace scte104 {
+
+    class InsertAvailDescriptor : public SCTE104Msg
+    {
+        std::vector<uint32_t> provider_avail_ids_;
+        public:
+            InsertAvailDescriptor(std::vector<uint32_t> provider_avail_ids)
+                : provider_avail_ids_(std::move(provider_avail_ids)) {}
+            void appendData(std::vector<uint8_t> &buf)
+            {
+                Bitstream bs = Bitstream(buf);
+                bs.write_bytes_msb(opid_insert_avail_descriptor, 2);//opID
+                bs.write_bytes_msb(1 + 4 * provider_avail_ids_.size(), 2);//data_length
+
+                bs.write_byte(provider_avail_ids_.size());//num_provider_avails
+                for (auto id : provider_avail_ids_)
+                    bs.write_bytes_msb(id, 4);//provider_avail_id
+            }
+            scte_104_opid getOpID() { return opid_insert_avail_descriptor; }
+    };
+}}}}
@@ -0,0 +1,51 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "messages.h"
+#include "core/ancillary/bitstream.h"
+#include "core/StdAfx.h"
+
+#include <string>
+
+namespace caspar { namespace core { namespace ancillary { namespace scte104 {
+
+    class InsertDTMFDescriptor : public SCTE104Msg
+    {
+        uint8_t pre_roll_ = 0;//tenths of a second
+        std::string dtmf_chars_;
+        public:
+            InsertDTMFDescriptor(uint8_t pre_roll, std::string dtmf_chars)
+                : pre_roll_(pre_roll)
+                , dtmf_chars_(std::move(dtmf_chars)) {}
+            void appendData(std::vector<uint8_t> &buf)
+            {
+                Bitstream bs = Bitstream(buf);
+                bs.write_bytes_msb(opid_insert_dtmf_descriptor, 2);//opID
+                bs.write_bytes_msb(2 + dtmf_chars_.size(), 2);//data_length
+
+                bs.write_byte(pre_roll_);//pre_roll
+                bs.write_byte(dtmf_chars_.size());//dtmf_length
+                for (auto c : dtmf_chars_)
+                    bs.write_byte(c);//DTMF_char
+            }
+            scte_104_opid getOpID() { return opid_insert_dtmf_descriptor; }
+    };
+}}}}
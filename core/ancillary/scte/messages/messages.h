@@ -28,7 +28,11 @@ namespace caspar { namespace core { namespace ancillary { namespace scte104 {
     enum scte_104_opid {
         opid_null = 0xFFFF,//reserved
         opid_splice = 0x0101,
-        opid_splice_null = 0x0102
+        opid_splice_null = 0x0102,
+        opid_time_signal = 0x0104,
+        opid_insert_dtmf_descriptor = 0x0109,
+        opid_insert_avail_descriptor = 0x010A,
+        opid_insert_segmentation_descriptor = 0x010B
     };
 
     class SCTE104Msg 
@@ -0,0 +1,47 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "messages.h"
+#include "core/ancillary/bitstream.h"
+#include "core/StdAfx.h"
+
+namespace caspar { namespace core { namespace ancillary { namespace scte104 {
+
+    //Operation kept as received, e.g. when passing through SCTE-104 from an ingest source
+    class RawMessage : public SCTE104Msg
+    {
+        uint16_t opid_;
+        std::vector<uint8_t> data_;
+        public:
+            RawMessage(uint16_t opid, std::vector<uint8_t> data)
+                : opid_(opid)
+                , data_(std::move(data)) {}
+            void appendData(std::vector<uint8_t> &buf)
+            {
+                Bitstream bs = Bitstream(buf);
+                bs.write_bytes_msb(opid_, 2);//opID
+                bs.write_bytes_msb(data_.size(), 2);//data_length
+                for (auto byte : data_)
+                    bs.write_byte(byte);
+            }
+            scte_104_opid getOpID() { return static_cast<scte_104_opid>(opid_); }
+    };
+}}}}
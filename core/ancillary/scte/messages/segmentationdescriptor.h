@@ -0,0 +1,83 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "messages.h"
+#include "core/ancillary/bitstream.h"
+#include "core/StdAfx.h"
+
+namespace caspar { namespace core { namespace ancillary { namespace scte104 {
+
+    struct segmentation_descriptor
+    {
+        uint32_t event_id = 0;
+        uint8_t event_cancel_indicator = 0;
+        uint16_t duration = 0;//seconds
+        uint8_t upid_type = 0;
+        std::vector<uint8_t> upid;
+        uint8_t type_id = 0;
+        uint8_t segment_num = 0;
+        uint8_t segments_expected = 0;
+        uint8_t duration_extension_frames = 0;
+        uint8_t delivery_not_restricted_flag = 1;
+        uint8_t web_delivery_allowed_flag = 0;
+        uint8_t no_regional_blackout_flag = 0;
+        uint8_t archive_allowed_flag = 0;
+        uint8_t device_restrictions = 0;
+        uint8_t insert_sub_segment_info = 0;
+        uint8_t sub_segment_num = 0;
+        uint8_t sub_segments_expected = 0;
+    };
+
+    class InsertSegmentationDescriptor : public SCTE104Msg
+    {
+        segmentation_descriptor descriptor_;
+        public:
+            InsertSegmentationDescriptor(segmentation_descriptor descriptor)
+                : descriptor_(std::move(descriptor)) {}
+            void appendData(std::vector<uint8_t> &buf)
+            {
+                Bitstream bs = Bitstream(buf);
+                bs.write_bytes_msb(opid_insert_segmentation_descriptor, 2);//opID
+                bs.write_bytes_msb(21 + descriptor_.upid.size(), 2);//data_length
+
+                bs.write_bytes_msb(descriptor_.event_id, 4);//segmentation_event_id
+                bs.write_byte(descriptor_.event_cancel_indicator);//segmentation_event_cancel_indicator
+                bs.write_bytes_msb(descriptor_.duration, 2);//duration
+                bs.write_byte(descriptor_.upid_type);//segmentation_upid_type
+                bs.write_byte(descriptor_.upid.size());//segmentation_upid_length
+                for (auto byte : descriptor_.upid)
+                    bs.write_byte(byte);//segmentation_upid
+                bs.write_byte(descriptor_.type_id);//segmentation_type_id
+                bs.write_byte(descriptor_.segment_num);//segment_num
+                bs.write_byte(descriptor_.segments_expected);//segments_expected
+                bs.write_byte(descriptor_.duration_extension_frames);//duration_extension_frames
+                bs.write_byte(descriptor_.delivery_not_restricted_flag);//delivery_not_restricted_flag
+                bs.write_byte(descriptor_.web_delivery_allowed_flag);//web_delivery_allowed_flag
+                bs.write_byte(descriptor_.no_regional_blackout_flag);//no_regional_blackout_flag
+                bs.write_byte(descriptor_.archive_allowed_flag);//archive_allowed_flag
+                bs.write_byte(descriptor_.device_restrictions);//device_restrictions
+                bs.write_byte(descriptor_.insert_sub_segment_info);//insert_sub_segment_info
+                bs.write_byte(descriptor_.sub_segment_num);//sub_segment_num
+                bs.write_byte(descriptor_.sub_segments_expected);//sub_segments_expected
+            }
+            scte_104_opid getOpID() { return opid_insert_segmentation_descriptor; }
+    };
+}}}}
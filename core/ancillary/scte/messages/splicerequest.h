@@ -58,8 +58,8 @@ namespace caspar { namespace core { namespace ancillary { namespace scte104 {
                 : splice_type_(type)
                 , event_id_(event_id)
                 , unique_program_id_(unique_program_id)
-                , break_duration_(break_duration)
                 , pre_roll_time_(pre_roll_time)
+                , break_duration_(break_duration)
                 , avail_num_(avail_num)
                 , avails_expected_(avails_expected)
                 , auto_return_flag_(auto_return_flag) {}
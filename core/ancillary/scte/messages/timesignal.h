@@ -0,0 +1,43 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "messages.h"
+#include "core/ancillary/bitstream.h"
+#include "core/StdAfx.h"
+
+namespace caspar { namespace core { namespace ancillary { namespace scte104 {
+
+    class TimeSignalRequest : public SCTE104Msg
+    {
+        uint16_t pre_roll_time_ = 0;//milliseconds
+        public:
+            TimeSignalRequest(uint16_t pre_roll_time)
+                : pre_roll_time_(pre_roll_time) {}
+            void appendData(std::vector<uint8_t> &buf)
+            {
+                Bitstream bs = Bitstream(buf);
+                bs.write_bytes_msb(opid_time_signal, 2);//opID
+                bs.write_bytes_msb(2, 2);//data_length
+                bs.write_bytes_msb(pre_roll_time_, 2);//pre_roll_time
+            }
+            scte_104_opid getOpID() { return opid_time_signal; }
+    };
+}}}}
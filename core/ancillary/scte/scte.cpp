@@ -23,9 +23,10 @@
 #include "core/ancillary/bitstream.h"
 #include "messages/splicenull.h"
 #include "messages/splicerequest.h"
+#include "messages/rawmessage.h"
 
 namespace caspar { namespace core { namespace ancillary {
-    static void write_scte_104_hdr(std::vector<std::uint8_t>&buf, size_t size)
+    static void write_scte_104_hdr(std::vector<std::uint8_t>&buf, size_t size, const std::vector<uint8_t>& header)
     {
         Bitstream bs = Bitstream(buf);
 
@@ -33,15 +34,36 @@ namespace caspar { namespace core { namespace ancillary {
 
         bs.write_bytes_msb(0xFFFF, 2);//reserved
         bs.write_bytes_msb(0, 2);//messageSize
-        bs.write_byte(0);//protocol_version
-        bs.write_byte(0);//AS_index
-        bs.write_byte(0);//message_number
-        bs.write_bytes_msb(0, 2);//DPI_PID_index
-        bs.write_byte(0);//SCE35_protocol_version
-        bs.write_byte(0);//timestamp.type
+        if (header.empty())
+        {
+            bs.write_byte(0);//protocol_version
+            bs.write_byte(0);//AS_index
+            bs.write_byte(0);//message_number
+            bs.write_bytes_msb(0, 2);//DPI_PID_index
+            bs.write_byte(0);//SCE35_protocol_version
+            bs.write_byte(0);//timestamp.type
+        }
+        else
+        {
+            for (auto byte : header)
+                bs.write_byte(byte);
+        }
         bs.write_byte(size);//num_ops
     }
 
+    //Size of the timestamp that follows time_type
+    static int timestamp_size(uint8_t time_type)
+    {
+        switch (time_type)
+        {
+            case 0: return 0;//none
+            case 1: return 6;//UTC seconds and microseconds
+            case 2: return 4;//VITC hours, minutes, seconds, frames
+            case 3: return 2;//GPI number and edge
+            default: return -1;
+        }
+    }
+
     static void set_scte_104_length(std::vector<std::uint8_t>&buf)
     {
         std::size_t size = buf.size() -1;// minus one because of inclusion of 2010 PD
@@ -52,7 +74,7 @@ namespace caspar { namespace core { namespace ancillary {
 
     std::vector<uint8_t> SCTE104AncData::getData()const {
         std::vector<uint8_t> out;
-        write_scte_104_hdr(out, messages.size());
+        write_scte_104_hdr(out, messages.size(), header);
         for (auto msg : messages)
         {
             msg.get()->appendData(out);
@@ -66,4 +88,41 @@ namespace caspar { namespace core { namespace ancillary {
         messages.push_back(std::move(msg));
     }
 
+    std::shared_ptr<SCTE104AncData> SCTE104AncData::parse(const uint8_t* data, size_t size)
+    {
+        //Payload descriptor 0x08 is a complete message in a single packet
+        if (size < 13 || data[0] != 0x08 || data[1] != 0xFF || data[2] != 0xFF)
+            return nullptr;
+
+        size_t message_size = (data[3] << 8) | data[4];
+        if (message_size < 12 || message_size > size - 1)
+            return nullptr;
+        size_t end = message_size + 1;
+
+        //protocol_version, AS_index, message_number, DPI_PID_index (2), SCTE35_protocol_version, time_type
+        size_t offset = 5 + 7;
+        auto ts_size = timestamp_size(data[offset - 1]);
+        if (ts_size < 0 || offset + ts_size + 1 > end)
+            return nullptr;
+        offset += ts_size;
+
+        auto result = std::make_shared<SCTE104AncData>();
+        result->header.assign(data + 5, data + offset);
+
+        size_t num_ops = data[offset++];
+        for (size_t op = 0; op < num_ops; op++)
+        {
+            if (offset + 4 > end)
+                return nullptr;
+            uint16_t opid = (data[offset] << 8) | data[offset + 1];
+            size_t data_length = (data[offset + 2] << 8) | data[offset + 3];
+            offset += 4;
+            if (offset + data_length > end)
+                return nullptr;
+            result->addMsg(std::unique_ptr<scte104::SCTE104Msg>(new scte104::RawMessage(opid, std::vector<uint8_t>(data + offset, data + offset + data_length))));
+            offset += data_length;
+        }
+        return result;
+    }
+
 }}}
\ No newline at end of file
@@ -33,8 +33,13 @@ class SCTE104AncData : public AncillaryData
         void getVancID(uint8_t& did, uint8_t& sdid) const { did = 0x41; sdid = 0x07; }
         ancillary_data_type getType() const { return ancillary_data_type_scte_104; }
         void addMsg(std::unique_ptr<scte104::SCTE104Msg> msg);
+
+        //Parses a multiple_operation_message as carried in VANC (SMPTE 2010), operations are kept
+        //as received. nullptr when it is malformed or split over several packets.
+        static std::shared_ptr<SCTE104AncData> parse(const uint8_t* data, size_t size);
     private:
         std::list<std::shared_ptr<scte104::SCTE104Msg>> messages;
+        std::vector<uint8_t> header;//protocol_version up to and including the timestamp, zeros when empty
 };
 
 }}}
@@ -0,0 +1,282 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "scte35.h"
+#include "core/ancillary/bitstream.h"
+#include "messages/splicenull.h"
+#include "messages/splicerequest.h"
+#include "messages/timesignal.h"
+
+#include <cmath>
+
+namespace caspar { namespace core { namespace ancillary { namespace scte35 {
+
+    static const uint8_t splice_info_table_id = 0xfc;
+    static const uint8_t segmentation_descriptor_tag = 0x02;
+    static const uint32_t cuei_identifier = 0x43554549;//"CUEI"
+    static const uint64_t pts_mask = (1ULL << 33) - 1;
+
+    uint32_t crc32(const uint8_t* data, size_t size)
+    {
+        //CRC-32/MPEG-2, as used by all MPEG-TS sections
+        uint32_t crc = 0xffffffff;
+        for (size_t i = 0; i < size; i++)
+        {
+            crc ^= static_cast<uint32_t>(data[i]) << 24;
+            for (int bit = 0; bit < 8; bit++)
+                crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+        }
+        return crc;
+    }
+
+    static boost::optional<uint64_t> read_splice_time(BitstreamReader& bs)
+    {
+        if (bs.read_bits(1))//time_specified_flag
+        {
+            bs.read_bits(6);//reserved
+            return bs.read_bits(33);//pts_time
+        }
+        bs.read_bits(7);//reserved
+        return boost::none;
+    }
+
+    static bool read_splice_insert(BitstreamReader& bs, splice_insert& insert)
+    {
+        insert.event_id = static_cast<uint32_t>(bs.read_bits(32));
+        insert.event_cancel = bs.read_bits(1) != 0;
+        bs.read_bits(7);//reserved
+        if (insert.event_cancel)
+            return !bs.has_overrun();
+
+        insert.out_of_network = bs.read_bits(1) != 0;
+        insert.program_splice = bs.read_bits(1) != 0;
+        bool duration_flag = bs.read_bits(1) != 0;
+        insert.splice_immediate = bs.read_bits(1) != 0;
+        bs.read_bits(4);//reserved
+
+        if (insert.program_splice && !insert.splice_immediate)
+            insert.pts_time = read_splice_time(bs);
+
+        if (!insert.program_splice)
+        {
+            //Component splices are signalled on the first component, SCTE-104 splices the program
+            auto component_count = bs.read_byte();
+            for (int i = 0; i < component_count; i++)
+            {
+                bs.read_byte();//component_tag
+                if (!insert.splice_immediate)
+                {
+                    auto pts_time = read_splice_time(bs);
+                    if (!insert.pts_time)
+                        insert.pts_time = pts_time;
+                }
+            }
+        }
+
+        if (duration_flag)
+        {
+            insert.auto_return = bs.read_bits(1) != 0;
+            bs.read_bits(6);//reserved
+            insert.break_duration = bs.read_bits(33);
+        }
+
+        insert.unique_program_id = static_cast<uint16_t>(bs.read_bits(16));
+        insert.avail_num = bs.read_byte();
+        insert.avails_expected = bs.read_byte();
+        return !bs.has_overrun();
+    }
+
+    static bool read_segmentation_descriptor(const uint8_t* data, size_t size, scte104::segmentation_descriptor& descriptor)
+    {
+        BitstreamReader bs(data, size);
+        if (bs.read_bits(32) != cuei_identifier)
+            return false;
+
+        descriptor.event_id = static_cast<uint32_t>(bs.read_bits(32));
+        descriptor.event_cancel_indicator = static_cast<uint8_t>(bs.read_bits(1));
+        bs.read_bits(7);//reserved
+        if (descriptor.event_cancel_indicator)
+            return !bs.has_overrun();
+
+        bool program_segmentation = bs.read_bits(1) != 0;
+        bool duration_flag = bs.read_bits(1) != 0;
+        descriptor.delivery_not_restricted_flag = static_cast<uint8_t>(bs.read_bits(1));
+        if (!descriptor.delivery_not_restricted_flag)
+        {
+            descriptor.web_delivery_allowed_flag = static_cast<uint8_t>(bs.read_bits(1));
+            descriptor.no_regional_blackout_flag = static_cast<uint8_t>(bs.read_bits(1));
+            descriptor.archive_allowed_flag = static_cast<uint8_t>(bs.read_bits(1));
+            descriptor.device_restrictions = static_cast<uint8_t>(bs.read_bits(2));
+        } else
+        {
+            bs.read_bits(5);//reserved
+        }
+
+        if (!program_segmentation)
+        {
+            auto component_count = bs.read_byte();
+            bs.skip_bytes(component_count * 6);//component_tag, reserved, pts_offset
+        }
+
+        if (duration_flag)
+        {
+            auto duration = bs.read_bits(40);
+            descriptor.duration = static_cast<uint16_t>(std::min<uint64_t>(0xffff, (duration + 45000) / 90000));
+        }
+
+        descriptor.upid_type = bs.read_byte();
+        auto upid_length = bs.read_byte();
+        for (int i = 0; i < upid_length; i++)
+            descriptor.upid.push_back(bs.read_byte());
+
+        descriptor.type_id = bs.read_byte();
+        descriptor.segment_num = bs.read_byte();
+        descriptor.segments_expected = bs.read_byte();
+
+        bool has_sub_segments = descriptor.type_id == 0x34 || descriptor.type_id == 0x36 || descriptor.type_id == 0x38 || descriptor.type_id == 0x3a;
+        if (has_sub_segments && bs.bytes_left() >= 2)
+        {
+            descriptor.insert_sub_segment_info = 1;
+            descriptor.sub_segment_num = bs.read_byte();
+            descriptor.sub_segments_expected = bs.read_byte();
+        }
+        return !bs.has_overrun();
+    }
+
+    bool parse(const uint8_t* data, size_t size, splice_info& info)
+    {
+        if (size < 3 || data[0] != splice_info_table_id)
+            return false;
+
+        size_t section_length = ((data[1] & 0x0f) << 8) | data[2];
+        if (section_length + 3 > size || section_length < 4)
+            return false;
+
+        //The CRC over a section including its CRC_32 field is 0
+        if (crc32(data, section_length + 3) != 0)
+            return false;
+
+        BitstreamReader bs(data + 3, section_length - 4);
+        bs.read_byte();//protocol_version
+        if (bs.read_bits(1))//encrypted_packet
+            return false;
+        bs.read_bits(6);//encryption_algorithm
+        info.pts_adjustment = bs.read_bits(33);
+        bs.read_byte();//cw_index
+        bs.read_bits(12);//tier
+        size_t command_length = static_cast<size_t>(bs.read_bits(12));
+        info.command_type = bs.read_byte();
+
+        auto command_start = bs.byte_pos();
+        switch (info.command_type)
+        {
+            case splice_command_null:
+                break;
+            case splice_command_insert:
+                if (!read_splice_insert(bs, info.insert))
+                    return false;
+                break;
+            case splice_command_time_signal:
+                info.time_signal_pts = read_splice_time(bs);
+                break;
+            default:
+                return false;
+        }
+
+        //splice_command_length is 0xfff in old streams that did not know the length in advance
+        if (command_length != 0xfff)
+            bs.skip_bytes(command_start + command_length - bs.byte_pos());
+
+        size_t descriptor_loop_length = static_cast<size_t>(bs.read_bits(16));
+        auto descriptors_end = bs.byte_pos() + descriptor_loop_length;
+        while (bs.byte_pos() + 2 <= descriptors_end && !bs.has_overrun())
+        {
+            auto tag = bs.read_byte();
+            size_t length = bs.read_byte();
+            auto descriptor_start = data + 3 + bs.byte_pos();
+            if (bs.byte_pos() + length > descriptors_end)
+                return false;
+
+            if (tag == segmentation_descriptor_tag)
+            {
+                scte104::segmentation_descriptor descriptor;
+                if (read_segmentation_descriptor(descriptor_start, length, descriptor))
+                    info.segmentation_descriptors.push_back(std::move(descriptor));
+            }
+            bs.skip_bytes(length);
+        }
+        return !bs.has_overrun();
+    }
+
+    boost::optional<uint64_t> splice_pts(const splice_info& info)
+    {
+        boost::optional<uint64_t> pts;
+        if (info.command_type == splice_command_insert && !info.insert.event_cancel && !info.insert.splice_immediate)
+            pts = info.insert.pts_time;
+        else if (info.command_type == splice_command_time_signal)
+            pts = info.time_signal_pts;
+
+        if (pts)
+            return (*pts + info.pts_adjustment) & pts_mask;
+        return boost::none;
+    }
+
+    std::shared_ptr<SCTE104AncData> to_scte104(const splice_info& info, uint16_t pre_roll)
+    {
+        auto data = std::make_shared<SCTE104AncData>();
+
+        if (info.command_type == splice_command_insert)
+        {
+            auto& insert = info.insert;
+            bool immediate = !splice_pts(info);
+            scte104::scte_104_splice_type type;
+            if (insert.event_cancel)
+                type = scte104::cancel;
+            else if (insert.out_of_network)
+                type = immediate ? scte104::start_immediate : scte104::start_normal;
+            else
+                type = immediate ? scte104::end_immediate : scte104::end_normal;
+
+            //SCTE-104 break_duration is in tenths of a second
+            uint16_t break_duration = insert.break_duration ? static_cast<uint16_t>(std::min<uint64_t>(0xffff, (*insert.break_duration + 4500) / 9000)) : 0;
+
+            data->addMsg(std::unique_ptr<scte104::SCTE104Msg>(new scte104::SpliceRequest(
+                    type,
+                    insert.event_id,
+                    insert.unique_program_id,
+                    immediate ? 0 : pre_roll,
+                    break_duration,
+                    insert.avail_num,
+                    insert.avails_expected,
+                    insert.auto_return ? 1 : 0)));
+        } else if (info.command_type == splice_command_time_signal)
+        {
+            data->addMsg(std::unique_ptr<scte104::SCTE104Msg>(new scte104::TimeSignalRequest(splice_pts(info) ? pre_roll : 0)));
+        } else
+        {
+            data->addMsg(std::unique_ptr<scte104::SCTE104Msg>(new scte104::SpliceNull()));
+        }
+
+        for (auto& descriptor : info.segmentation_descriptors)
+            data->addMsg(std::unique_ptr<scte104::SCTE104Msg>(new scte104::InsertSegmentationDescriptor(descriptor)));
+
+        return data;
+    }
+
+}}}}
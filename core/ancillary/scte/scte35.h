@@ -0,0 +1,75 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "scte.h"
+#include "messages/segmentationdescriptor.h"
+
+#include <boost/optional.hpp>
+
+namespace caspar { namespace core { namespace ancillary { namespace scte35 {
+
+    enum splice_command_type {
+        splice_command_null = 0x00,
+        splice_command_schedule = 0x04,
+        splice_command_insert = 0x05,
+        splice_command_time_signal = 0x06,
+        splice_command_bandwidth_reservation = 0x07,
+        splice_command_private = 0xff
+    };
+
+    struct splice_insert
+    {
+        uint32_t event_id = 0;
+        bool event_cancel = false;
+        bool out_of_network = false;
+        bool program_splice = true;
+        bool splice_immediate = false;
+        boost::optional<uint64_t> pts_time;//90 kHz, without pts_adjustment
+        boost::optional<uint64_t> break_duration;//90 kHz
+        bool auto_return = false;
+        uint16_t unique_program_id = 0;
+        uint8_t avail_num = 0;
+        uint8_t avails_expected = 0;
+    };
+
+    struct splice_info
+    {
+        uint64_t pts_adjustment = 0;
+        uint8_t command_type = splice_command_null;
+        splice_insert insert;//splice_command_insert
+        boost::optional<uint64_t> time_signal_pts;//splice_command_time_signal, without pts_adjustment
+        std::vector<scte104::segmentation_descriptor> segmentation_descriptors;
+    };
+
+    //Parses a splice_info_section, returns false on a CRC mismatch, on a malformed or encrypted
+    //section and on commands that have no SCTE-104 counterpart
+    bool parse(const uint8_t* data, size_t size, splice_info& info);
+
+    //The 33 bit PTS at which the splice happens, none for immediate and cancelling splices
+    boost::optional<uint64_t> splice_pts(const splice_info& info);
+
+    //Maps a parsed cue onto a SCTE-104 multiple_operation_message, pre_roll is the time in
+    //milliseconds from the frame that carries the message to the splice point
+    std::shared_ptr<SCTE104AncData> to_scte104(const splice_info& info, uint16_t pre_roll);
+
+    uint32_t crc32(const uint8_t* data, size_t size);
+
+}}}}
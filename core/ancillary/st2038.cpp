@@ -0,0 +1,242 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "st2038.h"
+#include "bitstream.h"
+#include "scte/scte35.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace caspar { namespace core { namespace ancillary { namespace st2038 {
+
+    //8 bit value with even parity in b8 and its inverse in b9
+    static inline uint16_t with_parity(uint8_t value)
+    {
+        return value | (__builtin_parity(value) ? 0x100 : 0x200);
+    }
+
+    static inline bool parity_ok(uint16_t word)
+    {
+        return word == with_parity(static_cast<uint8_t>(word));
+    }
+
+    static inline uint16_t checksum_word(uint16_t sum)
+    {
+        sum &= 0x1ff;
+        return sum | ((~sum & 0x100) << 1);
+    }
+
+    void write(const AncillaryContainer& ancillary, uint32_t width, std::vector<uint8_t>& out, uint16_t first_line, ancillary_data_type exclude)
+    {
+        std::vector<uint8_t> packets;
+        ancillary.getAncillaryAsPackets(packets, exclude);
+
+        auto start = out.size();
+        Bitstream bs = Bitstream(out);
+
+        //HD carries ancillary data in the luma samples only, SD in the interleaved samples
+        size_t line_samples = width > 720 ? width : width * 2;
+        uint16_t line = first_line;
+        size_t offset = 0;
+
+        size_t pos = 0;
+        while (pos + 4 <= packets.size())
+        {
+            uint8_t did = packets[pos];
+            uint8_t sdid = packets[pos + 1];
+            size_t size = std::min<size_t>((packets[pos + 2] << 8) | packets[pos + 3], packets.size() - pos - 4);
+            const uint8_t* data = packets.data() + pos + 4;
+            pos += 4 + size;
+
+            //The data count is a single byte, larger payloads can not be carried
+            if (size > 0xff)
+                continue;
+
+            if (offset > 0 && offset + size + 7 > line_samples)
+            {
+                line++;
+                offset = 0;
+            }
+
+            bs.write_bits(0, 6);
+            bs.write_bit(0);//c_not_y_channel_flag
+            bs.write_bits(line, 11);//line_number
+            bs.write_bits(offset, 12);//horizontal_offset
+
+            uint16_t sum = 0;
+            for (uint16_t word : { with_parity(did), with_parity(sdid), with_parity(static_cast<uint8_t>(size)) })
+            {
+                bs.write_bits(word, 10);
+                sum += word;
+            }
+            for (size_t n = 0; n < size; n++)
+            {
+                auto word = with_parity(data[n]);
+                bs.write_bits(word, 10);//user_data_words
+                sum += word;
+            }
+            bs.write_bits(checksum_word(sum), 10);//checksum_word
+            bs.write_align(1);//word_align
+
+            offset += size + 7;
+        }
+
+        //Every packet ends byte aligned, so nothing is pending in bs
+        if (out.size() == start)
+            out.push_back(0xff);//stuffing_byte
+    }
+
+    bool parse(const uint8_t* data, size_t size, std::vector<packet>& out)
+    {
+        BitstreamReader bs(data, size);
+
+        //Reserved zeros, flag, line_number, horizontal_offset, DID, SDID, data_count and checksum
+        while (bs.bytes_left() * 8 >= 6 + 1 + 11 + 12 + 4 * 10)
+        {
+            //Stuffing bytes start with ones
+            if (bs.read_bits(6) != 0)
+                return true;
+
+            packet pkt;
+            pkt.c_not_y_channel = bs.read_bits(1) != 0;
+            pkt.line_number = static_cast<uint16_t>(bs.read_bits(11));
+            pkt.horizontal_offset = static_cast<uint16_t>(bs.read_bits(12));
+
+            auto did = static_cast<uint16_t>(bs.read_bits(10));
+            auto sdid = static_cast<uint16_t>(bs.read_bits(10));
+            auto data_count = static_cast<uint16_t>(bs.read_bits(10));
+            if (!parity_ok(did) || !parity_ok(sdid) || !parity_ok(data_count))
+                return false;
+
+            uint16_t sum = did + sdid + data_count;
+            size_t count = data_count & 0xff;
+            pkt.data.resize(count);
+            for (size_t n = 0; n < count; n++)
+            {
+                auto word = static_cast<uint16_t>(bs.read_bits(10));
+                sum += word;
+                pkt.data[n] = static_cast<uint8_t>(word);
+            }
+            auto checksum = static_cast<uint16_t>(bs.read_bits(10));
+            if (bs.has_overrun() || checksum != checksum_word(sum))
+                return false;
+            bs.align();
+
+            pkt.did = static_cast<uint8_t>(did);
+            pkt.sdid = static_cast<uint8_t>(sdid);
+            out.push_back(std::move(pkt));
+        }
+        return true;
+    }
+
+    static const size_t ts_packet_size = 188;
+
+    void registration_writer::write(const uint8_t* data, size_t size, std::vector<uint8_t>& out)
+    {
+        pending_.insert(pending_.end(), data, data + size);
+
+        //The muxer starts every packet with the sync byte, after the 4 byte timecode in M2TS
+        if (packet_size_ == 0)
+        {
+            if (pending_.size() < 5)
+                return;
+            packet_size_ = pending_[0] == 0x47 ? ts_packet_size : ts_packet_size + 4;
+        }
+
+        size_t pos = 0;
+        for (; pos + packet_size_ <= pending_.size(); pos += packet_size_)
+            patch(pending_.data() + pos + packet_size_ - ts_packet_size);
+
+        out.insert(out.end(), pending_.begin(), pending_.begin() + pos);
+        pending_.erase(pending_.begin(), pending_.begin() + pos);
+    }
+
+    void registration_writer::patch(uint8_t* ts)
+    {
+        //Only packets that start a section can hold a whole one
+        if (ts[0] != 0x47 || !(ts[1] & 0x40) || !(ts[3] & 0x10))
+            return;
+
+        uint16_t pid = ((ts[1] & 0x1f) << 8) | ts[2];
+        size_t start = (ts[3] & 0x20) ? 5 + ts[4] : 4;//After the adaptation_field
+        if (start + 13 > ts_packet_size)
+            return;
+        start += 1 + ts[start];//After the pointer_field
+        if (start + 12 > ts_packet_size)
+            return;
+
+        uint8_t* section = ts + start;
+        size_t section_length = ((section[1] & 0x0f) << 8) | section[2];
+        size_t end = start + 3 + section_length;//The sections of FFmpeg fit a single packet
+        if (section_length < 9 || end > ts_packet_size || scte35::crc32(section, section_length + 3) != 0)
+            return;
+
+        if (pid == 0 && section[0] == 0x00)
+        {
+            //program_association_section, remember the PIDs of the program_map_sections
+            pmt_pids_.clear();
+            for (size_t n = start + 8; n + 4 <= end - 4; n += 4)
+            {
+                if ((ts[n] << 8 | ts[n + 1]) != 0)
+                    pmt_pids_.push_back(((ts[n + 2] & 0x1f) << 8) | ts[n + 3]);
+            }
+            return;
+        }
+
+        if (section[0] != 0x02 || std::find(pmt_pids_.begin(), pmt_pids_.end(), pid) == pmt_pids_.end())
+            return;
+
+        //TS_program_map_section, skip the program_info descriptors to the elementary stream loop
+        size_t n = start + 12 + (((section[10] & 0x0f) << 8) | section[11]);
+        while (n + 5 <= end - 4)
+        {
+            size_t es_info_length = ((ts[n + 3] & 0x0f) << 8) | ts[n + 4];
+
+            if (ts[n] == 0x06 && es_info_length == 0 && end + 6 <= ts_packet_size)
+            {
+                //Make room for the descriptor in the stuffing after the section
+                std::memmove(ts + n + 11, ts + n + 5, end - (n + 5));
+                const uint8_t descriptor[] = {
+                    0x05, 4,//registration_descriptor
+                    static_cast<uint8_t>(registration_format_identifier >> 24), static_cast<uint8_t>(registration_format_identifier >> 16),
+                    static_cast<uint8_t>(registration_format_identifier >> 8), static_cast<uint8_t>(registration_format_identifier)
+                };
+                std::memcpy(ts + n + 5, descriptor, sizeof(descriptor));
+                ts[n + 3] = (ts[n + 3] & 0xf0);
+                ts[n + 4] = 6;
+
+                end += 6;
+                section_length += 6;
+                section[1] = (section[1] & 0xf0) | static_cast<uint8_t>(section_length >> 8);
+                section[2] = static_cast<uint8_t>(section_length);
+
+                auto crc = scte35::crc32(section, section_length - 1);
+                ts[end - 4] = static_cast<uint8_t>(crc >> 24);
+                ts[end - 3] = static_cast<uint8_t>(crc >> 16);
+                ts[end - 2] = static_cast<uint8_t>(crc >> 8);
+                ts[end - 1] = static_cast<uint8_t>(crc);
+                es_info_length = 6;
+            }
+
+            n += 5 + es_info_length;
+        }
+    }
+
+}}}}
@@ -0,0 +1,67 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "ancillary.h"
+
+namespace caspar { namespace core { namespace ancillary { namespace st2038 {
+
+    //One ANC data packet of SMPTE ST 2038, the carriage of ancillary data in MPEG-2 transport streams
+    struct packet
+    {
+        bool c_not_y_channel = false;
+        uint16_t line_number = 0;
+        uint16_t horizontal_offset = 0;
+        uint8_t did = 0;
+        uint8_t sdid = 0;
+        std::vector<uint8_t> data;
+    };
+
+    //Appends the ancillary data of a frame as the PES payload of one ST 2038 access unit. Packets are
+    //placed in the luma channel from first_line on, starting a new line when the line of width pixels is full.
+    //Writes a single stuffing byte when there is no ancillary data, so the stream keeps one PES per frame.
+    void write(const AncillaryContainer& ancillary, uint32_t width, std::vector<uint8_t>& out, uint16_t first_line = 9, ancillary_data_type exclude = ancillary_data_none);
+
+    //Parses the ANC data packets of a PES payload up to the stuffing bytes. Returns false on a packet
+    //with bad parity, a bad checksum or that is truncated, the packets before it are kept in out.
+    bool parse(const uint8_t* data, size_t size, std::vector<packet>& out);
+
+    //format_identifier of the MPEG-2 registration descriptor that marks a PMT entry as ST 2038, 'VANC'
+    const uint32_t registration_format_identifier = 0x56414e43;
+
+    //Adds the 'VANC' registration descriptor to the PMT of a transport stream. The MPEG-TS muxer of FFmpeg
+    //writes ST 2038 as private data (stream_type 0x06) without any descriptor, so readers could not tell
+    //it apart from other private data. Those PMT entries are given the descriptor, everything else passes
+    //through unchanged. Packets are 188 bytes, or 192 with the M2TS timecode prefix.
+    class registration_writer
+    {
+    public:
+        //Appends the complete packets of data to out and keeps a trailing partial packet for the next call
+        void write(const uint8_t* data, size_t size, std::vector<uint8_t>& out);
+
+    private:
+        void patch(uint8_t* ts_packet);
+
+        size_t packet_size_ = 0;
+        std::vector<uint8_t> pending_;
+        std::vector<uint16_t> pmt_pids_;
+    };
+
+}}}}
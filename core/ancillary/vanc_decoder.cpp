@@ -0,0 +1,180 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "vanc_decoder.h"
+
+#include "cea708/cea708.h"
+#include "scte/scte.h"
+
+#include <unordered_map>
+
+namespace caspar { namespace core { namespace ancillary {
+
+	//DID, SDID and data count carry even parity of b0-b7 in b8 and its inverse in b9
+	static inline bool parity_ok(uint16_t word)
+	{
+		uint16_t expected = __builtin_parity(word & 0xff) ? 0x100 : 0x200;
+		return (word & 0x300) == expected;
+	}
+
+	static std::shared_ptr<AncillaryData> parse_scte_104(const uint8_t* data, size_t size)
+	{
+		return SCTE104AncData::parse(data, size);
+	}
+
+	static std::shared_ptr<AncillaryData> parse_cea708(const uint8_t* data, size_t size)
+	{
+		auto cea708 = std::make_shared<CEA708>(data, size, cdp);
+		return cea708->valid() ? cea708 : nullptr;
+	}
+
+	struct VancDecoder::impl : boost::noncopyable
+	{
+		std::unordered_map<uint16_t, AncillaryParser> parsers;
+		VancDecoderStats stats;
+		std::vector<uint16_t> samples;
+		std::vector<uint16_t> chroma;
+		std::vector<uint8_t> user_data;
+
+		impl()
+		{
+			registerParser(0x41, 0x07, parse_scte_104);
+			registerParser(0x61, 0x01, parse_cea708);
+		}
+
+		void registerParser(uint8_t did, uint8_t sdid, AncillaryParser parser)
+		{
+			uint16_t key = (did << 8) | sdid;
+			if (parser)
+				parsers[key] = std::move(parser);
+			else
+				parsers.erase(key);
+		}
+
+		std::shared_ptr<AncillaryData> dispatch(uint8_t did, uint8_t sdid, const uint8_t* data, size_t size)
+		{
+			stats.packets++;
+			auto it = parsers.find((did << 8) | sdid);
+			if (it != parsers.end())
+			{
+				auto parsed = it->second(data, size);
+				if (parsed)
+					return parsed;
+			}
+			return std::make_shared<RawAncillaryData>(did, sdid, std::vector<uint8_t>(data, data + size));
+		}
+
+		size_t decodeSamples(const uint16_t* s, size_t count, AncillaryContainer& out)
+		{
+			size_t found = 0;
+			size_t i = 0;
+			//ADF, DID, SDID, data count and checksum
+			while (i + 7 <= count)
+			{
+				if (s[i] != 0x000 || s[i + 1] != 0x3ff || s[i + 2] != 0x3ff)
+				{
+					i++;
+					continue;
+				}
+
+				uint16_t did = s[i + 3];
+				uint16_t sdid = s[i + 4];
+				uint16_t dc = s[i + 5];
+				if (!parity_ok(did) || !parity_ok(sdid) || !parity_ok(dc))
+				{
+					stats.parity_errors++;
+					i++;
+					continue;
+				}
+
+				size_t size = dc & 0xff;
+				if (i + 7 + size > count)
+				{
+					stats.truncated++;
+					break;
+				}
+
+				uint16_t checksum = did + sdid + dc;
+				user_data.resize(size);
+				for (size_t n = 0; n < size; n++)
+				{
+					checksum += s[i + 6 + n];
+					user_data[n] = static_cast<uint8_t>(s[i + 6 + n]);
+				}
+				checksum &= 0x1ff;
+				checksum |= (~checksum & 0x100) << 1;
+				if (s[i + 6 + size] != checksum)
+				{
+					stats.checksum_errors++;
+					i++;
+					continue;
+				}
+
+				out.addData(dispatch(static_cast<uint8_t>(did), static_cast<uint8_t>(sdid), user_data.data(), user_data.size()));
+				found++;
+				i += 7 + size;
+			}
+			return found;
+		}
+
+		size_t decodeV210(const uint32_t* line, size_t words, uint32_t width, AncillaryContainer& out)
+		{
+			//v210 holds Cb Y Cr Y ... in three 10 bit samples per word
+			samples.resize(words * 3);
+			for (size_t w = 0; w < words; w++)
+			{
+				samples[w * 3] = line[w] & 0x3ff;
+				samples[w * 3 + 1] = (line[w] >> 10) & 0x3ff;
+				samples[w * 3 + 2] = (line[w] >> 20) & 0x3ff;
+			}
+
+			if (width <= 720)
+				return decodeSamples(samples.data(), samples.size(), out);
+
+			//HD carries separate packets in the luma and chroma streams
+			size_t half = samples.size() / 2;
+			chroma.resize(half);
+			for (size_t n = 0; n < half; n++)
+			{
+				chroma[n] = samples[n * 2];
+				samples[n] = samples[n * 2 + 1];
+			}
+			samples.resize(half);
+			return decodeSamples(samples.data(), samples.size(), out) + decodeSamples(chroma.data(), chroma.size(), out);
+		}
+	};
+
+	VancDecoder::VancDecoder() : impl_(new impl) {}
+	VancDecoder::~VancDecoder() {}
+	void VancDecoder::registerParser(uint8_t did, uint8_t sdid, AncillaryParser parser) { impl_->registerParser(did, sdid, std::move(parser)); }
+	size_t VancDecoder::decodeV210(const uint32_t* line, size_t words, uint32_t width, AncillaryContainer& out)
+	{
+		return impl_->decodeV210(line, words, width, out);
+	}
+	size_t VancDecoder::decodeSamples(const uint16_t* samples, size_t count, AncillaryContainer& out)
+	{
+		return impl_->decodeSamples(samples, count, out);
+	}
+	std::shared_ptr<AncillaryData> VancDecoder::decodePacket(uint8_t did, uint8_t sdid, const uint8_t* data, size_t size)
+	{
+		return impl_->dispatch(did, sdid, data, size);
+	}
+	const VancDecoderStats& VancDecoder::stats() const { return impl_->stats; }
+
+}}}
@@ -0,0 +1,67 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "ancillary.h"
+
+#include <functional>
+
+namespace caspar { namespace core { namespace ancillary {
+
+//Turns the user data words of one ancillary packet into AncillaryData, returns nullptr
+//when the payload is not understood so the packet is kept as RawAncillaryData
+typedef std::function<std::shared_ptr<AncillaryData>(const uint8_t* data, size_t size)> AncillaryParser;
+
+struct VancDecoderStats
+{
+    uint64_t packets = 0;
+    uint64_t parity_errors = 0;
+    uint64_t checksum_errors = 0;
+    uint64_t truncated = 0;
+};
+
+//Finds ancillary packets (SMPTE 291) in VANC lines and dispatches them by DID/SDID.
+//SCTE-104 and CEA-708 parsers are registered by default, other packets are kept opaque.
+class VancDecoder final
+{
+    public:
+        VancDecoder();
+        ~VancDecoder();
+
+        //Replaces the parser for did/sdid, an empty parser keeps those packets opaque
+        void registerParser(uint8_t did, uint8_t sdid, AncillaryParser parser);
+
+        //Decodes a v210 line of words 32 bit words, width > 720 searches the Y and C streams
+        //separately (HD), otherwise the interleaved stream (SD). Returns the number of packets added.
+        size_t decodeV210(const uint32_t* line, size_t words, uint32_t width, AncillaryContainer& out);
+
+        //Decodes one stream of 10 bit samples, returns the number of packets added
+        size_t decodeSamples(const uint16_t* samples, size_t count, AncillaryContainer& out);
+
+        //Dispatches the user data words of a packet that was already validated, e.g. from ST 2038
+        std::shared_ptr<AncillaryData> decodePacket(uint8_t did, uint8_t sdid, const uint8_t* data, size_t size);
+
+        const VancDecoderStats& stats() const;
+    private:
+        struct impl;
+        spl::unique_ptr<impl> impl_;
+};
+
+}}}
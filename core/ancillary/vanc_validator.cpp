@@ -0,0 +1,270 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "vanc_validator.h"
+
+#include "cea708/cea708.h"
+
+#include <cstdio>
+
+namespace caspar { namespace core { namespace ancillary {
+
+    static std::string hex(unsigned value, int digits)
+    {
+        char buf[16];
+        std::snprintf(buf, sizeof(buf), "0x%0*X", digits, value);
+        return buf;
+    }
+
+    static bool parity_ok(uint16_t word)
+    {
+        uint16_t expected = __builtin_parity(word & 0xff) ? 0x100 : 0x200;
+        return (word & 0x300) == expected;
+    }
+
+    std::string describe_vanc_errors(uint32_t errors)
+    {
+        static const std::pair<uint32_t, const char*> names[] = {
+            { vanc_error_parity, "parity" },
+            { vanc_error_checksum, "checksum" },
+            { vanc_error_truncated, "truncated" },
+            { vanc_error_did, "did" },
+            { vanc_error_scte_104, "scte-104" },
+            { vanc_error_cea708, "cea-708" }
+        };
+
+        std::string result;
+        for (auto& name : names)
+        {
+            if ((errors & name.first) == 0)
+                continue;
+            if (!result.empty())
+                result += ",";
+            result += name.second;
+        }
+        return result.empty() ? "ok" : result;
+    }
+
+    bool validateSCTE104(const uint8_t* data, size_t size, std::string& detail)
+    {
+        if (size < 1)
+        {
+            detail = "empty payload";
+            return false;
+        }
+
+        //Messages split over several packets can only be checked once reassembled
+        if (data[0] != 0x08)
+        {
+            detail = "payload descriptor " + hex(data[0], 2) + ", segmented message not checked";
+            return true;
+        }
+
+        if (size < 13)
+        {
+            detail = "multiple_operation_message header truncated, " + std::to_string(size) + " bytes";
+            return false;
+        }
+
+        uint16_t opid = (data[1] << 8) | data[2];
+        if (opid != 0xFFFF)
+        {
+            detail = "opID " + hex(opid, 4) + " is not a multiple_operation_message";
+            return false;
+        }
+
+        size_t message_size = (data[3] << 8) | data[4];
+        if (message_size < 12 || message_size > size - 1)
+        {
+            detail = "messageSize " + std::to_string(message_size) + " does not fit the " + std::to_string(size - 1) + " byte message";
+            return false;
+        }
+        size_t end = message_size + 1;
+
+        if (data[5] != 0)
+        {
+            detail = "protocol_version " + std::to_string(data[5]);
+            return false;
+        }
+
+        static const int timestamp_sizes[] = { 0, 6, 4, 2 };
+        uint8_t time_type = data[11];
+        if (time_type > 3)
+        {
+            detail = "time_type " + std::to_string(time_type);
+            return false;
+        }
+
+        size_t offset = 12 + timestamp_sizes[time_type];
+        if (offset + 1 > end)
+        {
+            detail = "timestamp truncated";
+            return false;
+        }
+
+        size_t num_ops = data[offset++];
+        std::string ops;
+        for (size_t op = 0; op < num_ops; op++)
+        {
+            if (offset + 4 > end)
+            {
+                detail = "operation " + std::to_string(op + 1) + " of " + std::to_string(num_ops) + " truncated";
+                return false;
+            }
+            uint16_t op_id = (data[offset] << 8) | data[offset + 1];
+            size_t data_length = (data[offset + 2] << 8) | data[offset + 3];
+            offset += 4;
+            if (offset + data_length > end)
+            {
+                detail = "operation " + hex(op_id, 4) + " data_length " + std::to_string(data_length) + " exceeds the message";
+                return false;
+            }
+            offset += data_length;
+            ops += (ops.empty() ? "" : " ") + hex(op_id, 4);
+        }
+
+        detail = "message_number " + std::to_string(data[7]) + " ops [" + ops + "]";
+        if (offset != end)
+        {
+            detail += ", " + std::to_string(end - offset) + " bytes after the last operation";
+            return false;
+        }
+        return true;
+    }
+
+    static void validate_payload(VancPacketReport& report, const std::vector<uint8_t>& data)
+    {
+        if (report.did == 0x41 && report.sdid == 0x07)
+        {
+            if (!validateSCTE104(data.data(), data.size(), report.detail))
+                report.errors |= vanc_error_scte_104;
+        }
+        else if (report.did == 0x61 && report.sdid == 0x01)
+        {
+            CEA708 captions(data.data(), data.size(), cdp);
+            if (captions.valid())
+                report.detail = "CDP";
+            else
+            {
+                report.detail = "malformed CDP";
+                report.errors |= vanc_error_cea708;
+            }
+        }
+    }
+
+    void validateVancSamples(const uint16_t* s, size_t count, uint32_t line, bool chroma, std::vector<VancPacketReport>& out)
+    {
+        std::vector<uint8_t> user_data;
+        size_t i = 0;
+        while (i + 3 <= count)
+        {
+            if (s[i] != 0x000 || s[i + 1] != 0x3ff || s[i + 2] != 0x3ff)
+            {
+                i++;
+                continue;
+            }
+
+            VancPacketReport report;
+            report.line = line;
+            report.offset = static_cast<uint32_t>(i);
+            report.chroma = chroma;
+
+            if (i + 7 > count)
+            {
+                report.errors = vanc_error_truncated;
+                out.push_back(std::move(report));
+                break;
+            }
+
+            uint16_t did = s[i + 3];
+            uint16_t sdid = s[i + 4];
+            uint16_t dc = s[i + 5];
+            report.did = static_cast<uint8_t>(did);
+            report.sdid = static_cast<uint8_t>(sdid);
+            report.data_count = static_cast<uint8_t>(dc);
+
+            if (!parity_ok(did) || !parity_ok(sdid) || !parity_ok(dc))
+                report.errors |= vanc_error_parity;
+            if (report.did == 0x00)
+                report.errors |= vanc_error_did;
+
+            size_t size = dc & 0xff;
+            if (i + 7 + size > count)
+            {
+                report.errors |= vanc_error_truncated;
+                out.push_back(std::move(report));
+                break;
+            }
+
+            uint16_t checksum = did + sdid + dc;
+            user_data.resize(size);
+            for (size_t n = 0; n < size; n++)
+            {
+                checksum += s[i + 6 + n];
+                user_data[n] = static_cast<uint8_t>(s[i + 6 + n]);
+            }
+            checksum &= 0x1ff;
+            checksum |= (~checksum & 0x100) << 1;
+            if (s[i + 6 + size] != checksum)
+                report.errors |= vanc_error_checksum;
+
+            //A payload is only meaningful when its words arrived intact
+            if ((report.errors & (vanc_error_parity | vanc_error_checksum)) == 0)
+                validate_payload(report, user_data);
+
+            out.push_back(std::move(report));
+            i += 7 + size;
+        }
+    }
+
+    void validateVancLine(const uint32_t* words, size_t count, uint32_t width, uint32_t line, std::vector<VancPacketReport>& out)
+    {
+        //v210 holds Cb Y Cr Y ... in three 10 bit samples per word
+        std::vector<uint16_t> samples(count * 3);
+        for (size_t w = 0; w < count; w++)
+        {
+            samples[w * 3] = words[w] & 0x3ff;
+            samples[w * 3 + 1] = (words[w] >> 10) & 0x3ff;
+            samples[w * 3 + 2] = (words[w] >> 20) & 0x3ff;
+        }
+
+        if (width <= 720)
+        {
+            validateVancSamples(samples.data(), samples.size(), line, false, out);
+            return;
+        }
+
+        std::vector<uint16_t> luma(samples.size() / 2);
+        std::vector<uint16_t> chroma(samples.size() / 2);
+        for (size_t n = 0; n < luma.size(); n++)
+        {
+            chroma[n] = samples[n * 2];
+            luma[n] = samples[n * 2 + 1];
+        }
+        validateVancSamples(luma.data(), luma.size(), line, false, out);
+        validateVancSamples(chroma.data(), chroma.size(), line, true, out);
+    }
+
+    void validateVancLines(const AncillaryLines& lines, std::vector<VancPacketReport>& out)
+    {
+        for (size_t n = 0; n < lines.size(); n++)
+            validateVancLine(lines.line(n), lines.line_words, lines.width, static_cast<uint32_t>(n), out);
+    }
+
+}}}
@@ -0,0 +1,67 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "ancillary.h"
+
+#include <string>
+
+namespace caspar { namespace core { namespace ancillary {
+
+enum vanc_error : uint32_t
+{
+    vanc_error_none = 0,
+    vanc_error_parity = 1,      //DID, SDID or data count has wrong parity bits
+    vanc_error_checksum = 2,
+    vanc_error_truncated = 4,   //the packet runs past the end of the line
+    vanc_error_did = 8,         //DID 0x00 is undefined
+    vanc_error_scte_104 = 16,   //malformed SCTE-104 multiple_operation_message
+    vanc_error_cea708 = 32      //malformed caption distribution packet
+};
+
+//The result of validating one ancillary packet (SMPTE 291) found in VANC
+struct VancPacketReport
+{
+    uint32_t line = 0;          //index of the line in AncillaryLines
+    uint32_t offset = 0;        //sample of the ADF in its stream
+    bool chroma = false;        //found in the C stream of an HD line
+    uint8_t did = 0;
+    uint8_t sdid = 0;
+    uint8_t data_count = 0;
+    uint32_t errors = vanc_error_none;
+    std::string detail;         //what the payload holds, or why it is malformed
+};
+
+//Comma separated names of the vanc_error flags in errors, "ok" when there are none
+std::string describe_vanc_errors(uint32_t errors);
+
+//Validates every packet of one stream of 10 bit samples and appends a report for each
+void validateVancSamples(const uint16_t* samples, size_t count, uint32_t line, bool chroma, std::vector<VancPacketReport>& out);
+
+//Validates a v210 line, width > 720 checks the Y and C streams separately (HD), as VancDecoder::decodeV210
+void validateVancLine(const uint32_t* words, size_t count, uint32_t width, uint32_t line, std::vector<VancPacketReport>& out);
+
+//Validates all lines as packed by AncillaryContainer::packAncillaryLines
+void validateVancLines(const AncillaryLines& lines, std::vector<VancPacketReport>& out);
+
+//Checks the structure of an SCTE-104 payload as carried in VANC (SMPTE 2010), detail describes it
+bool validateSCTE104(const uint8_t* data, size_t size, std::string& detail);
+
+}}}
@@ -0,0 +1,351 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "../../StdAfx.h"
+
+#include "anc_monitor_consumer.h"
+
+#include "../frame_consumer.h"
+#include "../../ancillary/vanc_validator.h"
+#include "../../frame/frame.h"
+#include "../../help/help_sink.h"
+#include "../../help/help_repository.h"
+#include "../../module_dependencies.h"
+#include "../../monitor/monitor.h"
+#include "../../video_format.h"
+
+#include <common/env.h>
+#include <common/executor.h>
+#include <common/future.h>
+#include <common/log.h>
+#include <common/param.h>
+#include <common/timer.h>
+#include <common/utf.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+
+namespace caspar { namespace core { namespace anc_monitor {
+
+const int MAX_PENDING_FRAMES = 8;
+
+static std::string json_escape(const std::string& str)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	std::string result;
+	for (auto c : str)
+	{
+		auto byte = static_cast<unsigned char>(c);
+
+		if (c == '"' || c == '\\')
+		{
+			result += '\\';
+			result += c;
+		}
+		else if (c == '\n')
+			result += "\\n";
+		else if (c == '\r')
+			result += "\\r";
+		else if (c == '\t')
+			result += "\\t";
+		else if (byte < 0x20)
+		{
+			result += "\\u00";
+			result += hex[byte >> 4];
+			result += hex[byte & 0x0f];
+		}
+		else
+			result += c;
+	}
+	return result;
+}
+
+static bool is_within(const boost::filesystem::path& folder, const boost::filesystem::path& root)
+{
+	return std::mismatch(root.begin(), root.end(), folder.begin(), folder.end()).first == root.end();
+}
+
+// The trace file may only be in the log or media folder, relative paths are taken from the log folder
+static boost::filesystem::path trace_file_path(const std::wstring& trace_path)
+{
+	auto path = boost::filesystem::path(trace_path);
+	if (!path.is_absolute())
+		path = boost::filesystem::path(env::log_folder()) / path;
+
+	boost::system::error_code ec;
+	auto folder = boost::filesystem::canonical(path.parent_path(), ec);
+	auto filename = path.filename();
+
+	// Links are resolved before the check, a link as the file itself could point anywhere
+	if (!ec && filename != L"." && filename != L".." && !boost::filesystem::is_symlink(path))
+	{
+		for (auto& allowed : { env::log_folder(), env::media_folder() })
+		{
+			auto root = boost::filesystem::canonical(allowed, ec);
+			if (!ec && is_within(folder, root))
+				return folder / filename;
+		}
+	}
+
+	CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"Ancillary trace file must be in the log or media folder: " + trace_path));
+}
+
+// Validates the VANC packets of every outgoing frame on its own thread, frames are dropped rather
+// than delaying the channel when it falls behind.
+class anc_monitor_consumer : public frame_consumer
+{
+	monitor::subject						monitor_subject_;
+	const std::wstring						trace_path_;
+	std::ofstream							trace_;
+	int										channel_index_		= -1;
+	video_format_desc						format_desc_;
+
+	std::atomic<int64_t>					frames_checked_;
+	std::atomic<int64_t>					frames_dropped_;
+	std::atomic<int64_t>					packets_checked_;
+	std::atomic<int64_t>					packet_errors_;
+
+	std::vector<ancillary::VancPacketReport>	reports_;
+	caspar::timer							log_timer_;
+	bool									logged_			= false;
+
+	executor								executor_		{ L"anc_monitor_consumer" };
+public:
+	anc_monitor_consumer(const std::wstring& trace_path)
+		: trace_path_(trace_path)
+	{
+		frames_checked_		= 0;
+		frames_dropped_		= 0;
+		packets_checked_	= 0;
+		packet_errors_		= 0;
+
+		if (!trace_path_.empty())
+		{
+			auto path = trace_file_path(trace_path_);
+
+			trace_.open(path.string(), std::ios::out | std::ios::app);
+			if (!trace_)
+				CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"Could not open ancillary trace file " + path.wstring()));
+		}
+	}
+
+	~anc_monitor_consumer()
+	{
+		executor_.clear();
+		executor_.invoke([] { });
+	}
+
+	// frame_consumer
+
+	void initialize(const video_format_desc& format_desc, const audio_channel_layout& channel_layout, int channel_index) override
+	{
+		executor_.invoke([=]
+		{
+			format_desc_	= format_desc;
+			channel_index_	= channel_index;
+		});
+	}
+
+	std::future<bool> send(const_frame frame) override
+	{
+		if (executor_.size() >= MAX_PENDING_FRAMES)
+		{
+			++frames_dropped_;
+			return make_ready_future(true);
+		}
+
+		executor_.begin_invoke([=]
+		{
+			check(frame);
+		});
+
+		return make_ready_future(true);
+	}
+
+	monitor::subject& monitor_output() override
+	{
+		return monitor_subject_;
+	}
+
+	std::wstring print() const override
+	{
+		return L"anc-monitor[" + boost::lexical_cast<std::wstring>(channel_index_) + L"]";
+	}
+
+	std::wstring name() const override
+	{
+		return L"anc-monitor";
+	}
+
+	boost::property_tree::wptree info() const override
+	{
+		boost::property_tree::wptree info;
+		info.add(L"type",				L"anc-monitor");
+		info.add(L"trace-file",			trace_path_);
+		info.add(L"frames-checked",		frames_checked_.load());
+		info.add(L"frames-dropped",		frames_dropped_.load());
+		info.add(L"packets-checked",	packets_checked_.load());
+		info.add(L"packet-errors",		packet_errors_.load());
+		return info;
+	}
+
+	bool has_synchronization_clock() const override
+	{
+		return false;
+	}
+
+	int buffer_depth() const override
+	{
+		return -1;
+	}
+
+	int index() const override
+	{
+		return 71000;
+	}
+
+	int64_t presentation_frame_age_millis() const override
+	{
+		return 0;
+	}
+private:
+	void check(const const_frame& frame)
+	{
+		reports_.clear();
+
+		if (!frame.ancillary().empty())
+			ancillary::validateVancLines(*frame.ancillary().getAncillaryAsLines(format_desc_.width), reports_);
+
+		int64_t errors = 0;
+		for (auto& report : reports_)
+		{
+			auto error_names = ancillary::describe_vanc_errors(report.errors);
+
+			monitor_subject_ << monitor::message("/ancillary/packet")
+					% static_cast<int32_t>(report.line)
+					% static_cast<int32_t>(report.offset)
+					% static_cast<int32_t>(report.did)
+					% static_cast<int32_t>(report.sdid)
+					% static_cast<int32_t>(report.data_count)
+					% error_names
+					% report.detail;
+
+			if (report.errors != ancillary::vanc_error_none)
+			{
+				++errors;
+				log_error(report, error_names);
+			}
+		}
+
+		packets_checked_ += reports_.size();
+		packet_errors_ += errors;
+
+		monitor_subject_
+				<< monitor::message("/ancillary/packets") % static_cast<int64_t>(reports_.size())
+				<< monitor::message("/ancillary/errors") % errors % packet_errors_.load()
+				<< monitor::message("/ancillary/dropped") % frames_dropped_.load();
+
+		if (trace_.is_open())
+			write_trace();
+
+		++frames_checked_;
+	}
+
+	// At most one packet error is logged per second, OSC and the trace file carry them all
+	void log_error(const ancillary::VancPacketReport& report, const std::string& error_names)
+	{
+		if (logged_ && log_timer_.elapsed() < 1.0)
+			return;
+
+		logged_ = true;
+		log_timer_.restart();
+
+		CASPAR_LOG(warning) << print() << L" line " << report.line << (report.chroma ? L" C" : L" Y") << L" offset " << report.offset
+				<< L" DID " << static_cast<int>(report.did) << L" SDID " << static_cast<int>(report.sdid)
+				<< L": " << u16(error_names) << L" " << u16(report.detail);
+	}
+
+	void write_trace()
+	{
+		trace_ << "{\"frame\":" << frames_checked_.load() << ",\"packets\":[";
+		for (size_t n = 0; n < reports_.size(); n++)
+		{
+			auto& report = reports_[n];
+			trace_ << (n == 0 ? "" : ",")
+				<< "{\"line\":" << report.line
+				<< ",\"offset\":" << report.offset
+				<< ",\"stream\":\"" << (report.chroma ? "C" : "Y") << "\""
+				<< ",\"did\":" << static_cast<int>(report.did)
+				<< ",\"sdid\":" << static_cast<int>(report.sdid)
+				<< ",\"dc\":" << static_cast<int>(report.data_count)
+				<< ",\"errors\":\"" << ancillary::describe_vanc_errors(report.errors) << "\""
+				<< ",\"detail\":\"" << json_escape(report.detail) << "\"}";
+		}
+		trace_ << "]}\n";
+		trace_.flush();
+	}
+};
+
+void describe_consumer(core::help_sink& sink, const core::help_repository& repo)
+{
+	sink.short_description(L"Validates the ancillary data of every outgoing frame.");
+	sink.syntax(L"ANC-MONITOR {TRACE [file:string]}");
+	sink.para()->text(L"Decodes the VANC packets of every frame of the channel and checks DID/SDID, data count, parity, checksum and SCTE-104 message structure. ")
+		->text(L"Every packet is sent on OSC as /ancillary/packet with line, offset, DID, SDID, data count, errors and a description, errors are also logged.");
+	sink.para()->text(L"The checks run on their own thread, frames are skipped when it falls behind so the channel is never delayed.");
+	sink.definitions()
+		->item(L"file", L"Appends one JSON line per frame with its packets to this file, relative to the log folder. It has to be in the log or media folder.");
+	sink.para()->text(L"Examples:");
+	sink.example(L">> ADD 1 ANC-MONITOR");
+	sink.example(L">> ADD 1 ANC-MONITOR TRACE anc_trace.jsonl");
+}
+
+spl::shared_ptr<core::frame_consumer> create_consumer(
+		const std::vector<std::wstring>& params,
+		core::interaction_sink*,
+		std::vector<spl::shared_ptr<video_channel>> channels)
+{
+	if (params.size() < 1 || !boost::iequals(params.at(0), L"ANC-MONITOR"))
+		return core::frame_consumer::empty();
+
+	return spl::make_shared<anc_monitor_consumer>(get_param(L"TRACE", params, L""));
+}
+
+spl::shared_ptr<core::frame_consumer> create_preconfigured_consumer(
+		const boost::property_tree::wptree& ptree,
+		core::interaction_sink*,
+		std::vector<spl::shared_ptr<video_channel>> channels)
+{
+	return spl::make_shared<anc_monitor_consumer>(ptree.get(L"trace-file", L""));
+}
+
+void init(module_dependencies dependencies)
+{
+	dependencies.consumer_registry->register_consumer_factory(L"Ancillary Monitor Consumer", &create_consumer, &describe_consumer);
+	dependencies.consumer_registry->register_preconfigured_consumer_factory(L"anc-monitor", &create_preconfigured_consumer);
+}
+
+}}}
@@ -178,6 +178,7 @@ draw_frame draw_frame::mask(draw_frame fill, draw_frame key)
 
 	std::vector<draw_frame> frames;
 	key.transform().image_transform.is_key = true;
+	key.transform().image_transform.is_paired_key = true;
 	frames.push_back(std::move(key));
 	frames.push_back(std::move(fill));
 	return draw_frame(std::move(frames));
@@ -27,13 +27,14 @@
 #include <common/array.h>
 #include <common/future.h>
 #include <common/timer.h>
-#include <common/memshfl.h>
 
 #include <core/frame/frame_visitor.h>
+#include <core/frame/keying.h>
 #include <core/frame/pixel_format.h>
 #include <core/frame/geometry.h>
 #include <core/frame/audio_channel_layout.h>
 
+#include <atomic>
 #include <cstdint>
 #include <vector>
 
@@ -49,6 +50,7 @@ struct mutable_frame::impl : boost::noncopyable
 	const core::audio_channel_layout			channel_layout_;
 	const void*									tag_;
 	core::frame_geometry						geometry_				= frame_geometry::get_default();
+	bool										opaque_					= false;
 	caspar::timer								since_created_timer_;
 
 	impl(
@@ -95,8 +97,21 @@ std::size_t mutable_frame::height() const{return impl_->desc_.planes.at(0).heigh
 const void* mutable_frame::stream_tag()const{return impl_->tag_;}
 const frame_geometry& mutable_frame::geometry() const { return impl_->geometry_; }
 void mutable_frame::set_geometry(const frame_geometry& g) { impl_->geometry_ = g; }
+bool mutable_frame::is_opaque() const { return impl_->opaque_; }
+void mutable_frame::set_opaque(bool opaque) { impl_->opaque_ = opaque; }
 caspar::timer mutable_frame::since_created() const { return impl_->since_created_timer_; }
 
+namespace {
+
+std::uint64_t next_image_id()
+{
+	static std::atomic<std::uint64_t> last_id(0);
+
+	return ++last_id;
+}
+
+}
+
 const const_frame& const_frame::empty()
 {
 	static int dummy;
@@ -112,6 +127,8 @@ struct const_frame::impl : boost::noncopyable
 	const core::audio_channel_layout									channel_layout_;
 	const void*															tag_;
 	core::frame_geometry												geometry_;
+	bool																opaque_					= false;
+	std::uint64_t														image_id_				= 0;
 	caspar::timer														since_created_timer_;
 	bool																should_record_age_;
 	mutable std::atomic<int64_t>										recorded_age_;
@@ -136,6 +153,8 @@ struct const_frame::impl : boost::noncopyable
 		, channel_layout_(other.channel_layout_)
 		, tag_(other.tag_)
 		, geometry_(other.geometry_)
+		, opaque_(other.opaque_)
+		, image_id_(other.image_id_)
 		, since_created_timer_(other.since_created_timer_)
 		, should_record_age_(other.should_record_age_)
 		, key_only_on_demand_(other.key_only_on_demand_)
@@ -156,6 +175,7 @@ struct const_frame::impl : boost::noncopyable
 		, channel_layout_(channel_layout)
 		, tag_(tag)
 		, geometry_(frame_geometry::get_default())
+		, image_id_(next_image_id())
 		, since_created_timer_(std::move(since_created_timer))
 		, should_record_age_(false)
 		, ancillary_data_(std::move(ancillary_data))
@@ -170,7 +190,7 @@ struct const_frame::impl : boost::noncopyable
 			auto fill	= image.get();
 			auto key	= cache_aligned_vector<std::uint8_t>(fill.size());
 
-			aligned_memshfl(key.data(), fill.data(), fill.size(), 0x0F0F0F0F, 0x0B0B0B0B, 0x07070707, 0x03030303);
+			extract_key(fill.data(), key.data(), fill.size());
 
 			return array<const std::uint8_t>(key.data(), key.size(), false, std::move(key));
 		}).share();
@@ -182,6 +202,8 @@ struct const_frame::impl : boost::noncopyable
 		, channel_layout_(other.audio_channel_layout())
 		, tag_(other.stream_tag())
 		, geometry_(other.geometry())
+		, opaque_(other.is_opaque())
+		, image_id_(next_image_id())
 		, since_created_timer_(other.since_created())
 		, should_record_age_(true)
 	{
@@ -222,6 +244,24 @@ struct const_frame::impl : boost::noncopyable
 		return tag_ != empty().stream_tag() ? desc_.planes.at(0).size : 0;
 	}
 
+	bool is_opaque() const
+	{
+		if (tag_ == empty().stream_tag())
+			return false;
+
+		switch (desc_.format)
+		{
+		case core::pixel_format::gray:
+		case core::pixel_format::ycbcr:
+		case core::pixel_format::luma:
+		case core::pixel_format::bgr:
+		case core::pixel_format::rgb:
+			return true;
+		default:
+			return opaque_;
+		}
+	}
+
 	int64_t get_age_millis() const
 	{
 		if (should_record_age_)
@@ -282,6 +322,19 @@ const_frame const_frame::with_geometry(const frame_geometry& g) const
 
 	return copy;
 }
+const_frame const_frame::with_audio(audio_buffer audio_data, core::ancillary::AncillaryContainer ancillary_data) const
+{
+	const_frame copy(*impl_);
+
+	copy.impl_->audio_data_		= std::move(audio_data);
+	copy.impl_->ancillary_data_	= std::move(ancillary_data);
+	copy.impl_->since_created_timer_.restart();
+	copy.impl_->recorded_age_	= -1;
+
+	return copy;
+}
+bool const_frame::is_opaque() const { return impl_->is_opaque(); }
+std::uint64_t const_frame::image_id() const { return impl_->image_id_; }
 int64_t const_frame::get_age_millis() const { return impl_->get_age_millis(); }
 const_frame const_frame::key_only() const
 {
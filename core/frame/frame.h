@@ -60,6 +60,9 @@ public:
 	const core::frame_geometry& geometry() const;
 	void set_geometry(const frame_geometry& g);
 
+	bool is_opaque() const;
+	void set_opaque(bool opaque);
+
 	caspar::timer since_created() const;
 
 private:
@@ -114,6 +117,12 @@ public:
 
 	const core::frame_geometry& geometry() const;
 	const_frame with_geometry(const frame_geometry& g) const;
+	const_frame with_audio(audio_buffer audio_data, core::ancillary::AncillaryContainer ancillary_data) const;
+	bool is_opaque() const;
+
+	// Frames share an image id only if they share their image buffers, so an
+	// unchanged id means an unchanged image. Empty frames have id 0.
+	std::uint64_t image_id() const;
 	int64_t get_age_millis() const;
 
 	bool operator==(const const_frame& other);
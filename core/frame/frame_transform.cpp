@@ -101,10 +101,12 @@ image_transform& image_transform::operator*=(const image_transform &other)
 	chroma.spill_suppress_saturation	 = std::min(other.chroma.spill_suppress_saturation, chroma.spill_suppress_saturation);
 	field_mode							 = field_mode & other.field_mode;
 	is_key								|= other.is_key;
+	is_paired_key						|= other.is_paired_key;
 	is_mix								|= other.is_mix;
 	use_mipmap							|= other.use_mipmap;
 	blend_mode							 = std::max(blend_mode, other.blend_mode);
 	layer_depth							+= other.layer_depth;
+	is_isolated							 = other.is_isolated;
 
 	return *this;
 }
@@ -173,10 +175,12 @@ image_transform image_transform::tween(double time, const image_transform& sourc
 	result.chroma.show_mask					= dest.chroma.show_mask;
 	result.field_mode						= source.field_mode & dest.field_mode;
 	result.is_key							= source.is_key | dest.is_key;
+	result.is_paired_key					= source.is_paired_key | dest.is_paired_key;
 	result.is_mix							= source.is_mix | dest.is_mix;
 	result.use_mipmap						= source.use_mipmap | dest.use_mipmap;
 	result.blend_mode						= std::max(source.blend_mode, dest.blend_mode);
 	result.layer_depth						= dest.layer_depth;
+	result.is_isolated						= dest.is_isolated;
 
 	do_tween_rectangle(source.crop, dest.crop, result.crop, time, duration, tween);
 	do_tween_corners(source.perspective, dest.perspective, result.perspective, time, duration, tween);
@@ -220,10 +224,12 @@ bool operator==(const image_transform& lhs, const image_transform& rhs)
 		eq(lhs.angle, rhs.angle) &&
 		lhs.field_mode == rhs.field_mode &&
 		lhs.is_key == rhs.is_key &&
+		lhs.is_paired_key == rhs.is_paired_key &&
 		lhs.is_mix == rhs.is_mix &&
 		lhs.use_mipmap == rhs.use_mipmap &&
 		lhs.blend_mode == rhs.blend_mode &&
 		lhs.layer_depth == rhs.layer_depth &&
+		lhs.is_isolated == rhs.is_isolated &&
 		lhs.chroma.enable == rhs.chroma.enable &&
 		lhs.chroma.show_mask == rhs.chroma.show_mask &&
 		eq(lhs.chroma.target_hue, rhs.chroma.target_hue) &&
@@ -233,6 +239,11 @@ bool operator==(const image_transform& lhs, const image_transform& rhs)
 		eq(lhs.chroma.softness, rhs.chroma.softness) &&
 		eq(lhs.chroma.spill_suppress, rhs.chroma.spill_suppress) &&
 		eq(lhs.chroma.spill_suppress_saturation, rhs.chroma.spill_suppress_saturation) &&
+		eq(lhs.levels.min_input, rhs.levels.min_input) &&
+		eq(lhs.levels.max_input, rhs.levels.max_input) &&
+		eq(lhs.levels.gamma, rhs.levels.gamma) &&
+		eq(lhs.levels.min_output, rhs.levels.min_output) &&
+		eq(lhs.levels.max_output, rhs.levels.max_output) &&
 		lhs.crop == rhs.crop &&
 		lhs.perspective == rhs.perspective;
 }
@@ -100,10 +100,12 @@ struct image_transform final
 
 	core::field_mode		field_mode			= core::field_mode::progressive;
 	bool					is_key				= false;
+	bool					is_paired_key		= false;	// Keys only the next frame, which has the same transform. The mixer may sample it while drawing that frame.
 	bool					is_mix				= false;
 	bool					use_mipmap			= false;
 	core::blend_mode		blend_mode			= core::blend_mode::normal;
 	int						layer_depth			= 0;
+	bool					is_isolated			= false;	// Contents are drawn into an image of their own first, transforms apply to that image as a whole.
 
 	image_transform& operator*=(const image_transform &other);
 	image_transform operator*(const image_transform &other) const;
@@ -0,0 +1,63 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "../StdAfx.h"
+
+#include "keying.h"
+
+#include <tmmintrin.h>
+
+namespace caspar { namespace core {
+
+void extract_key(const std::uint8_t* source, std::uint8_t* dest, std::size_t size)
+{
+	const auto alpha = _mm_set_epi32(0x0F0F0F0F, 0x0B0B0B0B, 0x07070707, 0x03030303);
+
+	std::size_t n = 0;
+
+	// Bypasses the cache when it can, as the key is usually read next by an
+	// output card.
+	if (reinterpret_cast<std::uintptr_t>(dest) % 16 == 0)
+	{
+		for (; n + 64 <= size; n += 64)
+		{
+			auto source128	= reinterpret_cast<const __m128i*>(source + n);
+			auto dest128	= reinterpret_cast<__m128i*>(dest + n);
+
+			_mm_stream_si128(dest128,		_mm_shuffle_epi8(_mm_loadu_si128(source128),		alpha));
+			_mm_stream_si128(dest128 + 1,	_mm_shuffle_epi8(_mm_loadu_si128(source128 + 1),	alpha));
+			_mm_stream_si128(dest128 + 2,	_mm_shuffle_epi8(_mm_loadu_si128(source128 + 2),	alpha));
+			_mm_stream_si128(dest128 + 3,	_mm_shuffle_epi8(_mm_loadu_si128(source128 + 3),	alpha));
+		}
+
+		_mm_sfence();
+	}
+
+	for (; n + 16 <= size; n += 16)
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + n), _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + n)), alpha));
+
+	for (; n + 4 <= size; n += 4)
+	{
+		auto a = source[n + 3];
+
+		dest[n] = dest[n + 1] = dest[n + 2] = dest[n + 3] = a;
+	}
+}
+
+}}
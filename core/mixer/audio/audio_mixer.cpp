@@ -22,6 +22,7 @@
 #include "../../StdAfx.h"
 
 #include "audio_mixer.h"
+#include "loudness_meter.h"
 
 #include <core/frame/frame.h>
 #include <core/frame/frame_transform.h>
@@ -29,12 +30,15 @@
 #include <core/monitor/monitor.h>
 
 #include <common/diagnostics/graph.h>
+#include <common/env.h>
 
 #include <boost/range/adaptors.hpp>
 #include <boost/range/distance.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/property_tree/ptree.hpp>
 
 #include <map>
+#include <set>
 #include <stack>
 #include <vector>
 
@@ -46,6 +50,7 @@ struct audio_item
 	audio_transform			transform;
 	audio_buffer			audio_data;
 	audio_channel_layout	channel_layout	= audio_channel_layout::invalid();
+	int						layer			= std::numeric_limits<int>::min();
 
 	audio_item()
 	{
@@ -56,6 +61,7 @@ struct audio_item
 		, transform(std::move(other.transform))
 		, audio_data(std::move(other.audio_data))
 		, channel_layout(std::move(other.channel_layout))
+		, layer(other.layer)
 	{
 	}
 };
@@ -83,6 +89,11 @@ struct audio_mixer::impl : boost::noncopyable
 	float								master_volume_			= 1.0f;
 	float								previous_master_volume_	= master_volume_;
 	spl::shared_ptr<diagnostics::graph>	graph_;
+	std::unique_ptr<loudness_meter>		loudness_meter_;
+	const bool							loudness_per_layer_		= env::properties().get(L"configuration.mixer.loudness-per-layer", false);
+	std::map<int, std::unique_ptr<loudness_meter>>	layer_loudness_meters_;
+	std::set<int>						current_layers_;
+	int									current_layer_			= std::numeric_limits<int>::min();
 public:
 	impl(spl::shared_ptr<diagnostics::graph> graph)
 		: graph_(std::move(graph))
@@ -107,6 +118,7 @@ public:
 		item.transform		= transform_stack_.top();
 		item.audio_data		= frame.audio_data();
 		item.channel_layout = frame.audio_channel_layout();
+		item.layer			= current_layer_;
 
 		if(item.transform.is_still)
 			item.transform.volume = 0.0;
@@ -129,6 +141,35 @@ public:
 		return master_volume_;
 	}
 
+	void set_current_layer(int index)
+	{
+		current_layer_ = index;
+		current_layers_.insert(index);
+	}
+
+	boost::property_tree::wptree loudness_info() const
+	{
+		boost::property_tree::wptree info;
+
+		if (loudness_meter_)
+			info = loudness_meter_->info();
+
+		for (auto& layer : layer_loudness_meters_)
+			info.add_child(L"layers.layer", layer.second->info())
+				.add(L"index", layer.first);
+
+		return info;
+	}
+
+	void reset_loudness()
+	{
+		if (loudness_meter_)
+			loudness_meter_->reset();
+
+		for (auto& layer : layer_loudness_meters_)
+			layer.second->reset();
+	}
+
 	audio_buffer mix(const video_format_desc& format_desc, const audio_channel_layout& channel_layout)
 	{
 		if(format_desc_ != format_desc || channel_layout_ != channel_layout)
@@ -137,9 +178,12 @@ public:
 			audio_cadence_ = format_desc.audio_cadence;
 			format_desc_ = format_desc;
 			channel_layout_ = channel_layout;
+			loudness_meter_.reset(new loudness_meter(format_desc.audio_sample_rate, loudness_meter::channel_weights(channel_layout)));
+			layer_loudness_meters_.clear();
 		}
 
 		std::map<const void*, audio_stream>	next_audio_streams;
+		std::map<int, audio_buffer_ps>		layer_audio;
 
 		for (auto& item : items_)
 		{
@@ -210,12 +254,25 @@ public:
 			// TODO: Move volume mixing into code below, in order to support audio sample counts not corresponding to frame audio samples.
 			auto alpha = (next_volume-prev_volume)/static_cast<double>(item.audio_data.size()/channel_layout_.num_channels);
 
+			auto first_new_sample = next_audio.size();
+
 			for(size_t n = 0; n < item.audio_data.size(); ++n)
 			{
 				auto sample_multiplier = (prev_volume + (n / channel_layout_.num_channels) * alpha);
 				next_audio.push_back(item.audio_data.data()[n] * sample_multiplier);
 			}
 
+			if (loudness_per_layer_ && item.layer != std::numeric_limits<int>::min())
+			{
+				auto& layer = layer_audio[item.layer];
+				auto new_samples = next_audio.size() - first_new_sample;
+
+				if (layer.size() < new_samples)
+					layer.resize(new_samples, 0.0);
+
+				std::transform(next_audio.begin() + first_new_sample, next_audio.end(), layer.begin(), layer.begin(), std::plus<double>());
+			}
+
 			next_audio_streams[tag].prev_transform		= std::move(next_transform); // Store all active tags, inactive tags will be removed at the end.
 			next_audio_streams[tag].audio_data			= std::move(next_audio);
 			next_audio_streams[tag].channel_remapper	= std::move(channel_remapper);
@@ -225,6 +282,12 @@ public:
 
 		previous_master_volume_ = master_volume_;
 		items_.clear();
+		current_layer_ = std::numeric_limits<int>::min();
+
+		if (loudness_per_layer_)
+			measure_layer_loudness(std::move(layer_audio), audio_size(audio_cadence_.front()));
+
+		current_layers_.clear();
 
 		audio_streams_ = std::move(next_audio_streams);
 
@@ -300,9 +363,51 @@ public:
 
 		graph_->set_value("volume", static_cast<double>(*boost::max_element(max)) / std::numeric_limits<int32_t>::max());
 
+		loudness_meter_->process(result.data(), result.size() / num_channels);
+		send_loudness(*loudness_meter_, "");
+
 		return caspar::array<int32_t>(result.data(), result.size(), true, std::move(result_owner));
 	}
 
+	void measure_layer_loudness(std::map<int, audio_buffer_ps> layer_audio, std::size_t frame_size)
+	{
+		// Meters of layers that are no longer on the stage are dropped, the
+		// others are fed silence when they have no audio in this tick so that
+		// they keep running in step with the channel.
+		for (auto it = layer_loudness_meters_.begin(); it != layer_loudness_meters_.end();)
+		{
+			if (current_layers_.find(it->first) == current_layers_.end())
+				it = layer_loudness_meters_.erase(it);
+			else
+				layer_audio[(it++)->first];
+		}
+
+		for (auto& layer : layer_audio)
+		{
+			auto& meter = layer_loudness_meters_[layer.first];
+
+			if (!meter)
+				meter.reset(new loudness_meter(format_desc_.audio_sample_rate, loudness_meter::channel_weights(channel_layout_)));
+
+			if (layer.second.empty())
+				layer.second.resize(frame_size, 0.0);
+
+			meter->process(layer.second.data(), layer.second.size() / channel_layout_.num_channels);
+			send_loudness(*meter, "/layer/" + boost::lexical_cast<std::string>(layer.first));
+		}
+	}
+
+	void send_loudness(const loudness_meter& meter, const std::string& prefix)
+	{
+		monitor_subject_ << monitor::message(prefix + "/loudness/momentary") % static_cast<float>(meter.momentary());
+		monitor_subject_ << monitor::message(prefix + "/loudness/short-term") % static_cast<float>(meter.short_term());
+		monitor_subject_ << monitor::message(prefix + "/loudness/integrated") % static_cast<float>(meter.integrated());
+		monitor_subject_ << monitor::message(prefix + "/loudness/true-peak") % static_cast<float>(meter.max_true_peak());
+
+		for (int i = 0; i < meter.num_channels(); ++i)
+			monitor_subject_ << monitor::message(prefix + "/" + boost::lexical_cast<std::string>(i + 1) + "/dBTP") % static_cast<float>(meter.true_peak(i));
+	}
+
 	size_t audio_size(size_t num_samples) const
 	{
 		return num_samples * channel_layout_.num_channels;
@@ -315,6 +420,9 @@ void audio_mixer::visit(const const_frame& frame){impl_->visit(frame);}
 void audio_mixer::pop(){impl_->pop();}
 void audio_mixer::set_master_volume(float volume) { impl_->set_master_volume(volume); }
 float audio_mixer::get_master_volume() { return impl_->get_master_volume(); }
+void audio_mixer::set_current_layer(int index) { impl_->set_current_layer(index); }
+boost::property_tree::wptree audio_mixer::loudness_info() const { return impl_->loudness_info(); }
+void audio_mixer::reset_loudness() { impl_->reset_loudness(); }
 audio_buffer audio_mixer::operator()(const video_format_desc& format_desc, const audio_channel_layout& channel_layout){ return impl_->mix(format_desc, channel_layout); }
 monitor::subject& audio_mixer::monitor_output(){ return impl_->monitor_subject_; }
 
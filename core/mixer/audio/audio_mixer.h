@@ -29,6 +29,8 @@
 #include <core/frame/frame_visitor.h>
 #include <core/monitor/monitor.h>
 
+#include <boost/property_tree/ptree_fwd.hpp>
+
 #include <vector>
 #include <cstdint>
 
@@ -55,6 +57,8 @@ public:
 	audio_buffer operator()(const struct video_format_desc& format_desc, const struct audio_channel_layout& channel_layout);
 	void set_master_volume(float volume); 
 	float get_master_volume();
+	void set_current_layer(int index);
+	void reset_loudness();
 	monitor::subject& monitor_output();
 
 	// frame_visitor
@@ -65,6 +69,7 @@ public:
 	
 	// Properties
 
+	boost::property_tree::wptree loudness_info() const;
 private:
 	struct impl;
 	spl::shared_ptr<impl> impl_;
@@ -0,0 +1,505 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "../../StdAfx.h"
+
+#include "loudness_meter.h"
+
+#include <core/frame/audio_channel_layout.h>
+
+#include <common/except.h>
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/math/constants/constants.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+
+#include <emmintrin.h>
+
+namespace caspar { namespace core {
+
+namespace {
+
+const double	MINUS_INFINITY			= -std::numeric_limits<double>::infinity();
+const double	INT32_SCALE				= 1.0 / 2147483648.0;
+
+const int		SUB_BLOCKS_PER_SECOND	= 10;	// 100 ms sub-blocks
+const int		MOMENTARY_SUB_BLOCKS	= 4;	// 400 ms, also the gating block length (75 % overlap)
+const int		SHORT_TERM_SUB_BLOCKS	= 30;	// 3 s
+
+const double	ABSOLUTE_GATE			= -70.0;
+const double	RELATIVE_GATE			= -10.0;
+const double	HISTOGRAM_MAX			= 30.0;
+const int		HISTOGRAM_BINS_PER_LU	= 10;
+const int		HISTOGRAM_BINS			= static_cast<int>((HISTOGRAM_MAX - ABSOLUTE_GATE) * HISTOGRAM_BINS_PER_LU);
+
+const int		TRUE_PEAK_PHASES		= 4;
+const int		TRUE_PEAK_TAPS			= 12;	// per phase, 48 in total
+
+double to_loudness(double energy)
+{
+	return energy > 0.0 ? -0.691 + 10.0 * std::log10(energy) : MINUS_INFINITY;
+}
+
+double to_db(double peak)
+{
+	return peak > 0.0 ? 20.0 * std::log10(peak) : MINUS_INFINITY;
+}
+
+struct biquad_coefficients
+{
+	double b0, b1, b2, a1, a2;
+};
+
+// BS.1770-4 K-weighting, pre-filter (high shelf) and RLB filter (high pass)
+// derived for an arbitrary sample rate. At 48 kHz these give the
+// coefficients tabulated in the recommendation.
+biquad_coefficients shelf_filter(double sample_rate)
+{
+	const double f0	= 1681.974450955533;
+	const double g	= 3.999843853973347;
+	const double q	= 0.7071752369554196;
+
+	const double k	= std::tan(boost::math::constants::pi<double>() * f0 / sample_rate);
+	const double vh	= std::pow(10.0, g / 20.0);
+	const double vb	= std::pow(vh, 0.4996667741545416);
+	const double a0	= 1.0 + k / q + k * k;
+
+	return {
+		(vh + vb * k / q + k * k) / a0,
+		2.0 * (k * k - vh) / a0,
+		(vh - vb * k / q + k * k) / a0,
+		2.0 * (k * k - 1.0) / a0,
+		(1.0 - k / q + k * k) / a0
+	};
+}
+
+biquad_coefficients high_pass_filter(double sample_rate)
+{
+	const double f0	= 38.13547087602444;
+	const double q	= 0.5003270373238773;
+
+	const double k	= std::tan(boost::math::constants::pi<double>() * f0 / sample_rate);
+	const double a0	= 1.0 + k / q + k * k;
+
+	return {
+		1.0,
+		-2.0,
+		1.0,
+		2.0 * (k * k - 1.0) / a0,
+		(1.0 - k / q + k * k) / a0
+	};
+}
+
+inline __m128d load_pair(const int32_t* frame, int channel, int num_channels)
+{
+	return _mm_set_pd(channel + 1 < num_channels ? frame[channel + 1] * INT32_SCALE : 0.0, frame[channel] * INT32_SCALE);
+}
+
+inline __m128d load_pair(const double* frame, int channel, int num_channels)
+{
+	return _mm_set_pd(channel + 1 < num_channels ? frame[channel + 1] * INT32_SCALE : 0.0, frame[channel] * INT32_SCALE);
+}
+
+inline float load_sample(const int32_t* frame, int channel)
+{
+	return static_cast<float>(frame[channel] * INT32_SCALE);
+}
+
+inline float load_sample(const double* frame, int channel)
+{
+	return static_cast<float>(frame[channel] * INT32_SCALE);
+}
+
+}
+
+std::vector<double> loudness_meter::channel_weights(const audio_channel_layout& channel_layout)
+{
+	std::vector<double> weights(channel_layout.num_channels, 1.0);
+
+	if (channel_layout.channel_order.empty())
+		return weights;
+
+	bool has_main_programme = !channel_layout.indexes_of(L"FL").empty() || !channel_layout.indexes_of(L"FC").empty();
+
+	for (int i = 0; i < channel_layout.num_channels && i < static_cast<int>(channel_layout.channel_order.size()); ++i)
+	{
+		auto& name = channel_layout.channel_order.at(i);
+
+		if (name == L"LFE" || name == L"LFE2")
+			weights.at(i) = 0.0;
+		else if ((name == L"DL" || name == L"DR") && has_main_programme)
+			weights.at(i) = 0.0;
+		else if (name == L"BL" || name == L"BR" || name == L"SL" || name == L"SR" || name == L"BC")
+			weights.at(i) = 1.41;
+	}
+
+	return weights;
+}
+
+struct loudness_meter::impl : boost::noncopyable
+{
+	struct histogram_bin
+	{
+		uint64_t	count	= 0;
+		double		energy	= 0.0;
+	};
+
+	const int						sample_rate_;
+	const int						num_channels_;
+	const int						num_pairs_;
+	const std::vector<double>		weights_;
+	const int						sub_block_size_;
+
+	biquad_coefficients				shelf_;
+	biquad_coefficients				high_pass_;
+
+	// K-weighting filter state, transposed direct form II, two channels per
+	// SSE register: { shelf s1, shelf s2, high pass s1, high pass s2 } x 2.
+	std::vector<double>				filter_state_;
+	std::vector<double>				sub_block_energy_;
+	int								sub_block_fill_			= 0;
+
+	std::array<double, SHORT_TERM_SUB_BLOCKS>	sub_blocks_;
+	int											sub_block_count_	= 0;
+	int											sub_block_pos_		= 0;
+
+	std::vector<histogram_bin>		histogram_;
+
+	// True peak, 4x polyphase interpolation. Tap k of every phase is packed
+	// into one SSE register so that one sample produces all four
+	// interpolated values at once.
+	std::array<float, TRUE_PEAK_TAPS * TRUE_PEAK_PHASES>	true_peak_taps_;
+	std::vector<std::vector<float>>	true_peak_history_;
+	std::vector<float>				true_peak_buffer_;
+	std::vector<double>				true_peaks_;
+
+	impl(int sample_rate, std::vector<double> weights)
+		: sample_rate_(sample_rate)
+		, num_channels_(static_cast<int>(weights.size()))
+		, num_pairs_((num_channels_ + 1) / 2)
+		, weights_(std::move(weights))
+		, sub_block_size_(std::max(1, sample_rate / SUB_BLOCKS_PER_SECOND))
+		, shelf_(shelf_filter(sample_rate))
+		, high_pass_(high_pass_filter(sample_rate))
+		, histogram_(HISTOGRAM_BINS)
+		, true_peak_history_(num_channels_, std::vector<float>(TRUE_PEAK_TAPS - 1, 0.0f))
+		, true_peaks_(num_channels_, 0.0)
+	{
+		if (sample_rate_ <= 0 || num_channels_ <= 0)
+			CASPAR_THROW_EXCEPTION(invalid_argument() << msg_info(L"Loudness meter needs a positive sample rate and at least one channel"));
+
+		create_true_peak_taps();
+		reset();
+	}
+
+	void create_true_peak_taps()
+	{
+		// Blackman windowed sinc, cut off at the original Nyquist frequency.
+		const int		length	= TRUE_PEAK_TAPS * TRUE_PEAK_PHASES;
+		const double	center	= (length - 1) / 2.0;
+		const double	pi		= boost::math::constants::pi<double>();
+		std::array<double, TRUE_PEAK_TAPS * TRUE_PEAK_PHASES> h;
+
+		for (int m = 0; m < length; ++m)
+		{
+			double x		= (m - center) / TRUE_PEAK_PHASES;
+			double sinc		= x == 0.0 ? 1.0 : std::sin(pi * x) / (pi * x);
+			double window	= 0.42 - 0.5 * std::cos(2.0 * pi * m / (length - 1)) + 0.08 * std::cos(4.0 * pi * m / (length - 1));
+
+			h[m] = sinc * window;
+		}
+
+		for (int phase = 0; phase < TRUE_PEAK_PHASES; ++phase)
+		{
+			double sum = 0.0;
+
+			for (int tap = 0; tap < TRUE_PEAK_TAPS; ++tap)
+				sum += h[tap * TRUE_PEAK_PHASES + phase];
+
+			// Unity gain per phase so that DC does not read as a peak.
+			for (int tap = 0; tap < TRUE_PEAK_TAPS; ++tap)
+				true_peak_taps_[tap * TRUE_PEAK_PHASES + phase] = static_cast<float>(h[tap * TRUE_PEAK_PHASES + phase] / sum);
+		}
+	}
+
+	void reset()
+	{
+		filter_state_.assign(num_pairs_ * 8, 0.0);
+		sub_block_energy_.assign(num_pairs_ * 2, 0.0);
+		sub_block_fill_ = 0;
+		sub_blocks_.fill(0.0);
+		sub_block_count_ = 0;
+		sub_block_pos_ = 0;
+		histogram_.assign(HISTOGRAM_BINS, histogram_bin());
+
+		for (auto& history : true_peak_history_)
+			std::fill(history.begin(), history.end(), 0.0f);
+
+		std::fill(true_peaks_.begin(), true_peaks_.end(), 0.0);
+	}
+
+	template<typename Sample>
+	void process(const Sample* samples, std::size_t num_frames)
+	{
+		measure_true_peak(samples, num_frames);
+
+		while (num_frames > 0)
+		{
+			auto chunk = std::min(num_frames, static_cast<std::size_t>(sub_block_size_ - sub_block_fill_));
+
+			filter(samples, chunk);
+
+			samples				+= chunk * num_channels_;
+			num_frames			-= chunk;
+			sub_block_fill_		+= static_cast<int>(chunk);
+
+			if (sub_block_fill_ == sub_block_size_)
+				complete_sub_block();
+		}
+	}
+
+	template<typename Sample>
+	void filter(const Sample* samples, std::size_t num_frames)
+	{
+		const __m128d s_b0 = _mm_set1_pd(shelf_.b0);
+		const __m128d s_b1 = _mm_set1_pd(shelf_.b1);
+		const __m128d s_b2 = _mm_set1_pd(shelf_.b2);
+		const __m128d s_a1 = _mm_set1_pd(shelf_.a1);
+		const __m128d s_a2 = _mm_set1_pd(shelf_.a2);
+		const __m128d h_a1 = _mm_set1_pd(high_pass_.a1);
+		const __m128d h_a2 = _mm_set1_pd(high_pass_.a2);
+
+		for (int pair = 0; pair < num_pairs_; ++pair)
+		{
+			double* state = filter_state_.data() + pair * 8;
+			__m128d s1 = _mm_loadu_pd(state + 0);
+			__m128d s2 = _mm_loadu_pd(state + 2);
+			__m128d h1 = _mm_loadu_pd(state + 4);
+			__m128d h2 = _mm_loadu_pd(state + 6);
+			__m128d energy = _mm_setzero_pd();
+
+			const int channel = pair * 2;
+			const Sample* frame = samples;
+
+			for (std::size_t n = 0; n < num_frames; ++n, frame += num_channels_)
+			{
+				__m128d x = load_pair(frame, channel, num_channels_);
+
+				__m128d y = _mm_add_pd(_mm_mul_pd(s_b0, x), s1);
+				s1 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(s_b1, x), _mm_mul_pd(s_a1, y)), s2);
+				s2 = _mm_sub_pd(_mm_mul_pd(s_b2, x), _mm_mul_pd(s_a2, y));
+
+				// High pass numerator is { 1, -2, 1 }.
+				__m128d z = _mm_add_pd(y, h1);
+				h1 = _mm_sub_pd(_mm_sub_pd(h2, _mm_add_pd(y, y)), _mm_mul_pd(h_a1, z));
+				h2 = _mm_sub_pd(y, _mm_mul_pd(h_a2, z));
+
+				energy = _mm_add_pd(energy, _mm_mul_pd(z, z));
+			}
+
+			_mm_storeu_pd(state + 0, s1);
+			_mm_storeu_pd(state + 2, s2);
+			_mm_storeu_pd(state + 4, h1);
+			_mm_storeu_pd(state + 6, h2);
+
+			double* block_energy = sub_block_energy_.data() + channel;
+			_mm_storeu_pd(block_energy, _mm_add_pd(_mm_loadu_pd(block_energy), energy));
+		}
+	}
+
+	template<typename Sample>
+	void measure_true_peak(const Sample* samples, std::size_t num_frames)
+	{
+		const int history_length = TRUE_PEAK_TAPS - 1;
+		const __m128 sign_mask = _mm_set1_ps(-0.0f);
+
+		std::array<__m128, TRUE_PEAK_TAPS> taps;
+		for (int tap = 0; tap < TRUE_PEAK_TAPS; ++tap)
+			taps[tap] = _mm_loadu_ps(true_peak_taps_.data() + tap * TRUE_PEAK_PHASES);
+
+		true_peak_buffer_.resize(history_length + num_frames);
+
+		for (int channel = 0; channel < num_channels_; ++channel)
+		{
+			auto& history = true_peak_history_[channel];
+			float* buffer = true_peak_buffer_.data();
+
+			std::copy(history.begin(), history.end(), buffer);
+
+			for (std::size_t n = 0; n < num_frames; ++n)
+				buffer[history_length + n] = load_sample(samples + n * num_channels_, channel);
+
+			__m128 peak = _mm_setzero_ps();
+
+			for (std::size_t n = 0; n < num_frames; ++n)
+			{
+				const float* newest = buffer + history_length + n;
+				__m128 acc = _mm_setzero_ps();
+
+				for (int tap = 0; tap < TRUE_PEAK_TAPS; ++tap)
+					acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(newest[-tap]), taps[tap]));
+
+				peak = _mm_max_ps(peak, _mm_andnot_ps(sign_mask, acc));
+				peak = _mm_max_ps(peak, _mm_andnot_ps(sign_mask, _mm_set1_ps(*newest)));
+			}
+
+			std::array<float, 4> lanes;
+			_mm_storeu_ps(lanes.data(), peak);
+			true_peaks_[channel] = std::max(true_peaks_[channel], static_cast<double>(*std::max_element(lanes.begin(), lanes.end())));
+
+			std::copy(buffer + num_frames, buffer + num_frames + history_length, history.begin());
+		}
+	}
+
+	void complete_sub_block()
+	{
+		double energy = 0.0;
+
+		for (int channel = 0; channel < num_channels_; ++channel)
+			energy += weights_[channel] * sub_block_energy_[channel];
+
+		sub_blocks_[sub_block_pos_] = energy / sub_block_size_;
+		sub_block_pos_ = (sub_block_pos_ + 1) % SHORT_TERM_SUB_BLOCKS;
+		sub_block_count_ = std::min(sub_block_count_ + 1, SHORT_TERM_SUB_BLOCKS);
+		sub_block_fill_ = 0;
+		std::fill(sub_block_energy_.begin(), sub_block_energy_.end(), 0.0);
+
+		if (sub_block_count_ >= MOMENTARY_SUB_BLOCKS)
+			add_gating_block(mean_energy(MOMENTARY_SUB_BLOCKS));
+	}
+
+	void add_gating_block(double energy)
+	{
+		auto loudness = to_loudness(energy);
+
+		if (!(loudness >= ABSOLUTE_GATE))
+			return;
+
+		auto index = std::min(HISTOGRAM_BINS - 1, static_cast<int>((loudness - ABSOLUTE_GATE) * HISTOGRAM_BINS_PER_LU));
+		auto& bin = histogram_[index];
+		++bin.count;
+		bin.energy += energy;
+	}
+
+	double mean_energy(int num_sub_blocks) const
+	{
+		double energy = 0.0;
+
+		for (int i = 1; i <= num_sub_blocks; ++i)
+			energy += sub_blocks_[(sub_block_pos_ + SHORT_TERM_SUB_BLOCKS - i) % SHORT_TERM_SUB_BLOCKS];
+
+		return energy / num_sub_blocks;
+	}
+
+	double momentary() const
+	{
+		return sub_block_count_ >= MOMENTARY_SUB_BLOCKS ? to_loudness(mean_energy(MOMENTARY_SUB_BLOCKS)) : MINUS_INFINITY;
+	}
+
+	double short_term() const
+	{
+		return sub_block_count_ >= SHORT_TERM_SUB_BLOCKS ? to_loudness(mean_energy(SHORT_TERM_SUB_BLOCKS)) : MINUS_INFINITY;
+	}
+
+	double integrated() const
+	{
+		uint64_t	count	= 0;
+		double		energy	= 0.0;
+
+		for (auto& bin : histogram_)
+		{
+			count	+= bin.count;
+			energy	+= bin.energy;
+		}
+
+		if (count == 0)
+			return MINUS_INFINITY;
+
+		auto threshold = to_loudness(energy / count) + RELATIVE_GATE;
+		auto first_bin = std::max(0, static_cast<int>((threshold - ABSOLUTE_GATE) * HISTOGRAM_BINS_PER_LU));
+
+		count	= 0;
+		energy	= 0.0;
+
+		for (int index = first_bin; index < HISTOGRAM_BINS; ++index)
+		{
+			auto& bin = histogram_[index];
+
+			// The bin straddling the threshold is judged by its mean.
+			if (bin.count == 0 || (index == first_bin && to_loudness(bin.energy / bin.count) < threshold))
+				continue;
+
+			count	+= bin.count;
+			energy	+= bin.energy;
+		}
+
+		return count == 0 ? MINUS_INFINITY : to_loudness(energy / count);
+	}
+
+	double true_peak(int channel) const
+	{
+		if (channel < 0 || channel >= num_channels_)
+			CASPAR_THROW_EXCEPTION(out_of_range() << msg_info(L"Channel out of range"));
+
+		return to_db(true_peaks_[channel]);
+	}
+
+	double max_true_peak() const
+	{
+		return to_db(*std::max_element(true_peaks_.begin(), true_peaks_.end()));
+	}
+
+	boost::property_tree::wptree info() const
+	{
+		boost::property_tree::wptree info;
+
+		info.add(L"momentary", momentary());
+		info.add(L"short-term", short_term());
+		info.add(L"integrated", integrated());
+		info.add(L"true-peak", max_true_peak());
+
+		for (int channel = 0; channel < num_channels_; ++channel)
+		{
+			auto& channel_info = info.add(L"channels.channel", L"");
+			channel_info.add(L"index", channel + 1);
+			channel_info.add(L"weight", weights_[channel]);
+			channel_info.add(L"true-peak", true_peak(channel));
+		}
+
+		return info;
+	}
+};
+
+loudness_meter::loudness_meter(int sample_rate, std::vector<double> channel_weights) : impl_(new impl(sample_rate, std::move(channel_weights))) {}
+void loudness_meter::process(const int32_t* samples, std::size_t num_frames) { impl_->process(samples, num_frames); }
+void loudness_meter::process(const double* samples, std::size_t num_frames) { impl_->process(samples, num_frames); }
+void loudness_meter::reset() { impl_->reset(); }
+double loudness_meter::momentary() const { return impl_->momentary(); }
+double loudness_meter::short_term() const { return impl_->short_term(); }
+double loudness_meter::integrated() const { return impl_->integrated(); }
+double loudness_meter::true_peak(int channel) const { return impl_->true_peak(channel); }
+double loudness_meter::max_true_peak() const { return impl_->max_true_peak(); }
+int loudness_meter::num_channels() const { return impl_->num_channels_; }
+boost::property_tree::wptree loudness_meter::info() const { return impl_->info(); }
+
+}}
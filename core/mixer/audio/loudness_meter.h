@@ -0,0 +1,83 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <common/memory.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/property_tree/ptree_fwd.hpp>
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace caspar { namespace core {
+
+struct audio_channel_layout;
+
+/**
+ * EBU R128 / ITU-R BS.1770-4 loudness meter.
+ *
+ * Measures momentary (400 ms), short-term (3 s) and gated integrated loudness
+ * in LUFS, and the 4x oversampled true peak of every channel in dBTP. Values
+ * that cannot be measured yet (not enough audio, or everything gated away)
+ * are reported as negative infinity.
+ */
+class loudness_meter final : boost::noncopyable
+{
+public:
+	// Static Members
+
+	/**
+	 * The BS.1770 channel weights for a channel layout: 0 for LFE (and for
+	 * downmix channels when the layout also carries the main programme),
+	 * 1.41 for surround channels and 1.0 for everything else.
+	 */
+	static std::vector<double> channel_weights(const audio_channel_layout& channel_layout);
+
+	// Constructors
+
+	loudness_meter(int sample_rate, std::vector<double> channel_weights);
+
+	// Methods
+
+	/**
+	 * Feeds interleaved samples, full scale being the int32_t range. The
+	 * double overload is used for unclipped (mixer internal) samples.
+	 */
+	void process(const int32_t* samples, std::size_t num_frames);
+	void process(const double* samples, std::size_t num_frames);
+	void reset();
+
+	// Properties
+
+	double momentary() const;
+	double short_term() const;
+	double integrated() const;
+	double true_peak(int channel) const;
+	double max_true_peak() const;
+	int num_channels() const;
+	boost::property_tree::wptree info() const;
+private:
+	struct impl;
+	spl::shared_ptr<impl> impl_;
+};
+
+}}
@@ -0,0 +1,163 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "../StdAfx.h"
+
+#include "composite_cache.h"
+
+#include "image/image_mixer.h"
+
+#include <core/frame/draw_frame.h>
+#include <core/frame/frame.h>
+#include <core/frame/frame_transform.h>
+#include <core/frame/frame_visitor.h>
+#include <core/frame/geometry.h>
+#include <core/video_format.h>
+
+#include <boost/range/algorithm/equal.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace caspar { namespace core {
+
+namespace {
+
+// One push, visit or pop of a draw_frame tree. The image id is only set for
+// visits, the transform only for pushes.
+struct draw_call
+{
+	enum class type
+	{
+		push,
+		visit,
+		pop
+	};
+
+	draw_call::type			call;
+	image_transform			transform;
+	std::uint64_t			image_id		= 0;
+	frame_geometry			geometry		= frame_geometry::get_default();
+
+	bool operator==(const draw_call& other) const
+	{
+		return call == other.call
+			&& transform == other.transform
+			&& image_id == other.image_id
+			&& geometry.type() == other.geometry.type()
+			&& boost::equal(geometry.data(), other.geometry.data());
+	}
+};
+
+class draw_call_recorder : public frame_visitor
+{
+	std::vector<draw_call>&	calls_;
+public:
+	draw_call_recorder(std::vector<draw_call>& calls)
+		: calls_(calls)
+	{
+	}
+
+	void push(const frame_transform& transform) override
+	{
+		draw_call call;
+		call.call		= draw_call::type::push;
+		call.transform	= transform.image_transform;
+		calls_.push_back(call);
+	}
+
+	void visit(const const_frame& frame) override
+	{
+		draw_call call;
+		call.call		= draw_call::type::visit;
+		call.image_id	= frame.image_id();
+		call.geometry	= frame.geometry();
+		calls_.push_back(call);
+	}
+
+	void pop() override
+	{
+		draw_call call;
+		call.call		= draw_call::type::pop;
+		calls_.push_back(call);
+	}
+};
+
+bool same_output(const video_format_desc& lhs, const video_format_desc& rhs)
+{
+	return lhs.format == rhs.format
+		&& lhs.width == rhs.width
+		&& lhs.height == rhs.height
+		&& lhs.square_width == rhs.square_width
+		&& lhs.square_height == rhs.square_height
+		&& lhs.field_mode == rhs.field_mode;
+}
+
+}
+
+struct composite_cache::impl : boost::noncopyable
+{
+	std::vector<draw_call>							calls_;
+	std::vector<draw_call>							previous_calls_;
+	video_format_desc								previous_format_desc_;
+	bool											previous_straighten_alpha_	= false;
+	std::shared_future<array<const std::uint8_t>>	previous_image_;
+	bool											reused_						= false;
+
+	std::shared_future<array<const std::uint8_t>> operator()(
+			const std::vector<draw_frame>& layers,
+			image_mixer& mixer,
+			const video_format_desc& format_desc,
+			bool straighten_alpha)
+	{
+		calls_.clear();
+		draw_call_recorder recorder(calls_);
+
+		for (auto& layer : layers)
+			layer.accept(recorder);
+
+		// Compared with the calls of the last drawn composite, not the last
+		// tick, so that changes too small to count as a change on their own
+		// can not add up unseen.
+		reused_ = previous_image_.valid()
+				&& straighten_alpha == previous_straighten_alpha_
+				&& same_output(format_desc, previous_format_desc_)
+				&& calls_ == previous_calls_;
+
+		if (reused_)
+			return previous_image_;
+
+		for (auto& layer : layers)
+			layer.accept(mixer);
+
+		previous_image_				= mixer(format_desc, straighten_alpha).share();
+		previous_format_desc_		= format_desc;
+		previous_straighten_alpha_	= straighten_alpha;
+		previous_calls_.swap(calls_);
+
+		return previous_image_;
+	}
+};
+
+composite_cache::composite_cache() : impl_(new impl()){}
+composite_cache::~composite_cache(){}
+std::shared_future<array<const std::uint8_t>> composite_cache::operator()(const std::vector<draw_frame>& layers, image_mixer& mixer, const video_format_desc& format_desc, bool straighten_alpha) { return (*impl_)(layers, mixer, format_desc, straighten_alpha); }
+bool composite_cache::reused() const { return impl_->reused_; }
+
+}}
@@ -0,0 +1,64 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "../fwd.h"
+
+#include <common/array.h>
+#include <common/memory.h>
+
+#include <cstdint>
+#include <future>
+#include <vector>
+
+namespace caspar { namespace core {
+
+// Hands back the previous composite of the image mixer when a tick draws
+// exactly what the previous one drew: the same images, by image id, with the
+// same geometry and transforms, in the same video format. Only then are the
+// layers drawn again.
+class composite_cache final
+{
+	composite_cache(const composite_cache&);
+	composite_cache& operator=(const composite_cache&);
+public:
+
+	// Constructors
+
+	composite_cache();
+	~composite_cache();
+
+	// Methods
+
+	std::shared_future<array<const std::uint8_t>> operator()(
+			const std::vector<draw_frame>& layers,
+			image_mixer& mixer,
+			const video_format_desc& format_desc,
+			bool straighten_alpha);
+
+	// Properties
+
+	bool reused() const;
+private:
+	struct impl;
+	spl::unique_ptr<impl> impl_;
+};
+
+}}
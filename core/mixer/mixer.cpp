@@ -22,6 +22,8 @@
 #include "../StdAfx.h"
 
 #include "mixer.h"
+#include "composite_cache.h"
+#include "occlusion.h"
 
 #include "../frame/frame.h"
 
@@ -35,6 +37,7 @@
 #include <common/future.h>
 #include <common/timer.h>
 
+#include <core/ancillary/ancillary_merger.h>
 #include <core/frame/draw_frame.h>
 #include <core/frame/frame_factory.h>
 #include <core/frame/frame_transform.h>
@@ -59,9 +62,14 @@ struct mixer::impl : boost::noncopyable
 	int									channel_index_;
 	spl::shared_ptr<diagnostics::graph>	graph_;
 	std::atomic<int64_t>				current_mix_time_;
+	std::atomic<int>					culled_layers_;
 	spl::shared_ptr<monitor::subject>	monitor_subject_	= spl::make_shared<monitor::subject>("/mixer");
 	audio_mixer							audio_mixer_		{ graph_ };
 	spl::shared_ptr<image_mixer>		image_mixer_;
+	composite_cache						composite_cache_;
+	const_frame							previous_frame_;
+	std::atomic<int64_t>				reused_composites_;
+	ancillary::AncillaryMerger			ancillary_merger_;
 
 	bool								straighten_alpha_	= false;
 
@@ -75,6 +83,8 @@ public:
 	{
 		graph_->set_color("mix-time", diagnostics::color(1.0f, 0.0f, 0.9f, 0.8f));
 		current_mix_time_ = 0;
+		culled_layers_ = 0;
+		reused_composites_ = 0;
 		audio_mixer_.monitor_output().attach_parent(monitor_subject_);
 	}
 
@@ -92,21 +102,52 @@ public:
 						static_cast<double>(format_desc.square_width)
 						/ static_cast<double>(format_desc.square_height));
 
+				// Layers hidden behind an opaque full screen layer are still
+				// heard, but not uploaded and drawn.
+				auto occluder	= find_occluding_layer(frames);
+				int culled		= 0;
+
+				std::vector<draw_frame> layers;
 				ancillary::AncillaryContainer ancillary;
 				for (auto& frame : frames)
 				{
+					audio_mixer_.set_current_layer(frame.first);
 					frame.second.accept(audio_mixer_);
-					frame.second.transform().image_transform.layer_depth = 1;
-					frame.second.accept(*image_mixer_);
-					ancillary.appendFrom(frame.second.ancillary());
+					ancillary_merger_.add(frame.first, frame.second.ancillary());
+
+					if (occluder != frames.end() && frame.first < occluder->first)
+						++culled;
+					else
+					{
+						frame.second.transform().image_transform.layer_depth = 1;
+						layers.push_back(std::move(frame.second));
+					}
 				}
 
-				auto image = (*image_mixer_)(format_desc, straighten_alpha_);
+				culled_layers_ = culled;
+				*monitor_subject_ << monitor::message("/culled-layers") % culled;
+
+				ancillary_merger_.merge(format_desc, ancillary);
+				send_ancillary_stats();
+
+				auto image = composite_cache_(layers, *image_mixer_, format_desc, straighten_alpha_);
 				auto audio = audio_mixer_(format_desc, channel_layout);
 
+				*monitor_subject_ << monitor::message("/reused-composite") % composite_cache_.reused();
+
+				// Sharing the image also shares the key extracted from it by
+				// key outputs.
+				if (composite_cache_.reused() && previous_frame_.audio_channel_layout() == channel_layout)
+				{
+					++reused_composites_;
+					previous_frame_ = previous_frame_.with_audio(std::move(audio), std::move(ancillary));
+					return previous_frame_;
+				}
+
 				auto desc = core::pixel_format_desc(core::pixel_format::bgra);
 				desc.planes.push_back(core::pixel_format_desc::plane(format_desc.width, format_desc.height, 4));
-				return const_frame(std::move(image), std::move(audio), std::move(ancillary), this, desc, channel_layout);
+				previous_frame_ = const_frame(std::move(image), std::move(audio), std::move(ancillary), this, desc, channel_layout);
+				return previous_frame_;
 			}
 			catch(...)
 			{
@@ -122,6 +163,33 @@ public:
 		return frame;
 	}
 
+	void send_ancillary_stats()
+	{
+		auto& stats = ancillary_merger_.stats();
+
+		*monitor_subject_ << monitor::message("/ancillary/packets") % static_cast<int64_t>(stats.packets);
+		*monitor_subject_ << monitor::message("/ancillary/lines") % static_cast<int64_t>(stats.lines);
+		*monitor_subject_ << monitor::message("/ancillary/duplicates") % static_cast<int64_t>(stats.duplicates);
+		*monitor_subject_ << monitor::message("/ancillary/conflicts") % static_cast<int64_t>(stats.conflicts);
+		*monitor_subject_ << monitor::message("/ancillary/overflow") % static_cast<int64_t>(stats.overflows) % static_cast<int64_t>(stats.overflow_frames);
+	}
+
+	void set_ancillary_policy(uint8_t did, uint8_t sdid, ancillary::merge_policy policy)
+	{
+		executor_.begin_invoke([=]
+		{
+			ancillary_merger_.setPolicy(did, sdid, policy);
+		}, task_priority::high_priority);
+	}
+
+	void set_default_ancillary_policy(ancillary::merge_policy policy)
+	{
+		executor_.begin_invoke([=]
+		{
+			ancillary_merger_.setDefaultPolicy(policy);
+		}, task_priority::high_priority);
+	}
+
 	void set_master_volume(float volume)
 	{
 		executor_.begin_invoke([=]
@@ -158,10 +226,28 @@ public:
 	{
 		boost::property_tree::wptree info;
 		info.add(L"mix-time", current_mix_time_);
+		info.add(L"culled-layers", culled_layers_);
+		info.add(L"reused-composites", reused_composites_);
 
 		return make_ready_future(std::move(info));
 	}
 
+	std::future<boost::property_tree::wptree> loudness_info()
+	{
+		return executor_.begin_invoke([=]
+		{
+			return audio_mixer_.loudness_info();
+		}, task_priority::high_priority);
+	}
+
+	void reset_loudness()
+	{
+		executor_.begin_invoke([=]
+		{
+			audio_mixer_.reset_loudness();
+		}, task_priority::high_priority);
+	}
+
 	std::future<boost::property_tree::wptree> delay_info() const
 	{
 		boost::property_tree::wptree info;
@@ -177,8 +263,12 @@ void mixer::set_master_volume(float volume) { impl_->set_master_volume(volume);
 float mixer::get_master_volume() { return impl_->get_master_volume(); }
 void mixer::set_straight_alpha_output(bool value) { impl_->set_straight_alpha_output(value); }
 bool mixer::get_straight_alpha_output() { return impl_->get_straight_alpha_output(); }
+void mixer::set_ancillary_policy(uint8_t did, uint8_t sdid, ancillary::merge_policy policy) { impl_->set_ancillary_policy(did, sdid, policy); }
+void mixer::set_default_ancillary_policy(ancillary::merge_policy policy) { impl_->set_default_ancillary_policy(policy); }
 std::future<boost::property_tree::wptree> mixer::info() const{return impl_->info();}
 std::future<boost::property_tree::wptree> mixer::delay_info() const{ return impl_->delay_info(); }
+std::future<boost::property_tree::wptree> mixer::loudness_info() { return impl_->loudness_info(); }
+void mixer::reset_loudness() { impl_->reset_loudness(); }
 const_frame mixer::operator()(std::map<int, draw_frame> frames, const video_format_desc& format_desc, const core::audio_channel_layout& channel_layout){ return (*impl_)(std::move(frames), format_desc, channel_layout); }
 mutable_frame mixer::create_frame(const void* tag, const core::pixel_format_desc& desc, const core::audio_channel_layout& channel_layout) {return impl_->image_mixer_->create_frame(tag, desc, channel_layout);}
 monitor::subject& mixer::monitor_output() { return *impl_->monitor_subject_; }
@@ -31,11 +31,18 @@
 
 #include <boost/property_tree/ptree_fwd.hpp>
 
+#include <cstdint>
 #include <future>
 #include <map>
 
 FORWARD2(caspar, diagnostics, class graph);
 
+namespace caspar { namespace core { namespace ancillary {
+
+enum class merge_policy;
+
+}}}
+
 namespace caspar { namespace core {
 
 class mixer final
@@ -58,6 +65,9 @@ public:
 	float get_master_volume();
 	void set_straight_alpha_output(bool value);
 	bool get_straight_alpha_output();
+	void set_ancillary_policy(std::uint8_t did, std::uint8_t sdid, ancillary::merge_policy policy);
+	void set_default_ancillary_policy(ancillary::merge_policy policy);
+	void reset_loudness();
 
 	mutable_frame create_frame(const void* tag, const pixel_format_desc& desc, const core::audio_channel_layout& channel_layout);
 
@@ -65,6 +75,7 @@ public:
 
 	std::future<boost::property_tree::wptree> info() const;
 	std::future<boost::property_tree::wptree> delay_info() const;
+	std::future<boost::property_tree::wptree> loudness_info();
 
 	monitor::subject& monitor_output();
 
@@ -0,0 +1,179 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "../StdAfx.h"
+
+#include "occlusion.h"
+
+#include <core/frame/frame.h>
+#include <core/frame/frame_transform.h>
+#include <core/frame/frame_visitor.h>
+#include <core/frame/geometry.h>
+#include <core/frame/pixel_format.h>
+
+#include <boost/range/algorithm/equal.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <limits>
+#include <vector>
+
+namespace caspar { namespace core {
+
+namespace {
+
+// Less than a hundredth of a pixel at 8K, so tweens that end up a rounding
+// error away from the edge of the screen still count as covering it.
+const double tolerance = 0.000001;
+
+bool is_default(const boost::array<double, 2>& corner, double x, double y)
+{
+	return std::abs(corner[0] - x) < tolerance && std::abs(corner[1] - y) < tolerance;
+}
+
+bool fills_axis(double translation, double anchor, double scale)
+{
+	auto first	= translation - anchor * scale;
+	auto second	= first + scale;
+
+	return std::min(first, second) < tolerance && std::max(first, second) > 1.0 - tolerance;
+}
+
+bool covers_output(const const_frame& frame, const image_transform& transform)
+{
+	if (!frame.is_opaque() || frame.pixel_format_desc().planes.empty())
+		return false;
+
+	if (transform.opacity < 1.0 || transform.chroma.enable)
+		return false;
+
+	auto& geometry = frame.geometry();
+
+	if (geometry.type() != frame_geometry::geometry_type::quad || !boost::equal(geometry.data(), frame_geometry::get_default().data()))
+		return false;
+
+	if (std::abs(transform.angle) > tolerance)
+		return false;
+
+	auto& crop = transform.crop;
+
+	if (crop.ul[0] > tolerance || crop.ul[1] > tolerance || crop.lr[0] < 1.0 - tolerance || crop.lr[1] < 1.0 - tolerance)
+		return false;
+
+	auto& perspective = transform.perspective;
+
+	if (!is_default(perspective.ul, 0.0, 0.0) || !is_default(perspective.ur, 1.0, 0.0) || !is_default(perspective.lr, 1.0, 1.0) || !is_default(perspective.ll, 0.0, 1.0))
+		return false;
+
+	// The same test as the image kernel uses to enable the scissor.
+	auto& m_p = transform.clip_translation;
+	auto& m_s = transform.clip_scale;
+
+	if (m_p[0] > std::numeric_limits<double>::epsilon()			|| m_p[1] > std::numeric_limits<double>::epsilon() ||
+		m_s[0] < (1.0 - std::numeric_limits<double>::epsilon())	|| m_s[1] < (1.0 - std::numeric_limits<double>::epsilon()))
+		return false;
+
+	return fills_axis(transform.fill_translation[0], transform.anchor[0], transform.fill_scale[0])
+		&& fills_axis(transform.fill_translation[1], transform.anchor[1], transform.fill_scale[1]);
+}
+
+struct layer_coverage
+{
+	bool	has_key		= false;
+	bool	covers		= false;
+};
+
+class coverage_visitor : public frame_visitor
+{
+	std::vector<image_transform>	transform_stack_;
+	bool							has_key_			= false;
+	bool							blends_				= false;
+	int								covered_fields_		= 0;
+public:
+	coverage_visitor()
+	{
+		transform_stack_.push_back(image_transform());
+	}
+
+	void push(const frame_transform& transform) override
+	{
+		transform_stack_.push_back(transform_stack_.back() * transform.image_transform);
+	}
+
+	void visit(const const_frame& frame) override
+	{
+		auto& transform = transform_stack_.back();
+
+		has_key_	|= transform.is_key;
+		blends_		|= transform.is_mix || transform.blend_mode != blend_mode::normal;
+
+		if (covers_output(frame, transform))
+			covered_fields_ |= static_cast<int>(transform.field_mode);
+	}
+
+	void pop() override
+	{
+		transform_stack_.pop_back();
+	}
+
+	layer_coverage result() const
+	{
+		layer_coverage result;
+		result.has_key	= has_key_;
+		result.covers	= !has_key_ && !blends_ && covered_fields_ == static_cast<int>(field_mode::progressive);
+		return result;
+	}
+};
+
+layer_coverage get_coverage(const draw_frame& frame)
+{
+	coverage_visitor visitor;
+	frame.accept(visitor);
+	return visitor.result();
+}
+
+}
+
+std::map<int, draw_frame>::const_iterator find_occluding_layer(const std::map<int, draw_frame>& layers)
+{
+	if (layers.empty())
+		return layers.end();
+
+	auto layer		= std::prev(layers.end());
+	auto coverage	= get_coverage(layer->second);
+
+	while (true)
+	{
+		if (layer == layers.begin())
+			return coverage.covers ? layer : layers.end();
+
+		// A key in the layer below masks this one.
+		auto below			= std::prev(layer);
+		auto below_coverage	= get_coverage(below->second);
+
+		if (coverage.covers && !below_coverage.has_key)
+			return layer;
+
+		layer		= below;
+		coverage	= below_coverage;
+	}
+}
+
+}}
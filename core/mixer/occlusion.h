@@ -0,0 +1,37 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "../frame/draw_frame.h"
+
+#include <map>
+
+namespace caspar { namespace core {
+
+// Finds the top most layer that the image mixer draws as opaque pixels over the
+// whole output: an opaque frame with the default geometry, filling the screen
+// without rotation, crop, clip or perspective, at full opacity, with the normal
+// blend mode and no chroma key, in a layer without keys and not masked by the
+// layer below. Nothing below that layer can be seen. Returns layers.end() when
+// no layer covers the output. Transforms are composed with the aspect ratio set
+// by detail::set_current_aspect_ratio, like in the image mixer.
+std::map<int, draw_frame>::const_iterator find_occluding_layer(const std::map<int, draw_frame>& layers);
+
+}}
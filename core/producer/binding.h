@@ -28,11 +28,12 @@
 #include <map>
 #include <algorithm>
 #include <type_traits>
+#include <cstdint>
 #include <stdexcept>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/utility/value_init.hpp>
-#include <boost/range/algorithm/remove_if.hpp>
+#include <boost/range/algorithm_ext/erase.hpp>
 
 #include <common/tweener.h>
 #include <common/except.h>
@@ -41,32 +42,94 @@ namespace caspar { namespace core {
 
 namespace detail {
 
+// Bindings form a DAG. A change marks everything downstream dirty, and dirty values are only
+// recomputed when read, so a binding is evaluated at most once per change of its dependencies
+// however many paths lead to it. Bindings with listeners are evaluated right away, so listeners
+// still only fire when the value actually changes.
 struct impl_base : std::enable_shared_from_this<impl_base>
 {
-	std::vector<std::shared_ptr<impl_base>> dependencies_;
+	std::vector<std::shared_ptr<impl_base>>			dependencies_;
+	mutable std::vector<std::uint64_t>				dependency_versions_;
+	mutable std::vector<std::weak_ptr<impl_base>>	dependants_;
 	mutable std::vector<std::pair<
 			std::weak_ptr<void>,
-			std::function<void ()>>> on_change_;
+			std::function<void ()>>>				on_change_;
+	mutable std::uint64_t							version_	= 0;
+	mutable bool									dirty_		= false;
+	mutable bool									evaluated_	= false;
+	int												rank_		= 0; // above the rank of every dependency
 
 	virtual ~impl_base()
 	{
 	}
 
+	virtual bool bound() const = 0;
 	virtual void evaluate() const = 0;
 
 	void depend_on(const std::shared_ptr<impl_base>& dependency)
 	{
 		auto self = shared_from_this();
 
-		if (dependency->depends_on(self))
+		// Only a binding that something depends on can close a cycle
+		if (dependency == self || (!dependants_.empty() && dependency->depends_on(self)))
 			CASPAR_THROW_EXCEPTION(invalid_argument() << msg_info("Can't have circular dependencies between bindings"));
 
-		dependency->on_change(self, [=] { evaluate(); });
+		dependency->dependants_.push_back(self);
 		dependencies_.push_back(dependency);
+		dependency_versions_.push_back(~std::uint64_t(0));
+		raise_rank(dependency->rank_ + 1);
+
+		if (bound())
+		{
+			std::vector<std::shared_ptr<impl_base>> observed;
+			mark_dirty(observed);
+			evaluate_observed(observed);
+		}
+	}
+
+	// Whether a change of this binding stays local. It is not calculated from other bindings, what is
+	// calculated from it depends on nothing else and has nothing downstream, and only the bindings
+	// in owned may have listeners.
+	bool isolated(const std::vector<const void*>& owned) const
+	{
+		if (bound())
+			return false;
+
+		for (auto& dependant : dependants_)
+		{
+			auto strong = dependant.lock();
+
+			if (!strong)
+				continue;
+
+			if (strong->dependencies_.size() != 1 || strong->has_dependants())
+				return false;
+
+			bool is_owned = std::find(owned.begin(), owned.end(), dynamic_cast<const void*>(strong.get())) != owned.end();
+
+			if (!is_owned && strong->has_listeners())
+				return false;
+		}
+
+		return true;
+	}
+
+	bool has_dependants() const
+	{
+		return std::any_of(dependants_.begin(), dependants_.end(), [](const std::weak_ptr<impl_base>& d) { return !d.expired(); });
+	}
+
+	bool has_listeners() const
+	{
+		return std::any_of(on_change_.begin(), on_change_.end(), [](const std::pair<std::weak_ptr<void>, std::function<void ()>>& l) { return !l.first.expired(); });
 	}
 
 	bool depends_on(const std::shared_ptr<impl_base>& other) const
 	{
+		// Everything that depends on other is ranked above it
+		if (rank_ <= other->rank_)
+			return false;
+
 		for (auto& dependency : dependencies_)
 		{
 			if (dependency == other)
@@ -83,8 +146,130 @@ struct impl_base : std::enable_shared_from_this<impl_base>
 			const std::weak_ptr<void>& dependant,
 			const std::function<void ()>& listener) const
 	{
+		// Changes only reach a binding through clean dependencies. One that was never evaluated
+		// stays that way, so its first value is still compared with the default as listeners expect.
+		if (evaluated_)
+			evaluate();
+		else
+			refresh_dependencies();
+
 		on_change_.push_back(std::make_pair(dependant, listener));
 	}
+
+	void raise_rank(int rank)
+	{
+		if (rank_ >= rank)
+			return;
+
+		rank_ = rank;
+
+		for (auto& dependant : dependants_)
+		{
+			auto strong = dependant.lock();
+
+			if (strong)
+				strong->raise_rank(rank_ + 1);
+		}
+	}
+
+	void remove_dependencies()
+	{
+		for (auto& dependency : dependencies_)
+			boost::remove_erase_if(dependency->dependants_, [this](const std::weak_ptr<impl_base>& d)
+			{
+				return d.expired() || d.lock().get() == this;
+			});
+
+		dependencies_.clear();
+		dependency_versions_.clear();
+	}
+
+	void mark_dirty(std::vector<std::shared_ptr<impl_base>>& observed) const
+	{
+		dirty_ = true;
+
+		if (!on_change_.empty())
+			observed.push_back(std::const_pointer_cast<impl_base>(shared_from_this()));
+
+		mark_dependants_dirty(observed);
+	}
+
+	// Stops at dependants that are already dirty, everything downstream of them is dirty too
+	void mark_dependants_dirty(std::vector<std::shared_ptr<impl_base>>& observed) const
+	{
+		bool need_to_clean_up = false;
+
+		for (auto& dependant : dependants_)
+		{
+			auto strong = dependant.lock();
+
+			if (!strong)
+				need_to_clean_up = true;
+			else if (!strong->bound())
+				continue;
+			else if (!strong->dirty_)
+				strong->mark_dirty(observed);
+			else if (!strong->on_change_.empty())
+				observed.push_back(strong);
+		}
+
+		if (need_to_clean_up)
+			boost::remove_erase_if(dependants_, [](const std::weak_ptr<impl_base>& d) { return d.expired(); });
+	}
+
+	// In the order they were reached, which is the order the listeners were added along each path
+	static void evaluate_observed(const std::vector<std::shared_ptr<impl_base>>& observed)
+	{
+		for (auto& binding : observed)
+			binding->evaluate();
+	}
+
+	// Called when the value changed, the listeners of this binding fire before the ones downstream
+	void on_change() const
+	{
+		auto copy				= on_change_;
+		bool need_to_clean_up	= false;
+
+		for (auto& listener : copy)
+		{
+			auto strong = listener.first.lock();
+
+			if (strong)
+				listener.second();
+			else
+				need_to_clean_up = true;
+		}
+
+		if (need_to_clean_up)
+			boost::remove_erase_if(on_change_, [&](const std::pair<std::weak_ptr<void>, std::function<void()>>& l)
+			{
+				return l.first.expired();
+			});
+
+		std::vector<std::shared_ptr<impl_base>> observed;
+		mark_dependants_dirty(observed);
+		evaluate_observed(observed);
+	}
+
+	// Brings the dependencies up to date, returns whether any of them changed since the last call
+	bool refresh_dependencies() const
+	{
+		bool changed = false;
+
+		for (size_t i = 0; i < dependencies_.size(); ++i)
+		{
+			auto& dependency = dependencies_[i];
+			dependency->evaluate();
+
+			if (dependency->version_ != dependency_versions_[i])
+			{
+				dependency_versions_[i] = dependency->version_;
+				changed = true;
+			}
+		}
+
+		return changed;
+	}
 };
 
 }
@@ -98,7 +283,6 @@ private:
 	{
 		mutable T			value_;
 		std::function<T ()> expression_;
-		mutable bool		evaluated_		= false;
 
 		impl()
 			: value_(boost::value_initialized<T>())
@@ -115,17 +299,18 @@ private:
 			: value_(boost::value_initialized<T>())
 			, expression_(expression)
 		{
+			dirty_ = true;
 		}
 
 		T get() const
 		{
-			if (!evaluated_)
+			if (dirty_)
 				evaluate();
 
 			return value_;
 		}
 
-		bool bound() const
+		bool bound() const override
 		{
 			return static_cast<bool>(expression_);
 		}
@@ -139,56 +324,60 @@ private:
 				return;
 
 			value_ = value;
+			++version_;
 
 			on_change();
 		}
 
 		void evaluate() const override
 		{
-			if (bound())
+			if (!dirty_)
+				return;
+
+			if (!bound())
 			{
-				auto new_value = expression_();
+				dirty_ = false;
+				return;
+			}
 
-				evaluated_ = true;
+			// Still dirty while the dependencies are refreshed, so changes they announce stop here
+			bool changed = refresh_dependencies() || !evaluated_;
 
-				if (new_value != value_)
-				{
-					value_ = new_value;
-					on_change();
-				}
-			}
-			else
-				evaluated_ = true;
-		}
+			dirty_ = false;
 
-		using impl_base::on_change;
-		void on_change() const
-		{
-			auto copy				= on_change_;
-			bool need_to_clean_up	= false;
+			if (!changed)
+				return;
 
-			for (auto& listener : copy)
-			{
-				auto strong = listener.first.lock();
+			auto new_value = expression_();
 
-				if (strong)
-					listener.second();
-				else
-					need_to_clean_up = true;
-			}
+			evaluated_ = true;
 
-			if (need_to_clean_up)
-				boost::remove_if(on_change_, [&](const std::pair<std::weak_ptr<void>, std::function<void()>>& l)
-				{
-					return l.first.expired();
-				});
+			if (new_value != value_)
+			{
+				value_ = new_value;
+				++version_;
+				on_change();
+			}
 		}
 
+		using impl_base::on_change;
+
 		void bind(const std::shared_ptr<impl>& other)
 		{
 			unbind();
-			depend_on(other);
 			expression_ = [other]{ return other->get(); };
+			evaluated_ = false;
+
+			try
+			{
+				depend_on(other);
+			}
+			catch (...)
+			{
+				unbind();
+				throw;
+			}
+
 			evaluate();
 		}
 
@@ -197,7 +386,8 @@ private:
 			if (bound())
 			{
 				expression_ = std::function<T ()>();
-				dependencies_.clear();
+				dirty_ = false;
+				remove_dependencies();
 			}
 		}
 	};
@@ -271,6 +461,12 @@ public:
 		return impl_->bound();
 	}
 
+	// Whether this binding can change on another thread than the bindings around it, see impl_base
+	bool isolated(const std::vector<const void*>& owned = std::vector<const void*>()) const
+	{
+		return impl_->isolated(owned);
+	}
+
 	template<typename T2>
 	void depend_on(const binding<T2>& other)
 	{
@@ -536,6 +732,9 @@ public:
 		result.depend_on(frame_counter);
 		result.depend_on(tweener_func);
 
+		// The tween depends on the frames it has seen, so it is kept evaluated like it is observed.
+		result.on_change(result.impl_, [] { });
+
 		return result;
 	}
 
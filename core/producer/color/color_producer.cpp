@@ -38,6 +38,7 @@
 
 #include <boost/algorithm/string.hpp>
 
+#include <algorithm>
 #include <sstream>
 
 namespace caspar { namespace core {
@@ -51,6 +52,8 @@ draw_frame create_color_frame(void* tag, const spl::shared_ptr<frame_factory>& f
 	for (int i = 0; i < values.size(); ++i)
 		*reinterpret_cast<uint32_t*>(frame.image_data(0).begin() + (i * 4)) = values.at(i);
 
+	frame.set_opaque(std::all_of(values.begin(), values.end(), [](uint32_t value) { return (value >> 24) == 0xFF; }));
+
 	return core::draw_frame(std::move(frame));
 }
 
@@ -71,12 +71,14 @@ frame_producer_dependencies::frame_producer_dependencies(
 		const std::vector<spl::shared_ptr<video_channel>>& channels,
 		const video_format_desc& format_desc,
 		const spl::shared_ptr<const frame_producer_registry> producer_registry,
-		const spl::shared_ptr<const cg_producer_registry> cg_registry)
+		const spl::shared_ptr<const cg_producer_registry> cg_registry,
+		std::function<int64_t ()> channel_frame_number)
 	: frame_factory(frame_factory)
 	, channels(channels)
 	, format_desc(format_desc)
 	, producer_registry(producer_registry)
 	, cg_registry(cg_registry)
+	, channel_frame_number(std::move(channel_frame_number))
 {
 }
 
@@ -136,13 +136,15 @@ struct frame_producer_dependencies
 	video_format_desc								format_desc;
 	spl::shared_ptr<const frame_producer_registry>	producer_registry;
 	spl::shared_ptr<const cg_producer_registry>		cg_registry;
+	std::function<int64_t ()>						channel_frame_number;	// Empty when not created for a channel.
 
 	frame_producer_dependencies(
 			const spl::shared_ptr<core::frame_factory>& frame_factory,
 			const std::vector<spl::shared_ptr<video_channel>>& channels,
 			const video_format_desc& format_desc,
 			const spl::shared_ptr<const frame_producer_registry> producer_registry,
-			const spl::shared_ptr<const cg_producer_registry> cg_registry);
+			const spl::shared_ptr<const cg_producer_registry> cg_registry,
+			std::function<int64_t ()> channel_frame_number = nullptr);
 };
 
 typedef std::function<spl::shared_ptr<core::frame_producer>(const frame_producer_dependencies&, const std::vector<std::wstring>&)> producer_factory_t;
@@ -22,6 +22,7 @@
 #include "../../StdAfx.h"
 
 #include "framerate_producer.h"
+#include "motion_interpolator.h"
 
 #include "../frame_producer.h"
 #include "../../frame/audio_channel_layout.h"
@@ -31,10 +32,13 @@
 #include "../../frame/pixel_format.h"
 #include "../../monitor/monitor.h"
 #include "../../help/help_sink.h"
+#include "../../ancillary/cea708/cea708.h"
 
+#include <common/env.h>
 #include <common/future.h>
 #include <common/tweener.h>
 
+#include <deque>
 #include <functional>
 #include <queue>
 #include <future>
@@ -187,9 +191,13 @@ public:
 	}
 };
 
+// Source frames received ahead of time, so that the motion between them is known before they are shown.
+const std::size_t motion_lookahead = 2;
+
 class framerate_producer : public frame_producer_base
 {
 	spl::shared_ptr<frame_producer>						source_;
+	spl::shared_ptr<frame_factory>						frame_factory_;
 	std::function<boost::rational<int>()>				get_source_framerate_;
 	boost::rational<int>								source_framerate_				= -1;
 	audio_channel_layout								source_channel_layout_			= audio_channel_layout::invalid();
@@ -203,6 +211,9 @@ class framerate_producer : public frame_producer_base
 			const draw_frame& source,
 			const draw_frame& destination,
 			const boost::rational<int64_t>& distance)>	interpolator_					= drop_or_repeat;
+	std::shared_ptr<motion_interpolator>				motion_;
+	const bool											motion_by_default_				= boost::iequals(env::properties().get(L"configuration.framerate.interpolation", L"blend"), L"motion");
+	std::deque<std::pair<uint32_t, draw_frame>>			lookahead_;
 
 	boost::rational<std::int64_t>						current_frame_number_			= 0;
         std::pair<uint32_t, draw_frame>									previous_frame_					= std::make_pair(0, draw_frame::empty());
@@ -212,14 +223,18 @@ class framerate_producer : public frame_producer_base
 	unsigned int										output_repeat_					= 0;
 	unsigned int										output_frame_					= 0;
 	draw_frame											last_frame_						= draw_frame::empty();
+	ancillary::CEA708Retimer							caption_retimer_;
+	ancillary::AncillaryContainer						pending_ancillary_;
 public:
 	framerate_producer(
 			spl::shared_ptr<frame_producer> source,
+			spl::shared_ptr<frame_factory> frame_factory,
 			std::function<boost::rational<int> ()> get_source_framerate,
 			boost::rational<int> destination_framerate,
 			field_mode destination_fieldmode,
 			std::vector<int> destination_audio_cadence)
 		: source_(std::move(source))
+		, frame_factory_(std::move(frame_factory))
 		, get_source_framerate_(std::move(get_source_framerate))
 		, original_destination_framerate_(std::move(destination_framerate))
 		, original_destination_fieldmode_(destination_fieldmode)
@@ -237,20 +252,26 @@ public:
 
 		if (destination_fieldmode_ == field_mode::progressive)
 		{
-			return field1;
+			return attach_ancillary(std::move(field1));
 		}
 		else
 		{
 			auto field2 = do_render_progressive_frame(false);
 
-			return draw_frame::interlace(field1, field2, destination_fieldmode_);
+			return attach_ancillary(draw_frame::interlace(field1, field2, destination_fieldmode_));
 		}
 	}
 
 	std::future<std::wstring> call(const std::vector<std::wstring>& params) override
 	{
 		if (!boost::iequals(params.at(0), L"framerate"))
+		{
+			// The frames received ahead of time may not be what the source
+			// plays after the call (a seek, a loop or a new clip).
+			lookahead_.clear();
+
 			return source_->call(params);
+		}
 
 		if (boost::iequals(params.at(1), L"speed"))
 		{
@@ -265,13 +286,15 @@ public:
 		else if (boost::iequals(params.at(1), L"interpolation"))
 		{
 			if (boost::iequals(params.at(2), L"blend2"))
-				interpolator_ = &blend2;
+				set_interpolator(&blend2);
 			else if (boost::iequals(params.at(2), L"blend3"))
-				interpolator_ = blend3();
+				set_interpolator(blend3());
 			else if (boost::iequals(params.at(2), L"drop_or_repeat"))
-				interpolator_ = &drop_or_repeat;
+				set_interpolator(&drop_or_repeat);
+			else if (boost::iequals(params.at(2), L"motion"))
+				use_motion_interpolation();
 			else
-				CASPAR_THROW_EXCEPTION(user_error() << msg_info("Valid interpolations are DROP_OR_REPEAT, BLEND2 and BLEND3"));
+				CASPAR_THROW_EXCEPTION(user_error() << msg_info("Valid interpolations are DROP_OR_REPEAT, BLEND2, BLEND3 and MOTION"));
 		}
 		else if (boost::iequals(params.at(1), L"output_repeat")) // Only for debugging purposes
 		{
@@ -308,6 +331,9 @@ public:
 		if (incorrect_nb_frames)
 			incorrect_nb_frames->put_value(nb_frames());
 
+		if (motion_)
+			info.add_child(L"motion-interpolation", motion_->info());
+
 		return info;
 	}
 
@@ -374,6 +400,9 @@ private:
 
 		fast_forward_integer_frames(integer_next_frame - integer_current_frame);
 
+		if (motion_)
+			prepare_motion();
+
 		last_frame_ = result;
 		last_frame_.ancillary().clear();
 		if (sound)
@@ -405,12 +434,98 @@ private:
 		return speed_ * user_speed_.fetch();
 	}
 
-	std::pair<uint32_t, draw_frame> pop_frame_from_source()
+	void set_interpolator(decltype(interpolator_) interpolator)
+	{
+		interpolator_	= std::move(interpolator);
+		motion_			= nullptr;
+	}
+
+	void use_motion_interpolation()
+	{
+		if (motion_)
+			return;
+
+		auto motion		= std::make_shared<motion_interpolator>(frame_factory_, &blend2);
+		interpolator_	= [motion](const draw_frame& source, const draw_frame& destination, const boost::rational<int64_t>& distance)
+		{
+			return (*motion)(source, destination, distance);
+		};
+		motion_			= motion;
+	}
+
+	// Starts interpolating the frames coming up at the current speed.
+	void prepare_motion()
+	{
+		while (lookahead_.size() < motion_lookahead)
+			lookahead_.push_back(receive_from_source());
+
+		std::vector<draw_frame> frames { previous_frame_.second };
+
+		if (next_frame_.second != draw_frame::empty())
+			frames.push_back(next_frame_.second);
+
+		for (auto& frame : lookahead_)
+			frames.push_back(frame.second);
+
+		auto speed = get_speed();
+
+		if (speed <= 0)
+			return;
+
+		// Positions relative to previous_frame_, which is the integer part of current_frame_number_.
+		std::vector<std::vector<boost::rational<int64_t>>> distances(frames.size() - 1);
+
+		for (auto position = current_frame_number_ - boost::rational_cast<int64_t>(current_frame_number_);
+				position < static_cast<int64_t>(frames.size() - 1);
+				position += speed)
+		{
+			auto index = boost::rational_cast<int64_t>(position);
+
+			distances.at(index).push_back(position - index);
+		}
+
+		for (std::size_t n = 0; n < distances.size(); ++n)
+		{
+			if (!distances[n].empty())
+				motion_->prepare(frames[n], frames[n + 1], distances[n]);
+		}
+	}
+
+	std::pair<uint32_t, draw_frame> receive_from_source()
 	{
 		auto frame = source_->receive();
-                auto frame_number = source_->frame_number();
+		auto frame_number = source_->frame_number();
+
+		if (motion_)
+			motion_->retain(frame);
+
+		return std::make_pair(frame_number, frame);
+	}
+
+	std::pair<uint32_t, draw_frame> pop_frame_from_source()
+	{
+		std::pair<uint32_t, draw_frame> received;
+
+		if (lookahead_.empty())
+			received = receive_from_source();
+		else
+		{
+			received = std::move(lookahead_.front());
+			lookahead_.pop_front();
+		}
+
+		auto& frame = received.second;
+		auto frame_number = received.first;
 		update_source_framerate();
 
+		// Captions are re-timed separately, repeating or dropping the frame they came with would
+		// duplicate or lose caption bytes.
+		for (auto& captions : frame.ancillary().takeData(ancillary::ancillary_data_type_cea708))
+			caption_retimer_.push(*captions);
+
+		// The remaining messages (SCTE-104 cues among them) go out once, with the next output frame.
+		pending_ancillary_.appendFrom(frame.ancillary());
+
 		if (user_speed_.fetch() == 1)
 		{
 			audio_extractor extractor([this](const const_frame& frame)
@@ -483,6 +598,18 @@ private:
 		return draw_frame::over(frame, draw_frame(std::move(audio_frame)));
 	}
 
+	draw_frame attach_ancillary(draw_frame frame)
+	{
+		auto captions = caption_retimer_.pop(original_destination_framerate_);
+
+		if (captions)
+			frame.ancillary().addData(std::move(captions));
+
+		frame.ancillary().appendFrom(pending_ancillary_);
+
+		return frame;
+	}
+
 	bool enough_sound() const
 	{
 		return source_channel_layout_ == core::audio_channel_layout::invalid()
@@ -540,15 +667,17 @@ private:
 			auto high_destination_framerate	= destination_framerate > 47
 					|| destination_fieldmode_ != field_mode::progressive;
 
-			if (high_source_framerate && high_destination_framerate)	// The bluriness of blend3 is acceptable on high framerates.
-				interpolator_	= blend3();
+			if (motion_by_default_)										// Sharp, but costs CPU time.
+				use_motion_interpolation();
+			else if (high_source_framerate && high_destination_framerate)	// The bluriness of blend3 is acceptable on high framerates.
+				set_interpolator(blend3());
 			else														// blend3 is mostly too blurry on low framerates. blend2 provides a compromise.
-				interpolator_	= &blend2;
+				set_interpolator(&blend2);
 
-			CASPAR_LOG(warning) << source_->print() << L" Frame blending frame rate conversion required to conform to channel frame rate.";
+			CASPAR_LOG(warning) << source_->print() << (motion_ ? L" Motion compensated" : L" Frame blending") << L" frame rate conversion required to conform to channel frame rate.";
 		}
 		else
-			interpolator_		= &drop_or_repeat;
+			set_interpolator(&drop_or_repeat);
 	}
 };
 
@@ -557,6 +686,7 @@ void describe_framerate_producer(help_sink& sink)
 	sink.para()->text(L"Framerate conversion control / Slow motion examples:");
 	sink.example(L">> CALL 1-10 FRAMERATE INTERPOLATION BLEND2", L"enables 2 frame blend interpolation.");
 	sink.example(L">> CALL 1-10 FRAMERATE INTERPOLATION BLEND3", L"enables 3 frame blend interpolation.");
+	sink.example(L">> CALL 1-10 FRAMERATE INTERPOLATION MOTION", L"enables motion compensated interpolation, falling back to 2 frame blending for frames that are not ready in time.");
 	sink.example(L">> CALL 1-10 FRAMERATE INTERPOLATION DROP_OR_REPEAT", L"disables frame interpolation.");
 	sink.example(L">> CALL 1-10 FRAMERATE SPEED 0.25", L"immediately changes the speed to 25%. Sound will be disabled.");
 	sink.example(L">> CALL 1-10 FRAMERATE SPEED 0.25 50", L"changes the speed to 25% linearly over 50 frames. Sound will be disabled.");
@@ -566,6 +696,7 @@ void describe_framerate_producer(help_sink& sink)
 
 spl::shared_ptr<frame_producer> create_framerate_producer(
 		spl::shared_ptr<frame_producer> source,
+		const spl::shared_ptr<frame_factory>& frame_factory,
 		std::function<boost::rational<int> ()> get_source_framerate,
 		boost::rational<int> destination_framerate,
 		field_mode destination_fieldmode,
@@ -573,6 +704,7 @@ spl::shared_ptr<frame_producer> create_framerate_producer(
 {
 	return spl::make_shared<framerate_producer>(
 			std::move(source),
+			frame_factory,
 			std::move(get_source_framerate),
 			std::move(destination_framerate),
 			destination_fieldmode,
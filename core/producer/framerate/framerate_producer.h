@@ -39,6 +39,7 @@ void describe_framerate_producer(help_sink& sink);
 
 spl::shared_ptr<frame_producer> create_framerate_producer(
 		spl::shared_ptr<frame_producer> source,
+		const spl::shared_ptr<frame_factory>& frame_factory, // Creates the frames made by motion interpolation
 		std::function<boost::rational<int> ()> get_source_framerate, // Will be called after first receive() on the source
 		boost::rational<int> destination_framerate,
 		field_mode destination_fieldmode,
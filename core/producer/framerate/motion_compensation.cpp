@@ -0,0 +1,707 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "../../StdAfx.h"
+
+#include "motion_compensation.h"
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include <emmintrin.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+
+namespace caspar { namespace core { namespace motion {
+
+namespace {
+
+const int			block				= motion_field::block_size;
+const int			max_levels			= 5;
+const int			min_level_size		= 64;
+const int			search_range		= 8;		// Full search at the coarsest level, in pixels of that level.
+const int			max_refinements		= 8;
+const std::uint32_t	vector_penalty		= 4;		// Per pixel of deviation from the predicted vector.
+const std::uint32_t	occlusion_cost		= 12 * block * block;
+
+inline int clamp(int value, int min, int max)
+{
+	return std::max(min, std::min(value, max));
+}
+
+inline float clamp(float value, float min, float max)
+{
+	return std::max(min, std::min(value, max));
+}
+
+inline std::uint32_t sad_8x8(const std::uint8_t* a, int a_linesize, const std::uint8_t* b, int b_linesize)
+{
+	auto sum = _mm_setzero_si128();
+
+	for (int y = 0; y < block; y += 2)
+	{
+		auto a_rows = _mm_unpacklo_epi64(
+				_mm_loadl_epi64(reinterpret_cast<const __m128i*>(a + y * a_linesize)),
+				_mm_loadl_epi64(reinterpret_cast<const __m128i*>(a + (y + 1) * a_linesize)));
+		auto b_rows = _mm_unpacklo_epi64(
+				_mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + y * b_linesize)),
+				_mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + (y + 1) * b_linesize)));
+
+		sum = _mm_add_epi32(sum, _mm_sad_epu8(a_rows, b_rows));
+	}
+
+	return static_cast<std::uint32_t>(_mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8)));
+}
+
+inline const std::uint8_t* block_at(const plane& source, int x, int y)
+{
+	return source.data + clamp(y, 0, source.height - block) * source.linesize + clamp(x, 0, source.width - block);
+}
+
+// Keeps the block at x, y moved by the vector inside to.
+inline motion_vector clamp_vector(motion_vector vector, const plane& to, int x, int y)
+{
+	return motion_vector
+	{
+		clamp(x + vector.x, 0, to.width - block) - x,
+		clamp(y + vector.y, 0, to.height - block) - y
+	};
+}
+
+inline std::uint32_t block_cost(const plane& from, int x, int y, const plane& to, motion_vector vector)
+{
+	return sad_8x8(block_at(from, x, y), from.linesize, block_at(to, x + vector.x, y + vector.y), to.linesize);
+}
+
+int level_count(int width, int height)
+{
+	int count = 1;
+
+	while (count < max_levels && (width >> count) >= min_level_size && (height >> count) >= min_level_size)
+		++count;
+
+	return count;
+}
+
+class pyramid
+{
+	std::vector<std::vector<std::uint8_t>>	storage_;
+	std::vector<plane>						levels_;
+public:
+	pyramid(const plane& source, int count)
+		: storage_(count)
+	{
+		levels_.push_back(source);
+
+		for (int level = 1; level < count; ++level)
+		{
+			auto& finer		= levels_.back();
+			auto& data		= storage_[level];
+			int width		= finer.width / 2;
+			int height		= finer.height / 2;
+
+			data.resize(width * height);
+
+			tbb::parallel_for(0, height, [&](int y)
+			{
+				auto upper	= finer.data + 2 * y * finer.linesize;
+				auto lower	= upper + finer.linesize;
+				auto dest	= data.data() + y * width;
+
+				for (int x = 0; x < width; ++x)
+					dest[x] = static_cast<std::uint8_t>((upper[2 * x] + upper[2 * x + 1] + lower[2 * x] + lower[2 * x + 1] + 2) >> 2);
+			});
+
+			levels_.push_back(plane { data.data(), width, height, width });
+		}
+	}
+
+	const plane& level(int level) const
+	{
+		return levels_.at(level);
+	}
+};
+
+motion_field estimate_level(const plane& from, const plane& to, const motion_field* coarser)
+{
+	motion_field field;
+	field.columns	= from.width / block;
+	field.rows		= from.height / block;
+	field.vectors.resize(field.columns * field.rows);
+	field.costs.resize(field.columns * field.rows);
+
+	tbb::parallel_for(0, field.rows, [&](int row)
+	{
+		for (int column = 0; column < field.columns; ++column)
+		{
+			int				x			= column * block;
+			int				y			= row * block;
+			motion_vector	predicted	{ 0, 0 };
+			motion_vector	best		{ 0, 0 };
+			std::uint32_t	best_cost	= std::numeric_limits<std::uint32_t>::max();
+			std::uint32_t	best_score	= std::numeric_limits<std::uint32_t>::max();
+
+			auto evaluate = [&](motion_vector candidate)
+			{
+				candidate	= clamp_vector(candidate, to, x, y);
+				auto cost	= block_cost(from, x, y, to, candidate);
+				auto score	= cost + vector_penalty * (std::abs(candidate.x - predicted.x) + std::abs(candidate.y - predicted.y));
+
+				if (score >= best_score)
+					return false;
+
+				best		= candidate;
+				best_cost	= cost;
+				best_score	= score;
+
+				return true;
+			};
+
+			if (coarser)
+			{
+				auto scaled = [&](int coarser_column, int coarser_row)
+				{
+					auto& vector = coarser->at(coarser_column, coarser_row);
+					return motion_vector { vector.x * 2, vector.y * 2 };
+				};
+
+				predicted = scaled(column / 2, row / 2);
+
+				evaluate(predicted);
+				evaluate(scaled(column / 2 - 1, row / 2));
+				evaluate(scaled(column / 2 + 1, row / 2));
+				evaluate(scaled(column / 2, row / 2 - 1));
+				evaluate(scaled(column / 2, row / 2 + 1));
+				evaluate(motion_vector { 0, 0 });
+
+				for (int n = 0; n < max_refinements; ++n)
+				{
+					auto center		= best;
+					bool improved	= false;
+
+					for (int dy = -1; dy <= 1; ++dy)
+						for (int dx = -1; dx <= 1; ++dx)
+							if (dx != 0 || dy != 0)
+								improved |= evaluate(motion_vector { center.x + dx, center.y + dy });
+
+					if (!improved)
+						break;
+				}
+			}
+			else
+			{
+				for (int dy = -search_range; dy <= search_range; ++dy)
+					for (int dx = -search_range; dx <= search_range; ++dx)
+						evaluate(motion_vector { dx, dy });
+			}
+
+			field.vectors[row * field.columns + column]	= best;
+			field.costs[row * field.columns + column]	= best_cost;
+		}
+	});
+
+	return field;
+}
+
+// Compares the blocks at a in the first and b in the second frame. Near the edges both are moved by
+// the same amount to fit inside, so that they still lie on the same trajectory.
+std::uint32_t trajectory_cost(const plane& first, int ax, int ay, const plane& second, int bx, int by)
+{
+	auto shift = [](int a, int b, int size, int& result)
+	{
+		int min = std::max(-a, -b);
+		int max = std::min(size - block - a, size - block - b);
+
+		result = clamp(0, min, max);
+
+		return min <= max;
+	};
+
+	int dx;
+	int dy;
+
+	if (!shift(ax, bx, first.width, dx) || !shift(ay, by, first.height, dy))
+		return std::numeric_limits<std::uint32_t>::max();
+
+	return sad_8x8(
+			first.data + (ay + dy) * first.linesize + ax + dx, first.linesize,
+			second.data + (by + dy) * second.linesize + bx + dx, second.linesize);
+}
+
+// Bilinear sampling and blending in 1/128 steps, so that the SSE2 version can use 16 bit multiply-adds.
+const int fixed_bits	= 7;
+const int fixed_one		= 1 << fixed_bits;
+
+struct fixed_position
+{
+	int x;
+	int y;
+	int fraction_x;
+	int fraction_y;
+
+	fixed_position(float fx, float fy)
+	{
+		auto floor_x = std::floor(fx);
+		auto floor_y = std::floor(fy);
+
+		x			= static_cast<int>(floor_x);
+		y			= static_cast<int>(floor_y);
+		fraction_x	= static_cast<int>((fx - floor_x) * fixed_one);
+		fraction_y	= static_cast<int>((fy - floor_y) * fixed_one);
+	}
+
+	// Whether count pixels from here can be sampled without clamping.
+	bool inside(const plane& source, int count) const
+	{
+		return x >= 0 && y >= 0 && x + count < source.width && y + 1 < source.height;
+	}
+};
+
+inline int weight_of(float first_weight)
+{
+	return static_cast<int>(first_weight * fixed_one + 0.5f);
+}
+
+// Sample with fixed_bits of fraction, clamped to the edges.
+inline void sample(const plane& source, fixed_position position, int channels, int* out)
+{
+	if (position.x < 0)
+		position.x = position.fraction_x = 0;
+	else if (position.x >= source.width - 1)
+		position.x = source.width - 1, position.fraction_x = 0;
+
+	if (position.y < 0)
+		position.y = position.fraction_y = 0;
+	else if (position.y >= source.height - 1)
+		position.y = source.height - 1, position.fraction_y = 0;
+
+	int		dx	= position.x + 1 < source.width ? channels : 0;
+	int		dy	= position.y + 1 < source.height ? source.linesize : 0;
+	int		wx	= position.fraction_x;
+	int		wy	= position.fraction_y;
+	auto	p	= source.data + position.y * source.linesize + position.x * channels;
+
+	for (int channel = 0; channel < channels; ++channel, ++p)
+	{
+		int top		= p[0] * (fixed_one - wx) + p[dx] * wx;
+		int bottom	= p[dy] * (fixed_one - wx) + p[dy + dx] * wx;
+
+		out[channel] = (top * (fixed_one - wy) + bottom * wy) >> fixed_bits;
+	}
+}
+
+inline std::uint8_t blend(int a, int b, int weight)
+{
+	return static_cast<std::uint8_t>((a * weight + b * (fixed_one - weight) + (1 << (2 * fixed_bits - 1))) >> (2 * fixed_bits));
+}
+
+inline __m128i sample_8(const std::uint8_t* p, int dx, int dy, __m128i wx, __m128i wy)
+{
+	auto zero	= _mm_setzero_si128();
+	auto p00	= _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), zero);
+	auto p01	= _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p + dx)), zero);
+	auto p10	= _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p + dy)), zero);
+	auto p11	= _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p + dy + dx)), zero);
+
+	// wx holds fixed_one - fraction_x and fraction_x interleaved, as does wy.
+	auto top	= _mm_packs_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(p00, p01), wx), _mm_madd_epi16(_mm_unpackhi_epi16(p00, p01), wx));
+	auto bottom	= _mm_packs_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(p10, p11), wx), _mm_madd_epi16(_mm_unpackhi_epi16(p10, p11), wx));
+
+	return _mm_packs_epi32(
+			_mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(top, bottom), wy), fixed_bits),
+			_mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(top, bottom), wy), fixed_bits));
+}
+
+inline __m128i weights(int fraction)
+{
+	return _mm_set1_epi32(((fraction & 0xFFFF) << 16) | (fixed_one - fraction));
+}
+
+// Blends count bytes of the two frames, both moved by the same amount for the whole run.
+void blend_run(
+		const plane& first,
+		fixed_position a,
+		const plane& second,
+		fixed_position b,
+		int channels,
+		int weight,
+		std::uint8_t* dest,
+		int count)
+{
+	auto pa			= first.data + a.y * first.linesize + a.x * channels;
+	auto pb			= second.data + b.y * second.linesize + b.x * channels;
+	auto a_wx		= weights(a.fraction_x);
+	auto a_wy		= weights(a.fraction_y);
+	auto b_wx		= weights(b.fraction_x);
+	auto b_wy		= weights(b.fraction_y);
+	auto ab			= _mm_set1_epi32(((fixed_one - weight) << 16) | weight);
+	auto rounding	= _mm_set1_epi32(1 << (2 * fixed_bits - 1));
+	int n			= 0;
+
+	for (; n + 8 <= count; n += 8)
+	{
+		auto sa = sample_8(pa + n, channels, first.linesize, a_wx, a_wy);
+		auto sb = sample_8(pb + n, channels, second.linesize, b_wx, b_wy);
+
+		auto low	= _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(sa, sb), ab), rounding), 2 * fixed_bits);
+		auto high	= _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(sa, sb), ab), rounding), 2 * fixed_bits);
+		auto result	= _mm_packs_epi32(low, high);
+
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(dest + n), _mm_packus_epi16(result, result));
+	}
+
+	for (; n < count; ++n)
+	{
+		auto sample_one = [&](const std::uint8_t* p, int dy, const fixed_position& position)
+		{
+			int top		= p[0] * (fixed_one - position.fraction_x) + p[channels] * position.fraction_x;
+			int bottom	= p[dy] * (fixed_one - position.fraction_x) + p[dy + channels] * position.fraction_x;
+
+			return (top * (fixed_one - position.fraction_y) + bottom * position.fraction_y) >> fixed_bits;
+		};
+
+		dest[n] = blend(sample_one(pa + n, first.linesize, a), sample_one(pb + n, second.linesize, b), weight);
+	}
+}
+
+inline int cell_of(float position)
+{
+	return static_cast<int>(std::floor(position / block));
+}
+
+}
+
+const motion_vector& motion_field::at(int column, int row) const
+{
+	return vectors[clamp(row, 0, rows - 1) * columns + clamp(column, 0, columns - 1)];
+}
+
+std::uint32_t motion_field::cost_at(int column, int row) const
+{
+	return costs[clamp(row, 0, rows - 1) * columns + clamp(column, 0, columns - 1)];
+}
+
+std::vector<std::uint8_t> extract_luma(const plane& packed, int channels, int color_offset)
+{
+	std::vector<std::uint8_t> luma(packed.width * packed.height);
+
+	tbb::parallel_for(0, packed.height, [&](int y)
+	{
+		auto source	= packed.data + y * packed.linesize + color_offset;
+		auto dest	= luma.data() + y * packed.width;
+
+		for (int x = 0; x < packed.width; ++x, source += channels)
+			dest[x] = static_cast<std::uint8_t>((source[0] + 2 * source[1] + source[2] + 2) >> 2);
+	});
+
+	return luma;
+}
+
+motion_field estimate_motion(const plane& from, const plane& to)
+{
+	auto	count = level_count(from.width, from.height);
+	pyramid	from_levels(from, count);
+	pyramid	to_levels(to, count);
+
+	auto field = estimate_level(from_levels.level(count - 1), to_levels.level(count - 1), nullptr);
+
+	for (int level = count - 2; level >= 0; --level)
+	{
+		auto finer = estimate_level(from_levels.level(level), to_levels.level(level), &field);
+		field = std::move(finer);
+	}
+
+	return field;
+}
+
+void smooth_motion_field(motion_field& field, const plane& from, const plane& to)
+{
+	const auto original = field;
+
+	tbb::parallel_for(0, field.rows, [&](int row)
+	{
+		for (int column = 0; column < field.columns; ++column)
+		{
+			int xs[9];
+			int ys[9];
+			int n = 0;
+
+			for (int dy = -1; dy <= 1; ++dy)
+			{
+				for (int dx = -1; dx <= 1; ++dx, ++n)
+				{
+					auto& neighbour = original.at(column + dx, row + dy);
+					xs[n] = neighbour.x;
+					ys[n] = neighbour.y;
+				}
+			}
+
+			std::nth_element(xs, xs + 4, xs + 9);
+			std::nth_element(ys, ys + 4, ys + 9);
+
+			int		x		= column * block;
+			int		y		= row * block;
+			auto	index	= row * field.columns + column;
+			auto	median	= clamp_vector(motion_vector { xs[4], ys[4] }, to, x, y);
+			auto&	current	= original.vectors[index];
+
+			if (median.x == current.x && median.y == current.y)
+				continue;
+
+			auto cost			= block_cost(from, x, y, to, median);
+			auto current_cost	= original.costs[index];
+
+			if (cost <= current_cost + current_cost / 4 + block * block)
+			{
+				field.vectors[index]	= median;
+				field.costs[index]		= cost;
+			}
+		}
+	});
+}
+
+interpolation_map build_interpolation_map(
+		const motion_field& forward,
+		const motion_field& backward,
+		const plane& first,
+		const plane& second,
+		double distance)
+{
+	interpolation_map map;
+	map.columns		= forward.columns;
+	map.rows		= forward.rows;
+	map.distance	= distance;
+	map.cells.resize(map.columns * map.rows);
+
+	const float			t = static_cast<float>(distance);
+	std::atomic<int>	occluded(0);
+
+	tbb::parallel_for(0, map.rows, [&](int row)
+	{
+		int occluded_in_row = 0;
+
+		for (int column = 0; column < map.columns; ++column)
+		{
+			float cx = column * block + block / 2.0f;
+			float cy = row * block + block / 2.0f;
+
+			// Vectors through the center of the cell at t, u moving the content from the first to the second frame.
+			auto& forward_here	= forward.at(column, row);
+			auto& forward_in	= forward.at(cell_of(cx - t * forward_here.x), cell_of(cy - t * forward_here.y));
+			auto& backward_here	= backward.at(column, row);
+			auto& backward_in	= backward.at(cell_of(cx - (1.0f - t) * backward_here.x), cell_of(cy - (1.0f - t) * backward_here.y));
+
+			const float candidates[][2] =
+			{
+				{ static_cast<float>(forward_here.x),	static_cast<float>(forward_here.y)	},
+				{ static_cast<float>(forward_in.x),		static_cast<float>(forward_in.y)	},
+				{ static_cast<float>(-backward_here.x),	static_cast<float>(-backward_here.y)},
+				{ static_cast<float>(-backward_in.x),	static_cast<float>(-backward_in.y)	},
+				{ 0.0f,									0.0f								}
+			};
+
+			std::uint32_t	best_cost	= std::numeric_limits<std::uint32_t>::max();
+			int				best		= 0;
+			int				ax			= 0;
+			int				ay			= 0;
+			int				bx			= 0;
+			int				by			= 0;
+
+			for (int n = 0; n < 5; ++n)
+			{
+				int candidate_ax = static_cast<int>(std::lround(cx - t * candidates[n][0])) - block / 2;
+				int candidate_ay = static_cast<int>(std::lround(cy - t * candidates[n][1])) - block / 2;
+				int candidate_bx = static_cast<int>(std::lround(cx + (1.0f - t) * candidates[n][0])) - block / 2;
+				int candidate_by = static_cast<int>(std::lround(cy + (1.0f - t) * candidates[n][1])) - block / 2;
+
+				auto cost = trajectory_cost(first, candidate_ax, candidate_ay, second, candidate_bx, candidate_by);
+
+				if (cost < best_cost)
+				{
+					best_cost	= cost;
+					best		= n;
+					ax			= candidate_ax;
+					ay			= candidate_ay;
+					bx			= candidate_bx;
+					by			= candidate_by;
+				}
+			}
+
+			auto& cell			= map.cells[row * map.columns + column];
+			cell.x				= candidates[best][0];
+			cell.y				= candidates[best][1];
+			cell.first_weight	= 1.0f - t;
+
+			if (best_cost > occlusion_cost)
+			{
+				// Content that only the first frame shows has no match in the second, and the other way around.
+				bool first_matches	= forward.cost_at(cell_of(ax + block / 2.0f), cell_of(ay + block / 2.0f)) <= occlusion_cost;
+				bool second_matches	= backward.cost_at(cell_of(bx + block / 2.0f), cell_of(by + block / 2.0f)) <= occlusion_cost;
+
+				if (!first_matches && second_matches)
+				{
+					cell.first_weight = 1.0f;
+					++occluded_in_row;
+				}
+				else if (first_matches && !second_matches)
+				{
+					cell.first_weight = 0.0f;
+					++occluded_in_row;
+				}
+			}
+		}
+
+		occluded += occluded_in_row;
+	});
+
+	map.occluded = occluded;
+
+	return map;
+}
+
+void interpolate_plane(
+		const interpolation_map& map,
+		const plane& first,
+		const plane& second,
+		int channels,
+		int subsampling_x,
+		int subsampling_y,
+		std::uint8_t* destination,
+		int destination_linesize)
+{
+	const float t			= static_cast<float>(map.distance);
+	const float max_column	= static_cast<float>(map.columns - 1);
+	const float max_row		= static_cast<float>(map.rows - 1);
+
+	// The two cells each pixel is interpolated between are the same on every row, as runs of pixels.
+	struct run
+	{
+		int begin;
+		int end;
+		int left;
+		int right;
+	};
+
+	std::vector<run>	runs;
+	std::vector<float>	column_fraction(first.width);
+
+	for (int x = 0; x < first.width; ++x)
+	{
+		float	gx		= clamp(((x + 0.5f) * subsampling_x - block / 2.0f) / block, 0.0f, max_column);
+		int		left	= static_cast<int>(gx);
+
+		column_fraction[x] = gx - left;
+
+		if (runs.empty() || runs.back().left != left)
+			runs.push_back(run { x, x, left, std::min(left + 1, map.columns - 1) });
+
+		runs.back().end = x + 1;
+	}
+
+	tbb::parallel_for(tbb::blocked_range<int>(0, first.height, 16), [&](const tbb::blocked_range<int>& range)
+	{
+		std::vector<interpolation_map::cell> row_cells(map.columns);
+
+		for (int y = range.begin(); y != range.end(); ++y)
+		{
+			// Cells are interpolated between their centers, in luma pixels.
+			float	gy	= clamp(((y + 0.5f) * subsampling_y - block / 2.0f) / block, 0.0f, max_row);
+			int		r0	= static_cast<int>(gy);
+			int		r1	= std::min(r0 + 1, map.rows - 1);
+			float	fy	= gy - r0;
+
+			for (int column = 0; column < map.columns; ++column)
+			{
+				auto& upper = map.cells[r0 * map.columns + column];
+				auto& lower = map.cells[r1 * map.columns + column];
+
+				row_cells[column].x				= upper.x + (lower.x - upper.x) * fy;
+				row_cells[column].y				= upper.y + (lower.y - upper.y) * fy;
+				row_cells[column].first_weight	= upper.first_weight + (lower.first_weight - upper.first_weight) * fy;
+			}
+
+			auto row = destination + y * destination_linesize;
+
+			for (auto& r : runs)
+			{
+				auto& left	= row_cells[r.left];
+				auto& right	= row_cells[r.right];
+
+				if (left.x == right.x && left.y == right.y && left.first_weight == right.first_weight)
+				{
+					float ux = left.x / subsampling_x;
+					float uy = left.y / subsampling_y;
+
+					auto a = fixed_position(r.begin - t * ux, y - t * uy);
+					auto b = fixed_position(r.begin + (1.0f - t) * ux, y + (1.0f - t) * uy);
+
+					if (a.inside(first, r.end - r.begin) && b.inside(second, r.end - r.begin))
+					{
+						blend_run(
+								first, a,
+								second, b,
+								channels,
+								weight_of(left.first_weight),
+								row + r.begin * channels,
+								(r.end - r.begin) * channels);
+						continue;
+					}
+				}
+
+				for (int x = r.begin; x < r.end; ++x)
+				{
+					float	fx		= column_fraction[x];
+					float	ux		= (left.x + (right.x - left.x) * fx) / subsampling_x;
+					float	uy		= (left.y + (right.y - left.y) * fx) / subsampling_y;
+					int		weight	= weight_of(left.first_weight + (right.first_weight - left.first_weight) * fx);
+
+					float ax = x - t * ux;
+					float ay = y - t * uy;
+					float bx = x + (1.0f - t) * ux;
+					float by = y + (1.0f - t) * uy;
+
+					// Content moving in or out of the picture is only in one of the frames.
+					bool a_outside = ax < 0.0f || ay < 0.0f || ax > first.width - 1 || ay > first.height - 1;
+					bool b_outside = bx < 0.0f || by < 0.0f || bx > second.width - 1 || by > second.height - 1;
+
+					if (a_outside && !b_outside)
+						weight = 0;
+					else if (b_outside && !a_outside)
+						weight = fixed_one;
+
+					int a_samples[4];
+					int b_samples[4];
+					sample(first, fixed_position(ax, ay), channels, a_samples);
+					sample(second, fixed_position(bx, by), channels, b_samples);
+
+					auto dest = row + x * channels;
+
+					for (int channel = 0; channel < channels; ++channel)
+						dest[channel] = blend(a_samples[channel], b_samples[channel], weight);
+				}
+			}
+		}
+	});
+}
+
+}}}
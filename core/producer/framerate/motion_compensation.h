@@ -0,0 +1,111 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace caspar { namespace core { namespace motion {
+
+// An 8 bit image plane, channels interleaved bytes per pixel.
+struct plane
+{
+	const std::uint8_t*	data;
+	int					width;
+	int					height;
+	int					linesize;
+};
+
+struct motion_vector
+{
+	int x;
+	int y;
+};
+
+/**
+ * Block motion of one frame relative to another. The vector of a block moves
+ * it from the frame the field was estimated for onto its best match in the
+ * other frame, and its cost is the sum of absolute differences of that match.
+ */
+struct motion_field
+{
+	static const int			block_size = 8;
+
+	int							columns	= 0;
+	int							rows	= 0;
+	std::vector<motion_vector>	vectors;
+	std::vector<std::uint32_t>	costs;
+
+	// Clamped to the field, so callers can look up positions near the edges.
+	const motion_vector& at(int column, int row) const;
+	std::uint32_t cost_at(int column, int row) const;
+};
+
+/**
+ * How each block of an output frame between two frames is built: the motion
+ * from the first to the second frame through it, and how much of the first
+ * frame to use. Regions that are only visible in one of the frames use only
+ * that frame.
+ */
+struct interpolation_map
+{
+	struct cell
+	{
+		float	x;
+		float	y;
+		float	first_weight;
+	};
+
+	int					columns		= 0;
+	int					rows		= 0;
+	double				distance	= 0.0;
+	std::vector<cell>	cells;
+
+	int					occluded	= 0;	// Number of cells that use only one frame.
+};
+
+// Luma plane of a packed 8 bit format, approximated as (c0 + 2 * c1 + c2) / 4 from the three color channels starting at color_offset.
+std::vector<std::uint8_t> extract_luma(const plane& packed, int channels, int color_offset);
+
+// Hierarchical block matching of from onto to. Both are luma planes of the same size.
+motion_field estimate_motion(const plane& from, const plane& to);
+
+// Replaces vectors by the median of their 3x3 neighbourhood where that matches about as well.
+void smooth_motion_field(motion_field& field, const plane& from, const plane& to);
+
+interpolation_map build_interpolation_map(
+		const motion_field& forward,
+		const motion_field& backward,
+		const plane& first,
+		const plane& second,
+		double distance);
+
+// Warps one plane of the two frames to the map's distance. subsampling_x/y is the size of a luma pixel in this plane.
+void interpolate_plane(
+		const interpolation_map& map,
+		const plane& first,
+		const plane& second,
+		int channels,
+		int subsampling_x,
+		int subsampling_y,
+		std::uint8_t* destination,
+		int destination_linesize);
+
+}}}
@@ -0,0 +1,474 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "../../StdAfx.h"
+
+#include "motion_interpolator.h"
+#include "motion_compensation.h"
+
+#include "../../frame/audio_channel_layout.h"
+#include "../../frame/draw_frame.h"
+#include "../../frame/frame.h"
+#include "../../frame/frame_factory.h"
+#include "../../frame/frame_transform.h"
+#include "../../frame/frame_visitor.h"
+#include "../../frame/pixel_format.h"
+
+#include <common/executor.h>
+#include <common/future.h>
+#include <common/log.h>
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/range/algorithm/equal.hpp>
+
+#include <deque>
+#include <future>
+#include <map>
+
+namespace caspar { namespace core {
+
+namespace {
+
+const std::size_t	max_prepared_pairs	= 8;
+const std::size_t	max_retained_images	= 8;
+const std::size_t	max_queued_tasks	= 16;
+const int			min_size			= 2 * motion::motion_field::block_size;
+
+// The single image of a frame and the transforms it is drawn with.
+class image_extractor : public frame_visitor
+{
+	std::vector<frame_transform>	stack_;
+public:
+	std::vector<const_frame>		images;
+	std::vector<frame_transform>	transforms;
+
+	void push(const frame_transform& transform) override
+	{
+		stack_.push_back(transform);
+	}
+
+	void pop() override
+	{
+		stack_.pop_back();
+	}
+
+	void visit(const const_frame& frame) override
+	{
+		if (frame.pixel_format_desc().planes.empty())
+			return;
+
+		images.push_back(frame);
+		transforms = stack_;
+	}
+};
+
+// Audio is not part of the interpolated frames, and is muted by the producer after preparing.
+bool same_image_transforms(const std::vector<frame_transform>& lhs, const std::vector<frame_transform>& rhs)
+{
+	return boost::equal(lhs, rhs, [](const frame_transform& l, const frame_transform& r)
+	{
+		return l.image_transform == r.image_transform;
+	});
+}
+
+bool same_format(const pixel_format_desc& lhs, const pixel_format_desc& rhs)
+{
+	if (lhs.format != rhs.format || lhs.planes.size() != rhs.planes.size())
+		return false;
+
+	for (std::size_t n = 0; n < lhs.planes.size(); ++n)
+	{
+		auto& l = lhs.planes[n];
+		auto& r = rhs.planes[n];
+
+		if (l.width != r.width || l.height != r.height || l.linesize != r.linesize || l.stride != r.stride)
+			return false;
+	}
+
+	return true;
+}
+
+// Byte offset of the first of three color channels to estimate motion on, or -1 if not supported.
+int color_offset(pixel_format format)
+{
+	switch (format)
+	{
+	case pixel_format::bgra:
+	case pixel_format::rgba:
+	case pixel_format::bgr:
+	case pixel_format::rgb:
+		return 0;
+	case pixel_format::argb:
+	case pixel_format::abgr:
+		return 1;
+	case pixel_format::gray:
+	case pixel_format::luma:
+	case pixel_format::ycbcr:
+	case pixel_format::ycbcra:
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+bool is_packed_color(pixel_format format)
+{
+	return format != pixel_format::gray
+			&& format != pixel_format::luma
+			&& format != pixel_format::ycbcr
+			&& format != pixel_format::ycbcra;
+}
+
+// A copy in system memory of the image of a frame, taken when the frame is
+// received from the source. The buffers of the frame itself may be mapped
+// for upload only, and are reused once the frame has been drawn.
+struct image_copy
+{
+	std::uint64_t							id;
+	const void*								tag;
+	pixel_format_desc						desc;
+	std::vector<std::vector<std::uint8_t>>	planes;
+
+	explicit image_copy(const const_frame& frame)
+		: id(frame.image_id())
+		, tag(frame.stream_tag())
+		, desc(frame.pixel_format_desc())
+	{
+		for (int index = 0; index < static_cast<int>(desc.planes.size()); ++index)
+		{
+			auto data = frame.image_data(index);
+			planes.emplace_back(data.begin(), data.end());
+		}
+	}
+
+	motion::plane plane(int index) const
+	{
+		auto& plane = desc.planes.at(index);
+
+		return motion::plane { planes.at(index).data(), plane.width, plane.height, plane.linesize };
+	}
+};
+
+// Motion between two images, in both directions, estimated on their luma.
+struct analysis
+{
+	std::vector<std::uint8_t>	first_luma_storage;
+	std::vector<std::uint8_t>	second_luma_storage;
+	motion::plane				first_luma;
+	motion::plane				second_luma;
+	motion::motion_field		forward;
+	motion::motion_field		backward;
+
+	analysis(const image_copy& first, const image_copy& second)
+	{
+		auto format = first.desc.format;
+
+		if (is_packed_color(format))
+		{
+			auto channels = first.desc.planes.at(0).stride;
+
+			first_luma_storage	= motion::extract_luma(first.plane(0), channels, color_offset(format));
+			second_luma_storage	= motion::extract_luma(second.plane(0), channels, color_offset(format));
+			first_luma			= motion::plane { first_luma_storage.data(), first.desc.planes.at(0).width, first.desc.planes.at(0).height, first.desc.planes.at(0).width };
+			second_luma			= motion::plane { second_luma_storage.data(), second.desc.planes.at(0).width, second.desc.planes.at(0).height, second.desc.planes.at(0).width };
+		}
+		else
+		{
+			first_luma			= first.plane(0);
+			second_luma			= second.plane(0);
+		}
+
+		forward		= motion::estimate_motion(first_luma, second_luma);
+		backward	= motion::estimate_motion(second_luma, first_luma);
+		motion::smooth_motion_field(forward, first_luma, second_luma);
+		motion::smooth_motion_field(backward, second_luma, first_luma);
+	}
+};
+
+// The futures of executor::begin_invoke are deferred, so results are passed through a promise that can be polled.
+template<typename Func>
+auto run_on(executor& worker, Func func) -> std::shared_future<decltype(func())>
+{
+	auto promise	= std::make_shared<std::promise<decltype(func())>>();
+	auto future		= promise->get_future().share();
+
+	worker.begin_invoke([=]
+	{
+		try
+		{
+			promise->set_value(func());
+		}
+		catch (...)
+		{
+			promise->set_exception(std::current_exception());
+		}
+	});
+
+	return future;
+}
+
+// The planes of the result are only written to, they may be mapped for upload only.
+const_frame interpolate(frame_factory& frame_factory, const analysis& motion, const image_copy& first, const image_copy& second, double distance)
+{
+	auto map	= motion::build_interpolation_map(motion.forward, motion.backward, motion.first_luma, motion.second_luma, distance);
+	auto& desc	= first.desc;
+	auto& luma	= desc.planes.at(0);
+	auto frame	= frame_factory.create_frame(first.tag, desc, audio_channel_layout::invalid());
+
+	for (int index = 0; index < static_cast<int>(desc.planes.size()); ++index)
+	{
+		auto& plane = desc.planes.at(index);
+
+		motion::interpolate_plane(
+				map,
+				first.plane(index),
+				second.plane(index),
+				plane.stride,
+				luma.width / plane.width,
+				luma.height / plane.height,
+				frame.image_data(index).begin(),
+				plane.linesize);
+	}
+
+	return const_frame(std::move(frame));
+}
+
+}
+
+struct motion_interpolator::impl
+{
+	struct prepared_pair
+	{
+		std::shared_ptr<const image_copy>						first;
+		std::shared_ptr<const image_copy>						second;
+		std::vector<frame_transform>							transforms;
+		std::shared_future<std::shared_ptr<const analysis>>		motion;
+		std::map<boost::rational<int64_t>, std::shared_future<const_frame>>	frames;
+	};
+
+	spl::shared_ptr<frame_factory>								frame_factory_;
+	fallback_interpolator										fallback_;
+	std::deque<std::shared_ptr<const image_copy>>				images_;
+	std::deque<std::shared_ptr<prepared_pair>>					pairs_;
+	std::int64_t												interpolated_		= 0;
+	std::int64_t												late_				= 0;
+	std::int64_t												unsupported_		= 0;
+	std::int64_t												skipped_			= 0;
+	executor													executor_;
+
+	impl(const spl::shared_ptr<frame_factory>& frame_factory, fallback_interpolator fallback)
+		: frame_factory_(frame_factory)
+		, fallback_(std::move(fallback))
+		, executor_(L"motion_interpolator")
+	{
+	}
+
+	~impl()
+	{
+		executor_.clear();
+	}
+
+	// Only frames with one image of a supported format can be interpolated.
+	void retain(const draw_frame& frame)
+	{
+		image_extractor extractor;
+		frame.accept(extractor);
+
+		if (extractor.images.size() != 1)
+			return;
+
+		auto& image = extractor.images.front();
+
+		if (find_image(image.image_id())
+				|| color_offset(image.pixel_format_desc().format) < 0
+				|| image.width() < min_size
+				|| image.height() < min_size)
+			return;
+
+		images_.push_back(std::make_shared<image_copy>(image));
+
+		while (images_.size() > max_retained_images)
+			images_.pop_front();
+	}
+
+	std::shared_ptr<const image_copy> find_image(std::uint64_t id) const
+	{
+		for (auto& image : images_)
+		{
+			if (image->id == id)
+				return image;
+		}
+
+		return nullptr;
+	}
+
+	// Only retained frames with one image and the same transforms can be interpolated.
+	std::shared_ptr<prepared_pair> find_or_create(const draw_frame& source, const draw_frame& destination)
+	{
+		image_extractor first;
+		image_extractor second;
+		source.accept(first);
+		destination.accept(second);
+
+		if (first.images.size() != 1 || second.images.size() != 1)
+			return nullptr;
+
+		auto first_id	= first.images.front().image_id();
+		auto second_id	= second.images.front().image_id();
+
+		for (auto& pair : pairs_)
+		{
+			if (pair->first->id == first_id && pair->second->id == second_id)
+				return same_image_transforms(pair->transforms, first.transforms) ? pair : nullptr;
+		}
+
+		auto first_image	= find_image(first_id);
+		auto second_image	= find_image(second_id);
+
+		if (!first_image
+				|| !second_image
+				|| !same_image_transforms(first.transforms, second.transforms)
+				|| !same_format(first_image->desc, second_image->desc))
+			return nullptr;
+
+		if (executor_.size() >= max_queued_tasks)
+		{
+			++skipped_;
+			return nullptr;
+		}
+
+		auto pair			= std::make_shared<prepared_pair>();
+		pair->first			= first_image;
+		pair->second		= second_image;
+		pair->transforms	= first.transforms;
+		pair->motion		= run_on(executor_, [=]
+		{
+			return std::shared_ptr<const analysis>(std::make_shared<analysis>(*first_image, *second_image));
+		});
+
+		pairs_.push_back(pair);
+
+		while (pairs_.size() > max_prepared_pairs)
+			pairs_.pop_front();
+
+		return pair;
+	}
+
+	void prepare(const draw_frame& source, const draw_frame& destination, const std::vector<boost::rational<int64_t>>& distances)
+	{
+		auto pair = find_or_create(source, destination);
+
+		if (!pair)
+			return;
+
+		for (auto& distance : distances)
+		{
+			if (distance == 0 || pair->frames.find(distance) != pair->frames.end())
+				continue;
+
+			if (executor_.size() >= max_queued_tasks)
+			{
+				++skipped_;
+				return;
+			}
+
+			auto factory	= frame_factory_;
+			auto motion		= pair->motion;
+			auto first		= pair->first;
+			auto second		= pair->second;
+			auto t			= boost::rational_cast<double>(distance);
+
+			// Runs after the motion estimation, on the same thread.
+			pair->frames[distance] = run_on(executor_, [=]
+			{
+				return interpolate(*factory, *motion.get(), *first, *second, t);
+			});
+		}
+	}
+
+	draw_frame interpolate_frame(const draw_frame& source, const draw_frame& destination, const boost::rational<int64_t>& distance)
+	{
+		if (distance == 0 || destination == draw_frame::empty())
+			return fallback_(source, destination, distance);
+
+		auto pair = find_or_create(source, destination);
+
+		if (!pair)
+		{
+			++unsupported_;
+			return fallback_(source, destination, distance);
+		}
+
+		auto frame = pair->frames.find(distance);
+
+		if (frame == pair->frames.end() || !is_ready(frame->second))
+		{
+			++late_;
+			return fallback_(source, destination, distance);
+		}
+
+		const_frame image;
+
+		try
+		{
+			image = frame->second.get();
+		}
+		catch (...)
+		{
+			CASPAR_LOG_CURRENT_EXCEPTION();
+			pair->frames.erase(frame);
+			++unsupported_;
+			return fallback_(source, destination, distance);
+		}
+
+		++interpolated_;
+
+		// Drawn like the source image would have been.
+		auto result = draw_frame(std::move(image));
+		result.transform() = pair->transforms.back();
+
+		for (auto transform = pair->transforms.rbegin() + 1; transform != pair->transforms.rend(); ++transform)
+		{
+			result = draw_frame(std::vector<draw_frame> { result });
+			result.transform() = *transform;
+		}
+
+		return result;
+	}
+
+	boost::property_tree::wptree info() const
+	{
+		boost::property_tree::wptree info;
+
+		info.add(L"interpolated",	interpolated_);
+		info.add(L"late",			late_);
+		info.add(L"unsupported",	unsupported_);
+		info.add(L"skipped",		skipped_);
+
+		return info;
+	}
+};
+
+motion_interpolator::motion_interpolator(const spl::shared_ptr<frame_factory>& frame_factory, fallback_interpolator fallback) : impl_(new impl(frame_factory, std::move(fallback))) {}
+void motion_interpolator::retain(const draw_frame& frame) { impl_->retain(frame); }
+void motion_interpolator::prepare(const draw_frame& source, const draw_frame& destination, const std::vector<boost::rational<int64_t>>& distances) { impl_->prepare(source, destination, distances); }
+draw_frame motion_interpolator::operator()(const draw_frame& source, const draw_frame& destination, const boost::rational<int64_t>& distance) { return impl_->interpolate_frame(source, destination, distance); }
+boost::property_tree::wptree motion_interpolator::info() const { return impl_->info(); }
+
+}}
@@ -0,0 +1,72 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "../../fwd.h"
+
+#include <common/memory.h>
+
+#include <boost/property_tree/ptree_fwd.hpp>
+#include <boost/rational.hpp>
+
+#include <functional>
+#include <vector>
+
+namespace caspar { namespace core {
+
+/**
+ * Motion compensated frame interpolation on the CPU, for frames with a single
+ * 8 bit image. The motion between two frames is estimated and the frames in
+ * between are warped on a worker thread, ahead of when they are needed, after
+ * prepare() has been called for them. Frames that are not ready in time, or
+ * can't be interpolated, are made by the fallback interpolator instead. The
+ * interpolated frames are created by the frame factory.
+ *
+ * Only frames given to retain() are interpolated. Their images are copied to
+ * system memory there, before the frames are drawn, since the worker can't
+ * read the buffers of the frame factory.
+ *
+ * Copies share the same worker and prepared frames.
+ */
+class motion_interpolator
+{
+public:
+	typedef std::function<draw_frame (
+			const draw_frame& source,
+			const draw_frame& destination,
+			const boost::rational<int64_t>& distance)> fallback_interpolator;
+
+	motion_interpolator(const spl::shared_ptr<frame_factory>& frame_factory, fallback_interpolator fallback);
+
+	// Copies the image of a frame just received from the source, the last few are kept.
+	void retain(const draw_frame& frame);
+
+	// Starts interpolating the frames at the given distances between source and destination.
+	void prepare(const draw_frame& source, const draw_frame& destination, const std::vector<boost::rational<int64_t>>& distances);
+
+	draw_frame operator()(const draw_frame& source, const draw_frame& destination, const boost::rational<int64_t>& distance);
+
+	boost::property_tree::wptree info() const;
+private:
+	struct impl;
+	spl::shared_ptr<impl> impl_;
+};
+
+}}
@@ -0,0 +1,717 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "../../StdAfx.h"
+
+#include "expression_compiler.h"
+
+#include <common/except.h>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/locale.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <tuple>
+#include <vector>
+
+namespace caspar { namespace core { namespace scene {
+
+namespace {
+
+enum class opcode : uint8_t
+{
+	load_number,
+	load_boolean,
+	load_string,
+	move_number,
+	move_boolean,
+	move_string,
+	jump,
+	jump_if_false,
+	negate,
+	multiply,
+	divide,
+	modulus,
+	add,
+	subtract,
+	sin,
+	cos,
+	abs,
+	floor,
+	length,
+	less,
+	less_or_equal,
+	greater,
+	greater_or_equal,
+	equal_number,
+	equal_boolean,
+	equal_string,
+	not_,
+	and_,
+	or_,
+	concat,
+	number_to_string,
+	boolean_to_string,
+	to_lower,
+	to_upper
+};
+
+struct instruction
+{
+	opcode		op;
+	uint32_t	dst;
+	uint32_t	a;
+	uint32_t	b;
+};
+
+const std::locale& utf_locale()
+{
+	static const std::locale locale = []
+	{
+		boost::locale::generator gen;
+		gen.categories(boost::locale::codepage_facet);
+		gen.categories(boost::locale::convert_facet);
+
+		return gen("");
+	}();
+
+	return locale;
+}
+
+// Typed registers, one file per value type. Constants are written once when the
+// program is compiled, every other register is written by exactly one instruction.
+struct expression_program
+{
+	std::vector<instruction>			code;
+	std::vector<double>					numbers;
+	std::vector<char>					booleans;
+	std::vector<std::wstring>			strings;
+	std::vector<binding<double>>		number_leaves;
+	std::vector<binding<bool>>			boolean_leaves;
+	std::vector<binding<std::wstring>>	string_leaves;
+	uint32_t							result	= 0;
+
+	void run()
+	{
+		auto n		= numbers.data();
+		auto b		= booleans.data();
+		auto s		= strings.data();
+		size_t pc	= 0;
+
+		while (pc < code.size())
+		{
+			const auto& i = code[pc++];
+
+			switch (i.op)
+			{
+			case opcode::load_number:		n[i.dst] = number_leaves[i.a].get();								break;
+			case opcode::load_boolean:		b[i.dst] = boolean_leaves[i.a].get();								break;
+			case opcode::load_string:		s[i.dst] = string_leaves[i.a].get();								break;
+			case opcode::move_number:		n[i.dst] = n[i.a];													break;
+			case opcode::move_boolean:		b[i.dst] = b[i.a];													break;
+			case opcode::move_string:		s[i.dst] = s[i.a];													break;
+			case opcode::jump:				pc = i.dst;															break;
+			case opcode::jump_if_false:		if (!b[i.a]) pc = i.dst;											break;
+			case opcode::negate:			n[i.dst] = -n[i.a];													break;
+			case opcode::multiply:			n[i.dst] = n[i.a] * n[i.b];											break;
+			case opcode::divide:			n[i.dst] = n[i.a] / n[i.b];											break;
+			case opcode::modulus:			n[i.dst] = static_cast<double>(static_cast<int64_t>(n[i.a]) % static_cast<int64_t>(n[i.b]));	break;
+			case opcode::add:				n[i.dst] = n[i.a] + n[i.b];											break;
+			case opcode::subtract:			n[i.dst] = n[i.a] - n[i.b];											break;
+			case opcode::sin:				n[i.dst] = std::sin(n[i.a]);										break;
+			case opcode::cos:				n[i.dst] = std::cos(n[i.a]);										break;
+			case opcode::abs:				n[i.dst] = std::abs(n[i.a]);										break;
+			case opcode::floor:				n[i.dst] = std::floor(n[i.a]);										break;
+			case opcode::length:			n[i.dst] = static_cast<double>(s[i.a].length());					break;
+			case opcode::less:				b[i.dst] = n[i.a] < n[i.b];											break;
+			case opcode::less_or_equal:		b[i.dst] = n[i.a] <= n[i.b];										break;
+			case opcode::greater:			b[i.dst] = n[i.a] > n[i.b];											break;
+			case opcode::greater_or_equal:	b[i.dst] = n[i.a] >= n[i.b];										break;
+			case opcode::equal_number:		b[i.dst] = n[i.a] == n[i.b];										break;
+			case opcode::equal_boolean:		b[i.dst] = (b[i.a] != 0) == (b[i.b] != 0);							break;
+			case opcode::equal_string:		b[i.dst] = s[i.a] == s[i.b];										break;
+			case opcode::not_:				b[i.dst] = !b[i.a];													break;
+			case opcode::and_:				b[i.dst] = b[i.a] && b[i.b];										break;
+			case opcode::or_:				b[i.dst] = b[i.a] || b[i.b];										break;
+			case opcode::concat:			s[i.dst] = s[i.a] + s[i.b];											break;
+			case opcode::number_to_string:	s[i.dst] = boost::lexical_cast<std::wstring>(n[i.a]);				break;
+			case opcode::boolean_to_string:	s[i.dst] = boost::lexical_cast<std::wstring>(b[i.a] != 0);			break;
+			case opcode::to_lower:			s[i.dst] = boost::locale::to_lower(s[i.a], utf_locale());			break;
+			case opcode::to_upper:			s[i.dst] = boost::locale::to_upper(s[i.a], utf_locale());			break;
+			}
+		}
+	}
+};
+
+template<typename T> T result_of(const expression_program& program);
+template<> double result_of(const expression_program& program) { return program.numbers[program.result]; }
+template<> bool result_of(const expression_program& program) { return program.booleans[program.result] != 0; }
+template<> std::wstring result_of(const expression_program& program) { return program.strings[program.result]; }
+
+struct node_key
+{
+	expression_op		op;
+	expression_type		type;
+	const void*			args[3];
+	int					leaf;
+	uint64_t			number;
+	bool				boolean;
+	std::wstring		string;
+
+	explicit node_key(const expression_node& node)
+		: op(node.op)
+		, type(node.type)
+		, args { node.args[0].get(), node.args[1].get(), node.args[2].get() }
+		, leaf(node.leaf)
+		, boolean(node.boolean)
+		, string(node.string)
+	{
+		// Compare bit patterns so that a folded NaN can still be a key.
+		std::memcpy(&number, &node.number, sizeof(number));
+	}
+
+	bool operator<(const node_key& other) const
+	{
+		return std::tie(op, type, args[0], args[1], args[2], leaf, number, boolean, string)
+				< std::tie(other.op, other.type, other.args[0], other.args[1], other.args[2], other.leaf, other.number, other.boolean, other.string);
+	}
+};
+
+struct expression_leaves
+{
+	std::vector<binding<double>>		numbers;
+	std::vector<binding<bool>>			booleans;
+	std::vector<binding<std::wstring>>	strings;
+};
+
+bool all_constant(const expression_node& node)
+{
+	for (auto& arg : node.args)
+		if (arg && arg->op != expression_op::constant)
+			return false;
+
+	return true;
+}
+
+}
+
+struct expression_builder::impl
+{
+	expression_leaves					leaves;
+	std::map<void*, expression>			leaves_by_identity;
+	std::map<node_key, expression>		nodes;
+
+	expression intern(const expression_node& node)
+	{
+		node_key key(node);
+		auto it = nodes.find(key);
+
+		if (it != nodes.end())
+			return it->second;
+
+		auto result = std::make_shared<const expression_node>(node);
+		nodes.insert(std::make_pair(std::move(key), result));
+
+		return result;
+	}
+
+	template<typename T>
+	expression leaf(const binding<T>& value, std::vector<binding<T>>& of_type, expression_type type)
+	{
+		auto it = leaves_by_identity.find(value.identity());
+
+		if (it != leaves_by_identity.end())
+			return it->second;
+
+		expression_node node;
+		node.op		= expression_op::leaf;
+		node.type	= type;
+		node.leaf	= static_cast<int>(of_type.size());
+		of_type.push_back(value);
+
+		auto result = intern(node);
+		leaves_by_identity.insert(std::make_pair(value.identity(), result));
+
+		return result;
+	}
+
+	expression make(expression_op op, expression_type type, const expression& a, const expression& b = nullptr, const expression& c = nullptr)
+	{
+		expression_node node;
+		node.op		= op;
+		node.type	= type;
+		node.args[0]	= a;
+		node.args[1]	= b;
+		node.args[2]	= c;
+
+		if (!all_constant(node))
+			return intern(node);
+
+		// An integer modulus by zero is left to fail at run time, like it did before folding.
+		if (op == expression_op::modulus && static_cast<int64_t>(b->number) == 0)
+			return intern(node);
+
+		return fold(std::make_shared<const expression_node>(node));
+	}
+
+	expression fold(const expression& root);
+};
+
+namespace {
+
+class program_compiler
+{
+	const expression_leaves&						leaves_of_builder_;
+	expression_program&								program_;
+	std::map<const expression_node*, uint32_t>		constants_;
+	std::map<const expression_node*, uint32_t>		values_;
+	std::map<std::pair<expression_type, int>, uint32_t>	leaves_;
+public:
+	program_compiler(const expression_leaves& leaves, expression_program& program)
+		: leaves_of_builder_(leaves)
+		, program_(program)
+	{
+	}
+
+	uint32_t compile(const expression& node)
+	{
+		switch (node->op)
+		{
+		case expression_op::constant:
+			return constant(node);
+		case expression_op::select:
+			return select(node);
+		default:
+			break;
+		}
+
+		// Subexpressions are shared, so anything already computed on this path is reused.
+		auto it = values_.find(node.get());
+
+		if (it != values_.end())
+			return it->second;
+
+		uint32_t dst;
+
+		if (node->op == expression_op::leaf)
+		{
+			dst = allocate(node->type);
+			emit(load_op(node->type), dst, leaf(node));
+		}
+		else
+		{
+			auto a = compile(node->args[0]);
+			auto b = node->args[1] ? compile(node->args[1]) : 0u;
+			dst = allocate(node->type);
+			emit(opcode_of(*node), dst, a, b);
+		}
+
+		values_.insert(std::make_pair(node.get(), dst));
+
+		return dst;
+	}
+private:
+	uint32_t select(const expression& node)
+	{
+		auto condition	= compile(node->args[0]);
+		auto dst		= allocate(node->type);
+		auto to_false	= emit(opcode::jump_if_false, 0, condition);
+
+		// Values computed in one branch are not available after it.
+		auto before		= values_;
+		emit(move_op(node->type), dst, compile(node->args[1]));
+		values_			= before;
+		auto to_end		= emit(opcode::jump, 0);
+
+		program_.code[to_false].dst = static_cast<uint32_t>(program_.code.size());
+		emit(move_op(node->type), dst, compile(node->args[2]));
+		values_			= std::move(before);
+		program_.code[to_end].dst = static_cast<uint32_t>(program_.code.size());
+
+		return dst;
+	}
+
+	uint32_t constant(const expression& node)
+	{
+		auto it = constants_.find(node.get());
+
+		if (it != constants_.end())
+			return it->second;
+
+		auto dst = allocate(node->type);
+
+		switch (node->type)
+		{
+		case expression_type::number:	program_.numbers[dst]	= node->number;		break;
+		case expression_type::boolean:	program_.booleans[dst]	= node->boolean;	break;
+		case expression_type::string:	program_.strings[dst]	= node->string;		break;
+		}
+
+		constants_.insert(std::make_pair(node.get(), dst));
+
+		return dst;
+	}
+
+	uint32_t leaf(const expression& node)
+	{
+		auto key	= std::make_pair(node->type, node->leaf);
+		auto it		= leaves_.find(key);
+
+		if (it != leaves_.end())
+			return it->second;
+
+		uint32_t index = 0;
+
+		switch (node->type)
+		{
+		case expression_type::number:
+			index = static_cast<uint32_t>(program_.number_leaves.size());
+			program_.number_leaves.push_back(leaves_of_builder_.numbers.at(node->leaf));
+			break;
+		case expression_type::boolean:
+			index = static_cast<uint32_t>(program_.boolean_leaves.size());
+			program_.boolean_leaves.push_back(leaves_of_builder_.booleans.at(node->leaf));
+			break;
+		case expression_type::string:
+			index = static_cast<uint32_t>(program_.string_leaves.size());
+			program_.string_leaves.push_back(leaves_of_builder_.strings.at(node->leaf));
+			break;
+		}
+
+		leaves_.insert(std::make_pair(key, index));
+
+		return index;
+	}
+
+	uint32_t allocate(expression_type type)
+	{
+		switch (type)
+		{
+		case expression_type::number:
+			program_.numbers.push_back(0.0);
+			return static_cast<uint32_t>(program_.numbers.size() - 1);
+		case expression_type::boolean:
+			program_.booleans.push_back(false);
+			return static_cast<uint32_t>(program_.booleans.size() - 1);
+		default:
+			program_.strings.emplace_back();
+			return static_cast<uint32_t>(program_.strings.size() - 1);
+		}
+	}
+
+	size_t emit(opcode op, uint32_t dst, uint32_t a = 0, uint32_t b = 0)
+	{
+		program_.code.push_back(instruction { op, dst, a, b });
+
+		return program_.code.size() - 1;
+	}
+
+	static opcode load_op(expression_type type)
+	{
+		switch (type)
+		{
+		case expression_type::number:	return opcode::load_number;
+		case expression_type::boolean:	return opcode::load_boolean;
+		default:						return opcode::load_string;
+		}
+	}
+
+	static opcode move_op(expression_type type)
+	{
+		switch (type)
+		{
+		case expression_type::number:	return opcode::move_number;
+		case expression_type::boolean:	return opcode::move_boolean;
+		default:						return opcode::move_string;
+		}
+	}
+
+	static opcode opcode_of(const expression_node& node)
+	{
+		switch (node.op)
+		{
+		case expression_op::negate:				return opcode::negate;
+		case expression_op::not_:				return opcode::not_;
+		case expression_op::multiply:			return opcode::multiply;
+		case expression_op::divide:				return opcode::divide;
+		case expression_op::modulus:			return opcode::modulus;
+		case expression_op::add:				return opcode::add;
+		case expression_op::subtract:			return opcode::subtract;
+		case expression_op::less:				return opcode::less;
+		case expression_op::less_or_equal:		return opcode::less_or_equal;
+		case expression_op::greater:			return opcode::greater;
+		case expression_op::greater_or_equal:	return opcode::greater_or_equal;
+		case expression_op::and_:				return opcode::and_;
+		case expression_op::or_:				return opcode::or_;
+		case expression_op::concat:				return opcode::concat;
+		case expression_op::sin:				return opcode::sin;
+		case expression_op::cos:				return opcode::cos;
+		case expression_op::abs:				return opcode::abs;
+		case expression_op::floor:				return opcode::floor;
+		case expression_op::to_lower:			return opcode::to_lower;
+		case expression_op::to_upper:			return opcode::to_upper;
+		case expression_op::length:				return opcode::length;
+		case expression_op::equal:
+			switch (node.args[0]->type)
+			{
+			case expression_type::number:		return opcode::equal_number;
+			case expression_type::boolean:		return opcode::equal_boolean;
+			default:							return opcode::equal_string;
+			}
+		case expression_op::to_string:
+			return node.args[0]->type == expression_type::number ? opcode::number_to_string : opcode::boolean_to_string;
+		default:
+			CASPAR_THROW_EXCEPTION(invalid_operation() << msg_info(L"Expression operation can not be compiled"));
+		}
+	}
+};
+
+template<typename T>
+binding<T> run_program(const std::shared_ptr<expression_program>& program)
+{
+	binding<T> result([program] { program->run(); return result_of<T>(*program); });
+
+	for (auto& leaf : program->number_leaves)
+		result.depend_on(leaf);
+	for (auto& leaf : program->boolean_leaves)
+		result.depend_on(leaf);
+	for (auto& leaf : program->string_leaves)
+		result.depend_on(leaf);
+
+	return result;
+}
+
+void require_type(const expression& e, expression_type type)
+{
+	if (!e || e->type != type)
+		CASPAR_THROW_EXCEPTION(invalid_argument() << msg_info(L"Operand of wrong type in expression"));
+}
+
+}
+
+expression expression_builder::impl::fold(const expression& root)
+{
+	expression_program program;
+	program.result = program_compiler(leaves, program).compile(root);
+	program.run();
+
+	expression_node node;
+	node.op		= expression_op::constant;
+	node.type	= root->type;
+
+	switch (root->type)
+	{
+	case expression_type::number:	node.number		= result_of<double>(program);		break;
+	case expression_type::boolean:	node.boolean	= result_of<bool>(program);			break;
+	case expression_type::string:	node.string		= result_of<std::wstring>(program);	break;
+	}
+
+	return intern(node);
+}
+
+expression_builder::expression_builder()
+	: impl_(std::make_shared<impl>())
+{
+}
+
+expression expression_builder::constant(double value)
+{
+	expression_node node;
+	node.op		= expression_op::constant;
+	node.type	= expression_type::number;
+	node.number	= value;
+
+	return impl_->intern(node);
+}
+
+expression expression_builder::constant(bool value)
+{
+	expression_node node;
+	node.op			= expression_op::constant;
+	node.type		= expression_type::boolean;
+	node.boolean	= value;
+
+	return impl_->intern(node);
+}
+
+expression expression_builder::constant(const std::wstring& value)
+{
+	expression_node node;
+	node.op		= expression_op::constant;
+	node.type	= expression_type::string;
+	node.string	= value;
+
+	return impl_->intern(node);
+}
+
+expression expression_builder::leaf(const binding<double>& value)
+{
+	return impl_->leaf(value, impl_->leaves.numbers, expression_type::number);
+}
+
+expression expression_builder::leaf(const binding<bool>& value)
+{
+	return impl_->leaf(value, impl_->leaves.booleans, expression_type::boolean);
+}
+
+expression expression_builder::leaf(const binding<std::wstring>& value)
+{
+	return impl_->leaf(value, impl_->leaves.strings, expression_type::string);
+}
+
+expression expression_builder::leaf(const binding<int64_t>& value)
+{
+	// Read as a number, converted once however often the variable is used.
+	auto it = impl_->leaves_by_identity.find(value.identity());
+
+	if (it != impl_->leaves_by_identity.end())
+		return it->second;
+
+	auto result = leaf(value.as<double>());
+	impl_->leaves_by_identity.insert(std::make_pair(value.identity(), result));
+
+	return result;
+}
+
+expression expression_builder::apply(expression_op op, const expression& operand)
+{
+	switch (op)
+	{
+	case expression_op::negate:
+	case expression_op::sin:
+	case expression_op::cos:
+	case expression_op::abs:
+	case expression_op::floor:
+		require_type(operand, expression_type::number);
+		return impl_->make(op, expression_type::number, operand);
+	case expression_op::not_:
+		require_type(operand, expression_type::boolean);
+		return impl_->make(op, expression_type::boolean, operand);
+	case expression_op::to_lower:
+	case expression_op::to_upper:
+		require_type(operand, expression_type::string);
+		return impl_->make(op, expression_type::string, operand);
+	case expression_op::length:
+		require_type(operand, expression_type::string);
+		return impl_->make(op, expression_type::number, operand);
+	case expression_op::to_string:
+		if (operand->type == expression_type::string)
+			return operand;
+
+		return impl_->make(op, expression_type::string, operand);
+	default:
+		CASPAR_THROW_EXCEPTION(invalid_argument() << msg_info(L"Not a unary expression operation"));
+	}
+}
+
+expression expression_builder::apply(expression_op op, const expression& lhs, const expression& rhs)
+{
+	switch (op)
+	{
+	case expression_op::multiply:
+	case expression_op::divide:
+	case expression_op::modulus:
+	case expression_op::add:
+	case expression_op::subtract:
+		require_type(lhs, expression_type::number);
+		require_type(rhs, expression_type::number);
+		return impl_->make(op, expression_type::number, lhs, rhs);
+	case expression_op::less:
+	case expression_op::less_or_equal:
+	case expression_op::greater:
+	case expression_op::greater_or_equal:
+		require_type(lhs, expression_type::number);
+		require_type(rhs, expression_type::number);
+		return impl_->make(op, expression_type::boolean, lhs, rhs);
+	case expression_op::equal:
+		require_type(rhs, lhs->type);
+		return impl_->make(op, expression_type::boolean, lhs, rhs);
+	case expression_op::and_:
+	case expression_op::or_:
+		require_type(lhs, expression_type::boolean);
+		require_type(rhs, expression_type::boolean);
+		return impl_->make(op, expression_type::boolean, lhs, rhs);
+	case expression_op::concat:
+		require_type(lhs, expression_type::string);
+		require_type(rhs, expression_type::string);
+		return impl_->make(op, expression_type::string, lhs, rhs);
+	default:
+		CASPAR_THROW_EXCEPTION(invalid_argument() << msg_info(L"Not a binary expression operation"));
+	}
+}
+
+expression expression_builder::select(const expression& condition, const expression& true_value, const expression& false_value)
+{
+	require_type(condition, expression_type::boolean);
+	require_type(false_value, true_value->type);
+
+	if (condition->op == expression_op::constant)
+		return condition->boolean ? true_value : false_value;
+
+	if (true_value == false_value)
+		return true_value;
+
+	expression_node node;
+	node.op			= expression_op::select;
+	node.type		= true_value->type;
+	node.args[0]	= condition;
+	node.args[1]	= true_value;
+	node.args[2]	= false_value;
+
+	return impl_->intern(node);
+}
+
+boost::any expression_builder::compile(const expression& root) const
+{
+	if (root->op == expression_op::constant)
+	{
+		switch (root->type)
+		{
+		case expression_type::number:	return binding<double>(root->number);
+		case expression_type::boolean:	return binding<bool>(root->boolean);
+		default:						return binding<std::wstring>(root->string);
+		}
+	}
+
+	// A single variable or animation is returned as is, like the parser always did.
+	if (root->op == expression_op::leaf)
+	{
+		switch (root->type)
+		{
+		case expression_type::number:	return impl_->leaves.numbers.at(root->leaf);
+		case expression_type::boolean:	return impl_->leaves.booleans.at(root->leaf);
+		default:						return impl_->leaves.strings.at(root->leaf);
+		}
+	}
+
+	auto program = std::make_shared<expression_program>();
+	program->result = program_compiler(impl_->leaves, *program).compile(root);
+
+	switch (root->type)
+	{
+	case expression_type::number:	return run_program<double>(program);
+	case expression_type::boolean:	return run_program<bool>(program);
+	default:						return run_program<std::wstring>(program);
+	}
+}
+
+}}}
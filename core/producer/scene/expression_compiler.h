@@ -0,0 +1,115 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "../binding.h"
+
+#include <boost/any.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace caspar { namespace core { namespace scene {
+
+enum class expression_type
+{
+	number,
+	boolean,
+	string
+};
+
+enum class expression_op
+{
+	constant,
+	leaf,
+	negate,
+	not_,
+	multiply,
+	divide,
+	modulus,
+	add,
+	subtract,
+	less,
+	less_or_equal,
+	greater,
+	greater_or_equal,
+	equal,
+	and_,
+	or_,
+	concat,
+	to_string,
+	sin,
+	cos,
+	abs,
+	floor,
+	to_lower,
+	to_upper,
+	length,
+	select
+};
+
+struct expression_node;
+typedef std::shared_ptr<const expression_node> expression;
+
+struct expression_node
+{
+	expression_op	op;
+	expression_type	type;
+	expression		args[3];
+	int				leaf		= -1;
+	double			number		= 0.0;
+	bool			boolean		= false;
+	std::wstring	string;
+};
+
+/**
+ * Builds the typed tree of one parsed expression. Identical subexpressions are
+ * shared, operations on constants only are folded, and compile() turns the tree
+ * into a single binding that depends directly on the variables and animations
+ * it reads, evaluated by a small register program.
+ */
+class expression_builder
+{
+public:
+	expression_builder();
+
+	expression constant(double value);
+	expression constant(bool value);
+	expression constant(const std::wstring& value);
+	expression leaf(const binding<double>& value);
+	expression leaf(const binding<bool>& value);
+	expression leaf(const binding<std::wstring>& value);
+	expression leaf(const binding<int64_t>& value);
+
+	// The operands must already have the types the operation expects. equal and
+	// to_string accept any type and select requires both branches to be the same.
+	expression apply(expression_op op, const expression& operand);
+	expression apply(expression_op op, const expression& lhs, const expression& rhs);
+	expression select(const expression& condition, const expression& true_value, const expression& false_value);
+
+	// binding<double>, binding<bool> or binding<std::wstring> depending on the type of root.
+	boost::any compile(const expression& root) const;
+private:
+	struct impl;
+	std::shared_ptr<impl> impl_;
+};
+
+}}}
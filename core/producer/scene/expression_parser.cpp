@@ -22,6 +22,7 @@
 #include "../../StdAfx.h"
 
 #include "expression_parser.h"
+#include "expression_compiler.h"
 
 #include <string>
 #include <memory>
@@ -32,7 +33,6 @@
 #include <cmath>
 
 #include <boost/any.hpp>
-#include <boost/locale.hpp>
 
 #include <common/log.h>
 #include <common/except.h>
@@ -72,36 +72,66 @@ std::wstring at_position(
 			+ L" in " + str;
 }
 
-boost::any as_binding(const boost::any& value);
+std::wstring type_name(expression_type type)
+{
+	switch (type)
+	{
+	case expression_type::number:	return u16(typeid(double).name());
+	case expression_type::boolean:	return u16(typeid(bool).name());
+	default:						return u16(typeid(std::wstring).name());
+	}
+}
 
-template<typename T>
-binding<T> require(const boost::any& value)
+std::wstring type_name(const boost::any& value, const expression& e)
 {
-	auto b = as_binding(value);
+	if (!is<expression>(value))
+		return u16(value.type().name());
+
+	switch (e->type)
+	{
+	case expression_type::number:	return u16(typeid(binding<double>).name());
+	case expression_type::boolean:	return u16(typeid(binding<bool>).name());
+	default:						return u16(typeid(binding<std::wstring>).name());
+	}
+}
+
+expression as_expression(const boost::any& value, expression_builder& builder);
 
-	if (is<binding<T>>(b))
-		return as<binding<T>>(b);
+expression require(const boost::any& value, expression_type type, expression_builder& builder)
+{
+	auto e = as_expression(value, builder);
+
+	if (e->type == type)
+		return e;
 	else
 		CASPAR_THROW_EXCEPTION(user_error() << msg_info(
-			L"Required binding of type " + u16(typeid(T).name())
-			+ L" but got " + u16(value.type().name())));
+			L"Required binding of type " + type_name(type)
+			+ L" but got " + type_name(value, e)));
 }
 
-boost::any parse_expression(
+template<typename T>
+binding<T> require_binding(const boost::any& value, expression_type type, expression_builder& builder)
+{
+	return as<binding<T>>(builder.compile(require(value, type, builder)));
+}
+
+expression parse_subexpression(
 		std::wstring::const_iterator& cursor,
 		const std::wstring& str,
-		const variable_repository& var_repo);
+		const variable_repository& var_repo,
+		expression_builder& builder);
 
-boost::any parse_parenthesis(
+expression parse_parenthesis(
 		std::wstring::const_iterator& cursor,
 		const std::wstring& str,
-		const variable_repository& var_repo)
+		const variable_repository& var_repo,
+		expression_builder& builder)
 {
 	if (*cursor++ != L'(')
 		CASPAR_THROW_EXCEPTION(user_error()
 				<< msg_info(L"Expected (" + at_position(cursor, str)));
 
-	auto expr = parse_expression(cursor, str, var_repo);
+	auto expr = parse_subexpression(cursor, str, var_repo, builder);
 
 	if (next_non_whitespace(cursor, str, L"Expected )") != L')')
 		CASPAR_THROW_EXCEPTION(user_error()
@@ -112,115 +142,106 @@ boost::any parse_parenthesis(
 	return expr;
 }
 
-boost::any create_animate_function(const std::vector<boost::any>& params, const variable_repository& var_repo)
+expression create_animate_function(const std::vector<boost::any>& params, const variable_repository& var_repo, expression_builder& builder)
 {
 	if (params.size() != 3)
 		CASPAR_THROW_EXCEPTION(user_error()
 			<< msg_info(L"animate() function requires three parameters: to_animate, duration, tweener"));
 
-	auto to_animate		= require<double>(params.at(0));
+	auto to_animate		= require_binding<double>(params.at(0), expression_type::number, builder);
 	auto frame_counter	= var_repo(L"frame").as<double>();
-	auto duration		= require<double>(params.at(1));
-	auto tw				= require<std::wstring>(params.at(2)).transformed([](const std::wstring& s) { return tweener(s); });
+	auto duration		= require_binding<double>(params.at(1), expression_type::number, builder);
+	auto tw				= require_binding<std::wstring>(params.at(2), expression_type::string, builder).transformed([](const std::wstring& s) { return tweener(s); });
 
-	return to_animate.animated(frame_counter, duration, tw);
+	// Every animation keeps its own state, so it is never shared with an identical one.
+	return builder.leaf(to_animate.animated(frame_counter, duration, tw));
 }
 
-boost::any create_sin_function(const std::vector<boost::any>& params, const variable_repository& var_repo)
+expression create_sin_function(const std::vector<boost::any>& params, const variable_repository& var_repo, expression_builder& builder)
 {
 	if (params.size() != 1)
 		CASPAR_THROW_EXCEPTION(user_error()
 			<< msg_info(L"sin() function requires one parameters: angle"));
 
-	auto angle = require<double>(params.at(0));
+	auto angle = require(params.at(0), expression_type::number, builder);
 
-	return angle.transformed([](double a) { return std::sin(a); });
+	return builder.apply(expression_op::sin, angle);
 }
 
-boost::any create_cos_function(const std::vector<boost::any>& params, const variable_repository& var_repo)
+expression create_cos_function(const std::vector<boost::any>& params, const variable_repository& var_repo, expression_builder& builder)
 {
 	if (params.size() != 1)
 		CASPAR_THROW_EXCEPTION(user_error()
 			<< msg_info(L"cos() function requires one parameters: angle"));
 
-	auto angle = require<double>(params.at(0));
+	auto angle = require(params.at(0), expression_type::number, builder);
 
-	return angle.transformed([](double a) { return std::cos(a); });
+	return builder.apply(expression_op::cos, angle);
 }
 
-boost::any create_abs_function(const std::vector<boost::any>& params, const variable_repository& var_repo)
+expression create_abs_function(const std::vector<boost::any>& params, const variable_repository& var_repo, expression_builder& builder)
 {
 	if (params.size() != 1)
 		CASPAR_THROW_EXCEPTION(user_error()
 			<< msg_info(L"abs() function requires one parameters: value"));
 
-	auto val = require<double>(params.at(0));
+	auto val = require(params.at(0), expression_type::number, builder);
 
-	return val.transformed([](double v) { return std::abs(v); });
+	return builder.apply(expression_op::abs, val);
 }
 
-boost::any create_floor_function(const std::vector<boost::any>& params, const variable_repository& var_repo)
+expression create_floor_function(const std::vector<boost::any>& params, const variable_repository& var_repo, expression_builder& builder)
 {
 	if (params.size() != 1)
 		CASPAR_THROW_EXCEPTION(user_error()
 			<< msg_info(L"floor() function requires one parameters: value"));
 
-	auto val = require<double>(params.at(0));
+	auto val = require(params.at(0), expression_type::number, builder);
 
-	return val.transformed([](double v) { return std::floor(v); });
+	return builder.apply(expression_op::floor, val);
 }
 
-std::locale create_utf_locale()
-{
-	boost::locale::generator gen;
-	gen.categories(boost::locale::codepage_facet);
-	gen.categories(boost::locale::convert_facet);
-
-	return gen("");
-}
-
-boost::any create_to_lower_function(const std::vector<boost::any>& params, const variable_repository& var_repo)
+expression create_to_lower_function(const std::vector<boost::any>& params, const variable_repository& var_repo, expression_builder& builder)
 {
 	if (params.size() != 1)
 		CASPAR_THROW_EXCEPTION(user_error()
 			<< msg_info(L"to_lower() function requires one parameters: str"));
 
-	auto str	= require<std::wstring>(params.at(0));
-	auto locale	= create_utf_locale();
+	auto str = require(params.at(0), expression_type::string, builder);
 
-	return str.transformed([=](std::wstring v) { return boost::locale::to_lower(v, locale); });
+	return builder.apply(expression_op::to_lower, str);
 }
 
-boost::any create_to_upper_function(const std::vector<boost::any>& params, const variable_repository& var_repo)
+expression create_to_upper_function(const std::vector<boost::any>& params, const variable_repository& var_repo, expression_builder& builder)
 {
 	if (params.size() != 1)
 		CASPAR_THROW_EXCEPTION(user_error()
 			<< msg_info(L"to_upper() function requires one parameters: str"));
 
-	auto str	= require<std::wstring>(params.at(0));
-	auto locale	= create_utf_locale();
+	auto str = require(params.at(0), expression_type::string, builder);
 
-	return str.transformed([=](std::wstring v) { return boost::locale::to_upper(v, locale); });
+	return builder.apply(expression_op::to_upper, str);
 }
 
-boost::any create_length_function(const std::vector<boost::any>& params, const variable_repository& var_repo)
+expression create_length_function(const std::vector<boost::any>& params, const variable_repository& var_repo, expression_builder& builder)
 {
 	if (params.size() != 1)
 		CASPAR_THROW_EXCEPTION(user_error()
 			<< msg_info(L"length() function requires one parameters: str"));
 
-	auto str = require<std::wstring>(params.at(0));
+	auto str = require(params.at(0), expression_type::string, builder);
 
-	return str.transformed([](std::wstring v) { return static_cast<double>(v.length()); });
+	return builder.apply(expression_op::length, str);
 }
 
-boost::any parse_function(
+expression parse_function(
 		const std::wstring& function_name,
 		std::wstring::const_iterator& cursor,
 		const std::wstring& str,
-		const variable_repository& var_repo)
+		const variable_repository& var_repo,
+		expression_builder& builder)
 {
-	static std::map<std::wstring, std::function<boost::any (const std::vector<boost::any>& params, const variable_repository& var_repo)>> FUNCTIONS
+	static std::map<std::wstring, std::function<expression (const std::vector<boost::any>& params, const variable_repository& var_repo, expression_builder& builder)>> FUNCTIONS
 	{
 		{ L"animate",	create_animate_function },
 		{ L"sin",		create_sin_function },
@@ -246,7 +267,7 @@ boost::any parse_function(
 
 	while (cursor != str.end())
 	{
-		params.push_back(parse_expression(cursor, str, var_repo));
+		params.push_back(parse_subexpression(cursor, str, var_repo, builder));
 
 		auto next = next_non_whitespace(cursor, str, L"Expected , or )");
 
@@ -265,7 +286,7 @@ boost::any parse_function(
 
 	++cursor;
 
-	return function->second(params, var_repo);
+	return function->second(params, var_repo, builder);
 }
 
 double parse_constant(
@@ -349,7 +370,8 @@ std::wstring parse_string_literal(
 boost::any parse_variable(
 		std::wstring::const_iterator& cursor,
 		const std::wstring& str,
-		const variable_repository& var_repo)
+		const variable_repository& var_repo,
+		expression_builder& builder)
 {
 	std::wstring variable_name;
 
@@ -380,13 +402,13 @@ boost::any parse_variable(
 	variable& var = var_repo(variable_name);
 
 	if (var.is<double>())
-		return var.as<double>();
+		return builder.leaf(var.as<double>());
 	else if (var.is<int64_t>())
-		return var.as<int64_t>().as<double>();
+		return builder.leaf(var.as<int64_t>());
 	else if (var.is<std::wstring>())
-		return var.as<std::wstring>();
+		return builder.leaf(var.as<std::wstring>());
 	else if (var.is<bool>())
-		return var.as<bool>();
+		return builder.leaf(var.as<bool>());
 
 	CASPAR_THROW_EXCEPTION(user_error() << msg_info(
 				L"Unhandled variable type of " + variable_name
@@ -567,171 +589,103 @@ op parse_operator(std::wstring::const_iterator& cursor, const std::wstring& str)
 			L"Unexpected end of input (Expected operator) in " + str));
 }
 
-boost::any as_binding(const boost::any& value)
+expression as_expression(const boost::any& value, expression_builder& builder)
 {
-	// Wrap supported constants as bindings
+	// Constants
 	if (is<double>(value))
-		return binding<double>(as<double>(value));
+		return builder.constant(as<double>(value));
 	else if (is<bool>(value))
-		return binding<bool>(as<bool>(value));
+		return builder.constant(as<bool>(value));
 	else if (is<std::wstring>(value))
-		return binding<std::wstring>(as<std::wstring>(value));
-	// Already one of the supported binding types
-	else if (is<binding<double>>(value))
-		return as<binding<double>>(value);
-	else if (is<binding<bool>>(value))
-		return as<binding<bool>>(value);
-	else if (is<binding<std::wstring>>(value))
-		return as<binding<std::wstring>>(value);
+		return builder.constant(as<std::wstring>(value));
+	// Already an expression
+	else if (is<expression>(value))
+		return as<expression>(value);
 	else
 		CASPAR_THROW_EXCEPTION(user_error() << msg_info(
 				L"Couldn't detect type of " + u16(value.type().name())));
 }
 
-boost::any negative(const boost::any& to_create_negative_of)
-{
-	return -require<double>(to_create_negative_of);
-}
-
-boost::any not_(const boost::any& to_create_not_of)
-{
-	return !require<bool>(to_create_not_of);
-}
-
-boost::any multiply(const boost::any& lhs, boost::any& rhs)
+expression negative(const boost::any& to_create_negative_of, expression_builder& builder)
 {
-	return require<double>(lhs) * require<double>(rhs);
+	return builder.apply(expression_op::negate, require(to_create_negative_of, expression_type::number, builder));
 }
 
-boost::any divide(const boost::any& lhs, boost::any& rhs)
+expression not_(const boost::any& to_create_not_of, expression_builder& builder)
 {
-	return require<double>(lhs) / require<double>(rhs);
+	return builder.apply(expression_op::not_, require(to_create_not_of, expression_type::boolean, builder));
 }
 
-boost::any modulus(const boost::any& lhs, boost::any& rhs)
+expression arithmetic(expression_op op, const boost::any& lhs, const boost::any& rhs, expression_builder& builder)
 {
-	return
-			(
-					require<double>(lhs).as<int64_t>()
-					% require<double>(rhs).as<int64_t>()
-			).as<double>();
+	return builder.apply(
+			op,
+			require(lhs, expression_type::number, builder),
+			require(rhs, expression_type::number, builder));
 }
 
-binding<std::wstring> stringify(const boost::any& value)
+expression add(const boost::any& lhs, const boost::any& rhs, expression_builder& builder)
 {
-	auto b = as_binding(value);
-
-	if (is<binding<std::wstring>>(b))
-		return as<binding<std::wstring>>(b);
-	else if (is<binding<double>>(b))
-		return as<binding<double>>(b).as<std::wstring>();
-	else if (is<binding<bool>>(b))
-		return as<binding<bool>>(b).as<std::wstring>();
-	else
-		CASPAR_THROW_EXCEPTION(user_error()
-				<< msg_info(L"Couldn't stringify " + u16(value.type().name())));
-}
-
-boost::any add(const boost::any& lhs, boost::any& rhs)
-{
-	auto l = as_binding(lhs);
-	auto r = as_binding(rhs);
+	auto l = as_expression(lhs, builder);
+	auto r = as_expression(rhs, builder);
 
 	// number
-	if (is<binding<double>>(l) && is<binding<double>>(r))
-		return as<binding<double>>(l) + as<binding<double>>(r);
-	// string
-	else if (is<binding<std::wstring>>(l) && is<binding<std::wstring>>(r))
-		return as<binding<std::wstring>>(l) + as<binding<std::wstring>>(r);
-	// mixed types to string and concatenated
+	if (l->type == expression_type::number && r->type == expression_type::number)
+		return builder.apply(expression_op::add, l, r);
+	// string, or mixed types to string and concatenated
 	else
-		return stringify(lhs) + stringify(rhs);
-}
-
-boost::any subtract(const boost::any& lhs, boost::any& rhs)
-{
-	return require<double>(lhs) - require<double>(rhs);
-}
-
-boost::any less(const boost::any& lhs, boost::any& rhs)
-{
-	return require<double>(lhs) < require<double>(rhs);
+		return builder.apply(
+				expression_op::concat,
+				builder.apply(expression_op::to_string, l),
+				builder.apply(expression_op::to_string, r));
 }
 
-boost::any less_or_equal(const boost::any& lhs, boost::any& rhs)
+expression equal(const boost::any& lhs, const boost::any& rhs, expression_builder& builder)
 {
-	return require<double>(lhs) <= require<double>(rhs);
-}
+	auto l = as_expression(lhs, builder);
+	auto r = as_expression(rhs, builder);
 
-boost::any greater(const boost::any& lhs, boost::any& rhs)
-{
-	return require<double>(lhs) > require<double>(rhs);
-}
-
-boost::any greater_or_equal(const boost::any& lhs, boost::any& rhs)
-{
-	return require<double>(lhs) >= require<double>(rhs);
-}
-
-boost::any equal(const boost::any& lhs, boost::any& rhs)
-{
-	auto l = as_binding(lhs);
-	auto r = as_binding(rhs);
-
-	// number
-	if (is<binding<double>>(l) && is<binding<double>>(r))
-		return as<binding<double>>(l) == as<binding<double>>(r);
-	// string
-	else if (is<binding<std::wstring>>(l) && is<binding<std::wstring>>(r))
-		return as<binding<std::wstring>>(l) == as<binding<std::wstring>>(r);
+	// number or string
+	if (l->type == r->type && l->type != expression_type::boolean)
+		return builder.apply(expression_op::equal, l, r);
 	// boolean
 	else
-		return require<bool>(l) == require<bool>(r);
+		return builder.apply(
+				expression_op::equal,
+				require(l, expression_type::boolean, builder),
+				require(r, expression_type::boolean, builder));
 }
 
-boost::any and_(const boost::any& lhs, boost::any& rhs)
+expression logical(expression_op op, const boost::any& lhs, const boost::any& rhs, expression_builder& builder)
 {
-	return require<bool>(lhs) && require<bool>(rhs);
+	return builder.apply(
+			op,
+			require(lhs, expression_type::boolean, builder),
+			require(rhs, expression_type::boolean, builder));
 }
 
-boost::any or_(const boost::any& lhs, boost::any& rhs)
-{
-	return require<bool>(lhs) || require<bool>(rhs);
-}
-
-template<typename T>
-binding<T> ternary(
-		const binding<bool>& condition,
-		const binding<T>& true_value,
-		const binding<T>& false_value)
-{
-	return when(condition).then(true_value).otherwise(false_value);
-}
-
-boost::any ternary(
+expression ternary(
 		const boost::any& condition,
 		const boost::any& true_value,
-		const boost::any& false_value)
-{
-	auto cond = require<bool>(condition);
-	auto t = as_binding(true_value);
-	auto f = as_binding(false_value);
-
-	// double
-	if (is<binding<double>>(t) && is<binding<double>>(f))
-		return ternary(cond, as<binding<double>>(t), as<binding<double>>(f));
-	// string
-	else if (is<binding<std::wstring>>(t) && is<binding<std::wstring>>(f))
-		return ternary(
-				cond,
-				as<binding<std::wstring>>(t),
-				as<binding<std::wstring>>(f));
+		const boost::any& false_value,
+		expression_builder& builder)
+{
+	auto cond = require(condition, expression_type::boolean, builder);
+	auto t = as_expression(true_value, builder);
+	auto f = as_expression(false_value, builder);
+
+	// double or string
+	if (t->type == f->type && t->type != expression_type::boolean)
+		return builder.select(cond, t, f);
 	// bool
 	else
-		return ternary(cond, require<bool>(t), require<bool>(f));
+		return builder.select(
+				cond,
+				require(t, expression_type::boolean, builder),
+				require(f, expression_type::boolean, builder));
 }
 
-void resolve_operators(int precedence, std::vector<boost::any>& tokens)
+void resolve_operators(int precedence, std::vector<boost::any>& tokens, expression_builder& builder)
 {
 	for (int i = 0; i < tokens.size(); ++i)
 	{
@@ -746,6 +700,14 @@ void resolve_operators(int precedence, std::vector<boost::any>& tokens)
 			continue;
 
 		int index_after = i + 1;
+
+		// An operator at either end, as in "1 +"
+		if (index_after >= tokens.size()
+				|| (op_token.type != op::op_type::UNARY && i == 0)
+				|| (op_token.characters == L"?" && i + 3 >= tokens.size()))
+			CASPAR_THROW_EXCEPTION(user_error() << msg_info(
+					L"Missing operand of " + op_token.characters));
+
 		auto& token_after = tokens.at(index_after);
 
 		switch (op_token.type)
@@ -753,11 +715,11 @@ void resolve_operators(int precedence, std::vector<boost::any>& tokens)
 		case op::op_type::UNARY:
 			if (op_token.characters == L"unary-")
 			{
-				tokens.at(i) = negative(token_after);
+				tokens.at(i) = negative(token_after, builder);
 			}
 			else if (op_token.characters == L"!")
 			{
-				tokens.at(i) = not_(token_after);
+				tokens.at(i) = not_(token_after, builder);
 			}
 
 			tokens.erase(tokens.begin() + index_after);
@@ -768,31 +730,31 @@ void resolve_operators(int precedence, std::vector<boost::any>& tokens)
 				auto& token_before = tokens.at(i - 1);
 
 				if (op_token.characters == L"*")
-					token_before = multiply(token_before, token_after);
+					token_before = arithmetic(expression_op::multiply, token_before, token_after, builder);
 				else if (op_token.characters == L"/")
-					token_before = divide(token_before, token_after);
+					token_before = arithmetic(expression_op::divide, token_before, token_after, builder);
 				else if (op_token.characters == L"%")
-					token_before = modulus(token_before, token_after);
+					token_before = arithmetic(expression_op::modulus, token_before, token_after, builder);
 				else if (op_token.characters == L"+")
-					token_before = add(token_before, token_after);
+					token_before = add(token_before, token_after, builder);
 				else if (op_token.characters == L"-")
-					token_before = subtract(token_before, token_after);
+					token_before = arithmetic(expression_op::subtract, token_before, token_after, builder);
 				else if (op_token.characters == L"<")
-					token_before = less(token_before, token_after);
+					token_before = arithmetic(expression_op::less, token_before, token_after, builder);
 				else if (op_token.characters == L"<=")
-					token_before = less_or_equal(token_before, token_after);
+					token_before = arithmetic(expression_op::less_or_equal, token_before, token_after, builder);
 				else if (op_token.characters == L">")
-					token_before = greater(token_before, token_after);
+					token_before = arithmetic(expression_op::greater, token_before, token_after, builder);
 				else if (op_token.characters == L">=")
-					token_before = greater_or_equal(token_before, token_after);
+					token_before = arithmetic(expression_op::greater_or_equal, token_before, token_after, builder);
 				else if (op_token.characters == L"==")
-					token_before = equal(token_before, token_after);
+					token_before = equal(token_before, token_after, builder);
 				else if (op_token.characters == L"!=")
-					token_before = not_(equal(token_before, token_after));
+					token_before = not_(equal(token_before, token_after, builder), builder);
 				else if (op_token.characters == L"&&")
-					token_before = and_(token_before, token_after);
+					token_before = logical(expression_op::and_, token_before, token_after, builder);
 				else if (op_token.characters == L"||")
-					token_before = or_(token_before, token_after);
+					token_before = logical(expression_op::or_, token_before, token_after, builder);
 			}
 
 			tokens.erase(tokens.begin() + i, tokens.begin() + i + 2);
@@ -811,7 +773,7 @@ void resolve_operators(int precedence, std::vector<boost::any>& tokens)
 
 				auto& token_false_value = tokens.at(i + 3);
 				token_before = ternary(
-						token_before, token_after, token_false_value);
+						token_before, token_after, token_false_value, builder);
 				tokens.erase(tokens.begin() + i, tokens.begin() + i + 4);
 				--i;
 			}
@@ -821,10 +783,11 @@ void resolve_operators(int precedence, std::vector<boost::any>& tokens)
 	}
 }
 
-boost::any parse_expression(
+expression parse_subexpression(
 		std::wstring::const_iterator& cursor,
 		const std::wstring& str,
-		const variable_repository& var_repo)
+		const variable_repository& var_repo,
+		expression_builder& builder)
 {
 	std::vector<boost::any> tokens;
 	bool stop = false;
@@ -870,17 +833,17 @@ boost::any parse_expression(
 			{
 				auto function_name = as<std::wstring>(tokens.back());
 				tokens.pop_back();
-				tokens.push_back(parse_function(function_name, cursor, str, var_repo));
+				tokens.push_back(parse_function(function_name, cursor, str, var_repo, builder));
 			}
 			else
-				tokens.push_back(parse_parenthesis(cursor, str, var_repo));
+				tokens.push_back(parse_parenthesis(cursor, str, var_repo, builder));
 			break;
 		case L')':
 		case L',':
 			stop = true;
 			break;
 		default:
-			tokens.push_back(parse_variable(cursor, str, var_repo));
+			tokens.push_back(parse_variable(cursor, str, var_repo, builder));
 			break;
 		}
 
@@ -894,15 +857,24 @@ boost::any parse_expression(
 
 	for (int precedence = 1; tokens.size() > 1 && precedence < op::MAX_PRECEDENCE; ++precedence)
 	{
-		resolve_operators(precedence, tokens);
+		resolve_operators(precedence, tokens, builder);
 	}
 
 	if (tokens.size() > 1)
 		CASPAR_THROW_EXCEPTION(user_error()
 				<< msg_info(L"Expected operator" + at_position(cursor, str)));
 
+	return as_expression(tokens.at(0), builder);
+}
+
+boost::any parse_expression(
+		std::wstring::const_iterator& cursor,
+		const std::wstring& str,
+		const variable_repository& var_repo)
+{
+	expression_builder builder;
 
-	return as_binding(tokens.at(0));
+	return builder.compile(parse_subexpression(cursor, str, var_repo, builder));
 }
 
 }}}
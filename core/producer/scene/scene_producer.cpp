@@ -27,6 +27,8 @@
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string.hpp>
 
+#include <tbb/parallel_for.h>
+
 #include "scene_producer.h"
 
 #include "../../frame/draw_frame.h"
@@ -130,6 +132,14 @@ struct marker
 	}
 };
 
+struct layer_cache
+{
+	std::vector<std::shared_ptr<void>>	subscriptions;
+	bool								resubscribe			= true;
+	bool								transform_dirty		= true;
+	frame_transform						transform;
+};
+
 struct scene_producer::impl
 {
 	std::wstring											producer_name_;
@@ -151,6 +161,7 @@ struct scene_producer::impl
 	std::vector<std::wstring>								variable_names_;
 	std::multimap<int64_t, marker>							markers_by_frame_;
 	std::vector<std::shared_ptr<void>>						task_subscriptions_;
+	std::map<const layer*, layer_cache>						layer_caches_;
 	monitor::subject										monitor_subject_;
 	bool													paused_					= true;
 	bool													removed_				= false;
@@ -362,6 +373,135 @@ struct scene_producer::impl
 		return transform;
 	}
 
+	template<typename Func>
+	void for_each_transform_binding(const layer& layer, const Func& func) const
+	{
+		auto& producer_constraints = layer.producer.get()->pixel_constraints();
+
+		func(producer_constraints.width);
+		func(producer_constraints.height);
+		func(pixel_constraints_.width);
+		func(pixel_constraints_.height);
+
+		for (auto coord : { &layer.anchor, &layer.position, &layer.clip.upper_left, &layer.clip.lower_right, &layer.crop.upper_left, &layer.crop.lower_right,
+				&layer.perspective.upper_left, &layer.perspective.upper_right, &layer.perspective.lower_right, &layer.perspective.lower_left })
+		{
+			func(coord->x);
+			func(coord->y);
+		}
+
+		func(layer.rotation);
+		func(layer.levels.min_input);
+		func(layer.levels.max_input);
+		func(layer.levels.gamma);
+		func(layer.levels.min_output);
+		func(layer.levels.max_output);
+		func(layer.adjustments.opacity);
+		func(layer.adjustments.contrast);
+		func(layer.adjustments.saturation);
+		func(layer.adjustments.brightness);
+		func(layer.is_key);
+		func(layer.use_mipmap);
+		func(layer.blend_mode);
+		func(layer.chroma_key.enable);
+		func(layer.chroma_key.target_hue);
+		func(layer.chroma_key.hue_width);
+		func(layer.chroma_key.min_saturation);
+		func(layer.chroma_key.min_brightness);
+		func(layer.chroma_key.softness);
+		func(layer.chroma_key.spill_suppress);
+		func(layer.chroma_key.spill_suppress_saturation);
+		func(layer.volume);
+	}
+
+	// Only recalculated when one of the bindings it is calculated from has changed
+	const frame_transform& cached_transform(const layer& layer)
+	{
+		auto& cache = layer_caches_[&layer];
+
+		if (cache.resubscribe)
+		{
+			// The producer decides which constraints the transform depends on
+			auto resubscribe	= &cache.resubscribe;
+			auto dirty			= &cache.transform_dirty;
+
+			cache.subscriptions.clear();
+			cache.subscriptions.push_back(layer.producer.on_change([resubscribe] { *resubscribe = true; }));
+			for_each_transform_binding(layer, [&](const auto& binding)
+			{
+				cache.subscriptions.push_back(binding.on_change([dirty] { *dirty = true; }));
+			});
+
+			cache.resubscribe		= false;
+			cache.transform_dirty	= true;
+		}
+
+		if (cache.transform_dirty)
+		{
+			cache.transform			= get_transform(layer);
+			cache.transform_dirty	= false;
+		}
+
+		return cache.transform;
+	}
+
+	// A producer can change its pixel constraints while it is received. That may only happen in
+	// parallel with other layers when the change reaches nothing but the layer's own crop and
+	// perspective, which are read after all layers have been received. Constraints that are
+	// bound, or that scene variables and other transforms are calculated from, are shared.
+	static bool shares_bindings(const layer& layer)
+	{
+		auto& producer = *layer.producer.get();
+
+		if (!producer.get_variables().empty())
+			return true;
+
+		std::vector<const void*> owned;
+
+		for (auto coord : { &layer.crop.upper_left, &layer.crop.lower_right, &layer.perspective.upper_left,
+				&layer.perspective.upper_right, &layer.perspective.lower_right, &layer.perspective.lower_left })
+		{
+			owned.push_back(coord->x.identity());
+			owned.push_back(coord->y.identity());
+		}
+
+		auto& constraints = producer.pixel_constraints();
+
+		return !constraints.width.isolated(owned) || !constraints.height.isolated(owned);
+	}
+
+	// Bindings are not thread safe. Producers that share bindings with the scene (nested scenes,
+	// text, bound constraints) are received in order by a single task, while every other layer
+	// is received in parallel with it.
+	std::vector<draw_frame> receive_layers(const std::vector<const layer*>& layers)
+	{
+		std::vector<spl::shared_ptr<frame_producer>> producers;
+		std::vector<draw_frame> frames(layers.size());
+		std::vector<size_t> independent;
+		std::vector<size_t> shared;
+
+		for (size_t i = 0; i < layers.size(); ++i)
+		{
+			producers.push_back(layers[i]->producer.get());
+
+			if (shares_bindings(*layers[i]))
+				shared.push_back(i);
+			else
+				independent.push_back(i);
+		}
+
+		tbb::parallel_for(static_cast<size_t>(0), independent.size() + 1, [&](size_t task)
+		{
+			if (task < independent.size())
+				frames[independent[task]] = producers[independent[task]]->receive();
+			else
+				for (auto i : shared)
+					frames[i] = producers[i]->receive();
+		});
+
+		return frames;
+	}
+
 	boost::optional<std::pair<int64_t, marker>> find_first_stop_or_jump_or_remove(int64_t start_frame, int64_t end_frame)
 	{
 		auto lower = markers_by_frame_.lower_bound(start_frame);
@@ -472,19 +612,20 @@ struct scene_producer::impl
 		for (auto& timeline : timelines_)
 			timeline.second.on_frame(timeline_frame_number_.get());
 
-		std::vector<draw_frame> frames;
+		std::vector<const layer*> visible;
 
 		for (auto& layer : layers_)
 		{
-			if (layer.hidden.get())
-				continue;
-
-			draw_frame frame(layer.producer.get()->receive());
-			frame.transform() = get_transform(layer);
-			frames.push_back(frame);
+			if (!layer.hidden.get())
+				visible.push_back(&layer);
 		}
 
-		return draw_frame(frames);
+		auto frames = receive_layers(visible);
+
+		for (size_t i = 0; i < frames.size(); ++i)
+			frames[i].transform() = cached_transform(*visible[i]);
+
+		return draw_frame(std::move(frames));
 	}
 
 	void on_interaction(const interaction_event::ptr& event)
@@ -563,6 +704,7 @@ struct scene_producer::impl
 	void remove()
 	{
 		removed_ = true;
+		layer_caches_.clear();
 		layers_.clear();
 	}
 
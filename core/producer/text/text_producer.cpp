@@ -55,7 +55,6 @@
 #include FT_FREETYPE_H
 #include FT_GLYPH_H
 
-#include "utils/texture_atlas.h"
 #include "utils/texture_font.h"
 #include "utils/freetype_library.h"
 
@@ -143,9 +142,7 @@ struct text_producer::impl
 	variable_impl<double>					current_bearing_y_;
 	variable_impl<double>					current_protrude_under_y_;
 	draw_frame								frame_;
-	text::texture_atlas						atlas_						{ 1024, 512, 4 };
 	text::texture_font						font_;
-	const_frame								atlas_frame_;
 
 public:
 	explicit impl(const spl::shared_ptr<frame_factory>& frame_factory, int x, int y, const std::wstring& str, text::text_info& text_info, long parent_width, long parent_height, bool standalone)
@@ -153,14 +150,12 @@ public:
 		, x_(x), y_(y)
 		, parent_width_(parent_width), parent_height_(parent_height)
 		, standalone_(standalone)
-		, font_(atlas_, text::find_font_file(text_info), !standalone)
+		, font_(text::find_font_file(text_info), !standalone)
 	{
-		//TODO: examine str to determine which unicode_blocks to load
-		font_.load_glyphs(text::unicode_block::Basic_Latin, text_info.color);
-		font_.load_glyphs(text::unicode_block::Latin_1_Supplement, text_info.color);
-		font_.load_glyphs(text::unicode_block::Latin_Extended_A, text_info.color);
-
-		atlas_frame_ = create_atlas_frame();
+		//glyphs outside these blocks are rasterized on first use
+		font_.load_glyphs(text::unicode_block::Basic_Latin);
+		font_.prefetch_glyphs(text::unicode_block::Latin_1_Supplement);
+		font_.prefetch_glyphs(text::unicode_block::Latin_Extended_A);
 
 		tracking_.value().set(text_info.tracking);
 		scale_x_.value().set(text_info.scale_x);
@@ -186,28 +181,18 @@ public:
 		CASPAR_LOG(info) << print() << L" Initialized";
 	}
 
-	core::const_frame create_atlas_frame() const
-	{
-		core::pixel_format_desc pfd(core::pixel_format::bgra);
-		pfd.planes.push_back(core::pixel_format_desc::plane(static_cast<int>(atlas_.width()), static_cast<int>(atlas_.height()), static_cast<int>(atlas_.depth())));
-		auto frame = frame_factory_->create_frame(this, pfd, core::audio_channel_layout::invalid());
-		memcpy(frame.image_data().data(), atlas_.data(), frame.image_data().size());
-		return std::move(frame);
-	}
-
 	void generate_frame()
 	{
 		text::string_metrics metrics;
 		font_.set_tracking(tracking_.value().get());
 
-		auto vertex_stream = font_.create_vertex_stream(text_.value().get(), x_, y_, parent_width_, parent_height_, &metrics, shear_.value().get());
-		auto frame = atlas_frame_.with_geometry(frame_geometry(frame_geometry::geometry_type::quad_list, std::move(vertex_stream)));
+		auto frame = font_.create_frame(frame_factory_, text_.value().get(), x_, y_, parent_width_, parent_height_, &metrics, shear_.value().get());
 
 		this->constraints_.width.set(metrics.width * this->scale_x_.value().get());
 		this->constraints_.height.set(metrics.height * this->scale_y_.value().get());
 		current_bearing_y_.value().set(metrics.bearingY);
 		current_protrude_under_y_.value().set(metrics.protrudeUnderY);
-		frame_ = core::draw_frame(std::move(frame));
+		frame_ = std::move(frame);
 	}
 
 	// frame_producer
@@ -4,8 +4,25 @@
 #include "texture_font.h"
 #include "freetype_library.h"
 
+#include "../../../frame/frame.h"
+#include "../../../frame/draw_frame.h"
+#include "../../../frame/frame_factory.h"
+#include "../../../frame/geometry.h"
+#include "../../../frame/pixel_format.h"
+#include "../../../frame/audio_channel_layout.h"
+
+#include <common/executor.h>
+#include <common/thread_info.h>
+
+#include <boost/optional.hpp>
+
+#include <algorithm>
+#include <cstring>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <tuple>
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #include FT_GLYPH_H
@@ -23,98 +40,359 @@ struct unicode_range
 
 unicode_range get_range(unicode_block block);
 
+namespace {
 
-struct texture_font::impl
+const int		render_flags		= FT_LOAD_RENDER | FT_LOAD_FORCE_AUTOHINT | FT_LOAD_TARGET_NORMAL;
+const size_t	page_width			= 1024;
+const size_t	page_height			= 512;
+const size_t	page_depth			= 4;
+
+// Blocks larger than this (CJK, Hangul, the private use areas...) are only rasterized glyph by glyph
+// as they are used, prefetching them would fill dozens of pages.
+const int		max_prefetch_block	= 0x400;
+
+boost::optional<unicode_block> find_block(int code)
 {
+	for (int i = static_cast<int>(unicode_block::Basic_Latin); i <= static_cast<int>(unicode_block::Supplementary_Private_Use_Area_B); ++i)
+	{
+		auto range = get_range(static_cast<unicode_block>(i));
+
+		if (code >= range.first && code <= range.last)
+			return static_cast<unicode_block>(i);
+	}
+
+	return boost::none;
+}
+
+}
+
+// The glyphs of one font file rendered at one size, color and set of render flags, shared by
+// every texture_font with that key. Pages are added when the existing ones are full, so a glyph
+// is never dropped, and a placed glyph keeps its page and texture coordinates for the lifetime
+// of the atlas.
+class font_atlas : public std::enable_shared_from_this<font_atlas>, boost::noncopyable
+{
+public:
+	struct glyph
+	{
+		FT_UInt	index;
+		int		page;
+		int		width;
+		int		height;
+		double	left;
+		double	top;
+		double	right;
+		double	bottom;
+		FT_Pos	bearing_x;
+		FT_Pos	bearing_y;
+		FT_Pos	advance;
+	};
+
+	struct placement
+	{
+		const glyph*	info;
+		double			kerning;
+	};
+
 private:
-	struct glyph_info
+	struct page
 	{
-		glyph_info(int w, int h, double l, double t, double r, double b) : width(w), height(h), left(l), top(t), right(r), bottom(b)
-		{}
+		texture_atlas	atlas;
+		int				version;
+	};
 
-		double left, top, right, bottom;
-		int width, height;
+	struct upload
+	{
+		int				version;
+		const_frame		frame;
 	};
 
-	spl::shared_ptr<FT_FaceRec_>	face_;
-	texture_atlas					atlas_;
-	double							size_;
-	double							tracking_;
-	bool							normalize_;
-	std::map<int, glyph_info>		glyphs_;
-	std::wstring					name_;
+	typedef std::map<std::weak_ptr<frame_factory>, std::vector<upload>, std::owner_less<std::weak_ptr<frame_factory>>> upload_map;
+
+	std::mutex								mutex_;
+	executor&								worker_;
+	spl::shared_ptr<FT_FaceRec_>			face_;
+	const color<double>						color_;
+	const bool								use_kerning_;
+	std::vector<page>						pages_;
+	std::map<int, glyph>					glyphs_;
+	std::set<int>							missing_;
+	std::set<unicode_block>					blocks_;
+	upload_map								uploads_;
 
 public:
-	impl(texture_atlas& atlas, const text_info& info, bool normalize_coordinates)
-		: face_(get_new_face(u8(info.font_file), u8(info.font)))
-		, atlas_(atlas)
-		, size_(info.size)
-		, tracking_(info.size*info.tracking/1000.0)
-		, normalize_(normalize_coordinates)
-		, name_(info.font)
+	font_atlas(executor& worker, const text_info& info)
+		: worker_(worker)
+		, face_(get_new_face(u8(info.font_file), u8(info.font)))
+		, color_(info.color)
+		, use_kerning_((face_->face_flags & FT_FACE_FLAG_KERNING) == FT_FACE_FLAG_KERNING)
 	{
-		if (FT_Set_Char_Size(face_.get(), static_cast<FT_F26Dot6>(size_*64), 0, 72, 72))
+		if (FT_Set_Char_Size(face_.get(), static_cast<FT_F26Dot6>(info.size*64), 0, 72, 72))
 			CASPAR_THROW_EXCEPTION(expected_freetype_exception() << msg_info("Failed to set font size"));
 	}
 
-	void set_tracking(double tracking)
+	void load_glyphs(unicode_block block)
 	{
-		tracking_ = size_ * tracking / 1000.0;
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		blocks_.insert(block);
+		auto range = get_range(block);
+
+		for (int code = range.first; code <= range.last; ++code)
+			find_or_rasterize(code);
 	}
 
-	int count_glyphs_in_range(unicode_block block)
+	void prefetch_glyphs(unicode_block block)
 	{
-		unicode_range range = get_range(block);
-
-		//TODO: extract info from freetype
+		std::lock_guard<std::mutex> lock(mutex_);
 
-		//very pesimistic, assumes a glyph for each charcode
-		return range.last - range.first;
+		prefetch(block);
 	}
 
-	void load_glyphs(unicode_block block, const color<double>& col)
+	std::vector<placement> place(const std::wstring& str)
 	{
-		int flags = FT_LOAD_RENDER | FT_LOAD_FORCE_AUTOHINT | FT_LOAD_TARGET_NORMAL;
-		unicode_range range = get_range(block);
+		std::lock_guard<std::mutex> lock(mutex_);
 
-		for(int i = range.first; i <= range.last; ++i)
+		std::vector<placement> result;
+		result.reserve(str.length());
+		FT_UInt previous = 0;
+
+		for (auto code : str)
 		{
-			FT_UInt glyph_index = FT_Get_Char_Index(face_.get(), i);
-			if(!glyph_index)	//ignore codes that doesn't have a glyph for now. Might want to map these to a special glyph later.
+			auto info = find_or_rasterize(static_cast<int>(code));
+			if (!info)
 				continue;
 
-			FT_Error err = FT_Load_Glyph(face_.get(), glyph_index, flags);
-			if(err) continue;	//igonore glyphs that fail to load
+			double kerning = 0.0;
+
+			if (use_kerning_ && previous)
+			{
+				FT_Vector delta;
+				FT_Get_Kerning(face_.get(), previous, info->index, FT_KERNING_DEFAULT, &delta);
+
+				kerning = delta.x / 64.0;
+			}
+
+			result.push_back(placement { info, kerning });
+			previous = info->index;
+		}
+
+		return result;
+	}
+
+	const_frame page_frame(int index, const spl::shared_ptr<frame_factory>& factory)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		for (auto it = uploads_.begin(); it != uploads_.end();)
+		{
+			if (it->first.expired())
+				it = uploads_.erase(it);
+			else
+				++it;
+		}
+
+		auto& uploads = uploads_[factory];
+		uploads.resize(pages_.size(), upload { -1, const_frame() });
+
+		auto& page = pages_.at(index);
+		auto& upload = uploads.at(index);
 
-			const FT_Bitmap& bitmap = face_->glyph->bitmap;	//shorthand notation
+		if (upload.version != page.version)
+		{
+			core::pixel_format_desc pfd(core::pixel_format::bgra);
+			pfd.planes.push_back(core::pixel_format_desc::plane(static_cast<int>(page.atlas.width()), static_cast<int>(page.atlas.height()), static_cast<int>(page.atlas.depth())));
+			auto frame = factory->create_frame(this, pfd, core::audio_channel_layout::invalid());
+			std::memcpy(frame.image_data().data(), page.atlas.data(), frame.image_data().size());
+			upload.frame = std::move(frame);
+			upload.version = page.version;
+		}
+
+		return upload.frame;
+	}
+
+private:
+	const glyph* find_or_rasterize(int code)
+	{
+		auto it = glyphs_.find(code);
+		if (it != glyphs_.end())
+			return &it->second;
+
+		if (missing_.find(code) != missing_.end())
+			return nullptr;
+
+		//codes without a glyph in the font, or whose glyph fails to load, are remembered so they are only tried once
+		FT_UInt glyph_index = FT_Get_Char_Index(face_.get(), code);
+		if (!glyph_index || FT_Load_Glyph(face_.get(), glyph_index, render_flags))
+		{
+			missing_.insert(code);
+			return nullptr;
+		}
+
+		const FT_Bitmap& bitmap = face_->glyph->bitmap;	//shorthand notation
+
+		rect region;
+		int index = allocate(bitmap.width + 1, bitmap.rows + 1, region);
+		auto& page = pages_.at(index);
+
+		page.atlas.set_region(region.x, region.y, bitmap.width, bitmap.rows, bitmap.buffer, bitmap.pitch, color_);
+		++page.version;
+
+		glyph info;
+		info.index		= glyph_index;
+		info.page		= index;
+		info.width		= bitmap.width;
+		info.height		= bitmap.rows;
+		info.left		= region.x / static_cast<double>(page.atlas.width());
+		info.top		= region.y / static_cast<double>(page.atlas.height());
+		info.right		= (region.x + bitmap.width) / static_cast<double>(page.atlas.width());
+		info.bottom		= (region.y + bitmap.rows) / static_cast<double>(page.atlas.height());
+		info.bearing_x	= face_->glyph->metrics.horiBearingX;
+		info.bearing_y	= face_->glyph->metrics.horiBearingY;
+		info.advance	= face_->glyph->advance.x;
+
+		auto block = find_block(code);
+		if (block)
+			prefetch(*block);
+
+		return &glyphs_.insert(std::make_pair(code, info)).first->second;
+	}
+
+	int allocate(int width, int height, rect& region)
+	{
+		for (int index = 0; index < static_cast<int>(pages_.size()); ++index)
+		{
+			region = pages_[index].atlas.get_region(width, height);
+
+			if (region.x >= 0)
+				return index;
+		}
 
-			auto region = atlas_.get_region(bitmap.width+1, bitmap.rows+1);
-			if(region.x < 0)
+		//grow by a page, sized up for glyphs that wouldn't even fit on an empty default page
+		pages_.push_back(page {
+				texture_atlas(
+						std::max(page_width, static_cast<size_t>(width) + 2),
+						std::max(page_height, static_cast<size_t>(height) + 2),
+						page_depth),
+				0 });
+		region = pages_.back().atlas.get_region(width, height);
+
+		return static_cast<int>(pages_.size()) - 1;
+	}
+
+	// Rasterizes the rest of a block on the worker, one glyph per lock so producers are never held up
+	// for longer than a single glyph.
+	void prefetch(unicode_block block)
+	{
+		auto range = get_range(block);
+
+		if (range.last - range.first >= max_prefetch_block || !blocks_.insert(block).second)
+			return;
+
+		std::weak_ptr<font_atlas> weak_self = shared_from_this();
+
+		worker_.begin_invoke([=]
+		{
+			for (int code = range.first; code <= range.last; ++code)
 			{
-				//the glyph doesn't fit in the texture-atlas. ignore it for now.
-				//we might want to restart with a bigger atlas in the future
-				continue;
+				auto self = weak_self.lock();
+				if (!self)
+					return;
+
+				std::lock_guard<std::mutex> lock(self->mutex_);
+				self->find_or_rasterize(code);
 			}
+		}, task_priority::lowest_priority);
+	}
+};
+
+// Process wide registry of font atlases. Only weak references are kept, an atlas is evicted
+// together with its pages and uploaded frames when the last font using it goes away.
+class font_atlas_cache : boost::noncopyable
+{
+	typedef std::tuple<std::wstring, double, double, double, double, double, int> key;
+
+	std::mutex										mutex_;
+	std::map<key, std::weak_ptr<font_atlas>>		atlases_;
+	executor										worker_		{ L"font_atlas_cache" };
 
-			atlas_.set_region(region.x, region.y, bitmap.width, bitmap.rows, bitmap.buffer, bitmap.pitch, col);
-			glyphs_.insert(std::pair<int, glyph_info>(i, glyph_info(bitmap.width, bitmap.rows,
-										region.x / static_cast<double>(atlas_.width()),
-										region.y / static_cast<double>(atlas_.height()),
-										(region.x + bitmap.width) / static_cast<double>(atlas_.width()),
-										(region.y + bitmap.rows) / static_cast<double>(atlas_.height()))));
+public:
+	static font_atlas_cache& instance()
+	{
+		// The worker registers a thread_info, so the registry of those has to be destroyed after the cache
+		get_thread_info();
+
+		static font_atlas_cache cache;
+		return cache;
+	}
+
+	std::shared_ptr<font_atlas> get(const text_info& info)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		for (auto it = atlases_.begin(); it != atlases_.end();)
+		{
+			if (it->second.expired())
+				it = atlases_.erase(it);
+			else
+				++it;
+		}
+
+		auto& entry = atlases_[key(info.font_file, info.size, info.color.r, info.color.g, info.color.b, info.color.a, render_flags)];
+		auto atlas = entry.lock();
+
+		if (!atlas)
+		{
+			atlas = std::make_shared<font_atlas>(worker_, info);
+			entry = atlas;
 		}
+
+		return atlas;
+	}
+};
+
+struct texture_font::impl
+{
+private:
+	std::shared_ptr<font_atlas>		atlas_;
+	double							size_;
+	double							tracking_;
+	bool							normalize_;
+	std::wstring					name_;
+
+public:
+	impl(const text_info& info, bool normalize_coordinates)
+		: atlas_(font_atlas_cache::instance().get(info))
+		, size_(info.size)
+		, tracking_(info.size*info.tracking/1000.0)
+		, normalize_(normalize_coordinates)
+		, name_(info.font)
+	{
 	}
 
-	std::vector<frame_geometry::coord> create_vertex_stream(const std::wstring& str, int x, int y, int parent_width, int parent_height, string_metrics* metrics, double shear)
+	void set_tracking(double tracking)
 	{
-		//TODO: detect glyphs that aren't in the atlas and load them (and maybe that entire unicode_block on the fly
+		tracking_ = size_ * tracking / 1000.0;
+	}
+
+	void load_glyphs(unicode_block block)
+	{
+		atlas_->load_glyphs(block);
+	}
+
+	void prefetch_glyphs(unicode_block block)
+	{
+		atlas_->prefetch_glyphs(block);
+	}
+
+	draw_frame create_frame(const spl::shared_ptr<frame_factory>& frame_factory, const std::wstring& str, int x, int y, int parent_width, int parent_height, string_metrics* metrics, double shear)
+	{
+		auto placements = atlas_->place(str);
 
 		std::vector<frame_geometry::coord> result;
-		result.resize(4 * str.length());
+		result.resize(4 * placements.size());
 
-		bool use_kerning = (face_->face_flags & FT_FACE_FLAG_KERNING) == FT_FACE_FLAG_KERNING;
 		int index = 0;
-		FT_UInt previous = 0;
 		double pos_x = static_cast<double>(x);
 		double pos_y = static_cast<double>(y);
 
@@ -122,81 +400,62 @@ public:
 		int maxProtrudeUnderY = 0;
 		int maxHeight = 0;
 
-		for (auto it = str.begin(), end = str.end(); it != end; ++it, ++index)
+		for (auto it = placements.begin(), end = placements.end(); it != end; ++it, ++index)
 		{
-			auto glyph_it = glyphs_.find(*it);
-			if (glyph_it != glyphs_.end())
-			{
-				const glyph_info& coords = glyph_it->second;
-
-				FT_UInt glyph_index = FT_Get_Char_Index(face_.get(), (*it));
-
-				if(use_kerning && previous && glyph_index)
-				{
-					FT_Vector delta;
-					FT_Get_Kerning(face_.get(), previous, glyph_index, FT_KERNING_DEFAULT, &delta);
+			const font_atlas::glyph& coords = *it->info;
 
-					pos_x += delta.x / 64.0;
-				}
+			pos_x += it->kerning;
 
-				FT_Load_Glyph(face_.get(), glyph_index, FT_LOAD_NO_BITMAP | FT_LOAD_FORCE_AUTOHINT | FT_LOAD_TARGET_NORMAL);
+			double left = (pos_x + coords.bearing_x / 64.0) / parent_width;
+			double right = ((pos_x + coords.bearing_x / 64.0) + coords.width) / parent_width;
 
-				double left = (pos_x + face_->glyph->metrics.horiBearingX / 64.0) / parent_width;
-				double right = ((pos_x + face_->glyph->metrics.horiBearingX / 64.0) + coords.width) / parent_width;
+			double top = (pos_y - coords.bearing_y / 64.0) / parent_height;
+			double bottom = ((pos_y - coords.bearing_y / 64.0) + coords.height) / parent_height;
 
-				double top = (pos_y - face_->glyph->metrics.horiBearingY/64.0) / parent_height;
-				double bottom = ((pos_y - face_->glyph->metrics.horiBearingY / 64.0) + coords.height) / parent_height;
+			auto ul_index = index * 4;
+			auto ur_index = ul_index + 1;
+			auto lr_index = ul_index + 2;
+			auto ll_index = ul_index + 3;
 
-				auto ul_index = index * 4;
-				auto ur_index = ul_index + 1;
-				auto lr_index = ul_index + 2;
-				auto ll_index = ul_index + 3;
+			//vertex 1 upper left
+			result[ul_index].vertex_x = left;	//vertex.x
+			result[ul_index].vertex_y	= top;		  		//vertex.y
+			result[ul_index].texture_x	= coords.left;		//texcoord.r
+			result[ul_index].texture_y	= coords.top; 		//texcoord.s
 
-				//vertex 1 upper left
-				result[ul_index].vertex_x = left;	//vertex.x
-				result[ul_index].vertex_y	= top;		  		//vertex.y
-				result[ul_index].texture_x	= coords.left;		//texcoord.r
-				result[ul_index].texture_y	= coords.top; 		//texcoord.s
+			//vertex 2 upper right
+			result[ur_index].vertex_x = right;	//vertex.x
+			result[ur_index].vertex_y	= top;		   		//vertex.y
+			result[ur_index].texture_x	= coords.right;		//texcoord.r
+			result[ur_index].texture_y	= coords.top;  		//texcoord.s
 
-				//vertex 2 upper right
-				result[ur_index].vertex_x = right;	//vertex.x
-				result[ur_index].vertex_y	= top;		   		//vertex.y
-				result[ur_index].texture_x	= coords.right;		//texcoord.r
-				result[ur_index].texture_y	= coords.top;  		//texcoord.s
+			//vertex 3 lower right
+			result[lr_index].vertex_x	= right;	//vertex.x
+			result[lr_index].vertex_y	= bottom;	   			//vertex.y
+			result[lr_index].texture_x	= coords.right;			//texcoord.r
+			result[lr_index].texture_y	= coords.bottom;		//texcoord.s
 
-				//vertex 3 lower right
-				result[lr_index].vertex_x	= right;	//vertex.x
-				result[lr_index].vertex_y	= bottom;	   			//vertex.y
-				result[lr_index].texture_x	= coords.right;			//texcoord.r
-				result[lr_index].texture_y	= coords.bottom;		//texcoord.s
+			//vertex 4 lower left
+			result[ll_index].vertex_x	= left;	//vertex.x
+			result[ll_index].vertex_y	= bottom;				//vertex.y
+			result[ll_index].texture_x	= coords.left;			//texcoord.r
+			result[ll_index].texture_y	= coords.bottom;		//texcoord.s
 
-				//vertex 4 lower left
-				result[ll_index].vertex_x	= left;	//vertex.x
-				result[ll_index].vertex_y	= bottom;				//vertex.y
-				result[ll_index].texture_x	= coords.left;			//texcoord.r
-				result[ll_index].texture_y	= coords.bottom;		//texcoord.s
+			int bearingY = coords.bearing_y >> 6;
 
-				int bearingY = face_->glyph->metrics.horiBearingY >> 6;
+			if(bearingY > maxBearingY)
+				maxBearingY = bearingY;
 
-				if(bearingY > maxBearingY)
-					maxBearingY = bearingY;
+			int protrudeUnderY = coords.height - bearingY;
 
-				int protrudeUnderY = coords.height - bearingY;
+			if (protrudeUnderY > maxProtrudeUnderY)
+				maxProtrudeUnderY = protrudeUnderY;
 
-				if (protrudeUnderY > maxProtrudeUnderY)
-					maxProtrudeUnderY = protrudeUnderY;
+			if (maxBearingY + maxProtrudeUnderY > maxHeight)
+				maxHeight = maxBearingY + maxProtrudeUnderY;
 
-				if (maxBearingY + maxProtrudeUnderY > maxHeight)
-					maxHeight = maxBearingY + maxProtrudeUnderY;
-
-				pos_x += face_->glyph->advance.x / 64.0;
-				pos_x += tracking_;
-				previous = glyph_index;
-			}
-			else
-			{
-				//TODO: maybe we should try to load the glyph on the fly if it is missing.
-			}
+			pos_x += coords.advance / 64.0;
+			pos_x += tracking_;
 		}
 
 		if(normalize_)
@@ -219,7 +478,24 @@ public:
 			metrics->protrudeUnderY	= maxProtrudeUnderY;
 		}
 
-		return result;
+		//one quad list per atlas page, almost every string only touches the first one
+		std::map<int, std::vector<frame_geometry::coord>> streams;
+
+		for (size_t i = 0; i < placements.size(); ++i)
+		{
+			auto& stream = streams[placements[i].info->page];
+			stream.insert(stream.end(), result.begin() + i * 4, result.begin() + (i + 1) * 4);
+		}
+
+		std::vector<draw_frame> frames;
+
+		for (auto& stream : streams)
+			frames.push_back(draw_frame(atlas_->page_frame(stream.first, frame_factory).with_geometry(frame_geometry(frame_geometry::geometry_type::quad_list, std::move(stream.second)))));
+
+		if (frames.size() == 1)
+			return std::move(frames.front());
+
+		return draw_frame(std::move(frames));
 	}
 
 	std::wstring get_name() const
@@ -233,10 +509,11 @@ public:
 	}
 };
 
-texture_font::texture_font(texture_atlas& atlas, const text_info& info, bool normalize_coordinates) : impl_(new impl(atlas, info, normalize_coordinates)) {}
-void texture_font::load_glyphs(unicode_block range, const color<double>& col) { impl_->load_glyphs(range, col); }
+texture_font::texture_font(const text_info& info, bool normalize_coordinates) : impl_(new impl(info, normalize_coordinates)) {}
+void texture_font::load_glyphs(unicode_block range) { impl_->load_glyphs(range); }
+void texture_font::prefetch_glyphs(unicode_block range) { impl_->prefetch_glyphs(range); }
 void texture_font::set_tracking(double tracking) { impl_->set_tracking(tracking); }
-std::vector<frame_geometry::coord> texture_font::create_vertex_stream(const std::wstring& str, int x, int y, int parent_width, int parent_height, string_metrics* metrics, double shear) { return impl_->create_vertex_stream(str, x, y, parent_width, parent_height, metrics, shear); }
+draw_frame texture_font::create_frame(const spl::shared_ptr<frame_factory>& frame_factory, const std::wstring& str, int x, int y, int parent_width, int parent_height, string_metrics* metrics, double shear) { return impl_->create_frame(frame_factory, str, x, y, parent_width, parent_height, metrics, shear); }
 std::wstring texture_font::get_name() const { return impl_->get_name(); }
 double texture_font::get_size() const { return impl_->get_size(); }
 
@@ -6,11 +6,10 @@
 
 #include "string_metrics.h"
 #include "text_info.h"
-#include "../../../frame/geometry.h"
+#include "../../../fwd.h"
 
 namespace caspar { namespace core { namespace text {
 
-class texture_atlas;
 enum class unicode_block;
 
 class texture_font
@@ -20,10 +19,11 @@ class texture_font
 	const texture_font& operator=(const texture_font&);
 
 public:
-	texture_font(texture_atlas&, const text_info&, bool normalize_coordinates);
-	void load_glyphs(unicode_block block, const color<double>& col);
+	texture_font(const text_info&, bool normalize_coordinates);
+	void load_glyphs(unicode_block block);
+	void prefetch_glyphs(unicode_block block);
 	void set_tracking(double tracking);
-	std::vector<frame_geometry::coord> create_vertex_stream(const std::wstring& str, int x, int y, int parent_width, int parent_height, string_metrics* metrics, double shear = 0.0);
+	draw_frame create_frame(const spl::shared_ptr<frame_factory>& frame_factory, const std::wstring& str, int x, int y, int parent_width, int parent_height, string_metrics* metrics, double shear = 0.0);
 	std::wstring get_name() const;
 	double get_size() const;
 
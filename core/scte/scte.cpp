@@ -22,20 +22,31 @@
 #include "scte.h"
 #include "common/param.h"
 #include "common/except.h"
+#include "common/utf.h"
 
 #include "core/ancillary/ancillary.h"
 #include "core/ancillary/scte/scte.h"
+#include "core/ancillary/scte/messages/availdescriptor.h"
+#include "core/ancillary/scte/messages/dtmfdescriptor.h"
+#include "core/ancillary/scte/messages/segmentationdescriptor.h"
 #include "core/ancillary/scte/messages/splicenull.h"
 #include "core/ancillary/scte/messages/splicerequest.h"
+#include "core/ancillary/scte/messages/timesignal.h"
 
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/optional.hpp>
+
+#include <algorithm>
 #include <cstdint>
+#include <list>
+#include <mutex>
 #include <vector>
 namespace caspar { namespace core {
 
 void split_param(const std::wstring& in, std::list<std::wstring> &tokens)
 {
     std::wstring currentparam;
-    for (size_t index; index < in.length(); index++)
+    for (size_t index = 0; index < in.length(); index++)
     {
         if (in[index] == L'=' || in[index] == L',' || in[index] == L' ')
         {
@@ -58,6 +69,7 @@ void split_param(const std::wstring& in, std::list<std::wstring> &tokens)
 
 #define OPID_SPLICE L"SPLICE"
 #define OPID_SPLICE_NULL L"SPLICE_NULL"
+#define OPID_TIME_SIGNAL L"TIME_SIGNAL"
 
 #define SPLICE_START_NORMAL L"START_NORMAL"
 #define SPLICE_START_IMMEDIATE L"START_IMMEDIATE"
@@ -65,22 +77,107 @@ void split_param(const std::wstring& in, std::list<std::wstring> &tokens)
 #define SPLICE_END_IMMEDIATE L"END_IMMEDIATE"
 #define SPLICE_CANCEL L"CANCEL"
 
+//Reads an unsigned integer param, decimal or 0x prefixed hex, and checks that it fits the field it is written to
+template<typename T>
+T get_field_param(const std::wstring& name, const std::vector<std::wstring>& parameters, T fail_value)
+{
+    auto value_s = get_param(name, parameters, L"");
+    if (value_s.empty())
+        return fail_value;
+
+    int64_t value = -1;
+    try
+    {
+        size_t parsed = 0;
+        auto hex = boost::istarts_with(value_s, L"0x");
+        value = std::stoll(hex ? value_s.substr(2) : value_s, &parsed, hex ? 16 : 10);
+        if (parsed != value_s.size() - (hex ? 2 : 0))
+            value = -1;
+    }
+    catch (...)
+    {
+    }
+
+    if (value < 0 || value > static_cast<int64_t>(std::numeric_limits<T>::max()))
+        CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"SCTE param " + name + L" out of range"));
+    return static_cast<T>(value);
+}
+
+//Values of a param that may be given more than once, e.g. PROVIDER_AVAIL_ID=1,PROVIDER_AVAIL_ID=2
+std::vector<std::wstring> get_param_values(const std::wstring& name, const std::vector<std::wstring>& parameters)
+{
+    std::vector<std::wstring> values;
+    for (size_t index = 0; index + 1 < parameters.size(); index++)
+    {
+        if (boost::iequals(parameters[index], name))
+            values.push_back(parameters[++index]);
+    }
+    return values;
+}
+
+std::vector<uint8_t> parse_hex(const std::wstring& name, std::wstring hex)
+{
+    if (boost::istarts_with(hex, L"0x"))
+        hex = hex.substr(2);
+
+    std::vector<uint8_t> bytes;
+    if (hex.size() % 2 != 0 || hex.size() > 2 * 255)
+        CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"SCTE param " + name + L" must be an even number of hex digits"));
+    for (size_t index = 0; index < hex.size(); index += 2)
+    {
+        try
+        {
+            bytes.push_back(static_cast<uint8_t>(std::stoul(hex.substr(index, 2), nullptr, 16)));
+        }
+        catch (...)
+        {
+            CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"SCTE param " + name + L" is not hexadecimal"));
+        }
+    }
+    return bytes;
+}
+
 struct scte_104::impl : boost::noncopyable
 {
-    enum core::ancillary::scte104::scte_104_opid opid = core::ancillary::scte104::opid_null;
-    enum core::ancillary::scte104::scte_104_splice_type splice_type = core::ancillary::scte104::splice_type_null;
-    uint32_t event_id = 0;
-    uint16_t unique_program_id = 0;
-    uint16_t pre_roll_time = 0;//milliseconds
-    uint16_t break_duration = 0;
-    uint8_t avail_num = 0;
-    uint8_t avails_expected = 0;
-    uint8_t auto_return_flag = 0;
-
-    bool started = false;
-    timer since_last_splice_cmd;
-    timer since_first_frame;
-    uint16_t next_remaining_mark;
+    struct scheduled_event
+    {
+        enum core::ancillary::scte104::scte_104_opid opid = core::ancillary::scte104::opid_splice;
+        enum core::ancillary::scte104::scte_104_splice_type splice_type = core::ancillary::scte104::splice_type_null;
+        uint32_t event_id = 0;
+        uint16_t unique_program_id = 0;
+        uint16_t pre_roll_time = 0;//milliseconds
+        uint16_t break_duration = 0;
+        uint8_t avail_num = 0;
+        uint8_t avails_expected = 0;
+        uint8_t auto_return_flag = 0;
+
+        //Descriptors that go out after the request in the same message
+        boost::optional<core::ancillary::scte104::segmentation_descriptor> segmentation;
+        std::vector<uint32_t> provider_avail_ids;
+        std::string dtmf_chars;
+        uint8_t dtmf_pre_roll = 0;//tenths of a second
+
+        boost::optional<int64_t> splice_frame;//channel frame, fixed at the first tick after the event was scheduled
+        int64_t next_send_frame = 0;
+
+        bool has_pre_roll() const
+        {
+            return opid == core::ancillary::scte104::opid_time_signal
+                || splice_type == core::ancillary::scte104::start_normal
+                || splice_type == core::ancillary::scte104::end_normal;
+        }
+    };
+
+    std::mutex mutex;
+    std::list<scheduled_event> events;
+    bool send_null = false;
+
+    //milliseconds, 0 disables
+    uint16_t resend_interval = 1000;
+    uint16_t resend_limit = 4500;
+    uint16_t heartbeat_interval = 1000;
+
+    boost::optional<int64_t> last_sent_frame;
 
     impl(const std::wstring &scte_string)
     {
@@ -90,114 +187,228 @@ struct scte_104::impl : boost::noncopyable
     void parse_params(const std::wstring& scte_string)
     {
         CASPAR_LOG(debug) << scte_string;
-        constexpr auto uint32_max = std::numeric_limits<uint32_t>::max();
         constexpr auto uint16_max = std::numeric_limits<uint16_t>::max();
-        constexpr auto uint8_max = 255U;
         std::list<std::wstring> tokens;
         split_param(scte_string, tokens);
         std::vector<std::wstring> parameters(tokens.begin(), tokens.end());
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        resend_interval = get_field_param(L"RESEND_INTERVAL", parameters, resend_interval);
+        resend_limit = get_field_param(L"RESEND_LIMIT", parameters, resend_limit);
+        heartbeat_interval = get_field_param(L"HEARTBEAT", parameters, heartbeat_interval);
+
+        scheduled_event event;
         auto opid_s				= get_param(L"OPID", 			parameters, L"");
         if (opid_s.empty())
             CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"SCTE without OPID Param "));
         else if (opid_s == OPID_SPLICE_NULL)
-            opid = core::ancillary::scte104::opid_splice_null;
+        {
+            send_null = true;
+            return;
+        }
         else if (opid_s == OPID_SPLICE)
-            opid = core::ancillary::scte104::opid_splice;
+            event.opid = core::ancillary::scte104::opid_splice;
+        else if (opid_s == OPID_TIME_SIGNAL)
+            event.opid = core::ancillary::scte104::opid_time_signal;
         else
             CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"SCTE wrong OPID Param "));
-        if (opid == core::ancillary::scte104::opid_splice)
+
+        event.event_id = get_field_param<uint32_t>(L"EVENT_ID", parameters, 0);
+
+        if (event.opid == core::ancillary::scte104::opid_splice)
         {
             auto splice_type_s = get_param(L"SPLICE_TYPE", parameters, L"");
             if (splice_type_s.empty())
                 CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"SCTE no SPLICE_TYPE param"));
             else if (splice_type_s == SPLICE_START_NORMAL)
-                splice_type = core::ancillary::scte104::start_normal;
+                event.splice_type = core::ancillary::scte104::start_normal;
             else if (splice_type_s == SPLICE_START_IMMEDIATE)
-                splice_type = core::ancillary::scte104::start_immediate;
+                event.splice_type = core::ancillary::scte104::start_immediate;
             else if (splice_type_s == SPLICE_END_NORMAL)
-                splice_type = core::ancillary::scte104::end_normal;
+                event.splice_type = core::ancillary::scte104::end_normal;
             else if (splice_type_s == SPLICE_END_IMMEDIATE)
-                splice_type = core::ancillary::scte104::end_immediate;
+                event.splice_type = core::ancillary::scte104::end_immediate;
             else if (splice_type_s == SPLICE_CANCEL)
-                splice_type = core::ancillary::scte104::cancel;
+                event.splice_type = core::ancillary::scte104::cancel;
             else
                 CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"SCTE wrong SPLICE_TYPE Param "));
-            if (splice_type == core::ancillary::scte104::start_normal || splice_type == core::ancillary::scte104::end_normal) {
-                next_remaining_mark = pre_roll_time = get_param(L"PRE_ROLL_TIME", parameters, uint16_max);
-            }
-            if (splice_type == core::ancillary::scte104::start_normal || splice_type == core::ancillary::scte104::start_immediate) {
-                break_duration = get_param(L"BREAK_DURATION", parameters, uint16_max);
-                auto_return_flag = contains_param(L"AUTO_RETURN", parameters);
+
+            event.unique_program_id = get_field_param<uint16_t>(L"UNIQUE_PROGRAM_ID", parameters, 0);
+            event.avail_num = get_field_param<uint8_t>(L"AVAIL_NUM", parameters, 0);
+            event.avails_expected = get_field_param<uint8_t>(L"AVAILS_EXPECTED", parameters, 0);
+            if (event.has_pre_roll())
+                event.pre_roll_time = get_field_param(L"PRE_ROLL_TIME", parameters, uint16_max);
+            if (event.splice_type == core::ancillary::scte104::start_normal || event.splice_type == core::ancillary::scte104::start_immediate) {
+                event.break_duration = get_field_param(L"BREAK_DURATION", parameters, uint16_max);
+                event.auto_return_flag = contains_param(L"AUTO_RETURN", parameters);
             }
         }
-        CASPAR_LOG(debug) << "SCTE Configured with: OPID: " << opid
-                          << "Splice request, type: " << splice_type
-                          << " event id: " << event_id
-                          << " unique program_id: " << unique_program_id
-                          << " pre_roll_time: " << next_remaining_mark
-                          << " break_duration: " << break_duration
-                          << " avail_num: " << avail_num
-                          << " avails_expected: " << avails_expected
-                          << " auto_return_flag: " << auto_return_flag;
-        started = false;
-    }
+        else
+            event.pre_roll_time = get_field_param<uint16_t>(L"PRE_ROLL_TIME", parameters, 0);
 
-    auto get_data(bool null)
-    {
-        auto scte104_ancillary = std::make_shared<core::ancillary::SCTE104AncData>();
-        if (opid == core::ancillary::scte104::opid_splice) {
-            
-            auto splicerequest = std::make_unique<core::ancillary::scte104::SpliceRequest>(splice_type
-                                                                                         , event_id
-                                                                                         , unique_program_id
-                                                                                         , next_remaining_mark
-                                                                                         , break_duration
-                                                                                         , avail_num
-                                                                                         , avails_expected
-                                                                                         , auto_return_flag);
-            scte104_ancillary->addMsg(std::move(splicerequest));
-            CASPAR_LOG(debug) << "Splice request, type: " << splice_type
-                            << " event id: " << event_id
-                            << " unique program_id: " << unique_program_id
-                            << " pre_roll_time: " << next_remaining_mark
-                            << " break_duration: " << break_duration
-                            << " avail_num: " << avail_num
-                            << " avails_expected: " << avails_expected
-                            << " auto_return_flag: " << auto_return_flag;
-
-            next_remaining_mark -= 1000;
-            if (next_remaining_mark <= 4500 || next_remaining_mark > pre_roll_time)
+        if (contains_param(L"SEGMENTATION_TYPE_ID", parameters))
+        {
+            core::ancillary::scte104::segmentation_descriptor descriptor;
+            descriptor.event_id = get_field_param(L"SEGMENTATION_EVENT_ID", parameters, event.event_id);
+            descriptor.event_cancel_indicator = contains_param(L"SEGMENTATION_CANCEL", parameters);
+            descriptor.type_id = get_field_param<uint8_t>(L"SEGMENTATION_TYPE_ID", parameters, 0);
+            descriptor.duration = get_field_param<uint16_t>(L"DURATION", parameters, 0);
+            descriptor.duration_extension_frames = get_field_param<uint8_t>(L"DURATION_EXTENSION_FRAMES", parameters, 0);
+            descriptor.upid_type = get_field_param<uint8_t>(L"UPID_TYPE", parameters, 0);
+            descriptor.upid = parse_hex(L"UPID", get_param(L"UPID", parameters, L""));
+            descriptor.segment_num = get_field_param<uint8_t>(L"SEGMENT_NUM", parameters, 0);
+            descriptor.segments_expected = get_field_param<uint8_t>(L"SEGMENTS_EXPECTED", parameters, 0);
+            descriptor.sub_segment_num = get_field_param<uint8_t>(L"SUB_SEGMENT_NUM", parameters, 0);
+            descriptor.sub_segments_expected = get_field_param<uint8_t>(L"SUB_SEGMENTS_EXPECTED", parameters, 0);
+            descriptor.insert_sub_segment_info = contains_param(L"SUB_SEGMENT_NUM", parameters) || contains_param(L"SUB_SEGMENTS_EXPECTED", parameters);
+
+            if (contains_param(L"DEVICE_RESTRICTIONS", parameters))
             {
-                opid = core::ancillary::scte104::opid_splice_null;
+                //Restrictions apply as soon as any of them is given
+                descriptor.delivery_not_restricted_flag = 0;
+                descriptor.web_delivery_allowed_flag = contains_param(L"WEB_DELIVERY_ALLOWED", parameters);
+                descriptor.no_regional_blackout_flag = contains_param(L"NO_REGIONAL_BLACKOUT", parameters);
+                descriptor.archive_allowed_flag = contains_param(L"ARCHIVE_ALLOWED", parameters);
+                descriptor.device_restrictions = get_field_param<uint8_t>(L"DEVICE_RESTRICTIONS", parameters, 3);
+                if (descriptor.device_restrictions > 3)
+                    CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"SCTE param DEVICE_RESTRICTIONS out of range"));
             }
-        } else
+
+            event.segmentation = std::move(descriptor);
+        }
+
+        for (auto& id : get_param_values(L"PROVIDER_AVAIL_ID", parameters))
+            event.provider_avail_ids.push_back(get_field_param<uint32_t>(L"PROVIDER_AVAIL_ID", { L"PROVIDER_AVAIL_ID", id }, 0));
+        if (event.provider_avail_ids.size() > 255)
+            CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"SCTE too many PROVIDER_AVAIL_ID params"));
+
+        auto dtmf = get_param(L"DTMF", parameters, L"");
+        if (!dtmf.empty())
         {
-            scte104_ancillary->addMsg(std::make_unique<core::ancillary::scte104::SpliceNull>());
-            CASPAR_LOG(debug) << "Splice NULL";
+            if (dtmf.size() > 7 || dtmf.find_first_not_of(L"0123456789*#") != std::wstring::npos)
+                CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"SCTE param DTMF takes up to 7 of 0-9, * and #"));
+            event.dtmf_chars = u8(dtmf);
+            event.dtmf_pre_roll = get_field_param<uint8_t>(L"DTMF_PRE_ROLL", parameters, 0);
         }
 
-        since_last_splice_cmd.restart();
-        return scte104_ancillary;
+        CASPAR_LOG(debug) << "SCTE scheduled opid: " << event.opid
+                          << " splice type: " << event.splice_type
+                          << " event id: " << event.event_id
+                          << " unique program_id: " << event.unique_program_id
+                          << " pre_roll_time: " << event.pre_roll_time
+                          << " break_duration: " << event.break_duration
+                          << " avail_num: " << static_cast<int>(event.avail_num)
+                          << " avails_expected: " << static_cast<int>(event.avails_expected)
+                          << " auto_return_flag: " << static_cast<int>(event.auto_return_flag)
+                          << " segmentation: " << (event.segmentation ? 1 : 0)
+                          << " provider avails: " << event.provider_avail_ids.size()
+                          << " dtmf: " << event.dtmf_chars;
+
+        //A new request for an event replaces the pending one, a cancel is sent once in its place
+        events.remove_if([&](const scheduled_event& other) { return other.event_id == event.event_id; });
+        events.push_back(std::move(event));
     }
 
-    std::shared_ptr<core::ancillary::AncillaryData> tick()
+    static int64_t to_frames(int64_t milliseconds, const boost::rational<int>& framerate)
     {
-        if (!started)
+        auto n = static_cast<int64_t>(framerate.numerator());
+        auto d = static_cast<int64_t>(framerate.denominator()) * 1000;
+        return (milliseconds * n * 2 + d) / (d * 2);
+    }
+
+    static uint16_t to_milliseconds(int64_t frames, const boost::rational<int>& framerate)
+    {
+        auto n = static_cast<int64_t>(framerate.numerator());
+        auto d = static_cast<int64_t>(framerate.denominator()) * 1000;
+        auto milliseconds = (std::max<int64_t>(frames, 0) * d * 2 + n) / (n * 2);
+        return static_cast<uint16_t>(std::min<int64_t>(milliseconds, std::numeric_limits<uint16_t>::max()));
+    }
+
+    static void add_messages(const scheduled_event& event, uint16_t pre_roll_time, core::ancillary::SCTE104AncData& scte104_ancillary)
+    {
+        CASPAR_LOG(debug) << "SCTE request, opid: " << event.opid
+                          << " event id: " << event.event_id
+                          << " pre_roll_time: " << pre_roll_time;
+
+        if (event.opid == core::ancillary::scte104::opid_time_signal)
+            scte104_ancillary.addMsg(std::make_unique<core::ancillary::scte104::TimeSignalRequest>(pre_roll_time));
+        else
+            scte104_ancillary.addMsg(std::make_unique<core::ancillary::scte104::SpliceRequest>(event.splice_type
+                                                                                             , event.event_id
+                                                                                             , event.unique_program_id
+                                                                                             , pre_roll_time
+                                                                                             , event.break_duration
+                                                                                             , event.avail_num
+                                                                                             , event.avails_expected
+                                                                                             , event.auto_return_flag));
+
+        if (event.segmentation)
+            scte104_ancillary.addMsg(std::make_unique<core::ancillary::scte104::InsertSegmentationDescriptor>(*event.segmentation));
+        if (!event.provider_avail_ids.empty())
+            scte104_ancillary.addMsg(std::make_unique<core::ancillary::scte104::InsertAvailDescriptor>(event.provider_avail_ids));
+        if (!event.dtmf_chars.empty())
+            scte104_ancillary.addMsg(std::make_unique<core::ancillary::scte104::InsertDTMFDescriptor>(event.dtmf_pre_roll, event.dtmf_chars));
+    }
+
+    std::shared_ptr<core::ancillary::AncillaryData> tick(int64_t frame, const core::video_format_desc& format_desc)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        const auto& framerate = format_desc.framerate;
+
+        std::shared_ptr<core::ancillary::SCTE104AncData> scte104_ancillary;
+        auto message = [&]() -> core::ancillary::SCTE104AncData&
         {
-            since_first_frame.restart();
-            auto data = get_data(opid == core::ancillary::scte104::opid_splice_null);
-            started = true;
-            return data;
-        }
-        uint16_t remaining = pre_roll_time - (since_first_frame.elapsed() * 1000);
-        if (opid == core::ancillary::scte104::opid_splice && remaining <= next_remaining_mark)
+            if (!scte104_ancillary)
+                scte104_ancillary = std::make_shared<core::ancillary::SCTE104AncData>();
+            return *scte104_ancillary;
+        };
+
+        for (auto it = events.begin(); it != events.end();)
         {
-            return get_data(false);
+            auto& event = *it;
+
+            if (!event.has_pre_roll())
+            {
+                add_messages(event, 0, message());
+                it = events.erase(it);
+                continue;
+            }
+
+            if (!event.splice_frame)
+            {
+                event.splice_frame = frame + to_frames(event.pre_roll_time, framerate);
+                event.next_send_frame = frame;
+            }
+
+            if (frame >= event.next_send_frame)
+            {
+                add_messages(event, to_milliseconds(*event.splice_frame - frame, framerate), message());
+                event.next_send_frame = frame + std::max<int64_t>(to_frames(resend_interval, framerate), 1);
+            }
+
+            //Resends stop once the next one would fall within the resend limit of the splice point
+            if (resend_interval == 0 || *event.splice_frame - event.next_send_frame <= to_frames(resend_limit, framerate))
+                it = events.erase(it);
+            else
+                ++it;
         }
-        if (since_last_splice_cmd.elapsed() >= 1) {
-            return get_data(true);
+
+        auto heartbeat_due = heartbeat_interval != 0 && (!last_sent_frame || frame - *last_sent_frame >= to_frames(heartbeat_interval, framerate));
+
+        if (!scte104_ancillary && (send_null || heartbeat_due))
+        {
+            message().addMsg(std::make_unique<core::ancillary::scte104::SpliceNull>());
+            CASPAR_LOG(debug) << "Splice NULL";
         }
-        return nullptr;
+
+        send_null = false;
+
+        if (scte104_ancillary)
+            last_sent_frame = frame;
+
+        return scte104_ancillary;
     }
 };
 
@@ -210,6 +421,6 @@ scte_104& scte_104::operator=(scte_104&& other)
 	impl_ = std::move(other.impl_);
 	return *this;
 }
-std::shared_ptr<core::ancillary::AncillaryData> scte_104::tick(){ return impl_->tick(); }
+std::shared_ptr<core::ancillary::AncillaryData> scte_104::tick(int64_t channel_frame, const core::video_format_desc& format_desc){ return impl_->tick(channel_frame, format_desc); }
 void scte_104::update(const std::wstring& scte_string) { impl_->parse_params(scte_string); };
 }}
@@ -23,9 +23,17 @@
 #include "../StdAfx.h"
 
 #include "core/ancillary/ancillary.h"
+#include "core/video_format.h"
+
+#include <cstdint>
 
 namespace caspar { namespace core {
     
+    //Schedules SCTE-104 messages by channel frame: splice requests with a pre-roll are re-sent
+    //with a countdown to the same splice frame, splice_null heartbeats fill the gaps. Events
+    //are kept per event_id, a new request replaces the pending one with the same id.
+    //Counting channel frames rather than produced frames keeps the countdown running while
+    //the producer is paused or repeats frames.
     class scte_104 final
     {
         scte_104(const scte_104&);
@@ -36,7 +44,10 @@ namespace caspar { namespace core {
         ~scte_104();
         scte_104(scte_104&& other);
         scte_104& operator=(scte_104&& other);
-        std::shared_ptr<core::ancillary::AncillaryData>  tick();
+        //Called for every frame the producer emits, channel_frame is the number of the channel
+        //frame it goes out in and format_desc the channel's format
+        std::shared_ptr<core::ancillary::AncillaryData>  tick(int64_t channel_frame, const core::video_format_desc& format_desc);
+        //Schedules another request, takes the same parameters as the constructor
         void update(const std::wstring& scte_string);
         
     private:
@@ -78,6 +78,7 @@ struct video_channel::impl final
 	mutable std::mutex    								tick_listeners_mutex_;
 	int64_t												last_tick_listener_id	= 0;
 	std::unordered_map<int64_t, std::function<void ()>>	tick_listeners_;
+	std::atomic<int64_t>								frame_number_			{ 0 };
 
 	//executor											executor_				{ L"video_channel " + boost::lexical_cast<std::wstring>(index_) };
     std::atomic<bool> abort_request_{false};
@@ -223,6 +224,8 @@ public:
 			CASPAR_LOG_CURRENT_EXCEPTION();
 		}
 
+		++frame_number_;
+
 		//if (executor_.is_running())
 		//	executor_.begin_invoke([=]{tick();});
 	}
@@ -237,6 +240,11 @@ public:
 		return index_;
 	}
 
+	int64_t frame_number() const
+	{
+		return frame_number_;
+	}
+
 	boost::property_tree::wptree info() const
 	{
 		boost::property_tree::wptree info;
@@ -305,6 +313,7 @@ void core::video_channel::audio_channel_layout(const core::audio_channel_layout&
 boost::property_tree::wptree video_channel::info() const{return impl_->info();}
 boost::property_tree::wptree video_channel::delay_info() const { return impl_->delay_info(); }
 int video_channel::index() const { return impl_->index(); }
+int64_t video_channel::frame_number() const { return impl_->frame_number(); }
 monitor::subject& video_channel::monitor_output(){ return *impl_->monitor_subject_; }
 std::shared_ptr<void> video_channel::add_tick_listener(std::function<void()> listener) { return impl_->add_tick_listener(std::move(listener)); }
 
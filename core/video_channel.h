@@ -76,6 +76,8 @@ public:
 	boost::property_tree::wptree			info() const;
 	boost::property_tree::wptree			delay_info() const;
 	int										index() const;
+	// Number of the frame being produced, counts every tick whether or not producers are paused.
+	int64_t									frame_number() const;
 private:
 	struct impl;
 	spl::unique_ptr<impl> impl_;
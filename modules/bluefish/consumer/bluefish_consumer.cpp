@@ -34,10 +34,10 @@
 #include <common/executor.h>
 #include <common/diagnostics/graph.h>
 #include <common/array.h>
-#include <common/memshfl.h>
 #include <common/param.h>
 
 #include <core/consumer/frame_consumer.h>
+#include <core/frame/keying.h>
 #include <core/mixer/audio/audio_util.h>
 
 #include <tbb/concurrent_queue.h>
@@ -561,7 +561,7 @@ public:
 			if (!frame.image_data().empty())
 			{
 				if (key_only_)
-					aligned_memshfl(dest, frame.image_data().begin(), frame.image_data().size(), 0x0F0F0F0F, 0x0B0B0B0B, 0x07070707, 0x03030303);
+					core::extract_key(frame.image_data().begin(), static_cast<uint8_t*>(dest), frame.image_data().size());
 				else
 					std::memcpy(dest, frame.image_data().begin(), frame.image_data().size());
 			}
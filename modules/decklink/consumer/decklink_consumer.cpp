@@ -39,7 +39,6 @@
 #include <common/executor.h>
 #include <common/diagnostics/graph.h>
 #include <common/except.h>
-#include <common/memshfl.h>
 #include <common/no_init_proxy.h>
 #include <common/array.h>
 #include <common/future.h>
@@ -181,6 +180,7 @@ class decklink_frame : public IDeckLinkVideoFrame
 	const bool										key_only_;
 	bool											needs_to_copy_;
 	cache_aligned_vector<no_init_proxy<uint8_t>>	data_;
+	array<const uint8_t>							key_;
 public:
 	decklink_frame(core::const_frame frame, const core::video_format_desc& format_desc, bool key_only, bool will_attempt_dma)
 		: frame_(frame)
@@ -245,12 +245,11 @@ public:
 			}
 			else if(key_only_)
 			{
-				if(data_.empty())
-				{
-					data_.resize(frame_.image_data().size());
-					aligned_memshfl(data_.data(), frame_.image_data().begin(), frame_.image_data().size(), 0x0F0F0F0F, 0x0B0B0B0B, 0x07070707, 0x03030303);
-				}
-				*buffer = data_.data();
+				// Extracted once for all outputs of the key of the frame.
+				if(key_.empty())
+					key_ = frame_.key_only().image_data();
+
+				*buffer = const_cast<uint8_t*>(key_.begin());
 			}
 			else
 			{
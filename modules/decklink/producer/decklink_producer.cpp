@@ -25,6 +25,7 @@
 
 #include "../util/util.h"
 
+#include "../../ffmpeg/ffmpeg_error.h"
 #include "../../ffmpeg/producer/filter/filter.h"
 #include "../../ffmpeg/producer/util/util.h"
 #include "../../ffmpeg/producer/muxer/frame_muxer.h"
@@ -37,6 +38,7 @@
 #include <common/param.h>
 #include <common/timer.h>
 
+#include <core/ancillary/vanc_decoder.h>
 #include <core/frame/audio_channel_layout.h>
 #include <core/frame/frame.h>
 #include <core/frame/draw_frame.h>
@@ -93,6 +95,51 @@ std::wstring to_string(const T& cadence)
 	return boost::join(cadence | boost::adaptors::transformed([](size_t i) { return boost::lexical_cast<std::wstring>(i); }), L", ");
 }
 
+// First and last line of the vertical blanking of each field, lines the card does not capture are skipped
+std::vector<std::pair<uint32_t, uint32_t>> get_vanc_lines(const core::video_format_desc& format_desc)
+{
+	bool interlaced = format_desc.field_mode != core::field_mode::progressive;
+
+	switch (format_desc.height)
+	{
+	case 480:
+	case 486:
+		return { { 1, 22 }, { 263, 285 } };
+	case 576:
+		return { { 1, 22 }, { 313, 335 } };
+	case 720:
+		return { { 1, 25 } };
+	case 1080:
+		if (interlaced)
+			return { { 1, 20 }, { 561, 583 } };
+		return { { 1, 41 } };
+	default:
+		return { { 1, 41 } };
+	}
+}
+
+// The v210 decoder of FFmpeg unpacks to planar 10 bit 4:2:2 with SIMD. It expects rows padded
+// to 48 pixels, which is how the card delivers them.
+std::shared_ptr<AVCodecContext> open_v210_decoder(const core::video_format_desc& format_desc)
+{
+	auto codec = avcodec_find_decoder(AV_CODEC_ID_V210);
+
+	if (!codec)
+		CASPAR_THROW_EXCEPTION(caspar_exception() << msg_info(L"FFmpeg is built without a v210 decoder."));
+
+	std::shared_ptr<AVCodecContext> context(avcodec_alloc_context3(codec), [](AVCodecContext* codec_context)
+	{
+		avcodec_free_context(&codec_context);
+	});
+
+	context->width	= format_desc.width;
+	context->height	= format_desc.height;
+
+	FF(avcodec_open2(context.get(), codec, nullptr));
+
+	return context;
+}
+
 class decklink_producer : boost::noncopyable, public IDeckLinkInputCallback
 {
 	const int										device_index_;
@@ -106,6 +153,7 @@ class decklink_producer : boost::noncopyable, public IDeckLinkInputCallback
 
 	const std::wstring								model_name_			= get_model_name(decklink_);
 	const std::wstring								filter_;
+	const BMDPixelFormat							pixel_format_;
 
 	core::video_format_desc							in_format_desc_;
 	core::video_format_desc							out_format_desc_;
@@ -128,6 +176,12 @@ class decklink_producer : boost::noncopyable, public IDeckLinkInputCallback
 	tbb::concurrent_bounded_queue<core::draw_frame>	frame_buffer_;
 	core::draw_frame								last_frame_			= core::draw_frame::empty();
 
+	core::ancillary::VancDecoder					vanc_decoder_;
+	core::ancillary::AncillaryContainer				ancillary_;
+	const std::vector<std::pair<uint32_t, uint32_t>>	vanc_lines_			= get_vanc_lines(in_format_desc_);
+	bool											vanc_format_logged_	= false;
+	std::shared_ptr<AVCodecContext>					v210_decoder_;
+
 	std::exception_ptr								exception_;
 
 public:
@@ -137,9 +191,11 @@ public:
 			const spl::shared_ptr<core::frame_factory>& frame_factory,
 			const core::video_format_desc& out_format_desc,
 			const core::audio_channel_layout& channel_layout,
-			const std::wstring& filter)
+			const std::wstring& filter,
+			bool ten_bit)
 		: device_index_(device_index)
 		, filter_(filter)
+		, pixel_format_(ten_bit ? bmdFormat10BitYUV : bmdFormat8BitYUV)
 		, in_format_desc_(in_format_desc)
 		, out_format_desc_(out_format_desc)
 		, frame_factory_(frame_factory)
@@ -155,11 +211,17 @@ public:
 		graph_->set_text(print());
 		diagnostics::register_graph(graph_);
 
+		// 8 bit YUV is handed to the filter graph as it is. The VANC lines come in the pixel format of
+		// the picture and ancillary words need all 10 bits, so ancillary data is only ingested when
+		// capturing 10 bit YUV, which has to be unpacked first. bmdFormat8BitARGB is currently not
+		// supported by any decklink card. (2011-05-08)
+		if (pixel_format_ == bmdFormat10BitYUV)
+			v210_decoder_ = open_v210_decoder(in_format_desc_);
+
 		bool will_attempt_dma;
-		auto display_mode = get_display_mode(input_, in_format_desc.format, bmdFormat8BitYUV, bmdVideoInputFlagDefault, will_attempt_dma);
+		auto display_mode = get_display_mode(input_, in_format_desc.format, pixel_format_, bmdVideoInputFlagDefault, will_attempt_dma);
 
-		// NOTE: bmdFormat8BitARGB is currently not supported by any decklink card. (2011-05-08)
-		if(FAILED(input_->EnableVideoInput(display_mode, bmdFormat8BitYUV, 0)))
+		if(FAILED(input_->EnableVideoInput(display_mode, pixel_format_, 0)))
 			CASPAR_THROW_EXCEPTION(caspar_exception()
 									<< msg_info(print() + L" Could not enable video input.")
 									<< boost::errinfo_api_function("EnableVideoInput"));
@@ -232,11 +294,28 @@ public:
 
 			auto video_frame = ffmpeg::create_frame();
 
-			video_frame->data[0]			= reinterpret_cast<uint8_t*>(video_bytes);
-			video_frame->linesize[0]		= video->GetRowBytes();
-			video_frame->format				= AVPixelFormat::AV_PIX_FMT_UYVY422;
-			video_frame->width				= video->GetWidth();
-			video_frame->height				= video->GetHeight();
+			if (v210_decoder_)
+			{
+				AVPacket packet;
+				av_init_packet(&packet);
+				packet.data	= reinterpret_cast<uint8_t*>(video_bytes);
+				packet.size	= static_cast<int>(video->GetRowBytes() * video->GetHeight());
+
+				int got_frame = 0;
+				FF(avcodec_decode_video2(v210_decoder_.get(), video_frame.get(), &got_frame, &packet));
+
+				if (!got_frame)
+					return S_OK;
+			}
+			else
+			{
+				video_frame->data[0]		= reinterpret_cast<uint8_t*>(video_bytes);
+				video_frame->linesize[0]	= video->GetRowBytes();
+				video_frame->format			= AVPixelFormat::AV_PIX_FMT_UYVY422;
+				video_frame->width			= video->GetWidth();
+				video_frame->height			= video->GetHeight();
+			}
+
 			video_frame->interlaced_frame	= in_format_desc_.field_mode != core::field_mode::progressive;
 			video_frame->top_field_first	= in_format_desc_.field_mode == core::field_mode::upper ? 1 : 0;
 			video_frame->key_frame			= 1;
@@ -252,6 +331,10 @@ public:
 					<< core::monitor::message("/file/audio/format")			% u8(av_get_sample_fmt_name(AV_SAMPLE_FMT_S32))
 					<< core::monitor::message("/file/fps")					% in_format_desc_.fps;
 
+			// Ancillary
+
+			decode_vanc(video);
+
 			// Audio
 
 			std::shared_ptr<core::mutable_audio_buffer>	audio_buffer;
@@ -284,6 +367,7 @@ public:
 			// PUSH
 
 			muxer_.push({ audio_buffer });
+			muxer_.push(ancillary_);
 			muxer_.push(static_cast<std::shared_ptr<AVFrame>>(video_frame));
 
 			// POLL
@@ -316,6 +400,41 @@ public:
 		return S_OK;
 	}
 
+	// Collects the ancillary packets of the VANC lines into ancillary_. 8 bit samples lose the two
+	// least significant bits of every ancillary word, so only 10 bit VANC can be decoded, which is
+	// what the card delivers when capturing 10 bit YUV.
+	void decode_vanc(IDeckLinkVideoInputFrame* video)
+	{
+		IDeckLinkVideoFrameAncillary* raw_vanc = nullptr;
+		if (FAILED(video->GetAncillaryData(&raw_vanc)) || !raw_vanc)
+			return;
+
+		auto vanc = wrap_raw<com_ptr>(raw_vanc, true);
+
+		if (vanc->GetPixelFormat() != bmdFormat10BitYUV)
+		{
+			if (!vanc_format_logged_)
+				CASPAR_LOG(info) << print() << L" VANC is not captured as 10 bit YUV, ancillary data is not ingested. Use 10BIT to ingest it.";
+			vanc_format_logged_ = true;
+			return;
+		}
+
+		auto width = static_cast<uint32_t>(video->GetWidth());
+		auto words = (width + 47) / 48 * 32;// v210 rows are padded to 48 pixels
+
+		for (auto& range : vanc_lines_)
+		{
+			for (auto line = range.first; line <= range.second; ++line)
+			{
+				void* buffer = nullptr;
+				if (FAILED(vanc->GetBufferForVerticalBlankingLine(line, &buffer)) || !buffer)
+					continue;
+
+				vanc_decoder_.decodeV210(reinterpret_cast<const uint32_t*>(buffer), words, width, ancillary_);
+			}
+		}
+	}
+
 	core::draw_frame get_frame()
 	{
 		if(exception_ != nullptr)
@@ -362,6 +481,7 @@ public:
 			const core::audio_channel_layout& channel_layout,
 			int device_index,
 			const std::wstring& filter_str,
+			bool ten_bit,
 			uint32_t length)
 		: executor_(L"decklink_producer[" + boost::lexical_cast<std::wstring>(device_index) + L"]")
 		, length_(length)
@@ -371,7 +491,7 @@ public:
 		{
 			core::diagnostics::call_context::for_thread() = ctx;
 			com_initialize();
-			producer_.reset(new decklink_producer(in_format_desc, device_index, frame_factory, out_format_desc, channel_layout, filter_str));
+			producer_.reset(new decklink_producer(in_format_desc, device_index, frame_factory, out_format_desc, channel_layout, filter_str, ten_bit));
 		});
 	}
 
@@ -432,19 +552,21 @@ public:
 void describe_producer(core::help_sink& sink, const core::help_repository& repo)
 {
 	sink.short_description(L"Allows video sources to be input from BlackMagic Design cards.");
-	sink.syntax(L"DECKLINK [device:int],DEVICE [device:int] {FILTER [filter:string]} {LENGTH [length:int]} {FORMAT [format:string]} {CHANNEL_LAYOUT [channel_layout:string]}");
+	sink.syntax(L"DECKLINK [device:int],DEVICE [device:int] {FILTER [filter:string]} {LENGTH [length:int]} {FORMAT [format:string]} {CHANNEL_LAYOUT [channel_layout:string]} {10BIT}");
 	sink.para()->text(L"Allows video sources to be input from BlackMagic Design cards. Parameters:");
 	sink.definitions()
 		->item(L"device", L"The decklink device to stream the input from. See the Blackmagic control panel for the order of devices in your system.")
 		->item(L"filter", L"If specified, sets an FFmpeg video filter to use.")
 		->item(L"length", L"Optionally specify a limit on how many frames to produce.")
 		->item(L"format", L"Specifies what video format to expect on the incoming SDI/HDMI signal. If not specified the video format of the channel is assumed.")
-		->item(L"channel_layout", L"Specifies what audio channel layout to expect on the incoming SDI/HDMI signal. If not specified, stereo is assumed.");
+		->item(L"channel_layout", L"Specifies what audio channel layout to expect on the incoming SDI/HDMI signal. If not specified, stereo is assumed.")
+		->item(L"10BIT", L"Captures 10 bit YUV instead of 8 bit, which is needed to ingest ancillary data such as captions and SCTE-104 from the VANC lines, at the cost of unpacking every frame.");
 	sink.para()->text(L"Examples:");
 	sink.example(L">> PLAY 1-10 DECKLINK DEVICE 2", L"Play using decklink device 2 expecting the video signal to have the same video format as the channel.");
 	sink.example(L">> PLAY 1-10 DECKLINK DEVICE 2 FORMAT PAL FILTER yadif=1:-1", L"Play using decklink device 2 expecting the video signal to be in PAL and deinterlace it.");
 	sink.example(L">> PLAY 1-10 DECKLINK DEVICE 2 LENGTH 1000", L"Play using decklink device 2 but only produce 1000 frames.");
 	sink.example(L">> PLAY 1-10 DECKLINK DEVICE 2 CHANNEL_LAYOUT smpte", L"Play using decklink device 2 and expect smpte surround sound.");
+	sink.example(L">> PLAY 1-10 DECKLINK DEVICE 2 10BIT", L"Play using decklink device 2 and ingest the ancillary data of the VANC lines.");
 }
 
 spl::shared_ptr<core::frame_producer> create_producer(const core::frame_producer_dependencies& dependencies, const std::vector<std::wstring>& params)
@@ -458,6 +580,7 @@ spl::shared_ptr<core::frame_producer> create_producer(const core::frame_producer
 
 	auto filter_str		= get_param(L"FILTER", params);
 	auto length			= get_param(L"LENGTH", params, std::numeric_limits<uint32_t>::max());
+	auto ten_bit		= contains_param(L"10BIT", params);
 	auto in_format_desc = core::video_format_desc(get_param(L"FORMAT", params, L"INVALID"));
 
 	if(in_format_desc.format == core::video_format::invalid)
@@ -487,6 +610,7 @@ spl::shared_ptr<core::frame_producer> create_producer(const core::frame_producer
 			channel_layout,
 			device_index,
 			filter_str,
+			ten_bit,
 			length);
 
 	auto get_source_framerate	= [=] { return producer->get_out_framerate(); };
@@ -494,6 +618,7 @@ spl::shared_ptr<core::frame_producer> create_producer(const core::frame_producer
 
 	return core::create_destroy_proxy(core::create_framerate_producer(
 			producer,
+			dependencies.frame_factory,
 			get_source_framerate,
 			target_framerate,
 			dependencies.format_desc.field_mode,
@@ -19,6 +19,7 @@
 #include <common/param.h>
 #include <common/semaphore.h>
 
+#include <core/ancillary/st2038.h>
 #include <core/consumer/frame_consumer.h>
 #include <core/frame/frame.h>
 #include <core/frame/audio_channel_layout.h>
@@ -44,6 +45,7 @@
 #include <tbb/parallel_for.h>
 
 #include <atomic>
+#include <cstring>
 #include <numeric>
 
 #pragma warning(push)
@@ -166,6 +168,67 @@ std::vector<Out> from_terminated_array(const In* array, In terminator)
 	return result;
 }
 
+// Sits between the MPEG-TS muxer and the output, to add the 'VANC' registration descriptor that FFmpeg does not
+// write for the ST 2038 data stream. Without it the stream can not be told apart from other private data.
+class st2038_output
+{
+	AVIOContext*									output_;
+	std::shared_ptr<AVIOContext>					context_;
+	core::ancillary::st2038::registration_writer	writer_;
+	std::vector<std::uint8_t>						packets_;
+public:
+	explicit st2038_output(AVIOContext* output)
+		: output_(output)
+	{
+		// Room for whole packets of both 188 and 192 bytes
+		const int buffer_size = 188 * 192;
+
+		auto buffer = static_cast<unsigned char*>(av_malloc(buffer_size));
+
+		if (!buffer)
+			CASPAR_THROW_EXCEPTION(bad_alloc());
+
+		auto context = avio_alloc_context(buffer, buffer_size, 1, this, nullptr, &st2038_output::write, nullptr);
+
+		if (!context)
+		{
+			av_free(buffer);
+			CASPAR_THROW_EXCEPTION(bad_alloc());
+		}
+
+		context_.reset(
+			context,
+			[](AVIOContext* context)
+			{
+				av_freep(&context->buffer);
+				av_free(context);
+			});
+	}
+
+	~st2038_output()
+	{
+		avio_flush(context_.get());
+		avio_close(output_);
+	}
+
+	AVIOContext* context()
+	{
+		return context_.get();
+	}
+private:
+	static int write(void* opaque, std::uint8_t* buffer, int size)
+	{
+		auto self = static_cast<st2038_output*>(opaque);
+
+		self->packets_.clear();
+		self->writer_.write(buffer, static_cast<size_t>(size), self->packets_);
+
+		avio_write(self->output_, self->packets_.data(), static_cast<int>(self->packets_.size()));
+
+		return self->output_->error < 0 ? self->output_->error : size;
+	}
+};
+
 class ffmpeg_consumer
 {
 private:
@@ -181,13 +244,16 @@ private:
 	core::audio_channel_layout					in_channel_layout_			= core::audio_channel_layout::invalid();
 
 	std::shared_ptr<AVFormatContext>			oc_;
+	std::unique_ptr<st2038_output>				st2038_output_;
 	std::atomic<bool>							abort_request_;
 
 	std::shared_ptr<AVStream>					video_st_;
 	std::vector<std::shared_ptr<AVStream>>		audio_sts_;
+	std::shared_ptr<AVStream>					data_st_;
 
 	std::int64_t								video_pts_					= 0;
 	std::int64_t								audio_pts_					= 0;
+	std::int64_t								data_pts_					= 0;
 
 	std::unique_ptr<audio_filter>				audio_filter_;
 
@@ -261,6 +327,7 @@ public:
 				audio_filter_.reset();
 				video_st_.reset();
 				audio_sts_.clear();
+				data_st_.reset();
 
 				write_packet(nullptr, nullptr);
 
@@ -269,7 +336,9 @@ public:
 
 				FF(av_write_trailer(oc_.get()));
 
-				if (!(oc_->oformat->flags & AVFMT_NOFILE) && oc_->pb)
+				if (st2038_output_)
+					st2038_output_.reset();
+				else if (!(oc_->oformat->flags & AVFMT_NOFILE) && oc_->pb)
 					avio_close(oc_->pb);
 
 				oc_.reset();
@@ -376,6 +445,13 @@ public:
 								: "with id " + boost::lexical_cast<std::string>(
 										oc_->oformat->audio_codec))));
 
+			// ST 2038 ancillary data is written to MPEG-TS by default, other muxers may not accept data streams
+
+			const auto st2038 =
+				try_remove_arg<bool>(
+					options_,
+					boost::regex("^st2038$")).get_value_or(std::string(oc_->oformat->name) == "mpegts");
+
 			// Filters
 
 			{
@@ -416,6 +492,9 @@ public:
 					else
 						++it;
 				}
+
+				if (st2038)
+					data_st_ = open_data_stream();
 			}
 
 			// Output
@@ -439,6 +518,12 @@ public:
 						AVIO_FLAG_WRITE,
 						&oc_->interrupt_callback,
 						&av_opts));
+
+					if (data_st_ && std::string(oc_->oformat->name) == "mpegts")
+					{
+						st2038_output_.reset(new st2038_output(oc_->pb));
+						oc_->pb = st2038_output_->context();
+					}
 				}
 
 				FF(avformat_write_header(
@@ -469,6 +554,8 @@ public:
 		{
 			video_st_.reset();
 			audio_sts_.clear();
+			data_st_.reset();
+			st2038_output_.reset();
 			oc_.reset();
 			throw;
 		}
@@ -495,6 +582,9 @@ public:
 			});
 		tokens_.acquire();
 
+		if (data_st_)
+			write_ancillary(frame, token);
+
 		video_encoder_executor_.begin_invoke([=]() mutable
 		{
 			encode_video(
@@ -649,6 +739,63 @@ private:
 		});
 	}
 
+	std::shared_ptr<AVStream> open_data_stream()
+	{
+		auto st =
+			avformat_new_stream(
+				oc_.get(),
+				nullptr);
+
+		if (!st)
+			CASPAR_THROW_EXCEPTION(caspar_exception() << msg_info("Could not allocate data-stream.") << boost::errinfo_api_function("avformat_new_stream"));
+
+		st->codec->codec_type	= AVMEDIA_TYPE_DATA;
+		st->codec->codec_id		= AV_CODEC_ID_BIN_DATA;
+		st->time_base			= { in_video_format_.duration, in_video_format_.time_scale };
+
+		// Muxers with a tag table would reject the tag, for MPEG-TS st2038_output writes it as the registration descriptor
+		if (!oc_->oformat->codec_tag)
+			st->codec->codec_tag = MKTAG('V', 'A', 'N', 'C');
+
+		return std::shared_ptr<AVStream>(st, [](AVStream*) { });
+	}
+
+	// One ST 2038 PES per frame, with the PTS of the frame, so the producer can reattach the packets.
+	void write_ancillary(const core::const_frame& frame, std::shared_ptr<void> token)
+	{
+		std::vector<std::uint8_t> payload;
+
+		core::ancillary::st2038::write(
+			frame.ancillary(),
+			in_video_format_.width,
+			payload);
+
+		std::shared_ptr<AVPacket> pkt(
+			new AVPacket(),
+			[](AVPacket* p)
+			{
+				av_free_packet(p);
+				delete p;
+			});
+
+		FF(av_new_packet(
+			pkt.get(),
+			static_cast<int>(payload.size())));
+
+		std::memcpy(pkt->data, payload.data(), payload.size());
+
+		const AVRational frame_time_base = { in_video_format_.duration, in_video_format_.time_scale };
+
+		pkt->stream_index	= data_st_->index;
+		pkt->pts			= av_rescale_q(data_pts_, frame_time_base, data_st_->time_base);
+		pkt->dts			= pkt->pts;
+		pkt->duration		= static_cast<int>(av_rescale_q(1, frame_time_base, data_st_->time_base));
+
+		data_pts_ += 1;
+
+		write_packet(pkt, token);
+	}
+
 	void configure_video_filters(
 			const AVCodec& codec,
 			std::string filtergraph,
@@ -1299,6 +1446,8 @@ void describe_ffmpeg_consumer(core::help_sink& sink, const core::help_repository
 		->item(L"ffmpeg_paramX",		L"A parameter supported by FFmpeg. For example vcodec or acodec etc.")
 		->item(L"separate_key",		L"If defined will create two files simultaneously -- One for fill and one for key (_A will be appended).")
 		->item(L"mono_streams",		L"If defined every audio channel will be written to its own audio stream.");
+	sink.para()->text(L"Ancillary data such as SCTE-104 and captions is recorded as a SMPTE ST 2038 data stream in MPEG-TS. ")
+		->text(L"Use -st2038 0 to leave it out, or -st2038 1 to try it with other container formats.");
 	sink.para()->text(L"Examples:");
 	sink.example(L">> ADD 1 FILE output.mov -vcodec dnxhd");
 	sink.example(L">> ADD 1 FILE output.mov -vcodec prores");
@@ -25,6 +25,7 @@
 
 #include "consumer/ffmpeg_consumer.h"
 #include "producer/ffmpeg_producer.h"
+#include "producer/cache/clip_cache.h"
 #include "producer/util/util.h"
 
 #include <common/log.h>
@@ -36,10 +37,19 @@
 #include <core/producer/media_info/media_info.h>
 #include <core/producer/media_info/media_info_repository.h>
 #include <core/system_info_provider.h>
+#include <core/video_channel.h>
+#include <core/help/help_sink.h>
+#include <core/help/help_repository.h>
+
+#include <protocol/amcp/AMCPCommand.h>
+#include <protocol/amcp/amcp_command_repository.h>
 
 #include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/xml_parser.hpp>
 #include <boost/bind.hpp>
 
+#include <sstream>
+
 #include <mutex>
 
 #if defined(_MSC_VER)
@@ -232,6 +242,70 @@ void log_for_thread(void* ptr, int level, const char* fmt, va_list vl)
 	log_callback(ptr, std::max(level, min_level), fmt, vl);
 }
 
+void preload_describer(core::help_sink& sink, const core::help_repository& repo)
+{
+	sink.short_description(L"Decode a clip into the clip cache.");
+	sink.syntax(L"PRELOAD [video_channel:int] [clip:string] {FILTER [filter:string]} {CHANNEL_LAYOUT [channel_layout:string]}");
+	sink.para()
+		->text(L"Decodes ")->code(L"clip")->text(L" completely, in the video format of ")->code(L"video_channel")
+		->text(L", and keeps the frames in memory. Later ")->code(L"LOAD")->text(L", ")->code(L"LOADBG")->text(L" and ")
+		->code(L"PLAY")->text(L" of the same clip, with the same ")->code(L"FILTER")->text(L" and ")->code(L"CHANNEL_LAYOUT")
+		->text(L", on any channel with the same video format are served from memory without demuxing or decoding.");
+	sink.para()
+		->text(L"The cache size is limited by ")->code(L"configuration/ffmpeg/clip-cache-size")
+		->text(L" (MiB). The least recently played clips are evicted first.");
+	sink.para()->text(L"Examples:");
+	sink.example(L">> PRELOAD 1 STINGERS/WIPE");
+}
+
+std::wstring preload_command(protocol::amcp::command_context& ctx)
+{
+	auto channel = ctx.channel.channel;
+
+	preload_clip(core::frame_producer_dependencies(
+			channel->frame_factory(),
+			{ },
+			channel->video_format_desc(),
+			ctx.producer_registry,
+			ctx.cg_registry), ctx.parameters);
+
+	return L"202 PRELOAD OK\r\n";
+}
+
+void preload_clear_describer(core::help_sink& sink, const core::help_repository& repo)
+{
+	sink.short_description(L"Empty the clip cache.");
+	sink.syntax(L"PRELOAD CLEAR");
+	sink.para()->text(L"Removes all clips from the clip cache. Clips currently playing from the cache are not affected.");
+}
+
+std::wstring preload_clear_command(protocol::amcp::command_context& ctx)
+{
+	clip_cache::instance().clear();
+
+	return L"202 PRELOAD CLEAR OK\r\n";
+}
+
+void preload_info_describer(core::help_sink& sink, const core::help_repository& repo)
+{
+	sink.short_description(L"Get information about the clip cache.");
+	sink.syntax(L"PRELOAD INFO");
+	sink.para()->text(L"Returns the cache budget, its current size, hit, miss and eviction counts and the cached clips.");
+}
+
+std::wstring preload_info_command(protocol::amcp::command_context& ctx)
+{
+	boost::property_tree::wptree info;
+	info.add_child(L"clip-cache", clip_cache::instance().info());
+
+	std::wstringstream reply;
+	reply << L"201 PRELOAD INFO OK\r\n";
+	boost::property_tree::xml_parser::write_xml(reply, info, boost::property_tree::xml_writer_settings<std::wstring>(' ', 3));
+	reply << L"\r\n";
+
+	return reply.str();
+}
+
 void init(core::module_dependencies dependencies)
 {
 	av_lockmgr_register(ffmpeg_lock_callback);
@@ -275,7 +349,15 @@ void init(core::module_dependencies dependencies)
 		info.add(L"system.ffmpeg.avfilter", avfilter_version());
 		info.add(L"system.ffmpeg.avutil", avutil_version());
 		info.add(L"system.ffmpeg.swscale", swscale_version());
+		info.add_child(L"system.ffmpeg.clip-cache", clip_cache::instance().info());
 	});
+
+	if (dependencies.command_repository)
+	{
+		dependencies.command_repository->register_channel_command(L"Basic Commands", L"PRELOAD", preload_describer, preload_command, 1);
+		dependencies.command_repository->register_command(L"Basic Commands", L"PRELOAD CLEAR", preload_clear_describer, preload_clear_command, 0);
+		dependencies.command_repository->register_command(L"Query Commands", L"PRELOAD INFO", preload_info_describer, preload_info_command, 0);
+	}
 }
 
 void uninit()
@@ -0,0 +1,310 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "../../StdAfx.h"
+
+#include "cached_clip_producer.h"
+#include "clip_cache.h"
+
+#include <common/env.h>
+#include <common/future.h>
+
+#include <core/frame/draw_frame.h>
+#include <core/monitor/monitor.h>
+#include <core/producer/frame_producer.h>
+#include <core/scte/scte.h>
+#include <core/video_format.h>
+#include <core/ancillary/ancillary.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <algorithm>
+#include <limits>
+
+namespace caspar { namespace ffmpeg {
+
+/**
+ * Plays a clip from the clip cache. No demuxing or decoding takes place, so a
+ * frame is always available when the channel asks for it.
+ */
+class cached_clip_producer : public core::frame_producer_base
+{
+	spl::shared_ptr<core::monitor::subject>	monitor_subject_;
+	const std::shared_ptr<const cached_clip>	clip_;
+	core::constraints							constraints_;
+
+	bool										loop_;
+	uint32_t									in_;
+	uint32_t									out_;
+	std::size_t									position_;
+	int64_t										frame_number_		= 0;
+	uint32_t									file_frame_number_	= 0;
+	core::draw_frame							last_frame_			= core::draw_frame::empty();
+
+	const core::video_format_desc				format_desc_;
+	const std::function<int64_t ()>			channel_frame_number_;
+	int64_t										scte_104_ticks_		= 0;
+	std::unique_ptr<core::scte_104>				scte_104_;
+public:
+	cached_clip_producer(
+			const std::shared_ptr<const cached_clip>& clip,
+			bool loop,
+			uint32_t in,
+			uint32_t out,
+			std::unique_ptr<core::scte_104> scte_104,
+			const core::video_format_desc& format_desc,
+			std::function<int64_t ()> channel_frame_number)
+		: clip_(clip)
+		, constraints_(clip->width, clip->height)
+		, loop_(loop)
+		, in_(in)
+		, out_(out)
+		, position_(first_index())
+		, format_desc_(format_desc)
+		, channel_frame_number_(std::move(channel_frame_number))
+		, scte_104_(std::move(scte_104))
+	{
+	}
+
+	// frame_producer
+
+	core::draw_frame receive_impl() override
+	{
+		if (position_ >= last_index())
+		{
+			if (!loop_ || first_index() >= last_index())
+			{
+				send_osc();
+				return attach_scte_104(last_frame());
+			}
+
+			position_ = first_index();
+		}
+
+		auto frame = clip_->frames.at(position_++);
+
+		++frame_number_;
+		file_frame_number_	= frame.second;
+		last_frame_			= frame.first;
+
+		send_osc();
+
+		return attach_scte_104(std::move(frame.first));
+	}
+
+	// Counts channel frames like ffmpeg_producer, so a paused clip does not hold up the pre-roll.
+	core::draw_frame attach_scte_104(core::draw_frame frame)
+	{
+		auto channel_frame = channel_frame_number_ ? channel_frame_number_() : scte_104_ticks_;
+		++scte_104_ticks_;
+
+		if (scte_104_)
+		{
+			auto data = scte_104_->tick(channel_frame, format_desc_);
+
+			if (data)
+				frame.ancillary().addData(std::move(data));
+		}
+
+		return frame;
+	}
+
+	core::draw_frame last_frame() override
+	{
+		if (last_frame_ == core::draw_frame::empty())
+			return last_frame_;
+
+		return core::draw_frame::still(last_frame_);
+	}
+
+	core::constraints& pixel_constraints() override
+	{
+		return constraints_;
+	}
+
+	uint32_t nb_frames() const override
+	{
+		if (loop_)
+			return std::numeric_limits<uint32_t>::max();
+
+		auto first	= first_index();
+		auto last	= last_index();
+
+		return static_cast<uint32_t>(last > first ? last - first : 0);
+	}
+
+	std::future<std::wstring> call(const std::vector<std::wstring>& params) override
+	{
+		std::wstring result;
+
+		std::wstring cmd = params.at(0);
+		std::wstring value;
+		if (params.size() > 1)
+			value = params.at(1);
+
+		if (boost::iequals(cmd, L"loop"))
+		{
+			if (!value.empty())
+				loop_ = boost::lexical_cast<bool>(value);
+			result = boost::lexical_cast<std::wstring>(loop_);
+		}
+		else if (boost::iequals(cmd, L"in") || boost::iequals(cmd, L"start"))
+		{
+			if (!value.empty())
+				in_ = boost::lexical_cast<uint32_t>(value);
+			result = boost::lexical_cast<std::wstring>(in_);
+		}
+		else if (boost::iequals(cmd, L"out"))
+		{
+			if (!value.empty())
+				out_ = boost::lexical_cast<uint32_t>(value);
+			result = boost::lexical_cast<std::wstring>(out_);
+		}
+		else if (boost::iequals(cmd, L"length"))
+		{
+			if (!value.empty())
+				out_ = in_ + boost::lexical_cast<uint32_t>(value);
+			result = boost::lexical_cast<std::wstring>(out_ - in_);
+		}
+		else if (boost::iequals(cmd, L"seek") && !value.empty())
+		{
+			int64_t seek;
+			if (boost::iequals(value, L"rel"))
+				seek = file_frame_number_;
+			else if (boost::iequals(value, L"in"))
+				seek = in_;
+			else if (boost::iequals(value, L"out"))
+				seek = out_;
+			else if (boost::iequals(value, L"end"))
+				seek = clip_->file_nb_frames;
+			else
+				seek = boost::lexical_cast<int64_t>(value);
+
+			if (params.size() > 2)
+				seek += boost::lexical_cast<int64_t>(params.at(2));
+
+			seek		= std::max<int64_t>(0, std::min<int64_t>(seek, clip_->file_nb_frames > 0 ? clip_->file_nb_frames - 1 : 0));
+			position_	= index_of(static_cast<uint32_t>(seek));
+		}
+		else if (boost::iequals(cmd, L"scte"))
+		{
+			if (value.empty())
+				scte_104_.reset();
+			else if (!scte_104_)
+				scte_104_.reset(new core::scte_104(value));
+			else
+				scte_104_->update(value);
+		}
+		else
+			CASPAR_THROW_EXCEPTION(invalid_argument());
+
+		return make_ready_future(std::move(result));
+	}
+
+	std::wstring print() const override
+	{
+		return L"ffmpeg[" + boost::filesystem::path(clip_->filename).filename().wstring() + L"|cached|"
+						  + boost::lexical_cast<std::wstring>(file_frame_number_) + L"/" + boost::lexical_cast<std::wstring>(clip_->file_nb_frames) + L"]";
+	}
+
+	std::wstring name() const override
+	{
+		return L"ffmpeg";
+	}
+
+	boost::property_tree::wptree info() const override
+	{
+		boost::property_tree::wptree info;
+		info.add(L"type",				L"ffmpeg-producer");
+		info.add(L"filename",			clip_->filename);
+		info.add(L"cached",				true);
+		info.add(L"width",				clip_->width);
+		info.add(L"height",				clip_->height);
+		info.add(L"fps",				fps());
+		info.add(L"loop",				loop_);
+		info.add(L"frame-number",		frame_number_);
+		auto nb_frames2 = nb_frames();
+		info.add(L"nb-frames",			nb_frames2 == std::numeric_limits<uint32_t>::max() ? -1 : static_cast<int64_t>(nb_frames2));
+		info.add(L"file-frame-number",	file_frame_number_);
+		info.add(L"file-nb-frames",		clip_->file_nb_frames);
+		return info;
+	}
+
+	core::monitor::subject& monitor_output() override
+	{
+		return *monitor_subject_;
+	}
+
+	// cached_clip_producer
+
+	double fps() const
+	{
+		return static_cast<double>(clip_->framerate.numerator()) / static_cast<double>(clip_->framerate.denominator());
+	}
+
+	// Frames are addressed by the file frame number they were decoded at, so
+	// IN, OUT and SEEK mean the same thing as for an uncached clip.
+	std::size_t index_of(uint32_t file_frame_number) const
+	{
+		auto it = std::find_if(clip_->frames.begin(), clip_->frames.end(), [&](const std::pair<core::draw_frame, uint32_t>& frame)
+		{
+			return frame.second > file_frame_number;
+		});
+
+		return static_cast<std::size_t>(it - clip_->frames.begin());
+	}
+
+	std::size_t first_index() const
+	{
+		return index_of(in_);
+	}
+
+	std::size_t last_index() const
+	{
+		return out_ == std::numeric_limits<uint32_t>::max() ? clip_->frames.size() : index_of(out_);
+	}
+
+	void send_osc()
+	{
+		*monitor_subject_	<< core::monitor::message("/file/time")		% (file_frame_number_ / fps())
+																		% (clip_->file_nb_frames / fps())
+							<< core::monitor::message("/file/frame")		% static_cast<int32_t>(file_frame_number_)
+																		% static_cast<int32_t>(clip_->file_nb_frames)
+							<< core::monitor::message("/file/fps")		% fps()
+							<< core::monitor::message("/file/path")		% boost::filesystem::path(clip_->filename).filename().wstring()
+							<< core::monitor::message("/loop")			% loop_;
+	}
+};
+
+spl::shared_ptr<core::frame_producer> create_cached_clip_producer(
+		const std::shared_ptr<const cached_clip>& clip,
+		bool loop,
+		uint32_t in,
+		uint32_t out,
+		std::unique_ptr<core::scte_104> scte_104,
+		const core::video_format_desc& format_desc,
+		std::function<int64_t ()> channel_frame_number)
+{
+	return spl::make_shared<cached_clip_producer>(clip, loop, in, out, std::move(scte_104), format_desc, std::move(channel_frame_number));
+}
+
+}}
@@ -0,0 +1,51 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <common/memory.h>
+
+#include <core/fwd.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace caspar {
+
+namespace core {
+
+class scte_104;
+
+}
+
+namespace ffmpeg {
+
+struct cached_clip;
+
+spl::shared_ptr<core::frame_producer> create_cached_clip_producer(
+		const std::shared_ptr<const cached_clip>& clip,
+		bool loop,
+		uint32_t in,
+		uint32_t out,
+		std::unique_ptr<core::scte_104> scte_104,
+		const core::video_format_desc& format_desc,
+		std::function<int64_t ()> channel_frame_number);
+
+}}
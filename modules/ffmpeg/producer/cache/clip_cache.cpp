@@ -0,0 +1,175 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "../../StdAfx.h"
+
+#include "clip_cache.h"
+
+#include <common/env.h>
+#include <common/log.h>
+
+#include <core/video_format.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <list>
+#include <map>
+#include <mutex>
+
+namespace caspar { namespace ffmpeg {
+
+struct clip_cache::impl
+{
+	struct entry
+	{
+		std::wstring						key;
+		std::shared_ptr<const cached_clip>	clip;
+		int64_t								hits = 0;
+	};
+
+	mutable std::mutex										mutex_;
+	std::list<entry>										entries_;	// Most recently used first.
+	std::map<std::wstring, std::list<entry>::iterator>		index_;
+	std::size_t												size_bytes_	= 0;
+	const std::size_t										budget_;
+
+	int64_t													hits_		= 0;
+	int64_t													misses_		= 0;
+	int64_t													evictions_	= 0;
+
+	impl()
+		: budget_(env::properties().get(L"configuration.ffmpeg.clip-cache-size", 2048u) * 1024ull * 1024ull)
+	{
+	}
+
+	std::shared_ptr<const cached_clip> find(const std::wstring& key)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		auto it = index_.find(key);
+
+		if (it == index_.end())
+		{
+			++misses_;
+			return nullptr;
+		}
+
+		++hits_;
+		++it->second->hits;
+		entries_.splice(entries_.begin(), entries_, it->second);
+
+		return it->second->clip;
+	}
+
+	bool contains(const std::wstring& key) const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		return index_.find(key) != index_.end();
+	}
+
+	void insert(const std::wstring& key, std::shared_ptr<const cached_clip> clip)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		auto it = index_.find(key);
+
+		if (it != index_.end())
+			erase(it->second);
+
+		// Clips still playing keep their frames alive until they are
+		// destroyed, the budget only bounds what the cache itself retains.
+		while (!entries_.empty() && size_bytes_ + clip->size_bytes > budget_)
+		{
+			CASPAR_LOG(info) << L"[clip_cache] Evicting " << entries_.back().clip->filename << L" (" << entries_.back().clip->format_name << L")";
+			erase(std::prev(entries_.end()));
+			++evictions_;
+		}
+
+		size_bytes_ += clip->size_bytes;
+		entries_.push_front(entry { key, std::move(clip) });
+		index_[key] = entries_.begin();
+	}
+
+	void erase(std::list<entry>::iterator it)
+	{
+		size_bytes_ -= it->clip->size_bytes;
+		index_.erase(it->key);
+		entries_.erase(it);
+	}
+
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		entries_.clear();
+		index_.clear();
+		size_bytes_ = 0;
+	}
+
+	boost::property_tree::wptree info() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		boost::property_tree::wptree info;
+		info.add(L"budget-bytes",	budget_);
+		info.add(L"size-bytes",		size_bytes_);
+		info.add(L"hits",			hits_);
+		info.add(L"misses",			misses_);
+		info.add(L"evictions",		evictions_);
+
+		for (auto& entry : entries_)
+		{
+			boost::property_tree::wptree clip_info;
+			clip_info.add(L"filename",		entry.clip->filename);
+			clip_info.add(L"video-mode",	entry.clip->format_name);
+			clip_info.add(L"frames",		entry.clip->frames.size());
+			clip_info.add(L"size-bytes",	entry.clip->size_bytes);
+			clip_info.add(L"hits",			entry.hits);
+			info.add_child(L"clips.clip",	clip_info);
+		}
+
+		return info;
+	}
+};
+
+clip_cache::clip_cache() : impl_(new impl()) {}
+clip_cache& clip_cache::instance()
+{
+	static clip_cache cache;
+	return cache;
+}
+std::shared_ptr<const cached_clip> clip_cache::find(const std::wstring& key) { return impl_->find(key); }
+bool clip_cache::contains(const std::wstring& key) const { return impl_->contains(key); }
+void clip_cache::insert(const std::wstring& key, std::shared_ptr<const cached_clip> clip) { impl_->insert(key, std::move(clip)); }
+void clip_cache::clear() { impl_->clear(); }
+std::size_t clip_cache::budget() const { return impl_->budget_; }
+boost::property_tree::wptree clip_cache::info() const { return impl_->info(); }
+
+std::wstring clip_cache_key(
+		const std::wstring& filename,
+		const core::video_format_desc& format_desc,
+		const std::wstring& filter,
+		const std::wstring& channel_layout)
+{
+	return filename + L"|" + format_desc.name + L"|" + boost::to_upper_copy(filter) + L"|" + boost::to_upper_copy(channel_layout);
+}
+
+}}
@@ -0,0 +1,86 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <common/memory.h>
+
+#include <core/fwd.h>
+#include <core/frame/draw_frame.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/property_tree/ptree_fwd.hpp>
+#include <boost/rational.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace caspar { namespace ffmpeg {
+
+/**
+ * A clip fully decoded for one video format. The frames are the output of the
+ * frame muxer, paired with the file frame number they were decoded at.
+ */
+struct cached_clip
+{
+	std::wstring										filename;
+	std::wstring										format_name;
+	std::vector<std::pair<core::draw_frame, uint32_t>>	frames;
+	boost::rational<int>								framerate;
+	int													width			= 0;
+	int													height			= 0;
+	uint32_t											file_nb_frames	= 0;
+	std::size_t											size_bytes		= 0;
+};
+
+/**
+ * Process wide cache of preloaded clips, shared by the ffmpeg producers of
+ * all channels. Entries are evicted least recently used first when the
+ * configured byte budget (configuration/ffmpeg/clip-cache-size, in MiB) is
+ * exceeded.
+ */
+class clip_cache : boost::noncopyable
+{
+public:
+	static clip_cache& instance();
+
+	std::shared_ptr<const cached_clip>	find(const std::wstring& key);
+	bool								contains(const std::wstring& key) const;
+	void								insert(const std::wstring& key, std::shared_ptr<const cached_clip> clip);
+	void								clear();
+
+	std::size_t							budget() const;
+	boost::property_tree::wptree		info() const;
+private:
+	clip_cache();
+
+	struct impl;
+	spl::unique_ptr<impl> impl_;
+};
+
+std::wstring clip_cache_key(
+		const std::wstring& filename,
+		const core::video_format_desc& format_desc,
+		const std::wstring& filter,
+		const std::wstring& channel_layout);
+
+}}
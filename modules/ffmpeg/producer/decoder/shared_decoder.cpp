@@ -0,0 +1,413 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "../../StdAfx.h"
+
+#include "shared_decoder.h"
+
+#include "../input/input.h"
+#include "../video/video_decoder.h"
+#include "../audio/audio_decoder.h"
+#include "../scte35/scte35_decoder.h"
+#include "../st2038/st2038_decoder.h"
+#include "../util/fan_out.h"
+#include "../util/shared_registry.h"
+#include "../../ffmpeg_error.h"
+#include "../../ffmpeg.h"
+
+#include <common/diagnostics/graph.h>
+#include <common/except.h>
+#include <common/log.h>
+#include <common/utf.h>
+
+#include <tbb/parallel_invoke.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <mutex>
+
+#if defined(_MSC_VER)
+#pragma warning (push)
+#pragma warning (disable : 4244)
+#endif
+extern "C"
+{
+	#define __STDC_CONSTANT_MACROS
+	#define __STDC_LIMIT_MACROS
+	#include <libavformat/avformat.h>
+	#include <libavutil/frame.h>
+}
+#if defined(_MSC_VER)
+#pragma warning (pop)
+#endif
+
+namespace caspar { namespace ffmpeg {
+
+struct shared_decoder::impl : boost::noncopyable
+{
+	struct video_entry
+	{
+		std::shared_ptr<AVFrame>	frame;
+		uint32_t					file_frame_number;
+		ancillary_data				ancillary;
+	};
+
+	const std::wstring								filename_;
+	const bool										thumbnail_mode_;
+	ffmpeg::input									input_;
+	std::unique_ptr<video_decoder>					video_decoder_;
+	std::vector<std::unique_ptr<audio_decoder>>		audio_decoders_;
+	std::unique_ptr<scte35_decoder>					scte35_decoder_;
+	std::unique_ptr<st2038_decoder>					st2038_decoder_;
+
+	mutable std::mutex								mutex_;
+	int												next_subscriber_	= 0;
+	fan_out<video_entry>							video_				{ [](const video_entry& entry) { return share(entry); } };
+	fan_out<audio_buffers>							audio_;
+
+	impl(
+			const spl::shared_ptr<diagnostics::graph>& graph,
+			const std::wstring& url_or_file,
+			bool loop,
+			uint32_t in,
+			uint32_t out,
+			bool thumbnail_mode,
+			const ffmpeg_options& vid_params,
+			int audio_sample_rate)
+		: filename_(url_or_file)
+		, thumbnail_mode_(thumbnail_mode)
+		, input_(graph, url_or_file, loop, in, out, thumbnail_mode, vid_params)
+	{
+		try
+		{
+			video_decoder_.reset(new video_decoder(input_.context()));
+		}
+		catch (averror_stream_not_found&)
+		{
+			//CASPAR_LOG(warning) << print() << " No video-stream found. Running without video.";
+		}
+		catch (...)
+		{
+			if (!thumbnail_mode_)
+			{
+				CASPAR_LOG_CURRENT_EXCEPTION();
+				CASPAR_LOG(warning) << print() << "Failed to open video-stream. Running without video.";
+			}
+		}
+
+		if (thumbnail_mode_)
+			return;
+
+		if (video_decoder_ && scte35_decoder::has_streams(*input_.context()))
+			scte35_decoder_.reset(new scte35_decoder(input_.context(), video_decoder_->stream_index()));
+
+		if (video_decoder_ && st2038_decoder::has_streams(*input_.context()))
+			st2038_decoder_.reset(new st2038_decoder(input_.context(), video_decoder_->stream_index()));
+
+		for (unsigned stream_index = 0; stream_index < input_.context()->nb_streams; ++stream_index)
+		{
+			auto stream = input_.context()->streams[stream_index];
+
+			if (stream->codec->codec_type != AVMediaType::AVMEDIA_TYPE_AUDIO)
+				continue;
+
+			try
+			{
+				audio_decoders_.push_back(std::unique_ptr<audio_decoder>(new audio_decoder(stream_index, input_.context(), audio_sample_rate)));
+			}
+			catch (averror_stream_not_found&)
+			{
+				//CASPAR_LOG(warning) << print() << " No audio-stream found. Running without audio.";
+			}
+			catch (...)
+			{
+				CASPAR_LOG_CURRENT_EXCEPTION();
+				CASPAR_LOG(warning) << print() << " Failed to open audio-stream. Running without audio.";
+			}
+		}
+	}
+
+	int subscribe()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		if (!video_.open())
+			CASPAR_THROW_EXCEPTION(invalid_operation() << msg_info(print() + L" Closed for subscribers."));
+
+		video_.subscribe(next_subscriber_);
+		audio_.subscribe(next_subscriber_);
+
+		return next_subscriber_++;
+	}
+
+	void unsubscribe(int subscriber)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		video_.unsubscribe(subscriber);
+		audio_.unsubscribe(subscriber);
+	}
+
+	int num_subscribers() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		return video_.num_subscribers();
+	}
+
+	void close_for_subscribers()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		close();
+	}
+
+	void close()
+	{
+		video_.close();
+		audio_.close();
+	}
+
+	bool open_for_subscribers() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		return video_.open();
+	}
+
+	void poll(int subscriber, bool want_video, bool want_audio, std::shared_ptr<AVFrame>& video, uint32_t& file_frame_number, ancillary_data& ancillary, audio_buffers& audio)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		if (is_overflowed(subscriber))
+			return;
+
+		bool need_video = want_video && video_.empty(subscriber) && video_decoder_;
+		bool need_audio = want_audio && audio_.empty(subscriber);
+
+		if (need_video || need_audio)
+			decode(need_video, need_audio);
+
+		video_entry entry;
+
+		if (want_video && video_.pop(subscriber, entry))
+		{
+			video				= std::move(entry.frame);
+			file_frame_number	= entry.file_frame_number;
+			ancillary			= std::move(entry.ancillary);
+		}
+
+		if (want_audio)
+			audio_.pop(subscriber, audio);
+	}
+
+	bool overflowed(int subscriber) const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		return is_overflowed(subscriber);
+	}
+
+	bool is_overflowed(int subscriber) const
+	{
+		return video_.overflowed(subscriber) || audio_.overflowed(subscriber);
+	}
+
+	bool eof(int subscriber) const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		return input_.eof() && input_.buffer_empty() && video_.empty(subscriber) && audio_.empty(subscriber);
+	}
+
+	bool all_audio_decoders_ready() const
+	{
+		for (auto& audio_decoder : audio_decoders_)
+			if (!audio_decoder->ready())
+				return false;
+
+		return true;
+	}
+
+	void decode(bool want_video, bool want_audio)
+	{
+		std::shared_ptr<AVPacket> pkt;
+
+		for (int n = 0; n < 32 && ((video_decoder_ && !video_decoder_->ready()) || !all_audio_decoders_ready()) && input_.try_pop(pkt); ++n)
+		{
+			if (video_decoder_)
+				video_decoder_->push(pkt);
+
+			for (auto& audio_decoder : audio_decoders_)
+				audio_decoder->push(pkt);
+
+			if (scte35_decoder_)
+				scte35_decoder_->push(pkt);
+
+			if (st2038_decoder_)
+				st2038_decoder_->push(pkt);
+		}
+
+		std::shared_ptr<AVFrame>	video;
+		audio_buffers				audio;
+
+		tbb::parallel_invoke(
+		[&]
+		{
+			if (!want_video)
+				return;
+
+			do
+			{
+				video = video_decoder_->poll();
+			} while (!video && !video_decoder_->empty());
+		},
+		[&]
+		{
+			if (!want_audio)
+				return;
+
+			for (auto& audio_decoder : audio_decoders_)
+			{
+				auto audio_for_stream = audio_decoder->poll();
+
+				if (audio_for_stream)
+					audio.push_back(audio_for_stream);
+			}
+		});
+
+		if (video)
+		{
+			video_entry entry { video, video_decoder_->file_frame_number() };
+
+			if (video != flush_video() && video != empty_video())
+			{
+				if (scte35_decoder_)
+					entry.ancillary = scte35_decoder_->poll(*video);
+
+				if (st2038_decoder_)
+				{
+					auto st2038 = st2038_decoder_->poll(*video);
+					entry.ancillary.insert(entry.ancillary.end(), st2038.begin(), st2038.end());
+				}
+			}
+
+			video_.push(entry);
+		}
+
+		if (!audio.empty())
+			audio_.push(audio);
+
+		// Both replay the same stretch of the file to new subscribers.
+		if (!video_.open() || !audio_.open())
+			close();
+	}
+
+	// The filters of the frame muxer take ownership of the frame data, so each
+	// subscriber gets its own reference to the decoded frame.
+	static video_entry share(const video_entry& entry)
+	{
+		return video_entry { share(entry.frame), entry.file_frame_number, entry.ancillary };
+	}
+
+	static std::shared_ptr<AVFrame> share(const std::shared_ptr<AVFrame>& frame)
+	{
+		if (!frame || frame == flush_video() || frame == empty_video())
+			return frame;
+
+		auto clone = av_frame_clone(frame.get());
+
+		if (!clone)
+			CASPAR_THROW_EXCEPTION(caspar_exception() << msg_info("av_frame_clone failed"));
+
+		return std::shared_ptr<AVFrame>(clone, [frame](AVFrame* p)
+		{
+			av_frame_free(&p);
+		});
+	}
+
+	std::wstring print() const
+	{
+		return L"shared_decoder[" + filename_ + L"]";
+	}
+};
+
+shared_decoder::shared_decoder(
+		const spl::shared_ptr<diagnostics::graph>& graph,
+		const std::wstring& url_or_file,
+		bool loop,
+		uint32_t in,
+		uint32_t out,
+		bool thumbnail_mode,
+		const ffmpeg_options& vid_params,
+		int audio_sample_rate)
+	: impl_(new impl(graph, url_or_file, loop, in, out, thumbnail_mode, vid_params, audio_sample_rate))
+{
+}
+shared_decoder::~shared_decoder() {}
+int shared_decoder::subscribe() { return impl_->subscribe(); }
+void shared_decoder::unsubscribe(int subscriber) { impl_->unsubscribe(subscriber); }
+int shared_decoder::num_subscribers() const { return impl_->num_subscribers(); }
+void shared_decoder::close_for_subscribers() { impl_->close_for_subscribers(); }
+bool shared_decoder::open_for_subscribers() const { return impl_->open_for_subscribers(); }
+void shared_decoder::poll(int subscriber, bool want_video, bool want_audio, std::shared_ptr<AVFrame>& video, uint32_t& file_frame_number, ancillary_data& ancillary, audio_buffers& audio) { impl_->poll(subscriber, want_video, want_audio, video, file_frame_number, ancillary, audio); }
+bool shared_decoder::overflowed(int subscriber) const { return impl_->overflowed(subscriber); }
+bool shared_decoder::eof(int subscriber) const { return impl_->eof(subscriber); }
+ffmpeg::input& shared_decoder::input() { return impl_->input_; }
+const ffmpeg::input& shared_decoder::input() const { return impl_->input_; }
+video_decoder* shared_decoder::video() const { return impl_->video_decoder_.get(); }
+const std::vector<std::unique_ptr<audio_decoder>>& shared_decoder::audio() const { return impl_->audio_decoders_; }
+std::wstring shared_decoder::print() const { return impl_->print(); }
+
+std::shared_ptr<shared_decoder> open_shared_decoder(
+		const spl::shared_ptr<diagnostics::graph>& graph,
+		const std::wstring& url_or_file,
+		bool loop,
+		uint32_t in,
+		uint32_t out,
+		const ffmpeg_options& vid_params,
+		int audio_sample_rate,
+		int& subscriber)
+{
+	static shared_registry<shared_decoder> decoders;
+
+	auto key = url_or_file
+			+ L"|" + boost::lexical_cast<std::wstring>(loop)
+			+ L"|" + boost::lexical_cast<std::wstring>(in)
+			+ L"|" + boost::lexical_cast<std::wstring>(out)
+			+ L"|" + boost::lexical_cast<std::wstring>(audio_sample_rate);
+
+	for (auto& option : vid_params)
+		key += L"|" + u16(option.first) + L"=" + u16(option.second);
+
+	return decoders.join_or_create(key, [&](shared_decoder& decoder)
+	{
+		subscriber = decoder.subscribe();
+		CASPAR_LOG(info) << decoder.print() << L" Shared with " << decoder.num_subscribers() << L" subscribers.";
+		return true;
+	},
+	[&]
+	{
+		auto decoder = std::make_shared<shared_decoder>(graph, url_or_file, loop, in, out, false, vid_params, audio_sample_rate);
+		subscriber = decoder->subscribe();
+		return decoder;
+	});
+}
+
+}}
@@ -0,0 +1,132 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "../util/util.h"
+
+#include <common/memory.h>
+
+#include <core/frame/frame.h>
+#include <core/ancillary/ancillary.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct AVFrame;
+
+namespace caspar {
+
+namespace diagnostics {
+
+class graph;
+
+}
+
+namespace ffmpeg {
+
+class input;
+class video_decoder;
+class audio_decoder;
+
+/**
+ * Demuxes and decodes a file once on behalf of any number of subscribers.
+ * Every subscriber receives the full sequence of decoded video frames and
+ * audio buffers. The subscribers are shared_muxers, one for each video
+ * format, filter and channel layout the clip is played with.
+ *
+ * Subscribers can only join while the decoder is still at its start, which
+ * is the case for producers that are loaded in sync on several channels.
+ */
+class shared_decoder : boost::noncopyable
+{
+public:
+	typedef std::vector<std::shared_ptr<core::mutable_audio_buffer>> audio_buffers;
+	typedef std::vector<std::shared_ptr<core::ancillary::AncillaryData>> ancillary_data;
+
+	shared_decoder(
+			const spl::shared_ptr<diagnostics::graph>& graph,
+			const std::wstring& url_or_file,
+			bool loop,
+			uint32_t in,
+			uint32_t out,
+			bool thumbnail_mode,
+			const ffmpeg_options& vid_params,
+			int audio_sample_rate);
+	~shared_decoder();
+
+	int							subscribe();
+	void						unsubscribe(int subscriber);
+	int							num_subscribers() const;
+
+	// Stops new subscribers from joining. Called for decoders that must have a
+	// single subscriber, such as thumbnail decoders and the decoder a producer
+	// detaches onto. Otherwise joining stops by itself once the decoder is too
+	// far from the start to replay its history to a new subscriber.
+	void						close_for_subscribers();
+	bool						open_for_subscribers() const;
+
+	// Returns the next video frame and/or audio buffers of the subscriber,
+	// decoding more when its queue is empty. ancillary receives the data
+	// that arrived in the input's data streams for the returned video frame.
+	void						poll(
+										int subscriber,
+										bool want_video,
+										bool want_audio,
+										std::shared_ptr<AVFrame>& video,
+										uint32_t& file_frame_number,
+										ancillary_data& ancillary,
+										audio_buffers& audio);
+
+	// True when the subscriber fell so far behind the others that its
+	// backlog was dropped. It needs a decoder of its own to continue.
+	bool						overflowed(int subscriber) const;
+	bool						eof(int subscriber) const;
+
+	ffmpeg::input&				input();
+	const ffmpeg::input&		input() const;
+	video_decoder*				video() const;
+	const std::vector<std::unique_ptr<audio_decoder>>& audio() const;
+
+	std::wstring				print() const;
+private:
+	struct impl;
+	spl::unique_ptr<impl> impl_;
+};
+
+/**
+ * Subscribes to a shared decoder of the same file, position and audio sample
+ * rate if one is still open for subscribers, or creates and registers a new
+ * one.
+ */
+std::shared_ptr<shared_decoder> open_shared_decoder(
+		const spl::shared_ptr<diagnostics::graph>& graph,
+		const std::wstring& url_or_file,
+		bool loop,
+		uint32_t in,
+		uint32_t out,
+		const ffmpeg_options& vid_params,
+		int audio_sample_rate,
+		int& subscriber);
+
+}}
@@ -27,15 +27,18 @@
 #include "../ffmpeg_error.h"
 #include "util/util.h"
 #include "input/input.h"
+#include "decoder/shared_decoder.h"
 #include "audio/audio_decoder.h"
 #include "video/video_decoder.h"
-#include "muxer/frame_muxer.h"
-#include "filter/audio_filter.h"
+#include "muxer/shared_muxer.h"
+#include "cache/clip_cache.h"
+#include "cache/cached_clip_producer.h"
 
 #include <common/param.h>
 #include <common/diagnostics/graph.h>
 #include <common/future.h>
 #include <common/executor.h>
+#include <common/scope_exit.h>
 
 #include <core/frame/draw_frame.h>
 #include <core/help/help_repository.h>
@@ -92,13 +95,20 @@ struct ffmpeg_producer : public core::frame_producer_base
 
 	core::constraints									constraints_;
 
-	input												input_;
-	std::unique_ptr<video_decoder>						video_decoder_;
-	std::vector<std::unique_ptr<audio_decoder>>			audio_decoders_;
-	std::unique_ptr<frame_muxer>						muxer_;
+	const ffmpeg_options								vid_params_;
+	const int											audio_sample_rate_;
+	const std::wstring									filter_;
+	const std::wstring									custom_channel_order_;
+	const core::video_format_desc						format_desc_;
+	mutable std::mutex									muxer_mutex_;
+	std::mutex											detach_mutex_;
+	int													subscriber_					= -1;
+	std::shared_ptr<shared_muxer>						muxer_;
+	std::atomic<uint32_t>								decoded_file_frame_number_;
 
     caspar::executor worker_;
     std::atomic<bool> abort_;
+	std::atomic<bool>									decoding_done_;
 
 	const boost::rational<int>							framerate_;
 	const bool											thumbnail_mode_;
@@ -112,6 +122,8 @@ struct ffmpeg_producer : public core::frame_producer_base
 	int64_t												frame_number_				= 0;
 	uint32_t											file_frame_number_			= 0;
 
+	const std::function<int64_t ()>						channel_frame_number_;
+	int64_t												scte_104_ticks_				= 0;
 	std::unique_ptr<caspar::core::scte_104>				scte_104_ = nullptr;
 public:
 	explicit ffmpeg_producer(
@@ -125,16 +137,24 @@ public:
 			bool thumbnail_mode,
 			const std::wstring& custom_channel_order,
 			const ffmpeg_options& vid_params,
-			std::unique_ptr<caspar::core::scte_104> scte_104)
+			std::unique_ptr<caspar::core::scte_104> scte_104,
+			std::function<int64_t ()> channel_frame_number = nullptr)
 		: filename_(url_or_file)
 		, frame_factory_(frame_factory)
 		, initial_logger_disabler_(temporary_enable_quiet_logging_for_thread(thumbnail_mode))
-		, input_(graph_, url_or_file, loop, in, out, thumbnail_mode, vid_params)
+		, vid_params_(vid_params)
+		, audio_sample_rate_(format_desc.audio_sample_rate)
+		, filter_(filter)
+		, custom_channel_order_(custom_channel_order)
+		, format_desc_(format_desc)
+		, muxer_(open_muxer(url_or_file, loop, in, out, thumbnail_mode))
                 , worker_(L"FFmpeg worker - " + filename_)
                 , abort_(false)
-		, framerate_(read_framerate(*input_.context(), format_desc.framerate))
+		, decoding_done_(false)
+		, framerate_(muxer_->in_framerate())
 		, thumbnail_mode_(thumbnail_mode)
 		, last_frame_(core::draw_frame::empty())
+		, channel_frame_number_(std::move(channel_frame_number))
 		, scte_104_(std::move(scte_104))
 	{
 		graph_->set_color("frame-time", diagnostics::color(0.1f, 1.0f, 0.1f));
@@ -142,101 +162,44 @@ public:
         graph_->set_text(print());
 		diagnostics::register_graph(graph_);
 
-		try
-		{
-			video_decoder_.reset(new video_decoder(input_.context()));
-			if (!thumbnail_mode_)
-				CASPAR_LOG(info) << print() << L" " << video_decoder_->print();
+		decoded_file_frame_number_ = 0;
 
-			constraints_.width.set(video_decoder_->width());
-			constraints_.height.set(video_decoder_->height());
-		}
-		catch (averror_stream_not_found&)
-		{
-			//CASPAR_LOG(warning) << print() << " No video-stream found. Running without video.";
-		}
-		catch (...)
+		auto& decoder = *muxer_->decoder();
+
+		if (auto video = decoder.video())
 		{
 			if (!thumbnail_mode_)
-			{
-				CASPAR_LOG_CURRENT_EXCEPTION();
-				CASPAR_LOG(warning) << print() << "Failed to open video-stream. Running without video.";
-			}
-		}
+				CASPAR_LOG(info) << print() << L" " << video->print();
 
-		auto channel_layout = core::audio_channel_layout::invalid();
-		std::vector<audio_input_pad> audio_input_pads;
+			constraints_.width.set(video->width());
+			constraints_.height.set(video->height());
+		}
 
 		if (!thumbnail_mode_)
 		{
-			for (unsigned stream_index = 0; stream_index < input_.context()->nb_streams; ++stream_index)
-			{
-				auto stream = input_.context()->streams[stream_index];
-
-				if (stream->codec->codec_type != AVMediaType::AVMEDIA_TYPE_AUDIO)
-					continue;
-
-				try
-				{
-					audio_decoders_.push_back(std::unique_ptr<audio_decoder>(new audio_decoder(stream_index, input_.context(), format_desc.audio_sample_rate)));
-					audio_input_pads.emplace_back(
-							boost::rational<int>(1, format_desc.audio_sample_rate),
-							format_desc.audio_sample_rate,
-							AVSampleFormat::AV_SAMPLE_FMT_S32,
-							audio_decoders_.back()->ffmpeg_channel_layout());
-					CASPAR_LOG(info) << print() << L" " << audio_decoders_.back()->print();
-				}
-				catch (averror_stream_not_found&)
-				{
-					//CASPAR_LOG(warning) << print() << " No audio-stream found. Running without audio.";
-				}
-				catch (...)
-				{
-					CASPAR_LOG_CURRENT_EXCEPTION();
-					CASPAR_LOG(warning) << print() << " Failed to open audio-stream. Running without audio.";
-				}
-			}
-
-			if (audio_decoders_.size() == 1)
-			{
-				channel_layout = get_audio_channel_layout(
-						audio_decoders_.at(0)->num_channels(),
-						audio_decoders_.at(0)->ffmpeg_channel_layout(),
-						custom_channel_order);
-			}
-			else if (audio_decoders_.size() > 1)
-			{
-				auto num_channels = 0;
-				for (auto& dec : audio_decoders_) {
-					num_channels += dec->num_channels();
-				}
-				auto ffmpeg_channel_layout = av_get_default_channel_layout(num_channels);
-
-				channel_layout = get_audio_channel_layout(
-						num_channels,
-						ffmpeg_channel_layout,
-						custom_channel_order);
-			}
+			for (auto& audio_decoder : decoder.audio())
+				CASPAR_LOG(info) << print() << L" " << audio_decoder->print();
 		}
 
-		if (!video_decoder_ && audio_decoders_.empty())
-			CASPAR_THROW_EXCEPTION(averror_stream_not_found() << msg_info("No streams found"));
-
-		muxer_.reset(new frame_muxer(framerate_, std::move(audio_input_pads), frame_factory, format_desc, channel_layout, filter, true));
-
 		if (auto nb_frames = file_nb_frames())
 		{
 			out = std::min(out, nb_frames);
-			input_.out(out);
+			decoder.input().out(out);
 		}
 
                 if (!thumbnail_mode) {
                     worker_.begin_invoke([=]() {
+                        CASPAR_SCOPE_EXIT
+                        {
+                            decoding_done_ = true;
+                            buffer_cond_.notify_all();
+                        };
+
                         while (!abort_) {
                             bool got_frame = try_decode_frame();
 
                             // If end of file, then abort the loop
-                            if (input_.eof() && input_.buffer_empty() && !got_frame) {
+                            if (at_eof() && !got_frame) {
                                 return;
                             }
                         }
@@ -249,6 +212,8 @@ public:
             abort_ = true;
             buffer_cond_.notify_all();
             worker_.wait();
+            auto subscription = this->subscription();
+            subscription.first->unsubscribe(subscription.second);
         }
 
 	// frame_producer
@@ -283,7 +248,7 @@ public:
 
 	double out_fps() const
 	{
-		auto out_framerate	= muxer_->out_framerate();
+		auto out_framerate	= muxer()->out_framerate();
 		auto fps			= static_cast<double>(out_framerate.numerator()) / static_cast<double>(out_framerate.denominator());
 
 		return fps;
@@ -306,21 +271,21 @@ public:
                     std::unique_lock<std::mutex> buffer_lock(buffer_mutex_);
                     if (frame_buffer_.empty())
                     {
-                        if (input_.eof())
+                        if (decoder()->input().eof())
                         {
                             send_osc();
-                            return std::make_pair(last_frame(), -1);
+                            return std::make_pair(attach_scte_104(last_frame()), -1);
                         }
                         else if (!is_url())
                         {
                             graph_->set_tag(diagnostics::tag_severity::WARNING, "underflow");
                             send_osc();
-                            return std::make_pair(last_frame_, -1);
+                            return std::make_pair(attach_scte_104(last_frame_), -1);
                         }
                         else
                         {
                             send_osc();
-                            return std::make_pair(last_frame_, -1);
+                            return std::make_pair(attach_scte_104(last_frame_), -1);
                         }
                     }
 
@@ -336,17 +301,32 @@ public:
 		graph_->set_text(print());
 
 		last_frame_ = frame.first;
+		// Repeated on underflow and at the end, the ancillary data must only go out once.
+		last_frame_.ancillary().clear();
 
 		send_osc();
 
-		if (scte_104_) {
-			auto data = scte_104_.get()->tick();
+		frame.first = attach_scte_104(std::move(frame.first));
+
+		return frame;
+	}
+
+	// Ticked for every frame that leaves the producer, repeated ones included. The countdown
+	// follows the channel's frames so it keeps running while the producer is paused, only
+	// without a channel are the producer's own frames counted.
+	core::draw_frame attach_scte_104(core::draw_frame frame)
+	{
+		auto channel_frame = channel_frame_number_ ? channel_frame_number_() : scte_104_ticks_;
+		++scte_104_ticks_;
+
+		if (scte_104_)
+		{
+			auto data = scte_104_->tick(channel_frame, format_desc_);
+
 			if (data)
-			{
-				CASPAR_LOG(debug) << "Got SCTE data";
-				frame.first.ancillary().addData(std::move(data));
-			}
+				frame.ancillary().addData(std::move(data));
 		}
+
 		return frame;
 	}
 
@@ -367,7 +347,7 @@ public:
 																			% static_cast<int32_t>(file_nb_frames())
 							<< core::monitor::message("/file/fps")			% fps
 							<< core::monitor::message("/file/path")			% path_relative_to_media_
-							<< core::monitor::message("/loop")				% input_.loop();
+							<< core::monitor::message("/loop")				% decoder()->input().loop();
 	}
 
 	core::draw_frame render_specific_frame(uint32_t file_position)
@@ -378,7 +358,7 @@ public:
 		if (file_position > 0) // Assume frames are requested in sequential order,
 			                   // therefore no seeking should be necessary for the first frame.
 		{
-			input_.seek(file_position > 1 ? file_position - 2: file_position).get();
+			decoder()->input().seek(file_position > 1 ? file_position - 2: file_position).get();
 			std::this_thread::sleep_for(std::chrono::milliseconds(40));
 		}
 
@@ -403,7 +383,7 @@ public:
 				if (adjusted_seek > 1 && file_position > 0)
 				{
 					CASPAR_LOG(trace) << print() << L" adjusting to " << adjusted_seek;
-					input_.seek(static_cast<uint32_t>(adjusted_seek) - 1).get();
+					decoder()->input().seek(static_cast<uint32_t>(adjusted_seek) - 1).get();
 					std::this_thread::sleep_for(std::chrono::milliseconds(40));
 				}
 				else
@@ -463,26 +443,30 @@ public:
 
 	uint32_t file_frame_number() const
 	{
-		return video_decoder_ ? video_decoder_->file_frame_number() : 0;
+		return decoder()->video() ? decoded_file_frame_number_.load() : 0;
 	}
 
 	uint32_t nb_frames() const override
 	{
-		if (is_url() || input_.loop())
+		auto decoder = this->decoder();
+
+		if (is_url() || decoder->input().loop())
 			return std::numeric_limits<uint32_t>::max();
 
-		auto nb_frames = std::min(input_.out(), file_nb_frames());
-		if (nb_frames >= input_.in())
-			nb_frames -= input_.in();
+		auto nb_frames = std::min(decoder->input().out(), file_nb_frames());
+		if (nb_frames >= decoder->input().in())
+			nb_frames -= decoder->input().in();
 		else
 			nb_frames = 0;
 
-		return muxer_->calc_nb_frames(nb_frames);
+		return muxer()->calc_nb_frames(nb_frames);
 	}
 
 	uint32_t file_nb_frames() const
 	{
-		return video_decoder_ ? video_decoder_->nb_frames() : 0;
+		auto video = decoder()->video();
+
+		return video ? video->nb_frames() : 0;
 	}
 
 	std::future<std::wstring> call(const std::vector<std::wstring>& params) override
@@ -494,29 +478,34 @@ public:
 		if (params.size() > 1)
 			value = params.at(1);
 
+		// Changing the input of a shared decoder would affect the other
+		// channels playing the clip, so this producer gets its own first.
+		auto decoder = value.empty() || boost::iequals(cmd, L"scte") ? this->decoder() : private_decoder();
+		auto& input = decoder->input();
+
 		if (boost::iequals(cmd, L"loop"))
 		{
 			if (!value.empty())
-				input_.loop(boost::lexical_cast<bool>(value));
-			result = boost::lexical_cast<std::wstring>(input_.loop());
+				input.loop(boost::lexical_cast<bool>(value));
+			result = boost::lexical_cast<std::wstring>(input.loop());
 		}
 		else if (boost::iequals(cmd, L"in") || boost::iequals(cmd, L"start"))
 		{
 			if (!value.empty())
-				input_.in(boost::lexical_cast<uint32_t>(value));
-			result = boost::lexical_cast<std::wstring>(input_.in());
+				input.in(boost::lexical_cast<uint32_t>(value));
+			result = boost::lexical_cast<std::wstring>(input.in());
 		}
 		else if (boost::iequals(cmd, L"out"))
 		{
 			if (!value.empty())
-				input_.out(boost::lexical_cast<uint32_t>(value));
-			result = boost::lexical_cast<std::wstring>(input_.out());
+				input.out(boost::lexical_cast<uint32_t>(value));
+			result = boost::lexical_cast<std::wstring>(input.out());
 		}
 		else if (boost::iequals(cmd, L"length"))
 		{
 			if (!value.empty())
-				input_.length(boost::lexical_cast<uint32_t>(value));
-			result = boost::lexical_cast<std::wstring>(input_.length());
+				input.length(boost::lexical_cast<uint32_t>(value));
+			result = boost::lexical_cast<std::wstring>(input.length());
 		}
 		else if (boost::iequals(cmd, L"seek") && !value.empty())
 		{
@@ -526,9 +515,9 @@ public:
 			if (boost::iequals(value, L"rel"))
 				seek = file_frame_number();
 			else if (boost::iequals(value, L"in"))
-				seek = input_.in();
+				seek = input.in();
 			else if (boost::iequals(value, L"out"))
-				seek = input_.out();
+				seek = input.out();
 			else if (boost::iequals(value, L"end"))
 				seek = nb_frames;
 			else
@@ -542,7 +531,7 @@ public:
 			else if (seek >= nb_frames)
 				seek = nb_frames - 1;
 
-			input_.seek(static_cast<uint32_t>(seek));
+			input.seek(static_cast<uint32_t>(seek));
 		} else if (boost::iequals(cmd, L"scte"))
 		{
 			if (value.empty())
@@ -583,11 +572,15 @@ public:
 		boost::property_tree::wptree info;
 		info.add(L"type",				L"ffmpeg-producer");
 		info.add(L"filename",			filename_);
-		info.add(L"width",				video_decoder_ ? video_decoder_->width() : 0);
-		info.add(L"height",				video_decoder_ ? video_decoder_->height() : 0);
-		info.add(L"progressive",		video_decoder_ ? video_decoder_->is_progressive() : false);
+		auto decoder = this->decoder();
+		auto video = decoder->video();
+		info.add(L"width",				video ? video->width() : 0);
+		info.add(L"height",				video ? video->height() : 0);
+		info.add(L"progressive",		video ? video->is_progressive() : false);
 		info.add(L"fps",				static_cast<double>(framerate_.numerator()) / static_cast<double>(framerate_.denominator()));
-		info.add(L"loop",				input_.loop());
+		info.add(L"loop",				decoder->input().loop());
+		info.add(L"shared-decoder",		decoder->num_subscribers() > 1);
+		info.add(L"shared-muxer",		muxer()->num_subscribers() > 1);
 		info.add(L"frame-number",		frame_number_);
 		auto nb_frames2 = nb_frames();
 		info.add(L"nb-frames",			nb_frames2 == std::numeric_limits<int64_t>::max() ? -1 : nb_frames2);
@@ -605,113 +598,200 @@ public:
 
 	std::wstring print_mode() const
 	{
-		return video_decoder_ ? ffmpeg::print_mode(
-				video_decoder_->width(),
-				video_decoder_->height(),
+		auto video = decoder()->video();
+
+		return video ? ffmpeg::print_mode(
+				video->width(),
+				video->height(),
 				static_cast<double>(framerate_.numerator()) / static_cast<double>(framerate_.denominator()),
-				!video_decoder_->is_progressive()) : L"";
+				!video->is_progressive()) : L"";
 	}
 
-	bool all_audio_decoders_ready() const
+	std::shared_ptr<shared_muxer> open_muxer(const std::wstring& url_or_file, bool loop, uint32_t in, uint32_t out, bool thumbnail_mode)
 	{
-		for (auto& audio_decoder : audio_decoders_)
-			if (!audio_decoder->ready())
-				return false;
+		if (!thumbnail_mode)
+			return open_shared_muxer(graph_, frame_factory_, format_desc_, url_or_file, filter_, loop, in, out, custom_channel_order_, vid_params_, subscriber_);
 
-		return true;
+		auto decoder			= std::make_shared<shared_decoder>(graph_, url_or_file, loop, in, out, true, vid_params_, audio_sample_rate_);
+		auto decoder_subscriber	= decoder->subscribe();
+		decoder->close_for_subscribers();
+
+		auto muxer	= std::make_shared<shared_muxer>(decoder, decoder_subscriber, frame_factory_, format_desc_, filter_, custom_channel_order_, true);
+		subscriber_	= muxer->subscribe(*frame_factory_);
+		muxer->close_for_subscribers();
+
+		return muxer;
 	}
 
-	bool try_decode_frame()
+	std::shared_ptr<shared_muxer> muxer() const
 	{
-		std::shared_ptr<AVPacket> pkt;
+		std::lock_guard<std::mutex> lock(muxer_mutex_);
+		return muxer_;
+	}
 
-		for (int n = 0; n < 32 && ((video_decoder_ && !video_decoder_->ready()) || !all_audio_decoders_ready()) && input_.try_pop(pkt); ++n)
-		{
-			if (video_decoder_)
-				video_decoder_->push(pkt);
+	std::shared_ptr<shared_decoder> decoder() const
+	{
+		return muxer()->decoder();
+	}
 
-			for (auto& audio_decoder : audio_decoders_)
-				audio_decoder->push(pkt);
-		}
+	std::pair<std::shared_ptr<shared_muxer>, int> subscription() const
+	{
+		std::lock_guard<std::mutex> lock(muxer_mutex_);
+		return std::make_pair(muxer_, subscriber_);
+	}
 
-		std::shared_ptr<AVFrame>									video;
-		std::vector<std::shared_ptr<core::mutable_audio_buffer>>	audio;
+	// Continues on a decoder and muxer of our own, positioned at the last
+	// frame this producer has received.
+	std::shared_ptr<shared_muxer> detach_muxer()
+	{
+		std::lock_guard<std::mutex> lock(detach_mutex_);
 
-		tbb::parallel_invoke(
-		[&]
-		{
-			do
-			{
-				if (!muxer_->video_ready() && video_decoder_)
-				{
-					video = video_decoder_->poll();
-					if (video)
-						break;
-				}
-				else
-					break;
-			} while (!video_decoder_->empty());
-		},
-		[&]
-		{
-			if (!muxer_->audio_ready())
-			{
-				for (auto& audio_decoder : audio_decoders_)
-				{
-					auto audio_for_stream = audio_decoder->poll();
+		auto subscription		= this->subscription();
+		auto& current			= subscription.first->decoder()->input();
+		auto decoder			= std::make_shared<shared_decoder>(graph_, filename_, current.loop(), current.in(), current.out(), false, vid_params_, audio_sample_rate_);
+		auto decoder_subscriber	= decoder->subscribe();
+		decoder->close_for_subscribers();
 
-					if (audio_for_stream)
-						audio.push_back(audio_for_stream);
-				}
-			}
-		});
+		uint32_t position = decoded_file_frame_number_;
+		if (position > current.in())
+			decoder->input().seek(position);
 
-		muxer_->push(video);
-		muxer_->push(audio);
+		auto muxer		= std::make_shared<shared_muxer>(decoder, decoder_subscriber, frame_factory_, format_desc_, filter_, custom_channel_order_, false);
+		auto subscriber	= muxer->subscribe(*frame_factory_);
+		muxer->close_for_subscribers();
 
-		if (audio_decoders_.empty())
 		{
-			if (video == flush_video())
-				muxer_->push({ flush_audio() });
-			else if (!muxer_->audio_ready())
-				muxer_->push({ empty_audio() });
+			std::lock_guard<std::mutex> lock(muxer_mutex_);
+
+			muxer_		= muxer;
+			subscriber_	= subscriber;
 		}
 
-		if (!video_decoder_)
+		subscription.first->unsubscribe(subscription.second);
+
+		CASPAR_LOG(info) << print() << L" Detached from shared muxer.";
+
+		return muxer;
+	}
+
+	// Returns a decoder that no other producer depends on, for changes to the
+	// input that must only affect this producer.
+	std::shared_ptr<shared_decoder> private_decoder()
+	{
+		auto muxer		= this->muxer();
+		auto decoder	= muxer->decoder();
+
+		muxer->close_for_subscribers();
+		decoder->close_for_subscribers();
+
+		if (muxer->num_subscribers() > 1 || decoder->num_subscribers() > 1)
+			return detach_muxer()->decoder();
+
+		return decoder;
+	}
+
+	bool at_eof() const
+	{
+		auto subscription = this->subscription();
+
+		return subscription.first->eof(subscription.second);
+	}
+
+	bool try_decode_frame()
+	{
+		auto subscription = this->subscription();
+
+		if (subscription.first->overflowed(subscription.second))
 		{
-			if (boost::count_if(audio, [](std::shared_ptr<core::mutable_audio_buffer> a) { return a == flush_audio(); }) > 0)
-				muxer_->push(flush_video());
-			else if (!muxer_->video_ready())
-				muxer_->push(empty_video());
+			detach_muxer();
+			subscription = this->subscription();
 		}
 
-		uint32_t file_frame_number = 0;
-		file_frame_number = std::max(file_frame_number, video_decoder_ ? video_decoder_->file_frame_number() : 0);
+		core::draw_frame	frame;
+		uint32_t			file_frame_number;
 
-                bool got_frame = false;
-		for (auto frame = muxer_->poll(); frame != core::draw_frame::empty(); frame = muxer_->poll()) {
-                    if (frame != core::draw_frame::empty()) {
-                        got_frame = true;
-                        std::unique_lock<std::mutex> buffer_lock(buffer_mutex_);
-                        buffer_cond_.wait(buffer_lock, [&] { return frame_buffer_.size() <= 2 || abort_; });
-                        frame_buffer_.push(std::make_pair(frame, file_frame_number));
-                    }
-                }
+		if (!subscription.first->poll(subscription.second, frame, file_frame_number))
+			return false;
+
+		decoded_file_frame_number_ = file_frame_number;
 
-                return got_frame;
+		std::unique_lock<std::mutex> buffer_lock(buffer_mutex_);
+		buffer_cond_.wait(buffer_lock, [&] { return frame_buffer_.size() <= 2 || abort_; });
+		frame_buffer_.push(std::make_pair(std::move(frame), file_frame_number));
+
+		return true;
 	}
 
 	bool audio_only() const
 	{
-		return !video_decoder_;
+		return !decoder()->video();
 	}
 
 	boost::rational<int> get_out_framerate() const
 	{
-		return muxer_->out_framerate();
+		return muxer()->out_framerate();
+	}
+
+	std::shared_ptr<cached_clip> decode_to_cache(const core::video_format_desc& format_desc, std::size_t budget)
+	{
+		auto decoder = this->decoder();
+
+		if (!decoder->video())
+			CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"Only clips with video can be preloaded: " + filename_));
+
+		auto clip				= std::make_shared<cached_clip>();
+		clip->filename			= filename_;
+		clip->format_name		= format_desc.name;
+		clip->framerate			= get_out_framerate();
+		clip->width				= decoder->video()->width();
+		clip->height			= decoder->video()->height();
+		clip->file_nb_frames	= file_nb_frames();
+
+		int num_channels = 0;
+		for (auto& audio_decoder : decoder->audio())
+			num_channels += audio_decoder->num_channels();
+
+		// Estimate, as the decoded pixel format is not known here. BGRA is the
+		// worst case, planar YCbCr clips use less.
+		auto samples_per_frame	= static_cast<std::size_t>(format_desc.audio_sample_rate * clip->framerate.denominator() / clip->framerate.numerator());
+		auto frame_size			= static_cast<std::size_t>(clip->width) * clip->height * 4 + samples_per_frame * num_channels * sizeof(int32_t);
+
+		while (true)
+		{
+			std::unique_lock<std::mutex> buffer_lock(buffer_mutex_);
+			buffer_cond_.wait(buffer_lock, [&] { return !frame_buffer_.empty() || decoding_done_; });
+
+			if (frame_buffer_.empty())
+				break;
+
+			clip->frames.push_back(std::move(frame_buffer_.front()));
+			frame_buffer_.pop();
+			buffer_cond_.notify_all();
+
+			clip->size_bytes += frame_size;
+
+			if (clip->size_bytes > budget)
+				CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"Clip does not fit in the clip cache: " + filename_));
+		}
+
+		if (clip->frames.empty())
+			CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"No frames decoded: " + filename_));
+
+		return clip;
 	}
 };
 
+std::wstring get_filter(const std::vector<std::wstring>& params)
+{
+	auto filter_str = get_param(L"FILTER", params, L"");
+
+	boost::ireplace_all(filter_str, L"DEINTERLACE_BOB",	L"YADIF=1:-1");
+	boost::ireplace_all(filter_str, L"DEINTERLACE_LQ",	L"SEPARATEFIELDS");
+	boost::ireplace_all(filter_str, L"DEINTERLACE",		L"YADIF=0:-1");
+
+	return filter_str;
+}
+
 bool has_invalid_protocol(const std::wstring& filename)
 {
     static const auto invalid_protocols = {L"ndi:"};
@@ -727,7 +807,7 @@ bool has_invalid_protocol(const std::wstring& filename)
 void describe_producer(core::help_sink& sink, const core::help_repository& repo)
 {
 	sink.short_description(L"A producer for playing media files supported by FFmpeg.");
-	sink.syntax(L"[clip,url:string] {[loop:LOOP]} {IN,SEEK [in:int]} {OUT [out:int] | LENGTH [length:int]} {FILTER [filter:string]} {CHANNEL_LAYOUT [channel_layout:string]}");
+	sink.syntax(L"[clip,url:string] {[loop:LOOP]} {IN,SEEK [in:int]} {OUT [out:int] | LENGTH [length:int]} {FILTER [filter:string]} {CHANNEL_LAYOUT [channel_layout:string]} {SCTE [scte:string]}");
 	sink.para()
 		->text(L"The FFmpeg Producer can play all media that FFmpeg can play, which includes many ")
 		->text(L"QuickTime video codec such as Animation, PNG, PhotoJPEG, MotionJPEG, as well as ")
@@ -742,7 +822,13 @@ void describe_producer(core::help_sink& sink, const core::help_repository& repo)
 		->item(L"filter", L"If specified, will be used as an FFmpeg video filter.")
 		->item(L"channel_layout",
 				L"Optionally override the automatically deduced audio channel layout."
-				L"Either a named layout as specified in casparcg.config or in the format [type:string]:[channel_order:string] for a custom layout.");
+				L"Either a named layout as specified in casparcg.config or in the format [type:string]:[channel_order:string] for a custom layout.")
+		->item(L"scte", L"Optionally schedules a SCTE-104 request that goes out in the VANC of the clip's frames, see below.");
+	sink.para()
+		->text(L"When the same clip is loaded on several channels at once, with the same ")->code(L"LOOP")->text(L", ")
+		->code(L"IN")->text(L" and ")->code(L"OUT")->text(L", the producers share one decoder and only convert to each channel's ")
+		->text(L"video format separately. A producer gets a decoder of its own when its input is changed via ")->code(L"CALL")
+		->text(L" or when it falls too far behind the others.");
 	sink.para()->text(L"Examples:");
 	sink.example(L">> PLAY 1-10 folder/clip", L"to play all frames in a clip and stop at the last frame.");
 	sink.example(L">> PLAY 1-10 folder/clip LOOP", L"to loop a clip between the first frame and the last frame.");
@@ -762,6 +848,28 @@ void describe_producer(core::help_sink& sink, const core::help_repository& repo)
 	sink.example(L">> CALL 1-10 OUT 60");
 	sink.example(L">> CALL 1-10 LENGTH 50");
 	sink.example(L">> CALL 1-10 SEEK 30");
+	sink.example(L">> CALL 1-10 SCTE \"OPID=SPLICE,SPLICE_TYPE=START_NORMAL,EVENT_ID=12,PRE_ROLL_TIME=8000,BREAK_DURATION=300,AUTO_RETURN\"");
+	sink.para()
+		->text(L"A SCTE request is a list of ")->code(L"NAME=value")->text(L" pairs. ")->code(L"OPID")
+		->text(L" is ")->code(L"SPLICE")->text(L", ")->code(L"TIME_SIGNAL")->text(L" or ")->code(L"SPLICE_NULL")
+		->text(L". A splice takes ")->code(L"SPLICE_TYPE")->text(L" (")->code(L"START_NORMAL")->text(L", ")->code(L"START_IMMEDIATE")
+		->text(L", ")->code(L"END_NORMAL")->text(L", ")->code(L"END_IMMEDIATE")->text(L" or ")->code(L"CANCEL")->text(L"), ")
+		->code(L"UNIQUE_PROGRAM_ID")->text(L", ")->code(L"BREAK_DURATION")->text(L" in tenths of a second, ")->code(L"AVAIL_NUM")->text(L", ")
+		->code(L"AVAILS_EXPECTED")->text(L" and the flag ")->code(L"AUTO_RETURN")->text(L". Requests are kept per ")->code(L"EVENT_ID")
+		->text(L", a new one with the same id replaces the pending one. ")->code(L"PRE_ROLL_TIME")
+		->text(L" in milliseconds is counted down in frames and the request is sent again every ")->code(L"RESEND_INTERVAL")
+		->text(L" milliseconds until it is within ")->code(L"RESEND_LIMIT")->text(L" milliseconds of the splice point. A splice_null goes out every ")
+		->code(L"HEARTBEAT")->text(L" milliseconds when nothing else is sent, 0 disables it.");
+	sink.para()
+		->text(L"Descriptors are added to the request with ")->code(L"SEGMENTATION_TYPE_ID")->text(L" and optionally ")
+		->code(L"SEGMENTATION_EVENT_ID")->text(L", ")->code(L"SEGMENTATION_CANCEL")->text(L", ")->code(L"DURATION")->text(L" in seconds, ")
+		->code(L"DURATION_EXTENSION_FRAMES")->text(L", ")->code(L"UPID_TYPE")->text(L", ")->code(L"UPID")->text(L" as hex, ")
+		->code(L"SEGMENT_NUM")->text(L", ")->code(L"SEGMENTS_EXPECTED")->text(L", ")->code(L"SUB_SEGMENT_NUM")->text(L", ")
+		->code(L"SUB_SEGMENTS_EXPECTED")->text(L", ")->code(L"DEVICE_RESTRICTIONS")->text(L" with the flags ")->code(L"WEB_DELIVERY_ALLOWED")
+		->text(L", ")->code(L"NO_REGIONAL_BLACKOUT")->text(L" and ")->code(L"ARCHIVE_ALLOWED")->text(L"; with one or more ")
+		->code(L"PROVIDER_AVAIL_ID")->text(L" for an avail descriptor and with ")->code(L"DTMF")->text(L" and ")->code(L"DTMF_PRE_ROLL")
+		->text(L" in tenths of a second for a DTMF descriptor. Numbers can be given as decimal or 0x prefixed hex.");
+	sink.example(L">> CALL 1-10 SCTE \"OPID=TIME_SIGNAL,PRE_ROLL_TIME=4000,SEGMENTATION_TYPE_ID=0x34,SEGMENTATION_EVENT_ID=1,DURATION=120,UPID_TYPE=0x09,UPID=0x5349474E414C\"");
 	core::describe_framerate_producer(sink);
 }
 
@@ -798,7 +906,7 @@ spl::shared_ptr<core::frame_producer> create_producer(
 		out = uint32_max;
 	out							= get_param(L"OUT",				params, out);
 
-	auto filter_str				= get_param(L"FILTER",			params, L"");
+	auto filter_str				= get_filter(params);
 	auto custom_channel_order	= get_param(L"CHANNEL_LAYOUT",	params, L"");
 	auto scte_str				= get_param(L"SCTE", 			params, L"");
 
@@ -815,10 +923,6 @@ spl::shared_ptr<core::frame_producer> create_producer(
 	    }
     }
 
-	boost::ireplace_all(filter_str, L"DEINTERLACE_BOB",	L"YADIF=1:-1");
-	boost::ireplace_all(filter_str, L"DEINTERLACE_LQ",	L"SEPARATEFIELDS");
-	boost::ireplace_all(filter_str, L"DEINTERLACE",		L"YADIF=0:-1");
-
 	ffmpeg_options vid_params;
 	bool haveFFMPEGStartIndicator = false;
 	for (size_t i = 0; i < params.size() - 1; ++i)
@@ -836,6 +940,24 @@ spl::shared_ptr<core::frame_producer> create_producer(
 		}
 	}
 
+	if (vid_params.empty() && !boost::contains(file_or_url, L"://"))
+	{
+		auto clip = clip_cache::instance().find(clip_cache_key(file_or_url, dependencies.format_desc, filter_str, custom_channel_order));
+
+		if (clip)
+		{
+			auto framerate = clip->framerate;
+
+			return core::create_destroy_proxy(core::create_framerate_producer(
+					create_cached_clip_producer(clip, loop, in, out, std::move(scte_104), dependencies.format_desc, dependencies.channel_frame_number),
+					dependencies.frame_factory,
+					[framerate] { return framerate; },
+					dependencies.format_desc.framerate,
+					dependencies.format_desc.field_mode,
+					dependencies.format_desc.audio_cadence));
+		}
+	}
+
 	auto producer = spl::make_shared<ffmpeg_producer>(
 			dependencies.frame_factory,
 			dependencies.format_desc,
@@ -847,7 +969,8 @@ spl::shared_ptr<core::frame_producer> create_producer(
 			false,
 			custom_channel_order,
 			vid_params,
-			std::move(scte_104));
+			std::move(scte_104),
+			dependencies.channel_frame_number);
 
 	if (producer->audio_only())
 		return core::create_destroy_proxy(producer);
@@ -857,12 +980,51 @@ spl::shared_ptr<core::frame_producer> create_producer(
 
 	return core::create_destroy_proxy(core::create_framerate_producer(
 			producer,
+			dependencies.frame_factory,
 			get_source_framerate,
 			target_framerate,
 			dependencies.format_desc.field_mode,
 			dependencies.format_desc.audio_cadence));
 }
 
+std::wstring preload_clip(
+		const core::frame_producer_dependencies& dependencies,
+		const std::vector<std::wstring>& params)
+{
+	auto filename = probe_stem(env::media_folder() + L"/" + params.at(0), false);
+
+	if (filename.empty())
+		CASPAR_THROW_EXCEPTION(file_not_found() << msg_info(params.at(0)));
+
+	auto filter_str				= get_filter(params);
+	auto custom_channel_order	= get_param(L"CHANNEL_LAYOUT", params, L"");
+	auto key					= clip_cache_key(filename, dependencies.format_desc, filter_str, custom_channel_order);
+	auto& cache					= clip_cache::instance();
+
+	if (cache.contains(key))
+		return filename;
+
+	ffmpeg_options vid_params;
+	auto producer = spl::make_shared<ffmpeg_producer>(
+			dependencies.frame_factory,
+			dependencies.format_desc,
+			filename,
+			filter_str,
+			false,
+			0,
+			std::numeric_limits<uint32_t>::max(),
+			false,
+			custom_channel_order,
+			vid_params,
+			nullptr);
+
+	cache.insert(key, producer->decode_to_cache(dependencies.format_desc, cache.budget()));
+
+	CASPAR_LOG(info) << producer->print() << L" Preloaded for " << dependencies.format_desc.name;
+
+	return filename;
+}
+
 core::draw_frame create_thumbnail_frame(
 		const core::frame_producer_dependencies& dependencies,
 		const std::wstring& media_file,
@@ -35,6 +35,7 @@
 #include <core/frame/frame_factory.h>
 #include <core/frame/frame.h>
 #include <core/frame/audio_channel_layout.h>
+#include <core/ancillary/cea708/cea708.h>
 
 #include <common/env.h>
 #include <common/except.h>
@@ -132,6 +133,8 @@ struct frame_muxer::impl : boost::noncopyable
 	std::queue<std::queue<core::mutable_frame>>		video_streams_;
 	std::queue<core::mutable_audio_buffer>			audio_streams_;
 	std::queue<core::draw_frame>					frame_buffer_;
+	std::vector<std::uint8_t>						pending_captions_;
+	core::ancillary::AncillaryContainer				pending_ancillary_;
 	display_mode									display_mode_				= display_mode::invalid;
 	const boost::rational<int>						in_framerate_;
 	const video_format_desc							format_desc_;
@@ -210,6 +213,10 @@ struct frame_muxer::impl : boost::noncopyable
 		}
 		else
 		{
+			// Taken before filtering, deinterlacers and rate changing filters copy the side data to every
+			// output frame. The captions are paced again by the framerate producer.
+			boost::push_back(pending_captions_, get_a53_captions(*video_frame));
+
 			if (!filter_ || display_mode_ == display_mode::invalid)
 				update_display_mode(video_frame);
 
@@ -227,6 +234,16 @@ struct frame_muxer::impl : boost::noncopyable
 			CASPAR_THROW_EXCEPTION(invalid_operation() << source_info("frame_muxer") << msg_info("video-stream overflow. This can be caused by incorrect frame-rate. Check clip meta-data."));
 	}
 
+	void push(const std::shared_ptr<core::ancillary::AncillaryData>& ancillary)
+	{
+		pending_ancillary_.addData(ancillary);
+	}
+
+	void push(core::ancillary::AncillaryContainer& ancillary)
+	{
+		pending_ancillary_.appendFrom(ancillary);
+	}
+
 	void push(const std::vector<std::shared_ptr<core::mutable_audio_buffer>>& audio_samples_per_stream)
 	{
 		if (audio_samples_per_stream.empty())
@@ -313,7 +330,17 @@ struct frame_muxer::impl : boost::noncopyable
 		auto frame			= pop_video();
 		frame.audio_data()	= pop_audio();
 
-		frame_buffer_.push(core::draw_frame(std::move(frame)));
+		core::draw_frame result(std::move(frame));
+
+		if (!pending_captions_.empty())
+		{
+			result.ancillary().addData(std::make_shared<core::ancillary::CEA708>(pending_captions_.data(), pending_captions_.size(), core::ancillary::atsc53));
+			pending_captions_.clear();
+		}
+
+		result.ancillary().appendFrom(pending_ancillary_);
+
+		frame_buffer_.push(std::move(result));
 
 		return poll();
 	}
@@ -482,6 +509,8 @@ frame_muxer::frame_muxer(
 	: impl_(new impl(std::move(in_framerate), std::move(audio_input_pads), frame_factory, format_desc, channel_layout, filter, multithreaded_filter, force_deinterlacing)){}
 void frame_muxer::push(const std::shared_ptr<AVFrame>& video){impl_->push(video);}
 void frame_muxer::push(const std::vector<std::shared_ptr<core::mutable_audio_buffer>>& audio_samples_per_stream){impl_->push(audio_samples_per_stream);}
+void frame_muxer::push(const std::shared_ptr<core::ancillary::AncillaryData>& ancillary){impl_->push(ancillary);}
+void frame_muxer::push(core::ancillary::AncillaryContainer& ancillary){impl_->push(ancillary);}
 core::draw_frame frame_muxer::poll(){return impl_->poll();}
 uint32_t frame_muxer::calc_nb_frames(uint32_t nb_frames) const {return impl_->calc_nb_frames(nb_frames);}
 bool frame_muxer::video_ready() const{return impl_->video_ready();}
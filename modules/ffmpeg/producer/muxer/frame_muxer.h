@@ -56,6 +56,10 @@ public:
 
 	void push(const std::shared_ptr<AVFrame>& video_frame);
 	void push(const std::vector<std::shared_ptr<core::mutable_audio_buffer>>& audio_samples_per_stream);
+	// Attached to the next frame that leaves the muxer.
+	void push(const std::shared_ptr<core::ancillary::AncillaryData>& ancillary);
+	// Moves all data out of ancillary, attached to the next frame that leaves the muxer.
+	void push(core::ancillary::AncillaryContainer& ancillary);
 
 	bool video_ready() const;
 	bool audio_ready() const;
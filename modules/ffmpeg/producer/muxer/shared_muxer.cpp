@@ -0,0 +1,365 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "../../StdAfx.h"
+
+#include "shared_muxer.h"
+
+#include "frame_muxer.h"
+
+#include "../decoder/shared_decoder.h"
+#include "../audio/audio_decoder.h"
+#include "../input/input.h"
+#include "../filter/audio_filter.h"
+#include "../util/fan_out.h"
+#include "../util/shared_registry.h"
+#include "../../ffmpeg_error.h"
+
+#include <common/except.h>
+#include <common/log.h>
+#include <common/utf.h>
+
+#include <core/frame/audio_channel_layout.h>
+#include <core/frame/frame_factory.h>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/range/algorithm/count_if.hpp>
+
+#include <map>
+#include <mutex>
+
+#if defined(_MSC_VER)
+#pragma warning (push)
+#pragma warning (disable : 4244)
+#endif
+extern "C"
+{
+	#define __STDC_CONSTANT_MACROS
+	#define __STDC_LIMIT_MACROS
+	#include <libavformat/avformat.h>
+	#include <libavutil/channel_layout.h>
+}
+#if defined(_MSC_VER)
+#pragma warning (pop)
+#endif
+
+namespace caspar { namespace ffmpeg {
+
+struct shared_muxer::impl : boost::noncopyable
+{
+	struct entry
+	{
+		core::draw_frame	frame;
+		uint32_t			file_frame_number;
+	};
+
+	const std::shared_ptr<shared_decoder>			decoder_;
+	const int										decoder_subscriber_;
+	const boost::rational<int>						in_framerate_;
+	std::unique_ptr<frame_muxer>					muxer_;
+
+	mutable std::mutex								mutex_;
+	int												next_subscriber_	= 0;
+	std::map<int, const core::frame_factory*>		frame_factories_;
+	fan_out<entry>									frames_;
+	uint32_t										file_frame_number_	= 0;
+
+	impl(
+			const std::shared_ptr<shared_decoder>& decoder,
+			int decoder_subscriber,
+			const spl::shared_ptr<core::frame_factory>& frame_factory,
+			const core::video_format_desc& format_desc,
+			const std::wstring& filter,
+			const std::wstring& custom_channel_order,
+			bool thumbnail_mode)
+		: decoder_(decoder)
+		, decoder_subscriber_(decoder_subscriber)
+		, in_framerate_(read_framerate(*decoder_->input().context(), format_desc.framerate))
+	{
+		try
+		{
+			auto channel_layout = core::audio_channel_layout::invalid();
+			std::vector<audio_input_pad> audio_input_pads;
+
+			auto& audio_decoders = decoder_->audio();
+
+			if (!thumbnail_mode)
+			{
+				for (auto& audio_decoder : audio_decoders)
+				{
+					audio_input_pads.emplace_back(
+							boost::rational<int>(1, format_desc.audio_sample_rate),
+							format_desc.audio_sample_rate,
+							AVSampleFormat::AV_SAMPLE_FMT_S32,
+							audio_decoder->ffmpeg_channel_layout());
+				}
+
+				if (audio_decoders.size() == 1)
+				{
+					channel_layout = get_audio_channel_layout(
+							audio_decoders.at(0)->num_channels(),
+							audio_decoders.at(0)->ffmpeg_channel_layout(),
+							custom_channel_order);
+				}
+				else if (audio_decoders.size() > 1)
+				{
+					auto num_channels = 0;
+					for (auto& dec : audio_decoders) {
+						num_channels += dec->num_channels();
+					}
+					auto ffmpeg_channel_layout = av_get_default_channel_layout(num_channels);
+
+					channel_layout = get_audio_channel_layout(
+							num_channels,
+							ffmpeg_channel_layout,
+							custom_channel_order);
+				}
+			}
+
+			if (!decoder_->video() && audio_decoders.empty())
+				CASPAR_THROW_EXCEPTION(averror_stream_not_found() << msg_info("No streams found"));
+
+			muxer_.reset(new frame_muxer(in_framerate_, std::move(audio_input_pads), frame_factory, format_desc, channel_layout, filter, true));
+		}
+		catch (...)
+		{
+			decoder_->unsubscribe(decoder_subscriber_);
+			throw;
+		}
+	}
+
+	~impl()
+	{
+		decoder_->unsubscribe(decoder_subscriber_);
+	}
+
+	int subscribe(const core::frame_factory& frame_factory)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		if (!frames_.open())
+			CASPAR_THROW_EXCEPTION(invalid_operation() << msg_info(print() + L" Closed for subscribers."));
+
+		frames_.subscribe(next_subscriber_);
+		frame_factories_[next_subscriber_] = &frame_factory;
+
+		return next_subscriber_++;
+	}
+
+	void unsubscribe(int subscriber)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		frames_.unsubscribe(subscriber);
+		frame_factories_.erase(subscriber);
+	}
+
+	int num_subscribers() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		return frames_.num_subscribers();
+	}
+
+	bool has_subscriber_on(const core::frame_factory& frame_factory) const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		for (auto& subscriber : frame_factories_)
+		{
+			if (subscriber.second == &frame_factory)
+				return true;
+		}
+
+		return false;
+	}
+
+	void close_for_subscribers()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		frames_.close();
+	}
+
+	bool open_for_subscribers() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		return frames_.open();
+	}
+
+	bool poll(int subscriber, core::draw_frame& frame, uint32_t& file_frame_number)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		if (frames_.overflowed(subscriber))
+			return false;
+
+		if (frames_.empty(subscriber))
+			mux();
+
+		entry next;
+
+		if (!frames_.pop(subscriber, next))
+			return false;
+
+		frame				= std::move(next.frame);
+		file_frame_number	= next.file_frame_number;
+
+		return true;
+	}
+
+	bool overflowed(int subscriber) const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		return frames_.overflowed(subscriber) || decoder_->overflowed(decoder_subscriber_);
+	}
+
+	bool eof(int subscriber) const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		return decoder_->eof(decoder_subscriber_) && frames_.empty(subscriber);
+	}
+
+	void mux()
+	{
+		std::shared_ptr<AVFrame>		video;
+		shared_decoder::ancillary_data	ancillary;
+		shared_decoder::audio_buffers	audio;
+		uint32_t						file_frame_number = file_frame_number_;
+
+		decoder_->poll(
+				decoder_subscriber_,
+				decoder_->video() && !muxer_->video_ready(),
+				!muxer_->audio_ready(),
+				video,
+				file_frame_number,
+				ancillary,
+				audio);
+
+		if (video)
+			file_frame_number_ = file_frame_number;
+
+		for (auto& data : ancillary)
+			muxer_->push(data);
+
+		muxer_->push(video);
+		muxer_->push(audio);
+
+		if (decoder_->audio().empty())
+		{
+			if (video == flush_video())
+				muxer_->push({ flush_audio() });
+			else if (!muxer_->audio_ready())
+				muxer_->push({ empty_audio() });
+		}
+
+		if (!decoder_->video())
+		{
+			if (boost::count_if(audio, [](std::shared_ptr<core::mutable_audio_buffer> a) { return a == flush_audio(); }) > 0)
+				muxer_->push(flush_video());
+			else if (!muxer_->video_ready())
+				muxer_->push(empty_video());
+		}
+
+		for (auto frame = muxer_->poll(); frame != core::draw_frame::empty(); frame = muxer_->poll())
+			frames_.push(entry { std::move(frame), file_frame_number_ });
+	}
+
+	std::wstring print() const
+	{
+		return L"shared_muxer[" + decoder_->print() + L"]";
+	}
+};
+
+shared_muxer::shared_muxer(
+		const std::shared_ptr<shared_decoder>& decoder,
+		int decoder_subscriber,
+		const spl::shared_ptr<core::frame_factory>& frame_factory,
+		const core::video_format_desc& format_desc,
+		const std::wstring& filter,
+		const std::wstring& custom_channel_order,
+		bool thumbnail_mode)
+	: impl_(new impl(decoder, decoder_subscriber, frame_factory, format_desc, filter, custom_channel_order, thumbnail_mode))
+{
+}
+shared_muxer::~shared_muxer() {}
+int shared_muxer::subscribe(const core::frame_factory& frame_factory) { return impl_->subscribe(frame_factory); }
+void shared_muxer::unsubscribe(int subscriber) { impl_->unsubscribe(subscriber); }
+int shared_muxer::num_subscribers() const { return impl_->num_subscribers(); }
+bool shared_muxer::has_subscriber_on(const core::frame_factory& frame_factory) const { return impl_->has_subscriber_on(frame_factory); }
+void shared_muxer::close_for_subscribers() { impl_->close_for_subscribers(); }
+bool shared_muxer::open_for_subscribers() const { return impl_->open_for_subscribers(); }
+bool shared_muxer::poll(int subscriber, core::draw_frame& frame, uint32_t& file_frame_number) { return impl_->poll(subscriber, frame, file_frame_number); }
+bool shared_muxer::overflowed(int subscriber) const { return impl_->overflowed(subscriber); }
+bool shared_muxer::eof(int subscriber) const { return impl_->eof(subscriber); }
+const std::shared_ptr<shared_decoder>& shared_muxer::decoder() const { return impl_->decoder_; }
+boost::rational<int> shared_muxer::in_framerate() const { return impl_->in_framerate_; }
+boost::rational<int> shared_muxer::out_framerate() const { return impl_->muxer_->out_framerate(); }
+uint32_t shared_muxer::calc_nb_frames(uint32_t nb_frames) const { return impl_->muxer_->calc_nb_frames(nb_frames); }
+std::wstring shared_muxer::print() const { return impl_->print(); }
+
+std::shared_ptr<shared_muxer> open_shared_muxer(
+		const spl::shared_ptr<diagnostics::graph>& graph,
+		const spl::shared_ptr<core::frame_factory>& frame_factory,
+		const core::video_format_desc& format_desc,
+		const std::wstring& url_or_file,
+		const std::wstring& filter,
+		bool loop,
+		uint32_t in,
+		uint32_t out,
+		const std::wstring& custom_channel_order,
+		const ffmpeg_options& vid_params,
+		int& subscriber)
+{
+	static shared_registry<shared_muxer> muxers;
+
+	auto key = url_or_file
+			+ L"|" + boost::lexical_cast<std::wstring>(loop)
+			+ L"|" + boost::lexical_cast<std::wstring>(in)
+			+ L"|" + boost::lexical_cast<std::wstring>(out)
+			+ L"|" + format_desc.name
+			+ L"|" + filter
+			+ L"|" + custom_channel_order;
+
+	for (auto& option : vid_params)
+		key += L"|" + u16(option.first) + L"=" + u16(option.second);
+
+	return muxers.join_or_create(key, [&](shared_muxer& muxer)
+	{
+		if (muxer.has_subscriber_on(*frame_factory))
+			return false;
+
+		subscriber = muxer.subscribe(*frame_factory);
+		CASPAR_LOG(info) << muxer.print() << L" Shared with " << muxer.num_subscribers() << L" subscribers.";
+		return true;
+	},
+	[&]
+	{
+		int decoder_subscriber;
+		auto decoder	= open_shared_decoder(graph, url_or_file, loop, in, out, vid_params, format_desc.audio_sample_rate, decoder_subscriber);
+		auto muxer		= std::make_shared<shared_muxer>(decoder, decoder_subscriber, frame_factory, format_desc, filter, custom_channel_order, false);
+		subscriber		= muxer->subscribe(*frame_factory);
+		return muxer;
+	});
+}
+
+}}
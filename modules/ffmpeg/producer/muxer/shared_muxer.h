@@ -0,0 +1,123 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "../util/util.h"
+
+#include <common/memory.h>
+
+#include <core/frame/draw_frame.h>
+#include <core/fwd.h>
+#include <core/video_format.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/rational.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace caspar {
+
+namespace diagnostics {
+
+class graph;
+
+}
+
+namespace ffmpeg {
+
+class shared_decoder;
+
+/**
+ * Runs one frame_muxer on a subscription to a shared decoder, on behalf of
+ * any number of producers with the same video format, filter and audio
+ * channel layout. The filters and the conversion to the video format run
+ * once, and every subscriber gets its own copy of each draw_frame.
+ *
+ * Subscribers can only join while the muxer is still at its start, like
+ * with shared_decoder.
+ */
+class shared_muxer : boost::noncopyable
+{
+public:
+	// Takes over the subscription to decoder.
+	shared_muxer(
+			const std::shared_ptr<shared_decoder>& decoder,
+			int decoder_subscriber,
+			const spl::shared_ptr<core::frame_factory>& frame_factory,
+			const core::video_format_desc& format_desc,
+			const std::wstring& filter,
+			const std::wstring& custom_channel_order,
+			bool thumbnail_mode);
+	~shared_muxer();
+
+	int							subscribe(const core::frame_factory& frame_factory);
+	void						unsubscribe(int subscriber);
+	int							num_subscribers() const;
+
+	// Producers on the same channel share its frame factory. The audio mixer
+	// of a channel tells the streams apart by the tag of their frames, which
+	// is the same for all frames of a muxer, so they must not share a muxer.
+	bool						has_subscriber_on(const core::frame_factory& frame_factory) const;
+
+	// Stops new subscribers from joining, see shared_decoder.
+	void						close_for_subscribers();
+	bool						open_for_subscribers() const;
+
+	// Moves the next frame of the subscriber to frame, muxing more when its
+	// queue is empty. False when there is no frame yet.
+	bool						poll(int subscriber, core::draw_frame& frame, uint32_t& file_frame_number);
+
+	// True when the subscriber or the muxer fell so far behind that frames
+	// were dropped. The subscriber needs a muxer of its own to continue.
+	bool						overflowed(int subscriber) const;
+	bool						eof(int subscriber) const;
+
+	const std::shared_ptr<shared_decoder>& decoder() const;
+	boost::rational<int>		in_framerate() const;
+	boost::rational<int>		out_framerate() const;
+	uint32_t					calc_nb_frames(uint32_t nb_frames) const;
+
+	std::wstring				print() const;
+private:
+	struct impl;
+	spl::unique_ptr<impl> impl_;
+};
+
+/**
+ * Subscribes to a shared muxer of the same clip, video format, filter and
+ * channel layout on another channel if one is still open for subscribers,
+ * or creates and registers a new one on a shared decoder of the clip.
+ */
+std::shared_ptr<shared_muxer> open_shared_muxer(
+		const spl::shared_ptr<diagnostics::graph>& graph,
+		const spl::shared_ptr<core::frame_factory>& frame_factory,
+		const core::video_format_desc& format_desc,
+		const std::wstring& url_or_file,
+		const std::wstring& filter,
+		bool loop,
+		uint32_t in,
+		uint32_t out,
+		const std::wstring& custom_channel_order,
+		const ffmpeg_options& vid_params,
+		int& subscriber);
+
+}}
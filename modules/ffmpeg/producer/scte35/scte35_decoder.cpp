@@ -0,0 +1,190 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "../../StdAfx.h"
+
+#include "scte35_decoder.h"
+
+#include <core/ancillary/scte/scte35.h>
+
+#include <common/log.h>
+
+#include <boost/optional.hpp>
+
+#include <algorithm>
+#include <deque>
+#include <set>
+
+#if defined(_MSC_VER)
+#pragma warning (push)
+#pragma warning (disable : 4244)
+#endif
+extern "C"
+{
+	#define __STDC_CONSTANT_MACROS
+	#define __STDC_LIMIT_MACROS
+	#include <libavformat/avformat.h>
+	#include <libavutil/frame.h>
+}
+#if defined(_MSC_VER)
+#pragma warning (pop)
+#endif
+
+namespace caspar { namespace ffmpeg {
+
+namespace {
+
+const uint64_t	PTS_MASK	= (1ULL << 33) - 1;
+const AVRational MPEG_TIME_BASE = { 1, 90000 };
+
+// Cues are dropped oldest first if no video frame has been presented for this many of them.
+const size_t	MAX_PENDING	= 64;
+
+// Whether the 33 bit timestamp a lies at or after b, allowing for a single wrap in between.
+bool at_or_after(uint64_t a, uint64_t b)
+{
+	return ((a - b) & PTS_MASK) < (1ULL << 32);
+}
+
+}
+
+struct scte35_decoder::implementation : boost::noncopyable
+{
+	struct cue
+	{
+		core::ancillary::scte35::splice_info	info;
+		boost::optional<uint64_t>				arrival;
+	};
+
+	const spl::shared_ptr<AVFormatContext>	context_;
+	const int								video_stream_index_;
+	std::set<int>							stream_indices_;
+	std::deque<cue>							pending_;
+
+	implementation(const spl::shared_ptr<AVFormatContext>& context, int video_stream_index)
+		: context_(context)
+		, video_stream_index_(video_stream_index)
+	{
+		for (unsigned stream_index = 0; stream_index < context_->nb_streams; ++stream_index)
+		{
+			if (context_->streams[stream_index]->codec->codec_id == AV_CODEC_ID_SCTE_35)
+				stream_indices_.insert(static_cast<int>(stream_index));
+		}
+	}
+
+	boost::optional<uint64_t> to_mpeg_time(int64_t timestamp, int stream_index) const
+	{
+		if (timestamp == AV_NOPTS_VALUE)
+			return boost::none;
+
+		auto rescaled = av_rescale_q(timestamp, context_->streams[stream_index]->time_base, MPEG_TIME_BASE);
+
+		return static_cast<uint64_t>(rescaled) & PTS_MASK;
+	}
+
+	void push(const std::shared_ptr<AVPacket>& packet)
+	{
+		if (!packet)
+			return;
+
+		if (packet->data == nullptr)
+		{
+			// Seek or loop, whatever was announced belongs to the old position.
+			pending_.clear();
+			return;
+		}
+
+		if (stream_indices_.find(packet->stream_index) == stream_indices_.end())
+			return;
+
+		cue c;
+
+		if (!core::ancillary::scte35::parse(packet->data, static_cast<size_t>(packet->size), c.info))
+		{
+			CASPAR_LOG(debug) << print() << L" Ignoring unsupported or corrupt splice_info_section.";
+			return;
+		}
+
+		c.arrival = to_mpeg_time(packet->pts, packet->stream_index);
+
+		pending_.push_back(std::move(c));
+
+		if (pending_.size() > MAX_PENDING)
+			pending_.pop_front();
+	}
+
+	ancillary_data poll(const AVFrame& video_frame)
+	{
+		ancillary_data result;
+
+		if (pending_.empty())
+			return result;
+
+		auto frame_pts = to_mpeg_time(video_frame.best_effort_timestamp, video_stream_index_);
+
+		while (!pending_.empty())
+		{
+			auto& c = pending_.front();
+
+			if (frame_pts && c.arrival && !at_or_after(*frame_pts, *c.arrival))
+				break;
+
+			uint16_t pre_roll = 0;
+			auto splice_pts = core::ancillary::scte35::splice_pts(c.info);
+
+			if (frame_pts && splice_pts && at_or_after(*splice_pts, *frame_pts))
+			{
+				auto milliseconds = ((*splice_pts - *frame_pts) & PTS_MASK) / 90;
+				pre_roll = static_cast<uint16_t>(std::min<uint64_t>(milliseconds, 0xFFFF));
+			}
+
+			auto message = core::ancillary::scte35::to_scte104(c.info, pre_roll);
+
+			if (message)
+				result.push_back(std::move(message));
+
+			pending_.pop_front();
+		}
+
+		return result;
+	}
+
+	std::wstring print() const
+	{
+		return L"[scte35-decoder]";
+	}
+};
+
+scte35_decoder::scte35_decoder(const spl::shared_ptr<AVFormatContext>& context, int video_stream_index) : impl_(new implementation(context, video_stream_index)){}
+void scte35_decoder::push(const std::shared_ptr<AVPacket>& packet){impl_->push(packet);}
+scte35_decoder::ancillary_data scte35_decoder::poll(const AVFrame& video_frame){return impl_->poll(video_frame);}
+std::wstring scte35_decoder::print() const{return impl_->print();}
+
+bool scte35_decoder::has_streams(const AVFormatContext& context)
+{
+	for (unsigned stream_index = 0; stream_index < context.nb_streams; ++stream_index)
+	{
+		if (context.streams[stream_index]->codec->codec_id == AV_CODEC_ID_SCTE_35)
+			return true;
+	}
+
+	return false;
+}
+
+}}
@@ -0,0 +1,174 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "../../StdAfx.h"
+
+#include "st2038_decoder.h"
+
+#include <core/ancillary/st2038.h>
+#include <core/ancillary/vanc_decoder.h>
+
+#include <common/log.h>
+
+#include <deque>
+#include <set>
+
+#if defined(_MSC_VER)
+#pragma warning (push)
+#pragma warning (disable : 4244)
+#endif
+extern "C"
+{
+	#define __STDC_CONSTANT_MACROS
+	#define __STDC_LIMIT_MACROS
+	#include <libavformat/avformat.h>
+	#include <libavutil/frame.h>
+}
+#if defined(_MSC_VER)
+#pragma warning (pop)
+#endif
+
+namespace caspar { namespace ffmpeg {
+
+namespace {
+
+// Access units are dropped oldest first if no video frame has been presented for this many of them.
+const size_t	MAX_PENDING	= 64;
+
+// ST 2038 is private data, which is demuxed as binary data. Only the 'VANC' registration descriptor, which the
+// MPEG-TS demuxer stores as the codec tag, tells it apart from other private data.
+bool is_st2038_stream(const AVStream& stream)
+{
+	return stream.codec->codec_type == AVMEDIA_TYPE_DATA
+		&& stream.codec->codec_id == AV_CODEC_ID_BIN_DATA
+		&& stream.codec->codec_tag == MKTAG('V', 'A', 'N', 'C');
+}
+
+}
+
+struct st2038_decoder::implementation : boost::noncopyable
+{
+	struct access_unit
+	{
+		int64_t											pts;// In the time base of the video stream
+		std::vector<core::ancillary::st2038::packet>	packets;
+	};
+
+	const spl::shared_ptr<AVFormatContext>	context_;
+	const int								video_stream_index_;
+	int64_t									tolerance_			= 0;
+	std::set<int>							stream_indices_;
+	std::deque<access_unit>					pending_;
+	core::ancillary::VancDecoder			vanc_decoder_;
+
+	implementation(const spl::shared_ptr<AVFormatContext>& context, int video_stream_index)
+		: context_(context)
+		, video_stream_index_(video_stream_index)
+	{
+		for (unsigned stream_index = 0; stream_index < context_->nb_streams; ++stream_index)
+		{
+			if (is_st2038_stream(*context_->streams[stream_index]))
+				stream_indices_.insert(static_cast<int>(stream_index));
+		}
+
+		// Half a frame, so that rounding of the data timestamps does not move packets to the next frame.
+		auto video_stream = context_->streams[video_stream_index_];
+
+		if (video_stream->avg_frame_rate.num > 0)
+			tolerance_ = av_rescale_q(1, av_inv_q(video_stream->avg_frame_rate), video_stream->time_base) / 2;
+	}
+
+	void push(const std::shared_ptr<AVPacket>& packet)
+	{
+		if (!packet)
+			return;
+
+		if (packet->data == nullptr)
+		{
+			// Seek or loop, the pending packets belong to the old position.
+			pending_.clear();
+			return;
+		}
+
+		if (stream_indices_.find(packet->stream_index) == stream_indices_.end())
+			return;
+
+		access_unit unit;
+
+		unit.pts = packet->pts == AV_NOPTS_VALUE
+				? AV_NOPTS_VALUE
+				: av_rescale_q(packet->pts, context_->streams[packet->stream_index]->time_base, context_->streams[video_stream_index_]->time_base);
+
+		if (!core::ancillary::st2038::parse(packet->data, static_cast<size_t>(packet->size), unit.packets))
+			CASPAR_LOG(debug) << print() << L" Ignoring corrupt ANC data packet.";
+
+		if (unit.packets.empty())
+			return;
+
+		pending_.push_back(std::move(unit));
+
+		if (pending_.size() > MAX_PENDING)
+			pending_.pop_front();
+	}
+
+	ancillary_data poll(const AVFrame& video_frame)
+	{
+		ancillary_data result;
+
+		auto frame_pts = video_frame.best_effort_timestamp;
+
+		while (!pending_.empty())
+		{
+			auto& unit = pending_.front();
+
+			if (frame_pts != AV_NOPTS_VALUE && unit.pts != AV_NOPTS_VALUE && unit.pts > frame_pts + tolerance_)
+				break;
+
+			for (auto& packet : unit.packets)
+				result.push_back(vanc_decoder_.decodePacket(packet.did, packet.sdid, packet.data.data(), packet.data.size()));
+
+			pending_.pop_front();
+		}
+
+		return result;
+	}
+
+	std::wstring print() const
+	{
+		return L"[st2038-decoder]";
+	}
+};
+
+st2038_decoder::st2038_decoder(const spl::shared_ptr<AVFormatContext>& context, int video_stream_index) : impl_(new implementation(context, video_stream_index)){}
+void st2038_decoder::push(const std::shared_ptr<AVPacket>& packet){impl_->push(packet);}
+st2038_decoder::ancillary_data st2038_decoder::poll(const AVFrame& video_frame){return impl_->poll(video_frame);}
+std::wstring st2038_decoder::print() const{return impl_->print();}
+
+bool st2038_decoder::has_streams(const AVFormatContext& context)
+{
+	for (unsigned stream_index = 0; stream_index < context.nb_streams; ++stream_index)
+	{
+		if (is_st2038_stream(*context.streams[stream_index]))
+			return true;
+	}
+
+	return false;
+}
+
+}}
@@ -0,0 +1,60 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <common/memory.h>
+
+#include <core/ancillary/ancillary.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <memory>
+#include <vector>
+
+struct AVFormatContext;
+struct AVFrame;
+struct AVPacket;
+
+namespace caspar { namespace ffmpeg {
+
+/**
+ * Reads SMPTE ST 2038 ancillary data from the data streams of a file, as
+ * written by the ffmpeg consumer. The packets of an access unit are attached
+ * to the video frame that is presented at the PTS of the access unit.
+ */
+class st2038_decoder : boost::noncopyable
+{
+public:
+	typedef std::vector<std::shared_ptr<core::ancillary::AncillaryData>> ancillary_data;
+
+	explicit st2038_decoder(const spl::shared_ptr<AVFormatContext>& context, int video_stream_index);
+
+	static bool					has_streams(const AVFormatContext& context);
+
+	void						push(const std::shared_ptr<AVPacket>& packet);
+	ancillary_data				poll(const AVFrame& video_frame);
+
+	std::wstring				print() const;
+private:
+	struct implementation;
+	spl::shared_ptr<implementation> impl_;
+};
+
+}}
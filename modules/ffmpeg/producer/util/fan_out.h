@@ -0,0 +1,163 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <common/except.h>
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <map>
+
+namespace caspar { namespace ffmpeg {
+
+// How much is pushed before subscribers can no longer join.
+static const std::size_t DEFAULT_MAX_HISTORY = 25;
+// How far a subscriber may fall behind.
+static const std::size_t DEFAULT_MAX_BACKLOG = 50;
+
+/**
+ * Hands every entry pushed to each subscriber, which take them at their own
+ * pace. Subscribers can join until more than max_history entries have been
+ * pushed, and get those entries first. A subscriber that falls max_backlog
+ * entries behind has its backlog dropped and is marked as overflowed.
+ *
+ * Not thread safe, the owner serializes the calls.
+ */
+template<typename T>
+class fan_out
+{
+public:
+	// Makes the copy of an entry that a subscriber gets.
+	typedef std::function<T (const T&)> copier;
+
+	fan_out(
+			copier copy = [](const T& entry) { return entry; },
+			std::size_t max_history = DEFAULT_MAX_HISTORY,
+			std::size_t max_backlog = DEFAULT_MAX_BACKLOG)
+		: copy_(std::move(copy))
+		, max_history_(max_history)
+		, max_backlog_(max_backlog)
+	{
+	}
+
+	void subscribe(int subscriber)
+	{
+		if (!open_)
+			CASPAR_THROW_EXCEPTION(invalid_operation() << msg_info("Closed for subscribers."));
+
+		auto& queue = subscribers_[subscriber];
+
+		for (auto& entry : history_)
+			queue.entries.push_back(copy_(entry));
+	}
+
+	void unsubscribe(int subscriber)
+	{
+		subscribers_.erase(subscriber);
+	}
+
+	int num_subscribers() const
+	{
+		return static_cast<int>(subscribers_.size());
+	}
+
+	bool open() const
+	{
+		return open_;
+	}
+
+	void close()
+	{
+		open_ = false;
+		history_.clear();
+	}
+
+	void push(const T& entry)
+	{
+		for (auto& subscriber : subscribers_)
+		{
+			auto& queue = subscriber.second;
+
+			if (queue.overflowed)
+				continue;
+
+			if (queue.entries.size() >= max_backlog_)
+			{
+				queue.overflowed = true;
+				queue.entries.clear();
+				continue;
+			}
+
+			queue.entries.push_back(copy_(entry));
+		}
+
+		if (!open_)
+			return;
+
+		history_.push_back(entry);
+
+		if (history_.size() > max_history_)
+			close();
+	}
+
+	// Moves the subscriber's next entry to entry, false when it has none.
+	bool pop(int subscriber, T& entry)
+	{
+		auto it = subscribers_.find(subscriber);
+
+		if (it == subscribers_.end() || it->second.entries.empty())
+			return false;
+
+		entry = std::move(it->second.entries.front());
+		it->second.entries.pop_front();
+
+		return true;
+	}
+
+	bool empty(int subscriber) const
+	{
+		auto it = subscribers_.find(subscriber);
+
+		return it == subscribers_.end() || it->second.entries.empty();
+	}
+
+	bool overflowed(int subscriber) const
+	{
+		auto it = subscribers_.find(subscriber);
+
+		return it != subscribers_.end() && it->second.overflowed;
+	}
+private:
+	struct queue
+	{
+		std::deque<T>	entries;
+		bool			overflowed	= false;
+	};
+
+	const copier			copy_;
+	const std::size_t		max_history_;
+	const std::size_t		max_backlog_;
+	std::map<int, queue>	subscribers_;
+	std::deque<T>			history_;
+	bool					open_		= true;
+};
+
+}}
@@ -0,0 +1,104 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <common/except.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace caspar { namespace ffmpeg {
+
+/**
+ * Shared objects by key, for as long as they are alive and open for
+ * subscribers. T has open_for_subscribers().
+ */
+template<typename T>
+class shared_registry : boost::noncopyable
+{
+public:
+	// Returns the object registered under key if join accepts it. Otherwise
+	// registers and returns the object create returns. join may throw
+	// invalid_operation when the object was closed after it was found.
+	std::shared_ptr<T> join_or_create(
+			const std::wstring& key,
+			const std::function<bool (T&)>& join,
+			const std::function<std::shared_ptr<T> ()>& create)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		remove_closed();
+
+		auto it = objects_.find(key);
+
+		if (it != objects_.end())
+		{
+			auto object = it->second.lock();
+
+			try
+			{
+				if (object && join(*object))
+					return object;
+			}
+			catch (invalid_operation&)
+			{
+				// Closed between remove_closed() and now.
+			}
+		}
+
+		auto object = create();
+		objects_[key] = object;
+
+		return object;
+	}
+
+	// The number of objects that can still be joined.
+	int size()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		remove_closed();
+
+		return static_cast<int>(objects_.size());
+	}
+private:
+	void remove_closed()
+	{
+		for (auto it = objects_.begin(); it != objects_.end();)
+		{
+			auto object = it->second.lock();
+
+			if (!object || !object->open_for_subscribers())
+				it = objects_.erase(it);
+			else
+				++it;
+		}
+	}
+
+	std::mutex									mutex_;
+	std::map<std::wstring, std::weak_ptr<T>>	objects_;
+};
+
+}}
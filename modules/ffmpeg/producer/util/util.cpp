@@ -75,6 +75,17 @@ core::field_mode get_mode(const AVFrame& frame)
 	return frame.top_field_first ? core::field_mode::upper : core::field_mode::lower;
 }
 
+std::vector<std::uint8_t> get_a53_captions(const AVFrame& frame)
+{
+	// cc_data triplets exported by the mpeg2video and h264 decoders from the ATSC A/53 user data.
+	auto side_data = av_frame_get_side_data(&frame, AV_FRAME_DATA_A53_CC);
+
+	if (!side_data || side_data->size < 3)
+		return std::vector<std::uint8_t>();
+
+	return std::vector<std::uint8_t>(side_data->data, side_data->data + side_data->size - side_data->size % 3);
+}
+
 core::pixel_format get_pixel_format(AVPixelFormat pix_fmt)
 {
 	switch(pix_fmt)
@@ -61,6 +61,7 @@ typedef std::vector<std::pair<std::string, std::string>> ffmpeg_options;
 // Utils
 
 core::field_mode					get_mode(const AVFrame& frame);
+std::vector<std::uint8_t>			get_a53_captions(const AVFrame& frame);
 core::mutable_frame					make_frame(const void* tag, const spl::shared_ptr<AVFrame>& decoded_frame, core::frame_factory& frame_factory, const core::audio_channel_layout& channel_layout);
 spl::shared_ptr<AVFrame>			make_av_frame(core::mutable_frame& frame);
 spl::shared_ptr<AVFrame>			make_av_frame(std::array<uint8_t*, 4> data, const core::pixel_format_desc& pix_desc);
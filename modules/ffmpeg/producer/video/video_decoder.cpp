@@ -171,6 +171,7 @@ bool video_decoder::ready() const{return impl_->ready();}
 bool video_decoder::empty() const { return impl_->empty(); }
 int video_decoder::width() const{return impl_->width_;}
 int video_decoder::height() const{return impl_->height_;}
+int video_decoder::stream_index() const{return impl_->index_;}
 uint32_t video_decoder::nb_frames() const{return impl_->nb_frames();}
 uint32_t video_decoder::file_frame_number() const{return static_cast<uint32_t>(impl_->file_frame_number_);}
 bool	video_decoder::is_progressive() const{return impl_->is_progressive_;}
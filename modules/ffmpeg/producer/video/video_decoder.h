@@ -51,6 +51,7 @@ public:
 	int							width() const;
 	int							height() const;
 
+	int							stream_index() const;
 	uint32_t					nb_frames() const;
 	uint32_t					file_frame_number() const;
 	bool						is_progressive() const;
@@ -20,6 +20,7 @@
 */
 
 #include "html_producer.h"
+#include "../util/dirty_rect_compositor.h"
 
 #include <core/video_format.h>
 
@@ -51,6 +52,8 @@
 
 #include <tbb/concurrent_queue.h>
 
+#include <atomic>
+#include <memory>
 #include <mutex>
 
 #pragma warning(push)
@@ -94,6 +97,13 @@ class html_client
 	core::draw_frame						last_progressive_frame_;
 	mutable std::mutex					    last_frame_mutex_;
 
+	std::unique_ptr<dirty_rect_compositor>	compositor_;
+	core::draw_frame						base_frame_;
+	std::vector<core::draw_frame>			patch_frames_;
+	std::atomic<std::int64_t>				paint_count_;
+	std::atomic<std::int64_t>				full_paint_count_;
+	std::atomic<std::int64_t>				copied_bytes_;
+
 	CefRefPtr<CefBrowser>					browser_;
 
 	executor								executor_;
@@ -115,11 +125,15 @@ public:
 		graph_->set_color("tick-time", diagnostics::color(0.0f, 0.6f, 0.9f));
 		graph_->set_color("dropped-frame", diagnostics::color(0.3f, 0.6f, 0.3f));
 		graph_->set_color("browser-dropped-frame", diagnostics::color(0.6f, 0.1f, 0.1f));
+		graph_->set_color("full-paint", diagnostics::color(0.9f, 0.9f, 0.3f));
 		graph_->set_text(print());
 		diagnostics::register_graph(graph_);
 
 		loaded_ = false;
 		removed_ = false;
+		paint_count_ = 0;
+		full_paint_count_ = 0;
+		copied_bytes_ = 0;
 		executor_.begin_invoke([&]{ update(); });
 	}
 
@@ -195,6 +209,21 @@ public:
 		return removed_;
 	}
 
+	std::int64_t paint_count() const
+	{
+		return paint_count_;
+	}
+
+	std::int64_t full_paint_count() const
+	{
+		return full_paint_count_;
+	}
+
+	std::int64_t copied_bytes() const
+	{
+		return copied_bytes_;
+	}
+
 private:
 
 	bool GetViewRect(CefRefPtr<CefBrowser> browser, CefRect &rect)
@@ -223,17 +252,12 @@ private:
 		if (type != PET_VIEW)
 			return;
 
-		core::pixel_format_desc pixel_desc;
-		pixel_desc.format = core::pixel_format::bgra;
-		pixel_desc.planes.push_back(core::pixel_format_desc::plane(width, height, 4));
-
-		auto frame = frame_factory_->create_frame(this, pixel_desc, core::audio_channel_layout::invalid());
-		std::memcpy(frame.image_data().begin(), buffer, width * height * 4);
+		auto frame = composite(static_cast<const std::uint8_t*>(buffer), width, height, dirtyRects);
 
 		{
             std::lock_guard<std::mutex> lock(frames_mutex_);
 
-			frames_.push(core::draw_frame(std::move(frame)));
+			frames_.push(std::move(frame));
 
 			size_t max_in_queue = format_desc_.field_count + 1;
 
@@ -245,6 +269,78 @@ private:
 		}
 	}
 
+	core::draw_frame composite(const std::uint8_t* buffer, int width, int height, const RectList& dirty_rects)
+	{
+		if (!compositor_ || compositor_->width() != width || compositor_->height() != height)
+		{
+			compositor_.reset(new dirty_rect_compositor(width, height));
+			base_frame_ = core::draw_frame::empty();
+			patch_frames_.clear();
+		}
+
+		std::vector<dirty_rect> rects;
+		for (auto& rect : dirty_rects)
+			rects.push_back(dirty_rect { rect.x, rect.y, rect.width, rect.height });
+
+		auto update = compositor_->paint(buffer, std::move(rects));
+
+		++paint_count_;
+
+		if (update.full || base_frame_ == core::draw_frame::empty())
+		{
+			core::pixel_format_desc pixel_desc;
+			pixel_desc.format = core::pixel_format::bgra;
+			pixel_desc.planes.push_back(core::pixel_format_desc::plane(width, height, 4));
+
+			auto frame = frame_factory_->create_frame(this, pixel_desc, core::audio_channel_layout::invalid());
+			dirty_rect_compositor::copy_image(buffer, frame.image_data().size(), frame.image_data().begin());
+
+			base_frame_ = core::draw_frame(std::move(frame));
+			patch_frames_.clear();
+
+			++full_paint_count_;
+			copied_bytes_ += static_cast<std::int64_t>(width) * height * 4;
+			graph_->set_tag(diagnostics::tag_severity::SILENT, "full-paint");
+
+			return base_frame_;
+		}
+
+		// The previous frame is shared as is, already uploaded. Only the
+		// changed regions are copied and drawn on top of it.
+		for (auto& rect : update.patches)
+		{
+			core::pixel_format_desc pixel_desc;
+			pixel_desc.format = core::pixel_format::bgra;
+			pixel_desc.planes.push_back(core::pixel_format_desc::plane(rect.width, rect.height, 4));
+
+			auto frame = frame_factory_->create_frame(this, pixel_desc, core::audio_channel_layout::invalid());
+			dirty_rect_compositor::copy_rect(buffer, width, rect, frame.image_data().begin());
+
+			core::draw_frame patch(std::move(frame));
+			patch.transform().image_transform.fill_translation[0]	= static_cast<double>(rect.x) / width;
+			patch.transform().image_transform.fill_translation[1]	= static_cast<double>(rect.y) / height;
+			patch.transform().image_transform.fill_scale[0]			= static_cast<double>(rect.width) / width;
+			patch.transform().image_transform.fill_scale[1]			= static_cast<double>(rect.height) / height;
+			patch_frames_.push_back(std::move(patch));
+
+			copied_bytes_ += static_cast<std::int64_t>(rect.area()) * 4;
+		}
+
+		if (patch_frames_.empty())
+			return base_frame_;
+
+		std::vector<core::draw_frame> frames;
+		frames.push_back(base_frame_);
+		frames.insert(frames.end(), patch_frames_.begin(), patch_frames_.end());
+
+		// Drawn as one image, otherwise opacity, transitions and blend modes
+		// would let the stale base show through the patches.
+		core::draw_frame composite(std::move(frames));
+		composite.transform().image_transform.is_isolated = true;
+
+		return composite;
+	}
+
 	void OnAfterCreated(CefRefPtr<CefBrowser> browser) override
 	{
 		CASPAR_ASSERT(CefCurrentlyOn(TID_UI));
@@ -570,7 +666,13 @@ public:
 				return core::draw_frame::empty();
 			}
 
-			return client_->receive();
+			auto frame = client_->receive();
+
+			monitor_subject_	<< core::monitor::message("/paint/count")			% client_->paint_count()
+								<< core::monitor::message("/paint/full_count")		% client_->full_paint_count()
+								<< core::monitor::message("/paint/copied_bytes")	% client_->copied_bytes();
+
+			return frame;
 		}
 
 		return core::draw_frame::empty();
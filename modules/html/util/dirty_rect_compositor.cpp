@@ -0,0 +1,222 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dirty_rect_compositor.h"
+
+#include <tbb/parallel_for.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace caspar { namespace html {
+
+namespace {
+
+bool intersects(const dirty_rect& a, const dirty_rect& b)
+{
+	return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+dirty_rect bounds(const dirty_rect& a, const dirty_rect& b)
+{
+	auto left	= std::min(a.x, b.x);
+	auto top	= std::min(a.y, b.y);
+	auto right	= std::max(a.x + a.width, b.x + b.width);
+	auto bottom	= std::max(a.y + a.height, b.y + b.height);
+
+	return dirty_rect { left, top, right - left, bottom - top };
+}
+
+std::vector<dirty_rect> normalize(std::vector<dirty_rect> rects, int width, int height)
+{
+	std::vector<dirty_rect> result;
+
+	for (auto rect : rects)
+	{
+		// Not aligned or padded, unchanged pixels that aren't opaque can't be
+		// blended over themselves.
+		auto left	= std::max(0, rect.x);
+		auto top	= std::max(0, rect.y);
+		auto right	= std::min(width, rect.x + rect.width);
+		auto bottom	= std::min(height, rect.y + rect.height);
+
+		if (right <= left || bottom <= top)
+			continue;
+
+		dirty_rect clamped { left, top, right - left, bottom - top };
+
+		// Merge with everything it overlaps, until the result overlaps nothing.
+		for (auto it = result.begin(); it != result.end();)
+		{
+			if (intersects(*it, clamped))
+			{
+				clamped = bounds(*it, clamped);
+				result.erase(it);
+				it = result.begin();
+			}
+			else
+				++it;
+		}
+
+		result.push_back(clamped);
+	}
+
+	return result;
+}
+
+}
+
+struct dirty_rect_compositor::impl
+{
+	const int				width_;
+	const int				height_;
+	const int				max_patches_;
+	const double			max_patch_coverage_;
+
+	// Mirrors what the consumer of the updates currently shows. Large updates
+	// invalidate it rather than copying everything twice, the next small
+	// update refreshes it.
+	std::vector<std::uint8_t>	shadow_;
+	bool						shadow_valid_	= false;
+	int							patch_count_	= 0;
+
+	impl(int width, int height, int max_patches, double max_patch_coverage)
+		: width_(width)
+		, height_(height)
+		, max_patches_(max_patches)
+		, max_patch_coverage_(max_patch_coverage)
+		, shadow_(static_cast<std::size_t>(width) * height * 4)
+	{
+	}
+
+	update paint(const std::uint8_t* image, std::vector<dirty_rect> dirty_rects)
+	{
+		auto rects = normalize(std::move(dirty_rects), width_, height_);
+
+		update result;
+
+		if (rects.empty())
+		{
+			result.full = false;
+			return result;
+		}
+
+		std::size_t area = 0;
+		for (auto& rect : rects)
+			area += rect.area();
+
+		if (area > max_patch_coverage_ * width_ * height_)
+		{
+			shadow_valid_	= false;
+			patch_count_	= 0;
+			return result;
+		}
+
+		bool patchable =
+				shadow_valid_
+				&& patch_count_ + static_cast<int>(rects.size()) <= max_patches_
+				&& std::all_of(rects.begin(), rects.end(), [&](const dirty_rect& rect) { return exact_over(image, rect); });
+
+		if (shadow_valid_)
+		{
+			for (auto& rect : rects)
+				copy_rect_to_shadow(image, rect);
+		}
+		else
+		{
+			copy_image(image, shadow_.size(), shadow_.data());
+			shadow_valid_ = true;
+		}
+
+		if (!patchable)
+		{
+			patch_count_ = 0;
+			return result;
+		}
+
+		patch_count_	+= static_cast<int>(rects.size());
+		result.full		= false;
+		result.patches	= std::move(rects);
+
+		return result;
+	}
+
+	bool exact_over(const std::uint8_t* image, const dirty_rect& rect) const
+	{
+		for (int y = rect.y; y < rect.y + rect.height; ++y)
+		{
+			auto source = image + (static_cast<std::size_t>(y) * width_ + rect.x) * 4;
+			auto below	= shadow_.data() + (static_cast<std::size_t>(y) * width_ + rect.x) * 4;
+
+			for (int x = 0; x < rect.width; ++x, source += 4, below += 4)
+			{
+				std::uint32_t below_pixel;
+				std::memcpy(&below_pixel, below, 4);
+
+				if (source[3] != 255 && below_pixel != 0)
+					return false;
+			}
+		}
+
+		return true;
+	}
+
+	void copy_rect_to_shadow(const std::uint8_t* image, const dirty_rect& rect)
+	{
+		auto stride = static_cast<std::size_t>(width_) * 4;
+		auto offset = rect.y * stride + rect.x * 4;
+
+		for (int y = 0; y < rect.height; ++y)
+			std::memcpy(shadow_.data() + offset + y * stride, image + offset + y * stride, rect.width * 4);
+	}
+};
+
+dirty_rect_compositor::dirty_rect_compositor(int width, int height, int max_patches, double max_patch_coverage)
+	: impl_(new impl(width, height, max_patches, max_patch_coverage))
+{
+}
+
+dirty_rect_compositor::~dirty_rect_compositor() {}
+
+dirty_rect_compositor::update dirty_rect_compositor::paint(const std::uint8_t* image, std::vector<dirty_rect> dirty_rects)
+{
+	return impl_->paint(image, std::move(dirty_rects));
+}
+
+void dirty_rect_compositor::copy_rect(const std::uint8_t* image, int image_width, const dirty_rect& rect, std::uint8_t* destination)
+{
+	auto stride = static_cast<std::size_t>(image_width) * 4;
+	auto source = image + rect.y * stride + rect.x * 4;
+
+	for (int y = 0; y < rect.height; ++y)
+		std::memcpy(destination + static_cast<std::size_t>(y) * rect.width * 4, source + y * stride, rect.width * 4);
+}
+
+void dirty_rect_compositor::copy_image(const std::uint8_t* image, std::size_t size, std::uint8_t* destination)
+{
+	tbb::parallel_for(tbb::blocked_range<std::size_t>(0, size), [&](const tbb::blocked_range<std::size_t>& r)
+	{
+		std::memcpy(destination + r.begin(), image + r.begin(), r.size());
+	});
+}
+
+int dirty_rect_compositor::width() const { return impl_->width_; }
+int dirty_rect_compositor::height() const { return impl_->height_; }
+
+}}
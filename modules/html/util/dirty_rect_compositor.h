@@ -0,0 +1,77 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <common/memory.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace caspar { namespace html {
+
+struct dirty_rect
+{
+	int x;
+	int y;
+	int width;
+	int height;
+
+	std::size_t area() const { return static_cast<std::size_t>(width) * height; }
+};
+
+/**
+ * Decides how a browser paint is turned into a frame. Small changes are sent
+ * as patches drawn over the previous frame, which stays shared (and uploaded)
+ * instead of being copied again. The mixer can only blend a patch over what is
+ * below it, so a patch is only used where that gives exactly the new image:
+ * where every new pixel is opaque or the pixel below is fully transparent.
+ * Anything else is sent as a full frame.
+ *
+ * Works on premultiplied BGRA buffers and has no dependency on CEF.
+ */
+class dirty_rect_compositor : boost::noncopyable
+{
+public:
+	struct update
+	{
+		bool					full = true;	// Replace the whole image with the painted buffer.
+		std::vector<dirty_rect>	patches;		// Otherwise draw these regions of the painted buffer over the previous image, in order.
+	};
+
+	dirty_rect_compositor(int width, int height, int max_patches = 32, double max_patch_coverage = 0.25);
+	~dirty_rect_compositor();
+
+	update paint(const std::uint8_t* image, std::vector<dirty_rect> dirty_rects);
+
+	// Copies one region of a width * 4 byte stride image into a tightly packed destination.
+	static void copy_rect(const std::uint8_t* image, int image_width, const dirty_rect& rect, std::uint8_t* destination);
+	static void copy_image(const std::uint8_t* image, std::size_t size, std::uint8_t* destination);
+
+	int width() const;
+	int height() const;
+private:
+	struct impl;
+	spl::unique_ptr<impl> impl_;
+};
+
+}}
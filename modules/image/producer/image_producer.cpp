@@ -52,6 +52,22 @@
 
 namespace caspar { namespace image {
 
+namespace {
+
+// Scans the loaded bitmap, since the frame's buffer may be write only.
+bool has_opaque_alpha(const std::uint8_t* bgra, std::size_t size)
+{
+	for (std::size_t n = 3; n < size; n += 4)
+	{
+		if (bgra[n] != 0xFF)
+			return false;
+	}
+
+	return true;
+}
+
+}
+
 std::pair<core::draw_frame, core::constraints> load_image(
 		const spl::shared_ptr<core::frame_factory>& frame_factory,
 		const std::wstring& filename)
@@ -69,6 +85,7 @@ std::pair<core::draw_frame, core::constraints> load_image(
 			FreeImage_GetBits(bitmap.get()),
 			frame.image_data(0).size(),
 			frame.image_data(0).begin());
+	frame.set_opaque(has_opaque_alpha(FreeImage_GetBits(bitmap.get()), frame.image_data(0).size()));
 
 	return std::make_pair(
 			core::draw_frame(std::move(frame)),
@@ -121,6 +138,7 @@ struct image_producer : public core::frame_producer_base
 		auto frame = frame_factory_->create_frame(this, desc, core::audio_channel_layout::invalid());
 
 		std::copy_n(FreeImage_GetBits(bitmap.get()), frame.image_data().size(), frame.image_data().begin());
+		frame.set_opaque(has_opaque_alpha(FreeImage_GetBits(bitmap.get()), frame.image_data().size()));
 		frame_ = core::draw_frame(std::move(frame));
 		constraints_.width.set(FreeImage_GetWidth(bitmap.get()));
 		constraints_.height.set(FreeImage_GetHeight(bitmap.get()));
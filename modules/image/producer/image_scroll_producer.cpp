@@ -25,6 +25,7 @@
 #include "../util/image_loader.h"
 #include "../util/image_view.h"
 #include "../util/image_algorithms.h"
+#include "../util/tiled_image.h"
 
 #include <core/video_format.h>
 
@@ -46,6 +47,7 @@
 #include <common/param.h>
 #include <common/os/filesystem.h>
 #include <common/future.h>
+#include <common/executor.h>
 
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
@@ -56,10 +58,17 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cstdint>
+#include <future>
+#include <map>
 
 namespace caspar { namespace image {
 
+// How many frames ahead tiles are decoded when streaming, at the current speed.
+const double prefetch_frames	= 25.0;
+const double max_screens_ahead	= 4.0;
+
 // Like tweened_transform but for speed
 class speed_tweener
 {
@@ -125,6 +134,14 @@ struct image_scroll_producer : public core::frame_producer_base
 	int											start_offset_y_		= 0;
 	bool										progressive_;
 
+	const spl::shared_ptr<core::frame_factory>	frame_factory_;
+	std::shared_ptr<tiled_image>				tiles_;
+	std::map<int, std::shared_future<core::draw_frame>>	resident_tiles_;
+	std::atomic<int>							resident_count_		{ 0 };
+	std::atomic<std::int64_t>					late_frames_		{ 0 };
+	std::unique_ptr<executor>					decoder_;
+	core::draw_frame							last_frame_			= core::draw_frame::empty();
+
 	explicit image_scroll_producer(
 			const spl::shared_ptr<core::frame_factory>& frame_factory,
 			const core::video_format_desc& format_desc,
@@ -134,11 +151,13 @@ struct image_scroll_producer : public core::frame_producer_base
 			boost::optional<boost::posix_time::ptime> end_time,
 			int motion_blur_px = 0,
 			bool premultiply_with_alpha = false,
-			bool progressive = false)
+			bool progressive = false,
+			bool streaming = false)
 		: filename_(filename)
 		, format_desc_(format_desc)
 		, end_time_(std::move(end_time))
 		, progressive_(progressive)
+		, frame_factory_(frame_factory)
 	{
 		double speed = s;
 
@@ -189,26 +208,40 @@ struct image_scroll_producer : public core::frame_producer_base
 
 		boost::scoped_array<uint8_t> blurred_copy;
 
-		if (motion_blur_px > 0)
-		{
-			double angle = 3.14159265 / 2; // Up
+		double angle = 3.14159265 / 2; // Up
+
+		if (horizontal && speed < 0)
+			angle *= 2; // Left
+		else if (vertical && speed > 0)
+			angle *= 3; // Down
+		else if (horizontal && speed  > 0)
+			angle = 0.0; // Right
 
-			if (horizontal && speed < 0)
-				angle *= 2; // Left
-			else if (vertical && speed > 0)
-				angle *= 3; // Down
-			else if (horizontal && speed  > 0)
-				angle = 0.0; // Right
+		caspar::tweener blur_tweener(L"easeInQuad");
 
+		if (motion_blur_px > 0 && !streaming)
+		{
 			blurred_copy.reset(new uint8_t[count]);
 			image_view<bgra_pixel> blurred_view(blurred_copy.get(), width_, height_);
-			caspar::tweener blur_tweener(L"easeInQuad");
 			blur(original_view, blurred_view, angle, motion_blur_px, blur_tweener);
 			bytes = blurred_copy.get();
 			bitmap.reset();
 		}
 
-		if (vertical)
+		if (streaming)
+		{
+			// Only compressed tiles are kept. They are blurred and uploaded
+			// just before they scroll into view.
+			tiles_ = std::make_shared<tiled_image>(bytes, width_, height_, format_desc_.width, format_desc_.height, angle, motion_blur_px, blur_tweener);
+			bitmap.reset();
+			decoder_.reset(new executor(print()));
+			get_visible();
+
+			// Nothing has been shown yet that could be shown instead.
+			for (auto& tile : resident_tiles_)
+				tile.second.wait();
+		}
+		else if (vertical)
 		{
 			int n = 1;
 
@@ -313,8 +346,12 @@ struct image_scroll_producer : public core::frame_producer_base
 		return make_ready_future<std::wstring>(L"");
 	}
 
-	std::vector<core::draw_frame> get_visible()
+	// None while a visible tile is still being decoded.
+	boost::optional<std::vector<core::draw_frame>> get_visible()
 	{
+		if (tiles_)
+			return get_visible_tiles();
+
 		std::vector<core::draw_frame> result;
 		result.reserve(frames_.size());
 
@@ -349,13 +386,110 @@ struct image_scroll_producer : public core::frame_producer_base
 		return std::move(result);
 	}
 
+	boost::optional<std::vector<core::draw_frame>> get_visible_tiles()
+	{
+		bool vertical = width_ == format_desc_.width;
+		auto motion_offset_in_screens = vertical
+				? (static_cast<double>(start_offset_y_) + delta_) / static_cast<double>(format_desc_.height)
+				: (static_cast<double>(start_offset_x_) + delta_) / static_cast<double>(format_desc_.width);
+
+		// The same selection as get_visible() makes among all the frames,
+		// where tile n is at -(n + 1) screens.
+		std::vector<int> visible;
+		auto nearest = static_cast<int>(std::floor(motion_offset_in_screens));
+
+		for (int n = std::max(nearest - 3, 0); n <= std::min(nearest + 1, tiles_->count() - 1); ++n)
+		{
+			auto offset = -(static_cast<double>(n) + 1.0) + motion_offset_in_screens;
+
+			if (offset >= -1.0 && offset <= 1.0)
+				visible.push_back(n);
+		}
+
+		// Keep the tiles that will be visible within the next prefetch_frames
+		// at the current speed resident, decoding the ones that are not yet.
+		auto screen_size	= static_cast<double>(vertical ? format_desc_.height : format_desc_.width);
+		auto screens_ahead	= std::max(-max_screens_ahead, std::min(speed_.fetch() * prefetch_frames / screen_size, max_screens_ahead));
+		std::map<int, std::shared_future<core::draw_frame>> resident;
+
+		for (auto n : tiles_around(tiles_->count(), motion_offset_in_screens, screens_ahead))
+		{
+			auto tile = resident_tiles_.find(n);
+			resident[n] = tile != resident_tiles_.end() ? tile->second : decode_tile(n);
+		}
+
+		resident_tiles_ = std::move(resident);
+		resident_count_ = static_cast<int>(resident_tiles_.size());
+
+		std::vector<core::draw_frame> result;
+
+		for (auto n : visible)
+		{
+			auto& tile = resident_tiles_[n];
+
+			if (!is_ready(tile))
+				return boost::none;
+
+			result.push_back(tile.get());
+		}
+
+		return result;
+	}
+
+	std::shared_future<core::draw_frame> decode_tile(int n)
+	{
+		auto tiles			= tiles_;
+		auto frame_factory	= frame_factory_;
+		auto vertical		= width_ == format_desc_.width;
+		const void* tag		= this;
+
+		// The futures of executor::begin_invoke are deferred, the tile is
+		// passed through a promise so that it can be polled.
+		auto decoded		= std::make_shared<std::promise<core::draw_frame>>();
+		auto future			= decoded->get_future().share();
+
+		decoder_->begin_invoke([=]
+		{
+			try
+			{
+				core::pixel_format_desc desc = core::pixel_format::bgra;
+				desc.planes.push_back(core::pixel_format_desc::plane(tiles->tile_width(), tiles->tile_height(), 4));
+				auto frame = frame_factory->create_frame(tag, desc, core::audio_channel_layout::invalid());
+				tiles->decode(n, frame.image_data(0).begin());
+
+				core::draw_frame draw_frame(std::move(frame));
+
+				// Set the relative position to the other image fragments
+				draw_frame.transform().image_transform.fill_translation[vertical ? 1 : 0] = -(static_cast<double>(n) + 1.0);
+
+				decoded->set_value(std::move(draw_frame));
+			}
+			catch (...)
+			{
+				decoded->set_exception(std::current_exception());
+			}
+		});
+
+		return future;
+	}
+
 	// frame_producer
 	core::draw_frame render_frame(bool allow_eof)
 	{
-		if(frames_.empty())
+		if(frames_.empty() && !tiles_)
 			return core::draw_frame::empty();
 
-		core::draw_frame result(get_visible());
+		auto visible = get_visible();
+
+		// Repeated rather than waiting for the tiles, the scroll catches up
+		// once they are decoded.
+		if (!visible)
+		{
+			++late_frames_;
+			return last_frame_;
+		}
+
+		core::draw_frame result(std::move(*visible));
 		auto& fill_translation = result.transform().image_transform.fill_translation;
 
 		if (width_ == format_desc_.width)
@@ -377,6 +511,8 @@ struct image_scroll_producer : public core::frame_producer_base
 				+ (delta_) / static_cast<double>(format_desc_.width);
 		}
 
+		last_frame_ = result;
+
 		return result;
 	}
 
@@ -466,6 +602,16 @@ struct image_scroll_producer : public core::frame_producer_base
 		info.add(L"type", L"image-scroll");
 		info.add(L"filename", filename_);
 		info.add(L"speed", speed_.fetch());
+		info.add(L"streaming", static_cast<bool>(tiles_));
+
+		if (tiles_)
+		{
+			info.add(L"tiles", tiles_->count());
+			info.add(L"resident-tiles", resident_count_.load());
+			info.add(L"late-frames", late_frames_.load());
+			info.add(L"compressed-size", tiles_->compressed_size());
+		}
+
 		return info;
 	}
 
@@ -492,9 +638,9 @@ struct image_scroll_producer : public core::frame_producer_base
 void describe_scroll_producer(core::help_sink& sink, const core::help_repository& repo)
 {
 	sink.short_description(L"Scrolls an image either horizontally or vertically.");
-	sink.syntax(L"[image_file:string] SPEED [speed:float] {BLUR [blur_px:int]} {[premultiply:PREMULTIPLY]} {[progressive:PROGRESSIVE]}");
-	sink.syntax(L"[image_file:string] DURATION [duration:float] {BLUR [blur_px:int]} {[premultiply:PREMULTIPLY]} {[progressive:PROGRESSIVE]}");
-	sink.syntax(L"[image_file:string] END_TIME [end_time:string] {BLUR [blur_px:int]} {[premultiply:PREMULTIPLY]} {[progressive:PROGRESSIVE]}");
+	sink.syntax(L"[image_file:string] SPEED [speed:float] {BLUR [blur_px:int]} {[premultiply:PREMULTIPLY]} {[progressive:PROGRESSIVE]} {[stream:STREAM]}");
+	sink.syntax(L"[image_file:string] DURATION [duration:float] {BLUR [blur_px:int]} {[premultiply:PREMULTIPLY]} {[progressive:PROGRESSIVE]} {[stream:STREAM]}");
+	sink.syntax(L"[image_file:string] END_TIME [end_time:string] {BLUR [blur_px:int]} {[premultiply:PREMULTIPLY]} {[progressive:PROGRESSIVE]} {[stream:STREAM]}");
 	sink.para()
 		->text(L"Scrolls an image either horizontally or vertically. ")
 		->text(L"It is the image dimensions that decide if it will be a vertical scroll or a horizontal scroll. ")
@@ -507,10 +653,12 @@ void describe_scroll_producer(core::help_sink& sink, const core::help_repository
 		->item(L"end_time", L"An absolute date in the format yyyy-MM-dd HH:mm:ss for when the scroll should end, based on the system clock.")
 		->item(L"blur_px", L"If specified, will do a directional blur in the scrolling direction by the given number of pixels.")
 		->item(L"premultiply", L"If the image is in straight alpha, use this option to make it display correctly in CasparCG.")
-		->item(L"progressive", L"When an interlaced video format is used, by default the image is moved every field. This can be overridden by specifying this option, causing the image to only move on full frames.");
+		->item(L"progressive", L"When an interlaced video format is used, by default the image is moved every field. This can be overridden by specifying this option, causing the image to only move on full frames.")
+		->item(L"stream", L"Keep the image compressed in screen sized tiles and only blur and upload the ones about to scroll into view. Uses much less memory for very long images.");
 	sink.para()->text(L"If ")->code(L"SPEED [speed]")->text(L" is ommitted, the ordinary ")->see(L"Image Producer")->text(L" will be used instead.");
 	sink.example(L">> PLAY 1-10 cred_1280 SPEED 8 BLUR 2", L"Given that cred_1280 is a as wide as the video mode, this will create a rolling end credits with a little bit of blur and a speed of 8 pixels per frame.");
 	sink.example(L">> PLAY 1-10 cred_1280 DURATION 60", L"Will adjust the speed to make the scroll take 60 seconds.");
+	sink.example(L">> PLAY 1-10 cred_1920 SPEED 4 BLUR 2 STREAM", L"Will scroll a credit roll too long to keep in memory uncompressed.");
 	sink.example(L">> PLAY 1-10 cred_1920 END_TIME \"2016-05-15 00:46:17\"", L"Will adjust the speed to make the scroll end at the specific date and time 2016-05-15 00:46:17.");
 }
 
@@ -552,6 +700,7 @@ spl::shared_ptr<core::frame_producer> create_scroll_producer(const core::frame_p
 
 	bool premultiply_with_alpha = contains_param(L"PREMULTIPLY", params);
 	bool progressive = contains_param(L"PROGRESSIVE", params);
+	bool streaming = contains_param(L"STREAM", params);
 
 	return core::create_destroy_proxy(spl::make_shared<image_scroll_producer>(
 			dependencies.frame_factory,
@@ -562,7 +711,8 @@ spl::shared_ptr<core::frame_producer> create_scroll_producer(const core::frame_p
 			end_time,
 			motion_blur_px,
 			premultiply_with_alpha,
-			progressive));
+			progressive,
+			streaming));
 }
 
 }}
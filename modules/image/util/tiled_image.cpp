@@ -0,0 +1,417 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "tiled_image.h"
+
+#include "image_algorithms.h"
+
+#include <common/except.h>
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include <zlib.h> // Compiled into FreeImage
+
+#include <emmintrin.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace caspar { namespace image {
+
+namespace {
+
+struct tap
+{
+	std::int64_t	offset;	// In pixels from the blurred pixel, as image_view::relative.
+	int				weight;
+};
+
+struct tap_pair
+{
+	std::ptrdiff_t	first;	// In bytes.
+	std::ptrdiff_t	second;
+	std::int32_t	weights; // Both 16 bit weights, laid out for _mm_madd_epi16.
+};
+
+// Pixels that are consecutive both in the image and in a tile.
+struct span
+{
+	std::int64_t	first;			// Index of the first pixel in the image.
+	int				length;
+	int				dest;			// Index of the first pixel in the tile.
+	std::int64_t	source_begin;	// The pixels the blur reads, clipped to the image.
+	std::int64_t	source_end;
+	std::size_t		source_offset;	// Where they are in the decompressed tile, in bytes.
+};
+
+struct tile
+{
+	std::vector<span>			spans;
+	std::vector<std::uint8_t>	compressed;
+	std::size_t					source_size	= 0;
+	bool						partial		= false;
+};
+
+}
+
+struct tiled_image::impl
+{
+	const int				width_;
+	const int				height_;
+	const int				tile_width_;
+	const int				tile_height_;
+	const std::int64_t		pixel_count_;
+	std::vector<tap>		taps_;
+	std::vector<tap_pair>	interior_pairs_;
+	int						interior_weight_	= 255;
+	std::int64_t			min_offset_			= 0;
+	std::int64_t			max_offset_			= 0;
+	std::vector<tile>		tiles_;
+
+	impl(
+			const std::uint8_t* bgra,
+			int width,
+			int height,
+			int tile_width,
+			int tile_height,
+			double angle_radians,
+			int blur_px,
+			const caspar::tweener& tweener)
+		: width_(width)
+		, height_(height)
+		, tile_width_(tile_width)
+		, tile_height_(tile_height)
+		, pixel_count_(static_cast<std::int64_t>(width) * height)
+	{
+		bool vertical = width_ == tile_width_;
+
+		if (width_ <= 0 || height_ <= 0 || tile_width_ <= 0 || tile_height_ <= 0)
+			CASPAR_THROW_EXCEPTION(invalid_argument() << msg_info("Image and tile sizes have to be positive"));
+
+		if (!vertical && height_ != tile_height_)
+			CASPAR_THROW_EXCEPTION(invalid_argument() << msg_info("Neither width nor height of the image matches the tile"));
+
+		if (blur_px > 0)
+			init_taps(angle_radians, blur_px, tweener);
+
+		if (vertical)
+		{
+			std::int64_t tile_pixels = static_cast<std::int64_t>(tile_width_) * tile_height_;
+			tiles_.resize(static_cast<std::size_t>((pixel_count_ + tile_pixels - 1) / tile_pixels));
+
+			for (std::size_t index = 0; index < tiles_.size(); ++index)
+			{
+				auto end	= pixel_count_ - static_cast<std::int64_t>(index) * tile_pixels;
+				auto top	= end - tile_pixels;
+				auto begin	= std::max<std::int64_t>(top, 0);
+
+				tiles_[index].spans.push_back(make_span(begin, static_cast<int>(end - begin), static_cast<int>(begin - top)));
+				tiles_[index].partial = top < 0;
+			}
+		}
+		else
+		{
+			int columns = (width_ + tile_width_ - 1) / tile_width_;
+			tiles_.resize(columns);
+
+			for (int index = 0; index < columns; ++index)
+			{
+				int left	= (columns - 1 - index) * tile_width_;
+				int length	= std::min(tile_width_, width_ - left);
+
+				for (int y = 0; y < height_; ++y)
+					tiles_[index].spans.push_back(make_span(static_cast<std::int64_t>(y) * width_ + left, length, y * tile_width_));
+
+				tiles_[index].partial = length < tile_width_;
+			}
+		}
+
+		tbb::parallel_for(0, static_cast<int>(tiles_.size()), [&](int index)
+		{
+			compress(tiles_[index], bgra);
+		});
+	}
+
+	void init_taps(double angle_radians, int blur_px, const caspar::tweener& tweener)
+	{
+		// The same trail and weights as blur() in image_algorithms.h.
+		auto points = get_line_points(blur_px, angle_radians);
+		auto weights = get_tweened_values<uint8_t>(tweener, blur_px + 2, 255, 0);
+		weights.pop_back();
+		weights.erase(weights.begin());
+
+		std::vector<tap> interior_taps;
+		interior_taps.push_back(tap { 0, 255 });
+
+		for (int i = 0; i < blur_px; ++i)
+		{
+			tap t { points[i].first + static_cast<std::int64_t>(width_) * points[i].second, weights[i] };
+
+			taps_.push_back(t);
+			interior_taps.push_back(t);
+			interior_weight_ += t.weight;
+			min_offset_ = std::min(min_offset_, t.offset);
+			max_offset_ = std::max(max_offset_, t.offset);
+		}
+
+		if (interior_taps.size() % 2)
+			interior_taps.push_back(tap { 0, 0 });
+
+		for (std::size_t i = 0; i < interior_taps.size(); i += 2)
+		{
+			interior_pairs_.push_back(tap_pair {
+				static_cast<std::ptrdiff_t>(interior_taps[i].offset * 4),
+				static_cast<std::ptrdiff_t>(interior_taps[i + 1].offset * 4),
+				interior_taps[i].weight | (interior_taps[i + 1].weight << 16) });
+		}
+	}
+
+	span make_span(std::int64_t first, int length, int dest) const
+	{
+		span result;
+		result.first			= first;
+		result.length			= length;
+		result.dest				= dest;
+		result.source_begin		= std::max<std::int64_t>(first + min_offset_, 0);
+		result.source_end		= std::min<std::int64_t>(first + length + max_offset_, pixel_count_);
+		result.source_offset	= 0;
+		return result;
+	}
+
+	void compress(tile& t, const std::uint8_t* bgra) const
+	{
+		for (auto& s : t.spans)
+		{
+			s.source_offset = t.source_size;
+			t.source_size += static_cast<std::size_t>(s.source_end - s.source_begin) * 4;
+		}
+
+		std::vector<std::uint8_t> source(t.source_size);
+
+		for (auto& s : t.spans)
+			std::memcpy(source.data() + s.source_offset, bgra + s.source_begin * 4, static_cast<std::size_t>(s.source_end - s.source_begin) * 4);
+
+		auto size = compressBound(static_cast<uLong>(source.size()));
+		t.compressed.resize(size);
+
+		if (compress2(t.compressed.data(), &size, source.data(), static_cast<uLong>(source.size()), Z_BEST_SPEED) != Z_OK)
+			CASPAR_THROW_EXCEPTION(caspar_exception() << msg_info("Failed to compress image tile"));
+
+		t.compressed.resize(size);
+		t.compressed.shrink_to_fit();
+	}
+
+	void decode(int index, std::uint8_t* dest) const
+	{
+		if (index < 0 || index >= static_cast<int>(tiles_.size()))
+			CASPAR_THROW_EXCEPTION(out_of_range() << msg_info("No such image tile"));
+
+		auto& t = tiles_[index];
+		std::vector<std::uint8_t> source(t.source_size);
+		auto size = static_cast<uLongf>(source.size());
+
+		if (uncompress(source.data(), &size, t.compressed.data(), static_cast<uLong>(t.compressed.size())) != Z_OK || size != source.size())
+			CASPAR_THROW_EXCEPTION(caspar_exception() << msg_info("Failed to decompress image tile"));
+
+		if (t.partial)
+			std::memset(dest, 0, static_cast<std::size_t>(tile_width_) * tile_height_ * 4);
+
+		tbb::parallel_for(std::size_t(0), t.spans.size(), [&](std::size_t n)
+		{
+			auto& s = t.spans[n];
+			auto src = source.data() + s.source_offset + (s.first - s.source_begin) * 4;
+			auto dst = dest + static_cast<std::size_t>(s.dest) * 4;
+
+			tbb::parallel_for(tbb::blocked_range<int>(0, s.length, 16384), [&](const tbb::blocked_range<int>& r)
+			{
+				blur(s, src, dst, r.begin(), r.end());
+			});
+		});
+	}
+
+	// Blurs pixels [from, to) of a span, where src and dst point at its first
+	// pixel.
+	void blur(const span& s, const std::uint8_t* src, std::uint8_t* dst, int from, int to) const
+	{
+		if (taps_.empty())
+		{
+			std::memcpy(dst + from * 4, src + from * 4, static_cast<std::size_t>(to - from) * 4);
+			return;
+		}
+
+		// Pixels whose whole trail is inside the image.
+		auto interior_begin	= static_cast<int>(std::min<std::int64_t>(std::max<std::int64_t>(-min_offset_ - s.first, from), to));
+		auto interior_end	= static_cast<int>(std::min<std::int64_t>(std::max<std::int64_t>(pixel_count_ - max_offset_ - s.first, interior_begin), to));
+
+		for (int x = from; x < interior_begin; ++x)
+			blur_edge(s.first + x, src + x * 4, dst + x * 4);
+
+		auto x = interior_begin + blur_interior(src + interior_begin * 4, dst + interior_begin * 4, interior_end - interior_begin);
+
+		for (; x < to; ++x)
+			blur_edge(s.first + x, src + x * 4, dst + x * 4);
+	}
+
+	// Like rgba_weighting, stopping at the first pixel of the trail outside
+	// the image.
+	void blur_edge(std::int64_t pixel, const std::uint8_t* src, std::uint8_t* dst) const
+	{
+		int sum[4] = { 0, 0, 0, 0 };
+		int total_weight = 0;
+
+		for (auto& t : taps_)
+		{
+			auto other = pixel + t.offset;
+
+			if (other < 0 || other >= pixel_count_)
+				break;
+
+			auto other_pixel = src + t.offset * 4;
+
+			for (int c = 0; c < 4; ++c)
+				sum[c] += other_pixel[c] * t.weight;
+
+			total_weight += t.weight;
+		}
+
+		total_weight += 255;
+
+		for (int c = 0; c < 4; ++c)
+		{
+			sum[c] += src[c] * 255;
+			dst[c] = static_cast<std::uint8_t>(sum[c] / total_weight);
+		}
+	}
+
+	// Blurs groups of 4 pixels, two trail pixels at a time, and returns the
+	// number of pixels done. The sums are divided exactly in double precision.
+	int blur_interior(const std::uint8_t* src, std::uint8_t* dst, int count) const
+	{
+		const auto zero		= _mm_setzero_si128();
+		const auto divisor	= _mm_set1_pd(static_cast<double>(interior_weight_));
+
+		int x = 0;
+
+		for (; x + 4 <= count; x += 4)
+		{
+			auto pixels = src + x * 4;
+			__m128i sum[4] = { zero, zero, zero, zero };
+
+			for (auto& pair : interior_pairs_)
+			{
+				auto weights	= _mm_set1_epi32(pair.weights);
+				auto a			= _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + pair.first));
+				auto b			= _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + pair.second));
+				auto a_lo		= _mm_unpacklo_epi8(a, zero);
+				auto a_hi		= _mm_unpackhi_epi8(a, zero);
+				auto b_lo		= _mm_unpacklo_epi8(b, zero);
+				auto b_hi		= _mm_unpackhi_epi8(b, zero);
+
+				sum[0] = _mm_add_epi32(sum[0], _mm_madd_epi16(_mm_unpacklo_epi16(a_lo, b_lo), weights));
+				sum[1] = _mm_add_epi32(sum[1], _mm_madd_epi16(_mm_unpackhi_epi16(a_lo, b_lo), weights));
+				sum[2] = _mm_add_epi32(sum[2], _mm_madd_epi16(_mm_unpacklo_epi16(a_hi, b_hi), weights));
+				sum[3] = _mm_add_epi32(sum[3], _mm_madd_epi16(_mm_unpackhi_epi16(a_hi, b_hi), weights));
+			}
+
+			for (auto& channels : sum)
+			{
+				auto lo = _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(channels), divisor));
+				auto hi = _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(_mm_srli_si128(channels, 8)), divisor));
+				channels = _mm_unpacklo_epi64(lo, hi);
+			}
+
+			auto result = _mm_packus_epi16(_mm_packs_epi32(sum[0], sum[1]), _mm_packs_epi32(sum[2], sum[3]));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4), result);
+		}
+
+		return x;
+	}
+};
+
+tiled_image::tiled_image(
+		const std::uint8_t* bgra,
+		int width,
+		int height,
+		int tile_width,
+		int tile_height,
+		double angle_radians,
+		int blur_px,
+		const caspar::tweener& tweener)
+	: impl_(new impl(bgra, width, height, tile_width, tile_height, angle_radians, blur_px, tweener))
+{
+}
+
+tiled_image::~tiled_image()
+{
+}
+
+void tiled_image::decode(int index, std::uint8_t* dest) const
+{
+	impl_->decode(index, dest);
+}
+
+int tiled_image::count() const
+{
+	return static_cast<int>(impl_->tiles_.size());
+}
+
+int tiled_image::tile_width() const
+{
+	return impl_->tile_width_;
+}
+
+int tiled_image::tile_height() const
+{
+	return impl_->tile_height_;
+}
+
+std::size_t tiled_image::compressed_size() const
+{
+	std::size_t result = 0;
+
+	for (auto& t : impl_->tiles_)
+		result += t.compressed.size();
+
+	return result;
+}
+
+std::vector<int> tiles_around(int count, double offset, double screens_ahead)
+{
+	auto low	= std::min(offset, offset + screens_ahead);
+	auto high	= std::max(offset, offset + screens_ahead);
+	auto first	= std::max(static_cast<int>(std::ceil(low - 2.0)) - 1, 0);
+	auto last	= std::min(static_cast<int>(std::floor(high)) + 1, count - 1);
+
+	std::vector<int> result;
+
+	for (int n = first; n <= last; ++n)
+		result.push_back(n);
+
+	std::stable_sort(result.begin(), result.end(), [&](int lhs, int rhs)
+	{
+		return std::abs(lhs + 1.0 - offset) < std::abs(rhs + 1.0 - offset);
+	});
+
+	return result;
+}
+
+}}
@@ -0,0 +1,111 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <common/memory.h>
+#include <common/tweener.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace caspar { namespace image {
+
+/**
+ * A BGRA image kept in memory as separately compressed tiles, cut the same
+ * way the image_scroll_producer cuts an image into frames.
+ * <p>
+ * If the image is as wide as a tile, the tiles are horizontal bands counted
+ * from the bottom of the image, where the top most tile is padded with
+ * transparent pixels at the top. Otherwise the image must be as high as a
+ * tile and the tiles are vertical bands counted from the right, where the
+ * left most tile is padded with transparent pixels at the right.
+ * <p>
+ * Each tile keeps the source pixels needed by the directional blur around it,
+ * so a tile can be decoded and blurred on its own into exactly the pixels the
+ * blur function in image_algorithms.h would produce for the whole image.
+ * Tiles can be decoded concurrently.
+ */
+class tiled_image final
+{
+	tiled_image(const tiled_image&);
+	tiled_image& operator=(const tiled_image&);
+public:
+	/**
+	 * Cut and compress an image.
+	 *
+	 * @param bgra          The image, width * height BGRA pixels with the top
+	 *                      row first. Not referenced after construction.
+	 * @param width         The width of the image in pixels.
+	 * @param height        The height of the image in pixels.
+	 * @param tile_width    The width of a tile in pixels.
+	 * @param tile_height   The height of a tile in pixels.
+	 * @param angle_radians The angle in radians of the directional blur.
+	 * @param blur_px       The number of pixels of the blur, 0 for no blur.
+	 * @param tweener       The tweener to use to create a pixel weighting curve
+	 *                      with.
+	 */
+	tiled_image(
+			const std::uint8_t* bgra,
+			int width,
+			int height,
+			int tile_width,
+			int tile_height,
+			double angle_radians,
+			int blur_px,
+			const caspar::tweener& tweener);
+	~tiled_image();
+
+	/**
+	 * Decode, and blur, a tile.
+	 *
+	 * @param index The tile, where 0 is the bottom or right most tile.
+	 * @param dest  tile_width * tile_height BGRA pixels to write the tile to.
+	 */
+	void decode(int index, std::uint8_t* dest) const;
+
+	int count() const;
+	int tile_width() const;
+	int tile_height() const;
+
+	/**
+	 * @return the number of bytes of compressed pixel data kept in memory.
+	 */
+	std::size_t compressed_size() const;
+private:
+	struct impl;
+	spl::unique_ptr<impl> impl_;
+};
+
+/**
+ * The tiles to keep decoded while scrolling, nearest to the screen first.
+ * Tile n is on screen while the offset is between n and n + 2 screens.
+ *
+ * @param count         The number of tiles.
+ * @param offset        The current scroll offset in screens.
+ * @param screens_ahead How far the offset changes before a tile decoded now
+ *                      is ready, negative when it decreases.
+ *
+ * @return the tiles on screen from now until then, and one more on either
+ *         side.
+ */
+std::vector<int> tiles_around(int count, double offset, double screens_ahead);
+
+}}
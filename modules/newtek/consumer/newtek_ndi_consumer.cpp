@@ -43,16 +43,15 @@
 
 #include <boost/algorithm/string.hpp>
 #include <boost/property_tree/ptree.hpp>
-#include <boost/property_tree/xml_parser.hpp>
 #include <boost/chrono/system_clocks.hpp>
 #include <boost/crc.hpp>
 
 #include <atomic>
 
 #include "../util/ndi.h"
+#include "../util/ndi_ancillary.h"
 extern "C"
 {
-            #include "base64.h"
 	        #include <libswscale/swscale.h>
 	        #include <libavcodec/avcodec.h>
 	        #include <libavformat/avformat.h>
@@ -109,6 +108,7 @@ struct newtek_ndi_consumer : public boost::noncopyable
     std::unique_ptr<SwsContext, std::function<void(SwsContext*)>>	sws_;
     std::vector<uint8_t, tbb::cache_aligned_allocator<uint8_t>>     send_frame_buffer_;
     tbb::concurrent_bounded_queue<core::const_frame>	frame_buffer_;
+    ndi::ancillary_metadata_writer       ancillary_writer_;
 
     std::unique_ptr<NDIlib_send_instance_t, std::function<void(NDIlib_send_instance_t*)>> ndi_send_instance_;
 
@@ -330,26 +330,8 @@ struct newtek_ndi_consumer : public boost::noncopyable
             a_data = core::audio_buffer(buf->data(), buf->size(), true, std::move(buf));
         }
 
-        std::stringstream metadata;
-        boost::property_tree::ptree metadata_tree;
-        bool write_meta = false;
-        for (auto& vanc_line : frame.ancillary().getAncillaryAsLines(1920))
-        {
-            CASPAR_LOG(debug) << "Adding VANC line to metadata";
-            char *base64_vanc = (char*)calloc(Base64encode_len(vanc_line.size() * 4) +1, 1);
-            Base64encode(base64_vanc, (const char *)vanc_line.data(), (vanc_line.size() * 4));
-            CASPAR_LOG(trace) << base64_vanc;
-            metadata_tree.put("VANC_DATA", base64_vanc);
-            free(base64_vanc);
-            write_meta = true;
-        }
-
-        if (write_meta)
-            write_xml(metadata, metadata_tree);
-
-        char *test = (char *)calloc(metadata.str().size() +1, 1);
-        memcpy(test, metadata.str().c_str(), metadata.str().size());
-        ndi_video_frame_.p_metadata = test;
+        auto& metadata = ancillary_writer_.write(frame.ancillary());
+        ndi_video_frame_.p_metadata = metadata.empty() ? nullptr : metadata.c_str();
 
         ndi_video_frame_.p_data = v_data;
         ndi_lib_->NDIlib_send_send_video_v2(*ndi_send_instance_, &ndi_video_frame_);
@@ -360,7 +342,6 @@ struct newtek_ndi_consumer : public boost::noncopyable
         current_encoding_delay_ = frame.get_age_millis();
         timebase_frame_no_++;
         graph_->set_value("ndi-consume-time", ndi_consume_timer_.elapsed() * format_desc_.fps * 0.5);
-        free(test);
         return true;
     }
 
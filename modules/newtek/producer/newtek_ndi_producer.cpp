@@ -63,6 +63,7 @@ extern "C" {
 #endif
 
 #include "../util/ndi.h"
+#include "../util/ndi_ancillary.h"
 
 namespace caspar { namespace newtek {
 
@@ -194,9 +195,12 @@ struct newtek_ndi_producer : public core::frame_producer
                 ndi_lib_->NDIlib_framesync_free_audio(ndi_framesync_, &audio_frame);
                 auto mframe =
                     ffmpeg::make_frame(this, *(frame_factory_.get()), std::move(av_frame), std::move(a_frame));
+                core::ancillary::AncillaryContainer ancillary;
+                ndi::read_ancillary_metadata(video_frame.p_metadata, ancillary);
                 ndi_lib_->NDIlib_framesync_free_video(ndi_framesync_, &video_frame);
                 delete[] audio_frame_32s.p_data;
                 auto dframe = core::draw_frame(std::move(mframe));
+                dframe.ancillary().appendFrom(ancillary);
                 {
                     std::lock_guard<std::mutex> lock(frames_mutex_);
                     frames_.push(dframe);
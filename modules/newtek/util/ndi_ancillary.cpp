@@ -0,0 +1,94 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "../StdAfx.h"
+
+#include "ndi_ancillary.h"
+
+#include <cstring>
+
+namespace caspar { namespace newtek { namespace ndi {
+
+static const char open_tag[]  = "<caspar_anc>";
+static const char close_tag[] = "</caspar_anc>";
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+const std::string& ancillary_metadata_writer::write(const core::ancillary::AncillaryContainer& ancillary)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    packets_.clear();
+    metadata_.clear();
+    ancillary.getAncillaryAsPackets(packets_);
+    if (packets_.empty())
+        return metadata_;
+
+    metadata_.reserve(sizeof(open_tag) + sizeof(close_tag) + packets_.size() * 2);
+    metadata_ += open_tag;
+    for (auto byte : packets_) {
+        metadata_ += digits[byte >> 4];
+        metadata_ += digits[byte & 0x0f];
+    }
+    metadata_ += close_tag;
+    return metadata_;
+}
+
+bool read_ancillary_metadata(const char* metadata, core::ancillary::AncillaryContainer& out)
+{
+    if (!metadata)
+        return false;
+
+    auto begin = std::strstr(metadata, open_tag);
+    if (!begin)
+        return false;
+    begin += sizeof(open_tag) - 1;
+
+    auto end = std::strstr(begin, close_tag);
+    if (!end || (end - begin) % 2 != 0)
+        return false;
+
+    std::vector<uint8_t> packets;
+    packets.reserve((end - begin) / 2);
+    for (auto c = begin; c != end; c += 2) {
+        int high = hex_value(c[0]);
+        int low  = hex_value(c[1]);
+        if (high < 0 || low < 0)
+            return false;
+        packets.push_back(static_cast<uint8_t>((high << 4) | low));
+    }
+
+    // Packets are only added when the whole element is well formed
+    core::ancillary::AncillaryContainer parsed;
+    if (!parsed.addPackets(packets.data(), packets.size()))
+        return false;
+    out.appendFrom(parsed);
+    return true;
+}
+
+}}} // namespace caspar::newtek::ndi
@@ -0,0 +1,46 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <core/ancillary/ancillary.h>
+
+#include <string>
+#include <vector>
+
+namespace caspar { namespace newtek { namespace ndi {
+
+// Ancillary data travels as NDI frame metadata: <caspar_anc>hex</caspar_anc>, where the hex digits
+// are the packets of AncillaryContainer::getAncillaryAsPackets (DID, SDID, size, payload).
+class ancillary_metadata_writer
+{
+  public:
+    // Metadata for one frame, empty when there is no ancillary data. Valid until the next call.
+    const std::string& write(const core::ancillary::AncillaryContainer& ancillary);
+
+  private:
+    std::vector<uint8_t> packets_;
+    std::string          metadata_;
+};
+
+// Adds the packets of the <caspar_anc> element in metadata to out, returns false if there is
+// no such element or it is malformed
+bool read_ancillary_metadata(const char* metadata, core::ancillary::AncillaryContainer& out);
+
+}}} // namespace caspar::newtek::ndi
@@ -33,10 +33,51 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
 
+#include <tbb/parallel_for.h>
+
 #include <algorithm>
+#include <cstring>
 
 namespace caspar { namespace psd {
 
+namespace {
+
+// Decodes one PackBits compressed scanline and returns where the next one starts. Runs are
+// copied with memcpy/memset instead of byte by byte and are clamped to both the scanline and
+// the channel data, so corrupt files can't make it write or read out of bounds.
+const std::uint8_t* decode_packbits_scanline(const std::uint8_t* src, const std::uint8_t* end, std::uint8_t* line, int width)
+{
+	int column = 0;
+
+	while (column < width && src < end)
+	{
+		int control = static_cast<std::int8_t>(*src++);
+
+		if (control >= 0)
+		{
+			//literal run of control+1 bytes
+			auto available = static_cast<int>(std::min<std::ptrdiff_t>(control + 1, end - src));
+			auto length = std::min(available, width - column);
+
+			std::memcpy(line + column, src, length);
+			src += available;
+			column += length;
+		}
+		else if (control > -128 && src < end)
+		{
+			//the next byte repeated 1-control times
+			auto length = std::min(1 - control, width - column);
+
+			std::memset(line + column, *src++, length);
+			column += length;
+		}
+	}
+
+	return src;
+}
+
+}
+
 void layer::mask_info::read_mask_data(bigendian_file_input_stream& stream)
 {
 	auto length = stream.read_long();
@@ -155,7 +196,7 @@ struct layer::impl
 {
 	friend class layer;
 
-	impl() : blend_mode_(caspar::core::blend_mode::normal), layer_type_(layer_type::content), link_group_id_(0), opacity_(255), sheet_color_(0), baseClipping_(false), flags_(0), protection_flags_(0), masks_count_(0), scale_{ 1.0, 1.0 }, angle_(0), shear_(0), tags_(layer_tag::none)
+	impl() : blend_mode_(caspar::core::blend_mode::normal), layer_type_(layer_type::content), link_group_id_(0), opacity_(255), sheet_color_(0), baseClipping_(false), flags_(0), protection_flags_(0), masks_count_(0), scale_{ 1.0, 1.0 }, angle_(0), shear_(0), tags_(layer_tag::none), has_transparency_(false)
 	{}
 
 private:
@@ -187,6 +228,18 @@ private:
 
 	layer_tag						tags_;
 
+	struct channel_data
+	{
+		image8bit_ptr		target;
+		int					offset;
+		std::uint16_t		encoding;
+		const std::uint8_t*	data;
+		int					length;
+	};
+
+	std::vector<channel_data>		pending_channels_;
+	bool							has_transparency_;
+
 public:
 	void populate(bigendian_file_input_stream& stream, const psd_document& doc)
 	{
@@ -484,16 +537,17 @@ public:
 		return std::find_if(channels_.begin(), channels_.end(), [=](const channel& c) { return c.id == static_cast<int>(type); }) != channels_.end();
 	}
 
+	//only locates the channel data in the (memory mapped) stream, decode_channel_data() does the actual work
 	void read_channel_data(bigendian_file_input_stream& stream)
 	{
 		image8bit_ptr bitmap;
 
-		bool has_transparency = has_channel(channel_type::transparency);
+		has_transparency_ = has_channel(channel_type::transparency);
 	
 		if(!bitmap_rect_.empty())
 		{
 			bitmap = std::make_shared<image8bit>(bitmap_rect_.size.width, bitmap_rect_.size.height, 4);
-			if(!has_transparency)
+			if(!has_transparency_)
 				std::memset(bitmap->data(), 255, bitmap->width()*bitmap->height()*bitmap->channel_count());
 		}
 
@@ -535,57 +589,66 @@ public:
 			if(!discard_channel)
 			{
 				auto encoding = stream.read_short();
-				if(target)
-				{
-					if(encoding == 0)
-						read_raw_image_data(stream, channel.data_length-2, target, offset);
-					else if(encoding == 1)
-						read_rle_image_data(stream, target, offset);
-					else
-						CASPAR_THROW_EXCEPTION(psd_file_format_exception() << msg_info("Unhandled image data encoding: " + boost::lexical_cast<std::string>(encoding)));
-				}
+				if(encoding != 0 && encoding != 1)
+					CASPAR_THROW_EXCEPTION(psd_file_format_exception() << msg_info("Unhandled image data encoding: " + boost::lexical_cast<std::string>(encoding)));
+
+				auto length = static_cast<int>(std::max<std::streamoff>(end_of_data - stream.current_position(), 0));
+				pending_channels_.push_back(channel_data { target, offset, encoding, stream.read_block(length), length });
 			}
 			stream.set_position(end_of_data);
 		}
 
-		if(bitmap && has_transparency)
+		bitmap_ = bitmap;
+	}
+
+	void decode_channel_data()
+	{
+		//the channels write to separate bytes of the bitmap so they can be decoded concurrently
+		tbb::parallel_for(0, static_cast<int>(pending_channels_.size()), [&](int index)
+		{
+			auto& channel = pending_channels_[index];
+
+			if(channel.encoding == 0)
+				read_raw_image_data(channel.data, channel.length, channel.target, channel.offset);
+			else
+				read_rle_image_data(channel.data, channel.length, channel.target, channel.offset);
+		});
+
+		pending_channels_.clear();
+
+		if(bitmap_ && has_transparency_)
 		{
-			caspar::image::image_view<caspar::image::bgra_pixel> view(bitmap->data(), bitmap->width(), bitmap->height());
+			caspar::image::image_view<caspar::image::bgra_pixel> view(bitmap_->data(), bitmap_->width(), bitmap_->height());
 			caspar::image::premultiply(view);
 		}
-
-		bitmap_ = bitmap;
 	}
 
-	void read_raw_image_data(bigendian_file_input_stream& stream, int data_length, image8bit_ptr target, int offset)
+	void read_raw_image_data(const std::uint8_t* data, int data_length, image8bit_ptr target, int offset)
 	{
 		auto total_length = target->width() * target->height();
 		if (total_length != data_length)
 			CASPAR_THROW_EXCEPTION(psd_file_format_exception() << msg_info("total_length != data_length"));
 
-		auto data = target->data();
+		auto target_data = target->data();
 		auto stride = target->channel_count();
 
 		if (stride == 1)
-			stream.read(reinterpret_cast<char*>(data + offset), total_length);
+			std::memcpy(target_data + offset, data, total_length);
 		else
 		{
 			for(int index = 0; index < total_length; ++index)
-				data[index * stride + offset] = stream.read_byte();
+				target_data[index * stride + offset] = data[index];
 		}
 	}
 
-	void read_rle_image_data(bigendian_file_input_stream& stream, image8bit_ptr target, int offset)
+	void read_rle_image_data(const std::uint8_t* data, int data_length, image8bit_ptr target, int offset)
 	{
 		auto width = target->width();
 		auto height = target->height();
 		auto stride = target->channel_count();
 
-		std::vector<int> scanline_lengths;
-		scanline_lengths.reserve(height);
-
-		for (int scanlineIndex = 0; scanlineIndex < height; ++scanlineIndex)
-			scanline_lengths.push_back(static_cast<std::int16_t>(stream.read_short()));
+		auto src = data + std::min(height * 2, data_length);	//skip the scanline lengths, the scanlines are decoded back to back
+		auto end = data + data_length;
 
 		auto target_data = target->data();
 
@@ -593,39 +656,18 @@ public:
 
 		for(int scanlineIndex=0; scanlineIndex < height; ++scanlineIndex)
 		{
-			int colIndex = 0;
-
-			do
+			if (stride == 1)
 			{
-				int length = 0;
-
-				//Get controlbyte
-				char controlByte = static_cast<char>(stream.read_byte());
-				if(controlByte >= 0)
-				{
-					//Read uncompressed string
-					length = controlByte+1;
-					for(int index=0; index < length; ++index)
-						line[colIndex+index] = stream.read_byte();
-				}
-				else if(controlByte > -128)
-				{
-					//Repeat next byte
-					length = -controlByte+1;
-					auto value = stream.read_byte();
-					for(int index=0; index < length; ++index)
-						line[colIndex+index] = value;
-				}
-
-				colIndex += length;
+				src = decode_packbits_scanline(src, end, target_data + scanlineIndex*width + offset, width);
+				continue;
 			}
-			while(colIndex < width);
+
+			src = decode_packbits_scanline(src, end, line.data(), width);
 
 			//use line to populate target
+			auto target_line = target_data + scanlineIndex*width*stride + offset;
 			for(int index = 0; index < width; ++index)
-			{
-				target_data[(scanlineIndex*width+index) * stride + offset] = line[index];
-			}
+				target_line[index * stride] = line[index];
 		}
 	}
 };
@@ -634,6 +676,7 @@ layer::layer() : impl_(spl::make_shared<impl>()) {}
 
 void layer::populate(bigendian_file_input_stream& stream, const psd_document& doc) { impl_->populate(stream, doc); }
 void layer::read_channel_data(bigendian_file_input_stream& stream) { impl_->read_channel_data(stream); }
+void layer::decode_channel_data() { impl_->decode_channel_data(); }
 
 const std::wstring& layer::name() const { return impl_->name_; }
 int layer::opacity() const { return impl_->opacity_; }
@@ -124,6 +124,7 @@ public:
 
 	void populate(bigendian_file_input_stream&, const psd_document&);
 	void read_channel_data(bigendian_file_input_stream&);
+	void decode_channel_data();
 
 	const std::wstring& name() const;
 	int opacity() const;
@@ -25,6 +25,8 @@
 
 #include <common/log.h>
 
+#include <tbb/parallel_for_each.h>
+
 namespace caspar { namespace psd {
 
 psd_document::psd_document()
@@ -40,6 +42,9 @@ void psd_document::parse(const std::wstring& filename)
 	read_color_mode();
 	read_image_resources();
 	read_layers();
+
+	//everything has been copied out of the mapping, don't keep the file open
+	input_.close();
 }
 
 void psd_document::read_header()
@@ -210,9 +215,15 @@ void psd_document::read_layers()
 			auto end = layers_.end();
 			for(auto layer_it = layers_.begin(); layer_it != end; ++layer_it)
 			{
-				(*layer_it)->read_channel_data(input_);	//each layer reads it's "image data"
+				(*layer_it)->read_channel_data(input_);	//each layer locates it's "image data"
 			}
 
+			//the layers are independent of each other, decode them all in parallel
+			tbb::parallel_for_each(layers_.begin(), layers_.end(), [](const layer_ptr& layer)
+			{
+				layer->decode_channel_data();
+			});
+
 			input_.set_position(end_of_layers_info);
 		}
 
@@ -43,6 +43,11 @@ public:
 		return layers_;
 	}
 
+	const std::vector<layer_ptr>& layers() const
+	{
+		return layers_;
+	}
+
 	int width() const
 	{
 		return width_;
@@ -0,0 +1,197 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "psd_document_cache.h"
+#include "psd_document.h"
+
+#include <common/env.h>
+#include <common/log.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <ctime>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <mutex>
+
+namespace caspar { namespace psd {
+
+namespace {
+
+std::size_t bitmap_bytes(const image8bit_ptr& bitmap)
+{
+	return bitmap ? bitmap->width() * bitmap->height() * bitmap->channel_count() : 0;
+}
+
+std::size_t document_bytes(const psd_document& doc)
+{
+	std::size_t result = 0;
+
+	for (auto& layer : doc.layers())
+		result += bitmap_bytes(layer->bitmap()) + bitmap_bytes(layer->mask().bitmap());
+
+	return result;
+}
+
+}
+
+struct psd_document_cache::impl
+{
+	struct entry
+	{
+		std::wstring							filename;
+		std::time_t								modified;
+		std::uintmax_t							file_size;
+		std::size_t								size_bytes;
+		std::shared_ptr<const psd_document>		document;
+		int64_t									hits = 0;
+	};
+
+	mutable std::mutex										mutex_;
+	std::list<entry>										entries_;	// Most recently used first.
+	std::map<std::wstring, std::list<entry>::iterator>		index_;
+	std::size_t												size_bytes_	= 0;
+	const std::size_t										budget_;
+
+	int64_t													hits_		= 0;
+	int64_t													misses_		= 0;
+	int64_t													evictions_	= 0;
+
+	explicit impl(std::size_t budget)
+		: budget_(budget)
+	{
+	}
+
+	std::shared_ptr<const psd_document> load(const std::wstring& filename)
+	{
+		auto modified	= boost::filesystem::last_write_time(filename);
+		auto file_size	= boost::filesystem::file_size(filename);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			auto it = index_.find(filename);
+
+			if (it != index_.end())
+			{
+				if (it->second->modified == modified && it->second->file_size == file_size)
+				{
+					++hits_;
+					++it->second->hits;
+					entries_.splice(entries_.begin(), entries_, it->second);
+
+					return it->second->document;
+				}
+
+				erase(it->second);
+			}
+
+			++misses_;
+		}
+
+		// Parsed without holding the lock, loading one template shouldn't
+		// stall a CG ADD of another one on a different channel.
+		auto document = std::make_shared<psd_document>();
+		document->parse(filename);
+
+		insert(entry { filename, modified, file_size, document_bytes(*document), document });
+
+		return document;
+	}
+
+	void insert(entry e)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		auto it = index_.find(e.filename);
+
+		if (it != index_.end())
+			erase(it->second);
+
+		if (e.size_bytes > budget_)
+			return;
+
+		while (!entries_.empty() && size_bytes_ + e.size_bytes > budget_)
+		{
+			CASPAR_LOG(debug) << L"[psd_document_cache] Evicting " << entries_.back().filename;
+			erase(std::prev(entries_.end()));
+			++evictions_;
+		}
+
+		size_bytes_ += e.size_bytes;
+		entries_.push_front(std::move(e));
+		index_[entries_.front().filename] = entries_.begin();
+	}
+
+	void erase(std::list<entry>::iterator it)
+	{
+		size_bytes_ -= it->size_bytes;
+		index_.erase(it->filename);
+		entries_.erase(it);
+	}
+
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		entries_.clear();
+		index_.clear();
+		size_bytes_ = 0;
+	}
+
+	boost::property_tree::wptree info() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		boost::property_tree::wptree info;
+		info.add(L"budget-bytes",	budget_);
+		info.add(L"size-bytes",		size_bytes_);
+		info.add(L"hits",			hits_);
+		info.add(L"misses",			misses_);
+		info.add(L"evictions",		evictions_);
+
+		for (auto& entry : entries_)
+		{
+			boost::property_tree::wptree document_info;
+			document_info.add(L"filename",		entry.filename);
+			document_info.add(L"layers",		entry.document->layers().size());
+			document_info.add(L"size-bytes",	entry.size_bytes);
+			document_info.add(L"hits",			entry.hits);
+			info.add_child(L"documents.document", document_info);
+		}
+
+		return info;
+	}
+};
+
+psd_document_cache::psd_document_cache(std::size_t budget) : impl_(new impl(budget)) {}
+psd_document_cache::~psd_document_cache() {}
+psd_document_cache& psd_document_cache::instance()
+{
+	static psd_document_cache cache(env::properties().get(L"configuration.psd.document-cache-size", 256u) * 1024ull * 1024ull);
+	return cache;
+}
+std::shared_ptr<const psd_document> psd_document_cache::load(const std::wstring& filename) { return impl_->load(filename); }
+void psd_document_cache::clear() { impl_->clear(); }
+std::size_t psd_document_cache::budget() const { return impl_->budget_; }
+boost::property_tree::wptree psd_document_cache::info() const { return impl_->info(); }
+
+}}
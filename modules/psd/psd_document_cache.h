@@ -0,0 +1,60 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <common/memory.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/property_tree/ptree_fwd.hpp>
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace caspar { namespace psd {
+
+class psd_document;
+
+/**
+ * Process wide cache of parsed documents, keyed by path. An entry is only
+ * reused while the file's modification time and size are unchanged, so an
+ * edited template is parsed again on the next load. Entries are evicted
+ * least recently used first when the byte budget of their decoded bitmaps
+ * (configuration/psd/document-cache-size, in MiB) is exceeded.
+ */
+class psd_document_cache : boost::noncopyable
+{
+public:
+	explicit psd_document_cache(std::size_t budget);
+	~psd_document_cache();
+
+	static psd_document_cache& instance();
+
+	std::shared_ptr<const psd_document>	load(const std::wstring& filename);
+	void								clear();
+
+	std::size_t							budget() const;
+	boost::property_tree::wptree		info() const;
+private:
+	struct impl;
+	spl::unique_ptr<impl> impl_;
+};
+
+}}
@@ -24,6 +24,10 @@
 #include <common/utf.h>
 #include <common/endian.h>
 
+#include <boost/filesystem.hpp>
+
+#include <cstring>
+
 namespace caspar { namespace psd {
 
 bigendian_file_input_stream::bigendian_file_input_stream()
@@ -37,30 +41,65 @@ bigendian_file_input_stream::~bigendian_file_input_stream()
 
 void bigendian_file_input_stream::open(const std::wstring& filename)
 {
+	close();
 	filename_ = filename;
-	ifs_.open(filename_.c_str(), std::ios::in | std::ios::binary);
-	if(!ifs_.is_open())
-		CASPAR_THROW_EXCEPTION(file_not_found());
+
+	try
+	{
+		boost::interprocess::file_mapping file(boost::filesystem::path(filename_).string().c_str(), boost::interprocess::read_only);
+		auto size = boost::filesystem::file_size(filename_);
+
+		if (size > 0)	//an empty file can't be mapped, it will fail on the first read instead
+		{
+			boost::interprocess::mapped_region region(file, boost::interprocess::read_only);
+			region_.swap(region);
+		}
+
+		file_.swap(file);
+	}
+	catch (const boost::interprocess::interprocess_exception&)
+	{
+		CASPAR_THROW_EXCEPTION(file_not_found() << msg_info(L"Failed to open " + filename_));
+	}
+	catch (const boost::filesystem::filesystem_error&)
+	{
+		CASPAR_THROW_EXCEPTION(file_not_found() << msg_info(L"Failed to open " + filename_));
+	}
+
+	data_ = static_cast<const std::uint8_t*>(region_.get_address());
+	size_ = static_cast<std::streamoff>(region_.get_size());
+	position_ = 0;
 }
 
 void bigendian_file_input_stream::close()
 {
-	if(ifs_.is_open())
-		ifs_.close();
+	boost::interprocess::mapped_region().swap(region_);
+	boost::interprocess::file_mapping().swap(file_);
+	data_ = nullptr;
+	size_ = 0;
+	position_ = 0;
 }
 
-std::uint8_t bigendian_file_input_stream::read_byte()
+const std::uint8_t* bigendian_file_input_stream::advance(std::streamsize length)
 {
-	std::uint8_t out;
-	read(reinterpret_cast<char*>(&out), 1);
+	if (length < 0 || position_ < 0 || position_ + length > size_)
+		CASPAR_THROW_EXCEPTION(unexpected_eof_exception());
+
+	auto result = data_ + position_;
+	position_ += length;
+
+	return result;
+}
 
-	return out;
+std::uint8_t bigendian_file_input_stream::read_byte()
+{
+	return *advance(1);
 }
 
 std::uint16_t bigendian_file_input_stream::read_short()
 {
 	std::uint16_t out;
-	read(reinterpret_cast<char*>(&out), 2);
+	std::memcpy(&out, advance(2), 2);
 
 	return caspar::swap_byte_order(out);
 }
@@ -68,7 +107,7 @@ std::uint16_t bigendian_file_input_stream::read_short()
 std::uint32_t bigendian_file_input_stream::read_long()
 {
 	std::uint32_t in;
-	read(reinterpret_cast<char*>(&in), 4);
+	std::memcpy(&in, advance(4), 4);
 
 	return caspar::swap_byte_order(in);
 }
@@ -85,30 +124,27 @@ double bigendian_file_input_stream::read_double()
 void bigendian_file_input_stream::read(char* buf, std::streamsize length)
 {
 	if (length > 0)
-	{
-		if (ifs_.eof())
-			CASPAR_THROW_EXCEPTION(unexpected_eof_exception());
+		std::memcpy(buf, advance(length), static_cast<std::size_t>(length));
+}
 
-		ifs_.read(buf, length);
-		
-		if (ifs_.gcount() < length)
-			CASPAR_THROW_EXCEPTION(unexpected_eof_exception());
-	}
+const std::uint8_t* bigendian_file_input_stream::read_block(std::streamsize length)
+{
+	return advance(length);
 }
 
 std::streamoff bigendian_file_input_stream::current_position()
 {
-	return ifs_.tellg();
+	return position_;
 }
 
 void bigendian_file_input_stream::set_position(std::streamoff offset)
 {
-	ifs_.seekg(offset, std::ios_base::beg);
+	position_ = offset;
 }
 
 void bigendian_file_input_stream::discard_bytes(std::streamoff length)
 {
-	ifs_.seekg(length, std::ios_base::cur);
+	position_ += length;
 }
 
 void bigendian_file_input_stream::discard_to_next_word()
@@ -23,16 +23,20 @@
 
 #include <common/except.h>
 
-#include <boost/filesystem/fstream.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 
 #include <string>
-#include <fstream>
+#include <ios>
 #include <cstdint>
 
 namespace caspar { namespace psd {
 
 struct unexpected_eof_exception : virtual io_error {};
 
+// Reads big-endian data from a memory mapped file. The whole file is mapped on open so reading is
+// plain memory access, and read_block() hands out pointers into the mapping that stay valid until
+// the stream is closed.
 class bigendian_file_input_stream
 {
 public:
@@ -42,6 +46,7 @@ public:
 	void open(const std::wstring& filename);
 
 	void read(char*, std::streamsize);
+	const std::uint8_t* read_block(std::streamsize);
 	std::uint8_t read_byte();
 	std::uint16_t read_short();
 	std::uint32_t read_long();
@@ -59,8 +64,14 @@ public:
 
 	void close();
 private:
-	boost::filesystem::ifstream	ifs_;
-	std::wstring				filename_;
+	const std::uint8_t* advance(std::streamsize);
+
+	boost::interprocess::file_mapping	file_;
+	boost::interprocess::mapped_region	region_;
+	const std::uint8_t*					data_		= nullptr;
+	std::streamoff						size_		= 0;
+	std::streamoff						position_	= 0;
+	std::wstring						filename_;
 };
 
 class StreamPositionBackup
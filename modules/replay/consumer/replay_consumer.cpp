@@ -0,0 +1,229 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "replay_consumer.h"
+
+#include "../util/replay_buffer.h"
+
+#include <common/except.h>
+#include <common/executor.h>
+#include <common/diagnostics/graph.h>
+#include <common/future.h>
+#include <common/log.h>
+#include <common/param.h>
+#include <common/timer.h>
+
+#include <core/consumer/frame_consumer.h>
+#include <core/frame/frame.h>
+#include <core/frame/audio_channel_layout.h>
+#include <core/video_format.h>
+#include <core/help/help_sink.h>
+#include <core/help/help_repository.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <atomic>
+#include <cmath>
+#include <mutex>
+
+namespace caspar { namespace replay {
+
+// Frames waiting for the recording executor. Anything beyond this is dropped
+// instead of delaying the channel.
+const int MAX_PENDING_FRAMES = 3;
+
+struct replay_consumer : public core::frame_consumer
+{
+	core::monitor::subject				monitor_subject_;
+	spl::shared_ptr<diagnostics::graph>	graph_;
+
+	const std::wstring					name_;
+	const double						seconds_;
+	const bool							compress_;
+	const int							consumer_index_;
+	int									channel_index_		= -1;
+	std::shared_ptr<replay_buffer>		buffer_;
+	std::atomic<int64_t>				current_age_;
+
+	executor							executor_;
+public:
+	replay_consumer(const std::wstring& name, double seconds, bool compress)
+		: name_(name)
+		, seconds_(seconds)
+		, compress_(compress)
+		, consumer_index_(next_consumer_index())
+		, executor_(L"replay_consumer " + name)
+	{
+		current_age_ = 0;
+
+		graph_->set_color("write-time", diagnostics::color(0.1f, 1.0f, 0.1f));
+		graph_->set_color("dropped-frame", diagnostics::color(0.3f, 0.6f, 0.3f));
+		diagnostics::register_graph(graph_);
+	}
+
+	static int next_consumer_index()
+	{
+		static std::atomic<int> consumer_index_counter;
+		static std::once_flag consumer_index_counter_initialized;
+
+		std::call_once(consumer_index_counter_initialized, [&]()
+		{
+			consumer_index_counter = 0;
+		});
+
+		return ++consumer_index_counter;
+	}
+
+	// frame_consumer
+
+	void initialize(const core::video_format_desc& format_desc, const core::audio_channel_layout& channel_layout, int channel_index) override
+	{
+		channel_index_ = channel_index;
+
+		auto capacity = static_cast<int>(std::ceil(seconds_ * format_desc.fps));
+
+		executor_.invoke([=]
+		{
+			buffer_ = std::make_shared<replay_buffer>(name_, format_desc, channel_layout, capacity, compress_);
+		});
+
+		register_replay_buffer(spl::make_shared_ptr(buffer_));
+		graph_->set_text(print());
+
+		CASPAR_LOG(info) << print() << L" Initialized with " << capacity << L" frames.";
+	}
+
+	std::future<bool> send(core::const_frame frame) override
+	{
+		if (executor_.size() >= MAX_PENDING_FRAMES)
+		{
+			graph_->set_tag(diagnostics::tag_severity::WARNING, "dropped-frame");
+			return make_ready_future(true);
+		}
+
+		executor_.begin_invoke([=]
+		{
+			caspar::timer write_timer;
+
+			buffer_->write(frame);
+
+			graph_->set_value("write-time", write_timer.elapsed() * buffer_->format_desc().fps * 0.5);
+			current_age_ = frame.get_age_millis();
+		});
+
+		return make_ready_future(true);
+	}
+
+	std::wstring print() const override
+	{
+		return L"replay[" + name_ + L"|" + boost::lexical_cast<std::wstring>(channel_index_) + L"]";
+	}
+
+	std::wstring name() const override
+	{
+		return L"replay";
+	}
+
+	boost::property_tree::wptree info() const override
+	{
+		boost::property_tree::wptree info;
+		info.add(L"type", L"replay");
+
+		auto buffer = buffer_;
+
+		if (buffer)
+			info.add_child(L"buffer", buffer->info());
+
+		return info;
+	}
+
+	bool has_synchronization_clock() const override
+	{
+		return false;
+	}
+
+	int buffer_depth() const override
+	{
+		return -1;
+	}
+
+	int index() const override
+	{
+		return 110000 + consumer_index_;
+	}
+
+	int64_t presentation_frame_age_millis() const override
+	{
+		return current_age_;
+	}
+
+	core::monitor::subject& monitor_output() override
+	{
+		return monitor_subject_;
+	}
+};
+
+void describe_consumer(core::help_sink& sink, const core::help_repository& repo)
+{
+	sink.short_description(L"Keeps the last seconds of a channel in memory for instant replay.");
+	sink.syntax(L"REPLAY [name:string] {SECONDS [seconds:float|10]} {[compress:COMPRESS]}");
+	sink.para()
+		->text(L"Records the video, audio and ancillary data of a channel into a ring buffer in RAM that always holds the last ")
+		->code(L"seconds")->text(L" seconds. The recording can be played back with the ")
+		->code(L"replay://")->text(L" producer while recording continues.");
+	sink.para()
+		->text(L"Uncompressed recording needs one full frame of memory per recorded frame, so plan for ")
+		->text(L"about 8 MB per frame in 1080p. ")
+		->code(L"COMPRESS")->text(L" enables a fast lossless intra coder that is run on worker threads. ")
+		->text(L"It works best on graphics and other content with flat areas.");
+	sink.para()->text(L"Memory use and encoder load are reported by INFO on the channel.");
+	sink.para()->text(L"Examples:");
+	sink.example(L">> ADD 1 REPLAY cam1 SECONDS 30", L"keeps the last 30 seconds of channel 1 under the name cam1.");
+	sink.example(L">> ADD 1 REPLAY cam1 SECONDS 60 COMPRESS", L"keeps the last minute of channel 1 compressed.");
+}
+
+spl::shared_ptr<core::frame_consumer> create_consumer(
+		const std::vector<std::wstring>& params, core::interaction_sink*, std::vector<spl::shared_ptr<core::video_channel>> channels)
+{
+	if (params.size() < 2 || !boost::iequals(params.at(0), L"REPLAY"))
+		return core::frame_consumer::empty();
+
+	auto name		= params.at(1);
+	auto seconds	= get_param(L"SECONDS", params, 10.0);
+	auto compress	= contains_param(L"COMPRESS", params);
+
+	if (seconds <= 0.0)
+		CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"SECONDS must be positive."));
+
+	return spl::make_shared<replay_consumer>(name, seconds, compress);
+}
+
+spl::shared_ptr<core::frame_consumer> create_preconfigured_consumer(
+		const boost::property_tree::wptree& ptree, core::interaction_sink*, std::vector<spl::shared_ptr<core::video_channel>> channels)
+{
+	auto name		= ptree.get<std::wstring>(L"name");
+	auto seconds	= ptree.get(L"seconds", 10.0);
+	auto compress	= ptree.get(L"compress", false);
+
+	return spl::make_shared<replay_consumer>(name, seconds, compress);
+}
+
+}}
@@ -0,0 +1,299 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "replay_producer.h"
+
+#include "../util/replay_buffer.h"
+
+#include <common/except.h>
+#include <common/future.h>
+#include <common/log.h>
+#include <common/param.h>
+
+#include <core/ancillary/ancillary.h>
+#include <core/producer/frame_producer.h>
+#include <core/producer/framerate/framerate_producer.h>
+#include <core/frame/draw_frame.h>
+#include <core/frame/frame.h>
+#include <core/frame/frame_factory.h>
+#include <core/frame/pixel_format.h>
+#include <core/frame/audio_channel_layout.h>
+#include <core/monitor/monitor.h>
+#include <core/video_format.h>
+#include <core/help/help_sink.h>
+#include <core/help/help_repository.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+namespace caspar { namespace replay {
+
+class replay_producer : public core::frame_producer_base
+{
+	core::monitor::subject						monitor_subject_;
+	const spl::shared_ptr<core::frame_factory>	frame_factory_;
+	const spl::shared_ptr<replay_buffer>		buffer_;
+	core::constraints							constraints_;
+	core::pixel_format_desc						desc_;
+
+	const std::int64_t							in_;
+	const std::int64_t							out_;
+	std::atomic<std::int64_t>					position_;
+	std::atomic<int>							direction_;
+	std::atomic<bool>							loop_;
+public:
+	replay_producer(
+			const spl::shared_ptr<core::frame_factory>& frame_factory,
+			const spl::shared_ptr<replay_buffer>& buffer,
+			std::int64_t in,
+			std::int64_t length,
+			bool reverse,
+			bool loop)
+		: frame_factory_(frame_factory)
+		, buffer_(buffer)
+		, constraints_(buffer->format_desc().width, buffer->format_desc().height)
+		, desc_(core::pixel_format::bgra)
+		, in_(in)
+		, out_(length > 0 ? in + length - 1 : std::numeric_limits<std::int64_t>::max())
+	{
+		desc_.planes.push_back(core::pixel_format_desc::plane(buffer->format_desc().width, buffer->format_desc().height, 4));
+
+		direction_	= reverse ? -1 : 1;
+		loop_		= loop;
+		position_	= reverse ? out_ : in_; // Reverse playback without a length starts at the live edge.
+
+		CASPAR_LOG(info) << print() << L" Initialized";
+	}
+
+	~replay_producer()
+	{
+		CASPAR_LOG(info) << print() << L" Uninitialized";
+	}
+
+	// frame_producer
+
+	core::draw_frame receive_impl() override
+	{
+		auto first		= std::max(buffer_->first_frame(), in_);
+		auto last		= std::min(buffer_->last_frame(), out_);
+		auto position	= position_.load();
+		auto direction	= direction_.load();
+
+		if (last < first)
+			return core::draw_frame::late();
+
+		if (position > last)
+		{
+			// Reverse playback starts at the newest frame of the range.
+			if (direction < 0)
+				position = last;
+			// Caught up with the live edge, or past the out point.
+			else if (last != out_ || !loop_)
+				return core::draw_frame::late();
+			else
+				position = first;
+		}
+		else if (position < first)
+		{
+			// Overwritten while paused.
+			if (direction > 0)
+				position = first;
+			else if (loop_)
+				position = last;
+			// Reversed past the start frame.
+			else
+				return core::draw_frame::late();
+		}
+
+		auto frame = frame_factory_->create_frame(this, desc_, buffer_->channel_layout());
+		core::ancillary::AncillaryContainer ancillary;
+
+		if (!buffer_->read(position, frame, ancillary))
+			return core::draw_frame::late();
+
+		if (direction < 0)
+			reverse_audio(frame.audio_data(), buffer_->channel_layout().num_channels);
+
+		position_ = position + direction;
+
+		core::draw_frame result(std::move(frame));
+		result.ancillary() = std::move(ancillary);
+
+		return result;
+	}
+
+	std::future<std::wstring> call(const std::vector<std::wstring>& params) override
+	{
+		if (params.empty())
+			CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"No command given to " + print()));
+
+		auto& command = params.at(0);
+
+		if (boost::iequals(command, L"SEEK") && params.size() > 1)
+			position_ = in_ + boost::lexical_cast<std::int64_t>(params.at(1));
+		else if (boost::iequals(command, L"LIVE"))
+			position_ = buffer_->last_frame();
+		else if (boost::iequals(command, L"REVERSE"))
+			direction_ = -1;
+		else if (boost::iequals(command, L"FORWARD"))
+			direction_ = 1;
+		else if (boost::iequals(command, L"LOOP"))
+			loop_ = params.size() > 1 ? boost::lexical_cast<int>(params.at(1)) != 0 : true;
+		else
+			CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"Invalid command: " + command));
+
+		return make_ready_future<std::wstring>(L"");
+	}
+
+	uint32_t nb_frames() const override
+	{
+		if (out_ == std::numeric_limits<std::int64_t>::max())
+			return std::numeric_limits<uint32_t>::max();
+
+		return static_cast<uint32_t>(out_ - in_ + 1);
+	}
+
+	std::wstring name() const override
+	{
+		return L"replay";
+	}
+
+	std::wstring print() const override
+	{
+		return L"replay[" + buffer_->name() + L"|" + boost::lexical_cast<std::wstring>(position_.load()) + L"]";
+	}
+
+	core::constraints& pixel_constraints() override
+	{
+		return constraints_;
+	}
+
+	boost::property_tree::wptree info() const override
+	{
+		boost::property_tree::wptree info;
+		info.add(L"type",			L"replay");
+		info.add(L"name",			buffer_->name());
+		info.add(L"in",				in_);
+		info.add(L"position",		position_.load());
+		info.add(L"live-offset",	buffer_->last_frame() - position_.load());
+		info.add(L"direction",		direction_.load() > 0 ? L"forward" : L"reverse");
+		info.add(L"loop",			loop_.load());
+		info.add(L"frame-number",	frame_number());
+		info.add(L"nb-frames",		nb_frames());
+		return info;
+	}
+
+	core::monitor::subject& monitor_output() override
+	{
+		return monitor_subject_;
+	}
+private:
+	static void reverse_audio(core::mutable_audio_buffer& audio, int num_channels)
+	{
+		if (num_channels <= 0)
+			return;
+
+		auto samples = audio.size() / num_channels;
+
+		for (std::size_t n = 0; n < samples / 2; ++n)
+			std::swap_ranges(
+					audio.begin() + n * num_channels,
+					audio.begin() + (n + 1) * num_channels,
+					audio.begin() + (samples - n - 1) * num_channels);
+	}
+};
+
+void describe_producer(core::help_sink& sink, const core::help_repository& repo)
+{
+	sink.short_description(L"Plays back frames recorded by a replay consumer.");
+	sink.syntax(L"replay://[name:string] {START [start:int]} {LENGTH [length:int]} {SPEED [speed:float|1.0]} {[loop:LOOP]}");
+	sink.para()
+		->text(L"Plays any range of a replay buffer created with ")->code(L"ADD 1 REPLAY [name]")
+		->text(L" while the recording continues.");
+	sink.definitions()
+		->item(L"start", L"A negative value is the number of frames before the live edge, a positive value is the frame number since the recording started. Defaults to the oldest recorded frame.")
+		->item(L"length", L"The number of frames to play. Defaults to everything up to the live edge.")
+		->item(L"speed", L"Playback speed. Negative values play in reverse, from the end of the range back to the start frame. Without a length the end of the range is the live edge. Slow motion is done by the framerate producer.");
+	sink.para()->text(L"Examples:");
+	sink.example(L">> PLAY 2-10 replay://cam1 START -250 LENGTH 250", L"plays the last 10 seconds of a 25 fps recording.");
+	sink.example(L">> PLAY 2-10 replay://cam1 START -100 SPEED 0.5", L"plays from 100 frames ago in half speed.");
+	sink.example(L">> PLAY 2-10 replay://cam1 START -50 SPEED -1", L"plays the last 50 frames backwards, from the live edge, and stops at the oldest of them.");
+	sink.para()->text(L"The producer also supports the following CALL commands:");
+	sink.example(L">> CALL 2-10 SEEK 100", L"jumps to frame 100 after the start frame.");
+	sink.example(L">> CALL 2-10 LIVE", L"jumps to the live edge.");
+	sink.example(L">> CALL 2-10 REVERSE", L"plays backwards.");
+	sink.example(L">> CALL 2-10 FORWARD", L"plays forwards.");
+	sink.example(L">> CALL 2-10 LOOP 1", L"loops between the start frame and start + length.");
+	sink.example(L">> CALL 2-10 FRAMERATE SPEED 0.25 25", L"changes to quarter speed over 25 frames.");
+}
+
+spl::shared_ptr<core::frame_producer> create_producer(
+		const core::frame_producer_dependencies& dependencies,
+		const std::vector<std::wstring>& params)
+{
+	static const std::wstring PREFIX = L"replay://";
+
+	if (params.empty() || !boost::istarts_with(params.at(0), PREFIX))
+		return core::frame_producer::empty();
+
+	auto name	= params.at(0).substr(PREFIX.length());
+	auto buffer	= find_replay_buffer(name);
+
+	if (!buffer)
+		CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"No replay buffer named " + name));
+
+	auto start	= get_param(L"START", params, std::numeric_limits<std::int64_t>::min());
+	auto length	= get_param(L"LENGTH", params, static_cast<std::int64_t>(0));
+	auto speed	= get_param(L"SPEED", params, 1.0);
+	auto loop	= contains_param(L"LOOP", params);
+
+	if (speed == 0.0)
+		CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"SPEED can not be 0."));
+
+	std::int64_t in;
+
+	if (start == std::numeric_limits<std::int64_t>::min())
+		in = buffer->first_frame();
+	else if (start < 0)
+		in = std::max<std::int64_t>(0, buffer->last_frame() + 1 + start);
+	else
+		in = start;
+
+	auto framerate	= buffer->format_desc().framerate;
+	auto producer	= spl::make_shared<replay_producer>(dependencies.frame_factory, spl::make_shared_ptr(buffer), in, length, speed < 0.0, loop);
+	auto result		= core::create_framerate_producer(
+			producer,
+			dependencies.frame_factory,
+			[framerate] { return framerate; },
+			dependencies.format_desc.framerate,
+			dependencies.format_desc.field_mode,
+			dependencies.format_desc.audio_cadence);
+
+	if (std::abs(speed) != 1.0)
+		result->call({ L"FRAMERATE", L"SPEED", boost::lexical_cast<std::wstring>(std::abs(speed)) });
+
+	return result;
+}
+
+}}
@@ -0,0 +1,228 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "frame_codec.h"
+
+#include <tbb/parallel_for.h>
+
+#include <atomic>
+#include <cstring>
+
+namespace caspar { namespace replay {
+
+namespace {
+
+const int MIN_LINES_PER_BAND = 32;
+const int MAX_BANDS = 32;
+
+void append_uint32(std::vector<std::uint8_t>& dst, std::uint32_t value)
+{
+	auto offset = dst.size();
+	dst.resize(offset + sizeof(value));
+	std::memcpy(dst.data() + offset, &value, sizeof(value));
+}
+
+std::uint32_t read_uint32(const std::uint8_t* src)
+{
+	std::uint32_t value;
+	std::memcpy(&value, src, sizeof(value));
+	return value;
+}
+
+// PackBits as used by TIFF and PSD: a header byte n in [0, 127] is followed
+// by n + 1 literal bytes, n in [-127, -1] is followed by one byte repeated
+// 1 - n times.
+void pack_bits(const std::uint8_t* src, std::size_t size, std::vector<std::uint8_t>& dst)
+{
+	std::size_t i = 0;
+
+	while (i < size)
+	{
+		std::size_t run = 1;
+
+		while (i + run < size && run < 128 && src[i + run] == src[i])
+			++run;
+
+		if (run >= 3)
+		{
+			dst.push_back(static_cast<std::uint8_t>(257 - run));
+			dst.push_back(src[i]);
+			i += run;
+			continue;
+		}
+
+		auto start = i;
+
+		while (i < size && i - start < 128)
+		{
+			if (i + 2 < size && src[i] == src[i + 1] && src[i] == src[i + 2])
+				break;
+
+			++i;
+		}
+
+		auto count = i - start;
+		dst.push_back(static_cast<std::uint8_t>(count - 1));
+		dst.insert(dst.end(), src + start, src + i);
+	}
+}
+
+const std::uint8_t* unpack_bits(const std::uint8_t* src, const std::uint8_t* end, std::uint8_t* dst, std::size_t size)
+{
+	std::size_t i = 0;
+
+	while (i < size)
+	{
+		if (src >= end)
+			return nullptr;
+
+		auto header = static_cast<std::int8_t>(*src++);
+
+		if (header >= 0)
+		{
+			std::size_t count = header + 1;
+
+			if (i + count > size || src + count > end)
+				return nullptr;
+
+			std::memcpy(dst + i, src, count);
+			src += count;
+			i += count;
+		}
+		else if (header != -128)
+		{
+			std::size_t count = 1 - header;
+
+			if (i + count > size || src >= end)
+				return nullptr;
+
+			std::memset(dst + i, *src++, count);
+			i += count;
+		}
+	}
+
+	return src;
+}
+
+}
+
+frame_codec::frame_codec(int width, int height)
+	: width_(width)
+	, height_(height)
+	, lines_per_band_(std::max(MIN_LINES_PER_BAND, (height + MAX_BANDS - 1) / MAX_BANDS))
+	, band_count_((height + lines_per_band_ - 1) / lines_per_band_)
+	, band_buffers_(band_count_)
+	, residual_buffers_(band_count_, std::vector<std::uint8_t>(static_cast<std::size_t>(width) * 4))
+{
+	auto line_size = static_cast<std::size_t>(width_) * 4;
+
+	for (auto& buffer : band_buffers_)
+		buffer.reserve((line_size + line_size / 128 + 1) * lines_per_band_);
+}
+
+std::size_t frame_codec::max_encoded_size() const
+{
+	auto line_size = static_cast<std::size_t>(width_) * 4;
+
+	return sizeof(std::uint32_t) * (band_count_ + 1) + (line_size + line_size / 128 + 1) * height_;
+}
+
+void frame_codec::encode(const std::uint8_t* src, std::vector<std::uint8_t>& dst)
+{
+	auto line_size = static_cast<std::size_t>(width_) * 4;
+
+	tbb::parallel_for(0, band_count_, [&](int band)
+	{
+		auto& buffer	= band_buffers_[band];
+		auto begin		= band * lines_per_band_;
+		auto end		= std::min(height_, begin + lines_per_band_);
+
+		auto& residual	= residual_buffers_[band];
+
+		buffer.clear();
+
+		for (int y = begin; y < end; ++y)
+		{
+			auto line = src + y * line_size;
+
+			std::memcpy(residual.data(), line, 4);
+
+			for (std::size_t x = 4; x < line_size; ++x)
+				residual[x] = static_cast<std::uint8_t>(line[x] - line[x - 4]);
+
+			pack_bits(residual.data(), line_size, buffer);
+		}
+	});
+
+	append_uint32(dst, static_cast<std::uint32_t>(band_count_));
+
+	for (auto& buffer : band_buffers_)
+		append_uint32(dst, static_cast<std::uint32_t>(buffer.size()));
+
+	for (auto& buffer : band_buffers_)
+		dst.insert(dst.end(), buffer.begin(), buffer.end());
+}
+
+bool frame_codec::decode(const std::uint8_t* src, std::size_t size, std::uint8_t* dst) const
+{
+	auto header_size = sizeof(std::uint32_t) * (band_count_ + 1);
+
+	if (size < header_size || read_uint32(src) != static_cast<std::uint32_t>(band_count_))
+		return false;
+
+	std::vector<const std::uint8_t*> band_begins(band_count_);
+	auto offset = header_size;
+
+	for (int band = 0; band < band_count_; ++band)
+	{
+		band_begins[band] = src + offset;
+		offset += read_uint32(src + sizeof(std::uint32_t) * (band + 1));
+	}
+
+	if (offset != size)
+		return false;
+
+	auto line_size = static_cast<std::size_t>(width_) * 4;
+	std::atomic<bool> ok(true);
+
+	tbb::parallel_for(0, band_count_, [&](int band)
+	{
+		auto begin		= band * lines_per_band_;
+		auto end		= std::min(height_, begin + lines_per_band_);
+		auto data		= band_begins[band];
+		auto data_end	= band + 1 < band_count_ ? band_begins[band + 1] : src + size;
+
+		for (int y = begin; y < end && data; ++y)
+		{
+			auto line = dst + y * line_size;
+
+			data = unpack_bits(data, data_end, line, line_size);
+
+			for (std::size_t x = 4; data && x < line_size; ++x)
+				line[x] = static_cast<std::uint8_t>(line[x] + line[x - 4]);
+		}
+
+		if (!data)
+			ok = false;
+	});
+
+	return ok;
+}
+
+}}
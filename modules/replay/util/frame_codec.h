@@ -0,0 +1,56 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace caspar { namespace replay {
+
+// Fast lossless intra coder for BGRA frames. Every line is left-predicted
+// and the residual is PackBits encoded. The frame is split into horizontal
+// bands that are encoded and decoded in parallel.
+class frame_codec final
+{
+public:
+	frame_codec(int width, int height);
+
+	// Appends the encoded frame to dst. dst keeps its capacity between calls,
+	// so a reused buffer will stop allocating once it has seen a large frame.
+	void encode(const std::uint8_t* src, std::vector<std::uint8_t>& dst);
+
+	// Decodes a frame produced by encode() into dst (width * height * 4 bytes).
+	bool decode(const std::uint8_t* src, std::size_t size, std::uint8_t* dst) const;
+
+	// Worst case size of an encoded frame.
+	std::size_t max_encoded_size() const;
+
+	int width() const { return width_; }
+	int height() const { return height_; }
+private:
+	int										width_;
+	int										height_;
+	int										lines_per_band_;
+	int										band_count_;
+	std::vector<std::vector<std::uint8_t>>	band_buffers_;
+	std::vector<std::vector<std::uint8_t>>	residual_buffers_;
+};
+
+}}
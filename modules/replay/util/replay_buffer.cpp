@@ -0,0 +1,263 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "replay_buffer.h"
+#include "frame_codec.h"
+
+#include <common/except.h>
+#include <common/timer.h>
+
+#include <core/ancillary/ancillary.h>
+#include <core/frame/frame.h>
+#include <core/frame/audio_channel_layout.h>
+#include <core/video_format.h>
+
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/range/algorithm/max_element.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+namespace caspar { namespace replay {
+
+struct replay_buffer::impl : boost::noncopyable
+{
+	struct slot
+	{
+		std::mutex							mutex;
+		std::int64_t						frame_number	= -1;
+		std::vector<std::uint8_t>			image;
+		std::vector<std::int32_t>			audio;
+		core::ancillary::AncillaryContainer	ancillary;
+	};
+
+	const std::wstring					name_;
+	const core::video_format_desc		format_desc_;
+	const core::audio_channel_layout	channel_layout_;
+	const bool							compress_;
+	const std::size_t					image_size_;
+	mutable std::vector<slot>			slots_;
+	frame_codec							encoder_;
+	frame_codec							decoder_;
+
+	std::atomic<std::int64_t>			last_frame_;
+	std::atomic<std::int64_t>			memory_bytes_;
+	std::atomic<std::int64_t>			encoded_bytes_;
+	std::atomic<std::int64_t>			encode_time_us_;
+
+	impl(
+			const std::wstring& name,
+			const core::video_format_desc& format_desc,
+			const core::audio_channel_layout& channel_layout,
+			int capacity,
+			bool compress)
+		: name_(name)
+		, format_desc_(format_desc)
+		, channel_layout_(channel_layout)
+		, compress_(compress)
+		, image_size_(static_cast<std::size_t>(format_desc.width) * format_desc.height * 4)
+		, slots_(std::max(capacity, 2))
+		, encoder_(format_desc.width, format_desc.height)
+		, decoder_(format_desc.width, format_desc.height)
+	{
+		last_frame_		= -1;
+		encoded_bytes_	= 0;
+		encode_time_us_	= 0;
+
+		auto max_cadence = *boost::max_element(format_desc_.audio_cadence);
+		std::int64_t memory_bytes = 0;
+
+		// Uncompressed slots are allocated up front. Compressed slots grow to
+		// the size of the largest frame they have held and are reused from
+		// there on, so recording stops allocating after the first lap.
+		for (auto& slot : slots_)
+		{
+			if (!compress_)
+				slot.image.reserve(image_size_);
+
+			slot.audio.reserve(max_cadence * channel_layout_.num_channels);
+			memory_bytes += slot.image.capacity() + slot.audio.capacity() * sizeof(std::int32_t);
+		}
+
+		memory_bytes_ = memory_bytes;
+	}
+
+	void write(const core::const_frame& frame)
+	{
+		auto image = frame.image_data();
+
+		if (image.size() != image_size_)
+			return;
+
+		auto frame_number	= last_frame_ + 1;
+		auto& slot			= slots_[frame_number % slots_.size()];
+
+		std::lock_guard<std::mutex> lock(slot.mutex);
+
+		auto capacity_before = static_cast<std::int64_t>(slot.image.capacity() + slot.audio.capacity() * sizeof(std::int32_t));
+
+		if (compress_)
+		{
+			caspar::timer encode_timer;
+
+			slot.image.clear();
+			encoder_.encode(image.begin(), slot.image);
+
+			encode_time_us_	= static_cast<std::int64_t>(encode_timer.elapsed() * 1000000.0);
+			encoded_bytes_	= slot.image.size();
+		}
+		else
+		{
+			slot.image.resize(image_size_);
+			std::memcpy(slot.image.data(), image.begin(), image_size_);
+		}
+
+		slot.audio.assign(frame.audio_data().begin(), frame.audio_data().end());
+		slot.ancillary		= frame.ancillary();
+		slot.frame_number	= frame_number;
+
+		memory_bytes_ += static_cast<std::int64_t>(slot.image.capacity() + slot.audio.capacity() * sizeof(std::int32_t)) - capacity_before;
+		last_frame_ = frame_number;
+	}
+
+	bool read(std::int64_t frame_number, core::mutable_frame& frame, core::ancillary::AncillaryContainer& ancillary) const
+	{
+		if (frame_number < first_frame() || frame_number > last_frame_)
+			return false;
+
+		auto& slot = slots_[frame_number % slots_.size()];
+
+		std::lock_guard<std::mutex> lock(slot.mutex);
+
+		if (slot.frame_number != frame_number || frame.image_data().size() != image_size_)
+			return false;
+
+		if (compress_)
+		{
+			if (!decoder_.decode(slot.image.data(), slot.image.size(), frame.image_data().begin()))
+				CASPAR_THROW_EXCEPTION(invalid_operation() << msg_info(L"Corrupt frame in replay buffer " + name_));
+		}
+		else
+			std::memcpy(frame.image_data().begin(), slot.image.data(), image_size_);
+
+		frame.audio_data().assign(slot.audio.begin(), slot.audio.end());
+		ancillary = slot.ancillary;
+
+		return true;
+	}
+
+	std::int64_t first_frame() const
+	{
+		// The oldest slot is the next one to be overwritten, so it is not
+		// handed out to readers.
+		return std::max<std::int64_t>(0, last_frame_ - static_cast<std::int64_t>(slots_.size()) + 2);
+	}
+
+	boost::property_tree::wptree info() const
+	{
+		boost::property_tree::wptree info;
+		auto last = last_frame_.load();
+
+		info.add(L"name",				name_);
+		info.add(L"video-mode",			format_desc_.name);
+		info.add(L"capacity-frames",	slots_.size());
+		info.add(L"recorded-frames",	last + 1);
+		info.add(L"available-frames",	last < 0 ? 0 : last - first_frame() + 1);
+		info.add(L"memory-bytes",		memory_bytes_.load());
+		info.add(L"compressed",			compress_);
+
+		if (compress_)
+		{
+			auto encoded_bytes = encoded_bytes_.load();
+
+			info.add(L"compression-ratio",	encoded_bytes > 0 ? static_cast<double>(image_size_) / encoded_bytes : 0.0);
+			info.add(L"encode-time",		encode_time_us_.load() / 1000.0);
+			info.add(L"encode-load",		encode_time_us_.load() / 1000000.0 * format_desc_.fps);
+		}
+
+		return info;
+	}
+};
+
+replay_buffer::replay_buffer(
+		const std::wstring& name,
+		const core::video_format_desc& format_desc,
+		const core::audio_channel_layout& channel_layout,
+		int capacity,
+		bool compress)
+	: impl_(new impl(name, format_desc, channel_layout, capacity, compress)) {}
+replay_buffer::~replay_buffer() {}
+void replay_buffer::write(const core::const_frame& frame) { impl_->write(frame); }
+bool replay_buffer::read(std::int64_t frame_number, core::mutable_frame& frame, core::ancillary::AncillaryContainer& ancillary) const { return impl_->read(frame_number, frame, ancillary); }
+std::int64_t replay_buffer::first_frame() const { return impl_->first_frame(); }
+std::int64_t replay_buffer::last_frame() const { return impl_->last_frame_; }
+const std::wstring& replay_buffer::name() const { return impl_->name_; }
+const core::video_format_desc& replay_buffer::format_desc() const { return impl_->format_desc_; }
+const core::audio_channel_layout& replay_buffer::channel_layout() const { return impl_->channel_layout_; }
+boost::property_tree::wptree replay_buffer::info() const { return impl_->info(); }
+
+namespace {
+
+std::mutex& registry_mutex()
+{
+	static std::mutex instance;
+	return instance;
+}
+
+std::map<std::wstring, std::weak_ptr<replay_buffer>>& registry()
+{
+	static std::map<std::wstring, std::weak_ptr<replay_buffer>> instance;
+	return instance;
+}
+
+}
+
+void register_replay_buffer(const spl::shared_ptr<replay_buffer>& buffer)
+{
+	std::lock_guard<std::mutex> lock(registry_mutex());
+	auto& buffers = registry();
+
+	for (auto it = buffers.begin(); it != buffers.end();)
+	{
+		if (it->second.expired())
+			it = buffers.erase(it);
+		else
+			++it;
+	}
+
+	buffers[boost::to_upper_copy(buffer->name())] = buffer;
+}
+
+std::shared_ptr<replay_buffer> find_replay_buffer(const std::wstring& name)
+{
+	std::lock_guard<std::mutex> lock(registry_mutex());
+	auto& buffers = registry();
+	auto found = buffers.find(boost::to_upper_copy(name));
+
+	if (found == buffers.end())
+		return nullptr;
+
+	return found->second.lock();
+}
+
+}}
@@ -0,0 +1,72 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <common/memory.h>
+
+#include <core/fwd.h>
+
+#include <boost/property_tree/ptree_fwd.hpp>
+
+#include <cstdint>
+#include <string>
+
+FORWARD3(caspar, core, ancillary, class AncillaryContainer);
+
+namespace caspar { namespace replay {
+
+// Fixed size ring of the most recent frames of a channel. Written by a
+// replay_consumer and read by any number of replay_producers while the
+// recording continues.
+class replay_buffer final
+{
+	replay_buffer(const replay_buffer&);
+	replay_buffer& operator=(const replay_buffer&);
+public:
+	replay_buffer(
+			const std::wstring& name,
+			const core::video_format_desc& format_desc,
+			const core::audio_channel_layout& channel_layout,
+			int capacity,
+			bool compress);
+	~replay_buffer();
+
+	void write(const core::const_frame& frame);
+
+	// Copies recorded frame number frame_number into frame. Returns false if
+	// the frame has not been recorded yet or has already been overwritten.
+	bool read(std::int64_t frame_number, core::mutable_frame& frame, core::ancillary::AncillaryContainer& ancillary) const;
+
+	std::int64_t first_frame() const;
+	std::int64_t last_frame() const; // -1 until the first frame is recorded
+
+	const std::wstring& name() const;
+	const core::video_format_desc& format_desc() const;
+	const core::audio_channel_layout& channel_layout() const;
+	boost::property_tree::wptree info() const;
+private:
+	struct impl;
+	spl::unique_ptr<impl> impl_;
+};
+
+void register_replay_buffer(const spl::shared_ptr<replay_buffer>& buffer);
+std::shared_ptr<replay_buffer> find_replay_buffer(const std::wstring& name);
+
+}}
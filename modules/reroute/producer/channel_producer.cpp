@@ -353,6 +353,7 @@ spl::shared_ptr<core::frame_producer> create_channel_producer(
 
 	return core::create_framerate_producer(
 			producer,
+			dependencies.frame_factory,
 			[producer] { return producer->current_framerate(); },
 			dependencies.format_desc.framerate,
 			dependencies.format_desc.field_mode,
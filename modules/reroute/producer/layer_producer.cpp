@@ -254,6 +254,7 @@ public:
 };
 
 spl::shared_ptr<core::frame_producer> create_layer_producer(
+		const spl::shared_ptr<core::frame_factory>& frame_factory,
 		const spl::shared_ptr<core::video_channel>& channel,
 		int layer,
 		int frames_delay,
@@ -263,6 +264,7 @@ spl::shared_ptr<core::frame_producer> create_layer_producer(
 
 	return core::create_framerate_producer(
 			producer,
+			frame_factory,
 			std::bind(&layer_producer::current_framerate, producer),
 			destination_mode.framerate,
 			destination_mode.field_mode,
@@ -28,6 +28,7 @@
 namespace caspar { namespace reroute {
 
 spl::shared_ptr<core::frame_producer> create_layer_producer(
+		const spl::shared_ptr<core::frame_factory>& frame_factory,
 		const spl::shared_ptr<core::video_channel>& channel,
 		int layer,
 		int frames_delay,
@@ -29,7 +29,6 @@
 #include <common/log.h>
 #include <common/memory.h>
 #include <common/array.h>
-#include <common/memshfl.h>
 #include <common/utf.h>
 #include <common/prec_timer.h>
 #include <common/future.h>
@@ -45,6 +44,7 @@
 
 #include <core/video_format.h>
 #include <core/frame/frame.h>
+#include <core/frame/keying.h>
 #include <core/consumer/frame_consumer.h>
 #include <core/interaction/interaction_sink.h>
 #include <core/help/help_sink.h>
@@ -496,7 +496,7 @@ public:
 				tbb::parallel_for(tbb::blocked_range<int>(0, format_desc_.height), [&](const tbb::blocked_range<int>& r)
 				{
 					for(int n = r.begin(); n != r.end(); ++n)
-						aligned_memshfl(ptr+n*format_desc_.width*4, av_frame->data[0]+n*av_frame->linesize[0], format_desc_.width*4, 0x0F0F0F0F, 0x0B0B0B0B, 0x07070707, 0x03030303);
+						core::extract_key(av_frame->data[0]+n*av_frame->linesize[0], reinterpret_cast<uint8_t*>(ptr+n*format_desc_.width*4), format_desc_.width*4);
 				});
 			}
 			else
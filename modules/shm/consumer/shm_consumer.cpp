@@ -0,0 +1,233 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "shm_consumer.h"
+
+#include "../util/shared_memory_ring.h"
+
+#include <common/except.h>
+#include <common/executor.h>
+#include <common/diagnostics/graph.h>
+#include <common/future.h>
+#include <common/log.h>
+#include <common/param.h>
+#include <common/timer.h>
+
+#include <core/consumer/frame_consumer.h>
+#include <core/frame/frame.h>
+#include <core/frame/audio_channel_layout.h>
+#include <core/video_format.h>
+#include <core/help/help_sink.h>
+#include <core/help/help_repository.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <atomic>
+#include <mutex>
+
+namespace caspar { namespace shm {
+
+const int MAX_PENDING_FRAMES = 2;
+
+struct shm_consumer : public core::frame_consumer
+{
+	core::monitor::subject					monitor_subject_;
+	spl::shared_ptr<diagnostics::graph>		graph_;
+
+	const std::wstring						name_;
+	const int								slot_count_;
+	const int								max_ancillary_size_;
+	const int								consumer_index_;
+	int										channel_index_		= -1;
+	double									fps_				= 0.0;
+	std::unique_ptr<shared_memory_ring>		ring_;
+	std::atomic<int64_t>					current_age_;
+	std::atomic<int64_t>					frames_written_;
+	std::atomic<int64_t>					frames_dropped_;
+
+	executor								executor_;
+public:
+	shm_consumer(const std::wstring& name, int slot_count, int max_ancillary_size)
+		: name_(name)
+		, slot_count_(slot_count)
+		, max_ancillary_size_(max_ancillary_size)
+		, consumer_index_(next_consumer_index())
+		, executor_(L"shm_consumer " + name)
+	{
+		current_age_	= 0;
+		frames_written_	= 0;
+		frames_dropped_	= 0;
+
+		graph_->set_color("write-time", diagnostics::color(0.1f, 1.0f, 0.1f));
+		graph_->set_color("dropped-frame", diagnostics::color(0.3f, 0.6f, 0.3f));
+		diagnostics::register_graph(graph_);
+	}
+
+	~shm_consumer()
+	{
+		executor_.invoke([=]
+		{
+			ring_.reset();
+		});
+	}
+
+	static int next_consumer_index()
+	{
+		static std::atomic<int> consumer_index_counter;
+		static std::once_flag consumer_index_counter_initialized;
+
+		std::call_once(consumer_index_counter_initialized, [&]()
+		{
+			consumer_index_counter = 0;
+		});
+
+		return ++consumer_index_counter;
+	}
+
+	// frame_consumer
+
+	void initialize(const core::video_format_desc& format_desc, const core::audio_channel_layout& channel_layout, int channel_index) override
+	{
+		channel_index_	= channel_index;
+		fps_			= format_desc.fps;
+
+		executor_.invoke([=]
+		{
+			ring_.reset();
+			ring_.reset(new shared_memory_ring(name_, format_desc, channel_layout, slot_count_, max_ancillary_size_));
+		});
+
+		graph_->set_text(print());
+
+		CASPAR_LOG(info) << print() << L" Initialized.";
+	}
+
+	std::future<bool> send(core::const_frame frame) override
+	{
+		if (executor_.size() >= MAX_PENDING_FRAMES)
+		{
+			++frames_dropped_;
+			graph_->set_tag(diagnostics::tag_severity::WARNING, "dropped-frame");
+			return make_ready_future(true);
+		}
+
+		executor_.begin_invoke([=]
+		{
+			caspar::timer write_timer;
+
+			ring_->write(frame);
+			++frames_written_;
+
+			graph_->set_value("write-time", write_timer.elapsed() * fps_ * 0.5);
+			current_age_ = frame.get_age_millis();
+		});
+
+		return make_ready_future(true);
+	}
+
+	std::wstring print() const override
+	{
+		return L"shm[" + name_ + L"|" + boost::lexical_cast<std::wstring>(channel_index_) + L"]";
+	}
+
+	std::wstring name() const override
+	{
+		return L"shm";
+	}
+
+	boost::property_tree::wptree info() const override
+	{
+		boost::property_tree::wptree info;
+		info.add(L"type",				L"shm");
+		info.add(L"name",				name_);
+		info.add(L"slots",				slot_count_);
+		info.add(L"frames-written",		frames_written_.load());
+		info.add(L"frames-dropped",		frames_dropped_.load());
+		return info;
+	}
+
+	bool has_synchronization_clock() const override
+	{
+		return false;
+	}
+
+	int buffer_depth() const override
+	{
+		return -1;
+	}
+
+	int index() const override
+	{
+		return 120000 + consumer_index_;
+	}
+
+	int64_t presentation_frame_age_millis() const override
+	{
+		return current_age_;
+	}
+
+	core::monitor::subject& monitor_output() override
+	{
+		return monitor_subject_;
+	}
+};
+
+void describe_consumer(core::help_sink& sink, const core::help_repository& repo)
+{
+	sink.short_description(L"Publishes the frames of a channel in shared memory for other processes.");
+	sink.syntax(L"SHM [name:string] {SLOTS [slots:int|8]} {ANCILLARY_SIZE [bytes:int|65536]}");
+	sink.para()
+		->text(L"Writes the BGRA image, the interleaved audio and the ancillary packets of every frame into a lock-free ring of ")
+		->code(L"slots")->text(L" slots in the POSIX shared memory object ")->code(L"/casparcg-[name]")
+		->text(L". The layout is described in ")->code(L"modules/shm/shm_ring.h")
+		->text(L". The ring can be read by other processes or by the ")->code(L"shm://")->text(L" producer of another server.");
+	sink.para()
+		->text(L"The object is only accessible to the user and the group of the server. Adding the consumer fails if an object with the same name already exists, remove a stale one left by a crashed server from ")
+		->code(L"/dev/shm")->text(L".");
+	sink.para()->text(L"Examples:");
+	sink.example(L">> ADD 1 SHM analysis", L"publishes channel 1 as /casparcg-analysis.");
+	sink.example(L">> ADD 1 SHM multiview SLOTS 4", L"uses a smaller ring.");
+}
+
+spl::shared_ptr<core::frame_consumer> create_consumer(
+		const std::vector<std::wstring>& params, core::interaction_sink*, std::vector<spl::shared_ptr<core::video_channel>> channels)
+{
+	if (params.size() < 2 || !boost::iequals(params.at(0), L"SHM"))
+		return core::frame_consumer::empty();
+
+	auto name				= params.at(1);
+	auto slots				= get_param(L"SLOTS", params, 8);
+	auto ancillary_size		= get_param(L"ANCILLARY_SIZE", params, 65536);
+
+	return spl::make_shared<shm_consumer>(name, slots, ancillary_size);
+}
+
+spl::shared_ptr<core::frame_consumer> create_preconfigured_consumer(
+		const boost::property_tree::wptree& ptree, core::interaction_sink*, std::vector<spl::shared_ptr<core::video_channel>> channels)
+{
+	auto name				= ptree.get<std::wstring>(L"name");
+	auto slots				= ptree.get(L"slots", 8);
+	auto ancillary_size		= ptree.get(L"ancillary-size", 65536);
+
+	return spl::make_shared<shm_consumer>(name, slots, ancillary_size);
+}
+
+}}
@@ -0,0 +1,251 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "shm_producer.h"
+
+#include "../util/shared_memory_ring.h"
+
+#include <common/except.h>
+#include <common/diagnostics/graph.h>
+#include <common/log.h>
+
+#include <core/ancillary/ancillary.h>
+#include <core/producer/frame_producer.h>
+#include <core/producer/framerate/framerate_producer.h>
+#include <core/frame/draw_frame.h>
+#include <core/frame/frame.h>
+#include <core/frame/frame_factory.h>
+#include <core/frame/pixel_format.h>
+#include <core/frame/audio_channel_layout.h>
+#include <core/monitor/monitor.h>
+#include <core/video_format.h>
+#include <core/help/help_sink.h>
+#include <core/help/help_repository.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <atomic>
+
+namespace caspar { namespace shm {
+
+class shm_producer : public core::frame_producer_base
+{
+	core::monitor::subject						monitor_subject_;
+	spl::shared_ptr<diagnostics::graph>			graph_;
+	const spl::shared_ptr<core::frame_factory>	frame_factory_;
+	spl::shared_ptr<shared_memory_ring>			ring_;
+	core::audio_channel_layout					channel_layout_;
+	boost::rational<int>						framerate_;
+	core::constraints							constraints_;
+	core::pixel_format_desc						desc_;
+
+	std::uint64_t								next_sequence_	= 0;
+	std::atomic<std::int64_t>					frames_read_;
+	std::atomic<std::int64_t>					frames_dropped_;
+public:
+	shm_producer(const spl::shared_ptr<core::frame_factory>& frame_factory, const spl::shared_ptr<shared_memory_ring>& ring)
+		: frame_factory_(frame_factory)
+		, ring_(ring)
+		, channel_layout_(ring->channel_layout())
+		, framerate_(ring->format_desc().framerate)
+		, desc_(core::pixel_format::bgra)
+	{
+		update_format();
+
+		frames_read_	= 0;
+		frames_dropped_	= 0;
+
+		graph_->set_color("dropped-frame", diagnostics::color(0.3f, 0.6f, 0.3f));
+		graph_->set_text(print());
+		diagnostics::register_graph(graph_);
+
+		CASPAR_LOG(info) << print() << L" Initialized";
+	}
+
+	~shm_producer()
+	{
+		CASPAR_LOG(info) << print() << L" Uninitialized";
+	}
+
+	// frame_producer
+
+	void update_format()
+	{
+		auto& header = ring_->header();
+
+		constraints_.width.set(header.width);
+		constraints_.height.set(header.height);
+		desc_.planes.clear();
+		desc_.planes.push_back(core::pixel_format_desc::plane(header.width, header.height, 4));
+	}
+
+	// The old ring stays mapped until the writer has created the new one.
+	bool reopen()
+	{
+		if (!ring_->replaced())
+			return false;
+
+		try
+		{
+			auto ring		= spl::make_shared<shared_memory_ring>(ring_->name());
+			auto framerate	= ring->format_desc().framerate;
+
+			ring_			= std::move(ring);
+			channel_layout_	= ring_->channel_layout();
+			framerate_		= framerate;
+			next_sequence_	= 0;
+			update_format();
+
+			CASPAR_LOG(info) << print() << L" Writer restarted, reopened.";
+
+			return true;
+		}
+		catch (const user_error&)
+		{
+			return false;
+		}
+	}
+
+	core::draw_frame receive_impl() override
+	{
+		auto write_sequence	= ring_->write_sequence();
+
+		// Nothing new, check whether the writer has been restarted.
+		if ((write_sequence == 0 || write_sequence < next_sequence_) && reopen())
+			write_sequence = ring_->write_sequence();
+
+		auto slot_count		= ring_->header().slot_count;
+
+		if (write_sequence == 0)
+			return core::draw_frame::late();
+
+		if (next_sequence_ == 0)
+			next_sequence_ = write_sequence;
+
+		if (write_sequence < next_sequence_)
+		{
+			// The writer was restarted without creating a new ring.
+			if (next_sequence_ - write_sequence > slot_count)
+				next_sequence_ = write_sequence;
+			else
+				return core::draw_frame::late();
+		}
+
+		// Keep one slot of margin to the one being written.
+		if (write_sequence - next_sequence_ + 2 > slot_count)
+		{
+			frames_dropped_ += write_sequence - next_sequence_;
+			graph_->set_tag(diagnostics::tag_severity::WARNING, "dropped-frame");
+			next_sequence_ = write_sequence;
+		}
+
+		auto frame = frame_factory_->create_frame(this, desc_, channel_layout_);
+		core::ancillary::AncillaryContainer ancillary;
+
+		if (!ring_->read(next_sequence_, frame, ancillary))
+		{
+			++frames_dropped_;
+			graph_->set_tag(diagnostics::tag_severity::WARNING, "dropped-frame");
+			next_sequence_ = ring_->write_sequence();
+			return core::draw_frame::late();
+		}
+
+		++next_sequence_;
+		++frames_read_;
+
+		core::draw_frame result(std::move(frame));
+		result.ancillary() = std::move(ancillary);
+
+		return result;
+	}
+
+	boost::rational<int> framerate() const
+	{
+		return framerate_;
+	}
+
+	std::wstring name() const override
+	{
+		return L"shm";
+	}
+
+	std::wstring print() const override
+	{
+		return L"shm[" + ring_->name() + L"]";
+	}
+
+	core::constraints& pixel_constraints() override
+	{
+		return constraints_;
+	}
+
+	boost::property_tree::wptree info() const override
+	{
+		boost::property_tree::wptree info;
+		info.add(L"type",				L"shm");
+		info.add(L"name",				ring_->name());
+		info.add(L"width",				ring_->header().width);
+		info.add(L"height",				ring_->header().height);
+		info.add(L"frames-read",		frames_read_.load());
+		info.add(L"frames-dropped",		frames_dropped_.load());
+		return info;
+	}
+
+	core::monitor::subject& monitor_output() override
+	{
+		return monitor_subject_;
+	}
+};
+
+void describe_producer(core::help_sink& sink, const core::help_repository& repo)
+{
+	sink.short_description(L"Plays frames published in shared memory by another process.");
+	sink.syntax(L"shm://[name:string]");
+	sink.para()
+		->text(L"Reads the ring in the POSIX shared memory object ")->code(L"/casparcg-[name]")
+		->text(L", as written by the SHM consumer of this or another server, or by any process following ")
+		->code(L"modules/shm/shm_ring.h")->text(L".");
+	sink.para()->text(L"Examples:");
+	sink.example(L">> PLAY 1-10 shm://analysis");
+}
+
+spl::shared_ptr<core::frame_producer> create_producer(
+		const core::frame_producer_dependencies& dependencies,
+		const std::vector<std::wstring>& params)
+{
+	static const std::wstring PREFIX = L"shm://";
+
+	if (params.empty() || !boost::istarts_with(params.at(0), PREFIX))
+		return core::frame_producer::empty();
+
+	auto ring		= spl::make_shared<shared_memory_ring>(params.at(0).substr(PREFIX.length()));
+	auto producer	= spl::make_shared<shm_producer>(dependencies.frame_factory, ring);
+
+	return core::create_framerate_producer(
+			producer,
+			dependencies.frame_factory,
+			[=] { return producer->framerate(); },
+			dependencies.format_desc.framerate,
+			dependencies.format_desc.field_mode,
+			dependencies.format_desc.audio_cadence);
+}
+
+}}
@@ -0,0 +1,112 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Layout of the shared memory frame ring written by the shm consumer and read
+* by the shm producer. Plain C so that other processes can use it as is.
+*
+* The shared memory object is named "/casparcg-<name>" and consists of
+*
+*   caspar_shm_ring_header
+*   slot_count slots of slot_size bytes, each holding
+*     caspar_shm_slot_header
+*     image      image_size bytes of BGRA, premultiplied, top line first
+*     audio      max_audio_samples interleaved signed 32 bit samples
+*     ancillary  max_ancillary_size bytes of packets
+*
+* The offsets of image, audio and ancillary inside a slot are stored in the
+* ring header and are multiples of CASPAR_SHM_RING_ALIGNMENT.
+*
+* Ancillary packets are did (1 byte), sdid (1 byte), size (2 bytes, big
+* endian) followed by size bytes of user data words.
+*
+* There is a single writer. Frame number n (starting at 1) is written to slot
+* n % slot_count under a sequence lock: the writer stores n in sequence_begin,
+* writes the payload, stores n in sequence_end and finally in the header's
+* write_sequence. A reader loads sequence_end, copies the payload, then loads
+* sequence_begin again. The copy is only valid if both equal the frame number
+* it expected. All sequence fields must be accessed with acquire/release
+* atomics.
+*
+* A restarted writer creates a new object under the same name, readers should
+* reopen the name when write_sequence stops advancing.
+*/
+
+#ifndef CASPAR_SHM_RING_H
+#define CASPAR_SHM_RING_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CASPAR_SHM_RING_MAGIC		0x52534343u /* "CCSR" */
+#define CASPAR_SHM_RING_VERSION		1u
+#define CASPAR_SHM_RING_ALIGNMENT	64u
+#define CASPAR_SHM_RING_PREFIX		"/casparcg-"
+
+enum caspar_shm_field_mode
+{
+	CASPAR_SHM_FIELD_LOWER			= 1,
+	CASPAR_SHM_FIELD_UPPER			= 2,
+	CASPAR_SHM_FIELD_PROGRESSIVE	= 3
+};
+
+typedef struct caspar_shm_ring_header
+{
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	header_size;
+	uint32_t	slot_count;
+	uint64_t	slot_size;
+	uint32_t	image_offset;
+	uint32_t	audio_offset;
+	uint32_t	ancillary_offset;
+	uint32_t	width;
+	uint32_t	height;
+	uint32_t	image_size;
+	uint32_t	framerate_num;
+	uint32_t	framerate_den;
+	uint32_t	field_mode;				/* caspar_shm_field_mode */
+	uint32_t	audio_channels;
+	uint32_t	audio_sample_rate;
+	uint32_t	max_audio_samples;		/* per slot, all channels */
+	uint32_t	max_ancillary_size;
+	uint32_t	writer_pid;
+	uint8_t		reserved0[48];
+
+	uint64_t	write_sequence;			/* last completely written frame, 0 if none */
+	uint8_t		reserved1[56];
+} caspar_shm_ring_header;
+
+typedef struct caspar_shm_slot_header
+{
+	uint64_t	sequence_begin;
+	uint64_t	sequence_end;
+	uint32_t	audio_samples;			/* all channels */
+	uint32_t	ancillary_size;
+	uint8_t		reserved[40];
+} caspar_shm_slot_header;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
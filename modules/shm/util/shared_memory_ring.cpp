@@ -0,0 +1,361 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "shared_memory_ring.h"
+
+#include <common/except.h>
+#include <common/log.h>
+#include <common/utf.h>
+
+#include <core/ancillary/ancillary.h>
+#include <core/frame/frame.h>
+#include <core/frame/audio_channel_layout.h>
+#include <core/video_format.h>
+
+#include <boost/range/algorithm/max_element.hpp>
+
+#include <atomic>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace caspar { namespace shm {
+
+namespace {
+
+std::uint32_t align(std::uint64_t size)
+{
+	return static_cast<std::uint32_t>((size + CASPAR_SHM_RING_ALIGNMENT - 1) & ~static_cast<std::uint64_t>(CASPAR_SHM_RING_ALIGNMENT - 1));
+}
+
+std::uint64_t load_acquire(const std::uint64_t& value)
+{
+	return __atomic_load_n(&value, __ATOMIC_ACQUIRE);
+}
+
+std::uint64_t load_relaxed(const std::uint64_t& value)
+{
+	return __atomic_load_n(&value, __ATOMIC_RELAXED);
+}
+
+void store_release(std::uint64_t& value, std::uint64_t new_value)
+{
+	__atomic_store_n(&value, new_value, __ATOMIC_RELEASE);
+}
+
+void store_relaxed(std::uint64_t& value, std::uint64_t new_value)
+{
+	__atomic_store_n(&value, new_value, __ATOMIC_RELAXED);
+}
+
+}
+
+struct shared_memory_ring::impl : boost::noncopyable
+{
+	const std::wstring				name_;
+	const std::string				shm_name_;
+	const bool						writer_;
+	std::size_t						size_		= 0;
+	std::uint8_t*					data_		= nullptr;
+	std::uint64_t					sequence_	= 0;
+	ino_t							inode_		= 0;
+	dev_t							device_		= 0;
+	std::vector<std::uint8_t>		ancillary_buffer_;
+
+	impl(
+			const std::wstring& name,
+			const core::video_format_desc& format_desc,
+			const core::audio_channel_layout& channel_layout,
+			int slot_count,
+			int max_ancillary_size)
+		: name_(name)
+		, shm_name_(CASPAR_SHM_RING_PREFIX + u8(name))
+		, writer_(true)
+	{
+		caspar_shm_ring_header header;
+		std::memset(&header, 0, sizeof(header));
+
+		auto max_audio_samples = *boost::max_element(format_desc.audio_cadence) * channel_layout.num_channels;
+
+		header.magic				= CASPAR_SHM_RING_MAGIC;
+		header.version				= CASPAR_SHM_RING_VERSION;
+		header.header_size			= align(sizeof(caspar_shm_ring_header));
+		header.slot_count			= std::max(slot_count, 2);
+		header.width				= format_desc.width;
+		header.height				= format_desc.height;
+		header.image_size			= format_desc.width * format_desc.height * 4;
+		header.framerate_num		= format_desc.framerate.numerator();
+		header.framerate_den		= format_desc.framerate.denominator();
+		header.field_mode			= static_cast<std::uint32_t>(format_desc.field_mode);
+		header.audio_channels		= channel_layout.num_channels;
+		header.audio_sample_rate	= format_desc.audio_sample_rate;
+		header.max_audio_samples	= max_audio_samples;
+		header.max_ancillary_size	= max_ancillary_size;
+		header.writer_pid			= static_cast<std::uint32_t>(getpid());
+		header.image_offset			= align(sizeof(caspar_shm_slot_header));
+		header.audio_offset			= header.image_offset + align(header.image_size);
+		header.ancillary_offset		= header.audio_offset + align(max_audio_samples * sizeof(std::int32_t));
+		header.slot_size			= header.ancillary_offset + align(max_ancillary_size);
+
+		size_ = header.header_size + header.slot_count * header.slot_size;
+
+		auto fd = shm_open(shm_name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0660);
+
+		if (fd == -1 && errno == EEXIST)
+			CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"Shared memory " + u16(shm_name_) + L" is already in use"));
+		else if (fd == -1)
+			CASPAR_THROW_EXCEPTION(invalid_operation() << msg_info(L"Could not create shared memory " + u16(shm_name_)) << boost::errinfo_errno(errno));
+
+		if (ftruncate(fd, static_cast<off_t>(size_)) == -1)
+		{
+			auto error = errno;
+			close(fd);
+			shm_unlink(shm_name_.c_str());
+			CASPAR_THROW_EXCEPTION(invalid_operation() << msg_info(L"Could not allocate shared memory " + u16(shm_name_)) << boost::errinfo_errno(error));
+		}
+
+		map(fd, PROT_READ | PROT_WRITE);
+
+		// The magic is written last so that readers never see a partial header.
+		auto magic = header.magic;
+		header.magic = 0;
+		std::memcpy(data_, &header, sizeof(header));
+		__atomic_store_n(&mutable_header().magic, magic, __ATOMIC_RELEASE);
+
+		ancillary_buffer_.reserve(max_ancillary_size);
+	}
+
+	impl(const std::wstring& name)
+		: name_(name)
+		, shm_name_(CASPAR_SHM_RING_PREFIX + u8(name))
+		, writer_(false)
+	{
+		auto fd = shm_open(shm_name_.c_str(), O_RDONLY, 0);
+
+		if (fd == -1)
+			CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"No shared memory named " + u16(shm_name_)) << boost::errinfo_errno(errno));
+
+		struct stat info;
+
+		if (fstat(fd, &info) == -1 || static_cast<std::size_t>(info.st_size) < sizeof(caspar_shm_ring_header))
+		{
+			close(fd);
+			CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"Shared memory " + u16(shm_name_) + L" is not a frame ring"));
+		}
+
+		size_	= static_cast<std::size_t>(info.st_size);
+		inode_	= info.st_ino;
+		device_	= info.st_dev;
+		map(fd, PROT_READ);
+
+		auto& h = header();
+
+		if (__atomic_load_n(&h.magic, __ATOMIC_ACQUIRE) != CASPAR_SHM_RING_MAGIC
+			|| h.version != CASPAR_SHM_RING_VERSION
+			|| h.slot_count == 0
+			|| h.header_size + h.slot_count * h.slot_size > size_
+			|| h.image_size != h.width * h.height * 4
+			|| h.image_offset + h.image_size > h.audio_offset
+			|| h.audio_offset + h.max_audio_samples * sizeof(std::int32_t) > h.ancillary_offset
+			|| h.ancillary_offset + h.max_ancillary_size > h.slot_size)
+		{
+			munmap(data_, size_);
+			CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"Shared memory " + u16(shm_name_) + L" has an unsupported layout"));
+		}
+
+		ancillary_buffer_.reserve(h.max_ancillary_size);
+	}
+
+	~impl()
+	{
+		munmap(data_, size_);
+
+		if (writer_)
+			shm_unlink(shm_name_.c_str());
+	}
+
+	void map(int fd, int protection)
+	{
+		auto data = mmap(nullptr, size_, protection, MAP_SHARED, fd, 0);
+		auto error = errno;
+
+		close(fd);
+
+		if (data == MAP_FAILED)
+		{
+			if (writer_)
+				shm_unlink(shm_name_.c_str());
+
+			CASPAR_THROW_EXCEPTION(invalid_operation() << msg_info(L"Could not map shared memory " + u16(shm_name_)) << boost::errinfo_errno(error));
+		}
+
+		data_ = static_cast<std::uint8_t*>(data);
+	}
+
+	bool replaced() const
+	{
+		auto fd = shm_open(shm_name_.c_str(), O_RDONLY, 0);
+
+		if (fd == -1)
+			return true;
+
+		struct stat info;
+		auto result = fstat(fd, &info) == -1 || info.st_ino != inode_ || info.st_dev != device_;
+
+		close(fd);
+
+		return result;
+	}
+
+	const caspar_shm_ring_header& header() const
+	{
+		return *reinterpret_cast<const caspar_shm_ring_header*>(data_);
+	}
+
+	caspar_shm_ring_header& mutable_header()
+	{
+		return *reinterpret_cast<caspar_shm_ring_header*>(data_);
+	}
+
+	std::uint8_t* slot(std::uint64_t sequence) const
+	{
+		auto& h = header();
+
+		return data_ + h.header_size + (sequence % h.slot_count) * h.slot_size;
+	}
+
+	void write(const core::const_frame& frame)
+	{
+		auto& h			= header();
+		auto image		= frame.image_data();
+		auto& audio		= frame.audio_data();
+
+		if (image.size() != h.image_size)
+			return;
+
+		ancillary_buffer_.clear();
+		frame.ancillary().getAncillaryAsPackets(ancillary_buffer_);
+
+		if (ancillary_buffer_.size() > h.max_ancillary_size)
+		{
+			CASPAR_LOG(warning) << L"[shm] " << name_ << L" Ancillary data does not fit in slot, dropped.";
+			ancillary_buffer_.clear();
+		}
+
+		auto sequence		= ++sequence_;
+		auto data			= slot(sequence);
+		auto& slot_header	= *reinterpret_cast<caspar_shm_slot_header*>(data);
+		auto audio_samples	= std::min<std::size_t>(audio.size(), h.max_audio_samples);
+
+		store_relaxed(slot_header.sequence_begin, sequence);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		std::memcpy(data + h.image_offset, image.begin(), h.image_size);
+		std::memcpy(data + h.audio_offset, audio.begin(), audio_samples * sizeof(std::int32_t));
+		std::memcpy(data + h.ancillary_offset, ancillary_buffer_.data(), ancillary_buffer_.size());
+		slot_header.audio_samples	= static_cast<std::uint32_t>(audio_samples);
+		slot_header.ancillary_size	= static_cast<std::uint32_t>(ancillary_buffer_.size());
+
+		store_release(slot_header.sequence_end, sequence);
+		store_release(mutable_header().write_sequence, sequence);
+	}
+
+	bool read(std::uint64_t sequence, core::mutable_frame& frame, core::ancillary::AncillaryContainer& ancillary)
+	{
+		auto& h				= header();
+		auto data			= slot(sequence);
+		auto& slot_header	= *reinterpret_cast<const caspar_shm_slot_header*>(data);
+
+		if (load_acquire(slot_header.sequence_end) != sequence || frame.image_data().size() != h.image_size)
+			return false;
+
+		auto audio_samples	= std::min(slot_header.audio_samples, h.max_audio_samples);
+		auto ancillary_size	= std::min(slot_header.ancillary_size, h.max_ancillary_size);
+
+		std::memcpy(frame.image_data().begin(), data + h.image_offset, h.image_size);
+		frame.audio_data().resize(audio_samples);
+		std::memcpy(frame.audio_data().data(), data + h.audio_offset, audio_samples * sizeof(std::int32_t));
+		ancillary_buffer_.resize(ancillary_size);
+		std::memcpy(ancillary_buffer_.data(), data + h.ancillary_offset, ancillary_size);
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		if (load_relaxed(slot_header.sequence_begin) != sequence)
+			return false;
+
+		ancillary.addPackets(ancillary_buffer_.data(), ancillary_buffer_.size());
+
+		return true;
+	}
+
+	core::video_format_desc format_desc() const
+	{
+		auto& h = header();
+
+		for (int n = 0; n < static_cast<int>(core::video_format::invalid); ++n)
+		{
+			core::video_format_desc desc(static_cast<core::video_format>(n));
+
+			if (desc.width == static_cast<int>(h.width)
+				&& desc.height == static_cast<int>(h.height)
+				&& desc.framerate == boost::rational<int>(h.framerate_num, h.framerate_den)
+				&& static_cast<std::uint32_t>(desc.field_mode) == h.field_mode)
+			{
+				return desc;
+			}
+		}
+
+		CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"Shared memory " + u16(shm_name_) + L" uses an unknown video format"));
+	}
+
+	core::audio_channel_layout channel_layout() const
+	{
+		auto num_channels = static_cast<int>(header().audio_channels);
+
+		if (num_channels == 1)
+			return core::audio_channel_layout(num_channels, L"mono", L"FC");
+		else if (num_channels == 2)
+			return core::audio_channel_layout(num_channels, L"stereo", L"FL FR");
+
+		return core::audio_channel_layout(num_channels, L"", L"");
+	}
+};
+
+shared_memory_ring::shared_memory_ring(
+		const std::wstring& name,
+		const core::video_format_desc& format_desc,
+		const core::audio_channel_layout& channel_layout,
+		int slot_count,
+		int max_ancillary_size)
+	: impl_(new impl(name, format_desc, channel_layout, slot_count, max_ancillary_size)) {}
+shared_memory_ring::shared_memory_ring(const std::wstring& name) : impl_(new impl(name)) {}
+shared_memory_ring::~shared_memory_ring() {}
+void shared_memory_ring::write(const core::const_frame& frame) { impl_->write(frame); }
+bool shared_memory_ring::read(std::uint64_t sequence, core::mutable_frame& frame, core::ancillary::AncillaryContainer& ancillary) const { return impl_->read(sequence, frame, ancillary); }
+bool shared_memory_ring::replaced() const { return impl_->replaced(); }
+std::uint64_t shared_memory_ring::write_sequence() const { return load_acquire(impl_->header().write_sequence); }
+const caspar_shm_ring_header& shared_memory_ring::header() const { return impl_->header(); }
+core::video_format_desc shared_memory_ring::format_desc() const { return impl_->format_desc(); }
+core::audio_channel_layout shared_memory_ring::channel_layout() const { return impl_->channel_layout(); }
+const std::wstring& shared_memory_ring::name() const { return impl_->name_; }
+
+}}
@@ -0,0 +1,77 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "../shm_ring.h"
+
+#include <common/memory.h>
+
+#include <core/fwd.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+FORWARD3(caspar, core, ancillary, class AncillaryContainer);
+
+namespace caspar { namespace shm {
+
+// Maps a caspar_shm_ring, see shm_ring.h for the layout and the protocol.
+class shared_memory_ring final
+{
+	shared_memory_ring(const shared_memory_ring&);
+	shared_memory_ring& operator=(const shared_memory_ring&);
+public:
+	// Creates the ring for writing, readable and writable by the owner and its
+	// group only. Throws if a ring with the same name already exists.
+	shared_memory_ring(
+			const std::wstring& name,
+			const core::video_format_desc& format_desc,
+			const core::audio_channel_layout& channel_layout,
+			int slot_count,
+			int max_ancillary_size);
+
+	// Opens an existing ring for reading.
+	explicit shared_memory_ring(const std::wstring& name);
+
+	~shared_memory_ring();
+
+	void write(const core::const_frame& frame);
+
+	// Copies frame number sequence into frame. Returns false if it was not
+	// written yet, has been overwritten or was being written while copied.
+	bool read(std::uint64_t sequence, core::mutable_frame& frame, core::ancillary::AncillaryContainer& ancillary) const;
+
+	std::uint64_t write_sequence() const;
+
+	// True if the name no longer refers to the mapped ring, because the writer
+	// removed it or was restarted and created a new one.
+	bool replaced() const;
+
+	const caspar_shm_ring_header& header() const;
+	core::video_format_desc format_desc() const;
+	core::audio_channel_layout channel_layout() const;
+	const std::wstring& name() const;
+private:
+	struct impl;
+	spl::unique_ptr<impl> impl_;
+};
+
+}}
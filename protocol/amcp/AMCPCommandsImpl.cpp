@@ -304,12 +304,19 @@ std::vector<spl::shared_ptr<core::video_channel>> get_channels(const command_con
 
 core::frame_producer_dependencies get_producer_dependencies(const std::shared_ptr<core::video_channel>& channel, const command_context& ctx)
 {
+	std::weak_ptr<core::video_channel> weak_channel = channel;
+
 	return core::frame_producer_dependencies(
 			channel->frame_factory(),
 			get_channels(ctx),
 			channel->video_format_desc(),
 			ctx.producer_registry,
-			ctx.cg_registry);
+			ctx.cg_registry,
+			[weak_channel]() -> int64_t
+			{
+				auto strong = weak_channel.lock();
+				return strong ? strong->frame_number() : 0;
+			});
 }
 
 // Basic Commands
@@ -2660,6 +2667,45 @@ std::wstring info_delay_command(command_context& ctx)
 	return create_info_xml_reply(info, L"DELAY");
 }
 
+void info_loudness_describer(core::help_sink& sink, const core::help_repository& repo)
+{
+	sink.short_description(L"Get the EBU R128 loudness of a channel or a layer.");
+	sink.syntax(L"INFO [video_channel:int]{-[layer:int]} LOUDNESS {RESET}");
+	sink.para()->text(L"Gets the momentary, short-term and integrated loudness in LUFS and the true peak in dBTP of the mixed output of the specified channel, measured according to ITU-R BS.1770 / EBU R128.");
+	sink.para()
+		->text(L"Layers are only measured when ")->code(L"<mixer><loudness-per-layer>")
+		->text(L" is enabled in the configuration. Specify ")->code(L"RESET")
+		->text(L" to restart the integration and the true peak hold of the channel and all of its layers.");
+	sink.para()->text(L"Examples:");
+	sink.example(L">> INFO 1 LOUDNESS");
+	sink.example(L">> INFO 1-10 LOUDNESS");
+	sink.example(L">> INFO 1 LOUDNESS RESET");
+}
+
+std::wstring info_loudness_command(command_context& ctx)
+{
+	if (!ctx.parameters.empty() && boost::iequals(ctx.parameters.at(0), L"RESET"))
+	{
+		ctx.channel.channel->mixer().reset_loudness();
+
+		return L"202 INFO LOUDNESS OK\r\n";
+	}
+
+	auto info = ctx.channel.channel->mixer().loudness_info().get();
+	auto layer = ctx.layer_index(std::numeric_limits<int>::min());
+
+	if (layer == std::numeric_limits<int>::min())
+		return create_info_xml_reply(info, L"LOUDNESS");
+
+	for (auto& child : info.get_child(L"layers", boost::property_tree::wptree()))
+	{
+		if (child.second.get(L"index", std::numeric_limits<int>::min()) == layer)
+			return create_info_xml_reply(child.second, L"LOUDNESS");
+	}
+
+	CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"No loudness measured for layer " + boost::lexical_cast<std::wstring>(layer)));
+}
+
 void diag_describer(core::help_sink& sink, const core::help_repository& repo)
 {
 	sink.short_description(L"Open the diagnostics window.");
@@ -3088,6 +3134,7 @@ void register_commands(amcp_command_repository& repo)
 	repo.register_command(			L"Query Commands",		L"INFO QUEUES",					info_queues_describer,				info_queues_command,			0);
 	repo.register_command(			L"Query Commands",		L"INFO THREADS",				info_threads_describer,				info_threads_command,			0);
 	repo.register_channel_command(	L"Query Commands",		L"INFO DELAY",					info_delay_describer,				info_delay_command,				0);
+	repo.register_channel_command(	L"Query Commands",		L"INFO LOUDNESS",				info_loudness_describer,			info_loudness_command,			0);
 	repo.register_command(			L"Query Commands",		L"DIAG",						diag_describer,						diag_command,					0);
 	repo.register_command(			L"Query Commands",		L"GL INFO",						gl_info_describer,					gl_info_command,				0);
 	repo.register_command(			L"Query Commands",		L"GL GC",						gl_gc_describer,					gl_gc_command,					0);
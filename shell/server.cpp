@@ -45,7 +45,9 @@
 #include <core/producer/color/color_producer.h>
 #include <core/consumer/output.h>
 #include <core/consumer/syncto/syncto_consumer.h>
+#include <core/consumer/ancillary/anc_monitor_consumer.h>
 #include <core/mixer/mixer.h>
+#include <core/ancillary/ancillary_merger.h>
 #include <core/mixer/image/image_mixer.h>
 #include <core/thumbnail_generator.h>
 #include <core/producer/media_info/media_info.h>
@@ -185,6 +187,7 @@ struct server::impl : boost::noncopyable
 		core::init_cg_proxy_as_producer(dependencies);
 		core::scene::init(dependencies);
 		core::syncto::init(dependencies);
+		core::anc_monitor::init(dependencies);
 		help_repo_->register_item({ L"producer" }, L"Color Producer", &core::describe_color_producer);
 	}
 
@@ -290,6 +293,7 @@ struct server::impl : boost::noncopyable
 
 			channel->monitor_output().attach_parent(monitor_subject_);
 			channel->mixer().set_straight_alpha_output(xml_channel.second.get(L"straight-alpha-output", false));
+			setup_ancillary_merge(channel->mixer(), xml_channel.second);
 			channels_.push_back(channel);
 		}
 
@@ -332,6 +336,32 @@ struct server::impl : boost::noncopyable
 		}
 	}
 
+	static void setup_ancillary_merge(core::mixer& mixer, const boost::property_tree::wptree& xml_channel)
+	{
+		if (!xml_channel.get_child_optional(L"ancillary-merge"))
+			return;
+
+		mixer.set_default_ancillary_policy(core::ancillary::merge_policy_from_string(
+				xml_channel.get(L"ancillary-merge.default-policy", L"keep-all")));
+
+		for (auto& xml_packet : xml_channel | witerate_children(L"ancillary-merge") | welement_context_iteration)
+		{
+			if (xml_packet.first != L"packet")
+				continue;
+
+			auto did	= std::stoi(u8(ptree_get<std::wstring>(xml_packet.second, L"did")), nullptr, 0);
+			auto sdid	= std::stoi(u8(ptree_get<std::wstring>(xml_packet.second, L"sdid")), nullptr, 0);
+
+			if (did < 0 || did > 0xff || sdid < 0 || sdid > 0xff)
+				CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"Invalid ancillary DID/SDID in ancillary-merge"));
+
+			mixer.set_ancillary_policy(
+					static_cast<std::uint8_t>(did),
+					static_cast<std::uint8_t>(sdid),
+					core::ancillary::merge_policy_from_string(ptree_get<std::wstring>(xml_packet.second, L"policy")));
+		}
+	}
+
 	void setup_osc(const boost::property_tree::wptree& pt)
 	{
 		using boost::property_tree::wptree;
@@ -0,0 +1,53 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Tests of the ancillary data in core/ancillary. Every area has a source file
+// of its own, with one entry point called from here.
+
+#include <test/common/test.h>
+
+namespace caspar { namespace test {
+
+void test_cea708();
+void test_scte35();
+void test_scte104();
+void test_vanc_packer();
+void test_vanc_decoder();
+void test_scte104_scheduler();
+void test_st2038();
+void test_merger();
+void test_vanc_validator();
+
+}}
+
+int main()
+{
+	return caspar::test::run_tests("ancillary-test", []
+	{
+		caspar::test::test_cea708();
+		caspar::test::test_scte35();
+		caspar::test::test_scte104();
+		caspar::test::test_vanc_packer();
+		caspar::test::test_vanc_decoder();
+		caspar::test::test_scte104_scheduler();
+		caspar::test::test_st2038();
+		caspar::test::test_merger();
+		caspar::test::test_vanc_validator();
+	});
+}
@@ -0,0 +1,215 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Round trips captions through A/53 cc_data and SMPTE 334-2 CDPs, and checks
+// that re-timing between frame rates neither loses nor repeats caption bytes.
+
+#include <core/ancillary/cea708/cea708.h>
+
+#include <test/common/test.h>
+
+#include <boost/rational.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+namespace caspar { namespace core { namespace ancillary {
+
+bool operator==(const cc_data& a, const cc_data& b)
+{
+	return a.cc_valid == b.cc_valid && a.type == b.type && a.data1 == b.data1 && a.data2 == b.data2;
+}
+
+}}}
+
+namespace caspar { namespace test {
+
+using namespace core::ancillary;
+
+namespace {
+
+// Numbered triplets so that order, losses and repeats show.
+cc_data triplet(cc_type type, int number)
+{
+	return cc_data { true, type, static_cast<std::uint8_t>(number >> 8), static_cast<std::uint8_t>(number) };
+}
+
+std::vector<std::uint8_t> a53(const std::vector<cc_data>& captions)
+{
+	std::vector<std::uint8_t> result;
+
+	for (auto& cc : captions)
+	{
+		result.push_back(static_cast<std::uint8_t>(0xf8 | (cc.cc_valid ? 0x04 : 0x00) | cc.type));
+		result.push_back(cc.data1);
+		result.push_back(cc.data2);
+	}
+
+	return result;
+}
+
+void test_round_trip()
+{
+	std::vector<cc_data> captions;
+
+	for (int n = 0; n < 20; ++n)
+		captions.push_back(triplet(static_cast<cc_type>(n % 4), n));
+
+	captions[7].cc_valid = false;
+
+	auto bytes = a53(captions);
+	CEA708 from_a53(bytes.data(), bytes.size(), atsc53);
+
+	CHECK(from_a53.captions() == captions);
+	CHECK(from_a53.getA53Data() == bytes);
+
+	for (auto framerate : { boost::rational<int>(24000, 1001), boost::rational<int>(25), boost::rational<int>(30000, 1001), boost::rational<int>(50), boost::rational<int>(60) })
+	{
+		CEA708 packet(captions, framerate, 0x1234);
+		auto cdp_bytes = packet.getData();
+
+		// SMPTE 334-2: identifier, length, frame rate code, the footer repeats
+		// the sequence counter and the checksum makes the sum of all bytes 0.
+		std::uint8_t sum = 0;
+
+		for (auto byte : cdp_bytes)
+			sum += byte;
+
+		CHECK(cdp_bytes.size() == 13 + 3 * captions.size());
+		CHECK(cdp_bytes[0] == 0x96 && cdp_bytes[1] == 0x69);
+		CHECK(cdp_bytes[2] == cdp_bytes.size());
+		CHECK(cdp_bytes[5] == 0x12 && cdp_bytes[6] == 0x34);
+		CHECK(cdp_bytes[cdp_bytes.size() - 4] == 0x74);
+		CHECK(cdp_bytes[cdp_bytes.size() - 3] == 0x12 && cdp_bytes[cdp_bytes.size() - 2] == 0x34);
+		CHECK(sum == 0);
+
+		CEA708 from_cdp(cdp_bytes.data(), cdp_bytes.size(), cdp);
+
+		CHECK(from_cdp.valid());
+		CHECK(from_cdp.captions() == captions);
+		CHECK(from_cdp.getA53Data() == bytes);
+	}
+
+	std::cout << "cea708 round trip: ok" << std::endl;
+}
+
+void test_malformed()
+{
+	std::vector<cc_data> captions(10, triplet(cc_type_dtvcc_data, 1));
+	auto bytes = CEA708(captions, boost::rational<int>(25), 1).getData();
+
+	auto bad_checksum = bytes;
+	bad_checksum.back() ^= 0x01;
+	CHECK(!CEA708(bad_checksum.data(), bad_checksum.size(), cdp).valid());
+	CHECK(CEA708(bad_checksum.data(), bad_checksum.size(), cdp).captions().empty());
+
+	auto bad_identifier = bytes;
+	bad_identifier[0] = 0x00;
+	CHECK(!CEA708(bad_identifier.data(), bad_identifier.size(), cdp).valid());
+
+	for (std::size_t size = 0; size < bytes.size(); ++size)
+		CHECK(!CEA708(bytes.data(), size, cdp).valid());
+
+	std::cout << "cea708 malformed: ok" << std::endl;
+}
+
+// Feeds source frames of caption data at one rate and pops output frames at
+// another, as the framerate producer does.
+void check_retiming(boost::rational<int> source_rate, boost::rational<int> output_rate)
+{
+	const int source_frames = 300;
+	auto slots = CEA708::cc_count(output_rate);
+
+	std::vector<cc_data> sent_608;
+	std::vector<cc_data> sent_708;
+	std::vector<cc_data> received_608;
+	std::vector<cc_data> received_708;
+	CEA708Retimer retimer;
+	int pushed = 0;
+	int number = 0;
+
+	for (int output = 0; pushed < source_frames || output < source_frames * 4; ++output)
+	{
+		// Push every source frame that starts before this output frame.
+		while (pushed < source_frames && boost::rational<int>(pushed) / source_rate <= boost::rational<int>(output) / output_rate)
+		{
+			std::vector<cc_data> captions;
+			captions.push_back(triplet(cc_type_608_field1, number++));
+			captions.push_back(triplet(cc_type_608_field2, number++));
+
+			for (int n = 2; n < CEA708::cc_count(source_rate) - 2; ++n)
+				captions.push_back(triplet(n == 2 ? cc_type_dtvcc_start : cc_type_dtvcc_data, number++));
+
+			captions.push_back(cc_data { false, cc_type_dtvcc_start, 0, 0 });
+			captions.push_back(cc_data { false, cc_type_dtvcc_start, 0, 0 });
+
+			for (auto& cc : captions)
+			{
+				if (cc.cc_valid)
+					(cc.is_608() ? sent_608 : sent_708).push_back(cc);
+			}
+
+			retimer.push(CEA708(captions, source_rate, static_cast<std::uint16_t>(pushed)));
+			++pushed;
+		}
+
+		auto packet = retimer.pop(output_rate);
+
+		if (!packet)
+			continue;
+
+		CHECK(static_cast<int>(packet->captions().size()) == slots);
+
+		int field1 = 0;
+
+		for (auto& cc : packet->captions())
+		{
+			if (!cc.cc_valid)
+				continue;
+
+			field1 += cc.type == cc_type_608_field1;
+			(cc.is_608() ? received_608 : received_708).push_back(cc);
+		}
+
+		// At most one 608 byte pair per field and 29.97 Hz frame.
+		CHECK(field1 <= std::max(1, static_cast<int>(std::ceil(boost::rational_cast<double>(boost::rational<int>(30000, 1001) / output_rate) - 0.0001))));
+	}
+
+	CHECK(received_608 == sent_608);
+	CHECK(received_708 == sent_708);
+
+	std::cout << "cea708 retiming " << boost::rational_cast<double>(source_rate) << " -> " << boost::rational_cast<double>(output_rate) << ": ok" << std::endl;
+}
+
+}
+
+void test_cea708()
+{
+	test_round_trip();
+	test_malformed();
+	check_retiming(boost::rational<int>(30000, 1001), boost::rational<int>(25));
+	check_retiming(boost::rational<int>(25), boost::rational<int>(50));
+	check_retiming(boost::rational<int>(60000, 1001), boost::rational<int>(30000, 1001));
+	check_retiming(boost::rational<int>(24000, 1001), boost::rational<int>(60));
+}
+
+}}
@@ -0,0 +1,337 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Tests the per DID/SDID merge policies of AncillaryMerger and the VANC line
+// allocation it shares with packAncillaryLines.
+
+#include <core/ancillary/ancillary.h>
+#include <core/ancillary/ancillary_merger.h>
+#include <core/video_format.h>
+
+#include <common/except.h>
+
+#include <test/common/test.h>
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace caspar { namespace test {
+
+using namespace core::ancillary;
+
+namespace {
+
+std::shared_ptr<AncillaryData> packet(std::uint8_t did, std::uint8_t sdid, std::vector<std::uint8_t> data)
+{
+	return std::make_shared<RawAncillaryData>(did, sdid, std::move(data));
+}
+
+// Adds one container per layer, in the order given, and returns what the merger keeps.
+std::vector<std::shared_ptr<AncillaryData>> merge(
+		AncillaryMerger& merger,
+		const std::vector<std::pair<int, std::vector<std::shared_ptr<AncillaryData>>>>& layers,
+		const core::video_format_desc& format_desc = core::video_format_desc(core::video_format::x1080i5000))
+{
+	for (auto& layer : layers)
+	{
+		AncillaryContainer container;
+
+		for (auto& data : layer.second)
+			container.addData(data);
+
+		merger.add(layer.first, container);
+		CHECK(container.empty());
+	}
+
+	AncillaryContainer out;
+	merger.merge(format_desc, out);
+	return out.takeAll();
+}
+
+bool rejected(const std::wstring& policy)
+{
+	try
+	{
+		merge_policy_from_string(policy);
+	}
+	catch (const user_error&)
+	{
+		return true;
+	}
+
+	return false;
+}
+
+void test_policies()
+{
+	CHECK(merge_policy_from_string(L"keep-all") == merge_policy::keep_all);
+	CHECK(merge_policy_from_string(L"PRIORITY") == merge_policy::priority);
+	CHECK(merge_policy_from_string(L"Newest") == merge_policy::newest);
+	CHECK(rejected(L"oldest"));
+	CHECK(rejected(L""));
+
+	for (auto policy : { merge_policy::keep_all, merge_policy::priority, merge_policy::newest })
+		CHECK(merge_policy_from_string(to_string(policy)) == policy);
+
+	// Captions default to priority, everything else to keep-all.
+	AncillaryMerger merger;
+	CHECK(merger.getPolicy(0x61, 0x01) == merge_policy::priority);
+	CHECK(merger.getPolicy(0x41, 0x07) == merge_policy::keep_all);
+
+	merger.setDefaultPolicy(merge_policy::newest);
+	merger.setPolicy(0x41, 0x07, merge_policy::priority);
+	CHECK(merger.getPolicy(0x41, 0x07) == merge_policy::priority);
+	CHECK(merger.getPolicy(0x45, 0x01) == merge_policy::newest);
+	CHECK(merger.getPolicy(0x61, 0x01) == merge_policy::priority);
+
+	std::cout << "merger policies: ok" << std::endl;
+}
+
+void test_keep_all()
+{
+	AncillaryMerger merger;
+	auto a = packet(0x41, 0x07, { 1, 2, 3 });
+	auto b = packet(0x41, 0x07, { 4, 5 });
+	auto c = packet(0x45, 0x01, { 6 });
+	auto a_copy = packet(0x41, 0x07, { 1, 2, 3 });
+
+	// Layer order, whatever order the layers come in, and the order within a layer.
+	auto out = merge(merger, { { 20, { c } }, { 10, { a, b } }, { 30, { a_copy } } });
+	CHECK(out.size() == 3);
+	CHECK(out[0] == a);
+	CHECK(out[1] == b);
+	CHECK(out[2] == c);
+	CHECK(merger.stats().packets == 3);
+	CHECK(merger.stats().duplicates == 1);
+	CHECK(merger.stats().conflicts == 0);
+
+	// A copy within a layer is dropped too, the same payload under another DID/SDID is not.
+	out = merge(merger, { { 10, { a, a_copy, packet(0x41, 0x08, { 1, 2, 3 }) } } });
+	CHECK(out.size() == 2);
+	CHECK(merger.stats().duplicates == 2);
+
+	std::cout << "merger keep-all: ok" << std::endl;
+}
+
+void test_priority()
+{
+	AncillaryMerger merger;
+	auto low = packet(0x61, 0x01, { 1 });
+	auto high = packet(0x61, 0x01, { 2 });
+	auto high2 = packet(0x61, 0x01, { 3 });
+	auto other = packet(0x41, 0x07, { 4 });
+
+	auto out = merge(merger, { { 20, { high, high2 } }, { 10, { low, other } } });
+	CHECK(out.size() == 3);
+	CHECK(out[0] == other);
+	CHECK(out[1] == high);
+	CHECK(out[2] == high2);
+	CHECK(merger.stats().conflicts == 1);
+
+	// The lower layer takes over as soon as the higher one stops.
+	out = merge(merger, { { 10, { low } } });
+	CHECK(out.size() == 1);
+	CHECK(out[0] == low);
+
+	// And loses again when it comes back.
+	out = merge(merger, { { 10, { low } }, { 20, { high } } });
+	CHECK(out.size() == 1);
+	CHECK(out[0] == high);
+	CHECK(merger.stats().conflicts == 2);
+
+	std::cout << "merger priority: ok" << std::endl;
+}
+
+void test_newest()
+{
+	AncillaryMerger merger;
+	merger.setPolicy(0x41, 0x07, merge_policy::newest);
+
+	auto on = [](int layer) { return packet(0x41, 0x07, { static_cast<std::uint8_t>(layer) }); };
+	auto layer_of = [](const std::vector<std::shared_ptr<AncillaryData>>& out)
+	{
+		CHECK(out.size() == 1);
+		return static_cast<int>(out[0]->getData()[0]);
+	};
+
+	CHECK(layer_of(merge(merger, { { 20, { on(20) } } })) == 20);
+
+	// A lower layer that starts later wins, and keeps winning.
+	CHECK(layer_of(merge(merger, { { 20, { on(20) } }, { 10, { on(10) } } })) == 10);
+	CHECK(layer_of(merge(merger, { { 20, { on(20) } }, { 10, { on(10) } } })) == 10);
+
+	// When it stops the other layer takes over, it started earlier but is still carrying.
+	CHECK(layer_of(merge(merger, { { 20, { on(20) } } })) == 20);
+
+	// A layer that restarts counts from its new start.
+	CHECK(layer_of(merge(merger, { { 20, { on(20) } }, { 10, { on(10) } } })) == 10);
+	CHECK(layer_of(merge(merger, { { 10, { on(10) } } })) == 10);
+	CHECK(layer_of(merge(merger, { { 20, { on(20) } }, { 10, { on(10) } } })) == 20);
+
+	// Layers that start together go to the highest.
+	AncillaryMerger together;
+	together.setPolicy(0x41, 0x07, merge_policy::newest);
+	CHECK(layer_of(merge(together, { { 10, { on(10) } }, { 30, { on(30) } }, { 20, { on(20) } } })) == 30);
+
+	// An empty frame forgets the onsets.
+	CHECK(merge(together, { }).empty());
+	CHECK(layer_of(merge(together, { { 30, { on(30) } } })) == 30);
+	CHECK(layer_of(merge(together, { { 10, { on(10) } }, { 30, { on(30) } } })) == 10);
+
+	std::cout << "merger newest: ok" << std::endl;
+}
+
+void test_budgets()
+{
+	CHECK(vanc_line_budget(core::video_format_desc(core::video_format::pal)) == 32);
+	CHECK(vanc_line_budget(core::video_format_desc(core::video_format::ntsc)) == 22);
+	CHECK(vanc_line_budget(core::video_format_desc(core::video_format::x720p5000)) == 17);
+	CHECK(vanc_line_budget(core::video_format_desc(core::video_format::x1080i5000)) == 25);
+	CHECK(vanc_line_budget(core::video_format_desc(core::video_format::x1080p5000)) == 33);
+
+	std::cout << "merger line budgets: ok" << std::endl;
+}
+
+// The allocator has to break lines exactly where packAncillaryLines does.
+void test_line_allocation()
+{
+	for (std::uint32_t width : { 720u, 1280u, 1920u, 3840u })
+	{
+		VancLineAllocator allocator(width);
+		CHECK(allocator.lines() == 0);
+		CHECK(allocator.peek(10) == 0);
+
+		// Breaks before a packet that does not leave a sample on the line.
+		auto room = allocator.samplesPerLine() - 7 - 1;
+		CHECK(allocator.add(room - 1) == 0);
+		CHECK(allocator.peek(0) == 1);
+
+		for (std::uint32_t seed = 1; seed <= 300; ++seed)
+		{
+			VancLineAllocator frame(width);
+			AncillaryContainer container;
+			std::vector<std::size_t> lines_of;
+
+			auto sizes = noise(64, seed * 4 + width);
+
+			for (std::size_t n = 0; n < static_cast<std::size_t>(sizes[0] % 40); ++n)
+			{
+				std::size_t size = sizes[n + 1] % 2 ? sizes[n + 1] : sizes[n + 1] % 16;
+				container.addData(packet(0x80, static_cast<std::uint8_t>(n), noise(size, seed + static_cast<std::uint32_t>(n))));
+
+				auto line = frame.peek(size);
+				CHECK(frame.add(size) == line);
+				CHECK(frame.lines() == line + 1);
+			}
+
+			AncillaryLines lines;
+			container.packAncillaryLines(width, lines);
+			CHECK(lines.size() == frame.lines());
+			CHECK(container.getAncillaryAsLines(width)->size() == frame.lines());
+		}
+	}
+
+	std::cout << "merger line allocation: ok" << std::endl;
+}
+
+void test_overflow()
+{
+	for (auto format : { core::video_format::pal, core::video_format::ntsc, core::video_format::x720p5000, core::video_format::x1080i5000, core::video_format::x1080p5000 })
+	{
+		core::video_format_desc format_desc(format);
+		auto budget = vanc_line_budget(format_desc);
+
+		for (std::uint32_t seed = 1; seed <= 100; ++seed)
+		{
+			AncillaryMerger merger;
+			std::vector<std::pair<int, std::vector<std::shared_ptr<AncillaryData>>>> layers;
+			std::size_t total = 0;
+
+			// Up to 4 lines of data per layer on 20 layers, which overflows some frames.
+			for (int layer = 0; layer < 20; ++layer)
+			{
+				auto sizes = noise(16, seed * 20 + layer);
+				layers.push_back({ layer, { } });
+
+				for (std::size_t n = 0; n < sizes[0] % 8; ++n, ++total)
+					layers.back().second.push_back(packet(0x80 | static_cast<std::uint8_t>(layer), static_cast<std::uint8_t>(n), noise(sizes[n + 1] % 2 ? 255 : sizes[n + 1], seed + layer)));
+			}
+
+			auto out = merge(merger, layers, format_desc);
+			auto& stats = merger.stats();
+
+			CHECK(stats.packets == out.size());
+			CHECK(stats.packets + stats.overflows == total);
+			CHECK(stats.overflow_frames == (stats.overflows > 0 ? 1u : 0u));
+
+			AncillaryContainer container;
+			for (auto& data : out)
+				container.addData(data);
+
+			AncillaryLines lines;
+			container.packAncillaryLines(format_desc.width, lines);
+			CHECK(lines.size() <= budget);
+			CHECK(lines.size() == stats.lines);
+
+			// Packets that fit after one that did not are still sent.
+			if (stats.overflows > 0)
+				CHECK(out.size() > 0);
+		}
+	}
+
+	// Nothing is dropped that would have fit.
+	AncillaryMerger merger;
+	core::video_format_desc format_desc(core::video_format::x720p5000);
+	VancLineAllocator allocator(format_desc.width);
+	std::vector<std::shared_ptr<AncillaryData>> full;
+
+	while (allocator.peek(255) < vanc_line_budget(format_desc))
+	{
+		allocator.add(255);
+		full.push_back(packet(0x80, static_cast<std::uint8_t>(full.size()), noise(255, static_cast<std::uint32_t>(full.size()))));
+	}
+
+	CHECK(merge(merger, { { 10, full } }, format_desc).size() == full.size());
+	CHECK(merger.stats().overflows == 0);
+	CHECK(merger.stats().lines == vanc_line_budget(format_desc));
+
+	full.push_back(packet(0x81, 0x00, noise(255, 1000)));
+	CHECK(merge(merger, { { 10, full } }, format_desc).size() == full.size() - 1);
+	CHECK(merger.stats().overflows == 1);
+	CHECK(merger.stats().overflow_frames == 1);
+
+	std::cout << "merger overflow: ok" << std::endl;
+}
+
+}
+
+void test_merger()
+{
+	test_policies();
+	test_keep_all();
+	test_priority();
+	test_newest();
+	test_budgets();
+	test_line_allocation();
+	test_overflow();
+}
+
+}}
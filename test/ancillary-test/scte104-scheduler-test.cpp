@@ -0,0 +1,219 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Drives the SCTE-104 scheduler in core/scte with the channel frame counter of
+// every video format, and checks that the pre-roll countdown, the resends and
+// the heartbeats follow the channel's clock, also while the producer is paused.
+
+#include "scte104.h"
+
+#include <core/ancillary/scte/scte.h>
+#include <core/scte/scte.h>
+#include <core/video_format.h>
+
+#include <test/common/test.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace caspar { namespace test {
+
+using namespace core::ancillary;
+
+namespace {
+
+struct sent_message
+{
+	std::int64_t					frame;
+	std::vector<scte104_operation>	operations;
+};
+
+// Ticks the scheduler once for channel frame, as a producer does for every frame it emits.
+bool tick(core::scte_104& scte, std::int64_t frame, const core::video_format_desc& format_desc, std::vector<sent_message>& sent)
+{
+	auto data = std::dynamic_pointer_cast<SCTE104AncData>(scte.tick(frame, format_desc));
+
+	if (!data)
+		return false;
+
+	sent.push_back(sent_message { frame, scte104_operations(data->getData()) });
+
+	return true;
+}
+
+std::int64_t milliseconds(std::int64_t frames, const core::video_format_desc& format_desc)
+{
+	return frames * 1000 * format_desc.framerate.denominator() / format_desc.framerate.numerator();
+}
+
+std::int64_t frames(std::int64_t milliseconds, const core::video_format_desc& format_desc)
+{
+	return std::llround(static_cast<double>(milliseconds) * format_desc.framerate.numerator() / format_desc.framerate.denominator() / 1000.0);
+}
+
+int pre_roll_time(const scte104_operation& splice_request)
+{
+	CHECK(splice_request.opid == scte104::opid_splice);
+	CHECK(splice_request.data.size() == 14);
+
+	return static_cast<int>(read_msb(splice_request.data, 7, 2));
+}
+
+// Every message counts down to the same channel frame, 8 s after the first one.
+void check_countdown(const std::vector<sent_message>& sent, std::int64_t start, const core::video_format_desc& format_desc)
+{
+	auto frame_duration = milliseconds(1, format_desc) + 1;
+
+	for (auto& message : sent)
+	{
+		CHECK(message.operations.size() == 1);
+
+		auto remaining = 8000 - milliseconds(message.frame - start, format_desc);
+
+		CHECK(std::abs(pre_roll_time(message.operations[0]) - remaining) <= frame_duration);
+	}
+}
+
+void test_countdown(const core::video_format_desc& format_desc)
+{
+	core::scte_104 scte(L"OPID=SPLICE,SPLICE_TYPE=START_NORMAL,EVENT_ID=7,PRE_ROLL_TIME=8000,BREAK_DURATION=300,RESEND_INTERVAL=1000,RESEND_LIMIT=4500,HEARTBEAT=0");
+
+	// The channel has been running for a while before the request comes in.
+	const std::int64_t start = 100000;
+	std::vector<sent_message> sent;
+
+	for (auto frame = start; frame < start + frames(10000, format_desc); ++frame)
+		tick(scte, frame, format_desc, sent);
+
+	// Sent at 0, 1, 2 and 3 s, the next one would fall within the 4.5 s resend limit.
+	CHECK(sent.size() == 4);
+	CHECK(sent[0].frame == start);
+
+	for (std::size_t n = 1; n < sent.size(); ++n)
+		CHECK(sent[n].frame - sent[n - 1].frame == frames(1000, format_desc));
+
+	check_countdown(sent, start, format_desc);
+}
+
+void test_pause(const core::video_format_desc& format_desc)
+{
+	core::scte_104 scte(L"OPID=SPLICE,SPLICE_TYPE=START_NORMAL,EVENT_ID=7,PRE_ROLL_TIME=8000,BREAK_DURATION=300,RESEND_INTERVAL=1000,RESEND_LIMIT=2500,HEARTBEAT=0");
+
+	const std::int64_t start		= 5;
+	const std::int64_t pause		= start + frames(500, format_desc);
+	const std::int64_t resume		= pause + frames(3000, format_desc);
+	std::vector<sent_message> sent;
+
+	// The producer is not ticked while paused, the channel frames keep counting.
+	for (auto frame = start; frame < start + frames(10000, format_desc); ++frame)
+	{
+		if (frame < pause || frame >= resume)
+			tick(scte, frame, format_desc, sent);
+	}
+
+	CHECK(sent.size() >= 2);
+	CHECK(sent[0].frame == start);
+
+	// The resend that was due during the pause goes out as soon as the producer resumes,
+	// counting down from where the channel is rather than where the producer stopped.
+	CHECK(sent[1].frame == resume);
+	CHECK(pre_roll_time(sent[1].operations[0]) < 8000 - 3000);
+
+	check_countdown(sent, start, format_desc);
+}
+
+void test_repeated_ticks(const core::video_format_desc& format_desc)
+{
+	core::scte_104 scte(L"OPID=SPLICE,SPLICE_TYPE=START_NORMAL,EVENT_ID=7,PRE_ROLL_TIME=8000,BREAK_DURATION=300,HEARTBEAT=1000");
+
+	const std::int64_t start = 0;
+	std::vector<sent_message> sent;
+
+	// A producer that emits two frames for some channel frames, e.g. one pulled twice to
+	// change rate, does not send anything twice.
+	for (auto frame = start; frame < start + frames(8000, format_desc); ++frame)
+	{
+		tick(scte, frame, format_desc, sent);
+		CHECK(!tick(scte, frame, format_desc, sent));
+	}
+
+	CHECK(!sent.empty());
+
+	for (std::size_t n = 1; n < sent.size(); ++n)
+		CHECK(sent[n].frame > sent[n - 1].frame);
+}
+
+void test_heartbeat(const core::video_format_desc& format_desc)
+{
+	core::scte_104 scte(L"OPID=SPLICE_NULL,HEARTBEAT=2000");
+
+	const std::int64_t start		= 42;
+	const std::int64_t pause		= start + frames(4000, format_desc);
+	const std::int64_t resume		= pause + frames(5000, format_desc);
+	const auto spacing				= frames(2000, format_desc);
+	std::vector<sent_message> sent;
+
+	for (auto frame = start; frame < resume + frames(6000, format_desc); ++frame)
+	{
+		if (frame < pause || frame >= resume)
+			tick(scte, frame, format_desc, sent);
+	}
+
+	for (auto& message : sent)
+	{
+		CHECK(message.operations.size() == 1);
+		CHECK(message.operations[0].opid == scte104::opid_splice_null);
+		CHECK(message.operations[0].data.empty());
+	}
+
+	// Every 2 s of channel time before the pause, at once after it and every 2 s from there.
+	std::vector<std::int64_t> expected { start, start + spacing };
+
+	for (auto frame = resume; frame < resume + frames(6000, format_desc); frame += spacing)
+		expected.push_back(frame);
+
+	CHECK(sent.size() == expected.size());
+
+	for (std::size_t n = 0; n < sent.size(); ++n)
+		CHECK(sent[n].frame == expected[n]);
+}
+
+}
+
+void test_scte104_scheduler()
+{
+	for (int n = static_cast<int>(core::video_format::pal); n < static_cast<int>(core::video_format::invalid); ++n)
+	{
+		core::video_format_desc format_desc(static_cast<core::video_format>(n));
+
+		test_countdown(format_desc);
+		test_pause(format_desc);
+		test_repeated_ticks(format_desc);
+		test_heartbeat(format_desc);
+
+		std::cout << "scte104 scheduler " << std::string(format_desc.name.begin(), format_desc.name.end()) << ": ok" << std::endl;
+	}
+}
+
+}}
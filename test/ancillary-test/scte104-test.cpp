@@ -0,0 +1,291 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Checks the serialization of every SCTE-104 operation against reference
+// payloads written out from the tables of SCTE 104, both for the message
+// classes themselves and for the requests the SCTE producer parameter builds.
+
+#include "scte104.h"
+
+#include <core/ancillary/scte/messages/availdescriptor.h>
+#include <core/ancillary/scte/messages/dtmfdescriptor.h>
+#include <core/ancillary/scte/messages/segmentationdescriptor.h>
+#include <core/ancillary/scte/messages/splicenull.h>
+#include <core/ancillary/scte/messages/splicerequest.h>
+#include <core/ancillary/scte/messages/timesignal.h>
+#include <core/ancillary/scte/scte.h>
+#include <core/scte/scte.h>
+#include <core/video_format.h>
+
+#include <common/except.h>
+
+#include <test/common/test.h>
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace caspar { namespace test {
+
+using namespace core::ancillary;
+
+namespace {
+
+typedef std::vector<std::uint8_t> bytes;
+
+bytes operator+(bytes lhs, const bytes& rhs)
+{
+	lhs.insert(lhs.end(), rhs.begin(), rhs.end());
+	return lhs;
+}
+
+bytes serialize(scte104::SCTE104Msg&& message)
+{
+	bytes result;
+	message.appendData(result);
+	return result;
+}
+
+// multiple_operation_message with the SMPTE 2010 payload descriptor in front, no timestamp.
+bytes message(std::uint8_t num_ops, const bytes& operations)
+{
+	auto message_size = static_cast<std::uint16_t>(12 + operations.size());
+
+	return bytes {
+		0x08,										// payload descriptor, single packet
+		0xff, 0xff,									// reserved
+		static_cast<std::uint8_t>(message_size >> 8), static_cast<std::uint8_t>(message_size & 0xff),
+		0x00,										// protocol_version
+		0x00,										// AS_index
+		0x00,										// message_number
+		0x00, 0x00,									// DPI_PID_index
+		0x00,										// SCTE35_protocol_version
+		0x00,										// time_type
+		num_ops
+	} + operations;
+}
+
+const bytes splice_request_reference {
+	0x01, 0x01, 0x00, 0x0e,						// opID, data_length
+	0x01,										// splice_insert_type start_normal
+	0x12, 0x34, 0x56, 0x78,						// splice_event_id
+	0xab, 0xcd,									// unique_program_id
+	0x1f, 0x40,									// pre_roll_time 8000 ms
+	0x01, 0x2c,									// break_duration 300
+	0x01,										// avail_num
+	0x02,										// avails_expected
+	0x01										// auto_return_flag
+};
+
+const bytes time_signal_reference {
+	0x01, 0x04, 0x00, 0x02,
+	0x0f, 0xa0									// pre_roll_time 4000 ms
+};
+
+const bytes segmentation_reference {
+	0x01, 0x0b, 0x00, 0x1b,						// data_length 21 + 6
+	0x00, 0x00, 0x00, 0x01,						// segmentation_event_id
+	0x00,										// segmentation_event_cancel_indicator
+	0x00, 0x78,									// duration 120 s
+	0x09,										// segmentation_upid_type
+	0x06,										// segmentation_upid_length
+	0x53, 0x49, 0x47, 0x4e, 0x41, 0x4c,			// segmentation_upid "SIGNAL"
+	0x34,										// segmentation_type_id
+	0x01,										// segment_num
+	0x02,										// segments_expected
+	0x00,										// duration_extension_frames
+	0x00,										// delivery_not_restricted_flag
+	0x01,										// web_delivery_allowed_flag
+	0x00,										// no_regional_blackout_flag
+	0x01,										// archive_allowed_flag
+	0x02,										// device_restrictions
+	0x01,										// insert_sub_segment_info
+	0x03,										// sub_segment_num
+	0x04										// sub_segments_expected
+};
+
+const bytes avail_reference {
+	0x01, 0x0a, 0x00, 0x09,
+	0x02,										// num_provider_avails
+	0x00, 0x00, 0x00, 0x01,
+	0xde, 0xad, 0xbe, 0xef
+};
+
+const bytes dtmf_reference {
+	0x01, 0x09, 0x00, 0x06,
+	0x32,										// pre_roll 5 s in tenths
+	0x04,										// dtmf_length
+	0x31, 0x32, 0x33, 0x2a						// "123*"
+};
+
+const bytes splice_null_reference {
+	0x01, 0x02, 0x00, 0x00
+};
+
+scte104::segmentation_descriptor reference_segmentation()
+{
+	scte104::segmentation_descriptor descriptor;
+	descriptor.event_id						= 1;
+	descriptor.duration						= 120;
+	descriptor.upid_type					= 0x09;
+	descriptor.upid							= { 'S', 'I', 'G', 'N', 'A', 'L' };
+	descriptor.type_id						= 0x34;
+	descriptor.segment_num					= 1;
+	descriptor.segments_expected			= 2;
+	descriptor.delivery_not_restricted_flag	= 0;
+	descriptor.web_delivery_allowed_flag	= 1;
+	descriptor.archive_allowed_flag			= 1;
+	descriptor.device_restrictions			= 2;
+	descriptor.insert_sub_segment_info		= 1;
+	descriptor.sub_segment_num				= 3;
+	descriptor.sub_segments_expected		= 4;
+	return descriptor;
+}
+
+bytes first_message(const std::wstring& scte_string)
+{
+	core::scte_104 scte(scte_string);
+	auto data = std::dynamic_pointer_cast<SCTE104AncData>(scte.tick(0, core::video_format_desc(core::video_format::pal)));
+
+	CHECK(data);
+
+	return data->getData();
+}
+
+bool rejected(const std::wstring& scte_string)
+{
+	try
+	{
+		core::scte_104 scte(scte_string);
+	}
+	catch (const user_error&)
+	{
+		return true;
+	}
+
+	return false;
+}
+
+void test_operations()
+{
+	CHECK(serialize(scte104::SpliceRequest(scte104::start_normal, 0x12345678, 0xabcd, 8000, 300, 1, 2, 1)) == splice_request_reference);
+	CHECK(serialize(scte104::TimeSignalRequest(4000)) == time_signal_reference);
+	CHECK(serialize(scte104::InsertSegmentationDescriptor(reference_segmentation())) == segmentation_reference);
+	CHECK(serialize(scte104::InsertAvailDescriptor({ 1, 0xdeadbeef })) == avail_reference);
+	CHECK(serialize(scte104::InsertDTMFDescriptor(50, "123*")) == dtmf_reference);
+	CHECK(serialize(scte104::SpliceNull()) == splice_null_reference);
+
+	// A UPID of the maximum length still fits its length fields.
+	auto descriptor = reference_segmentation();
+	descriptor.upid.assign(255, 0xa5);
+	auto long_upid = serialize(scte104::InsertSegmentationDescriptor(descriptor));
+	CHECK(long_upid.size() == 4 + 21 + 255);
+	CHECK(read_msb(long_upid, 2, 2) == 21 + 255);
+	CHECK(long_upid[12] == 255);
+
+	std::cout << "scte104 operations: ok" << std::endl;
+}
+
+void test_multiple_operation_message()
+{
+	SCTE104AncData data;
+	data.addMsg(std::make_unique<scte104::TimeSignalRequest>(4000));
+	data.addMsg(std::make_unique<scte104::InsertSegmentationDescriptor>(reference_segmentation()));
+	data.addMsg(std::make_unique<scte104::InsertAvailDescriptor>(std::vector<std::uint32_t> { 1, 0xdeadbeef }));
+	data.addMsg(std::make_unique<scte104::InsertDTMFDescriptor>(50, "123*"));
+
+	auto expected = message(4, time_signal_reference + segmentation_reference + avail_reference + dtmf_reference);
+
+	CHECK(data.getData() == expected);
+
+	// What is received is written out again unchanged.
+	auto parsed = SCTE104AncData::parse(expected.data(), expected.size());
+	CHECK(parsed);
+	CHECK(parsed->getData() == expected);
+
+	// A timestamp is kept as it came in.
+	auto with_timestamp = expected;
+	with_timestamp[11] = 3;										// time_type GPI
+	with_timestamp.insert(with_timestamp.begin() + 12, { 0x02, 0x01 });
+	with_timestamp[4] += 2;
+	parsed = SCTE104AncData::parse(with_timestamp.data(), with_timestamp.size());
+	CHECK(parsed);
+	CHECK(parsed->getData() == with_timestamp);
+
+	// Operations that run past messageSize, an unknown time_type and a multi packet
+	// payload descriptor are refused.
+	auto truncated = expected;
+	truncated.pop_back();
+	CHECK(!SCTE104AncData::parse(truncated.data(), truncated.size()));
+
+	auto bad_time_type = expected;
+	bad_time_type[11] = 4;
+	CHECK(!SCTE104AncData::parse(bad_time_type.data(), bad_time_type.size()));
+
+	auto split = expected;
+	split[0] = 0x0a;
+	CHECK(!SCTE104AncData::parse(split.data(), split.size()));
+
+	std::cout << "scte104 multiple_operation_message: ok" << std::endl;
+}
+
+void test_requests()
+{
+	CHECK(first_message(L"OPID=SPLICE,SPLICE_TYPE=START_NORMAL,EVENT_ID=0x12345678,UNIQUE_PROGRAM_ID=0xABCD,PRE_ROLL_TIME=8000,BREAK_DURATION=300,AVAIL_NUM=1,AVAILS_EXPECTED=2,AUTO_RETURN")
+			== message(1, splice_request_reference));
+
+	CHECK(first_message(L"OPID=TIME_SIGNAL,PRE_ROLL_TIME=4000,SEGMENTATION_TYPE_ID=0x34,SEGMENTATION_EVENT_ID=1,DURATION=120,UPID_TYPE=0x09,UPID=0x5349474E414C,"
+						L"SEGMENT_NUM=1,SEGMENTS_EXPECTED=2,SUB_SEGMENT_NUM=3,SUB_SEGMENTS_EXPECTED=4,DEVICE_RESTRICTIONS=2,WEB_DELIVERY_ALLOWED,ARCHIVE_ALLOWED,"
+						L"PROVIDER_AVAIL_ID=1,PROVIDER_AVAIL_ID=0xDEADBEEF,DTMF=123*,DTMF_PRE_ROLL=50")
+			== message(4, time_signal_reference + segmentation_reference + avail_reference + dtmf_reference));
+
+	CHECK(first_message(L"OPID=SPLICE,SPLICE_TYPE=CANCEL,EVENT_ID=5") == message(1, bytes {
+		0x01, 0x01, 0x00, 0x0e,
+		0x05,									// splice_insert_type cancel
+		0x00, 0x00, 0x00, 0x05,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+	}));
+
+	CHECK(first_message(L"OPID=SPLICE_NULL") == message(1, splice_null_reference));
+
+	CHECK(rejected(L"SPLICE_TYPE=START_NORMAL"));
+	CHECK(rejected(L"OPID=SPLICE"));
+	CHECK(rejected(L"OPID=SPLICE,SPLICE_TYPE=START_NORMAL,AVAIL_NUM=256"));
+	CHECK(rejected(L"OPID=SPLICE,SPLICE_TYPE=START_NORMAL,EVENT_ID=-1"));
+	CHECK(rejected(L"OPID=TIME_SIGNAL,SEGMENTATION_TYPE_ID=0x34,UPID=0x123"));
+	CHECK(rejected(L"OPID=TIME_SIGNAL,SEGMENTATION_TYPE_ID=0x34,UPID=0xZZ"));
+	CHECK(rejected(L"OPID=TIME_SIGNAL,SEGMENTATION_TYPE_ID=0x34,DEVICE_RESTRICTIONS=4"));
+	CHECK(rejected(L"OPID=TIME_SIGNAL,DTMF=12345678"));
+	CHECK(rejected(L"OPID=TIME_SIGNAL,DTMF=12A"));
+
+	std::cout << "scte104 requests: ok" << std::endl;
+}
+
+}
+
+void test_scte104()
+{
+	test_operations();
+	test_multiple_operation_message();
+	test_requests();
+}
+
+}}
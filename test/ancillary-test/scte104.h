@@ -0,0 +1,77 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Splits SCTE-104 multiple_operation_messages, as produced by SCTE104AncData,
+// into their operations, checking the message framing on the way.
+
+#pragma once
+
+#include <test/common/test.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace caspar { namespace test {
+
+struct scte104_operation
+{
+	std::uint16_t				opid;
+	std::vector<std::uint8_t>	data;
+};
+
+inline std::uint32_t read_msb(const std::vector<std::uint8_t>& data, std::size_t offset, int bytes)
+{
+	std::uint32_t value = 0;
+
+	for (int n = 0; n < bytes; ++n)
+		value = (value << 8) | data.at(offset + n);
+
+	return value;
+}
+
+// message starts with the SMPTE 2010 payload descriptor, followed by the
+// SCTE-104 multiple_operation_message without a timestamp.
+inline std::vector<scte104_operation> scte104_operations(const std::vector<std::uint8_t>& message)
+{
+	CHECK(message.size() >= 13);
+	CHECK(message[0] == 0x08);								// payload descriptor, single packet
+	CHECK(read_msb(message, 1, 2) == 0xffff);				// reserved
+	CHECK(read_msb(message, 3, 2) == message.size() - 1);	// messageSize
+	CHECK(message[11] == 0);								// time_type none
+
+	std::vector<scte104_operation> result;
+	std::size_t offset = 13;
+
+	for (int op = 0; op < message[12]; ++op)
+	{
+		auto opid	= static_cast<std::uint16_t>(read_msb(message, offset, 2));
+		auto length	= read_msb(message, offset + 2, 2);
+
+		CHECK(offset + 4 + length <= message.size());
+		result.push_back(scte104_operation { opid, std::vector<std::uint8_t>(message.begin() + offset + 4, message.begin() + offset + 4 + length) });
+		offset += 4 + length;
+	}
+
+	CHECK(offset == message.size());
+
+	return result;
+}
+
+}}
@@ -0,0 +1,331 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Builds SCTE-35 splice_info_sections, converts them to SCTE-104 and checks
+// every field that arrives, then round trips the SCTE-104 messages together
+// with CEA-708 captions through the packet format of an AncillaryContainer.
+
+#include "scte104.h"
+
+#include <core/ancillary/ancillary.h>
+#include <core/ancillary/bitstream.h>
+#include <core/ancillary/cea708/cea708.h>
+#include <core/ancillary/scte/scte.h>
+#include <core/ancillary/scte/scte35.h>
+
+#include <test/common/test.h>
+
+#include <boost/rational.hpp>
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace caspar { namespace test {
+
+using namespace core::ancillary;
+
+namespace {
+
+typedef std::vector<std::uint8_t> bytes;
+
+bytes splice_section(std::uint64_t pts_adjustment, std::uint8_t command_type, const bytes& command, const bytes& descriptors)
+{
+	bytes result;
+
+	{
+		Bitstream bs(result);
+		bs.write_byte(0xfc);										// table_id
+		bs.write_bits(0, 2);										// section_syntax_indicator, private_indicator
+		bs.write_bits(3, 2);										// sap_type
+		bs.write_bits(11 + command.size() + 2 + descriptors.size() + 4, 12);
+		bs.write_byte(0);											// protocol_version
+		bs.write_bits(0, 7);										// encrypted_packet, encryption_algorithm
+		bs.write_bits(pts_adjustment, 33);
+		bs.write_byte(0);											// cw_index
+		bs.write_bits(0xfff, 12);									// tier
+		bs.write_bits(command.size(), 12);
+		bs.write_byte(command_type);
+
+		for (auto byte : command)
+			bs.write_byte(byte);
+
+		bs.write_bytes_msb(descriptors.size(), 2);
+
+		for (auto byte : descriptors)
+			bs.write_byte(byte);
+	}
+
+	auto crc = scte35::crc32(result.data(), result.size());
+
+	Bitstream(result).write_bytes_msb(crc, 4);
+
+	return result;
+}
+
+void write_splice_time(Bitstream& bs, std::uint64_t pts)
+{
+	bs.write_bits(1, 1);
+	bs.write_bits(0x3f, 6);
+	bs.write_bits(pts, 33);
+}
+
+bytes splice_insert(std::uint32_t event_id, bool out_of_network, bool immediate, std::uint64_t pts, std::uint64_t duration, bool cancel = false)
+{
+	bytes result;
+	Bitstream bs(result);
+
+	bs.write_bytes_msb(event_id, 4);
+	bs.write_bits(cancel, 1);
+	bs.write_bits(0x7f, 7);
+
+	if (cancel)
+		return result;
+
+	bs.write_bits(out_of_network, 1);
+	bs.write_bits(1, 1);											// program_splice_flag
+	bs.write_bits(duration != 0, 1);
+	bs.write_bits(immediate, 1);
+	bs.write_bits(0xf, 4);
+
+	if (!immediate)
+		write_splice_time(bs, pts);
+
+	if (duration != 0)
+	{
+		bs.write_bits(1, 1);										// auto_return
+		bs.write_bits(0x3f, 6);
+		bs.write_bits(duration, 33);
+	}
+
+	bs.write_bytes_msb(0x1234, 2);									// unique_program_id
+	bs.write_byte(2);												// avail_num
+	bs.write_byte(3);												// avails_expected
+
+	return result;
+}
+
+bytes segmentation_descriptor(std::uint32_t event_id, std::uint64_t duration, const bytes& upid, std::uint8_t type_id)
+{
+	bytes body;
+
+	{
+		Bitstream bs(body);
+		bs.write_bytes_msb(0x43554549, 4);							// "CUEI"
+		bs.write_bytes_msb(event_id, 4);
+		bs.write_bits(0, 1);										// segmentation_event_cancel_indicator
+		bs.write_bits(0x7f, 7);
+		bs.write_bits(1, 1);										// program_segmentation_flag
+		bs.write_bits(1, 1);										// segmentation_duration_flag
+		bs.write_bits(0, 1);										// delivery_not_restricted_flag
+		bs.write_bits(1, 1);										// web_delivery_allowed_flag
+		bs.write_bits(0, 1);										// no_regional_blackout_flag
+		bs.write_bits(1, 1);										// archive_allowed_flag
+		bs.write_bits(2, 2);										// device_restrictions
+		bs.write_bits(duration, 40);
+		bs.write_byte(0x0c);										// segmentation_upid_type, MPU
+		bs.write_byte(static_cast<std::uint8_t>(upid.size()));
+
+		for (auto byte : upid)
+			bs.write_byte(byte);
+
+		bs.write_byte(type_id);
+		bs.write_byte(1);											// segment_num
+		bs.write_byte(4);											// segments_expected
+		bs.write_byte(5);											// sub_segment_num
+		bs.write_byte(6);											// sub_segments_expected
+	}
+
+	bytes result { 0x02, static_cast<std::uint8_t>(body.size()) };
+	result.insert(result.end(), body.begin(), body.end());
+
+	return result;
+}
+
+scte35::splice_info parse(const bytes& section)
+{
+	scte35::splice_info info;
+	CHECK(scte35::parse(section.data(), section.size(), info));
+	return info;
+}
+
+void test_splice_insert()
+{
+	auto info = parse(splice_section(90000, scte35::splice_command_insert, splice_insert(0xdeadbeef, true, false, 900000, 30 * 90000), { }));
+
+	CHECK(info.command_type == scte35::splice_command_insert);
+	CHECK(info.insert.event_id == 0xdeadbeef);
+	CHECK(*scte35::splice_pts(info) == 990000);
+
+	auto ops = scte104_operations(scte35::to_scte104(info, 4000)->getData());
+
+	CHECK(ops.size() == 1);
+	CHECK(ops[0].opid == 0x0101);
+	CHECK(ops[0].data == bytes({
+			0x01,						// start_normal
+			0xde, 0xad, 0xbe, 0xef,		// splice_event_id
+			0x12, 0x34,					// unique_program_id
+			0x0f, 0xa0,					// pre_roll_time 4000 ms
+			0x01, 0x2c,					// break_duration 300 tenths
+			0x02, 0x03,					// avail_num, avails_expected
+			0x01 }));					// auto_return_flag
+
+	// Immediate splices have no pre-roll, the end of a break no duration.
+	info = parse(splice_section(0, scte35::splice_command_insert, splice_insert(7, false, true, 0, 0), { }));
+	ops = scte104_operations(scte35::to_scte104(info, 4000)->getData());
+	CHECK(!scte35::splice_pts(info));
+	CHECK(ops[0].data[0] == 0x04);								// end_immediate
+	CHECK(read_msb(ops[0].data, 7, 2) == 0);
+	CHECK(read_msb(ops[0].data, 9, 2) == 0);
+
+	info = parse(splice_section(0, scte35::splice_command_insert, splice_insert(7, false, false, 0, 0, true), { }));
+	ops = scte104_operations(scte35::to_scte104(info, 4000)->getData());
+	CHECK(ops[0].data[0] == 0x05);								// cancel
+
+	std::cout << "scte35 splice_insert: ok" << std::endl;
+}
+
+void test_time_signal()
+{
+	bytes command;
+	{
+		Bitstream bs(command);
+		write_splice_time(bs, (1ULL << 33) - 10);
+	}
+
+	bytes upid { 'C', 'A', 'S', 'P' };
+	auto info = parse(splice_section(20, scte35::splice_command_time_signal, command, segmentation_descriptor(42, 60 * 90000 + 100, upid, 0x34)));
+
+	// The PTS wraps at 33 bits.
+	CHECK(*scte35::splice_pts(info) == 10);
+	CHECK(info.segmentation_descriptors.size() == 1);
+
+	auto ops = scte104_operations(scte35::to_scte104(info, 2000)->getData());
+
+	CHECK(ops.size() == 2);
+	CHECK(ops[0].opid == 0x0104);
+	CHECK(ops[0].data == bytes({ 0x07, 0xd0 }));
+	CHECK(ops[1].opid == 0x010b);
+	CHECK(ops[1].data == bytes({
+			0x00, 0x00, 0x00, 0x2a,		// segmentation_event_id
+			0x00,						// segmentation_event_cancel_indicator
+			0x00, 0x3c,					// duration, seconds
+			0x0c, 0x04,					// segmentation_upid_type and length
+			'C', 'A', 'S', 'P',
+			0x34, 0x01, 0x04,			// segmentation_type_id, segment_num, segments_expected
+			0x00,						// duration_extension_frames
+			0x00, 0x01, 0x00, 0x01,		// delivery_not_restricted, web, no_regional_blackout, archive
+			0x02,						// device_restrictions
+			0x01, 0x05, 0x06 }));		// insert_sub_segment_info, sub_segment_num, sub_segments_expected
+
+	info = parse(splice_section(0, scte35::splice_command_null, { }, { }));
+	ops = scte104_operations(scte35::to_scte104(info, 0)->getData());
+	CHECK(ops.size() == 1 && ops[0].opid == 0x0102 && ops[0].data.empty());
+
+	std::cout << "scte35 time_signal: ok" << std::endl;
+}
+
+void test_rejected()
+{
+	auto section = splice_section(0, scte35::splice_command_insert, splice_insert(1, true, false, 100, 0), { });
+	scte35::splice_info info;
+
+	for (std::size_t size = 0; size < section.size(); ++size)
+		CHECK(!scte35::parse(section.data(), size, info));
+
+	for (std::size_t n = 0; n < section.size(); ++n)
+	{
+		auto corrupt = section;
+		corrupt[n] ^= 0x10;
+		CHECK(!scte35::parse(corrupt.data(), corrupt.size(), info));
+	}
+
+	// Encrypted sections and commands without a SCTE-104 counterpart.
+	auto encrypted = section;
+	encrypted[4] |= 0x80;
+	auto crc = scte35::crc32(encrypted.data(), encrypted.size() - 4);
+	encrypted.resize(encrypted.size() - 4);
+	Bitstream(encrypted).write_bytes_msb(crc, 4);
+	CHECK(!scte35::parse(encrypted.data(), encrypted.size(), info));
+	CHECK(!scte35::parse(splice_section(0, scte35::splice_command_bandwidth_reservation, { }, { }).data(), splice_section(0, scte35::splice_command_bandwidth_reservation, { }, { }).size(), info));
+
+	std::cout << "scte35 rejected: ok" << std::endl;
+}
+
+// SCTE-104 and captions arrive together in the same frame and must survive
+// the packet format used between processes.
+void test_container_round_trip()
+{
+	auto info		= parse(splice_section(0, scte35::splice_command_insert, splice_insert(9, true, false, 9000, 90000), { }));
+	auto scte104	= scte35::to_scte104(info, 1000);
+
+	std::vector<cc_data> captions;
+
+	for (int n = 0; n < CEA708::cc_count(boost::rational<int>(30000, 1001)); ++n)
+		captions.push_back(cc_data { true, n < 2 ? static_cast<cc_type>(n) : cc_type_dtvcc_data, static_cast<std::uint8_t>(n), 0x80 });
+
+	auto cea708 = std::make_shared<CEA708>(captions, boost::rational<int>(30000, 1001), 17);
+
+	AncillaryContainer source;
+	source.addData(scte104);
+	source.addData(cea708);
+
+	bytes packets;
+	source.getAncillaryAsPackets(packets);
+
+	AncillaryContainer received;
+	CHECK(received.addPackets(packets.data(), packets.size()));
+
+	auto received_scte104 = received.takeData(ancillary_data_type_scte_104);
+	auto received_cea708 = received.takeData(ancillary_data_type_cea708);
+
+	CHECK(received.empty());
+	CHECK(received_scte104.size() == 1 && received_scte104[0]->getData() == scte104->getData());
+	CHECK(received_cea708.size() == 1 && received_cea708[0]->getData() == cea708->getData());
+
+	auto message = received_scte104[0]->getData();
+	auto reparsed = SCTE104AncData::parse(message.data(), message.size());
+	CHECK(reparsed && reparsed->getData() == message);
+
+	auto cdp_bytes = received_cea708[0]->getData();
+	CEA708 reparsed_cea708(cdp_bytes.data(), cdp_bytes.size(), cdp);
+	CHECK(reparsed_cea708.valid());
+	CHECK(reparsed_cea708.getA53Data() == cea708->getA53Data());
+
+	// appendFrom moves everything and leaves the source empty.
+	AncillaryContainer target;
+	target.appendFrom(source);
+	CHECK(source.empty());
+	CHECK(target.takeAll().size() == 2);
+
+	std::cout << "scte35 container round trip: ok" << std::endl;
+}
+
+}
+
+void test_scte35()
+{
+	test_splice_insert();
+	test_time_signal();
+	test_rejected();
+	test_container_round_trip();
+}
+
+}}
@@ -0,0 +1,459 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Loops ancillary data through an MPEG-TS the way the ffmpeg consumer writes it
+// and the producer reads it back: ST 2038 PES payloads, the 'VANC' registration
+// descriptor added to the PMT, and a PMT lookup like the MPEG-TS demuxer's.
+
+#include <core/ancillary/ancillary.h>
+#include <core/ancillary/scte/scte35.h>
+#include <core/ancillary/st2038.h>
+#include <core/ancillary/vanc_decoder.h>
+
+#include <test/common/test.h>
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace caspar { namespace test {
+
+using namespace core::ancillary;
+
+namespace {
+
+const std::uint16_t	pmt_pid			= 0x1000;
+const std::uint16_t	video_pid		= 0x100;
+const std::uint16_t	audio_pid		= 0x101;
+const std::uint16_t	data_pid		= 0x102;
+const std::uint16_t	teletext_pid	= 0x103;
+
+struct packet_data
+{
+	std::uint8_t				did;
+	std::uint8_t				sdid;
+	std::vector<std::uint8_t>	data;
+
+	bool operator==(const packet_data& other) const
+	{
+		return did == other.did && sdid == other.sdid && data == other.data;
+	}
+};
+
+packet_data describe(const AncillaryData& data)
+{
+	packet_data result;
+	data.getVancID(result.did, result.sdid);
+	result.data = data.getData();
+	return result;
+}
+
+// Random packets that fit the single byte data count of ST 2038.
+std::vector<std::shared_ptr<AncillaryData>> random_packets(std::uint32_t seed)
+{
+	std::vector<std::shared_ptr<AncillaryData>> packets;
+	auto sizes = noise(64, seed);
+
+	for (std::size_t n = 0; n < static_cast<std::size_t>(sizes[0] % 20); ++n)
+	{
+		auto bytes = noise(sizes[n + 1] + 2, seed * 64 + static_cast<std::uint32_t>(n));
+		auto did = static_cast<std::uint8_t>(bytes[0] | 0x80);		// type 1 DIDs, clear of the registered parsers
+		packets.push_back(std::make_shared<RawAncillaryData>(did, bytes[1], std::vector<std::uint8_t>(bytes.begin() + 2, bytes.end())));
+	}
+
+	return packets;
+}
+
+std::vector<packet_data> describe(const std::vector<std::shared_ptr<AncillaryData>>& packets)
+{
+	std::vector<packet_data> result;
+
+	for (auto& data : packets)
+		result.push_back(describe(*data));
+
+	return result;
+}
+
+std::vector<std::uint8_t> write(const std::vector<std::shared_ptr<AncillaryData>>& packets, std::uint32_t width)
+{
+	AncillaryContainer container;
+
+	for (auto& data : packets)
+		container.addData(data);
+
+	std::vector<std::uint8_t> payload;
+	st2038::write(container, width, payload);
+	return payload;
+}
+
+std::vector<packet_data> decode(const std::vector<st2038::packet>& packets)
+{
+	VancDecoder decoder;
+	std::vector<packet_data> result;
+
+	for (auto& packet : packets)
+		result.push_back(describe(*decoder.decodePacket(packet.did, packet.sdid, packet.data.data(), packet.data.size())));
+
+	return result;
+}
+
+void put_crc(std::vector<std::uint8_t>& section)
+{
+	auto crc = scte35::crc32(section.data(), section.size());
+
+	for (int shift = 24; shift >= 0; shift -= 8)
+		section.push_back(static_cast<std::uint8_t>(crc >> shift));
+}
+
+// Splits a section or PES into transport stream packets, stuffing the last one like the FFmpeg muxer.
+void put_packets(std::vector<std::uint8_t>& ts, std::uint16_t pid, std::vector<std::uint8_t> payload, bool section, std::size_t prefix)
+{
+	static std::map<std::uint16_t, std::uint8_t> continuity;
+
+	if (section)
+	{
+		payload.insert(payload.begin(), 0x00);		// pointer_field
+		payload.resize(((payload.size() + 183) / 184) * 184, 0xff);
+	}
+
+	for (std::size_t pos = 0; pos < payload.size();)
+	{
+		ts.insert(ts.end(), prefix, 0x00);
+		ts.push_back(0x47);
+		ts.push_back(static_cast<std::uint8_t>((pos == 0 ? 0x40 : 0x00) | pid >> 8));
+		ts.push_back(static_cast<std::uint8_t>(pid));
+
+		auto size = std::min<std::size_t>(184, payload.size() - pos);
+		auto cc = continuity[pid]++ & 0x0f;
+
+		if (size == 184)
+			ts.push_back(static_cast<std::uint8_t>(0x10 | cc));
+		else
+		{
+			ts.push_back(static_cast<std::uint8_t>(0x30 | cc));
+			ts.push_back(static_cast<std::uint8_t>(183 - size));		// adaptation_field_length
+
+			if (size < 183)
+			{
+				ts.push_back(0x00);
+				ts.insert(ts.end(), 182 - size, 0xff);
+			}
+		}
+
+		ts.insert(ts.end(), payload.begin() + pos, payload.begin() + pos + size);
+		pos += size;
+	}
+}
+
+void put_pat(std::vector<std::uint8_t>& ts, std::size_t prefix)
+{
+	std::vector<std::uint8_t> section { 0x00, 0xb0, 13, 0x00, 0x01, 0xc1, 0x00, 0x00, 0x00, 0x01, static_cast<std::uint8_t>(0xe0 | pmt_pid >> 8), static_cast<std::uint8_t>(pmt_pid) };
+	put_crc(section);
+	put_packets(ts, 0, section, true, prefix);
+}
+
+// The PMT the MPEG-TS muxer of FFmpeg writes for video, audio, ST 2038 and a teletext stream.
+void put_pmt(std::vector<std::uint8_t>& ts, std::size_t prefix)
+{
+	std::vector<std::uint8_t> section { 0x02, 0xb0, 0x00, 0x00, 0x01, 0xc1, 0x00, 0x00, static_cast<std::uint8_t>(0xe0 | video_pid >> 8), static_cast<std::uint8_t>(video_pid), 0xf0, 0x00 };
+
+	auto put_stream = [&](std::uint8_t stream_type, std::uint16_t pid, std::vector<std::uint8_t> descriptors)
+	{
+		section.push_back(stream_type);
+		section.push_back(static_cast<std::uint8_t>(0xe0 | pid >> 8));
+		section.push_back(static_cast<std::uint8_t>(pid));
+		section.push_back(static_cast<std::uint8_t>(0xf0 | descriptors.size() >> 8));
+		section.push_back(static_cast<std::uint8_t>(descriptors.size()));
+		section.insert(section.end(), descriptors.begin(), descriptors.end());
+	};
+
+	put_stream(0x1b, video_pid, {});
+	put_stream(0x0f, audio_pid, {});
+	put_stream(0x06, data_pid, {});
+	put_stream(0x06, teletext_pid, { 0x56, 0x05, 'e', 'n', 'g', 0x09, 0x00 });
+
+	section[2] = static_cast<std::uint8_t>(section.size() + 4 - 3);
+	put_crc(section);
+	put_packets(ts, pmt_pid, section, true, prefix);
+}
+
+void put_pes(std::vector<std::uint8_t>& ts, std::uint16_t pid, const std::vector<std::uint8_t>& data, std::size_t prefix)
+{
+	std::vector<std::uint8_t> pes { 0x00, 0x00, 0x01, 0xbd, 0x00, 0x00, 0x80, 0x80, 0x05, 0x21, 0x00, 0x01, 0x00, 0x01 };
+	pes[4] = static_cast<std::uint8_t>((data.size() + 8) >> 8);
+	pes[5] = static_cast<std::uint8_t>(data.size() + 8);
+	pes.insert(pes.end(), data.begin(), data.end());
+	put_packets(ts, pid, pes, false, prefix);
+}
+
+struct demuxed
+{
+	std::map<std::uint16_t, std::uint8_t>				stream_types;
+	std::map<std::uint16_t, std::uint32_t>				registrations;
+	std::map<std::uint16_t, std::vector<std::uint8_t>>	descriptors;
+	std::vector<std::vector<std::uint8_t>>				st2038_payloads;
+	int													bad_crcs	= 0;
+};
+
+// Reads the PMT like the MPEG-TS demuxer, then takes the PES payloads of the streams it calls ST 2038.
+demuxed demux(const std::vector<std::uint8_t>& ts, std::size_t prefix)
+{
+	demuxed result;
+	std::vector<std::uint8_t> pes;
+
+	auto flush = [&]
+	{
+		if (pes.size() >= 9)
+			result.st2038_payloads.emplace_back(pes.begin() + 9 + pes[8], pes.end());
+		pes.clear();
+	};
+
+	for (std::size_t pos = prefix; pos + 188 <= ts.size(); pos += 188 + prefix)
+	{
+		const std::uint8_t* packet = ts.data() + pos;
+		CHECK(packet[0] == 0x47);
+
+		std::uint16_t pid = (packet[1] & 0x1f) << 8 | packet[2];
+		bool start = (packet[1] & 0x40) != 0;
+		std::size_t offset = (packet[3] & 0x20) ? 5 + packet[4] : 4;
+
+		if (pid == pmt_pid && start)
+		{
+			const std::uint8_t* section = packet + offset + 1 + packet[offset];
+			std::size_t section_length = (section[1] & 0x0f) << 8 | section[2];
+
+			if (scte35::crc32(section, section_length + 3) != 0)
+			{
+				++result.bad_crcs;
+				continue;
+			}
+
+			result.stream_types.clear();
+			result.registrations.clear();
+			result.descriptors.clear();
+
+			for (std::size_t n = 12 + ((section[10] & 0x0f) << 8 | section[11]); n + 5 <= section_length + 3 - 4;)
+			{
+				std::uint16_t es_pid = (section[n + 1] & 0x1f) << 8 | section[n + 2];
+				std::size_t length = (section[n + 3] & 0x0f) << 8 | section[n + 4];
+
+				result.stream_types[es_pid] = section[n];
+				result.descriptors[es_pid].assign(section + n + 5, section + n + 5 + length);
+
+				for (std::size_t d = n + 5; d + 2 <= n + 5 + length; d += 2 + section[d + 1])
+				{
+					if (section[d] == 0x05 && section[d + 1] >= 4)
+						result.registrations[es_pid] = section[d + 2] << 24 | section[d + 3] << 16 | section[d + 4] << 8 | section[d + 5];
+				}
+
+				n += 5 + length;
+			}
+		}
+		else if (result.stream_types.count(pid) && result.stream_types.at(pid) == 0x06
+				&& result.registrations.count(pid) && result.registrations.at(pid) == st2038::registration_format_identifier)
+		{
+			if (start)
+				flush();
+
+			pes.insert(pes.end(), packet + offset, packet + 188);
+		}
+	}
+
+	flush();
+	return result;
+}
+
+// Passes the stream through the writer in pieces of random size, as the muxer's IO buffer would.
+std::vector<std::uint8_t> register_st2038(const std::vector<std::uint8_t>& ts, std::uint32_t seed)
+{
+	st2038::registration_writer writer;
+	std::vector<std::uint8_t> out;
+	auto sizes = noise(ts.size(), seed);
+
+	for (std::size_t pos = 0, n = 0; pos < ts.size(); ++n)
+	{
+		auto size = std::min<std::size_t>(ts.size() - pos, sizes[n % sizes.size()] * 7 + 1);
+		writer.write(ts.data() + pos, size, out);
+		pos += size;
+	}
+
+	return out;
+}
+
+void test_round_trip()
+{
+	for (std::uint32_t width : { 720u, 1280u, 1920u })
+	{
+		for (std::uint32_t seed = 1; seed <= 300; ++seed)
+		{
+			auto packets = random_packets(seed);
+			auto payload = write(packets, width);
+
+			std::vector<st2038::packet> parsed;
+			CHECK(st2038::parse(payload.data(), payload.size(), parsed));
+			CHECK(decode(parsed) == describe(packets));
+
+			// In the luma channel, one after the other, within the line.
+			std::size_t line_samples = width > 720 ? width : width * 2;
+			std::uint16_t line = 9;
+			std::size_t end = 0;
+
+			for (auto& packet : parsed)
+			{
+				CHECK(!packet.c_not_y_channel);
+				CHECK(packet.line_number == line || packet.line_number == line + 1);
+
+				if (packet.line_number != line)
+				{
+					line = packet.line_number;
+					end = 0;
+				}
+
+				CHECK(packet.horizontal_offset == end);
+				end += packet.data.size() + 7;
+				CHECK(end <= line_samples || packet.horizontal_offset == 0);
+			}
+
+			// An empty frame is a single stuffing byte.
+			if (packets.empty())
+				CHECK(payload == std::vector<std::uint8_t> { 0xff });
+		}
+	}
+
+	std::cout << "st2038 round trip: ok" << std::endl;
+}
+
+void test_loopback()
+{
+	for (std::size_t prefix : { 0, 4 })
+	{
+		for (std::uint32_t seed = 1; seed <= 50; ++seed)
+		{
+			std::vector<std::uint8_t> ts;
+			std::vector<std::vector<std::shared_ptr<AncillaryData>>> frames;
+
+			for (std::uint32_t frame = 0; frame < 10; ++frame)
+			{
+				// FFmpeg repeats the tables
+				if (frame % 4 == 0)
+				{
+					put_pat(ts, prefix);
+					put_pmt(ts, prefix);
+				}
+
+				frames.push_back(random_packets(seed * 10 + frame));
+				put_pes(ts, video_pid, noise(400, seed + frame), prefix);
+				put_pes(ts, data_pid, write(frames.back(), 1920), prefix);
+				put_pes(ts, teletext_pid, noise(46, seed + frame), prefix);
+			}
+
+			// Without the descriptor nothing is taken for ST 2038.
+			auto before = demux(ts, prefix);
+			CHECK(before.st2038_payloads.empty());
+
+			auto out = register_st2038(ts, seed);
+			CHECK(out.size() == ts.size());
+
+			auto after = demux(out, prefix);
+			CHECK(after.bad_crcs == 0);
+			CHECK(after.stream_types == before.stream_types);
+			CHECK(after.registrations.size() == 1);
+			CHECK(after.registrations.at(data_pid) == st2038::registration_format_identifier);
+			CHECK(after.descriptors.at(teletext_pid) == before.descriptors.at(teletext_pid));
+
+			CHECK(after.st2038_payloads.size() == frames.size());
+
+			for (std::size_t frame = 0; frame < frames.size(); ++frame)
+			{
+				std::vector<st2038::packet> parsed;
+				CHECK(st2038::parse(after.st2038_payloads[frame].data(), after.st2038_payloads[frame].size(), parsed));
+				CHECK(decode(parsed) == describe(frames[frame]));
+			}
+
+			// Only the PMT changes, and a second pass finds nothing left to do.
+			for (std::size_t pos = 0; pos < ts.size(); pos += 188 + prefix)
+			{
+				std::uint16_t pid = (ts[pos + prefix + 1] & 0x1f) << 8 | ts[pos + prefix + 2];
+
+				if (pid != pmt_pid)
+					CHECK(std::equal(ts.begin() + pos, ts.begin() + pos + 188 + prefix, out.begin() + pos));
+			}
+
+			CHECK(register_st2038(out, seed + 1) == out);
+		}
+	}
+
+	std::cout << "st2038 loopback: ok" << std::endl;
+}
+
+void test_untouched()
+{
+	// A PMT that no PAT points to.
+	std::vector<std::uint8_t> ts;
+	put_pmt(ts, 0);
+	CHECK(register_st2038(ts, 1) == ts);
+
+	// A PMT with a bad CRC.
+	ts.clear();
+	put_pat(ts, 0);
+	auto pmt = ts.size();
+	put_pmt(ts, 0);
+	ts[pmt + 20] ^= 0x01;
+	CHECK(register_st2038(ts, 2) == ts);
+
+	// Noise, with and without sync bytes, in whole packets of either size.
+	for (std::uint32_t seed = 1; seed <= 200; ++seed)
+	{
+		auto data = noise(188 * 48, seed);
+
+		if (seed % 2 == 0)
+		{
+			for (std::size_t pos = 0; pos < data.size(); pos += 188)
+				data[pos] = 0x47;
+		}
+
+		auto out = register_st2038(data, seed);
+		CHECK(out == data);
+	}
+
+	// A trailing partial packet is held back until it is complete.
+	ts.clear();
+	put_pat(ts, 0);
+	st2038::registration_writer writer;
+	std::vector<std::uint8_t> out;
+	writer.write(ts.data(), 100, out);
+	CHECK(out.empty());
+	writer.write(ts.data() + 100, 88, out);
+	CHECK(out == ts);
+
+	std::cout << "st2038 untouched streams: ok" << std::endl;
+}
+
+}
+
+void test_st2038()
+{
+	test_round_trip();
+	test_loopback();
+	test_untouched();
+}
+
+}}
@@ -0,0 +1,372 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Round trips ancillary packets through the v210 lines AncillaryContainer packs
+// and VancDecoder reads back, and feeds the decoder damaged and random lines.
+
+#include <core/ancillary/ancillary.h>
+#include <core/ancillary/cea708/cea708.h>
+#include <core/ancillary/scte/messages/splicenull.h>
+#include <core/ancillary/scte/scte.h>
+#include <core/ancillary/vanc_decoder.h>
+
+#include <test/common/test.h>
+
+#include <boost/rational.hpp>
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace caspar { namespace test {
+
+using namespace core::ancillary;
+
+namespace {
+
+struct packet_data
+{
+	std::uint8_t				did;
+	std::uint8_t				sdid;
+	std::vector<std::uint8_t>	data;
+
+	bool operator==(const packet_data& other) const
+	{
+		return did == other.did && sdid == other.sdid && data == other.data;
+	}
+};
+
+packet_data describe(const AncillaryData& data)
+{
+	packet_data result;
+	data.getVancID(result.did, result.sdid);
+	result.data = data.getData();
+	return result;
+}
+
+std::vector<packet_data> decode(const AncillaryLines& lines, VancDecoder& decoder)
+{
+	AncillaryContainer out;
+
+	for (std::size_t n = 0; n < lines.size(); ++n)
+		decoder.decodeV210(lines.line(n), lines.line_words, lines.width, out);
+
+	std::vector<packet_data> result;
+
+	for (auto& data : out.takeAll())
+		result.push_back(describe(*data));
+
+	return result;
+}
+
+// Random packets, none of them with the DID/SDID of a registered parser.
+std::vector<std::shared_ptr<AncillaryData>> random_packets(std::uint32_t seed)
+{
+	std::vector<std::shared_ptr<AncillaryData>> packets;
+	auto sizes = noise(64, seed);
+
+	for (std::size_t n = 0; n < static_cast<std::size_t>(sizes[0] % 20 + 1); ++n)
+	{
+		auto bytes = noise(sizes[n + 1] % 256 + 2, seed * 64 + static_cast<std::uint32_t>(n));
+		auto did = static_cast<std::uint8_t>(bytes[0] | 0x80);		// type 1 DIDs, 0x80 and up, stay clear of 0x41 and 0x61
+		packets.push_back(std::make_shared<RawAncillaryData>(did, bytes[1], std::vector<std::uint8_t>(bytes.begin() + 2, bytes.end())));
+	}
+
+	return packets;
+}
+
+AncillaryLines pack(const std::vector<std::shared_ptr<AncillaryData>>& packets, std::uint32_t width)
+{
+	AncillaryContainer container;
+
+	for (auto& data : packets)
+		container.addData(data);
+
+	AncillaryLines lines;
+	container.packAncillaryLines(width, lines);
+	return lines;
+}
+
+std::vector<packet_data> describe(const std::vector<std::shared_ptr<AncillaryData>>& packets)
+{
+	std::vector<packet_data> result;
+
+	for (auto& data : packets)
+		result.push_back(describe(*data));
+
+	return result;
+}
+
+const std::vector<std::uint32_t> widths { 720, 1280, 1920, 3840 };
+
+void test_round_trip()
+{
+	for (auto width : widths)
+	{
+		for (std::uint32_t seed = 1; seed <= 300; ++seed)
+		{
+			auto packets = random_packets(seed);
+			VancDecoder decoder;
+
+			CHECK(decode(pack(packets, width), decoder) == describe(packets));
+			CHECK(decoder.stats().packets == packets.size());
+			CHECK(decoder.stats().parity_errors == 0);
+			CHECK(decoder.stats().checksum_errors == 0);
+			CHECK(decoder.stats().truncated == 0);
+		}
+	}
+
+	std::cout << "vanc decoder round trip: ok" << std::endl;
+}
+
+void test_parsers()
+{
+	auto scte104 = std::make_shared<SCTE104AncData>();
+	scte104->addMsg(std::make_unique<scte104::SpliceNull>());
+
+	std::vector<cc_data> captions { { true, cc_type_608_field1, 0x94, 0x2c }, { true, cc_type_dtvcc_start, 0x02, 0x21 } };
+	auto cea708 = std::make_shared<CEA708>(captions, boost::rational<int>(30000, 1001), 0x4321);
+
+	for (auto width : widths)
+	{
+		AncillaryContainer out;
+		VancDecoder decoder;
+		auto lines = pack({ scte104, cea708 }, width);
+
+		for (std::size_t n = 0; n < lines.size(); ++n)
+			decoder.decodeV210(lines.line(n), lines.line_words, width, out);
+
+		// Known packets come back as their own types and serialize unchanged.
+		auto scte = out.takeData(ancillary_data_type_scte_104);
+		CHECK(scte.size() == 1);
+		CHECK(std::dynamic_pointer_cast<SCTE104AncData>(scte[0]));
+		CHECK(scte[0]->getData() == scte104->getData());
+
+		auto cc = out.takeData(ancillary_data_type_cea708);
+		CHECK(cc.size() == 1);
+		auto parsed = std::dynamic_pointer_cast<CEA708>(cc[0]);
+		CHECK(parsed);
+		CHECK(parsed->getData() == cea708->getData());
+		CHECK(parsed->captions().size() == captions.size());
+		CHECK(out.empty());
+	}
+
+	// A payload the parser rejects is kept as it came in.
+	AncillaryContainer out;
+	VancDecoder decoder;
+	auto broken = std::make_shared<RawAncillaryData>(0x61, 0x01, std::vector<std::uint8_t> { 0x96, 0x69, 0x05 });
+	auto lines = pack({ broken }, 1920);
+	decoder.decodeV210(lines.line(0), lines.line_words, 1920, out);
+	auto kept = out.takeAll();
+	CHECK(kept.size() == 1);
+	CHECK(std::dynamic_pointer_cast<RawAncillaryData>(kept[0]));
+	CHECK(describe(*kept[0]) == describe(*broken));
+
+	// Without a parser the same DID/SDID stays opaque.
+	decoder.registerParser(0x41, 0x07, nullptr);
+	lines = pack({ scte104 }, 1920);
+	decoder.decodeV210(lines.line(0), lines.line_words, 1920, out);
+	kept = out.takeAll();
+	CHECK(kept.size() == 1);
+	CHECK(std::dynamic_pointer_cast<RawAncillaryData>(kept[0]));
+
+	std::cout << "vanc decoder parsers: ok" << std::endl;
+}
+
+void test_chroma_stream()
+{
+	// HD carries packets in the C stream as well, which the packer never writes to.
+	// Moves the Y samples of one set of packets to C, next to the Y samples of another.
+	auto in_luma	= random_packets(5);
+	auto in_chroma	= random_packets(6);
+	auto luma		= pack(in_luma, 1920);
+	auto chroma		= pack(in_chroma, 1920);
+	CHECK(luma.size() == 1 && chroma.size() == 1);
+
+	auto samples = [](const AncillaryLines& lines)
+	{
+		std::vector<std::uint16_t> result;
+
+		for (auto word : lines.words)
+		{
+			result.push_back(word & 0x3ff);
+			result.push_back((word >> 10) & 0x3ff);
+			result.push_back((word >> 20) & 0x3ff);
+		}
+
+		return result;
+	};
+
+	auto y = samples(luma);
+	auto c = samples(chroma);
+
+	for (std::size_t n = 0; n + 1 < c.size(); n += 2)
+	{
+		c[n]		= c[n + 1];
+		c[n + 1]	= y[n + 1];
+	}
+
+	AncillaryLines lines = luma;
+
+	for (std::size_t w = 0; w < lines.words.size(); ++w)
+		lines.words[w] = c[w * 3] | (c[w * 3 + 1] << 10) | (c[w * 3 + 2] << 20);
+
+	auto expected = describe(in_luma);
+
+	for (auto& packet : describe(in_chroma))
+		expected.push_back(packet);
+
+	VancDecoder decoder;
+	CHECK(decode(lines, decoder) == expected);
+
+	std::cout << "vanc decoder chroma stream: ok" << std::endl;
+}
+
+void test_damaged()
+{
+	auto packets = random_packets(9);
+	auto lines = pack(packets, 1920);
+	CHECK(lines.size() == 1);
+
+	// The first packet starts at Y0: word 0 holds Y0 at bits 10-19, word 1 Y1 and Y2, word 2 Y3, word 3 Y4 and Y5.
+	auto with_sample = [&](std::size_t index, std::uint32_t value)
+	{
+		auto damaged = lines;
+		static const int word[]		= { 0, 1, 1, 2, 3, 3 };
+		static const int shift[]	= { 10, 0, 20, 10, 0, 20 };
+		auto& target = damaged.words[index / 6 * 4 + word[index % 6]];
+		target = (target & ~(0x3ffu << shift[index % 6])) | (value << shift[index % 6]);
+		return damaged;
+	};
+	auto sample = [&](std::size_t index)
+	{
+		static const int word[]		= { 0, 1, 1, 2, 3, 3 };
+		static const int shift[]	= { 10, 0, 20, 10, 0, 20 };
+		return (lines.words[index / 6 * 4 + word[index % 6]] >> shift[index % 6]) & 0x3ff;
+	};
+
+	auto rest = describe(packets);
+	rest.erase(rest.begin());
+
+	{
+		VancDecoder decoder;
+		CHECK(decode(with_sample(3, sample(3) ^ 0x100), decoder) == rest);	// DID parity
+		CHECK(decoder.stats().parity_errors == 1);
+	}
+	{
+		VancDecoder decoder;
+		CHECK(decode(with_sample(5, sample(5) ^ 0x001), decoder) == rest);	// data count
+		CHECK(decoder.stats().parity_errors == 1);
+	}
+	{
+		VancDecoder decoder;
+		auto checksum = 6 + packets[0]->getData().size();
+		CHECK(decode(with_sample(checksum, sample(checksum) ^ 0x001), decoder) == rest);
+		CHECK(decoder.stats().checksum_errors == 1);
+	}
+	{
+		// Cut off in the middle of a packet: 40 words hold 60 Y samples.
+		VancDecoder decoder;
+		AncillaryContainer out;
+		auto long_packet = pack({ std::make_shared<RawAncillaryData>(0x80, 0x01, std::vector<std::uint8_t>(100, 0x55)) }, 1920);
+		decoder.decodeV210(long_packet.line(0), 40, 1920, out);
+		CHECK(out.empty());
+		CHECK(decoder.stats().truncated == 1);
+	}
+
+	std::cout << "vanc decoder damaged packets: ok" << std::endl;
+}
+
+void test_fuzz()
+{
+	std::size_t runs = 0;
+
+	for (auto width : widths)
+	{
+		for (std::uint32_t seed = 1; seed <= 2000; ++seed)
+		{
+			auto packets = random_packets(seed);
+			auto lines = pack(packets, width);
+			auto random = noise(16, seed ^ 0x5a5a5a5a);
+			auto expected = describe(packets);
+
+			// One flipped bit loses at most the packet it hits, everything decoded is a packet that was sent.
+			auto flipped = lines;
+			auto bit = (random[0] | random[1] << 8 | random[2] << 16) % (flipped.words.size() * 30);
+			flipped.words[bit / 30] ^= 1u << (bit % 30);
+
+			VancDecoder decoder;
+			auto decoded = decode(flipped, decoder);
+			std::size_t next = 0;
+
+			for (auto& packet : decoded)
+			{
+				while (next < expected.size() && !(expected[next] == packet))
+					++next;
+
+				CHECK(next < expected.size());
+				++next;
+			}
+
+			CHECK(decoded.size() + 1 >= expected.size());
+
+			// Lines cut short anywhere, and lines of noise.
+			auto words = (random[3] | random[4] << 8) % (lines.line_words + 1);
+			AncillaryContainer out;
+			decoder.decodeV210(lines.line(0), words, width, out);
+
+			auto garbage = noise(lines.line_words * 4, seed);
+			decoder.decodeV210(reinterpret_cast<const std::uint32_t*>(garbage.data()), lines.line_words, width, out);
+
+			// Noise that starts every packet with a valid header.
+			std::vector<std::uint16_t> samples(garbage.begin(), garbage.end());
+
+			for (std::size_t n = 0; n + 6 < samples.size(); n += 40)
+			{
+				samples[n] = 0x000;
+				samples[n + 1] = 0x3ff;
+				samples[n + 2] = 0x3ff;
+				samples[n + 3] = 0x1c5;
+				samples[n + 4] = 0x101;
+				samples[n + 5] = samples[n + 5] & 0xff;
+				samples[n + 5] |= __builtin_parity(samples[n + 5]) ? 0x100 : 0x200;
+			}
+
+			decoder.decodeSamples(samples.data(), samples.size(), out);
+			out.clear();
+			++runs;
+		}
+	}
+
+	std::cout << "vanc decoder fuzz: " << runs << " lines with bit flips, truncation and noise: ok" << std::endl;
+}
+
+}
+
+void test_vanc_decoder()
+{
+	test_round_trip();
+	test_parsers();
+	test_chroma_stream();
+	test_damaged();
+	test_fuzz();
+}
+
+}}
@@ -0,0 +1,359 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Compares the v210 VANC lines of AncillaryContainer bit for bit with the
+// packer it replaced, kept here as the reference, at SD and HD widths, and
+// times both.
+
+#include <core/ancillary/ancillary.h>
+
+#include <test/common/test.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <vector>
+
+namespace caspar { namespace test {
+
+using namespace core::ancillary;
+
+namespace {
+
+typedef std::list<std::vector<std::uint32_t>> reference_lines;
+
+// The previous implementation, one vector per packet and per line.
+std::vector<std::uint16_t> reference_packet(const std::vector<std::uint8_t>& data, std::uint8_t did, std::uint8_t sdid)
+{
+	std::vector<std::uint16_t> packet { 0x000, 0x3ff, 0x3ff, did, sdid, static_cast<std::uint16_t>(data.size()) };
+	packet.insert(packet.end(), data.begin(), data.end());
+
+	std::uint16_t checksum = 0;
+
+	for (std::size_t i = 3; i < packet.size(); ++i)
+	{
+		packet[i] |= __builtin_parity(packet[i]) ? 0x100 : 0x200;
+		checksum = (checksum + packet[i]) & 0x1ff;
+	}
+
+	checksum |= (~checksum & 0x100) << 1;
+	packet.push_back(checksum);
+
+	return packet;
+}
+
+void reference_y10(const std::uint16_t* src, std::vector<std::uint32_t>& dst, std::size_t width)
+{
+	std::size_t w = 0;
+
+	for (; w < width / 6; ++w)
+	{
+		dst.push_back(src[w * 6 + 0] << 10);
+		dst.push_back(src[w * 6 + 1] | (src[w * 6 + 2] << 20));
+		dst.push_back(src[w * 6 + 3] << 10);
+		dst.push_back(src[w * 6 + 4] | (src[w * 6 + 5] << 20));
+	}
+
+	auto remaining = width % 6;
+
+	if (remaining)
+	{
+		dst.push_back(src[w * 6 + 0] << 10);
+
+		if (remaining == 2)
+			dst.push_back(src[w * 6 + 1]);
+		else if (remaining > 2)
+		{
+			dst.push_back(src[w * 6 + 1] | (src[w * 6 + 2] << 20));
+
+			if (remaining > 3)
+			{
+				dst.push_back(src[w * 6 + 3] << 10);
+
+				if (remaining > 4)
+					dst.push_back(src[w * 6 + 4] | (src[w * 6 + 5] << 20));
+			}
+		}
+	}
+}
+
+void reference_uyvy(const std::uint16_t* src, std::vector<std::uint32_t>& dst, std::size_t width)
+{
+	for (std::size_t i = 0; i < width; i += 3)
+	{
+		std::uint32_t pixel = src[i];
+		pixel |= (i + 1 < width ? src[i + 1] : 0x040) << 10;
+		pixel |= (i + 2 < width ? src[i + 2] : 0x200) << 20;
+		dst.push_back(pixel);
+	}
+}
+
+reference_lines reference_pack(const std::vector<std::shared_ptr<AncillaryData>>& packets, std::uint32_t width)
+{
+	reference_lines lines;
+	std::size_t samples_per_line = width > 720 ? (width / 4) * 6 : (width / 4) * 12;
+	std::size_t remaining = samples_per_line;
+	std::list<std::vector<std::uint16_t>> lines_data(1);
+
+	for (auto& data : packets)
+	{
+		std::uint8_t did, sdid;
+		data->getVancID(did, sdid);
+		auto packet = reference_packet(data->getData(), did, sdid);
+
+		if (packet.size() >= remaining)
+		{
+			lines_data.emplace_back();
+			remaining = samples_per_line;
+		}
+
+		lines_data.back().insert(lines_data.back().end(), packet.begin(), packet.end());
+		remaining -= packet.size();
+	}
+
+	for (auto& samples : lines_data)
+	{
+		// Lines without packets are no longer sent.
+		if (samples.empty())
+			continue;
+
+		auto count = std::min(samples.size(), samples_per_line);
+
+		// The Y-only tail read a sample past the packets, which is 0 now.
+		samples.resize(samples.size() + 6, 0);
+
+		std::vector<std::uint32_t> line;
+
+		if (width > 720)
+			reference_y10(samples.data(), line, count);
+		else
+			reference_uyvy(samples.data(), line, count);
+
+		line.resize((width + 31) & ~31, 0);
+		lines.push_back(std::move(line));
+	}
+
+	return lines;
+}
+
+std::shared_ptr<AncillaryData> packet(std::size_t size, std::uint32_t seed)
+{
+	auto bytes = noise(size + 2, seed);
+	return std::make_shared<RawAncillaryData>(bytes[0], bytes[1], std::vector<std::uint8_t>(bytes.begin() + 2, bytes.end()));
+}
+
+std::vector<std::shared_ptr<AncillaryData>> random_packets(std::uint32_t seed)
+{
+	std::vector<std::shared_ptr<AncillaryData>> packets;
+	auto sizes = noise(64, seed);
+
+	for (std::size_t n = 0; n < static_cast<std::size_t>(sizes[0] % 40 + 1); ++n)
+		packets.push_back(packet(sizes[n + 1] % 256, seed * 64 + static_cast<std::uint32_t>(n)));
+
+	return packets;
+}
+
+bool equal(const AncillaryLines& lines, const reference_lines& reference)
+{
+	if (lines.size() != reference.size())
+		return false;
+
+	std::size_t index = 0;
+
+	for (auto& line : reference)
+	{
+		if (line.size() != lines.line_words || !std::equal(line.begin(), line.end(), lines.line(index++)))
+			return false;
+	}
+
+	return true;
+}
+
+AncillaryContainer container(const std::vector<std::shared_ptr<AncillaryData>>& packets)
+{
+	AncillaryContainer result;
+
+	for (auto& data : packets)
+		result.addData(data);
+
+	return result;
+}
+
+const std::vector<std::uint32_t> widths { 720, 1280, 1440, 1920, 2048, 3840, 4096 };
+
+void test_random_packets()
+{
+	for (auto width : widths)
+	{
+		for (std::uint32_t seed = 1; seed <= 200; ++seed)
+		{
+			auto packets = random_packets(seed);
+			AncillaryLines lines;
+			container(packets).packAncillaryLines(width, lines);
+
+			CHECK(lines.width == width);
+			CHECK(equal(lines, reference_pack(packets, width)));
+		}
+	}
+
+	std::cout << "vanc packer random packets: ok" << std::endl;
+}
+
+void test_line_boundaries()
+{
+	for (auto width : widths)
+	{
+		std::size_t samples_per_line = width > 720 ? (width / 4) * 6 : (width / 4) * 12;
+
+		// The first packet leaves room for one more packet of size user data words,
+		// 7 words for the rest of the packet, minus one sample more or less.
+		for (int slack = -1; slack <= 1; ++slack)
+		{
+			for (std::size_t size : { 0, 1, 5, 6, 7, 255 })
+			{
+				auto first = static_cast<std::int64_t>(samples_per_line) - static_cast<std::int64_t>(size + 7) - 7 + slack;
+
+				if (first < 0)
+					continue;
+
+				// More than 255 bytes go into several packets.
+				std::vector<std::shared_ptr<AncillaryData>> packets;
+
+				while (first > 255)
+				{
+					auto part = std::min<std::int64_t>(255, first - 7);
+					packets.push_back(packet(static_cast<std::size_t>(part), static_cast<std::uint32_t>(first)));
+					first -= part + 7;
+				}
+
+				packets.push_back(packet(static_cast<std::size_t>(first), 11));
+
+				packets.push_back(packet(size, 12));
+				packets.push_back(packet(size, 13));
+
+				AncillaryLines lines;
+				container(packets).packAncillaryLines(width, lines);
+
+				CHECK(equal(lines, reference_pack(packets, width)));
+			}
+		}
+	}
+
+	std::cout << "vanc packer line boundaries: ok" << std::endl;
+}
+
+void test_data_count_parity()
+{
+	// A data count above 255 is out of spec, but keeps the parity the old packer gave it.
+	std::vector<std::shared_ptr<AncillaryData>> packets { packet(300, 1), packet(511, 2), packet(256, 3) };
+
+	for (auto width : { 1920u, 3840u })
+	{
+		AncillaryLines lines;
+		container(packets).packAncillaryLines(width, lines);
+
+		CHECK(equal(lines, reference_pack(packets, width)));
+	}
+
+	std::cout << "vanc packer data count parity: ok" << std::endl;
+}
+
+void test_shared_lines()
+{
+	auto packets = random_packets(7);
+	auto anc = container(packets);
+
+	auto lines = anc.getAncillaryAsLines(1920);
+	CHECK(equal(*lines, reference_pack(packets, 1920)));
+
+	// Every consumer of the frame gets the same packing, until the container changes.
+	CHECK(anc.getAncillaryAsLines(1920) == lines);
+	CHECK(anc.getAncillaryAsLines(720) != lines);
+	CHECK(equal(*anc.getAncillaryAsLines(720), reference_pack(packets, 720)));
+
+	auto copy = anc;
+	CHECK(copy.getAncillaryAsLines(720) == anc.getAncillaryAsLines(720));
+
+	anc.addData(packet(10, 99));
+	packets.push_back(packet(10, 99));
+	CHECK(equal(*anc.getAncillaryAsLines(720), reference_pack(packets, 720)));
+
+	// Excluded types leave the lines, and do not share the packing of all types.
+	AncillaryContainer mixed;
+	mixed.addData(std::make_shared<RawAncillaryData>(0x41, 0x07, std::vector<std::uint8_t>(20, 1)));
+	mixed.addData(std::make_shared<RawAncillaryData>(0x61, 0x01, std::vector<std::uint8_t>(30, 2)));
+	auto all = mixed.getAncillaryAsLines(1920);
+	auto captions = mixed.getAncillaryAsLines(1920, ancillary_data_type_scte_104);
+	CHECK(all != captions);
+	CHECK(equal(*captions, reference_pack({ std::make_shared<RawAncillaryData>(0x61, 0x01, std::vector<std::uint8_t>(30, 2)) }, 1920)));
+
+	AncillaryLines none;
+	AncillaryContainer().packAncillaryLines(1920, none);
+	CHECK(none.size() == 0);
+
+	std::cout << "vanc packer shared lines: ok" << std::endl;
+}
+
+void benchmark()
+{
+	// Captions and a SCTE-104 message every frame, and a few larger packets.
+	std::vector<std::shared_ptr<AncillaryData>> packets { packet(73, 1), packet(40, 2), packet(200, 3), packet(200, 4), packet(200, 5), packet(120, 6) };
+	auto anc = container(packets);
+	const int runs = 2000;
+
+	auto time = [&](const std::function<void()>& func)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		for (int n = 0; n < runs; ++n)
+			func();
+
+		return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / runs;
+	};
+
+	for (auto width : { 720u, 1920u })
+	{
+		AncillaryLines lines;
+		std::size_t sink = 0;
+
+		auto reference	= time([&] { sink += reference_pack(packets, width).size(); });
+		auto pack		= time([&] { anc.packAncillaryLines(width, lines); sink += lines.size(); });
+		auto shared		= time([&] { sink += anc.getAncillaryAsLines(width)->size(); });
+
+		std::cout << "vanc packer " << width << " wide, " << packets.size() << " packets: previous " << reference
+				<< " us, packAncillaryLines " << pack << " us, shared lines " << shared << " us" << (sink == 0 ? " (empty)" : "") << std::endl;
+	}
+}
+
+}
+
+void test_vanc_packer()
+{
+	test_random_packets();
+	test_line_boundaries();
+	test_data_count_parity();
+	test_shared_lines();
+	benchmark();
+}
+
+}}
@@ -0,0 +1,307 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Feeds the VANC validator of the ANC-MONITOR consumer known-bad packets, one
+// fault at a time, and checks that clean packed lines validate without errors.
+
+#include <core/ancillary/ancillary.h>
+#include <core/ancillary/cea708/cea708.h>
+#include <core/ancillary/scte/messages/splicenull.h>
+#include <core/ancillary/scte/scte.h>
+#include <core/ancillary/vanc_validator.h>
+
+#include <test/common/test.h>
+
+#include <boost/rational.hpp>
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace caspar { namespace test {
+
+using namespace core::ancillary;
+
+namespace {
+
+std::uint16_t with_parity(std::uint8_t value)
+{
+	return value | (__builtin_parity(value) ? 0x100 : 0x200);
+}
+
+// ADF, DID, SDID, data count, user data words and checksum of one SMPTE 291 packet.
+std::vector<std::uint16_t> packet_samples(std::uint8_t did, std::uint8_t sdid, const std::vector<std::uint8_t>& data)
+{
+	std::vector<std::uint16_t> samples { 0x000, 0x3ff, 0x3ff, with_parity(did), with_parity(sdid), with_parity(static_cast<std::uint8_t>(data.size())) };
+
+	for (auto byte : data)
+		samples.push_back(with_parity(byte));
+
+	std::uint16_t sum = 0;
+
+	for (std::size_t n = 3; n < samples.size(); ++n)
+		sum += samples[n];
+
+	sum &= 0x1ff;
+	samples.push_back(sum | ((~sum & 0x100) << 1));
+	return samples;
+}
+
+std::vector<VancPacketReport> validate(const std::vector<std::uint16_t>& samples)
+{
+	std::vector<VancPacketReport> reports;
+	validateVancSamples(samples.data(), samples.size(), 3, false, reports);
+	return reports;
+}
+
+// The single report of samples, with errors as expected.
+VancPacketReport expect(const std::vector<std::uint16_t>& samples, std::uint32_t errors)
+{
+	auto reports = validate(samples);
+	CHECK(reports.size() == 1);
+	CHECK(reports[0].errors == errors);
+	return reports[0];
+}
+
+std::vector<std::uint8_t> scte104_payload()
+{
+	SCTE104AncData scte104;
+	scte104.addMsg(std::make_unique<scte104::SpliceNull>());
+	return scte104.getData();
+}
+
+void test_clean()
+{
+	auto report = expect(packet_samples(0x80, 0x01, { 1, 2, 3 }), vanc_error_none);
+	CHECK(report.line == 3);
+	CHECK(report.offset == 0);
+	CHECK(!report.chroma);
+	CHECK(report.did == 0x80);
+	CHECK(report.sdid == 0x01);
+	CHECK(report.data_count == 3);
+
+	// Samples before the ADF move the offset.
+	auto samples = packet_samples(0x80, 0x01, { });
+	samples.insert(samples.begin(), { 0x040, 0x200, 0x040 });
+	CHECK(expect(samples, vanc_error_none).offset == 3);
+
+	report = expect(packet_samples(0x41, 0x07, scte104_payload()), vanc_error_none);
+	CHECK(report.detail == "message_number 0 ops [0x0102]");
+
+	std::vector<cc_data> captions { { true, cc_type_608_field1, 0x94, 0x2c } };
+	CHECK(expect(packet_samples(0x61, 0x01, CEA708(captions, boost::rational<int>(25, 1), 1).getData()), vanc_error_none).detail == "CDP");
+
+	CHECK(describe_vanc_errors(vanc_error_none) == "ok");
+	CHECK(describe_vanc_errors(vanc_error_parity | vanc_error_cea708) == "parity,cea-708");
+
+	std::cout << "vanc validator clean packets: ok" << std::endl;
+}
+
+void test_bad_words()
+{
+	auto good = packet_samples(0x80, 0x01, { 1, 2, 3 });
+
+	// Parity of DID, SDID and data count. The checksum covers b8 but not b9.
+	for (std::size_t word : { 3, 4, 5 })
+	{
+		auto bad = good;
+		bad[word] ^= 0x100;
+		expect(bad, vanc_error_parity | vanc_error_checksum);
+
+		bad = good;
+		bad[word] ^= 0x200;
+		expect(bad, vanc_error_parity);
+	}
+
+	// A user data word and the checksum itself.
+	auto bad = good;
+	bad[6] ^= 0x001;
+	expect(bad, vanc_error_checksum);
+
+	bad = good;
+	bad.back() ^= 0x001;
+	expect(bad, vanc_error_checksum);
+
+	// DID 0 is undefined.
+	expect(packet_samples(0x00, 0x01, { 1 }), vanc_error_did);
+
+	std::cout << "vanc validator bad words: ok" << std::endl;
+}
+
+void test_truncated()
+{
+	auto good = packet_samples(0x80, 0x01, std::vector<std::uint8_t>(20, 0x55));
+
+	// Cut anywhere after the ADF, up to the checksum.
+	for (std::size_t size = 3; size < good.size(); ++size)
+		expect(std::vector<std::uint16_t>(good.begin(), good.begin() + size), vanc_error_truncated);
+
+	// A packet after a truncated one can not be there.
+	auto samples = packet_samples(0x80, 0x02, { 1 });
+	samples.insert(samples.end(), good.begin(), good.end() - 1);
+	auto reports = validate(samples);
+	CHECK(reports.size() == 2);
+	CHECK(reports[0].errors == vanc_error_none);
+	CHECK(reports[1].errors == vanc_error_truncated);
+
+	std::cout << "vanc validator truncated packets: ok" << std::endl;
+}
+
+void test_bad_scte104()
+{
+	auto good = scte104_payload();
+	CHECK(good[0] == 0x08);
+
+	auto rejected = [](const std::vector<std::uint8_t>& payload, const std::string& reason)
+	{
+		auto report = expect(packet_samples(0x41, 0x07, payload), vanc_error_scte_104);
+		CHECK(report.detail.find(reason) != std::string::npos);
+	};
+
+	auto bad = good;
+	bad[4] += 1;	// messageSize past the payload
+	rejected(bad, "messageSize");
+
+	bad = good;
+	bad[4] = 11;
+	rejected(bad, "messageSize");
+
+	bad = good;
+	bad[4] += 1;	// a byte after the last operation
+	bad.push_back(0x00);
+	rejected(bad, "after the last operation");
+
+	bad = good;
+	bad[2] = 0xfe;
+	rejected(bad, "opID");
+
+	bad = good;
+	bad[5] = 1;
+	rejected(bad, "protocol_version");
+
+	bad = good;
+	bad[11] = 4;
+	rejected(bad, "time_type");
+
+	bad = good;
+	bad[12] = 2;	// num_ops
+	rejected(bad, "truncated");
+
+	bad = good;
+	bad[16] = 0xff;	// data_length of the operation
+	rejected(bad, "exceeds the message");
+
+	rejected(std::vector<std::uint8_t>(good.begin(), good.begin() + 12), "header truncated");
+	rejected({ }, "empty payload");
+
+	// Segmented messages are passed, and damaged words hide the payload check.
+	CHECK(expect(packet_samples(0x41, 0x07, { 0x00, 0xff }), vanc_error_none).detail.find("not checked") != std::string::npos);
+
+	auto damaged = packet_samples(0x41, 0x07, std::vector<std::uint8_t>(good.begin(), good.begin() + 12));
+	damaged[8] ^= 0x001;
+	expect(damaged, vanc_error_checksum);
+
+	std::cout << "vanc validator bad scte-104: ok" << std::endl;
+}
+
+void test_bad_cdp()
+{
+	std::vector<cc_data> captions { { true, cc_type_608_field1, 0x94, 0x2c } };
+	auto good = CEA708(captions, boost::rational<int>(25, 1), 1).getData();
+
+	auto bad = good;
+	bad[0] = 0x00;	// cdp_identifier
+	CHECK(expect(packet_samples(0x61, 0x01, bad), vanc_error_cea708).detail == "malformed CDP");
+
+	bad = good;
+	bad.back() ^= 0x01;	// packet_checksum
+	expect(packet_samples(0x61, 0x01, bad), vanc_error_cea708);
+
+	expect(packet_samples(0x61, 0x01, std::vector<std::uint8_t>(good.begin(), good.begin() + good.size() / 2)), vanc_error_cea708);
+	expect(packet_samples(0x61, 0x01, { 0x96, 0x69, 0x05 }), vanc_error_cea708);
+
+	std::cout << "vanc validator bad cdp: ok" << std::endl;
+}
+
+void test_lines()
+{
+	for (std::uint32_t width : { 720u, 1920u })
+	{
+		AncillaryContainer container;
+
+		for (std::uint8_t n = 0; n < 31; ++n)
+			container.addData(std::make_shared<RawAncillaryData>(0x80, n, noise(n * 8, n)));
+
+		auto scte104 = std::make_shared<SCTE104AncData>();
+		scte104->addMsg(std::make_unique<scte104::SpliceNull>());
+		container.addData(scte104);
+
+		AncillaryLines lines;
+		container.packAncillaryLines(width, lines);
+
+		std::vector<VancPacketReport> reports;
+		validateVancLines(lines, reports);
+		CHECK(reports.size() == 32);
+
+		for (auto& report : reports)
+		{
+			CHECK(report.errors == vanc_error_none);
+			CHECK(!report.chroma);
+			CHECK(report.line < lines.size());
+		}
+
+		CHECK(reports.back().did == 0x41 && reports.back().sdid == 0x07);
+		CHECK(reports.back().line == lines.size() - 1);
+	}
+
+	// The C stream of an HD line: C samples are the even ones.
+	auto samples = packet_samples(0x80, 0x01, { 1, 2, 3 });
+	std::vector<std::uint32_t> words(64, 0);
+	std::vector<std::uint16_t> interleaved(words.size() * 3, 0x040);
+
+	for (std::size_t n = 0; n < samples.size(); ++n)
+		interleaved[n * 2] = samples[n];
+
+	for (std::size_t w = 0; w < words.size(); ++w)
+		words[w] = interleaved[w * 3] | (interleaved[w * 3 + 1] << 10) | (interleaved[w * 3 + 2] << 20);
+
+	std::vector<VancPacketReport> reports;
+	validateVancLine(words.data(), words.size(), 1920, 7, reports);
+	CHECK(reports.size() == 1);
+	CHECK(reports[0].chroma);
+	CHECK(reports[0].line == 7);
+	CHECK(reports[0].errors == vanc_error_none);
+
+	std::cout << "vanc validator lines: ok" << std::endl;
+}
+
+}
+
+void test_vanc_validator()
+{
+	test_clean();
+	test_bad_words();
+	test_truncated();
+	test_bad_scte104();
+	test_bad_cdp();
+	test_lines();
+}
+
+}}
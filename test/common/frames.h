@@ -0,0 +1,139 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Frames for the tests of core, built without an accelerator, and a visitor
+// that collects what the image mixer would draw.
+
+#pragma once
+
+#include <core/frame/audio_channel_layout.h>
+#include <core/frame/draw_frame.h>
+#include <core/frame/frame.h>
+#include <core/frame/frame_factory.h>
+#include <core/frame/frame_transform.h>
+#include <core/frame/frame_visitor.h>
+#include <core/frame/pixel_format.h>
+
+#include <common/array.h>
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+namespace caspar { namespace test {
+
+// A frame of one plane that shares the pixels given.
+inline core::const_frame make_frame(
+		std::shared_ptr<std::vector<std::uint8_t>> pixels,
+		core::pixel_format format,
+		int width,
+		int height,
+		int channels,
+		bool opaque = false,
+		core::mutable_audio_buffer audio = core::mutable_audio_buffer())
+{
+	core::pixel_format_desc desc(format);
+	desc.planes.push_back(core::pixel_format_desc::plane(width, height, channels));
+
+	std::vector<array<std::uint8_t>> buffers;
+	buffers.push_back(array<std::uint8_t>(pixels->data(), pixels->size(), false, pixels));
+
+	core::mutable_frame frame(std::move(buffers), std::move(audio), nullptr, desc, core::audio_channel_layout::invalid());
+	frame.set_opaque(opaque);
+
+	return core::const_frame(std::move(frame));
+}
+
+// A BGRA frame with a copy of the pixels given.
+inline core::const_frame make_bgra_frame(const std::vector<std::uint8_t>& pixels, int width, int height, core::mutable_audio_buffer audio = core::mutable_audio_buffer())
+{
+	return make_frame(std::make_shared<std::vector<std::uint8_t>>(pixels), core::pixel_format::bgra, width, height, 4, false, std::move(audio));
+}
+
+// Creates frames in system memory, for producers under test.
+class frame_factory : public core::frame_factory
+{
+public:
+	core::mutable_frame create_frame(const void* tag, const core::pixel_format_desc& desc, const core::audio_channel_layout& channel_layout) override
+	{
+		std::vector<array<std::uint8_t>> buffers;
+
+		for (auto& plane : desc.planes)
+		{
+			auto pixels = std::make_shared<std::vector<std::uint8_t>>(plane.size);
+			buffers.push_back(array<std::uint8_t>(pixels->data(), pixels->size(), false, pixels));
+		}
+
+		return core::mutable_frame(std::move(buffers), core::mutable_audio_buffer(), tag, desc, channel_layout);
+	}
+
+	int get_max_frame_size() override
+	{
+		return std::numeric_limits<int>::max();
+	}
+};
+
+// The frames the image mixer would draw, with the transforms composed the way
+// it composes them. Like the image mixer it skips frames without an image.
+struct collected_frames
+{
+	std::vector<core::const_frame>		frames;
+	std::vector<core::image_transform>	transforms;
+};
+
+class frame_collector : public core::frame_visitor
+{
+	collected_frames&					result_;
+	std::vector<core::image_transform>	transform_stack_	{ core::image_transform() };
+public:
+	explicit frame_collector(collected_frames& result)
+		: result_(result)
+	{
+	}
+
+	void push(const core::frame_transform& transform) override
+	{
+		transform_stack_.push_back(transform_stack_.back() * transform.image_transform);
+	}
+
+	void visit(const core::const_frame& frame) override
+	{
+		if (frame.pixel_format_desc().planes.empty())
+			return;
+
+		result_.frames.push_back(frame);
+		result_.transforms.push_back(transform_stack_.back());
+	}
+
+	void pop() override
+	{
+		transform_stack_.pop_back();
+	}
+};
+
+inline collected_frames collect(const core::draw_frame& frame)
+{
+	collected_frames result;
+	frame_collector collector(result);
+	frame.accept(collector);
+	return result;
+}
+
+}}
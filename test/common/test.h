@@ -0,0 +1,67 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Shared by the test executables under test/. A test throws on the first
+// failed CHECK, and run_tests turns that into the exit code ctest expects.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#define CHECK(expr) do { if (!(expr)) throw std::runtime_error(std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " #expr); } while (0)
+
+namespace caspar { namespace test {
+
+// The same pseudo random bytes for the same seed on every platform.
+inline std::vector<std::uint8_t> noise(std::size_t size, std::uint32_t seed)
+{
+	std::vector<std::uint8_t> result(size);
+
+	for (auto& value : result)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		value = static_cast<std::uint8_t>(seed >> 24);
+	}
+
+	return result;
+}
+
+inline int run_tests(const std::string& name, const std::function<void()>& tests)
+{
+	try
+	{
+		tests();
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << name << " failed: " << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+}}
@@ -0,0 +1,100 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Tests of the ancillary data the ffmpeg module reads from and writes to
+// files. Every area has a source file of its own, with one entry point called
+// from here.
+
+#include <modules/ffmpeg/ffmpeg.h>
+
+#include <test/common/test.h>
+
+#include <common/env.h>
+
+#include <core/consumer/frame_consumer.h>
+#include <core/help/help_repository.h>
+#include <core/module_dependencies.h>
+#include <core/producer/cg_proxy.h>
+#include <core/producer/frame_producer.h>
+#include <core/producer/media_info/in_memory_media_info_repository.h>
+#include <core/system_info_provider.h>
+
+#include <boost/filesystem.hpp>
+
+#include <fstream>
+
+namespace caspar { namespace test {
+
+void test_scte35_ingest(const boost::filesystem::path& folder);
+void test_st2038_record();
+
+namespace {
+
+// The consumer records to and the producer plays from the media folder.
+void configure(const boost::filesystem::path& folder)
+{
+	{
+		std::ofstream file("ffmpeg-test.config");
+		file << "<configuration><paths>";
+
+		for (auto path : { "media-path", "log-path", "data-path", "template-path", "thumbnail-path", "font-path" })
+			file << "<" << path << ">" << (folder / path).string() << "</" << path << ">";
+
+		file << "</paths></configuration>";
+	}
+
+	env::configure(L"ffmpeg-test.config");
+	boost::filesystem::remove("ffmpeg-test.config");
+}
+
+void init_module()
+{
+	auto help_repo = spl::make_shared<core::help_repository>();
+
+	ffmpeg::init(core::module_dependencies(
+			spl::make_shared<core::system_info_provider_repository>(),
+			spl::make_shared<core::cg_producer_registry>(),
+			core::create_in_memory_media_info_repository(),
+			spl::make_shared<core::frame_producer_registry>(help_repo),
+			spl::make_shared<core::frame_consumer_registry>(help_repo),
+			nullptr));
+}
+
+}
+
+}}
+
+int main()
+{
+	auto folder = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("ffmpeg-test-%%%%%%%%");
+	boost::filesystem::create_directories(folder);
+
+	auto result = caspar::test::run_tests("ffmpeg-test", [&]
+	{
+		caspar::test::configure(folder);
+		caspar::test::init_module();
+		caspar::test::test_scte35_ingest(folder);
+		caspar::test::test_st2038_record();
+	});
+
+	caspar::ffmpeg::uninit();
+	boost::filesystem::remove_all(folder);
+
+	return result;
+}
@@ -0,0 +1,513 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Writes a short MPEG-TS with MPEG-2 video and an SCTE-35 PID, reads it back
+// with FFmpeg through the scte35_decoder the ffmpeg producer uses, and checks
+// which frame every cue lands on and the pre-roll it gets there.
+
+#include <test/ancillary-test/scte104.h>
+
+#include <modules/ffmpeg/producer/scte35/scte35_decoder.h>
+#include <modules/ffmpeg/producer/util/util.h>
+
+#include <core/ancillary/bitstream.h>
+#include <core/ancillary/scte/scte35.h>
+
+#include <test/common/test.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/optional.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#pragma warning (push)
+#pragma warning (disable : 4244)
+#endif
+extern "C"
+{
+	#define __STDC_CONSTANT_MACROS
+	#define __STDC_LIMIT_MACROS
+	#include <libavcodec/avcodec.h>
+	#include <libavformat/avformat.h>
+	#include <libavutil/frame.h>
+}
+#if defined(_MSC_VER)
+#pragma warning (pop)
+#endif
+
+namespace caspar { namespace test {
+
+using namespace core::ancillary;
+
+namespace {
+
+typedef std::vector<std::uint8_t> bytes;
+
+const int			FRAMES			= 12;
+const std::uint64_t	FIRST_PTS		= 90000;
+const std::uint64_t	FRAME_TICKS		= 3600;		// 25 fps at 90 kHz
+const int			PMT_PID			= 0x1000;
+const int			VIDEO_PID		= 0x100;
+const int			SCTE35_PID		= 0x101;
+
+std::uint64_t frame_pts(int frame)
+{
+	return FIRST_PTS + frame * FRAME_TICKS;
+}
+
+// Packetizes into 188 byte transport stream packets.
+class transport_stream
+{
+public:
+	bytes data;
+
+	// A PSI section, alone in a packet.
+	void write_section(int pid, const bytes& section)
+	{
+		bytes payload { 0x00 };										// pointer_field
+		payload.insert(payload.end(), section.begin(), section.end());
+		payload.resize(184, 0xff);
+
+		write_packet(pid, true, payload.data(), payload.size());
+	}
+
+	// A video PES with a PTS, with the PCR in its first packet. after_first
+	// is called after that packet, to interleave other PIDs with the PES.
+	void write_pes(int pid, std::uint64_t pts, std::uint64_t pcr, const bytes& es, const std::function<void ()>& after_first)
+	{
+		bytes pes { 0x00, 0x00, 0x01, 0xe0, 0x00, 0x00, 0x80, 0x80, 0x05 };
+
+		{
+			Bitstream bs(pes);
+			bs.write_bits(2, 4);
+			bs.write_bits(pts >> 30, 3);
+			bs.write_bits(1, 1);
+			bs.write_bits(pts >> 15, 15);
+			bs.write_bits(1, 1);
+			bs.write_bits(pts, 15);
+			bs.write_bits(1, 1);
+		}
+
+		pes.insert(pes.end(), es.begin(), es.end());
+
+		std::size_t offset = write_packet(pid, true, pes.data(), pes.size(), pcr);
+
+		after_first();
+
+		while (offset < pes.size())
+			offset += write_packet(pid, false, pes.data() + offset, pes.size() - offset);
+	}
+private:
+	// Returns how much of the payload went into the packet, the rest of it is
+	// stuffed through the adaptation field.
+	std::size_t write_packet(int pid, bool unit_start, const std::uint8_t* payload, std::size_t size, const boost::optional<std::uint64_t>& pcr = boost::none)
+	{
+		bytes adaptation;
+
+		if (pcr)
+		{
+			Bitstream bs(adaptation);
+			bs.write_byte(0x10);									// PCR_flag
+			bs.write_bits(*pcr / 300, 33);
+			bs.write_bits(0x3f, 6);
+			bs.write_bits(*pcr % 300, 9);
+		}
+
+		bool has_adaptation = pcr || size < 184;
+		std::size_t taken = std::min<std::size_t>(size, has_adaptation ? 184 - 1 - adaptation.size() : 184);
+		std::size_t stuffing = has_adaptation ? 184 - 1 - adaptation.size() - taken : 0;
+
+		if (stuffing > 0 && adaptation.empty())
+		{
+			adaptation.push_back(0x00);								// no flags
+			--stuffing;
+		}
+
+		adaptation.insert(adaptation.end(), stuffing, 0xff);
+
+		auto& continuity = continuity_[pid];
+
+		data.push_back(0x47);
+		data.push_back(static_cast<std::uint8_t>((unit_start ? 0x40 : 0x00) | (pid >> 8)));
+		data.push_back(static_cast<std::uint8_t>(pid));
+		data.push_back(static_cast<std::uint8_t>((has_adaptation ? 0x30 : 0x10) | continuity));
+
+		continuity = (continuity + 1) & 0x0f;
+
+		if (has_adaptation)
+		{
+			data.push_back(static_cast<std::uint8_t>(adaptation.size()));
+			data.insert(data.end(), adaptation.begin(), adaptation.end());
+		}
+
+		data.insert(data.end(), payload, payload + taken);
+
+		return taken;
+	}
+
+	std::map<int, int> continuity_;
+};
+
+bytes psi_section(std::uint8_t table_id, std::uint16_t id_extension, const bytes& body)
+{
+	bytes result;
+
+	{
+		Bitstream bs(result);
+		bs.write_byte(table_id);
+		bs.write_bits(1, 1);										// section_syntax_indicator
+		bs.write_bits(0, 1);
+		bs.write_bits(3, 2);
+		bs.write_bits(5 + body.size() + 4, 12);
+		bs.write_bytes_msb(id_extension, 2);
+		bs.write_bits(3, 2);
+		bs.write_bits(0, 5);										// version_number
+		bs.write_bits(1, 1);										// current_next_indicator
+		bs.write_byte(0);											// section_number
+		bs.write_byte(0);											// last_section_number
+
+		for (auto byte : body)
+			bs.write_byte(byte);
+	}
+
+	auto crc = scte35::crc32(result.data(), result.size());
+
+	Bitstream(result).write_bytes_msb(crc, 4);
+
+	return result;
+}
+
+bytes pat()
+{
+	bytes body;
+
+	{
+		Bitstream bs(body);
+		bs.write_bytes_msb(1, 2);									// program_number
+		bs.write_bits(7, 3);
+		bs.write_bits(PMT_PID, 13);
+	}
+
+	return psi_section(0x00, 1, body);
+}
+
+// The CUEI registration descriptor on the program is what makes FFmpeg read
+// stream type 0x86 as SCTE-35 sections rather than as PES.
+bytes pmt()
+{
+	bytes body;
+
+	{
+		Bitstream bs(body);
+		bs.write_bits(7, 3);
+		bs.write_bits(VIDEO_PID, 13);								// PCR_PID
+		bs.write_bits(0xf, 4);
+		bs.write_bits(6, 12);										// program_info_length
+		bs.write_byte(0x05);										// registration_descriptor
+		bs.write_byte(4);
+		bs.write_bytes_msb(0x43554549, 4);							// "CUEI"
+
+		for (auto stream : { std::make_pair(0x02, VIDEO_PID), std::make_pair(0x86, SCTE35_PID) })
+		{
+			bs.write_byte(static_cast<std::uint8_t>(stream.first));
+			bs.write_bits(7, 3);
+			bs.write_bits(stream.second, 13);
+			bs.write_bits(0xf, 4);
+			bs.write_bits(0, 12);									// ES_info_length
+		}
+	}
+
+	return psi_section(0x02, 1, body);
+}
+
+bytes splice_section(std::uint64_t pts_adjustment, std::uint8_t command_type, const bytes& command)
+{
+	bytes result;
+
+	{
+		Bitstream bs(result);
+		bs.write_byte(0xfc);										// table_id
+		bs.write_bits(0, 2);										// section_syntax_indicator, private_indicator
+		bs.write_bits(3, 2);										// sap_type
+		bs.write_bits(11 + command.size() + 2 + 4, 12);
+		bs.write_byte(0);											// protocol_version
+		bs.write_bits(0, 7);										// encrypted_packet, encryption_algorithm
+		bs.write_bits(pts_adjustment, 33);
+		bs.write_byte(0);											// cw_index
+		bs.write_bits(0xfff, 12);									// tier
+		bs.write_bits(command.size(), 12);
+		bs.write_byte(command_type);
+
+		for (auto byte : command)
+			bs.write_byte(byte);
+
+		bs.write_bytes_msb(0, 2);									// descriptor_loop_length
+	}
+
+	auto crc = scte35::crc32(result.data(), result.size());
+
+	Bitstream(result).write_bytes_msb(crc, 4);
+
+	return result;
+}
+
+bytes splice_insert(std::uint32_t event_id, bool out_of_network, boost::optional<std::uint64_t> pts)
+{
+	bytes result;
+	Bitstream bs(result);
+
+	bs.write_bytes_msb(event_id, 4);
+	bs.write_bits(0, 1);											// splice_event_cancel_indicator
+	bs.write_bits(0x7f, 7);
+	bs.write_bits(out_of_network, 1);
+	bs.write_bits(1, 1);											// program_splice_flag
+	bs.write_bits(0, 1);											// duration_flag
+	bs.write_bits(!pts, 1);											// splice_immediate_flag
+	bs.write_bits(0xf, 4);
+
+	if (pts)
+	{
+		bs.write_bits(1, 1);										// time_specified_flag
+		bs.write_bits(0x3f, 6);
+		bs.write_bits(*pts, 33);
+	}
+
+	bs.write_bytes_msb(0x1234, 2);									// unique_program_id
+	bs.write_byte(0);												// avail_num
+	bs.write_byte(0);												// avails_expected
+
+	return result;
+}
+
+bytes time_signal(std::uint64_t pts)
+{
+	bytes result;
+	Bitstream bs(result);
+
+	bs.write_bits(1, 1);											// time_specified_flag
+	bs.write_bits(0x3f, 6);
+	bs.write_bits(pts, 33);
+
+	return result;
+}
+
+// Intra only MPEG-2, so that every packet decodes to the frame it carries.
+std::vector<bytes> encode_video()
+{
+	auto codec = avcodec_find_encoder(AV_CODEC_ID_MPEG2VIDEO);
+	CHECK(codec);
+
+	std::shared_ptr<AVCodecContext> context(avcodec_alloc_context3(codec), [](AVCodecContext* p)
+	{
+		avcodec_free_context(&p);
+	});
+
+	context->width			= 64;
+	context->height			= 64;
+	context->pix_fmt		= AV_PIX_FMT_YUV420P;
+	context->time_base		= { 1, 25 };
+	context->gop_size		= 1;
+	context->max_b_frames	= 0;
+
+	CHECK(avcodec_open2(context.get(), codec, nullptr) >= 0);
+
+	auto frame = ffmpeg::create_frame();
+	frame->format	= context->pix_fmt;
+	frame->width	= context->width;
+	frame->height	= context->height;
+	CHECK(av_frame_get_buffer(frame.get(), 32) >= 0);
+
+	std::vector<bytes> result;
+
+	auto receive = [&](AVFrame* input)
+	{
+		auto packet = ffmpeg::create_packet();
+		int got_packet = 0;
+
+		CHECK(avcodec_encode_video2(context.get(), packet.get(), input, &got_packet) >= 0);
+
+		if (got_packet)
+			result.push_back(bytes(packet->data, packet->data + packet->size));
+
+		return got_packet != 0;
+	};
+
+	for (int n = 0; n < FRAMES; ++n)
+	{
+		CHECK(av_frame_make_writable(frame.get()) >= 0);
+
+		for (int plane = 0; plane < 3; ++plane)
+		{
+			for (int y = 0; y < (plane == 0 ? 64 : 32); ++y)
+				std::fill_n(frame->data[plane] + y * frame->linesize[plane], plane == 0 ? 64 : 32, static_cast<std::uint8_t>(plane == 0 ? 16 + n * 16 : 128));
+		}
+
+		frame->pts = n;
+		receive(frame.get());
+	}
+
+	while (receive(nullptr))
+	{
+	}
+
+	CHECK(result.size() == FRAMES);
+
+	return result;
+}
+
+// Cues are written right after the packet with the PCR of the frame they
+// belong to, so they arrive at that frame's PTS. FFmpeg has not returned the
+// frame by then, whatever the parser and decoder delay.
+void write_file(const boost::filesystem::path& path, const std::map<int, bytes>& cues)
+{
+	auto video = encode_video();
+	transport_stream ts;
+
+	for (int n = 0; n < FRAMES; ++n)
+	{
+		ts.write_section(0x0000, pat());
+		ts.write_section(PMT_PID, pmt());
+		ts.write_pes(VIDEO_PID, frame_pts(n), frame_pts(n) * 300, video.at(n), [&]
+		{
+			auto cue = cues.find(n);
+
+			if (cue != cues.end())
+				ts.write_section(SCTE35_PID, cue->second);
+		});
+	}
+
+	boost::filesystem::ofstream file(path, std::ios::binary);
+	file.write(reinterpret_cast<const char*>(ts.data.data()), ts.data.size());
+}
+
+// The SCTE-104 operations attached to each frame, by frame index.
+std::map<int, std::vector<scte104_operation>> read_file(const boost::filesystem::path& path)
+{
+	auto context = ffmpeg::open_input(path.wstring());
+
+	CHECK(ffmpeg::scte35_decoder::has_streams(*context));
+
+	int video_index = -1;
+	auto codec = ffmpeg::open_codec(*context, AVMEDIA_TYPE_VIDEO, video_index, true);
+	ffmpeg::scte35_decoder decoder(context, video_index);
+
+	std::map<int, std::vector<scte104_operation>> result;
+	int frames = 0;
+
+	auto decode = [&](AVPacket& packet)
+	{
+		auto frame = ffmpeg::create_frame();
+		int got_frame = 0;
+
+		CHECK(avcodec_decode_video2(codec.get(), frame.get(), &got_frame, &packet) >= 0);
+
+		if (!got_frame)
+			return false;
+
+		auto pts	= static_cast<std::uint64_t>(frame->best_effort_timestamp);
+		auto index	= static_cast<int>((pts - FIRST_PTS) / FRAME_TICKS);
+
+		CHECK(pts == frame_pts(index));
+		CHECK(index == frames++);
+
+		for (auto& message : decoder.poll(*frame))
+		{
+			for (auto& op : scte104_operations(message->getData()))
+				result[index].push_back(op);
+		}
+
+		return true;
+	};
+
+	while (true)
+	{
+		std::shared_ptr<AVPacket> packet = ffmpeg::create_packet();
+
+		if (av_read_frame(context.get(), packet.get()) < 0)
+			break;
+
+		decoder.push(packet);
+
+		if (packet->stream_index == video_index)
+			decode(*packet);
+	}
+
+	auto flush = ffmpeg::create_packet();
+	flush->data	= nullptr;
+	flush->size	= 0;
+
+	while (decode(*flush))
+	{
+	}
+
+	CHECK(frames == FRAMES);
+
+	return result;
+}
+
+}
+
+void test_scte35_ingest(const boost::filesystem::path& folder)
+{
+	auto path = folder / L"scte35.ts";
+
+	// A break 4 s after frame 3, a time signal 2 s after frame 7 that needs
+	// the pts_adjustment to get there, and an immediate return at frame 9.
+	write_file(path, {
+		{ 3, splice_section(0, scte35::splice_command_insert, splice_insert(0x1001, true, frame_pts(3) + 4 * 90000)) },
+		{ 7, splice_section(9000, scte35::splice_command_time_signal, time_signal(frame_pts(7) + 2 * 90000 - 9000)) },
+		{ 9, splice_section(0, scte35::splice_command_insert, splice_insert(0x1002, false, boost::none)) }
+	});
+
+	auto landed = read_file(path);
+
+	CHECK(landed.size() == 3);
+
+	auto& start = landed.at(3);
+	CHECK(start.size() == 1);
+	CHECK(start[0].opid == 0x0101);
+	CHECK(start[0].data[0] == 0x01);								// start_normal
+	CHECK(read_msb(start[0].data, 1, 4) == 0x1001);
+	CHECK(read_msb(start[0].data, 7, 2) == 4000);					// pre_roll_time
+
+	auto& signal = landed.at(7);
+	CHECK(signal.size() == 1);
+	CHECK(signal[0].opid == 0x0104);
+	CHECK(read_msb(signal[0].data, 0, 2) == 2000);
+
+	auto& end = landed.at(9);
+	CHECK(end.size() == 1);
+	CHECK(end[0].opid == 0x0101);
+	CHECK(end[0].data[0] == 0x04);									// end_immediate
+	CHECK(read_msb(end[0].data, 1, 4) == 0x1002);
+	CHECK(read_msb(end[0].data, 7, 2) == 0);
+
+	std::cout << "scte35 ingest: cues on frames 3, 7 and 9 with 4000, 2000 and 0 ms pre-roll" << std::endl;
+}
+
+}}
@@ -0,0 +1,227 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Records frames with ancillary data to MPEG-TS through the ffmpeg consumer,
+// which writes it as an ST 2038 stream marked with the 'VANC' registration
+// descriptor, then plays the file back through the ffmpeg producer and checks
+// that every packet comes back on the frame it was recorded with. Recording
+// to MXF with -st2038 1 is left untested.
+
+#include <modules/ffmpeg/consumer/ffmpeg_consumer.h>
+#include <modules/ffmpeg/producer/ffmpeg_producer.h>
+
+#include <test/common/frames.h>
+#include <test/common/test.h>
+
+#include <core/ancillary/ancillary.h>
+#include <core/consumer/frame_consumer.h>
+#include <core/frame/audio_channel_layout.h>
+#include <core/frame/draw_frame.h>
+#include <core/frame/frame.h>
+#include <core/help/help_repository.h>
+#include <core/producer/cg_proxy.h>
+#include <core/producer/frame_producer.h>
+#include <core/producer/media_info/in_memory_media_info_repository.h>
+#include <core/video_format.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace caspar { namespace test {
+
+using namespace core::ancillary;
+
+namespace {
+
+const int FRAMES = 12;
+
+const core::video_format_desc& format_desc()
+{
+	static const core::video_format_desc desc(core::video_format::x576p2500);
+	return desc;
+}
+
+// Frames are told apart by their grey level, which survives the encoding.
+int grey(int frame)
+{
+	return 20 + frame * 15;
+}
+
+int frame_of_luma(int luma)
+{
+	int result		= -1;
+	int distance	= 256;
+
+	for (int frame = 0; frame < FRAMES; ++frame)
+	{
+		int expected = 16 + grey(frame) * 219 / 255;
+
+		if (std::abs(luma - expected) < distance)
+		{
+			result		= frame;
+			distance	= std::abs(luma - expected);
+		}
+	}
+
+	CHECK(distance < 5);
+
+	return result;
+}
+
+// Type 1 DIDs, clear of the parsers of the VANC decoder so that they come
+// back as the raw packets they were recorded as.
+std::map<int, std::vector<std::shared_ptr<AncillaryData>>> recorded_packets()
+{
+	std::map<int, std::vector<std::shared_ptr<AncillaryData>>> result;
+
+	result[1].push_back(std::make_shared<RawAncillaryData>(0xc0, 0x01, std::vector<std::uint8_t> { 1, 2, 3 }));
+	result[4].push_back(std::make_shared<RawAncillaryData>(0xc0, 0x04, noise(200, 4)));
+	result[4].push_back(std::make_shared<RawAncillaryData>(0xc1, 0x04, std::vector<std::uint8_t> { 4 }));
+	result[5].push_back(std::make_shared<RawAncillaryData>(0xc0, 0x05, noise(16, 5)));
+	result[11].push_back(std::make_shared<RawAncillaryData>(0xc2, 0x0b, noise(255, 11)));
+
+	return result;
+}
+
+void record(const std::wstring& file)
+{
+	auto stereo		= core::audio_channel_layout(2, L"stereo", L"FL FR");
+	auto consumer	= ffmpeg::create_ffmpeg_consumer({ L"FILE", file, L"-tokens", L"64" }, nullptr, { });
+	auto packets	= recorded_packets();
+
+	consumer->initialize(format_desc(), stereo, 1);
+
+	for (int n = 0; n < FRAMES; ++n)
+	{
+		core::mutable_audio_buffer audio(format_desc().audio_cadence.front() * 2, 0);
+		auto frame = make_bgra_frame(std::vector<std::uint8_t>(format_desc().size, static_cast<std::uint8_t>(grey(n))), format_desc().width, format_desc().height, std::move(audio));
+
+		AncillaryContainer ancillary;
+
+		for (auto& data : packets[n])
+			ancillary.addData(data);
+
+		consumer->send(frame.with_audio(frame.audio_data(), std::move(ancillary))).get();
+	}
+
+	// The consumer flushes the encoders and writes the trailer when it is
+	// destroyed on return, before the file is played back.
+}
+
+struct packet_data
+{
+	std::uint8_t				did;
+	std::uint8_t				sdid;
+	std::vector<std::uint8_t>	data;
+
+	bool operator==(const packet_data& other) const
+	{
+		return did == other.did && sdid == other.sdid && data == other.data;
+	}
+};
+
+std::vector<packet_data> describe(const std::vector<std::shared_ptr<AncillaryData>>& packets)
+{
+	std::vector<packet_data> result;
+
+	for (auto& data : packets)
+	{
+		packet_data packet;
+		data->getVancID(packet.did, packet.sdid);
+		packet.data = data->getData();
+		result.push_back(std::move(packet));
+	}
+
+	return result;
+}
+
+// The ancillary data of every frame the producer plays, by frame index.
+std::map<int, std::vector<std::shared_ptr<AncillaryData>>> play(const std::wstring& file)
+{
+	core::frame_producer_dependencies dependencies(
+			spl::make_shared<test::frame_factory>(),
+			{ },
+			format_desc(),
+			spl::make_shared<core::frame_producer_registry>(spl::make_shared<core::help_repository>()),
+			spl::make_shared<core::cg_producer_registry>());
+	auto producer = ffmpeg::create_producer(dependencies, { file }, core::create_in_memory_media_info_repository());
+
+	CHECK(producer != core::frame_producer::empty());
+
+	std::map<int, std::vector<std::shared_ptr<AncillaryData>>> result;
+	int last = -1;
+
+	// Frames repeated on underflow and at the end come without ancillary data.
+	for (int n = 0; n < 500 && last < FRAMES - 1; ++n)
+	{
+		auto frame	= producer->receive();
+		auto images	= collect(frame);
+
+		if (images.frames.empty())
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			continue;
+		}
+
+		auto& image	= images.frames.front();
+		auto& plane	= image.pixel_format_desc().planes.at(0);
+		auto luma	= image.image_data(0).begin()[(plane.height / 2) * plane.linesize + plane.linesize / 2];
+		auto index	= frame_of_luma(luma);
+
+		CHECK(index >= last);
+
+		if (index > last)
+		{
+			CHECK(index == last + 1);
+			last = index;
+		}
+
+		for (auto& data : frame.ancillary().takeAll())
+			result[index].push_back(data);
+	}
+
+	CHECK(last == FRAMES - 1);
+
+	return result;
+}
+
+}
+
+void test_st2038_record()
+{
+	record(L"st2038.ts");
+
+	auto recorded	= recorded_packets();
+	auto played		= play(L"st2038");
+
+	CHECK(played.size() == recorded.size());
+
+	for (auto& frame : recorded)
+		CHECK(describe(played[frame.first]) == describe(frame.second));
+
+	std::wcout << L"st2038 record: " << recorded.size() << L" frames of " << FRAMES << L" came back with their packets" << std::endl;
+}
+
+}}
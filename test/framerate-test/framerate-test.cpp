@@ -0,0 +1,491 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Moves generated textures by known amounts and checks the motion estimated
+// between them, and the frames interpolated in between against the texture at
+// the position it should have at that time, also through the
+// motion_interpolator used by the framerate producer. Times the work at 1080p.
+
+#include <core/producer/framerate/motion_compensation.h>
+#include <core/producer/framerate/motion_interpolator.h>
+
+#include <test/common/frames.h>
+#include <test/common/test.h>
+
+#include <core/frame/draw_frame.h>
+#include <core/frame/frame.h>
+#include <core/frame/frame_transform.h>
+#include <core/frame/pixel_format.h>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace caspar;
+using namespace caspar::core::motion;
+
+namespace {
+
+typedef std::vector<std::uint8_t> image;
+
+// Non repeating smooth noise, so that any block has a unique match.
+class texture
+{
+	std::uint32_t seed_;
+
+	double lattice(int x, int y, int cell) const
+	{
+		auto x0 = static_cast<int>(std::floor(static_cast<double>(x) / cell));
+		auto y0 = static_cast<int>(std::floor(static_cast<double>(y) / cell));
+		auto fx = (x - x0 * cell) / static_cast<double>(cell);
+		auto fy = (y - y0 * cell) / static_cast<double>(cell);
+
+		auto at = [&](int lx, int ly)
+		{
+			std::uint32_t h = seed_ ^ (static_cast<std::uint32_t>(lx) * 374761393u + static_cast<std::uint32_t>(ly) * 668265263u + static_cast<std::uint32_t>(cell) * 1442695041u);
+			h = (h ^ (h >> 13)) * 1274126177u;
+			return ((h ^ (h >> 16)) & 0xFFFF) / 65535.0;
+		};
+
+		auto top	= at(x0, y0) + (at(x0 + 1, y0) - at(x0, y0)) * fx;
+		auto bottom	= at(x0, y0 + 1) + (at(x0 + 1, y0 + 1) - at(x0, y0 + 1)) * fx;
+
+		return top + (bottom - top) * fy;
+	}
+public:
+	explicit texture(std::uint32_t seed)
+		: seed_(seed)
+	{
+	}
+
+	std::uint8_t operator()(int x, int y) const
+	{
+		return static_cast<std::uint8_t>(16 + 120 * lattice(x, y, 24) + 60 * lattice(x, y, 7) + 20 * lattice(x, y, 3));
+	}
+};
+
+struct object
+{
+	const texture*	pattern;
+	int				x;			// Position at time 0.
+	int				y;
+	int				width;		// 0 for the background.
+	int				height;
+	int				dx;			// Motion per frame, even.
+	int				dy;
+};
+
+// The scene at time 0 or 2 for frames and 1 for the frame half way, objects painted in order.
+image render(const std::vector<object>& objects, int width, int height, int time)
+{
+	image result(width * height);
+
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			for (auto& o : objects)
+			{
+				int ox = o.x + o.dx * time / 2;
+				int oy = o.y + o.dy * time / 2;
+
+				if (o.width == 0 || (x >= ox && x < ox + o.width && y >= oy && y < oy + o.height))
+					result[y * width + x] = (*o.pattern)(x - ox, y - oy);
+			}
+		}
+	}
+
+	return result;
+}
+
+plane view(const image& i, int width, int height)
+{
+	return plane { i.data(), width, height, width };
+}
+
+double psnr(const image& a, const image& b)
+{
+	double error = 0.0;
+
+	for (std::size_t n = 0; n < a.size(); ++n)
+		error += (a[n] - b[n]) * static_cast<double>(a[n] - b[n]);
+
+	error /= a.size();
+
+	return error == 0.0 ? 99.0 : 10.0 * std::log10(255.0 * 255.0 / error);
+}
+
+struct result
+{
+	double	correct_vectors;
+	double	motion_psnr;
+	double	blend_psnr;
+	int		occluded;
+};
+
+result run(const std::vector<object>& objects, int width, int height)
+{
+	auto first	= render(objects, width, height, 0);
+	auto half	= render(objects, width, height, 1);
+	auto second	= render(objects, width, height, 2);
+
+	auto forward	= estimate_motion(view(first, width, height), view(second, width, height));
+	auto backward	= estimate_motion(view(second, width, height), view(first, width, height));
+	smooth_motion_field(forward, view(first, width, height), view(second, width, height));
+	smooth_motion_field(backward, view(second, width, height), view(first, width, height));
+
+	// Blocks inside the background, away from the edges and from every other object.
+	int inside	= 0;
+	int correct	= 0;
+	auto& background = objects.front();
+
+	for (int row = 0; row < forward.rows; ++row)
+	{
+		for (int column = 0; column < forward.columns; ++column)
+		{
+			int x = column * motion_field::block_size;
+			int y = row * motion_field::block_size;
+
+			if (x + background.dx < 0 || y + background.dy < 0 || x + background.dx + motion_field::block_size > width || y + background.dy + motion_field::block_size > height)
+				continue;
+
+			bool covered = false;
+
+			for (std::size_t n = 1; n < objects.size(); ++n)
+			{
+				auto& o = objects[n];
+				int margin = motion_field::block_size + std::abs(o.dx) + std::abs(o.dy);
+				covered |= x + margin > o.x && x < o.x + o.width + margin && y + margin > o.y && y < o.y + o.height + margin;
+			}
+
+			if (covered)
+				continue;
+
+			auto& vector = forward.at(column, row);
+			++inside;
+			correct += vector.x == background.dx && vector.y == background.dy;
+		}
+	}
+
+	auto map = build_interpolation_map(forward, backward, view(first, width, height), view(second, width, height), 0.5);
+	image interpolated(width * height);
+	interpolate_plane(map, view(first, width, height), view(second, width, height), 1, 1, 1, interpolated.data(), width);
+
+	image blended(width * height);
+
+	for (std::size_t n = 0; n < blended.size(); ++n)
+		blended[n] = static_cast<std::uint8_t>((first[n] + second[n] + 1) / 2);
+
+	return result { inside ? static_cast<double>(correct) / inside : 1.0, psnr(interpolated, half), psnr(blended, half), map.occluded };
+}
+
+void report(const std::wstring& name, const result& r)
+{
+	std::wcout << name << L": " << static_cast<int>(r.correct_vectors * 100.0) << L"% correct vectors, "
+			<< L"motion " << r.motion_psnr << L" dB, blend " << r.blend_psnr << L" dB, "
+			<< r.occluded << L" occluded cells" << std::endl;
+}
+
+void test_still()
+{
+	texture background(1);
+	auto r = run({ object { &background, 0, 0, 0, 0, 0, 0 } }, 320, 240);
+	report(L"still", r);
+
+	CHECK(r.correct_vectors == 1.0);
+	CHECK(r.motion_psnr >= 99.0);
+}
+
+void test_pan()
+{
+	texture background(2);
+	auto r = run({ object { &background, 0, 0, 0, 0, 6, -4 } }, 720, 576);
+	report(L"pan", r);
+
+	CHECK(r.correct_vectors > 0.98);
+	CHECK(r.motion_psnr > 40.0);
+	CHECK(r.motion_psnr > r.blend_psnr + 10.0);
+}
+
+void test_fast_pan()
+{
+	texture background(3);
+	auto r = run({ object { &background, 0, 0, 0, 0, 62, 24 } }, 1280, 720);
+	report(L"fast pan", r);
+
+	CHECK(r.correct_vectors > 0.95);
+	CHECK(r.motion_psnr > 35.0);
+	CHECK(r.motion_psnr > r.blend_psnr + 10.0);
+}
+
+void test_occlusion()
+{
+	texture background(4);
+	texture foreground(5);
+	auto r = run(
+	{
+		object { &background, 0, 0, 0, 0, -4, 2 },
+		object { &foreground, 200, 150, 160, 120, 24, 0 }
+	}, 720, 576);
+	report(L"occlusion", r);
+
+	CHECK(r.correct_vectors > 0.95);
+	CHECK(r.occluded > 0);
+	CHECK(r.motion_psnr > 30.0);
+	CHECK(r.motion_psnr > r.blend_psnr + 8.0);
+}
+
+// Counts the frames created, which are filled with a marker the interpolator
+// has to overwrite. Like the buffers of the GPU accelerator, which are reused
+// once uploaded, every buffer handed out is overwritten by submit().
+class submitting_frame_factory : public test::frame_factory
+{
+	std::mutex						mutex_;
+	std::vector<std::shared_ptr<image>>	buffers_;
+public:
+	std::atomic<int>	created { 0 };
+
+	core::mutable_frame create_frame(const void* tag, const core::pixel_format_desc& desc, const core::audio_channel_layout& channel_layout) override
+	{
+		auto frame = test::frame_factory::create_frame(tag, desc, channel_layout);
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		for (int n = 0; n < static_cast<int>(desc.planes.size()); ++n)
+		{
+			std::fill(frame.image_data(n).begin(), frame.image_data(n).end(), 0x55);
+			buffers_.push_back(*frame.image_data(n).storage<std::shared_ptr<image>>());
+		}
+
+		++created;
+
+		return frame;
+	}
+
+	void submit()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		for (auto& buffer : buffers_)
+		{
+			for (std::size_t n = 0; n < buffer->size(); ++n)
+				(*buffer)[n] = static_cast<std::uint8_t>(n * 37);
+		}
+
+		buffers_.clear();
+	}
+};
+
+// An opaque grey BGRA frame from the factory.
+core::const_frame make_frame(core::frame_factory& factory, const image& luma, int width, int height)
+{
+	core::pixel_format_desc desc(core::pixel_format::bgra);
+	desc.planes.push_back(core::pixel_format_desc::plane(width, height, 4));
+
+	auto frame	= factory.create_frame(nullptr, desc, core::audio_channel_layout::invalid());
+	auto pixels	= frame.image_data(0).begin();
+
+	for (int n = 0; n < width * height; ++n)
+	{
+		pixels[n * 4] = pixels[n * 4 + 1] = pixels[n * 4 + 2] = luma[n];
+		pixels[n * 4 + 3] = 255;
+	}
+
+	return core::const_frame(std::move(frame));
+}
+
+void test_interpolator()
+{
+	const int width		= 720;
+	const int height	= 576;
+
+	texture background(8);
+	std::vector<object> objects { object { &background, 0, 0, 0, 0, 8, 2 } };
+	auto half = render(objects, width, height, 1);
+
+	auto factory = spl::make_shared<submitting_frame_factory>();
+	core::draw_frame first(make_frame(*factory, render(objects, width, height, 0), width, height));
+	core::draw_frame second(make_frame(*factory, render(objects, width, height, 2), width, height));
+	core::draw_frame unretained(make_frame(*factory, render(objects, width, height, 2), width, height));
+	first.transform().image_transform.fill_translation[0]	= 0.25;
+	second.transform().image_transform.fill_translation[0]	= 0.25;
+
+	int fallbacks = 0;
+	core::motion_interpolator interpolator(factory, [&](const core::draw_frame& source, const core::draw_frame&, const boost::rational<int64_t>&)
+	{
+		++fallbacks;
+		return source;
+	});
+
+	const boost::rational<int64_t> distance(1, 2);
+
+	// As the framerate producer does when receiving from the source, after
+	// which the frames are drawn and their buffers reused.
+	interpolator.retain(first);
+	interpolator.retain(second);
+	factory->submit();
+	CHECK(factory->created == 3);
+
+	// Not prepared.
+	CHECK(interpolator(first, second, distance) == first);
+	CHECK(fallbacks == 1);
+
+	interpolator.prepare(first, second, { distance, boost::rational<int64_t>(3, 4) });
+
+	// The framerate producer mutes the frames after preparing them.
+	auto muted_first	= first;
+	auto muted_second	= second;
+	muted_first.transform().audio_transform.volume	= 0.0;
+	muted_second.transform().audio_transform.volume	= 0.0;
+
+	auto result = muted_first;
+
+	for (int n = 0; n < 1000 && result == muted_first; ++n)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		result = interpolator(muted_first, muted_second, distance);
+	}
+
+	CHECK(result != muted_first);
+
+	auto collected = test::collect(result);
+	CHECK(collected.frames.size() == 1);
+	CHECK(collected.transforms.front().fill_translation[0] == 0.25);
+
+	auto& frame = collected.frames.front();
+	CHECK(frame.pixel_format_desc().format == core::pixel_format::bgra);
+	CHECK(frame.width() == width && frame.height() == height);
+	CHECK(factory->created >= 4);
+
+	image interpolated(width * height);
+
+	for (int n = 0; n < width * height; ++n)
+		interpolated[n] = frame.image_data(0).begin()[n * 4 + 1];
+
+	auto quality = psnr(interpolated, half);
+	CHECK(quality > 40.0);
+
+	// More than one image can't be warped.
+	core::draw_frame both(std::vector<core::draw_frame> { first, second });
+	CHECK(interpolator(both, second, distance) == both);
+
+	// Nor can a frame that was never copied.
+	CHECK(interpolator(first, unretained, distance) == first);
+
+	auto info = interpolator.info();
+	CHECK(info.get<int>(L"interpolated") == 1);
+	CHECK(info.get<int>(L"late") >= 1);
+	CHECK(info.get<int>(L"unsupported") == 2);
+
+	std::wcout << L"interpolator: " << quality << L" dB" << std::endl;
+}
+
+template<typename Func>
+double milliseconds(int repeat, const Func& func)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	for (int n = 0; n < repeat; ++n)
+		func();
+
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / repeat;
+}
+
+void benchmark()
+{
+	const int width		= 1920;
+	const int height	= 1080;
+	const int repeat	= 5;
+
+	texture background(6);
+	texture foreground(7);
+	std::vector<object> objects
+	{
+		object { &background, 0, 0, 0, 0, 10, 4 },
+		object { &foreground, 600, 300, 400, 300, -30, 8 }
+	};
+
+	auto first_luma		= render(objects, width, height, 0);
+	auto second_luma	= render(objects, width, height, 2);
+	image first(width * height * 4);
+	image second(width * height * 4);
+
+	for (int n = 0; n < width * height; ++n)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			first[n * 4 + c]	= first_luma[n];
+			second[n * 4 + c]	= second_luma[n];
+		}
+
+		first[n * 4 + 3]	= 255;
+		second[n * 4 + 3]	= 255;
+	}
+
+	plane first_bgra	{ first.data(), width, height, width * 4 };
+	plane second_bgra	{ second.data(), width, height, width * 4 };
+	motion_field forward;
+	motion_field backward;
+
+	auto estimation = milliseconds(repeat, [&]
+	{
+		auto a = extract_luma(first_bgra, 4, 0);
+		auto b = extract_luma(second_bgra, 4, 0);
+		forward		= estimate_motion(view(a, width, height), view(b, width, height));
+		backward	= estimate_motion(view(b, width, height), view(a, width, height));
+		smooth_motion_field(forward, view(a, width, height), view(b, width, height));
+		smooth_motion_field(backward, view(b, width, height), view(a, width, height));
+	});
+
+	image output(width * height * 4);
+	auto interpolation = milliseconds(repeat, [&]
+	{
+		auto map = build_interpolation_map(forward, backward, view(first_luma, width, height), view(second_luma, width, height), 0.4);
+		interpolate_plane(map, first_bgra, second_bgra, 4, 1, 1, output.data(), width * 4);
+	});
+
+	// 25 to 50 fps estimates once per source frame and interpolates every other output frame.
+	std::wcout << L"1080p bgra: motion estimation " << estimation << L" ms per source frame, interpolation "
+			<< interpolation << L" ms per output frame, " << (estimation + interpolation) * 25.0 / 10.0 << L"% of a core for 25 to 50 fps" << std::endl;
+}
+
+}
+
+int main()
+{
+	return test::run_tests("framerate-test", []
+	{
+		test_still();
+		test_pan();
+		test_fast_pan();
+		test_occlusion();
+		test_interpolator();
+		benchmark();
+	});
+}
@@ -0,0 +1,322 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Replays generated browser paints through the dirty_rect_compositor and draws its updates the
+// way the mixer would, full frames replacing and patches blended over, checking that the result
+// always equals the painted image. Needs no CEF.
+//
+// With a layer opacity below 1 the base and its patches have to be blended as one image, the
+// way the mixer draws an isolated frame.
+
+#include <modules/html/util/dirty_rect_compositor.h>
+
+#include <test/common/test.h>
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace caspar::html;
+
+namespace {
+
+typedef std::vector<std::uint8_t> image;
+
+struct browser
+{
+	int		width;
+	int		height;
+	image	pixels;
+
+	browser(int width, int height)
+		: width(width)
+		, height(height)
+		, pixels(width * height * 4)
+	{
+	}
+
+	// Fills a rect with a premultiplied color and returns it as the dirty rect.
+	dirty_rect fill(int x, int y, int w, int h, std::uint8_t b, std::uint8_t g, std::uint8_t r, std::uint8_t a)
+	{
+		for (int row = y; row < y + h; ++row)
+		{
+			for (int column = x; column < x + w; ++column)
+			{
+				auto pixel = &pixels[(row * width + column) * 4];
+				pixel[0] = b * a / 255;
+				pixel[1] = g * a / 255;
+				pixel[2] = r * a / 255;
+				pixel[3] = a;
+			}
+		}
+
+		return dirty_rect { x, y, w, h };
+	}
+};
+
+struct display
+{
+	image		pixels;
+	int			full_updates	= 0;
+	int			patches			= 0;
+	std::size_t	copied_bytes	= 0;
+
+	void apply(const browser& source, const dirty_rect_compositor::update& update)
+	{
+		if (update.full)
+		{
+			pixels.resize(source.pixels.size());
+			dirty_rect_compositor::copy_image(source.pixels.data(), source.pixels.size(), pixels.data());
+			++full_updates;
+			copied_bytes += source.pixels.size();
+			return;
+		}
+
+		for (auto& rect : update.patches)
+		{
+			CHECK(rect.x >= 0 && rect.y >= 0 && rect.x + rect.width <= source.width && rect.y + rect.height <= source.height);
+
+			image patch(rect.area() * 4);
+			dirty_rect_compositor::copy_rect(source.pixels.data(), source.width, rect, patch.data());
+
+			for (int y = 0; y < rect.height; ++y)
+			{
+				for (int x = 0; x < rect.width; ++x)
+				{
+					auto over	= &patch[(y * rect.width + x) * 4];
+					auto below	= &pixels[((rect.y + y) * source.width + rect.x + x) * 4];
+
+					for (int c = 0; c < 4; ++c)
+						below[c] = static_cast<std::uint8_t>(over[c] + below[c] * (255 - over[3]) / 255);
+				}
+			}
+
+			++patches;
+			copied_bytes += patch.size();
+		}
+	}
+};
+
+// Blends a premultiplied rect over the same rect of a full image.
+void blend(image& below, int width, const std::uint8_t* over, const dirty_rect& rect, double opacity)
+{
+	for (int y = 0; y < rect.height; ++y)
+	{
+		for (int x = 0; x < rect.width; ++x)
+		{
+			auto source	= &over[(y * rect.width + x) * 4];
+			auto target	= &below[((rect.y + y) * width + rect.x + x) * 4];
+			auto alpha	= static_cast<int>(source[3] * opacity + 0.5);
+
+			for (int c = 0; c < 4; ++c)
+				target[c] = static_cast<std::uint8_t>(static_cast<int>(source[c] * opacity + 0.5) + target[c] * (255 - alpha) / 255);
+		}
+	}
+}
+
+// What html_producer sends: the last full frame and every patch since.
+struct composite
+{
+	image										base;
+	std::vector<std::pair<dirty_rect, image>>	patches;
+
+	void apply(const browser& source, const dirty_rect_compositor::update& update)
+	{
+		if (update.full)
+		{
+			base = source.pixels;
+			patches.clear();
+			return;
+		}
+
+		for (auto& rect : update.patches)
+		{
+			image patch(rect.area() * 4);
+			dirty_rect_compositor::copy_rect(source.pixels.data(), source.width, rect, patch.data());
+			patches.emplace_back(rect, std::move(patch));
+		}
+	}
+
+	// Drawn into an image of its own first, then blended.
+	image isolated(const browser& source, image background, double opacity) const
+	{
+		auto flat = base;
+
+		for (auto& patch : patches)
+			blend(flat, source.width, patch.second.data(), patch.first, 1.0);
+
+		blend(background, source.width, flat.data(), dirty_rect { 0, 0, source.width, source.height }, opacity);
+
+		return background;
+	}
+
+	// Every frame blended on its own.
+	image separate(const browser& source, image background, double opacity) const
+	{
+		blend(background, source.width, base.data(), dirty_rect { 0, 0, source.width, source.height }, opacity);
+
+		for (auto& patch : patches)
+			blend(background, source.width, patch.second.data(), patch.first, opacity);
+
+		return background;
+	}
+};
+
+void paint(dirty_rect_compositor& compositor, const browser& source, display& target, std::vector<dirty_rect> dirty)
+{
+	target.apply(source, compositor.paint(source.pixels.data(), std::move(dirty)));
+	CHECK(target.pixels == source.pixels);
+}
+
+void test_lower_third()
+{
+	browser source(1920, 1080);
+	display target;
+	dirty_rect_compositor compositor(source.width, source.height);
+
+	// The template appears, then a clock ticks on an opaque box.
+	paint(compositor, source, target, { source.fill(0, 0, 1920, 1080, 0, 0, 0, 0) });
+	paint(compositor, source, target, { source.fill(100, 850, 1200, 150, 200, 40, 40, 255) });
+	paint(compositor, source, target, { source.fill(1300, 850, 300, 150, 20, 20, 20, 230) });
+
+	auto full_updates = target.full_updates;
+	auto copied_bytes = target.copied_bytes;
+
+	for (int second = 0; second < 20; ++second)
+		paint(compositor, source, target, { source.fill(1350 + second % 3, 890, 200, 60, 255, 255, second * 10, 255) });
+
+	CHECK(target.patches > 0);
+	CHECK(target.full_updates - full_updates <= 1);
+	CHECK(target.copied_bytes - copied_bytes < 20 * 1920 * 1080 * 4 / 20);
+
+	// Text fading out on the transparent part can't be blended over the old
+	// text, it has to replace it.
+	paint(compositor, source, target, { source.fill(200, 100, 300, 40, 255, 255, 255, 128) });
+	paint(compositor, source, target, { source.fill(200, 100, 300, 40, 255, 255, 255, 0) });
+
+	std::wcout << L"lower third: " << target.full_updates << L" full updates, " << target.patches << L" patches, " << target.copied_bytes / 1024 << L" KiB copied" << std::endl;
+}
+
+void test_random()
+{
+	std::mt19937 random(1234);
+	browser source(640, 360);
+	display target;
+	dirty_rect_compositor compositor(source.width, source.height, 8, 0.25);
+
+	auto next = [&](int max) { return static_cast<int>(random() % max); };
+
+	paint(compositor, source, target, { dirty_rect { 0, 0, source.width, source.height } });
+
+	for (int i = 0; i < 2000; ++i)
+	{
+		std::vector<dirty_rect> dirty;
+
+		for (int count = next(4); count > 0; --count)
+		{
+			auto w = 1 + next(i % 50 == 0 ? 640 : 100);
+			auto h = 1 + next(i % 50 == 0 ? 360 : 60);
+			auto x = next(source.width - w + 1);
+			auto y = next(source.height - h + 1);
+			std::uint8_t alphas[] = { 0, 255, 255, 128, static_cast<std::uint8_t>(next(256)) };
+
+			dirty.push_back(source.fill(x, y, w, h, next(256), next(256), next(256), alphas[next(5)]));
+		}
+
+		// Browsers may report more than what changed, and rects partly outside the view.
+		if (next(10) == 0)
+			dirty.push_back(dirty_rect { -20, source.height - 10, 50, 40 });
+
+		paint(compositor, source, target, dirty);
+	}
+
+	CHECK(target.patches > 0);
+	CHECK(target.full_updates > 1);
+
+	std::wcout << L"random: " << target.full_updates << L" full updates, " << target.patches << L" patches" << std::endl;
+}
+
+void test_untouched()
+{
+	browser source(64, 64);
+	display target;
+	dirty_rect_compositor compositor(source.width, source.height);
+
+	paint(compositor, source, target, { source.fill(0, 0, 64, 64, 1, 2, 3, 255) });
+
+	auto update = compositor.paint(source.pixels.data(), { });
+	CHECK(!update.full);
+	CHECK(update.patches.empty());
+
+	update = compositor.paint(source.pixels.data(), { dirty_rect { 70, 70, 5, 5 } });
+	CHECK(!update.full);
+	CHECK(update.patches.empty());
+
+	std::wcout << L"untouched: ok" << std::endl;
+}
+
+void test_opacity()
+{
+	browser source(320, 180);
+	browser background(320, 180);
+	composite target;
+	dirty_rect_compositor compositor(source.width, source.height);
+
+	background.fill(0, 0, 320, 180, 10, 200, 10, 255);
+
+	target.apply(source, compositor.paint(source.pixels.data(), { source.fill(0, 0, 320, 180, 0, 0, 0, 0) }));
+	target.apply(source, compositor.paint(source.pixels.data(), { source.fill(20, 130, 200, 40, 200, 40, 40, 255) }));
+
+	for (int second = 0; second < 5; ++second)
+		target.apply(source, compositor.paint(source.pixels.data(), { source.fill(30 + second, 140, 50, 20, 255, 255, second * 40, 255) }));
+
+	CHECK(!target.patches.empty());
+
+	for (auto opacity : { 1.0, 0.5, 0.25 })
+	{
+		auto expected = background.pixels;
+		blend(expected, source.width, source.pixels.data(), dirty_rect { 0, 0, source.width, source.height }, opacity);
+
+		CHECK(target.isolated(source, background.pixels, opacity) == expected);
+
+		// The stale base would show through the patches.
+		if (opacity < 1.0)
+			CHECK(target.separate(source, background.pixels, opacity) != expected);
+	}
+
+	std::wcout << L"opacity: ok" << std::endl;
+}
+
+}
+
+int main()
+{
+	return caspar::test::run_tests("html-test", []
+	{
+		test_lower_third();
+		test_random();
+		test_untouched();
+		test_opacity();
+	});
+}
@@ -0,0 +1,291 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Checks that the tiles of a tiled_image are bit identical to the frames the
+// image_scroll_producer cuts from an image it has blurred as a whole, and
+// measures the memory and decode time of a tiled credit roll. Also checks that
+// the tiles kept decoded while scrolling cover the next frames.
+
+#include <modules/image/util/tiled_image.h>
+#include <modules/image/util/image_algorithms.h>
+#include <modules/image/util/image_view.h>
+
+#include <test/common/test.h>
+
+#include <common/tweener.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace caspar;
+using namespace caspar::image;
+
+namespace {
+
+typedef std::vector<std::uint8_t> pixels;
+
+const double angles[] = { 3.14159265 / 2, 3.14159265, 3.14159265 / 2 * 3, 0.0 }; // Up, left, down and right as the producer.
+
+std::uint32_t hash(std::uint32_t x, std::uint32_t y, std::uint32_t seed)
+{
+	std::uint32_t h = seed ^ (x * 374761393u + y * 668265263u);
+	h = (h ^ (h >> 13)) * 1274126177u;
+	return h ^ (h >> 16);
+}
+
+pixels noise(int width, int height)
+{
+	pixels result(static_cast<std::size_t>(width) * height * 4);
+
+	for (int y = 0; y < height; ++y)
+		for (int x = 0; x < width; ++x)
+		{
+			auto h = hash(x, y, 1);
+			std::memcpy(&result[(static_cast<std::size_t>(y) * width + x) * 4], &h, 4);
+		}
+
+	return result;
+}
+
+// White glyph like blocks on transparent lines of text.
+pixels credit_roll(int width, int height)
+{
+	pixels result(static_cast<std::size_t>(width) * height * 4, 0);
+
+	for (int y = 0; y < height; ++y)
+	{
+		if (y % 60 >= 24)
+			continue;
+
+		for (int x = width / 4; x < width * 3 / 4; ++x)
+		{
+			if (hash(x / 3, y / 4, 2) % 3)
+				continue;
+
+			std::memset(&result[(static_cast<std::size_t>(y) * width + x) * 4], 255, 4);
+		}
+	}
+
+	return result;
+}
+
+// The frames image_scroll_producer makes out of the image when not streaming.
+std::vector<pixels> reference_tiles(const pixels& image, int width, int height, int tile_width, int tile_height, double angle, int blur_px)
+{
+	auto bytes = image.data();
+	pixels blurred(image.size());
+	auto count = width * height * 4;
+
+	if (blur_px > 0)
+	{
+		image_view<bgra_pixel> original_view(const_cast<std::uint8_t*>(image.data()), width, height);
+		image_view<bgra_pixel> blurred_view(blurred.data(), width, height);
+		blur(original_view, blurred_view, angle, blur_px, caspar::tweener(L"easeInQuad"));
+		bytes = blurred.data();
+	}
+
+	std::vector<pixels> result;
+	auto frame_size = tile_width * tile_height * 4;
+
+	if (width == tile_width)
+	{
+		while (count > 0)
+		{
+			pixels frame(frame_size);
+
+			if (count >= frame_size)
+			{
+				std::copy_n(bytes + count - frame_size, frame_size, frame.begin());
+				count -= frame_size;
+			}
+			else
+			{
+				std::copy_n(bytes, count, frame.begin() + frame_size - count);
+				count = 0;
+			}
+
+			result.push_back(frame);
+		}
+	}
+	else
+	{
+		int i = 0;
+
+		while (count > 0)
+		{
+			pixels frame(frame_size);
+
+			if (count >= frame_size)
+			{
+				for (int y = 0; y < height; ++y)
+					std::copy_n(bytes + i * tile_width * 4 + y * width * 4, tile_width * 4, frame.begin() + y * tile_width * 4);
+
+				++i;
+				count -= frame_size;
+			}
+			else
+			{
+				auto width2 = width % tile_width;
+
+				for (int y = 0; y < height; ++y)
+					std::copy_n(bytes + i * tile_width * 4 + y * width * 4, width2 * 4, frame.begin() + y * tile_width * 4);
+
+				count = 0;
+			}
+
+			result.push_back(frame);
+		}
+
+		std::reverse(result.begin(), result.end());
+	}
+
+	return result;
+}
+
+void check_identical(int width, int height, int tile_width, int tile_height)
+{
+	auto image = noise(width, height);
+
+	for (auto angle : angles)
+		for (int blur_px : { 0, 1, 3, 17, 70 })
+		{
+			auto expected = reference_tiles(image, width, height, tile_width, tile_height, angle, blur_px);
+			tiled_image tiles(image.data(), width, height, tile_width, tile_height, angle, blur_px, caspar::tweener(L"easeInQuad"));
+
+			CHECK(tiles.count() == static_cast<int>(expected.size()));
+
+			for (int index = 0; index < tiles.count(); ++index)
+			{
+				pixels tile(tile_width * tile_height * 4, 0xCD);
+				tiles.decode(index, tile.data());
+				CHECK(tile == expected[index]);
+			}
+		}
+
+	std::wcout << width << L"x" << height << L" in " << tile_width << L"x" << tile_height << L" tiles: identical" << std::endl;
+}
+
+void test_vertical()
+{
+	check_identical(64, 200, 64, 48);
+	check_identical(64, 144, 64, 48);
+	check_identical(64, 20, 64, 48);
+}
+
+void test_horizontal()
+{
+	check_identical(150, 48, 64, 48);
+	check_identical(192, 48, 64, 48);
+	check_identical(30, 48, 64, 48);
+}
+
+void test_credit_roll()
+{
+	const int width = 1920;
+	const int height = 20000;
+	const int tile_height = 1080;
+
+	auto image = credit_roll(width, height);
+
+	auto start = std::chrono::steady_clock::now();
+	tiled_image tiles(image.data(), width, height, width, tile_height, angles[0], 8, caspar::tweener(L"easeInQuad"));
+	auto compressed = std::chrono::steady_clock::now();
+
+	pixels tile(width * tile_height * 4);
+
+	for (int index = 0; index < tiles.count(); ++index)
+		tiles.decode(index, tile.data());
+
+	auto decoded = std::chrono::steady_clock::now();
+
+	auto raw_size = image.size();
+	image.clear();
+	image.shrink_to_fit();
+
+	// Only the compressed tiles stay resident, besides the few decoded ones.
+	CHECK(tiles.count() == (height + tile_height - 1) / tile_height);
+	CHECK(tiles.compressed_size() * 8 < raw_size);
+
+	auto ms = [](std::chrono::steady_clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+
+	std::wcout << width << L"x" << height << L" credit roll: " << raw_size / 1000000 << L" MB as " << tiles.compressed_size() / 1000000.0
+			<< L" MB of compressed tiles, tiled in " << ms(compressed - start) << L" ms, "
+			<< ms(decoded - compressed) / tiles.count() << L" ms per decoded and blurred 1080p tile" << std::endl;
+}
+
+
+void test_prefetch()
+{
+	auto sorted = [](std::vector<int> tiles)
+	{
+		std::sort(tiles.begin(), tiles.end());
+		return tiles;
+	};
+
+	// Standing still, the two tiles on screen and one on either side, nearest first.
+	auto still = tiles_around(10, 3.5, 0.0);
+	CHECK(sorted(still) == std::vector<int>({ 1, 2, 3, 4 }));
+	CHECK(still.front() == 2 || still.front() == 3);
+
+	CHECK(sorted(tiles_around(10, 3.5, 2.2)) == std::vector<int>({ 1, 2, 3, 4, 5, 6 }));
+	CHECK(sorted(tiles_around(10, 3.5, -2.2)) == std::vector<int>({ 0, 1, 2, 3, 4 }));
+	CHECK(sorted(tiles_around(10, 11.0, 0.5)) == std::vector<int>({ 8, 9 }));
+	CHECK(tiles_around(10, -3.0, 0.5).empty());
+
+	// Every tile on screen during the next frames is among them, in either direction.
+	for (auto speed : { 0.01, 0.3, -0.3, 1.0 })
+	{
+		for (double offset = -1.0; offset < 12.0; offset += 0.37)
+		{
+			auto tiles = tiles_around(10, offset, speed * 5);
+
+			for (int frame = 0; frame <= 5; ++frame)
+			{
+				auto later = offset + speed * frame;
+
+				for (int n = 0; n < 10; ++n)
+				{
+					if (later - 2.0 <= n && n <= later)
+						CHECK(std::find(tiles.begin(), tiles.end(), n) != tiles.end());
+				}
+			}
+		}
+	}
+
+	std::wcout << L"prefetch: ok" << std::endl;
+}
+
+}
+
+int main()
+{
+	return test::run_tests("image-test", []
+	{
+		test_vertical();
+		test_horizontal();
+		test_credit_roll();
+		test_prefetch();
+	});
+}
@@ -0,0 +1,201 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Checks the key extraction against the shuffle used for key outputs before,
+// checks that the separated producer leaves the keying to the mixer, and times
+// the key extraction at 1080p.
+
+#include <core/frame/keying.h>
+
+#include <test/common/frames.h>
+#include <test/common/test.h>
+
+#include <core/ancillary/ancillary.h>
+#include <core/frame/audio_channel_layout.h>
+#include <core/frame/draw_frame.h>
+#include <core/frame/frame.h>
+#include <core/frame/frame_transform.h>
+#include <core/frame/pixel_format.h>
+#include <core/monitor/monitor.h>
+#include <core/producer/frame_producer.h>
+#include <core/producer/separated/separated_producer.h>
+
+#include <common/array.h>
+#include <common/cache_aligned_vector.h>
+#include <common/future.h>
+#include <common/memshfl.h>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace caspar;
+
+namespace {
+
+typedef std::vector<std::uint8_t> image;
+
+struct test_producer : public core::frame_producer_base
+{
+	core::monitor::subject	monitor_subject_;
+	core::constraints		constraints_;
+	core::draw_frame		frame_;
+
+	explicit test_producer(core::draw_frame frame)
+		: frame_(std::move(frame))
+	{
+	}
+
+	core::draw_frame receive_impl() override						{ return frame_; }
+	core::constraints& pixel_constraints() override					{ return constraints_; }
+	std::wstring print() const override								{ return L"test"; }
+	std::wstring name() const override								{ return L"test"; }
+	boost::property_tree::wptree info() const override				{ return boost::property_tree::wptree(); }
+	core::monitor::subject& monitor_output() override				{ return monitor_subject_; }
+};
+
+void test_extract_key()
+{
+	const std::size_t size = 1920 * 1080 * 4;
+
+	auto source = test::noise(size + 5, 3);
+	cache_aligned_vector<std::uint8_t> aligned_source(source.begin(), source.begin() + size);
+	cache_aligned_vector<std::uint8_t> expected(size);
+	image dest(size + 7);
+
+	// The shuffle the key outputs used before.
+	aligned_memshfl(expected.data(), aligned_source.data(), size, 0x0F0F0F0F, 0x0B0B0B0B, 0x07070707, 0x03030303);
+	core::extract_key(aligned_source.data(), dest.data(), size);
+	CHECK(std::equal(expected.begin(), expected.end(), dest.begin()));
+
+	for (int pixels : { 1, 15, 17, 1919 })
+	{
+		core::extract_key(source.data() + 5, dest.data() + 7, pixels * 4);
+
+		for (int n = 0; n < pixels * 4; ++n)
+			CHECK(dest[n + 7] == source[n - n % 4 + 3 + 5]);
+	}
+
+	std::wcout << L"extract_key: same as the previous shuffle" << std::endl;
+}
+
+// The key of a separated producer's fill is drawn by the mixer, the frames
+// of the producers may be mapped for upload only and are never read back.
+void test_separated_producer()
+{
+	const int width		= 64;
+	const int height	= 36;
+
+	auto fill_frame		= test::make_bgra_frame(test::noise(width * height * 4, 4), width, height, core::mutable_audio_buffer(1920 * 2, 7));
+	auto key_frame		= test::make_bgra_frame(test::noise(width * height * 4, 5), width, height);
+	auto separated		= core::create_separated_producer(
+			spl::make_shared<test_producer>(core::draw_frame(core::const_frame(fill_frame))),
+			spl::make_shared<test_producer>(core::draw_frame(core::const_frame(key_frame))));
+
+	for (auto frame : { separated->receive(), separated->last_frame() })
+	{
+		auto masked = test::collect(frame);
+
+		CHECK(masked.frames.size() == 2);
+		CHECK(masked.transforms[0].is_key && !masked.transforms[1].is_key);
+		CHECK(masked.transforms[0].is_paired_key);
+		CHECK(masked.frames[0] == key_frame);
+		CHECK(masked.frames[1] == fill_frame);
+		CHECK(masked.frames[1].audio_data().size() == 1920 * 2);
+	}
+
+	std::wcout << L"separated producer: keyed by the mixer" << std::endl;
+}
+
+void test_key_only()
+{
+	const int width		= 64;
+	const int height	= 36;
+
+	auto pixels = std::make_shared<cache_aligned_vector<std::uint8_t>>(width * height * 4);
+	auto random = test::noise(pixels->size(), 7);
+	std::copy(random.begin(), random.end(), pixels->begin());
+
+	core::pixel_format_desc desc(core::pixel_format::bgra);
+	desc.planes.push_back(core::pixel_format_desc::plane(width, height, 4));
+
+	core::const_frame frame(
+			make_ready_future(array<const std::uint8_t>(pixels->data(), pixels->size(), false, pixels)).share(),
+			core::audio_buffer(),
+			core::ancillary::AncillaryContainer(),
+			nullptr,
+			desc,
+			core::audio_channel_layout::invalid());
+
+	auto key = frame.key_only().image_data(0);
+
+	CHECK(key.size() == pixels->size());
+	CHECK(frame.key_only().image_data(0).begin() == key.begin()); // Shared by every output of the key.
+
+	for (std::size_t n = 0; n < key.size(); ++n)
+		CHECK(key.begin()[n] == random[n - n % 4 + 3]);
+
+	std::wcout << L"key_only: extracted once" << std::endl;
+}
+
+void benchmark()
+{
+	const std::size_t size = 1920 * 1080 * 4;
+	const int runs = 20;
+
+	cache_aligned_vector<std::uint8_t> fill(size, 200);
+	cache_aligned_vector<std::uint8_t> dest(size);
+
+	auto time = [&](const std::function<void()>& func)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		for (int n = 0; n < runs; ++n)
+			func();
+
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / runs;
+	};
+
+	auto extract		= time([&] { core::extract_key(fill.data(), dest.data(), size); });
+	auto shuffle		= time([&] { aligned_memshfl(dest.data(), fill.data(), size, 0x0F0F0F0F, 0x0B0B0B0B, 0x07070707, 0x03030303); });
+
+	std::wcout << L"1080p bgra on one core: extract_key " << extract
+			<< L" ms, previous shuffle " << shuffle << L" ms" << std::endl;
+}
+
+}
+
+int main()
+{
+	return test::run_tests("keying-test", []
+	{
+		test_extract_key();
+		test_separated_producer();
+		test_key_only();
+		benchmark();
+	});
+}
@@ -0,0 +1,315 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Checks the loudness meter against the synthetic test signals of EBU Tech
+// 3341: the stationary sine cases of integrated loudness and gating, the
+// short-term case, the surround weighting of BS.1770 and the true peak of an
+// fs/4 tone that peaks between samples. The programme material cases need
+// the EBU test files and are not part of this test. Also checks that the
+// audio mixer keeps a meter for each layer on the stage and no others.
+
+#include <core/mixer/audio/loudness_meter.h>
+#include <core/mixer/audio/audio_mixer.h>
+
+#include <test/common/test.h>
+
+#include <core/frame/audio_channel_layout.h>
+#include <core/frame/frame.h>
+#include <core/frame/pixel_format.h>
+#include <core/video_format.h>
+
+#include <common/diagnostics/graph.h>
+#include <common/env.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace caspar;
+
+namespace {
+
+const int		SAMPLE_RATE	= 48000;
+const double	PI			= 3.14159265358979323846;
+
+struct segment
+{
+	double	seconds;
+	double	dbfs;
+};
+
+// Feeds a 1 kHz sine in every channel, level[channel] dB below full scale,
+// in chunks of one 25 fps frame like the mixer does.
+class sine_source
+{
+	core::loudness_meter&	meter_;
+	int					num_channels_;
+	std::int64_t		position_	= 0;
+public:
+	sine_source(core::loudness_meter& meter)
+		: meter_(meter)
+		, num_channels_(meter.num_channels())
+	{
+	}
+
+	void play(double seconds, const std::vector<double>& dbfs, double frequency = 1000.0, double phase = 0.0)
+	{
+		const int chunk = SAMPLE_RATE / 25;
+		auto remaining = static_cast<std::int64_t>(std::llround(seconds * SAMPLE_RATE));
+		std::vector<std::int32_t> samples;
+
+		while (remaining > 0)
+		{
+			auto frames = static_cast<int>(std::min<std::int64_t>(chunk, remaining));
+
+			samples.resize(frames * num_channels_);
+
+			for (int n = 0; n < frames; ++n)
+			{
+				auto value = std::sin(2.0 * PI * frequency * (position_ + n) / SAMPLE_RATE + phase);
+
+				for (int channel = 0; channel < num_channels_; ++channel)
+					samples[n * num_channels_ + channel] = static_cast<std::int32_t>(std::lround(value * std::pow(10.0, dbfs.at(channel) / 20.0) * std::numeric_limits<std::int32_t>::max()));
+			}
+
+			meter_.process(samples.data(), frames);
+			position_ += frames;
+			remaining -= frames;
+		}
+	}
+
+	void play(const std::vector<segment>& segments)
+	{
+		for (auto& s : segments)
+			play(s.seconds, std::vector<double>(num_channels_, s.dbfs));
+	}
+};
+
+bool near(double value, double expected, double tolerance)
+{
+	return std::abs(value - expected) <= tolerance;
+}
+
+void check_integrated(const std::string& name, const std::vector<segment>& segments)
+{
+	core::loudness_meter meter(SAMPLE_RATE, { 1.0, 1.0 });
+	sine_source(meter).play(segments);
+
+	std::cout << name << ": I " << meter.integrated() << " LUFS" << std::endl;
+	CHECK(near(meter.integrated(), -23.0, 0.1));
+}
+
+// Tech 3341 cases 1 and 2, where momentary, short-term and integrated agree.
+void test_stationary()
+{
+	for (auto level : { -23.0, -33.0 })
+	{
+		core::loudness_meter meter(SAMPLE_RATE, { 1.0, 1.0 });
+		sine_source(meter).play({ { 20.0, level } });
+
+		std::cout << "stationary " << level << ": M " << meter.momentary() << " S " << meter.short_term() << " I " << meter.integrated() << std::endl;
+		CHECK(near(meter.momentary(), level, 0.1));
+		CHECK(near(meter.short_term(), level, 0.1));
+		CHECK(near(meter.integrated(), level, 0.1));
+	}
+}
+
+// Tech 3341 cases 3, 4 and 5: the relative gate removes the quiet parts, the
+// absolute gate the -72 dBFS parts.
+void test_gating()
+{
+	check_integrated("case 3", { { 10.0, -36.0 }, { 60.0, -23.0 }, { 10.0, -36.0 } });
+	check_integrated("case 4", { { 10.0, -72.0 }, { 10.0, -36.0 }, { 60.0, -23.0 }, { 10.0, -36.0 }, { 10.0, -72.0 } });
+	check_integrated("case 5", { { 20.0, -26.0 }, { 20.1, -20.0 }, { 20.0, -26.0 } });
+}
+
+// Only silence and audio below the absolute gate can not be measured.
+void test_silence()
+{
+	core::loudness_meter meter(SAMPLE_RATE, { 1.0, 1.0 });
+	sine_source(meter).play({ { 5.0, -80.0 } });
+
+	CHECK(std::isinf(meter.integrated()) && meter.integrated() < 0.0);
+}
+
+// Tech 3341 case 9: every 3 s window holds one 1.34 s burst at -20 dBFS and
+// 1.66 s at -30 dBFS, so the short-term loudness is constant at -23 LUFS.
+void test_short_term()
+{
+	core::loudness_meter meter(SAMPLE_RATE, { 1.0, 1.0 });
+	sine_source source(meter);
+
+	source.play({ { 1.34, -20.0 }, { 1.66, -30.0 } });
+
+	for (int n = 0; n < 19; ++n)
+	{
+		source.play({ { 1.34, -20.0 } });
+		CHECK(near(meter.short_term(), -23.0, 0.1));
+		source.play({ { 1.66, -30.0 } });
+		CHECK(near(meter.short_term(), -23.0, 0.1));
+	}
+
+	std::cout << "case 9: S " << meter.short_term() << " LUFS" << std::endl;
+}
+
+// Surround channels are weighted with 1.41 and LFE is ignored: L, R and C at
+// -28 dBFS, Ls and Rs at -30 dBFS and a loud LFE.
+void test_surround()
+{
+	core::audio_channel_layout layout(6, L"5.1", L"FL FR FC LFE SL SR");
+	auto weights = core::loudness_meter::channel_weights(layout);
+
+	CHECK(weights == std::vector<double>({ 1.0, 1.0, 1.0, 0.0, 1.41, 1.41 }));
+
+	core::loudness_meter meter(SAMPLE_RATE, weights);
+	sine_source(meter).play(20.0, { -28.0, -28.0, -28.0, -10.0, -30.0, -30.0 });
+
+	// The K-weighting is 0 dB at 1 kHz, within the tolerance.
+	auto expected = 10.0 * std::log10((3.0 * std::pow(10.0, -2.8) + 2.0 * 1.41 * std::pow(10.0, -3.0)) / 2.0);
+
+	std::cout << "surround: I " << meter.integrated() << " LUFS, expected " << expected << std::endl;
+	CHECK(near(meter.integrated(), expected, 0.1));
+}
+
+// A tone at a quarter of the sample rate with a 45 degree phase has its
+// samples 3 dB below the peak of the waveform. Tech 3341 allows true peak
+// meters +0.2/-0.4 dB.
+void test_true_peak()
+{
+	for (auto level : { -6.0, 0.0 })
+	{
+		core::loudness_meter meter(SAMPLE_RATE, { 1.0, 1.0 });
+		sine_source(meter).play(1.0, { level, level }, SAMPLE_RATE / 4.0, PI / 4.0);
+
+		std::cout << "true peak " << level << ": " << meter.max_true_peak() << " dBTP" << std::endl;
+		CHECK(meter.max_true_peak() <= level + 0.2);
+		CHECK(meter.max_true_peak() >= level - 0.4);
+		CHECK(meter.true_peak(0) == meter.true_peak(1));
+	}
+}
+
+void configure(const boost::filesystem::path& folder)
+{
+	{
+		std::ofstream file("loudness-test.config");
+		file << "<configuration><paths>";
+
+		for (auto path : { "media-path", "log-path", "data-path", "template-path", "thumbnail-path", "font-path" })
+			file << "<" << path << ">" << (folder / path).string() << "</" << path << ">";
+
+		file << "</paths><mixer><loudness-per-layer>true</loudness-per-layer></mixer></configuration>";
+	}
+
+	env::configure(L"loudness-test.config");
+	boost::filesystem::remove("loudness-test.config");
+}
+
+void test_layer_meters()
+{
+	const core::video_format_desc desc(core::video_format::x1080p5994);
+
+	auto stereo	= core::audio_channel_layout(2, L"stereo", L"FL FR");
+	core::audio_mixer mixer(spl::make_shared<diagnostics::graph>());
+
+	// One tick of the mixer with the layers on the stage, of which the
+	// audible ones play a tone.
+	auto tick = [&](std::set<int> layers, std::set<int> audible)
+	{
+		for (auto layer : layers)
+		{
+			mixer.set_current_layer(layer);
+
+			if (audible.count(layer))
+			{
+				core::mutable_frame frame(
+						{ },
+						core::mutable_audio_buffer(desc.audio_cadence.front() * stereo.num_channels, std::numeric_limits<std::int32_t>::max() / 4),
+						nullptr,
+						core::pixel_format_desc(core::pixel_format::invalid),
+						stereo);
+
+				mixer.visit(core::const_frame(std::move(frame)));
+			}
+		}
+
+		mixer(desc, stereo);
+	};
+	auto metered = [&]
+	{
+		std::set<int> layers;
+		auto info = mixer.loudness_info();
+
+		if (auto children = info.get_child_optional(L"layers"))
+			for (auto& layer : *children)
+				layers.insert(layer.second.get<int>(L"index"));
+
+		return layers;
+	};
+
+	for (int n = 0; n < 10; ++n)
+		tick({ 10, 20 }, { 10, 20 });
+
+	CHECK((metered() == std::set<int> { 10, 20 }));
+
+	// A layer without audio keeps its meter, fed with silence.
+	for (int n = 0; n < 10; ++n)
+		tick({ 10, 20 }, { 10 });
+
+	CHECK((metered() == std::set<int> { 10, 20 }));
+
+	tick({ 10 }, { 10 });
+	CHECK((metered() == std::set<int> { 10 }));
+
+	tick({ }, { });
+	CHECK(metered().empty());
+
+	std::cout << "layer meters: ok" << std::endl;
+}
+
+}
+
+int main()
+{
+	auto folder = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("loudness-test-%%%%%%%%");
+
+	auto result = test::run_tests("loudness-test", [&]
+	{
+		test_stationary();
+		test_gating();
+		test_silence();
+		test_short_term();
+		test_surround();
+		test_true_peak();
+
+		configure(folder);
+		test_layer_meters();
+	});
+
+	boost::filesystem::remove_all(folder);
+
+	return result;
+}
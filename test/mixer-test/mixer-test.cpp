@@ -0,0 +1,313 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Checks which layers find_occluding_layer lets the mixer skip: only layers
+// below one that the image mixer draws as opaque pixels over the whole output.
+// Checks that composite_cache only draws a tick again when something on it
+// changed, counting the frames drawn by an image mixer over repeated ticks.
+
+#include <core/mixer/composite_cache.h>
+#include <core/mixer/image/image_mixer.h>
+#include <core/mixer/occlusion.h>
+
+#include <test/common/frames.h>
+#include <test/common/test.h>
+
+#include <core/frame/draw_frame.h>
+#include <core/frame/frame.h>
+#include <core/frame/frame_transform.h>
+#include <core/frame/geometry.h>
+#include <core/frame/pixel_format.h>
+
+#include <core/video_format.h>
+
+#include <common/array.h>
+#include <common/future.h>
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+using namespace caspar;
+
+namespace {
+
+core::const_frame make_frame(core::pixel_format format, bool opaque)
+{
+	const int channels = format == core::pixel_format::gray ? 1 : 4;
+
+	return test::make_frame(std::make_shared<std::vector<std::uint8_t>>(16 * 9 * channels, 0xFF), format, 16, 9, channels, opaque);
+}
+
+core::draw_frame opaque_frame()
+{
+	return core::draw_frame(make_frame(core::pixel_format::bgra, true));
+}
+
+// The layer the mixer stops drawing below, or -1 if it draws every layer.
+int occluding_layer(const std::map<int, core::draw_frame>& layers)
+{
+	auto occluder = core::find_occluding_layer(layers);
+
+	return occluder == layers.end() ? -1 : occluder->first;
+}
+
+// Whether a transformed opaque frame over layer 10 hides it.
+bool occludes(const std::function<void(core::image_transform&)>& transform)
+{
+	auto frame = opaque_frame();
+	transform(frame.transform().image_transform);
+
+	std::map<int, core::draw_frame> layers;
+	layers[10] = opaque_frame();
+	layers[20] = frame;
+
+	return occluding_layer(layers) == 20;
+}
+
+void test_frames()
+{
+	CHECK(occludes([](core::image_transform&) { }));
+
+	std::map<int, core::draw_frame> layers;
+	layers[10] = opaque_frame();
+	layers[20] = core::draw_frame(make_frame(core::pixel_format::bgra, false));
+	CHECK(occluding_layer(layers) == 10);
+
+	// Formats without alpha are opaque without the flag.
+	layers[20] = core::draw_frame(make_frame(core::pixel_format::gray, false));
+	CHECK(occluding_layer(layers) == 20);
+
+	layers[20] = core::draw_frame::empty();
+	CHECK(occluding_layer(layers) == 10);
+
+	// The top most opaque layer.
+	layers[20] = opaque_frame();
+	layers[30] = opaque_frame();
+	CHECK(occluding_layer(layers) == 30);
+
+	CHECK(occluding_layer(std::map<int, core::draw_frame>()) == -1);
+
+	// Geometry that leaves part of the screen.
+	auto geometry = core::frame_geometry(core::frame_geometry::geometry_type::quad, {
+			{ 0.0, 0.0, 0.0, 0.0 }, { 0.5, 0.0, 1.0, 0.0 }, { 0.5, 1.0, 1.0, 1.0 }, { 0.0, 1.0, 0.0, 1.0 } });
+	layers.erase(30);
+	layers[20] = core::draw_frame(make_frame(core::pixel_format::bgra, true).with_geometry(geometry));
+	CHECK(occluding_layer(layers) == 10);
+
+	std::wcout << L"frames: opaque formats, flag and layer order" << std::endl;
+}
+
+void test_transforms()
+{
+	CHECK(!occludes([](core::image_transform& t) { t.opacity = 0.99; }));
+	CHECK(!occludes([](core::image_transform& t) { t.fill_scale[0] = 0.5; }));
+	CHECK(!occludes([](core::image_transform& t) { t.fill_translation[1] = 0.1; }));
+	CHECK(!occludes([](core::image_transform& t) { t.angle = 0.1; }));
+	CHECK(!occludes([](core::image_transform& t) { t.crop.lr[0] = 0.9; }));
+	CHECK(!occludes([](core::image_transform& t) { t.clip_scale[1] = 0.9; }));
+	CHECK(!occludes([](core::image_transform& t) { t.perspective.ur[0] = 0.9; }));
+	CHECK(!occludes([](core::image_transform& t) { t.blend_mode = core::blend_mode::multiply; }));
+	CHECK(!occludes([](core::image_transform& t) { t.is_mix = true; }));
+	CHECK(!occludes([](core::image_transform& t) { t.is_key = true; }));
+	CHECK(!occludes([](core::image_transform& t) { t.chroma.enable = true; }));
+	CHECK(!occludes([](core::image_transform& t) { t.field_mode = core::field_mode::upper; }));
+
+	// Still covering the screen.
+	CHECK(occludes([](core::image_transform& t) { t.fill_scale = { { 2.0, 2.0 } }; t.fill_translation = { { -0.5, -0.5 } }; }));
+	CHECK(occludes([](core::image_transform& t) { t.anchor = { { 0.5, 0.5 } }; t.fill_translation = { { 0.5, 0.5 } }; }));
+	CHECK(occludes([](core::image_transform& t) { t.fill_scale = { { -1.0, 1.0 } }; t.fill_translation = { { 1.0, 0.0 } }; }));
+	CHECK(occludes([](core::image_transform& t) { t.crop.ul = { { -0.1, -0.1 } }; t.clip_translation = { { -0.1, 0.0 } }; }));
+	CHECK(occludes([](core::image_transform& t) { t.opacity = 1.5; t.levels.max_output = 0.5; }));
+
+	// Composed down the tree like in the image mixer.
+	auto child = opaque_frame();
+	child.transform().image_transform.fill_scale = { { 2.0, 2.0 } };
+	core::draw_frame parent(std::vector<core::draw_frame> { child });
+	parent.transform().image_transform.fill_scale = { { 0.5, 0.5 } };
+
+	std::map<int, core::draw_frame> layers;
+	layers[10] = opaque_frame();
+	layers[20] = parent;
+	CHECK(occluding_layer(layers) == 20);
+
+	parent.transform().image_transform.opacity = 0.5;
+	layers[20] = parent;
+	CHECK(occluding_layer(layers) == 10);
+
+	std::wcout << L"transforms: only full screen, full opacity and normal blending" << std::endl;
+}
+
+void test_fields_and_keys()
+{
+	std::map<int, core::draw_frame> layers;
+	layers[10] = opaque_frame();
+
+	// Both fields opaque.
+	layers[20] = core::draw_frame::interlace(opaque_frame(), opaque_frame(), core::field_mode::upper);
+	CHECK(occluding_layer(layers) == 20);
+
+	layers[20] = core::draw_frame::interlace(opaque_frame(), core::draw_frame(make_frame(core::pixel_format::bgra, false)), core::field_mode::upper);
+	CHECK(occluding_layer(layers) == 10);
+
+	// A masked layer is not opaque.
+	layers[20] = core::draw_frame::mask(opaque_frame(), opaque_frame());
+	CHECK(occluding_layer(layers) == 10);
+
+	// A key in the layer below masks the layer above it.
+	auto key = opaque_frame();
+	key.transform().image_transform.is_key = true;
+	layers[20] = key;
+	layers[30] = opaque_frame();
+	CHECK(occluding_layer(layers) == 10);
+
+	layers[40] = opaque_frame();
+	CHECK(occluding_layer(layers) == 40);
+
+	std::wcout << L"fields and keys: both fields needed, masked layers drawn" << std::endl;
+}
+
+// Counts what an image mixer would blend.
+class counting_image_mixer : public core::image_mixer
+{
+public:
+	int blends	= 0;
+	int renders	= 0;
+
+	void push(const core::frame_transform&) override
+	{
+	}
+
+	void visit(const core::const_frame&) override
+	{
+		++blends;
+	}
+
+	void pop() override
+	{
+	}
+
+	std::future<array<const std::uint8_t>> operator()(const core::video_format_desc& format_desc, bool) override
+	{
+		++renders;
+
+		auto image = std::make_shared<std::vector<std::uint8_t>>(format_desc.size);
+		return make_ready_future(array<const std::uint8_t>(image->data(), image->size(), false, image));
+	}
+
+	core::mutable_frame create_frame(const void*, const core::pixel_format_desc&, const core::audio_channel_layout&) override
+	{
+		throw std::logic_error("not used");
+	}
+
+	int get_max_frame_size() override
+	{
+		return 0;
+	}
+};
+
+void test_composite_cache()
+{
+	counting_image_mixer mixer;
+	core::composite_cache cache;
+	core::video_format_desc format_desc(core::video_format::x1080p5000);
+
+	// A paused clip under a still graphic.
+	auto clip		= opaque_frame();
+	auto graphic	= core::draw_frame(make_frame(core::pixel_format::bgra, false));
+	graphic.transform().image_transform.fill_scale = { { 0.5, 0.5 } };
+
+	std::vector<core::draw_frame> layers { clip, graphic };
+	auto first = cache(layers, mixer, format_desc, false).get();
+
+	for (int tick = 0; tick < 100; ++tick)
+	{
+		// A new tree every tick, like the stage sends.
+		std::vector<core::draw_frame> same_layers { core::draw_frame(clip), core::draw_frame(graphic) };
+		CHECK(cache(same_layers, mixer, format_desc, false).get().begin() == first.begin());
+		CHECK(cache.reused());
+	}
+
+	CHECK(mixer.blends == 2);
+	CHECK(mixer.renders == 1);
+
+	// Anything that changes the image is drawn again.
+	auto moved = graphic;
+	moved.transform().image_transform.fill_translation[0] = 0.25;
+	auto levels = graphic;
+	levels.transform().image_transform.levels.gamma = 0.8;
+	auto new_image = core::draw_frame(make_frame(core::pixel_format::bgra, false));
+
+	for (auto& changed : std::vector<std::vector<core::draw_frame>> {
+			{ clip, moved },
+			{ clip, levels },
+			{ clip, new_image },
+			{ clip },
+			{ clip, graphic, graphic },
+			{ core::draw_frame(std::vector<core::draw_frame> { clip, graphic }) } })
+	{
+		cache(layers, mixer, format_desc, false);
+
+		auto renders = mixer.renders;
+		cache(changed, mixer, format_desc, false);
+		CHECK(!cache.reused() && mixer.renders == renders + 1);
+		cache(changed, mixer, format_desc, false);
+		CHECK(cache.reused() && mixer.renders == renders + 1);
+	}
+
+	auto renders = mixer.renders;
+	cache(layers, mixer, format_desc, false);
+	cache(layers, mixer, format_desc, true);
+	cache(layers, mixer, core::video_format_desc(core::video_format::x1080i5000), true);
+	CHECK(mixer.renders == renders + 3);
+
+	// The same buffers with other geometry is another image.
+	core::const_frame image = make_frame(core::pixel_format::bgra, false);
+	auto geometry = core::frame_geometry(core::frame_geometry::geometry_type::quad, {
+			{ 0.0, 0.0, 0.0, 0.0 }, { 0.5, 0.0, 1.0, 0.0 }, { 0.5, 1.0, 1.0, 1.0 }, { 0.0, 1.0, 0.0, 1.0 } });
+	CHECK(image.with_geometry(geometry).image_id() == image.image_id());
+	CHECK(image.key_only().image_id() != image.image_id());
+
+	renders = mixer.renders;
+	cache({ core::draw_frame(core::const_frame(image)) }, mixer, format_desc, false);
+	cache({ core::draw_frame(image.with_geometry(geometry)) }, mixer, format_desc, false);
+	cache({ core::draw_frame(image.with_geometry(geometry)) }, mixer, format_desc, false);
+	CHECK(mixer.renders == renders + 2);
+
+	std::wcout << L"composite_cache: 101 identical ticks blended 2 frames once" << std::endl;
+}
+
+}
+
+int main()
+{
+	return test::run_tests("mixer-test", []
+	{
+		core::detail::set_current_aspect_ratio(16.0 / 9.0);
+
+		test_frames();
+		test_transforms();
+		test_fields_and_keys();
+		test_composite_cache();
+	});
+}
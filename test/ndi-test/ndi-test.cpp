@@ -0,0 +1,215 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Round trips ancillary data through the <caspar_anc> NDI frame metadata and
+// checks that malformed metadata is rejected without adding packets. None of
+// this needs the NDI SDK.
+
+#include <modules/newtek/util/ndi_ancillary.h>
+
+#include <core/ancillary/ancillary.h>
+
+#include <test/common/test.h>
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace caspar { namespace test {
+
+using namespace core::ancillary;
+using namespace newtek::ndi;
+
+namespace {
+
+struct packet_data
+{
+	std::uint8_t				did;
+	std::uint8_t				sdid;
+	std::vector<std::uint8_t>	data;
+
+	bool operator==(const packet_data& other) const
+	{
+		return did == other.did && sdid == other.sdid && data == other.data;
+	}
+};
+
+std::vector<packet_data> packets(AncillaryContainer& container)
+{
+	std::vector<packet_data> result;
+
+	for (auto& data : container.takeAll())
+	{
+		packet_data packet;
+		data->getVancID(packet.did, packet.sdid);
+		packet.data = data->getData();
+		result.push_back(packet);
+	}
+
+	return result;
+}
+
+AncillaryContainer random_container(std::uint32_t seed, std::vector<packet_data>& expected)
+{
+	AncillaryContainer container;
+	auto sizes = noise(64, seed);
+
+	for (std::size_t n = 0; n < static_cast<std::size_t>(sizes[0] % 10); ++n)
+	{
+		// Sizes past 255 too, the metadata has a 16 bit size unlike a VANC packet.
+		auto bytes = noise((sizes[n + 1] << 2) + 2, seed * 64 + static_cast<std::uint32_t>(n));
+		packet_data packet { bytes[0], bytes[1], std::vector<std::uint8_t>(bytes.begin() + 2, bytes.end()) };
+		container.addData(std::make_shared<RawAncillaryData>(packet.did, packet.sdid, packet.data));
+		expected.push_back(packet);
+	}
+
+	return container;
+}
+
+void test_round_trip()
+{
+	ancillary_metadata_writer writer;
+
+	for (std::uint32_t seed = 1; seed <= 2000; ++seed)
+	{
+		std::vector<packet_data> expected;
+		auto container = random_container(seed, expected);
+
+		// The writer reuses its buffers, every frame starts from scratch.
+		auto& metadata = writer.write(container);
+
+		if (expected.empty())
+		{
+			CHECK(metadata.empty());
+			continue;
+		}
+
+		std::size_t size = 0;
+
+		for (auto& packet : expected)
+			size += 4 + packet.data.size();
+
+		CHECK(metadata.size() == std::string("<caspar_anc></caspar_anc>").size() + size * 2);
+		CHECK(metadata.find("<caspar_anc>") == 0);
+
+		AncillaryContainer received;
+		CHECK(read_ancillary_metadata(metadata.c_str(), received));
+		CHECK(packets(received) == expected);
+	}
+
+	std::cout << "ndi metadata round trip: ok" << std::endl;
+}
+
+void test_format()
+{
+	AncillaryContainer container;
+	container.addData(std::make_shared<RawAncillaryData>(0x61, 0x01, std::vector<std::uint8_t> { 0x96, 0x69 }));
+	container.addData(std::make_shared<RawAncillaryData>(0x41, 0x07, std::vector<std::uint8_t>()));
+
+	ancillary_metadata_writer writer;
+	CHECK(writer.write(container) == "<caspar_anc>610100029669" "41070000</caspar_anc>");
+
+	// Upper case digits and other metadata around the element are accepted, packets are appended.
+	AncillaryContainer received;
+	received.addData(std::make_shared<RawAncillaryData>(0x80, 0x00, std::vector<std::uint8_t> { 1 }));
+	CHECK(read_ancillary_metadata("<ndi_format version=\"1\"/><caspar_anc>610100029669" "41070000</caspar_anc><other/>", received));
+	CHECK(read_ancillary_metadata("<caspar_anc>8001000AFF</caspar_anc>", received) == false);
+	CHECK(read_ancillary_metadata("<caspar_anc>80010001FF</caspar_anc>", received));
+
+	auto types = received.takeAll();
+	CHECK(types.size() == 4);
+	CHECK(types[1]->getType() == ancillary_data_type_cea708);
+	CHECK(types[2]->getType() == ancillary_data_type_scte_104);
+	CHECK(types[3]->getData() == std::vector<std::uint8_t> { 0xff });
+
+	std::cout << "ndi metadata format: ok" << std::endl;
+}
+
+void test_malformed()
+{
+	const std::vector<const char*> malformed
+	{
+		nullptr,
+		"",
+		"<other/>",
+		"<caspar_anc>610100029669",							// no close tag
+		"<caspar_anc>61010002966</caspar_anc>",				// odd number of digits
+		"<caspar_anc>6101000296xz</caspar_anc>",			// not hex
+		"<caspar_anc>610100039669</caspar_anc>",			// size past the end
+		"<caspar_anc>61010002966941</caspar_anc>",			// a partial packet header after a good packet
+		"<caspar_anc>610100029669 4107</caspar_anc>",
+	};
+
+	for (auto metadata : malformed)
+	{
+		AncillaryContainer received;
+		CHECK(!read_ancillary_metadata(metadata, received));
+		CHECK(received.empty());
+	}
+
+	// An empty element is well formed and adds nothing.
+	AncillaryContainer received;
+	CHECK(read_ancillary_metadata("<caspar_anc></caspar_anc>", received));
+	CHECK(received.empty());
+
+	// Noise never crashes and never leaves part of the packets behind.
+	for (std::uint32_t seed = 1; seed <= 2000; ++seed)
+	{
+		std::vector<packet_data> expected;
+		auto container = random_container(seed, expected);
+		auto metadata = ancillary_metadata_writer().write(container);
+
+		if (metadata.empty())
+			continue;
+
+		auto random = noise(4, seed);
+		auto damaged = metadata;
+		damaged[12 + (random[0] | random[1] << 8) % (metadata.size() - 25)] = "0123456789abcdefxX<"[random[2] % 19];
+
+		AncillaryContainer out;
+
+		if (read_ancillary_metadata(damaged.c_str(), out))
+			CHECK(!out.empty() || expected.empty());
+		else
+			CHECK(out.empty());
+
+		auto cut = metadata.substr(0, (random[3] * metadata.size()) / 256);
+		out.clear();
+		CHECK(!read_ancillary_metadata(cut.c_str(), out));
+		CHECK(out.empty());
+	}
+
+	std::cout << "ndi metadata malformed: ok" << std::endl;
+}
+
+}
+
+}}
+
+int main()
+{
+	return caspar::test::run_tests("ndi-test", []
+	{
+		caspar::test::test_round_trip();
+		caspar::test::test_format();
+		caspar::test::test_malformed();
+	});
+}
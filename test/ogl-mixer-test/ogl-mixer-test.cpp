@@ -0,0 +1,201 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Draws fill and key pairs through the OpenGL image mixer, once with the key
+// sampled in the draw of the fill and once through the key texture, and
+// checks that both give the same image. Passes without drawing anything when
+// no OpenGL device can be created.
+
+#include <accelerator/ogl/image/image_mixer.h>
+#include <accelerator/ogl/util/device.h>
+
+#include <test/common/test.h>
+
+#include <core/frame/audio_channel_layout.h>
+#include <core/frame/draw_frame.h>
+#include <core/frame/frame.h>
+#include <core/frame/frame_transform.h>
+#include <core/frame/pixel_format.h>
+#include <core/video_format.h>
+
+#include <common/array.h>
+#include <common/memory.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+using namespace caspar;
+
+namespace {
+
+typedef std::vector<std::uint8_t> image;
+
+core::pixel_format_desc bgra(int width, int height)
+{
+	core::pixel_format_desc desc(core::pixel_format::bgra);
+	desc.planes.push_back(core::pixel_format_desc::plane(width, height, 4));
+	return desc;
+}
+
+core::pixel_format_desc ycbcr(int width, int height)
+{
+	core::pixel_format_desc desc(core::pixel_format::ycbcr);
+	desc.planes.push_back(core::pixel_format_desc::plane(width, height, 1));
+	desc.planes.push_back(core::pixel_format_desc::plane(width / 2, height / 2, 1));
+	desc.planes.push_back(core::pixel_format_desc::plane(width / 2, height / 2, 1));
+	return desc;
+}
+
+// A frame from the mixer's frame factory, like producers get them.
+core::draw_frame make_frame(core::frame_factory& factory, const core::pixel_format_desc& desc, std::uint32_t seed)
+{
+	auto frame = factory.create_frame(nullptr, desc, core::audio_channel_layout::invalid());
+
+	for (std::size_t n = 0; n < desc.planes.size(); ++n)
+	{
+		auto pixels = test::noise(desc.planes[n].size, seed + static_cast<std::uint32_t>(n));
+		std::copy(pixels.begin(), pixels.end(), frame.image_data(n).begin());
+	}
+
+	return core::draw_frame(std::move(frame));
+}
+
+// What draw_frame::mask returned before keys could be paired with their fill.
+core::draw_frame unpaired_mask(core::draw_frame fill, core::draw_frame key)
+{
+	std::vector<core::draw_frame> frames;
+	key.transform().image_transform.is_key = true;
+	frames.push_back(std::move(key));
+	frames.push_back(std::move(fill));
+	return core::draw_frame(std::move(frames));
+}
+
+image render(core::image_mixer& mixer, const core::draw_frame& frame, const core::video_format_desc& format_desc)
+{
+	auto layer = core::draw_frame::push(frame);
+	layer.transform().image_transform.layer_depth = 1;
+	layer.accept(mixer);
+
+	auto result = mixer(format_desc, false).get();
+
+	return image(result.begin(), result.end());
+}
+
+// The key texture holds 8 bit values, the paired key is not rounded before it is applied.
+void check_same(const image& paired, const image& unpaired)
+{
+	CHECK(paired.size() == unpaired.size());
+
+	int max_difference = 0;
+
+	for (std::size_t n = 0; n < paired.size(); ++n)
+		max_difference = std::max(max_difference, std::abs(paired[n] - unpaired[n]));
+
+	CHECK(max_difference <= 1);
+	CHECK(std::any_of(paired.begin(), paired.end(), [](std::uint8_t value) { return value != 0; }));
+}
+
+void test_paired_key(core::image_mixer& mixer, const std::wstring& name)
+{
+	core::video_format_desc progressive(core::video_format::x720p5000);
+	core::video_format_desc interlaced(core::video_format::pal);
+
+	auto fill	= make_frame(mixer, bgra(320, 180), 1);
+	auto key	= make_frame(mixer, bgra(320, 180), 2);
+
+	check_same(
+			render(mixer, core::draw_frame::mask(fill, key), progressive),
+			render(mixer, unpaired_mask(fill, key), progressive));
+
+	// The transform of the layer applies to both.
+	auto transformed	= core::draw_frame::push(core::draw_frame::mask(fill, key));
+	auto transformed_unpaired = core::draw_frame::push(unpaired_mask(fill, key));
+
+	for (auto frame : { &transformed, &transformed_unpaired })
+	{
+		auto& transform = frame->transform().image_transform;
+		transform.opacity				= 0.6;
+		transform.fill_scale			= { 0.5, 0.7 };
+		transform.fill_translation		= { 0.2, 0.1 };
+		transform.levels.gamma			= 1.3;
+		transform.brightness			= 1.2;
+	}
+
+	check_same(render(mixer, transformed, progressive), render(mixer, transformed_unpaired, progressive));
+
+	// A key in another pixel format than its fill, on both fields.
+	auto sd_fill	= make_frame(mixer, bgra(720, 576), 3);
+	auto sd_key		= make_frame(mixer, ycbcr(720, 576), 4);
+
+	check_same(
+			render(mixer, core::draw_frame::mask(sd_fill, sd_key), interlaced),
+			render(mixer, unpaired_mask(sd_fill, sd_key), interlaced));
+
+	// A key drawn before the pair adds to the paired key.
+	auto extra_key = make_frame(mixer, bgra(320, 180), 5);
+	extra_key.transform().image_transform.is_key = true;
+
+	check_same(
+			render(mixer, core::draw_frame({ extra_key, core::draw_frame::mask(fill, key) }), progressive),
+			render(mixer, core::draw_frame({ extra_key, unpaired_mask(fill, key) }), progressive));
+
+	// A key transformed apart from its fill.
+	auto moved_key = key;
+	moved_key.transform().image_transform.fill_translation = { 0.25, 0.0 };
+
+	check_same(
+			render(mixer, core::draw_frame::mask(fill, moved_key), progressive),
+			render(mixer, unpaired_mask(fill, moved_key), progressive));
+
+	std::wcout << name << L": paired key same as the key texture" << std::endl;
+}
+
+}
+
+int main()
+{
+	return test::run_tests("ogl-mixer-test", []
+	{
+		std::shared_ptr<accelerator::ogl::device> ogl;
+
+		try
+		{
+			ogl = std::make_shared<accelerator::ogl::device>();
+		}
+		catch (...)
+		{
+			std::wcout << L"no OpenGL device, nothing drawn" << std::endl;
+			return;
+		}
+
+		// The mixers of a device share their shader, so one at a time.
+		{
+			accelerator::ogl::image_mixer mixer(spl::make_shared_ptr(ogl), false, false, 1);
+			test_paired_key(mixer, L"simple blending");
+		}
+		{
+			accelerator::ogl::image_mixer mixer(spl::make_shared_ptr(ogl), true, false, 2);
+			test_paired_key(mixer, L"blend modes");
+		}
+	});
+}
@@ -1,71 +1,516 @@
-// psd-test.cpp : Defines the entry point for the console application.
-//
+/*
+* Copyright (c) 2021 in2ip B.V.
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Gijs Peskens <gijs@in2ip.nl>
+*/
 
-#include "stdafx.h"
-#include "../../modules/psd/doc.h"
-#include "../../modules/psd/layer.h"
-#include "../../common/utf.h"
+// Without arguments, generates PSD files covering raw and RLE (PackBits) channel data, layer masks and
+// the document cache, verifies the decoded pixels and prints load-time benchmarks. With a filename,
+// dumps the parsed structure of that document as xml, like the old psd-test did.
 
-#include <sstream>
-#include <iostream>
+#include <modules/psd/psd_document.h>
+#include <modules/psd/psd_document_cache.h>
+#include <modules/psd/layer.h>
+
+#include <test/common/test.h>
 
+#include <common/utf.h>
+
+#include <boost/filesystem.hpp>
 #include <boost/property_tree/ptree.hpp>
-#include <boost/property_tree/detail/file_parser_error.hpp>
 #include <boost/property_tree/xml_parser.hpp>
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace caspar;
+
+namespace {
+
+typedef std::function<std::uint8_t (int channel, int x, int y)> pixel_source;
+
+enum class encoding { raw = 0, rle = 1 };
+
+struct test_layer
+{
+	std::string		name;
+	int				left;
+	int				top;
+	int				width;
+	int				height;
+	encoding		compression;
+	bool			has_alpha;
+	bool			has_mask;
+	pixel_source	pixels;		// channel is the psd channel id, -1 for alpha, -2 for the mask
+};
+
+class writer
+{
+	std::vector<std::uint8_t> data_;
+public:
+	void u8(std::uint8_t value)		{ data_.push_back(value); }
+	void u16(std::uint16_t value)	{ u8(value >> 8); u8(value & 0xff); }
+	void u32(std::uint32_t value)	{ u16(value >> 16); u16(value & 0xffff); }
+	void tag(const char* value)		{ data_.insert(data_.end(), value, value + 4); }
+	void bytes(const std::vector<std::uint8_t>& value) { data_.insert(data_.end(), value.begin(), value.end()); }
+
+	std::size_t position() const { return data_.size(); }
+	void patch_u32(std::size_t position, std::uint32_t value)
+	{
+		for (int i = 0; i < 4; ++i)
+			data_[position + i] = static_cast<std::uint8_t>(value >> (24 - i * 8));
+	}
+
+	const std::vector<std::uint8_t>& data() const { return data_; }
+};
+
+std::vector<std::uint8_t> pack_bits(const std::uint8_t* row, int width)
+{
+	std::vector<std::uint8_t> result;
+	int x = 0;
+
+	while (x < width)
+	{
+		int run = 1;
+		while (x + run < width && run < 128 && row[x + run] == row[x])
+			++run;
+
+		if (run > 1)
+		{
+			result.push_back(static_cast<std::uint8_t>(1 - run));
+			result.push_back(row[x]);
+			x += run;
+		}
+		else
+		{
+			int literal = 1;
+			while (x + literal < width && literal < 128 && (x + literal + 1 >= width || row[x + literal] != row[x + literal + 1]))
+				++literal;
+
+			result.push_back(static_cast<std::uint8_t>(literal - 1));
+			result.insert(result.end(), row + x, row + x + literal);
+			x += literal;
+		}
+	}
+
+	return result;
+}
+
+std::vector<std::uint8_t> encode_channel(const test_layer& layer, int channel, int width, int height)
+{
+	writer out;
+	std::vector<std::uint8_t> plane(width * height);
+
+	for (int y = 0; y < height; ++y)
+		for (int x = 0; x < width; ++x)
+			plane[y * width + x] = layer.pixels(channel, x, y);
+
+	out.u16(static_cast<std::uint16_t>(layer.compression));
+
+	if (layer.compression == encoding::raw)
+		out.bytes(plane);
+	else
+	{
+		std::vector<std::vector<std::uint8_t>> rows;
+		for (int y = 0; y < height; ++y)
+			rows.push_back(pack_bits(&plane[y * width], width));
+
+		for (auto& row : rows)
+			out.u16(static_cast<std::uint16_t>(row.size()));
+
+		for (auto& row : rows)
+		{
+			// A -128 header byte is a no-op that encoders are allowed to emit.
+			out.u8(0x80);
+			out.bytes(row);
+		}
+	}
+
+	return out.data();
+}
 
-int _tmain(int argc, _TCHAR* argv[])
+void write_psd(const std::wstring& filename, int width, int height, const std::vector<test_layer>& layers)
 {
-	if(argc > 1)
+	writer out;
+
+	out.tag("8BPS");
+	out.u16(1);
+	for (int i = 0; i < 6; ++i)
+		out.u8(0);
+	out.u16(3);
+	out.u32(height);
+	out.u32(width);
+	out.u16(8);
+	out.u16(3);		// rgb
+
+	out.u32(0);		// color mode data
+	out.u32(0);		// image resources
+
+	auto layer_and_mask = out.position();
+	out.u32(0);
+	auto layer_info = out.position();
+	out.u32(0);
+	out.u16(static_cast<std::uint16_t>(layers.size()));
+
+	std::vector<std::vector<std::pair<int, std::vector<std::uint8_t>>>> channel_data;
+
+	for (auto& layer : layers)
 	{
-		caspar::psd::psd_document doc;
-		if(doc.parse(argv[1]))
+		std::vector<std::pair<int, std::vector<std::uint8_t>>> channels;
+
+		if (layer.has_alpha)
+			channels.push_back(std::make_pair(-1, encode_channel(layer, -1, layer.width, layer.height)));
+		for (int channel = 0; channel < 3; ++channel)
+			channels.push_back(std::make_pair(channel, encode_channel(layer, channel, layer.width, layer.height)));
+		if (layer.has_mask)
+			channels.push_back(std::make_pair(-2, encode_channel(layer, -2, layer.width / 2, layer.height / 2)));
+
+		out.u32(layer.top);
+		out.u32(layer.left);
+		out.u32(layer.top + layer.height);
+		out.u32(layer.left + layer.width);
+		out.u16(static_cast<std::uint16_t>(channels.size()));
+		for (auto& channel : channels)
 		{
-			std::wstringstream trace;
-
-			trace << L"<doc filename='" << doc.filename() << L"' color_mode='" << caspar::psd::color_mode_to_string(doc.color_mode()) << L"' color_depth='" << doc.color_depth() << L"' channel_count='" << doc.channels_count() << L"' width='" << doc.width() << L"' height='" << doc.height() << L"'>" << std::endl;
-			if(doc.has_timeline())
-			{
-				trace << L"<timeline>" << std::endl;
-					boost::property_tree::xml_writer_settings<std::wstring> w(' ', 3);
-					boost::property_tree::write_xml(trace, doc.timeline(), w);
-
-				trace << L"</timeline>" << std::endl;
-
-			}
-	
-			auto end = doc.layers().end();
-			for(auto it = doc.layers().begin(); it != end; ++it)
-			{
-				caspar::psd::layer_ptr layer = (*it);
-				trace << L"	<layer name='" << layer->name() << L"' opacity='" << layer->opacity() << L"' visible='" << layer->is_visible() << L"' protected='" << layer->is_position_protected() << L"'>" << std::endl;
-				if(layer->bitmap())
-					trace << L"		<bounding-box x='" << layer->location().x << L"' y='" << layer->location().y << L"' width='" << layer->bitmap()->width() << L"' height='" << layer->bitmap()->height() << L"' />" << std::endl;
-				//if(layer->mask())
-				//	trace << L"		<mask default-value='" << layer->mask_info().default_value_ << L"' enabled=" << layer->mask_info().enabled() << L" linked=" << layer->mask_info().linked() << L" inverted=" << layer->mask_info().inverted() << L" left='" << layer->mask_info().rect_.left << L"' top='" << layer->mask_info().rect_.top << "' right='" << layer->mask_info().rect_.right << "' bottom='" << layer->mask_info().rect_.bottom << "' />" << std::endl;
-				if(layer->is_text())
-				{
-					trace << L"			<text value='" << (*it)->text_data().get(L"EngineDict.Editor.Text", L"") << L"' />" << std::endl;
-					boost::property_tree::xml_writer_settings<std::wstring> w(' ', 3);
-					boost::property_tree::write_xml(trace, (*it)->text_data(), w);
-				}
-				if(layer->has_timeline())
-				{
-					trace << L"			<timeline>" << std::endl;
-					boost::property_tree::xml_writer_settings<std::wstring> w(' ', 3);
-					boost::property_tree::write_xml(trace, (*it)->timeline_data(), w);
-					trace << L"			</timeline>" << std::endl;
-				}
-				trace << L"	</layer>" << std::endl;
-			}
-
-			trace << L"</doc>" << std::endl;
-	
-			std::ofstream log("psd-log.txt");
-			log << caspar::u8(trace.str());
-			std::cout << caspar::u8(trace.str());
+			out.u16(static_cast<std::uint16_t>(channel.first));
+			out.u32(static_cast<std::uint32_t>(channel.second.size()));
 		}
+
+		out.tag("8BIM");
+		out.tag("norm");
+		out.u8(255);	// opacity
+		out.u8(0);		// clipping
+		out.u8(0);		// flags
+		out.u8(0);		// filler
+
+		auto extras = out.position();
+		out.u32(0);
+
+		if (layer.has_mask)
+		{
+			out.u32(20);
+			out.u32(layer.top);
+			out.u32(layer.left);
+			out.u32(layer.top + layer.height / 2);
+			out.u32(layer.left + layer.width / 2);
+			out.u8(0);	// default value
+			out.u8(0);	// flags
+			out.u16(0);	// padding
+		}
+		else
+			out.u32(0);
+
+		out.u32(0);		// blending ranges
+
+		auto padded_name_length = (layer.name.size() + 1 + 3) / 4 * 4;
+		out.u8(static_cast<std::uint8_t>(layer.name.size()));
+		for (std::size_t i = 0; i < padded_name_length - 1; ++i)
+			out.u8(i < layer.name.size() ? layer.name[i] : 0);
+
+		out.tag("8BIM");
+		out.tag("luni");
+		out.u32(static_cast<std::uint32_t>(4 + layer.name.size() * 2));
+		out.u32(static_cast<std::uint32_t>(layer.name.size()));
+		for (auto c : layer.name)
+			out.u16(c);
+
+		out.patch_u32(extras, static_cast<std::uint32_t>(out.position() - extras - 4));
+		channel_data.push_back(std::move(channels));
+	}
+
+	for (auto& channels : channel_data)
+		for (auto& channel : channels)
+			out.bytes(channel.second);
+
+	if (out.position() % 2)
+		out.u8(0);
+
+	out.patch_u32(layer_info, static_cast<std::uint32_t>(out.position() - layer_info - 4));
+	out.u32(0);		// global layer mask info
+	out.patch_u32(layer_and_mask, static_cast<std::uint32_t>(out.position() - layer_and_mask - 4));
+
+	std::ofstream file(boost::filesystem::path(filename).string(), std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char*>(out.data().data()), out.data().size());
+}
+
+std::uint8_t premultiplied(std::uint8_t value, std::uint8_t alpha)
+{
+	return static_cast<std::uint8_t>(value * alpha / 255);
+}
+
+void verify_layer(const psd::layer_ptr& actual, const test_layer& expected)
+{
+	CHECK(actual->name() == u16(expected.name));
+	CHECK(actual->location().x == expected.left);
+	CHECK(actual->location().y == expected.top);
+	CHECK(actual->bitmap());
+	CHECK(actual->bitmap()->width() == expected.width);
+	CHECK(actual->bitmap()->height() == expected.height);
+
+	auto pixels = actual->bitmap()->data();
+
+	for (int y = 0; y < expected.height; ++y)
+	{
+		for (int x = 0; x < expected.width; ++x)
+		{
+			auto pixel = pixels + (y * expected.width + x) * 4;
+			std::uint8_t alpha = expected.has_alpha ? expected.pixels(-1, x, y) : 255;
+
+			CHECK(pixel[3] == alpha);
+			CHECK(pixel[2] == premultiplied(expected.pixels(0, x, y), alpha));
+			CHECK(pixel[1] == premultiplied(expected.pixels(1, x, y), alpha));
+			CHECK(pixel[0] == premultiplied(expected.pixels(2, x, y), alpha));
+		}
+	}
+
+	CHECK(static_cast<bool>(actual->mask().bitmap()) == expected.has_mask);
+
+	if (expected.has_mask)
+	{
+		auto& mask = actual->mask().bitmap();
+		CHECK(mask->width() == expected.width / 2);
+		CHECK(mask->height() == expected.height / 2);
+
+		for (int y = 0; y < mask->height(); ++y)
+			for (int x = 0; x < mask->width(); ++x)
+				CHECK(mask->data()[y * mask->width() + x] == expected.pixels(-2, x, y));
 	}
-	return 0;
 }
 
+std::uint8_t gradient(int channel, int x, int y)
+{
+	return static_cast<std::uint8_t>(x * (channel + 3) + y * 7);
+}
+
+std::uint8_t flat_runs(int channel, int x, int y)
+{
+	// Long runs separated by short literals, the kind of content graphics templates have.
+	return (x / 37 + y / 11) % 3 == 0 ? static_cast<std::uint8_t>(x ^ y ^ channel) : static_cast<std::uint8_t>(64 * (channel + 2));
+}
+
+std::vector<test_layer> sample_layers()
+{
+	return {
+		{ "raw gradient",		0,	0,	67,	31,	encoding::raw,	false,	false,	gradient },
+		{ "rle runs",			5,	3,	300,	40,	encoding::rle,	true,	false,	flat_runs },
+		{ "rle with mask",		20,	10,	130,	64,	encoding::rle,	true,	true,	gradient },
+		{ "raw with mask",		1,	2,	33,	17,	encoding::raw,	true,	true,	flat_runs },
+	};
+}
+
+void test_decode(const std::wstring& filename)
+{
+	auto layers = sample_layers();
+	write_psd(filename, 400, 120, layers);
+
+	psd::psd_document doc;
+	doc.parse(filename);
+
+	CHECK(doc.width() == 400);
+	CHECK(doc.height() == 120);
+	CHECK(doc.layers().size() == layers.size());
+
+	for (std::size_t i = 0; i < layers.size(); ++i)
+		verify_layer(doc.layers()[i], layers[i]);
+
+	std::wcout << L"decode: " << layers.size() << L" layers ok" << std::endl;
+}
+
+void test_cache(const std::wstring& filename, const std::wstring& other_filename)
+{
+	auto layers = sample_layers();
+	write_psd(filename, 400, 120, layers);
+	write_psd(other_filename, 400, 120, layers);
+
+	psd::psd_document_cache cache(16 * 1024 * 1024);
+
+	auto first = cache.load(filename);
+	CHECK(cache.load(filename) == first);
+
+	// An edited template has to be parsed again.
+	layers[0].pixels = flat_runs;
+	write_psd(filename, 400, 120, layers);
+	boost::filesystem::last_write_time(filename, boost::filesystem::last_write_time(filename) + 10);
+
+	auto edited = cache.load(filename);
+	CHECK(edited != first);
+	verify_layer(edited->layers()[0], layers[0]);
+	CHECK(cache.load(filename) == edited);
+
+	auto info = cache.info();
+	CHECK(info.get<int>(L"hits") == 2);
+	CHECK(info.get<int>(L"misses") == 2);
+
+	// With room for a single document the least recently used one is evicted.
+	psd::psd_document_cache small_cache(cache.info().get<std::size_t>(L"size-bytes"));
+	auto a = small_cache.load(filename);
+	auto b = small_cache.load(other_filename);
+	CHECK(small_cache.load(other_filename) == b);
+	CHECK(small_cache.load(filename) != a);
+	CHECK(small_cache.info().get<int>(L"evictions") == 2);
+
+	psd::psd_document_cache no_cache(0);
+	CHECK(no_cache.load(filename) != no_cache.load(filename));
+
+	std::wcout << L"cache: ok" << std::endl;
+}
+
+void test_corrupt_rle(const std::wstring& filename)
+{
+	// Runs that claim more bytes than the row holds must be clamped, not overflow the bitmap.
+	test_layer layer { "corrupt", 0, 0, 16, 4, encoding::rle, false, false, gradient };
+	write_psd(filename, 16, 4, { layer });
+
+	std::vector<char> data;
+	{
+		std::ifstream file(boost::filesystem::path(filename).string(), std::ios::binary);
+		data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	}
+
+	// Turn the headers of the first rows in every channel into maximum length repeats.
+	for (std::size_t i = 0; i + 1 < data.size(); ++i)
+		if (static_cast<std::uint8_t>(data[i]) == 0x80)
+			data[i + 1] = static_cast<char>(0x81);
+	{
+		std::ofstream file(boost::filesystem::path(filename).string(), std::ios::binary | std::ios::trunc);
+		file.write(data.data(), data.size());
+	}
+
+	psd::psd_document doc;
+	doc.parse(filename);
+	CHECK(doc.layers().size() == 1);
+
+	std::wcout << L"corrupt rle: ok" << std::endl;
+}
+
+template<typename Func>
+double measure_ms(int iterations, const Func& func)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < iterations; ++i)
+		func();
+
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+void benchmark(const std::wstring& filename)
+{
+	std::vector<test_layer> layers;
+
+	for (int i = 0; i < 40; ++i)
+		layers.push_back({ "layer " + std::to_string(i), (i * 24) % 960, (i * 13) % 540, 960, 540, i % 4 == 0 ? encoding::raw : encoding::rle, true, i % 5 == 0, flat_runs });
+
+	write_psd(filename, 1920, 1080, layers);
+
+	auto parse = measure_ms(5, [&]
+	{
+		psd::psd_document doc;
+		doc.parse(filename);
+	});
+
+	psd::psd_document_cache cache(1024 * 1024 * 1024);
+	auto cold = measure_ms(1, [&] { cache.load(filename); });
+	auto warm = measure_ms(100, [&] { cache.load(filename); });
+
+	std::wcout << L"benchmark: 1920x1080, " << layers.size() << L" layers of 960x540 ("
+		<< boost::filesystem::file_size(filename) / 1024 << L" KiB)" << std::endl
+		<< L"  parse:      " << parse << L" ms" << std::endl
+		<< L"  cache miss: " << cold << L" ms" << std::endl
+		<< L"  cache hit:  " << warm << L" ms" << std::endl;
+}
+
+void dump(const std::wstring& filename)
+{
+	psd::psd_document doc;
+	doc.parse(filename);
+
+	std::wstringstream trace;
+	boost::property_tree::xml_writer_settings<std::wstring> w(' ', 3);
+
+	trace << L"<doc filename='" << doc.filename() << L"' color_depth='" << doc.color_depth() << L"' channel_count='" << doc.channels_count() << L"' width='" << doc.width() << L"' height='" << doc.height() << L"'>" << std::endl;
+	if (doc.has_timeline())
+	{
+		trace << L"<timeline>" << std::endl;
+		boost::property_tree::write_xml(trace, doc.timeline(), w);
+		trace << L"</timeline>" << std::endl;
+	}
+
+	for (auto& layer : doc.layers())
+	{
+		trace << L"	<layer name='" << layer->name() << L"' opacity='" << layer->opacity() << L"' visible='" << layer->is_visible() << L"' protected='" << layer->is_position_protected() << L"'>" << std::endl;
+		if (layer->bitmap())
+			trace << L"		<bounding-box x='" << layer->location().x << L"' y='" << layer->location().y << L"' width='" << layer->bitmap()->width() << L"' height='" << layer->bitmap()->height() << L"' />" << std::endl;
+		if (layer->is_text())
+		{
+			trace << L"			<text value='" << layer->text_data().get(L"EngineDict.Editor.Text", L"") << L"' />" << std::endl;
+			boost::property_tree::write_xml(trace, layer->text_data(), w);
+		}
+		if (layer->has_timeline())
+		{
+			trace << L"			<timeline>" << std::endl;
+			boost::property_tree::write_xml(trace, layer->timeline_data(), w);
+			trace << L"			</timeline>" << std::endl;
+		}
+		trace << L"	</layer>" << std::endl;
+	}
+
+	trace << L"</doc>" << std::endl;
+
+	std::cout << u8(trace.str());
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	// psd-test <file> prints what the parser reads from a document.
+	if (argc > 1)
+		return test::run_tests("psd-test", [&] { dump(u16(argv[1])); });
+
+	return test::run_tests("psd-test", []
+	{
+		auto directory = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("psd-test-%%%%-%%%%");
+		boost::filesystem::create_directories(directory);
+
+		auto cleanup = [&] { boost::system::error_code ec; boost::filesystem::remove_all(directory, ec); };
+
+		try
+		{
+			test_decode((directory / "decode.psd").wstring());
+			test_cache((directory / "cache.psd").wstring(), (directory / "other.psd").wstring());
+			test_corrupt_rle((directory / "corrupt.psd").wstring());
+			benchmark((directory / "benchmark.psd").wstring());
+		}
+		catch (...)
+		{
+			cleanup();
+			throw;
+		}
+
+		cleanup();
+	});
+}
@@ -0,0 +1,340 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Conformance of core::binding: values, lazy evaluation, listeners and the
+// order they fire in, binding and unbinding, and cycle detection.
+
+#include <core/producer/binding.h>
+
+#include <test/common/test.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace caspar { namespace test {
+
+using core::binding;
+
+namespace {
+
+template<typename Func>
+bool throws(const Func& func)
+{
+	try
+	{
+		func();
+	}
+	catch (const caspar_exception&)
+	{
+		return true;
+	}
+
+	return false;
+}
+
+void test_values()
+{
+	binding<int> a(1);
+	binding<int> b(2);
+	auto sum = a + b;
+	auto scaled = sum * 10 - 3;
+	auto less = a < b;
+	auto text = scaled.as<std::wstring>();
+	auto real = a.as<double>() / 4.0;
+
+	CHECK(sum.get() == 3);
+	CHECK(scaled.get() == 27);
+	CHECK(less.get());
+	CHECK(text.get() == L"27");
+	CHECK(real.get() == 0.25);
+
+	a.set(5);
+	CHECK(sum.get() == 7);
+	CHECK(scaled.get() == 67);
+	CHECK(!less.get());
+	CHECK(text.get() == L"67");
+	CHECK(real.get() == 1.25);
+
+	// Only unbound values can be set.
+	CHECK(sum.bound());
+	CHECK(!a.bound());
+	CHECK(throws([&] { sum.set(1); }));
+
+	auto choice = core::when(less).then(a).otherwise(b);
+	CHECK(choice.get() == 2);
+	b.set(6);
+	CHECK(choice.get() == 5);
+
+	binding<bool> t(true);
+	binding<bool> f(false);
+	CHECK((t && f).get() == false);
+	CHECK((t || f).get() == true);
+	CHECK((!f).get() == true);
+
+	std::cout << "binding values: ok" << std::endl;
+}
+
+void test_lazy()
+{
+	binding<int> a(1);
+	int calls = 0;
+	binding<int> doubled([&] { ++calls; return a.get() * 2; }, a);
+
+	// Nothing is computed before the first read, and a read without a change computes nothing.
+	CHECK(calls == 0);
+	CHECK(doubled.get() == 2);
+	CHECK(doubled.get() == 2);
+	CHECK(calls == 1);
+
+	// Any number of changes cost one evaluation on the next read.
+	a.set(2);
+	a.set(3);
+	a.set(4);
+	CHECK(calls == 1);
+	CHECK(doubled.get() == 8);
+	CHECK(calls == 2);
+
+	// Setting the same value is not a change.
+	a.set(4);
+	CHECK(doubled.get() == 8);
+	CHECK(calls == 2);
+
+	// A diamond evaluates its bottom once per change.
+	int bottom_calls = 0;
+	auto left = a + 1;
+	auto right = a * 3;
+	binding<int> bottom([&] { ++bottom_calls; return left.get() + right.get(); }, left, right);
+
+	CHECK(bottom.get() == 17);
+	a.set(5);
+	CHECK(bottom.get() == 21);
+	CHECK(bottom_calls == 2);
+
+	// An upstream change that does not change the dependency stops there.
+	binding<int> x(10);
+	int parity_calls = 0;
+	auto even = x.transformed([](int v) { return v % 2 == 0; });
+	binding<bool> flag([&] { ++parity_calls; return even.get(); }, even);
+	CHECK(flag.get());
+	x.set(12);
+	CHECK(flag.get());
+	CHECK(parity_calls == 1);
+
+	std::cout << "binding lazy evaluation: ok" << std::endl;
+}
+
+void test_listeners()
+{
+	binding<int> a(1);
+	auto b = a * 2;
+	auto c = b + 1;
+	std::vector<std::string> fired;
+
+	auto on_a = a.on_change([&] { fired.push_back("a"); });
+	auto on_c = c.on_change([&] { fired.push_back("c"); });
+	auto on_b = b.on_change([&] { fired.push_back("b"); });
+
+	// Upstream first, without any read, and only on real changes.
+	a.set(2);
+	CHECK((fired == std::vector<std::string> { "a", "b", "c" }));
+
+	fired.clear();
+	a.set(2);
+	CHECK(fired.empty());
+
+	// b changes from 4 to 4 through a different a, so nothing below it fires.
+	binding<int> d(3);
+	auto clamped = d.transformed([](int v) { return v > 5 ? 5 : v; });
+	int clamped_fires = 0;
+	auto on_clamped = clamped.on_change([&] { ++clamped_fires; });
+	d.set(6);
+	d.set(7);
+	CHECK(clamped_fires == 1);
+
+	// A dropped subscription stops firing.
+	on_b.reset();
+	fired.clear();
+	a.set(3);
+	CHECK((fired == std::vector<std::string> { "a", "c" }));
+
+	// A diamond fires its bottom once.
+	auto left = a + 1;
+	auto right = a + 2;
+	auto bottom = left + right;
+	int bottom_fires = 0;
+	auto on_bottom = bottom.on_change([&] { ++bottom_fires; });
+	a.set(4);
+	CHECK(bottom_fires == 1);
+	CHECK(bottom.get() == 11);
+
+	// A listener on a binding that was never read still sees the first change.
+	binding<int> e(1);
+	auto never_read = e * 10;
+	int never_read_fires = 0;
+	auto on_never_read = never_read.on_change([&] { ++never_read_fires; });
+	e.set(2);
+	CHECK(never_read_fires == 1);
+	CHECK(never_read.get() == 20);
+
+	std::cout << "binding listeners: ok" << std::endl;
+}
+
+void test_bind()
+{
+	binding<int> source(1);
+	binding<int> target(7);
+	int fires = 0;
+	auto on_target = target.on_change([&] { ++fires; });
+
+	target.bind(source);
+	CHECK(target.bound());
+	CHECK(target.get() == 1);
+	CHECK(fires == 1);
+
+	source.set(2);
+	CHECK(target.get() == 2);
+	CHECK(fires == 2);
+
+	// Downstream of a bound binding follows the source.
+	auto plus = target + 100;
+	source.set(3);
+	CHECK(plus.get() == 103);
+
+	// Unbinding keeps the last value and cuts the link.
+	target.unbind();
+	CHECK(!target.bound());
+	CHECK(target.get() == 3);
+	source.set(4);
+	CHECK(target.get() == 3);
+	target.set(9);
+	CHECK(plus.get() == 109);
+
+	// Rebinding to another source.
+	binding<int> other(50);
+	target.bind(source);
+	target.bind(other);
+	source.set(5);
+	CHECK(target.get() == 50);
+
+	std::cout << "binding bind and unbind: ok" << std::endl;
+}
+
+void test_cycles()
+{
+	binding<int> a(1);
+	binding<int> b(2);
+	binding<int> c(3);
+
+	CHECK(throws([&] { a.bind(a); }));
+	CHECK(!a.bound());
+
+	b.bind(a);
+	c.bind(b);
+
+	// a -> b -> c, binding a to c would close the loop. A failed bind leaves a unbound and usable.
+	CHECK(throws([&] { a.bind(c); }));
+	CHECK(!a.bound());
+	a.set(10);
+	CHECK(c.get() == 10);
+
+	// Through derived bindings too.
+	auto derived = c * 2;
+	CHECK(throws([&] { a.bind(derived); }));
+	CHECK(!a.bound());
+
+	// Not a cycle: two bindings on the same source.
+	binding<int> d;
+	d.bind(b);
+	CHECK(d.get() == 10);
+
+	// A long chain is still checked.
+	std::vector<binding<int>> chain(200);
+	chain[0].set(1);
+
+	for (std::size_t n = 1; n < chain.size(); ++n)
+		chain[n].bind(chain[n - 1]);
+
+	CHECK(chain.back().get() == 1);
+	CHECK(throws([&] { chain[0].bind(chain.back()); }));
+	chain[0].set(2);
+	CHECK(chain.back().get() == 2);
+
+	std::cout << "binding cycles: ok" << std::endl;
+}
+
+
+void test_isolated()
+{
+	binding<int> source(1);
+	CHECK(source.isolated());
+
+	// Listeners on the binding itself don't matter, it is the one that changes.
+	auto on_source = source.on_change([] { });
+	CHECK(source.isolated());
+
+	// Calculated from source alone, with nothing downstream.
+	binding<int> mirror;
+	mirror.bind(source);
+	CHECK(source.isolated());
+	CHECK(!mirror.isolated());
+
+	// Listeners on a dependant only when it is owned.
+	auto on_mirror = mirror.on_change([] { });
+	CHECK(!source.isolated());
+	CHECK(source.isolated({ mirror.identity() }));
+	on_mirror.reset();
+	CHECK(source.isolated());
+
+	// Something downstream of a dependant.
+	{
+		auto doubled = mirror * 2;
+		CHECK(!source.isolated({ mirror.identity() }));
+	}
+	CHECK(source.isolated());
+
+	// A dependant that is calculated from another binding too.
+	binding<int> other(2);
+	{
+		auto sum = source + other;
+		CHECK(!source.isolated());
+		CHECK(!other.isolated());
+	}
+	CHECK(source.isolated());
+
+	mirror.unbind();
+	CHECK(source.isolated());
+	CHECK(mirror.isolated());
+
+	std::cout << "binding isolation: ok" << std::endl;
+}
+
+}
+
+void test_binding()
+{
+	test_values();
+	test_lazy();
+	test_listeners();
+	test_bind();
+	test_cycles();
+	test_isolated();
+}
+
+}}
@@ -0,0 +1,426 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Conformance of the scene expressions: every operator, function and type
+// conversion is evaluated over a series of variable updates and compared with
+// the same computation in C++. Also covers animate() and the parse errors, and
+// times parsing and per frame evaluation of scenes of growing size.
+
+#include <boost/any.hpp>
+
+#include <core/producer/scene/expression_parser.h>
+
+#include <common/except.h>
+#include <common/utf.h>
+
+#include <test/common/test.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cwctype>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace caspar { namespace test {
+
+namespace {
+
+struct state
+{
+	double			x;
+	std::int64_t	n;
+	std::wstring	s;
+	bool			b;
+	double			frame;
+};
+
+class variables
+{
+	std::map<std::wstring, std::shared_ptr<core::variable>> variables_;
+public:
+	template<typename T>
+	core::binding<T>& add(const std::wstring& name, T initial_value)
+	{
+		auto var = std::make_shared<core::variable_impl<T>>(L"", true, initial_value);
+		variables_[name] = var;
+		return var->value();
+	}
+
+	core::scene::variable_repository repository()
+	{
+		return [this](const std::wstring& name) -> core::variable&
+		{
+			auto found = variables_.find(name);
+
+			if (found == variables_.end())
+				CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"No variable named " + name));
+
+			return *found->second;
+		};
+	}
+};
+
+std::wstring str(double value)
+{
+	return boost::lexical_cast<std::wstring>(value);
+}
+
+bool same(double actual, double expected)
+{
+	if (std::isnan(expected))
+		return std::isnan(actual);
+
+	if (std::isinf(expected))
+		return actual == expected;
+
+	return std::abs(actual - expected) <= 1e-9 * std::max(1.0, std::abs(expected));
+}
+
+const std::vector<state> steps
+{
+	{ 0.0,		0,		L"abc",		false,	0.0 },
+	{ 1.5,		1,		L"abc",		true,	1.0 },
+	{ 3.0,		4,		L"",		true,	2.0 },
+	{ 3.0,		5,		L"Mixed",	false,	3.0 },
+	{ -2.25,	-7,		L"abc",		false,	4.0 },
+	{ 10.0,		9,		L"x y z",	true,	5.0 },
+	{ 0.1,		10,		L"abc",		true,	6.0 },
+	{ 1e6,		123456,	L"big",		false,	7.0 },
+	{ -0.0,		0,		L"\"q\"",	true,	8.0 },
+	{ 5.0,		-1,		L"abc",		false,	9.0 },
+	{ 6.0,		3,		L"ABC",		true,	10.0 },
+	{ std::numeric_limits<double>::infinity(),	2,	L"inf",	false,	11.0 },
+	{ std::nan(""),	8,		L"nan",		true,	12.0 },
+	{ 2.0,		4,		L"abc",		true,	13.0 }
+};
+
+template<typename T>
+struct case_
+{
+	std::wstring						expression;
+	std::function<T (const state&)>		expected;
+};
+
+const std::vector<case_<double>> number_cases
+{
+	{ L"1 + 2 * 3",							[](const state&) { return 7.0; } },
+	{ L"(1 + 2) * 3",						[](const state&) { return 9.0; } },
+	{ L"x * 2 - 1",							[](const state& v) { return v.x * 2 - 1; } },
+	{ L"-x + 3",							[](const state& v) { return -v.x + 3; } },
+	{ L"-(x + 1) * 2",						[](const state& v) { return -(v.x + 1) * 2; } },
+	{ L"x / 4",								[](const state& v) { return v.x / 4; } },
+	{ L"10 - 4 - 3",						[](const state&) { return 3.0; } },
+	{ L"n % 3",								[](const state& v) { return static_cast<double>(v.n % 3); } },
+	{ L"n * x",								[](const state& v) { return static_cast<double>(v.n) * v.x; } },
+	{ L"n + n / 2",							[](const state& v) { return static_cast<double>(v.n) + static_cast<double>(v.n) / 2; } },
+	{ L"abs(x - 10)",						[](const state& v) { return std::abs(v.x - 10); } },
+	{ L"floor(x / 3)",						[](const state& v) { return std::floor(v.x / 3); } },
+	{ L"sin(x) * sin(x) + cos(x) * cos(x)",	[](const state& v) { return std::sin(v.x) * std::sin(v.x) + std::cos(v.x) * std::cos(v.x); } },
+	{ L"sin(frame / 25) * 100 + x",			[](const state& v) { return std::sin(v.frame / 25) * 100 + v.x; } },
+	{ L"length(s) + 1",						[](const state& v) { return static_cast<double>(v.s.length() + 1); } },
+	{ L"length(s + x)",						[](const state& v) { return static_cast<double>((v.s + str(v.x)).length()); } },
+	{ L"x > 5 ? x : 5",						[](const state& v) { return v.x > 5 ? v.x : 5; } },
+	{ L"b ? 1 : 2",							[](const state& v) { return v.b ? 1.0 : 2.0; } },
+	{ L"(b ? x : n) + 0.5",					[](const state& v) { return (v.b ? v.x : static_cast<double>(v.n)) + 0.5; } },
+	{ L"frame * 0.5 + x",					[](const state& v) { return v.frame * 0.5 + v.x; } },
+	{ L"(x + 1) * (x + 1) - (x + 1)",		[](const state& v) { return (v.x + 1) * (v.x + 1) - (v.x + 1); } }
+};
+
+const std::vector<case_<bool>> boolean_cases
+{
+	{ L"true",								[](const state&) { return true; } },
+	{ L"!b",								[](const state& v) { return !v.b; } },
+	{ L"!b && x >= 0",						[](const state& v) { return !v.b && v.x >= 0; } },
+	{ L"x == 3 || n != 4",					[](const state& v) { return v.x == 3 || v.n != 4; } },
+	{ L"x < 2 || x > 5",					[](const state& v) { return v.x < 2 || v.x > 5; } },
+	{ L"x <= 3 && n >= 1",					[](const state& v) { return v.x <= 3 && v.n >= 1; } },
+	{ L"s == \"abc\"",						[](const state& v) { return v.s == L"abc"; } },
+	{ L"s != \"abc\" && b",					[](const state& v) { return v.s != L"abc" && v.b; } },
+	{ L"b == true",							[](const state& v) { return v.b; } },
+	{ L"b == (x > 1)",						[](const state& v) { return v.b == (v.x > 1); } },
+	{ L"1 + 2 < 4 && 2 * 3 == 6",			[](const state&) { return true; } },
+	{ L"x == x",							[](const state& v) { return v.x == v.x; } },
+	{ L"b ? x > 0 : n > 0",					[](const state& v) { return v.b ? v.x > 0 : v.n > 0; } }
+};
+
+const std::vector<case_<std::wstring>> string_cases
+{
+	{ L"\"x=\" + x",						[](const state& v) { return L"x=" + str(v.x); } },
+	{ L"s + n",								[](const state& v) { return v.s + str(static_cast<double>(v.n)); } },
+	{ L"x + s",								[](const state& v) { return str(v.x) + v.s; } },
+	{ L"1 + 2 + s",							[](const state& v) { return L"3" + v.s; } },
+	{ L"s + 1 + 2",							[](const state& v) { return v.s + L"12"; } },
+	{ L"to_upper(s) + to_lower(\"ABC\")",	[](const state& v) { std::wstring u; for (auto c : v.s) u += static_cast<wchar_t>(std::towupper(c)); return u + L"abc"; } },
+	{ L"b + \"!\"",							[](const state& v) { return std::wstring(v.b ? L"1" : L"0") + L"!"; } },
+	{ L"b ? s : \"none\"",					[](const state& v) { return v.b ? v.s : L"none"; } },
+	{ L"\"a\\\"b\\nc\\\\\"",				[](const state&) { return std::wstring(L"a\"b\nc\\"); } },
+	{ L"x < 2 ? \"small\" : (x < 10 ? \"medium\" : \"large\")",	[](const state& v) { return std::wstring(v.x < 2 ? L"small" : (v.x < 10 ? L"medium" : L"large")); } },
+	{ L"s + s + s",							[](const state& v) { return v.s + v.s + v.s; } }
+};
+
+void report(const std::wstring& expression, bool ok)
+{
+	if (!ok)
+		std::wcerr << L"wrong value of " << expression << std::endl;
+
+	CHECK(ok);
+}
+
+template<typename T>
+std::vector<core::binding<T>> parse_all(const std::vector<case_<T>>& cases, variables& vars)
+{
+	std::vector<core::binding<T>> result;
+
+	for (auto& c : cases)
+		result.push_back(core::scene::parse_expression<T>(c.expression, vars.repository()));
+
+	return result;
+}
+
+void test_values()
+{
+	variables vars;
+	auto& x		= vars.add<double>(L"x", 0.0);
+	auto& n		= vars.add<std::int64_t>(L"n", 0);
+	auto& s		= vars.add<std::wstring>(L"s", L"");
+	auto& b		= vars.add<bool>(L"b", false);
+	auto& frame	= vars.add<double>(L"frame", 0.0);
+
+	auto numbers	= parse_all(number_cases, vars);
+	auto booleans	= parse_all(boolean_cases, vars);
+	auto strings	= parse_all(string_cases, vars);
+
+	// A listener on every number expression, to check it fires when the value changes.
+	std::vector<int> fires(numbers.size());
+	std::vector<std::shared_ptr<void>> subscriptions;
+
+	for (std::size_t i = 0; i < numbers.size(); ++i)
+		subscriptions.push_back(numbers[i].on_change([&fires, i] { ++fires[i]; }));
+
+	std::vector<double> previous(numbers.size());
+
+	for (std::size_t i = 0; i < numbers.size(); ++i)
+		previous[i] = numbers[i].get();
+
+	auto set = [&](const state& step)
+	{
+		x.set(step.x);
+		n.set(step.n);
+		s.set(step.s);
+		b.set(step.b);
+		frame.set(step.frame);
+	};
+
+	for (auto& step : steps)
+	{
+		std::fill(fires.begin(), fires.end(), 0);
+		set(step);
+
+		for (std::size_t i = 0; i < numbers.size(); ++i)
+		{
+			auto value = numbers[i].get();
+			report(number_cases[i].expression, same(value, number_cases[i].expected(step)));
+
+			// NaN never equals itself, so it is left out.
+			if (!std::isnan(value) && !std::isnan(previous[i]) && value != previous[i])
+				CHECK(fires[i] > 0);
+
+			previous[i] = value;
+		}
+
+		for (std::size_t i = 0; i < booleans.size(); ++i)
+			report(boolean_cases[i].expression, booleans[i].get() == boolean_cases[i].expected(step));
+
+		for (std::size_t i = 0; i < strings.size(); ++i)
+			report(string_cases[i].expression, strings[i].get() == string_cases[i].expected(step));
+
+		// Setting the same values again changes nothing, but a NaN is never the same value.
+		std::fill(fires.begin(), fires.end(), 0);
+		set(step);
+
+		for (std::size_t i = 0; i < numbers.size(); ++i)
+			CHECK(fires[i] == 0 || std::isnan(step.x));
+	}
+
+	// The same expression parsed again gives the same values.
+	auto again = parse_all(number_cases, vars);
+
+	for (std::size_t i = 0; i < numbers.size(); ++i)
+		CHECK(same(again[i].get(), numbers[i].get()));
+
+	std::cout << "expression values: " << number_cases.size() + boolean_cases.size() + string_cases.size() << " expressions over " << steps.size() << " steps: ok" << std::endl;
+}
+
+void test_animate()
+{
+	variables vars;
+	auto& x		= vars.add<double>(L"x", 0.0);
+	auto& frame	= vars.add<double>(L"frame", 0.0);
+
+	auto animated = core::scene::parse_expression<double>(L"animate(x, 10, \"linear\")", vars.repository());
+	CHECK(animated.get() == 0.0);
+
+	x.set(100.0);
+
+	std::vector<double> values;
+
+	for (int f = 1; f <= 20; ++f)
+	{
+		frame.set(f);
+		values.push_back(animated.get());
+	}
+
+	// Moves evenly from 0 to 100 and stays there.
+	for (std::size_t i = 1; i < values.size(); ++i)
+		CHECK(values[i] >= values[i - 1]);
+
+	CHECK(values.front() < 100.0);
+	CHECK(values[4] > 0.0 && values[4] < 100.0);
+	CHECK(values.back() == 100.0);
+	CHECK(same(values[5] - values[4], values[4] - values[3]));
+
+	// Two animations of the same value keep their own state.
+	auto first = core::scene::parse_expression<double>(L"animate(x, 4, \"linear\")", vars.repository());
+	frame.set(21);
+	first.get();
+	x.set(0.0);
+	frame.set(22);
+	auto second = core::scene::parse_expression<double>(L"animate(x, 4, \"linear\")", vars.repository());
+	CHECK(first.get() > 0.0);
+	CHECK(second.get() == 0.0);
+
+	std::cout << "expression animate: ok" << std::endl;
+}
+
+void test_errors()
+{
+	variables vars;
+	vars.add<double>(L"x", 1.0);
+	vars.add<std::wstring>(L"s", L"a");
+	vars.add<bool>(L"b", true);
+
+	auto rejected = [&](const std::wstring& expression, const std::wstring& reason)
+	{
+		try
+		{
+			core::scene::parse_expression<std::wstring>(expression, vars.repository());
+		}
+		catch (const user_error& e)
+		{
+			auto message = boost::get_error_info<msg_info_t>(e);
+			CHECK(message);
+			if (u16(*message).find(reason) == std::wstring::npos)
+				std::wcerr << expression << L": " << u16(*message) << std::endl;
+
+			CHECK(u16(*message).find(reason) != std::wstring::npos);
+			return;
+		}
+
+		std::wcerr << expression << L" was accepted" << std::endl;
+		CHECK(false);
+	};
+
+	rejected(L"1 +",				L"Missing operand of +");
+	rejected(L"* 2",				L"Missing operand of *");
+	rejected(L"b ? 1",				L"Missing operand of ?");
+	rejected(L"(1 + 2",				L"Expected )");
+	rejected(L"\"abc",				L"Expected closing \"");
+	rejected(L"nope(1)",			L"unknown function");
+	rejected(L"sin(1, 2)",			L"sin() function requires one");
+	rejected(L"animate(x, 2)",		L"animate() function requires three");
+	rejected(L"x && b",				L"Required binding of type");
+	rejected(L"s * 2",				L"Required binding of type");
+	rejected(L"!x",					L"Required binding of type");
+	rejected(L"x == b",				L"Required binding of type");
+	rejected(L"b ? x : s",			L"Required binding of type");
+	rejected(L"x ? 1 : 2",			L"Required binding of type");
+	rejected(L"missing + 1",		L"No variable named missing");
+	rejected(L"x === 1",			L"Expected second character of operator");
+	rejected(L"x << 1",				L"Did not expect <");
+
+	std::cout << "expression errors: ok" << std::endl;
+}
+
+}
+
+void test_expressions()
+{
+	test_values();
+	test_animate();
+	test_errors();
+}
+
+// A scene with four expressions per layer that all read the frame, like a
+// scene that animates every layer, read every frame.
+void benchmark_expressions()
+{
+	const int frames = 500;
+
+	for (int layers : { 250, 1000, 2500 })
+	{
+		variables vars;
+		auto& frame = vars.add<double>(L"frame", 0.0);
+		std::vector<core::binding<double>> numbers;
+		std::vector<core::binding<std::wstring>> strings;
+
+		auto start = std::chrono::steady_clock::now();
+
+		for (int layer = 0; layer < layers; ++layer)
+		{
+			auto name = L"layer" + boost::lexical_cast<std::wstring>(layer) + L".x";
+			vars.add<double>(name, layer);
+
+			numbers.push_back(core::scene::parse_expression<double>(name + L" + frame * 2", vars.repository()));
+			numbers.push_back(core::scene::parse_expression<double>(L"sin(frame / 25) * 100 + " + name, vars.repository()));
+			numbers.push_back(core::scene::parse_expression<double>(L"frame % 50 < 25 ? " + name + L" : -" + name, vars.repository()));
+			strings.push_back(core::scene::parse_expression<std::wstring>(L"\"frame \" + floor(frame / 25)", vars.repository()));
+		}
+
+		auto parsed = std::chrono::steady_clock::now();
+		double sum = 0.0;
+
+		for (int f = 0; f < frames; ++f)
+		{
+			frame.set(f);
+
+			for (auto& number : numbers)
+				sum += number.get();
+
+			for (auto& string : strings)
+				sum += static_cast<double>(string.get().length());
+		}
+
+		auto done = std::chrono::steady_clock::now();
+		CHECK(sum != 0.0);
+
+		std::cout << "expression benchmark: " << layers * 4 << " bindings, parse "
+				<< std::chrono::duration<double, std::milli>(parsed - start).count() << " ms, "
+				<< std::chrono::duration<double, std::micro>(done - parsed).count() / frames << " us per frame" << std::endl;
+	}
+}
+
+}}
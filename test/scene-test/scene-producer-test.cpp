@@ -0,0 +1,256 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// The layers of a scene_producer are received in parallel unless their producer
+// shares bindings with the scene. Checks which layers are received one after
+// another, that transforms follow constraints changed while receiving, and
+// measures the time per frame.
+
+#include <boost/any.hpp>
+
+#include <core/producer/scene/scene_producer.h>
+#include <core/frame/draw_frame.h>
+#include <core/frame/frame_transform.h>
+#include <core/frame/frame_visitor.h>
+#include <core/monitor/monitor.h>
+#include <core/video_format.h>
+
+#include <test/common/test.h>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace caspar { namespace test {
+
+using namespace core;
+
+namespace {
+
+struct test_producer : public frame_producer_base
+{
+	monitor::subject		monitor_subject_;
+	constraints				constraints_		{ 100, 100 };
+	int						work_				= 0;
+	int						sleep_ms_			= 0;
+	bool					grow_				= false;
+	std::atomic<int>*		in_flight_			= nullptr;
+	std::atomic<int>*		most_in_flight_		= nullptr;
+
+	draw_frame receive_impl() override
+	{
+		if (in_flight_)
+		{
+			auto now = ++*in_flight_;
+			auto most = most_in_flight_->load();
+
+			while (now > most && !most_in_flight_->compare_exchange_weak(most, now))
+				;
+		}
+
+		if (sleep_ms_)
+			std::this_thread::sleep_for(std::chrono::milliseconds(sleep_ms_));
+
+		volatile double sum = 0.0;
+
+		for (int i = 0; i < work_; ++i)
+			sum = sum + std::sqrt(static_cast<double>(i));
+
+		if (grow_)
+			constraints_.width.set(constraints_.width.get() + 10.0);
+
+		if (in_flight_)
+			--*in_flight_;
+
+		return draw_frame::empty();
+	}
+
+	constraints& pixel_constraints() override						{ return constraints_; }
+	std::wstring print() const override								{ return L"test"; }
+	std::wstring name() const override								{ return L"test"; }
+	boost::property_tree::wptree info() const override				{ return boost::property_tree::wptree(); }
+	monitor::subject& monitor_output() override						{ return monitor_subject_; }
+};
+
+// The transforms of the layers. frame_producer_base wraps the frame of the scene,
+// and the frames of the layers below it, in one more draw_frame each.
+struct transform_collector : public frame_visitor
+{
+	std::vector<frame_transform>	transforms;
+	int								depth		= 0;
+
+	void push(const frame_transform& transform) override
+	{
+		if (depth++ == 2)
+			transforms.push_back(transform);
+	}
+
+	void visit(const const_frame&) override	{ }
+	void pop() override						{ --depth; }
+};
+
+spl::shared_ptr<scene::scene_producer> create_scene()
+{
+	return spl::make_shared<scene::scene_producer>(L"scene", L"test", 1920, 1080, video_format_desc(video_format::x1080p5000));
+}
+
+std::vector<frame_transform> receive(scene::scene_producer& scene)
+{
+	transform_collector collector;
+	static_cast<frame_producer&>(scene).receive().accept(collector);
+
+	return collector.transforms;
+}
+
+void test_serial_when_shared()
+{
+	auto scene = create_scene();
+	std::atomic<int> in_flight(0);
+	std::atomic<int> most_in_flight(0);
+	auto& size = scene->create_variable<double>(L"size", false);
+	size.set(200.0);
+
+	for (int n = 0; n < 12; ++n)
+	{
+		auto producer = spl::make_shared<test_producer>();
+		auto name = L"layer" + std::to_wstring(n);
+		auto& layer = scene->create_layer(producer, n, n, name);
+
+		producer->sleep_ms_ = 2;
+
+		if (n % 4 == 0)
+			continue; // Independent, not counted.
+
+		producer->in_flight_ = &in_flight;
+		producer->most_in_flight_ = &most_in_flight;
+
+		if (n % 4 == 1)
+			producer->constraints_.width.bind(size);						// Bound to a scene variable
+		else if (n % 4 == 2)
+			layer.anchor.x.bind(producer->constraints_.width * 0.5);		// A transform calculated from it
+		else
+		{
+			// A scene variable that a transform is calculated from
+			auto& half_height = scene->create_variable<double>(name + L".half_height", false);
+			half_height.bind(producer->constraints_.height * 0.5);
+			layer.position.y.bind(half_height);
+		}
+	}
+
+	for (int frame = 0; frame < 5; ++frame)
+		receive(*scene);
+
+	CHECK(in_flight == 0);
+	CHECK(most_in_flight == 1);
+
+	std::cout << "scene_producer shared layers received in order: ok" << std::endl;
+}
+
+void test_constraints_changed_while_receiving()
+{
+	auto scene = create_scene();
+	auto grower = spl::make_shared<test_producer>();
+	auto plain = spl::make_shared<test_producer>();
+
+	grower->grow_ = true;
+
+	auto& grower_layer = scene->create_layer(grower, 0, 0, L"grower");
+	auto& follower_layer = scene->create_layer(plain, 0, 0, L"follower");
+
+	follower_layer.position.x.bind(grower->constraints_.width * 2.0);
+
+	for (int frame = 1; frame <= 3; ++frame)
+	{
+		auto transforms = receive(*scene);
+		auto width = 100.0 + frame * 10.0;
+
+		CHECK(transforms.size() == 2);
+		CHECK(std::abs(transforms[0].image_transform.fill_scale[0] - width / 1920.0) < 1e-9);
+		CHECK(std::abs(transforms[0].image_transform.crop.lr[0] - 1.0) < 1e-9);
+		CHECK(std::abs(transforms[1].image_transform.fill_translation[0] - width * 2.0 / 1920.0) < 1e-9);
+	}
+
+	// Only its own crop and perspective follow the width, it may be received in parallel again.
+	follower_layer.position.x.unbind();
+	grower_layer.crop.lower_right.x.unbind();
+	grower_layer.crop.lower_right.x.set(50.0);
+
+	auto transforms = receive(*scene);
+
+	CHECK(std::abs(transforms[0].image_transform.fill_scale[0] - 140.0 / 1920.0) < 1e-9);
+	CHECK(std::abs(transforms[0].image_transform.crop.lr[0] - 50.0 / 140.0) < 1e-9);
+	CHECK(std::abs(transforms[0].image_transform.perspective.ur[0] - 1.0) < 1e-9);
+
+	std::cout << "scene_producer constraints changed while receiving: ok" << std::endl;
+}
+
+}
+
+void test_scene_producer()
+{
+	test_serial_when_shared();
+	test_constraints_changed_while_receiving();
+}
+
+void benchmark_scene_producer()
+{
+	const int frames = 100;
+	const int layers = 200;
+
+	for (int work : { 0, 2000, 20000 })
+	{
+		for (bool shared : { false, true })
+		{
+			auto scene = create_scene();
+			auto& size = scene->create_variable<double>(L"size", false);
+			size.set(100.0);
+
+			for (int n = 0; n < layers; ++n)
+			{
+				auto producer = spl::make_shared<test_producer>();
+				producer->work_ = work;
+
+				if (shared)
+					producer->constraints_.width.bind(size);
+
+				scene->create_layer(producer, n, n, L"layer" + std::to_wstring(n));
+			}
+
+			for (int frame = 0; frame < 10; ++frame)
+				receive(*scene);
+
+			auto start = std::chrono::steady_clock::now();
+
+			for (int frame = 0; frame < frames; ++frame)
+				receive(*scene);
+
+			auto done = std::chrono::steady_clock::now();
+
+			std::cout << "scene_producer benchmark: " << layers << (shared ? " shared" : " independent") << " layers, "
+					<< work << " iterations each, " << std::chrono::duration<double, std::milli>(done - start).count() / frames
+					<< " ms per frame" << std::endl;
+		}
+	}
+}
+
+}}
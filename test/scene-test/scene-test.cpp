@@ -0,0 +1,45 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Tests of scene_producer and the bindings and expressions scenes are built from. Every area has
+// a source file of its own, with one entry point called from here.
+
+#include <test/common/test.h>
+
+namespace caspar { namespace test {
+
+void test_binding();
+void test_expressions();
+void test_scene_producer();
+void benchmark_expressions();
+void benchmark_scene_producer();
+
+}}
+
+int main()
+{
+	return caspar::test::run_tests("scene-test", []
+	{
+		caspar::test::test_binding();
+		caspar::test::test_expressions();
+		caspar::test::test_scene_producer();
+		caspar::test::benchmark_expressions();
+		caspar::test::benchmark_scene_producer();
+	});
+}
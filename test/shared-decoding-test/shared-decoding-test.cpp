@@ -0,0 +1,257 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Checks the fan out that the shared decoders and muxers hand their frames to
+// their subscribers with: the late join window, unsubscription and overflow.
+// Checks that the registry they are shared through only hands out objects
+// that are alive, open and accepted by the caller.
+
+#include <modules/ffmpeg/producer/util/fan_out.h>
+#include <modules/ffmpeg/producer/util/shared_registry.h>
+
+#include <test/common/test.h>
+
+#include <common/except.h>
+
+#include <iostream>
+#include <memory>
+#include <string>
+
+using namespace caspar;
+
+namespace {
+
+struct copied
+{
+	int	value	= 0;
+	int	copies	= 0;
+
+	copied() = default;
+	explicit copied(int value) : value(value) { }
+};
+
+void test_late_join()
+{
+	ffmpeg::fan_out<int> fan_out;
+
+	fan_out.subscribe(1);
+
+	for (int n = 0; n < static_cast<int>(ffmpeg::DEFAULT_MAX_HISTORY); ++n)
+		fan_out.push(n);
+
+	CHECK(fan_out.open());
+
+	// Joins within the window and gets everything pushed so far.
+	fan_out.subscribe(2);
+
+	for (int n = 0; n < static_cast<int>(ffmpeg::DEFAULT_MAX_HISTORY); ++n)
+	{
+		int first;
+		int second;
+
+		CHECK(fan_out.pop(1, first) && first == n);
+		CHECK(fan_out.pop(2, second) && second == n);
+	}
+
+	CHECK(fan_out.empty(1) && fan_out.empty(2));
+
+	// One more and it is too late to join.
+	fan_out.push(static_cast<int>(ffmpeg::DEFAULT_MAX_HISTORY));
+
+	CHECK(!fan_out.open());
+
+	bool refused = false;
+
+	try
+	{
+		fan_out.subscribe(3);
+	}
+	catch (invalid_operation&)
+	{
+		refused = true;
+	}
+
+	CHECK(refused);
+	CHECK(fan_out.num_subscribers() == 2);
+
+	// The subscribers that are in still get everything.
+	fan_out.push(100);
+
+	int value;
+	CHECK(fan_out.pop(2, value) && value == static_cast<int>(ffmpeg::DEFAULT_MAX_HISTORY));
+	CHECK(fan_out.pop(2, value) && value == 100);
+	CHECK(!fan_out.pop(2, value));
+
+	std::wcout << L"late join: " << ffmpeg::DEFAULT_MAX_HISTORY << L" entries replayed, refused after" << std::endl;
+}
+
+void test_unsubscribe()
+{
+	ffmpeg::fan_out<int> fan_out;
+
+	fan_out.subscribe(1);
+	fan_out.subscribe(2);
+	fan_out.push(1);
+	fan_out.unsubscribe(1);
+	fan_out.push(2);
+
+	int value;
+	CHECK(fan_out.num_subscribers() == 1);
+	CHECK(!fan_out.pop(1, value));
+	CHECK(fan_out.empty(1));
+	CHECK(!fan_out.overflowed(1));
+	CHECK(fan_out.pop(2, value) && value == 1);
+	CHECK(fan_out.pop(2, value) && value == 2);
+
+	// Closing drops the history but not what the subscribers have queued.
+	fan_out.push(3);
+	fan_out.close();
+	CHECK(fan_out.pop(2, value) && value == 3);
+
+	fan_out.unsubscribe(2);
+	CHECK(fan_out.num_subscribers() == 0);
+
+	std::wcout << L"unsubscribe: nothing more queued" << std::endl;
+}
+
+void test_overflow()
+{
+	ffmpeg::fan_out<int> fan_out([](const int& entry) { return entry; }, 4, 3);
+
+	fan_out.subscribe(1);
+	fan_out.subscribe(2);
+
+	for (int n = 0; n < 4; ++n)
+	{
+		fan_out.push(n);
+
+		int value;
+		CHECK(fan_out.pop(2, value) && value == n);
+	}
+
+	// The one that kept up is unaffected, the other has its backlog dropped.
+	CHECK(!fan_out.overflowed(2));
+	CHECK(fan_out.overflowed(1));
+	CHECK(fan_out.empty(1));
+
+	fan_out.push(4);
+	CHECK(fan_out.empty(1));
+
+	std::wcout << L"overflow: only the subscriber that fell behind" << std::endl;
+}
+
+void test_copies()
+{
+	ffmpeg::fan_out<copied> fan_out([](const copied& entry)
+	{
+		auto copy = entry;
+		++copy.copies;
+		return copy;
+	});
+
+	fan_out.subscribe(1);
+	fan_out.push(copied(7));
+	fan_out.subscribe(2);
+
+	copied first;
+	copied second;
+
+	CHECK(fan_out.pop(1, first) && first.value == 7 && first.copies == 1);
+	CHECK(fan_out.pop(2, second) && second.value == 7 && second.copies == 1);
+
+	std::wcout << L"copies: one per subscriber" << std::endl;
+}
+
+struct shared_object
+{
+	bool	open		= true;
+	int		subscribers	= 0;
+
+	bool open_for_subscribers() const
+	{
+		return open;
+	}
+};
+
+void test_registry()
+{
+	ffmpeg::shared_registry<shared_object> registry;
+
+	int created = 0;
+	auto create = [&]
+	{
+		++created;
+		return std::make_shared<shared_object>();
+	};
+	auto join = [](shared_object& object)
+	{
+		++object.subscribers;
+		return true;
+	};
+
+	auto first	= registry.join_or_create(L"a", join, create);
+	auto second	= registry.join_or_create(L"a", join, create);
+	auto other	= registry.join_or_create(L"b", join, create);
+
+	CHECK(first == second);
+	CHECK(first->subscribers == 1);
+	CHECK(first != other);
+	CHECK(created == 2);
+	CHECK(registry.size() == 2);
+
+	// Refused joins create a new object, which replaces the old one.
+	auto refused = registry.join_or_create(L"a", [](shared_object&) { return false; }, create);
+	CHECK(refused != first);
+	CHECK(created == 3);
+	CHECK(registry.join_or_create(L"a", join, create) == refused);
+
+	// Objects closed after they were found count as refused.
+	auto closing = registry.join_or_create(L"a", [](shared_object&) -> bool
+	{
+		CASPAR_THROW_EXCEPTION(invalid_operation() << msg_info("Closed for subscribers."));
+	}, create);
+	CHECK(closing != refused);
+	CHECK(created == 4);
+
+	// Closed and expired objects are forgotten.
+	closing->open = false;
+	CHECK(registry.size() == 1);
+	auto reopened = registry.join_or_create(L"a", join, create);
+	CHECK(reopened != closing);
+	CHECK(created == 5);
+
+	other.reset();
+	CHECK(registry.size() == 1);
+
+	std::wcout << L"registry: joins open objects, forgets closed and expired" << std::endl;
+}
+
+}
+
+int main()
+{
+	return test::run_tests("shared-decoding-test", []
+	{
+		test_late_join();
+		test_unsubscribe();
+		test_overflow();
+		test_copies();
+		test_registry();
+	});
+}
@@ -0,0 +1,284 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Publishes frames through the SHM consumer and plays them back through the
+// shm:// producer, through the same POSIX shared memory a second server would
+// use. Also restarts the consumer while the producer is playing, and runs
+// four 1080p50 pairs in real time checking that no frame is dropped.
+
+#include <modules/shm/consumer/shm_consumer.h>
+#include <modules/shm/producer/shm_producer.h>
+#include <modules/shm/util/shared_memory_ring.h>
+
+#include <test/common/frames.h>
+#include <test/common/test.h>
+
+#include <common/env.h>
+#include <common/except.h>
+
+#include <core/consumer/frame_consumer.h>
+#include <core/frame/audio_channel_layout.h>
+#include <core/frame/draw_frame.h>
+#include <core/frame/frame.h>
+#include <core/help/help_repository.h>
+#include <core/producer/cg_proxy.h>
+#include <core/producer/frame_producer.h>
+#include <core/video_format.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace caspar;
+
+namespace {
+
+// The framerate producer wrapping the shm producer reads the configuration.
+void configure(const boost::filesystem::path& folder)
+{
+	{
+		std::ofstream file("shm-test.config");
+		file << "<configuration><paths>";
+
+		for (auto path : { "media-path", "log-path", "data-path", "template-path", "thumbnail-path", "font-path" })
+			file << "<" << path << ">" << (folder / path).string() << "</" << path << ">";
+
+		file << "</paths></configuration>";
+	}
+
+	env::configure(L"shm-test.config");
+	boost::filesystem::remove("shm-test.config");
+}
+
+const core::video_format_desc& format_desc()
+{
+	static const core::video_format_desc desc(core::video_format::x576p2500);
+	return desc;
+}
+
+core::const_frame make_frame(std::uint8_t value)
+{
+	core::mutable_audio_buffer audio(format_desc().audio_cadence.front() * 2, value * 1000);
+
+	return test::make_bgra_frame(std::vector<std::uint8_t>(format_desc().size, value), format_desc().width, format_desc().height, std::move(audio));
+}
+
+// Receives until the producer returns the frame filled with value.
+void expect_frame(core::frame_producer& producer, std::uint8_t value)
+{
+	for (int n = 0; n < 200; ++n)
+	{
+		auto frames = test::collect(producer.receive());
+
+		if (!frames.frames.empty() && frames.frames.front().image_data().begin()[0] == value)
+		{
+			auto& frame = frames.frames.front();
+
+			CHECK(static_cast<int>(frame.width()) == format_desc().width);
+			CHECK(static_cast<int>(frame.height()) == format_desc().height);
+			CHECK(frame.image_data().begin()[format_desc().size - 1] == value);
+			CHECK(!frame.audio_data().empty());
+			CHECK(frame.audio_data().begin()[0] == value * 1000);
+			return;
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	throw std::runtime_error("frame " + std::to_string(value) + " never arrived");
+}
+
+void test_loopback()
+{
+	auto name		= L"shm-test-" + std::to_wstring(getpid());
+	auto stereo		= core::audio_channel_layout(2, L"stereo", L"FL FR");
+	auto consumer	= shm::create_consumer({ L"SHM", name, L"SLOTS", L"4" }, nullptr, { });
+
+	consumer->initialize(format_desc(), stereo, 1);
+
+	// Only the owner and its group may open the ring, and a second writer is refused.
+	auto fd = shm_open((CASPAR_SHM_RING_PREFIX + std::string(name.begin(), name.end())).c_str(), O_RDONLY, 0);
+	struct stat info;
+	CHECK(fd != -1);
+	CHECK(fstat(fd, &info) == 0);
+	CHECK((info.st_mode & S_IRWXO) == 0);
+	close(fd);
+
+	try
+	{
+		shm::shared_memory_ring ring(name, format_desc(), stereo, 4, 1024);
+		CHECK(!"a second writer was allowed");
+	}
+	catch (const user_error&)
+	{
+	}
+
+	core::frame_producer_dependencies dependencies(
+			spl::make_shared<test::frame_factory>(),
+			{ },
+			format_desc(),
+			spl::make_shared<core::frame_producer_registry>(spl::make_shared<core::help_repository>()),
+			spl::make_shared<core::cg_producer_registry>());
+	auto producer = shm::create_producer(dependencies, { L"shm://" + name });
+
+	for (std::uint8_t value = 1; value <= 8; ++value)
+	{
+		consumer->send(make_frame(value));
+		expect_frame(*producer, value);
+	}
+
+	std::wcout << L"loopback: ok" << std::endl;
+
+	// The restarted consumer creates a new ring that the producer has to reopen.
+	consumer->initialize(format_desc(), stereo, 1);
+
+	for (std::uint8_t value = 9; value <= 12; ++value)
+	{
+		consumer->send(make_frame(value));
+		expect_frame(*producer, value);
+	}
+
+	std::wcout << L"restart: ok" << std::endl;
+}
+
+// One channel publishing and another server playing it back, each at its
+// own frame clock. The sequence number of a frame is its audio.
+struct pair
+{
+	std::wstring						name;
+	spl::shared_ptr<core::frame_consumer>	consumer;
+	spl::shared_ptr<core::frame_producer>	producer;
+	std::vector<std::int32_t>			received;
+};
+
+void test_realtime()
+{
+	const core::video_format_desc desc(core::video_format::x1080p5000);
+	const int pair_count	= 4;
+	const int frame_count	= 200;
+
+	auto stereo		= core::audio_channel_layout(2, L"stereo", L"FL FR");
+	auto pixels		= std::make_shared<std::vector<std::uint8_t>>(desc.size, 128);
+	auto period		= std::chrono::microseconds(static_cast<std::int64_t>(1000000.0 / desc.fps));
+
+	core::frame_producer_dependencies dependencies(
+			spl::make_shared<test::frame_factory>(),
+			{ },
+			desc,
+			spl::make_shared<core::frame_producer_registry>(spl::make_shared<core::help_repository>()),
+			spl::make_shared<core::cg_producer_registry>());
+
+	std::vector<std::unique_ptr<pair>> pairs;
+
+	for (int n = 0; n < pair_count; ++n)
+	{
+		auto name		= L"shm-test-" + std::to_wstring(getpid()) + L"-" + std::to_wstring(n);
+		auto consumer	= shm::create_consumer({ L"SHM", name }, nullptr, { });
+
+		consumer->initialize(desc, stereo, n + 1);
+
+		pairs.push_back(std::unique_ptr<pair>(new pair { name, consumer, shm::create_producer(dependencies, { L"shm://" + name }), { } }));
+	}
+
+	auto start = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+	std::vector<std::thread> threads;
+
+	for (auto& p : pairs)
+	{
+		auto& pair = *p;
+
+		threads.emplace_back([&, start]
+		{
+			for (int frame = 1; frame <= frame_count; ++frame)
+			{
+				std::this_thread::sleep_until(start + period * frame);
+				pair.consumer->send(test::make_frame(pixels, core::pixel_format::bgra, desc.width, desc.height, 4, false, core::mutable_audio_buffer(desc.audio_cadence.front() * 2, frame)));
+			}
+		});
+
+		// Half a frame behind the writer, and on for two more frames to take the last ones.
+		threads.emplace_back([&, start]
+		{
+			for (int frame = 1; frame <= frame_count + 2; ++frame)
+			{
+				std::this_thread::sleep_until(start + period * frame + period / 2);
+
+				for (auto& image : test::collect(pair.producer->receive()).frames)
+				{
+					auto sequence = image.audio_data().begin()[0];
+
+					if (pair.received.empty() || pair.received.back() != sequence)
+						pair.received.push_back(sequence);
+				}
+			}
+		});
+	}
+
+	for (auto& thread : threads)
+		thread.join();
+
+	for (auto& p : pairs)
+	{
+		auto& received = p->received;
+
+		CHECK(p->consumer->info().get<std::int64_t>(L"frames-dropped") == 0);
+		CHECK(p->producer->info().get<std::int64_t>(L"frames-dropped") == 0);
+
+		// The producer starts at the latest frame when it first finds the ring.
+		CHECK(!received.empty() && received.front() <= 3);
+		CHECK(received.back() == frame_count);
+
+		for (std::size_t n = 1; n < received.size(); ++n)
+			CHECK(received[n] == received[n - 1] + 1);
+	}
+
+	std::wcout << L"realtime: " << pair_count << L" x 1080p50 for " << frame_count << L" frames, none dropped" << std::endl;
+}
+
+}
+
+int main()
+{
+	auto folder = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("shm-test-%%%%%%%%");
+
+	auto result = test::run_tests("shm-test", [&]
+	{
+		configure(folder);
+		test_loopback();
+		test_realtime();
+	});
+
+	boost::filesystem::remove_all(folder);
+
+	return result;
+}
@@ -0,0 +1,314 @@
+/*
+* Copyright (c) 2011 Sveriges Television AB <info@casparcg.com>
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Tests of the glyph atlases that text producers share. Glyphs are never
+// dropped when a page is full, a page is uploaded once per frame factory and
+// again only when it changed, and atlases and uploads are evicted together with
+// their last user.
+
+#include <core/producer/text/utils/texture_font.h>
+#include <core/frame/geometry.h>
+
+#include <common/utf.h>
+
+#include <test/common/frames.h>
+#include <test/common/test.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace caspar { namespace test {
+
+namespace {
+
+using core::text::texture_font;
+using core::text::unicode_block;
+
+// What a frame factory created, kept apart from it so it can be checked after the factory is gone.
+struct frame_ledger
+{
+	int											created		= 0;
+	std::vector<std::weak_ptr<std::vector<std::uint8_t>>>	buffers;
+
+	int alive() const
+	{
+		return static_cast<int>(std::count_if(buffers.begin(), buffers.end(), [](const std::weak_ptr<std::vector<std::uint8_t>>& b) { return !b.expired(); }));
+	}
+};
+
+// Creates frames in system memory and records them in a ledger.
+class counting_frame_factory : public core::frame_factory
+{
+	std::shared_ptr<frame_ledger> ledger_;
+public:
+	explicit counting_frame_factory(const std::shared_ptr<frame_ledger>& ledger)
+		: ledger_(ledger)
+	{
+	}
+
+	core::mutable_frame create_frame(const void* tag, const core::pixel_format_desc& desc, const core::audio_channel_layout& channel_layout) override
+	{
+		std::vector<array<std::uint8_t>> buffers;
+
+		for (auto& plane : desc.planes)
+		{
+			auto pixels = std::make_shared<std::vector<std::uint8_t>>(plane.size);
+			ledger_->buffers.push_back(pixels);
+			buffers.push_back(array<std::uint8_t>(pixels->data(), pixels->size(), false, pixels));
+		}
+
+		++ledger_->created;
+
+		return core::mutable_frame(std::move(buffers), core::mutable_audio_buffer(), tag, desc, channel_layout);
+	}
+
+	int get_max_frame_size() override
+	{
+		return std::numeric_limits<int>::max();
+	}
+};
+
+spl::shared_ptr<core::frame_factory> create_factory(const std::shared_ptr<frame_ledger>& ledger)
+{
+	return spl::make_shared<counting_frame_factory>(ledger);
+}
+
+core::text::text_info font_info(double size, unsigned int color = 0xffffffff)
+{
+	core::text::text_info info;
+	info.font		= L"Liberation Sans";
+	info.font_file	= u16(CASPAR_SOURCE_PREFIX) + L"/deploy/general/server/font/LiberationSans-Regular.ttf";
+	info.size		= size;
+	info.color		= core::text::color<double>(color);
+
+	return info;
+}
+
+// Every character of these blocks that Liberation Sans has a glyph for, so none of them may go missing.
+std::wstring all_characters()
+{
+	std::wstring result;
+
+	for (auto range : { std::make_pair(0x21, 0x7e), std::make_pair(0xa1, 0xff), std::make_pair(0x100, 0x17f), std::make_pair(0x391, 0x3a1),
+			std::make_pair(0x3a3, 0x3c9), std::make_pair(0x410, 0x44f) })
+	{
+		for (int code = range.first; code <= range.second; ++code)
+			result.push_back(static_cast<wchar_t>(code));
+	}
+
+	return result;
+}
+
+void load_all(texture_font& font)
+{
+	// Loaded up front, so no prefetch changes a page behind the test's back.
+	for (auto block : { unicode_block::Basic_Latin, unicode_block::Latin_1_Supplement, unicode_block::Latin_Extended_A,
+			unicode_block::Greek_and_Coptic, unicode_block::Cyrillic })
+		font.load_glyphs(block);
+}
+
+struct glyph_rect
+{
+	int left;
+	int top;
+	int right;
+	int bottom;
+};
+
+void test_no_drops()
+{
+	auto ledger = std::make_shared<frame_ledger>();
+	auto factory = create_factory(ledger);
+	texture_font font(font_info(120.0), false);
+	load_all(font);
+
+	auto text = all_characters();
+	auto pages = collect(font.create_frame(factory, text, 0, 200, 1920, 1080, nullptr)).frames;
+
+	// The glyphs of 120pt text need many 1024x512 pages, where a single atlas used to drop them.
+	CHECK(pages.size() > 4);
+	CHECK(ledger->created == static_cast<int>(pages.size()));
+
+	std::size_t quads = 0;
+
+	for (auto& page : pages)
+	{
+		auto& coords = page.geometry().data();
+		auto width = static_cast<int>(page.width());
+		auto height = static_cast<int>(page.height());
+		auto pixels = page.image_data();
+		std::vector<glyph_rect> rects;
+
+		CHECK(page.geometry().type() == core::frame_geometry::geometry_type::quad_list);
+		CHECK(coords.size() % 4 == 0);
+		CHECK(!coords.empty());
+		quads += coords.size() / 4;
+
+		for (std::size_t n = 0; n < coords.size(); n += 4)
+		{
+			auto& upper_left = coords[n];
+			auto& lower_right = coords[n + 2];
+			glyph_rect rect {
+				static_cast<int>(upper_left.texture_x * width + 0.5),
+				static_cast<int>(upper_left.texture_y * height + 0.5),
+				static_cast<int>(lower_right.texture_x * width + 0.5),
+				static_cast<int>(lower_right.texture_y * height + 0.5)
+			};
+
+			CHECK(rect.left >= 0 && rect.right <= width && rect.left <= rect.right);
+			CHECK(rect.top >= 0 && rect.bottom <= height && rect.top <= rect.bottom);
+
+			if (rect.left == rect.right || rect.top == rect.bottom)
+				continue;
+
+			// Rasterized into the page, and into a region of its own.
+			int coverage = 0;
+
+			for (int y = rect.top; y < rect.bottom; ++y)
+				for (int x = rect.left; x < rect.right; ++x)
+					coverage += pixels.data()[(y * width + x) * 4 + 3];
+
+			CHECK(coverage > 0);
+
+			for (auto& other : rects)
+				CHECK(rect.right <= other.left || other.right <= rect.left || rect.bottom <= other.top || other.bottom <= rect.top);
+
+			rects.push_back(rect);
+		}
+	}
+
+	CHECK(quads == text.size());
+
+	// The same glyphs again are placed where they were.
+	auto again = collect(font.create_frame(factory, text, 0, 200, 1920, 1080, nullptr)).frames;
+	CHECK(again.size() == pages.size());
+
+	for (std::size_t n = 0; n < pages.size(); ++n)
+		CHECK(again[n].geometry().data() == pages[n].geometry().data());
+
+	std::cout << "font atlas " << text.size() << " glyphs on " << pages.size() << " pages: ok" << std::endl;
+}
+
+void test_uploads()
+{
+	auto ledger = std::make_shared<frame_ledger>();
+	auto factory = create_factory(ledger);
+	texture_font first(font_info(30.0), false);
+	texture_font second(font_info(30.0), true);
+	texture_font other_color(font_info(30.0, 0xff00ff00), false);
+	first.load_glyphs(unicode_block::Basic_Latin);
+	other_color.load_glyphs(unicode_block::Basic_Latin);
+
+	auto shared = collect(first.create_frame(factory, L"Shared", 0, 0, 1920, 1080, nullptr)).frames;
+	CHECK(shared.size() == 1);
+	CHECK(ledger->created == 1);
+
+	// The same key shares the atlas and its upload.
+	auto reused = collect(second.create_frame(factory, L"glyphs", 0, 0, 1920, 1080, nullptr)).frames;
+	CHECK(reused.size() == 1);
+	CHECK(ledger->created == 1);
+	CHECK(reused[0].image_data().begin() == shared[0].image_data().begin());
+
+	// The color is baked into the pixels, so another color has an atlas of its own.
+	collect(other_color.create_frame(factory, L"Shared", 0, 0, 1920, 1080, nullptr));
+	CHECK(ledger->created == 2);
+
+	// A page is uploaded again after glyphs were added to it.
+	first.load_glyphs(unicode_block::Latin_1_Supplement);
+	auto changed = collect(first.create_frame(factory, L"Shared", 0, 0, 1920, 1080, nullptr)).frames;
+	CHECK(ledger->created == 3);
+	CHECK(changed[0].image_data().begin() != shared[0].image_data().begin());
+	collect(second.create_frame(factory, L"\u00e9t\u00e9", 0, 0, 1920, 1080, nullptr));
+	CHECK(ledger->created == 3);
+
+	// Every frame factory gets uploads of its own.
+	auto other_ledger = std::make_shared<frame_ledger>();
+	collect(first.create_frame(create_factory(other_ledger), L"Shared", 0, 0, 1920, 1080, nullptr));
+	CHECK(other_ledger->created == 1);
+	CHECK(ledger->created == 3);
+
+	std::cout << "font atlas uploads: ok" << std::endl;
+}
+
+void test_eviction()
+{
+	auto ledger = std::make_shared<frame_ledger>();
+	auto factory = create_factory(ledger);
+
+	{
+		texture_font font(font_info(40.0), false);
+		font.load_glyphs(unicode_block::Basic_Latin);
+
+		// The upload for a frame factory is kept while the factory lives, and released once
+		// it is gone.
+		auto other_ledger = std::make_shared<frame_ledger>();
+		{
+			auto other_factory = create_factory(other_ledger);
+			collect(font.create_frame(other_factory, L"Evicted", 0, 0, 1920, 1080, nullptr));
+			collect(font.create_frame(other_factory, L"Evicted", 0, 0, 1920, 1080, nullptr));
+			CHECK(other_ledger->created == 1);
+			CHECK(other_ledger->alive() == 1);
+		}
+
+		collect(font.create_frame(factory, L"Evicted", 0, 0, 1920, 1080, nullptr));
+		CHECK(ledger->created == 1);
+		CHECK(ledger->alive() == 1);
+		CHECK(other_ledger->alive() == 0);
+
+		// The atlas lives as long as any font with its key.
+		{
+			texture_font same_key(font_info(40.0), true);
+			collect(same_key.create_frame(factory, L"Evicted", 0, 0, 1920, 1080, nullptr));
+			CHECK(ledger->created == 1);
+		}
+
+		collect(font.create_frame(factory, L"Evicted", 0, 0, 1920, 1080, nullptr));
+		CHECK(ledger->created == 1);
+	}
+
+	// Gone with the last font, pages and uploads included.
+	CHECK(ledger->alive() == 0);
+
+	texture_font font(font_info(40.0), false);
+	font.load_glyphs(unicode_block::Basic_Latin);
+	collect(font.create_frame(factory, L"Evicted", 0, 0, 1920, 1080, nullptr));
+	CHECK(ledger->created == 2);
+	CHECK(ledger->alive() == 1);
+
+	std::cout << "font atlas eviction: ok" << std::endl;
+}
+
+}
+
+}}
+
+int main()
+{
+	return caspar::test::run_tests("text-test", []
+	{
+		caspar::test::test_no_drops();
+		caspar::test::test_uploads();
+		caspar::test::test_eviction();
+	});
+}
@@ -0,0 +1,6 @@
+#define CASPAR_GEN 2
+#define CASPAR_MAYOR 1
+#define CASPAR_MINOR 0
+#define CASPAR_TAG "In2ip Beta 1"
+#define CASPAR_REV 48
+#define CASPAR_HASH "3c321e0"